@@ -46,6 +46,14 @@
  * be blind to these packets or forged packets looking alike. */
 #define ENCRYPTED_TLS_BYPASS    0
 
+/* Set BUILD_XSKMAP to 1 to use the filter with Suricata's AF_XDP capture,
+ * the packets not bypassed are then sent to the AF_XDP socket of their
+ * queue. Needs kernel 5.3 or newer and BUILD_CPUMAP set to 0 as the
+ * packets can't be redirected to both. */
+#define BUILD_XSKMAP        0
+/* Increase XSKMAP_MAX_QUEUES if your card has more than 64 queues */
+#define XSKMAP_MAX_QUEUES   64
+
 /* Set it to 0 if for example you plan to use the XDP filter in a
  * network card that don't support per CPU value (like netronome) */
 #define USE_PERCPU_HASH     1
@@ -176,6 +184,16 @@ struct bpf_map_def SEC("maps") tx_peer_int = {
 };
 #endif
 
+#if BUILD_XSKMAP
+/* AF_XDP sockets indexed by queue, set by Suricata at start */
+struct bpf_map_def SEC("maps") xsks_map = {
+    .type = BPF_MAP_TYPE_XSKMAP,
+    .key_size = sizeof(int),
+    .value_size = sizeof(int),
+    .max_entries = XSKMAP_MAX_QUEUES,
+};
+#endif
+
 #define USE_GLOBAL_BYPASS   0
 #if USE_GLOBAL_BYPASS
 /* single entry to indicate if global bypass switch is on */
@@ -482,7 +500,7 @@ static int __always_inline filter_ipv6(struct xdp_md *ctx, void *data, __u64 nh_
 #endif
 }
 
-int SEC("xdp") xdp_hashfilter(struct xdp_md *ctx)
+static __always_inline int hashfilter(struct xdp_md *ctx)
 {
     void *data_end = (void *)(long)ctx->data_end;
     void *data = (void *)(long)ctx->data;
@@ -551,6 +569,21 @@ int SEC("xdp") xdp_hashfilter(struct xdp_md *ctx)
     return XDP_PASS;
 }
 
+int SEC("xdp") xdp_hashfilter(struct xdp_md *ctx)
+{
+#if BUILD_XSKMAP
+    int index = ctx->rx_queue_index;
+    int ret = hashfilter(ctx);
+
+    /* packets for Suricata go to the socket of the queue if there is one */
+    if (ret == XDP_PASS && bpf_map_lookup_elem(&xsks_map, &index))
+        return bpf_redirect_map(&xsks_map, index, 0);
+    return ret;
+#else
+    return hashfilter(ctx);
+#endif
+}
+
 char __license[] SEC("license") = "GPL";
 
 __u32 __version SEC("version") = LINUX_VERSION_CODE;
@@ -0,0 +1,218 @@
+# Copyright (C) 2020 Open Information Security Foundation
+#
+# You can copy, redistribute or modify this Program under the terms of
+# the GNU General Public License version 2 as published by the Free
+# Software Foundation.
+
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# version 2 along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+# 02110-1301, USA.
+
+""" Reader for EVE logs written with "format: cbor".
+
+Each record is a 4 byte big endian length followed by one CBOR map.
+Only the subset of CBOR Suricata writes is supported: integers, text
+and byte strings, arrays and maps (definite and indefinite length),
+floats, booleans and null.
+"""
+
+from __future__ import print_function
+
+import sys
+import struct
+import json
+import logging
+from collections import OrderedDict
+
+logger = logging.getLogger("eve")
+
+# Break marker ending an indefinite length item.
+BREAK = object()
+
+
+class DecodeError(Exception):
+    pass
+
+
+def _argument(buf, offset, info):
+    """ Return the argument encoded in the low 5 bits of an initial byte
+    and the offset following it. None is returned for indefinite
+    length. """
+    if info < 24:
+        return info, offset
+    if info == 31:
+        return None, offset
+    if info > 27:
+        raise DecodeError("reserved additional info %d" % (info))
+    size = 1 << (info - 24)
+    if offset + size > len(buf):
+        raise DecodeError("truncated item")
+    val = 0
+    for b in bytearray(buf[offset:offset + size]):
+        val = (val << 8) | b
+    return val, offset + size
+
+
+def _decode_string(buf, offset, major, length):
+    if length is None:
+        chunks = []
+        while True:
+            chunk, offset = decode_item(buf, offset)
+            if chunk is BREAK:
+                break
+            chunks.append(chunk)
+        return (u"" if major == 3 else b"").join(chunks), offset
+    if offset + length > len(buf):
+        raise DecodeError("truncated string")
+    val = bytes(buf[offset:offset + length])
+    if major == 3:
+        val = val.decode("utf-8")
+    return val, offset + length
+
+
+def _decode_simple(buf, offset, info):
+    if info == 20:
+        return False, offset
+    if info == 21:
+        return True, offset
+    if info == 22 or info == 23:
+        return None, offset
+    if info == 25:
+        return _decode_half(buf, offset)
+    if info == 26:
+        return struct.unpack(">f", bytes(buf[offset:offset + 4]))[0], offset + 4
+    if info == 27:
+        return struct.unpack(">d", bytes(buf[offset:offset + 8]))[0], offset + 8
+    if info == 31:
+        return BREAK, offset
+    raise DecodeError("unsupported simple value %d" % (info))
+
+
+def _decode_half(buf, offset):
+    half = struct.unpack(">H", bytes(buf[offset:offset + 2]))[0]
+    exp = (half >> 10) & 0x1f
+    mant = half & 0x3ff
+    if exp == 0:
+        val = mant * 2.0 ** -24
+    elif exp != 31:
+        val = (mant + 1024) * 2.0 ** (exp - 25)
+    elif mant == 0:
+        val = float("inf")
+    else:
+        val = float("nan")
+    return -val if half & 0x8000 else val, offset + 2
+
+
+def decode_item(buf, offset=0):
+    """ Decode one CBOR item starting at offset, returns the value and the
+    offset following it. """
+    if offset >= len(buf):
+        raise DecodeError("truncated item")
+    initial = bytearray(buf[offset:offset + 1])[0]
+    major = initial >> 5
+    info = initial & 0x1f
+    offset += 1
+
+    if major == 7:
+        return _decode_simple(buf, offset, info)
+
+    arg, offset = _argument(buf, offset, info)
+    if major == 0:
+        return arg, offset
+    if major == 1:
+        return -1 - arg, offset
+    if major == 2 or major == 3:
+        return _decode_string(buf, offset, major, arg)
+    if major == 4:
+        val = []
+        while arg is None or len(val) < arg:
+            item, offset = decode_item(buf, offset)
+            if item is BREAK:
+                if arg is not None:
+                    raise DecodeError("unexpected break")
+                break
+            val.append(item)
+        return val, offset
+    if major == 5:
+        val = OrderedDict()
+        while arg is None or len(val) < arg:
+            key, offset = decode_item(buf, offset)
+            if key is BREAK:
+                if arg is not None:
+                    raise DecodeError("unexpected break")
+                break
+            val[key], offset = decode_item(buf, offset)
+        return val, offset
+    # Major type 6: tagged item, the tag is dropped.
+    return decode_item(buf, offset)
+
+
+def read_records(fileobj):
+    """ Generator returning the records of a CBOR EVE log. """
+    while True:
+        header = fileobj.read(4)
+        if not header:
+            return
+        if len(header) < 4:
+            raise DecodeError("truncated record header")
+        length = struct.unpack(">I", header)[0]
+        body = fileobj.read(length)
+        if len(body) < length:
+            raise DecodeError("truncated record")
+        record, offset = decode_item(body)
+        if offset != length:
+            raise DecodeError("%d trailing bytes in record" % (
+                length - offset))
+        yield record
+
+
+def to_json(record):
+    """ Render a decoded record as an EVE JSON line. """
+    return json.dumps(record, separators=(",", ":"))
+
+
+def register_args(parser):
+    subparser = parser.add_subparsers(help="sub-command help")
+    decode_parser = subparser.add_parser("decode",
+            help="Convert CBOR EVE logs to EVE JSON")
+    decode_parser.add_argument("-o", "--output",
+            help="file to write the JSON records to, default stdout")
+    decode_parser.add_argument("filenames", nargs="*", metavar="<filename>",
+            help="CBOR EVE log files, default stdin")
+    decode_parser.set_defaults(func=decode)
+
+
+def decode(args):
+    if args.output:
+        output = open(args.output, "w")
+    else:
+        output = sys.stdout
+
+    inputs = args.filenames or [None]
+    count = 0
+    for filename in inputs:
+        if filename is None:
+            fileobj = getattr(sys.stdin, "buffer", sys.stdin)
+        else:
+            fileobj = open(filename, "rb")
+        try:
+            for record in read_records(fileobj):
+                print(to_json(record), file=output)
+                count += 1
+        except DecodeError as err:
+            logger.error("%s: %s", filename or "stdin", err)
+            return 1
+        finally:
+            if filename is not None:
+                fileobj.close()
+
+    if output is not sys.stdout:
+        output.close()
+    logger.info("Converted %d records", count)
+    return 0
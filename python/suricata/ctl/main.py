@@ -19,7 +19,7 @@ import os
 import argparse
 import logging
 
-from suricata.ctl import filestore, loghandler
+from suricata.ctl import eve, filestore, loghandler, stats
 
 def init_logger():
     """ Initialize logging, use colour if on a tty. """
@@ -38,6 +38,11 @@ def main():
     subparsers = parser.add_subparsers(help='sub-command help')
     fs_parser = subparsers.add_parser("filestore", help="Filestore related commands")
     filestore.register_args(parser=fs_parser)
+    eve_parser = subparsers.add_parser("eve", help="EVE log related commands")
+    eve.register_args(parser=eve_parser)
+    stats_parser = subparsers.add_parser("stats",
+            help="Show the counters of a running Suricata")
+    stats.register_args(parser=stats_parser)
     args = parser.parse_args()
     try:
         func = args.func
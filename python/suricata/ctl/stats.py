@@ -0,0 +1,267 @@
+# Copyright (C) 2020 Open Information Security Foundation
+#
+# You can copy, redistribute or modify this Program under the terms of
+# the GNU General Public License version 2 as published by the Free
+# Software Foundation.
+
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# version 2 along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+# 02110-1301, USA.
+
+""" Reader for the counters Suricata exports in a memory mapped file
+when "stats.shared-memory" is enabled.
+
+The layout is described in src/counters-shm.h. Each thread block is
+protected by a sequence number that is odd while the thread updates its
+values, so a block is read again until a consistent copy is seen.
+"""
+
+from __future__ import print_function
+
+import sys
+import os
+import mmap
+import json
+import time
+import struct
+import logging
+from collections import OrderedDict
+
+logger = logging.getLogger("stats")
+
+MAGIC = b"SCSTATS1"
+VERSION = 1
+
+FLAG_RUNNING = 0x1
+
+BLOCK_RETIRED = 0x1
+
+TYPE_NORMAL = 1
+TYPE_AVERAGE = 2
+TYPE_MAXIMUM = 3
+TYPE_FUNC = 4
+
+BLOCK_ALIGN = 64
+
+HEADER = struct.Struct("=8sIIQIIQIIIIII")
+NAME = struct.Struct("=128sII")
+BLOCK = struct.Struct("=64sQQII")
+VALUE = struct.Struct("=IIQQ")
+
+# Offset of the sequence number in a block.
+BLOCK_SEQ_OFFSET = 64
+
+# Attempts at a consistent read of a block before giving up on it.
+MAX_RETRIES = 1000
+
+
+class StatsFileError(Exception):
+    pass
+
+
+def _cstr(buf):
+    return buf.split(b"\0", 1)[0].decode("utf-8", "replace")
+
+
+def _align(n):
+    return (n + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1)
+
+
+def parse_header(buf):
+    if len(buf) < HEADER.size:
+        raise StatsFileError("file too small")
+    (magic, version, flags, size, pid, interval, start_time,
+     names_offset, names_max, names_cnt,
+     blocks_offset, blocks_cnt, blocks_len) = HEADER.unpack_from(buf, 0)
+    if magic != MAGIC:
+        raise StatsFileError("bad magic, not a Suricata stats file")
+    if version != VERSION:
+        raise StatsFileError("unsupported version %d" % (version))
+    if size > len(buf):
+        raise StatsFileError("file is truncated")
+    return {
+        "flags": flags,
+        "size": size,
+        "pid": pid,
+        "interval": interval,
+        "start_time": start_time,
+        "names_offset": names_offset,
+        "names_max": names_max,
+        "names_cnt": min(names_cnt, names_max),
+        "blocks_offset": blocks_offset,
+        "blocks_cnt": blocks_cnt,
+        "blocks_len": blocks_len,
+    }
+
+
+def read_names(buf, header):
+    names = []
+    for i in range(header["names_cnt"]):
+        name, ctype, _ = NAME.unpack_from(
+            buf, header["names_offset"] + i * NAME.size)
+        names.append((_cstr(name), ctype))
+    return names
+
+
+def read_block(buf, offset):
+    """ Return (thread name, timestamp, flags, [(gid, value, updates)])
+    for the block at offset, or None if no consistent copy could be
+    read. """
+    for _ in range(MAX_RETRIES):
+        seq, = struct.unpack_from("=Q", buf, offset + BLOCK_SEQ_OFFSET)
+        if seq & 1:
+            continue
+        thread_name, _, ts, cnt, flags = BLOCK.unpack_from(buf, offset)
+        values = []
+        for i in range(cnt):
+            gid, _, value, updates = VALUE.unpack_from(
+                buf, offset + BLOCK.size + i * VALUE.size)
+            values.append((gid, value, updates))
+        seq2, = struct.unpack_from("=Q", buf, offset + BLOCK_SEQ_OFFSET)
+        if seq == seq2:
+            return _cstr(thread_name), ts, flags, values
+    return None
+
+
+def read_blocks(buf, header):
+    blocks = []
+    offset = header["blocks_offset"]
+    end = header["blocks_offset"] + header["blocks_len"]
+    for _ in range(header["blocks_cnt"]):
+        if offset + BLOCK.size > end:
+            break
+        cnt, = struct.unpack_from("=I", buf, offset + BLOCK.size - 8)
+        block = read_block(buf, offset)
+        if block is None:
+            logger.warning("Skipping block at offset %d, no consistent read",
+                           offset)
+        elif not block[2] & BLOCK_RETIRED:
+            blocks.append((block[0], block[1], block[3]))
+        offset += _align(BLOCK.size + cnt * VALUE.size)
+    return blocks
+
+
+def merge(names, blocks):
+    """ Merge the values of all threads the way Suricata's stats log
+    does: sum of normal counters, averages over all updates and the
+    highest maximum. """
+    totals = {}
+    for _, _, values in blocks:
+        for gid, value, updates in values:
+            if gid >= len(names):
+                continue
+            ctype = names[gid][1]
+            if gid not in totals:
+                totals[gid] = [0, 0]
+            total = totals[gid]
+            if ctype == TYPE_MAXIMUM:
+                total[0] = max(total[0], value)
+            else:
+                total[0] += value
+            total[1] += updates
+
+    merged = OrderedDict()
+    for gid, (name, ctype) in enumerate(names):
+        if gid not in totals:
+            continue
+        value, updates = totals[gid]
+        if ctype == TYPE_AVERAGE:
+            value = value // updates if updates else 0
+        merged[name] = value
+    return merged
+
+
+def per_thread(names, blocks):
+    threads = OrderedDict()
+    for thread_name, _, values in blocks:
+        counters = threads.setdefault(thread_name, OrderedDict())
+        for gid, value, updates in values:
+            if gid >= len(names):
+                continue
+            name, ctype = names[gid]
+            if ctype == TYPE_AVERAGE:
+                value = value // updates if updates else 0
+            counters[name] = value
+    return threads
+
+
+def read_stats(buf, threads=False):
+    header = parse_header(buf)
+    names = read_names(buf, header)
+    blocks = read_blocks(buf, header)
+    stats = OrderedDict()
+    stats["pid"] = header["pid"]
+    stats["running"] = bool(header["flags"] & FLAG_RUNNING)
+    stats["uptime"] = max(0, int(time.time()) - header["start_time"])
+    stats["counters"] = merge(names, blocks)
+    if threads:
+        stats["threads"] = per_thread(names, blocks)
+    return stats
+
+
+def open_stats(filename):
+    with open(filename, "rb") as fileobj:
+        if os.fstat(fileobj.fileno()).st_size == 0:
+            raise StatsFileError("%s is empty" % (filename))
+        return mmap.mmap(fileobj.fileno(), 0, access=mmap.ACCESS_READ)
+
+
+def print_stats(stats, output):
+    output.write("Pid %d, uptime %ds%s\n" % (
+        stats["pid"], stats["uptime"],
+        "" if stats["running"] else " (not running)"))
+    width = max([len(name) for name in stats["counters"]] + [7])
+    output.write("%-*s | %-20s\n" % (width, "Counter", "Value"))
+    for name, value in stats["counters"].items():
+        output.write("%-*s | %-20d\n" % (width, name, value))
+    for thread_name, counters in stats.get("threads", {}).items():
+        output.write("\n%s\n" % (thread_name))
+        for name, value in counters.items():
+            output.write("%-*s | %-20d\n" % (width, name, value))
+
+
+def register_args(parser):
+    parser.add_argument("-f", "--file", required=True,
+                        help="stats file, stats.shared-memory.filename")
+    parser.add_argument("--threads", action="store_true",
+                        help="show the counters of each thread")
+    parser.add_argument("--json", action="store_true",
+                        help="output JSON")
+    parser.add_argument("--interval", type=int, default=0,
+                        help="print the counters every N seconds")
+    parser.set_defaults(func=show)
+
+
+def show(args):
+    try:
+        buf = open_stats(args.file)
+    except (IOError, OSError, StatsFileError) as err:
+        logger.error("Failed to open %s: %s", args.file, err)
+        return 1
+
+    try:
+        while True:
+            try:
+                stats = read_stats(buf, threads=args.threads)
+            except StatsFileError as err:
+                logger.error("Failed to read %s: %s", args.file, err)
+                return 1
+            if args.json:
+                print(json.dumps(stats))
+            else:
+                print_stats(stats, sys.stdout)
+            sys.stdout.flush()
+            if args.interval <= 0:
+                break
+            time.sleep(args.interval)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        buf.close()
+    return 0
@@ -0,0 +1,34 @@
+from __future__ import print_function
+
+import io
+import unittest
+
+from suricata.ctl import eve
+
+class DecodeTestCase(unittest.TestCase):
+
+    def test_decode_item(self):
+        self.assertEqual(eve.decode_item(b"\x17"), (23, 1))
+        self.assertEqual(eve.decode_item(b"\x19\x01\xf4"), (500, 3))
+        self.assertEqual(eve.decode_item(b"\x39\x01\xf3"), (-500, 3))
+        self.assertEqual(eve.decode_item(b"\x62ab"), (u"ab", 3))
+        self.assertEqual(eve.decode_item(
+            b"\xfb\x40\x04\x00\x00\x00\x00\x00\x00"), (2.5, 9))
+        self.assertEqual(eve.decode_item(b"\x9f\xf5\xf4\xf6\xff"),
+                         ([True, False, None], 5))
+
+        with self.assertRaises(eve.DecodeError):
+            eve.decode_item(b"\x19\x01")
+        with self.assertRaises(eve.DecodeError):
+            eve.decode_item(b"\x82\x01\xff")
+
+    def test_read_records(self):
+        record = b"\xbf\x61a\x61b\x61l\x9f\x01\xff\x61o\xa1\x61k\x20\xff"
+        data = b"\x00\x00\x00\x11" + record
+        records = list(eve.read_records(io.BytesIO(data * 2)))
+        self.assertEqual(len(records), 2)
+        self.assertEqual(eve.to_json(records[0]),
+                         '{"a":"b","l":[1],"o":{"k":-1}}')
+
+        with self.assertRaises(eve.DecodeError):
+            list(eve.read_records(io.BytesIO(data[:-1])))
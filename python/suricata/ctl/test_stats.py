@@ -0,0 +1,84 @@
+from __future__ import print_function
+
+import struct
+import unittest
+
+from suricata.ctl import stats
+
+
+def build(names, blocks):
+    names_offset = 64
+    names_max = 8
+    blocks_offset = names_offset + names_max * stats.NAME.size
+    area = b""
+    for block in blocks:
+        thread_name, seq, values = block[:3]
+        flags = block[3] if len(block) > 3 else 0
+        block = stats.BLOCK.pack(thread_name, seq, 0, len(values), flags)
+        for gid, value, updates in values:
+            block += stats.VALUE.pack(gid, 0, value, updates)
+        block += b"\0" * (stats._align(len(block)) - len(block))
+        area += block
+    size = blocks_offset + len(area)
+    buf = bytearray(size)
+    stats.HEADER.pack_into(buf, 0, stats.MAGIC, stats.VERSION,
+                           stats.FLAG_RUNNING, size, 1234, 1, 0,
+                           names_offset, names_max, len(names),
+                           blocks_offset, len(blocks), len(area))
+    for i, (name, ctype) in enumerate(names):
+        stats.NAME.pack_into(buf, names_offset + i * stats.NAME.size,
+                             name, ctype, 0)
+    buf[blocks_offset:] = area
+    return bytes(buf)
+
+
+class StatsTestCase(unittest.TestCase):
+
+    names = [
+        (b"decoder.pkts", stats.TYPE_NORMAL),
+        (b"decoder.avg_pkt_size", stats.TYPE_AVERAGE),
+        (b"decoder.max_pkt_size", stats.TYPE_MAXIMUM),
+        (b"flow.memuse", stats.TYPE_FUNC),
+    ]
+
+    def test_merge(self):
+        buf = build(self.names, [
+            (b"W#01", 2, [(0, 10, 10), (1, 1000, 10), (2, 1500, 1)]),
+            (b"W#02", 4, [(0, 30, 30), (1, 3000, 10), (2, 60, 1)]),
+            (b"Global", 2, [(3, 4096, 0)]),
+        ])
+        result = stats.read_stats(buf, threads=True)
+        counters = result["counters"]
+        self.assertEqual(result["pid"], 1234)
+        self.assertEqual(counters["decoder.pkts"], 40)
+        self.assertEqual(counters["decoder.avg_pkt_size"], 200)
+        self.assertEqual(counters["decoder.max_pkt_size"], 1500)
+        self.assertEqual(counters["flow.memuse"], 4096)
+        self.assertEqual(result["threads"]["W#02"]["decoder.pkts"], 30)
+
+    def test_inconsistent_block(self):
+        # A block with an odd sequence number is being updated and is
+        # skipped after the retries.
+        buf = build(self.names, [
+            (b"W#01", 3, [(0, 10, 10)]),
+            (b"W#02", 2, [(0, 5, 5)]),
+        ])
+        result = stats.read_stats(buf)
+        self.assertEqual(result["counters"]["decoder.pkts"], 5)
+
+    def test_retired_block(self):
+        # A block replaced by a bigger one is skipped.
+        buf = build(self.names, [
+            (b"Global", 2, [(3, 1024, 1)], stats.BLOCK_RETIRED),
+            (b"W#01", 2, [(0, 10, 10)]),
+            (b"Global", 2, [(3, 4096, 1)]),
+        ])
+        result = stats.read_stats(buf, threads=True)
+        self.assertEqual(result["counters"]["flow.memuse"], 4096)
+        self.assertEqual(result["counters"]["decoder.pkts"], 10)
+
+    def test_bad_magic(self):
+        buf = bytearray(build(self.names, []))
+        buf[0:8] = b"XXXXXXXX"
+        with self.assertRaises(stats.StatsFileError):
+            stats.read_stats(bytes(buf))
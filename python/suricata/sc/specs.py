@@ -194,4 +194,43 @@ argsd = {
             "required": 1,
         },
     ],
+    "pcap-log-extract": [
+        {
+            "name": "src-ip",
+            "required": 1,
+        },
+        {
+            "name": "src-port",
+            "type": int,
+            "required": 1,
+        },
+        {
+            "name": "dst-ip",
+            "required": 1,
+        },
+        {
+            "name": "dst-port",
+            "type": int,
+            "required": 1,
+        },
+        {
+            "name": "proto",
+            "type": int,
+            "required": 1,
+        },
+        {
+            "name": "filename",
+            "required": 1,
+        },
+        {
+            "name": "start",
+            "type": int,
+            "required": 0,
+        },
+        {
+            "name": "end",
+            "type": int,
+            "required": 0,
+        },
+    ],
     }
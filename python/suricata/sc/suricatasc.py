@@ -108,6 +108,7 @@ class SuricataSC:
                 "memcap-show",
                 "dataset-add",
                 "dataset-remove",
+                "pcap-log-extract",
                 ]
         self.cmd_list = self.basic_commands + self.fn_commands
         self.sck_path = sck_path
@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+#
+# Replay throughput benchmark for the pcap-file runmodes.
+#
+# Writes a synthetic pcap with many interleaved TCP and UDP flows, runs
+# Suricata on it in each of the given runmodes and prints the packet rate.
+# The eve.json flow and alert records of the runs are compared, as the
+# runmodes are expected to give the same result.
+#
+# Usage: ./pcap-replay-bench.py --suricata ./src/suricata -c suricata.yaml
+#            --runmodes autofp,parallel --set pcap-file.decode-threads=4
+
+import argparse
+import json
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+def checksum(data):
+    if len(data) % 2:
+        data += b"\x00"
+    s = sum(struct.unpack("!%dH" % (len(data) // 2), data))
+    while s >> 16:
+        s = (s & 0xffff) + (s >> 16)
+    return ~s & 0xffff
+
+def ipv4(src, dst, proto, payload, ident):
+    hdr = struct.pack("!BBHHHBBH4s4s", 0x45, 0, 20 + len(payload), ident & 0xffff,
+            0, 64, proto, 0, src, dst)
+    hdr = hdr[:10] + struct.pack("!H", checksum(hdr)) + hdr[12:]
+    return hdr + payload
+
+def l4_checksum(src, dst, proto, segment):
+    pseudo = struct.pack("!4s4sBBH", src, dst, 0, proto, len(segment))
+    return checksum(pseudo + segment)
+
+def tcp(src, dst, sport, dport, seq, ack, flags, payload):
+    hdr = struct.pack("!HHIIBBHHH", sport, dport, seq & 0xffffffff,
+            ack & 0xffffffff, 5 << 4, flags, 65535, 0, 0)
+    seg = hdr + payload
+    csum = l4_checksum(src, dst, 6, seg)
+    return seg[:16] + struct.pack("!H", csum) + seg[18:]
+
+def udp(src, dst, sport, dport, payload):
+    seg = struct.pack("!HHHH", sport, dport, 8 + len(payload), 0) + payload
+    csum = l4_checksum(src, dst, 17, seg) or 0xffff
+    return seg[:6] + struct.pack("!H", csum) + seg[8:]
+
+def ether(payload):
+    return b"\x00\x01\x02\x03\x04\x05\x00\x0a\x0b\x0c\x0d\x0e\x08\x00" + payload
+
+def tcp_flow(i, segments):
+    """ Packets of a HTTP like TCP session, as (direction, ip packet) """
+    cli = struct.pack("!BBBB", 10, (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff)
+    srv = struct.pack("!BBBB", 192, 168, (i >> 8) & 0xff, 1)
+    sport = 1024 + (i % 60000)
+    cseq, sseq = 1000 + i, 5000 + i
+    pkts = []
+    pkts.append(ipv4(cli, srv, 6, tcp(cli, srv, sport, 80, cseq, 0, 0x02, b""), i))
+    pkts.append(ipv4(srv, cli, 6, tcp(srv, cli, 80, sport, sseq, cseq + 1, 0x12, b""), i))
+    cseq += 1
+    sseq += 1
+    pkts.append(ipv4(cli, srv, 6, tcp(cli, srv, sport, 80, cseq, sseq, 0x10, b""), i))
+    for n in range(segments):
+        req = ("GET /bench/%d/%d HTTP/1.1\r\nHost: bench%d.example\r\n"
+               "User-Agent: bench\r\n\r\n" % (i, n, i % 97)).encode()
+        pkts.append(ipv4(cli, srv, 6, tcp(cli, srv, sport, 80, cseq, sseq, 0x18, req), i))
+        cseq += len(req)
+        body = b"x" * (200 + (i * 7 + n) % 1000)
+        rsp = ("HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n" % len(body)).encode() + body
+        pkts.append(ipv4(srv, cli, 6, tcp(srv, cli, 80, sport, sseq, cseq, 0x18, rsp), i))
+        sseq += len(rsp)
+    pkts.append(ipv4(cli, srv, 6, tcp(cli, srv, sport, 80, cseq, sseq, 0x11, b""), i))
+    pkts.append(ipv4(srv, cli, 6, tcp(srv, cli, 80, sport, sseq, cseq + 1, 0x11, b""), i))
+    pkts.append(ipv4(cli, srv, 6, tcp(cli, srv, sport, 80, cseq + 1, sseq + 1, 0x10, b""), i))
+    return pkts
+
+def udp_flow(i):
+    cli = struct.pack("!BBBB", 10, 200, (i >> 8) & 0xff, i & 0xff)
+    srv = struct.pack("!BBBB", 8, 8, 8, 8)
+    sport = 1024 + (i % 60000)
+    name = b"".join(bytes([len(l)]) + l for l in
+            [("host%d" % i).encode(), b"bench", b"example"]) + b"\x00"
+    query = struct.pack("!HHHHHH", i & 0xffff, 0x0100, 1, 0, 0, 0) + name + b"\x00\x01\x00\x01"
+    answer = (struct.pack("!HHHHHH", i & 0xffff, 0x8180, 1, 1, 0, 0) + name +
+            b"\x00\x01\x00\x01" + b"\xc0\x0c\x00\x01\x00\x01\x00\x00\x00\x3c\x00\x04" + cli)
+    return [ipv4(cli, srv, 17, udp(cli, srv, sport, 53, query), i),
+            ipv4(srv, cli, 17, udp(srv, cli, 53, sport, answer), i)]
+
+def write_pcap(path, flows, segments, active):
+    """ Interleave the flows, with about 'active' flows open at a time """
+    ts = 1577836800.0
+    count = 0
+    with open(path, "wb") as f:
+        f.write(struct.pack("<IHHiIII", 0xa1b2c3d4, 2, 4, 0, 0, 65535, 1))
+        pending = []
+        started = 0
+        while started < flows or pending:
+            while started < flows and len(pending) < active:
+                if started % 4 == 3:
+                    pending.append(udp_flow(started))
+                else:
+                    pending.append(tcp_flow(started, segments))
+                started += 1
+            still = []
+            for pkts in pending:
+                frame = ether(pkts.pop(0))
+                ts += 0.00001
+                sec = int(ts)
+                f.write(struct.pack("<IIII", sec, int((ts - sec) * 1000000),
+                        len(frame), len(frame)))
+                f.write(frame)
+                count += 1
+                if pkts:
+                    still.append(pkts)
+            pending = still
+    return count
+
+def eve_records(path):
+    """ Flow and alert records with the fields that depend on timing removed """
+    records = []
+    if not os.path.exists(path):
+        return records
+    with open(path) as f:
+        for line in f:
+            event = json.loads(line)
+            if event.get("event_type") not in ("flow", "alert"):
+                continue
+            for key in ("timestamp", "flow_id", "pcap_cnt"):
+                event.pop(key, None)
+            records.append(json.dumps(event, sort_keys=True))
+    return sorted(records)
+
+def run(args, runmode, pcap, logdir):
+    cmd = [args.suricata, "-r", pcap, "-l", logdir, "--runmode", runmode,
+            "-k", "none"]
+    if args.config:
+        cmd += ["-c", args.config]
+    if args.rules:
+        cmd += ["-S", args.rules]
+    for s in args.set:
+        cmd += ["--set", s]
+    start = time.time()
+    subprocess.check_call(cmd, stdout=subprocess.DEVNULL)
+    return time.time() - start
+
+def main():
+    parser = argparse.ArgumentParser(description="pcap-file replay benchmark")
+    parser.add_argument("--suricata", default="suricata", help="suricata binary")
+    parser.add_argument("-c", "--config", help="suricata.yaml to use")
+    parser.add_argument("-S", "--rules", help="rule file to load")
+    parser.add_argument("--set", action="append", default=[],
+            help="configuration override, passed on to suricata")
+    parser.add_argument("--runmodes", default="single,autofp,parallel")
+    parser.add_argument("--flows", type=int, default=50000)
+    parser.add_argument("--segments", type=int, default=8,
+            help="request and response pairs per TCP flow")
+    parser.add_argument("--active", type=int, default=1000,
+            help="flows interleaved at a time")
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--pcap", help="where to write the pcap, kept after the run")
+    args = parser.parse_args()
+
+    tmpdir = tempfile.mkdtemp(prefix="pcap-bench-")
+    try:
+        pcap = args.pcap or os.path.join(tmpdir, "bench.pcap")
+        count = write_pcap(pcap, args.flows, args.segments, args.active)
+        print("%s: %d packets, %d bytes" % (pcap, count, os.path.getsize(pcap)))
+
+        reference = None
+        for runmode in args.runmodes.split(","):
+            best = None
+            for i in range(args.repeat):
+                logdir = os.path.join(tmpdir, "%s-%d" % (runmode, i))
+                os.mkdir(logdir)
+                elapsed = run(args, runmode, pcap, logdir)
+                best = elapsed if best is None else min(best, elapsed)
+            records = eve_records(os.path.join(logdir, "eve.json"))
+            same = ""
+            if reference is None:
+                reference = records
+            elif records != reference:
+                same = " (eve.json differs from %s)" % args.runmodes.split(",")[0]
+            print("%-10s %8.2fs %10.0f pkts/s %8d records%s" % (runmode, best,
+                    count / best, len(records), same))
+    finally:
+        shutil.rmtree(tmpdir)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -60,6 +60,7 @@
 #include "conf.h"
 #include "util-memcmp.h"
 #include "util-spm.h"
+#include "util-hash-lookup3.h"
 #include "util-debug.h"
 
 #include "runmodes.h"
@@ -159,8 +160,41 @@ typedef struct AppLayerProtoDetectCtx_ {
      * for protocol detection.  This table is independent of the
      * ipproto. */
     const char *alproto_names[ALPROTO_MAX];
+
+    /* number of entries in the per thread decision cache, 0 if disabled */
+    uint32_t cache_size;
 } AppLayerProtoDetectCtx;
 
+/** max size of the first data of a flow direction that is cached */
+#define ALPD_CACHE_MAX_BUFLEN       256
+#define ALPD_CACHE_DEFAULT_SIZE     1024
+
+#define ALPD_CACHE_FLAG_REVERSE     BIT_U8(0)
+
+/**
+ * \brief Cached protocol detection decision.
+ *
+ *  Detection on the first data of a flow direction only depends on the
+ *  data, the ports and the ipproto, so the decision can be reused for
+ *  flows that start with the same data, e.g. during scans and floods.
+ *  The source port is only part of the key if a probing parser is
+ *  registered on it, as clients use a new one for each flow.
+ */
+typedef struct AppLayerProtoDetectCacheEntry_ {
+    AppProto alproto;           /**< ALPROTO_UNKNOWN if entry is unused */
+    uint16_t sp;                /**< 0 if no probing parser on the port */
+    uint16_t dp;
+    uint16_t buflen;
+    uint8_t protomap;
+    uint8_t direction;
+    uint8_t flags;              /**< ALPD_CACHE_FLAG_* */
+    uint32_t flow_flags;        /**< PM/PP done flags detection set */
+    uint32_t pp_mask;           /**< probing parser mask detection set */
+    uint32_t pp_mask_rev;       /**< bits midstream detection set in the
+                                 *   mask of the other direction */
+    uint8_t buf[ALPD_CACHE_MAX_BUFLEN];
+} AppLayerProtoDetectCacheEntry;
+
 /**
  * \brief The app layer protocol detection thread context.
  */
@@ -169,6 +203,10 @@ struct AppLayerProtoDetectThreadCtx_ {
     /* The value 2 is for direction(0 - toserver, 1 - toclient). */
     MpmThreadCtx mpm_tctx[FLOW_PROTO_DEFAULT][2];
     SpmThreadCtx *spm_thread_ctx;
+
+    /* decision cache, direct mapped */
+    AppLayerProtoDetectCacheEntry *cache;
+    uint32_t cache_size;
 };
 
 /* The global app layer proto detection context. */
@@ -1486,6 +1524,68 @@ static int AppLayerProtoDetectPMRegisterPattern(uint8_t ipproto, AppProto alprot
 
 /***** Protocol Retrieval *****/
 
+#define ALPD_CACHE_DIR_FLAGS(dir) (((dir) & STREAM_TOSERVER) ? \
+        (FLOW_TS_PM_ALPROTO_DETECT_DONE|FLOW_TS_PP_ALPROTO_DETECT_DONE) : \
+        (FLOW_TC_PM_ALPROTO_DETECT_DONE|FLOW_TC_PP_ALPROTO_DETECT_DONE))
+#define ALPD_CACHE_PP_MASK(f, dir) (((dir) & STREAM_TOSERVER) ? \
+        &(f)->probing_parser_toserver_alproto_masks : \
+        &(f)->probing_parser_toclient_alproto_masks)
+#define ALPD_CACHE_PP_MASK_REV(f, dir) (((dir) & STREAM_TOSERVER) ? \
+        &(f)->probing_parser_toclient_alproto_masks : \
+        &(f)->probing_parser_toserver_alproto_masks)
+
+/** \internal
+ *  \brief Check if detection depends on the value of a port: a probing
+ *         parser is registered on it, not only on any port.
+ */
+static bool AppLayerProtoDetectCachePortUsed(uint8_t ipproto, uint16_t port)
+{
+    const AppLayerProtoDetectProbingParserPort *pp_port =
+        AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, ipproto, port);
+    return (pp_port != NULL && pp_port->port != 0);
+}
+
+/** \internal
+ *  \brief Get the cache slot for the data, or NULL if the cache can't be
+ *         used for it.
+ *
+ *  Only the first detection attempt in a direction is cached: later
+ *  attempts depend on the PM/PP state the earlier ones left in the flow.
+ */
+static AppLayerProtoDetectCacheEntry *AppLayerProtoDetectCacheSlot(
+        const AppLayerProtoDetectThreadCtx *tctx, const Flow *f,
+        const uint8_t *buf, uint32_t buflen, uint8_t ipproto,
+        uint8_t direction, uint16_t *sp, uint16_t *dp)
+{
+    if (tctx->cache == NULL || buflen == 0 || buflen > ALPD_CACHE_MAX_BUFLEN)
+        return NULL;
+    if (f->flags & ALPD_CACHE_DIR_FLAGS(direction))
+        return NULL;
+    if (*ALPD_CACHE_PP_MASK(f, direction) != 0)
+        return NULL;
+
+    *sp = FLOW_GET_SP(f);
+    if (!AppLayerProtoDetectCachePortUsed(ipproto, *sp))
+        *sp = 0;
+    *dp = f->protodetect_dp ? f->protodetect_dp : FLOW_GET_DP(f);
+
+    uint32_t hash = hashlittle_safe(buf, buflen,
+            ((uint32_t)*sp << 16) | *dp);
+    hash ^= ((uint32_t)f->protomap << 8) | (direction & STREAM_TOSERVER);
+    return &tctx->cache[hash % tctx->cache_size];
+}
+
+static int AppLayerProtoDetectCacheLookup(const AppLayerProtoDetectCacheEntry *e,
+        const Flow *f, const uint8_t *buf, uint32_t buflen, uint8_t direction,
+        uint16_t sp, uint16_t dp)
+{
+    return (e->alproto != ALPROTO_UNKNOWN &&
+            e->buflen == buflen && e->sp == sp && e->dp == dp &&
+            e->protomap == f->protomap &&
+            e->direction == (direction & STREAM_TOSERVER) &&
+            memcmp(e->buf, buf, buflen) == 0);
+}
+
 AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
                                      Flow *f,
                                      const uint8_t *buf, uint32_t buflen,
@@ -1499,6 +1599,23 @@ AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
     AppProto alproto = ALPROTO_UNKNOWN;
     AppProto pm_alproto = ALPROTO_UNKNOWN;
 
+    uint16_t sp = 0, dp = 0;
+    AppLayerProtoDetectCacheEntry *ce = AppLayerProtoDetectCacheSlot(tctx, f,
+            buf, buflen, ipproto, direction, &sp, &dp);
+    if (ce != NULL &&
+            AppLayerProtoDetectCacheLookup(ce, f, buf, buflen, direction, sp, dp))
+    {
+        /* leave the flow as the full detection would have */
+        f->flags |= ce->flow_flags;
+        *ALPD_CACHE_PP_MASK(f, direction) = ce->pp_mask;
+        *ALPD_CACHE_PP_MASK_REV(f, direction) |= ce->pp_mask_rev;
+        if (ce->flags & ALPD_CACHE_FLAG_REVERSE)
+            *reverse_flow = true;
+        SCLogDebug("cached decision %u", ce->alproto);
+        SCReturnUInt(ce->alproto);
+    }
+    const uint32_t pp_mask_rev = *ALPD_CACHE_PP_MASK_REV(f, direction);
+
     if (!FLOW_IS_PM_DONE(f, direction)) {
         AppProto pm_results[ALPROTO_MAX];
         uint16_t pm_matches = AppLayerProtoDetectPMGetProto(tctx, f,
@@ -1529,7 +1646,9 @@ AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
         }
     }
 
-    /* Look if flow can be found in expectation list */
+    /* Look if flow can be found in expectation list. This depends on
+     * more than the data, so don't cache it. */
+    ce = NULL;
     if (!FLOW_IS_PE_DONE(f, direction)) {
         alproto = AppLayerProtoDetectPEGetProto(f, ipproto, direction);
     }
@@ -1538,6 +1657,20 @@ AppProto AppLayerProtoDetectGetProto(AppLayerProtoDetectThreadCtx *tctx,
     if (!AppProtoIsValid(alproto))
         alproto = pm_alproto;
 
+    if (ce != NULL && AppProtoIsValid(alproto)) {
+        ce->alproto = alproto;
+        ce->sp = sp;
+        ce->dp = dp;
+        ce->buflen = (uint16_t)buflen;
+        ce->protomap = f->protomap;
+        ce->direction = direction & STREAM_TOSERVER;
+        ce->flags = *reverse_flow ? ALPD_CACHE_FLAG_REVERSE : 0;
+        ce->flow_flags = f->flags & ALPD_CACHE_DIR_FLAGS(direction);
+        ce->pp_mask = *ALPD_CACHE_PP_MASK(f, direction);
+        ce->pp_mask_rev = *ALPD_CACHE_PP_MASK_REV(f, direction) & ~pp_mask_rev;
+        memcpy(ce->buf, buf, buflen);
+    }
+
     SCReturnUInt(alproto);
 }
 
@@ -1785,6 +1918,17 @@ int AppLayerProtoDetectSetup(void)
 
     AppLayerExpectationSetup();
 
+    intmax_t cache_size = ALPD_CACHE_DEFAULT_SIZE;
+    if (ConfGetInt("app-layer.detection-cache-size", &cache_size) == 1) {
+        if (cache_size < 0 || cache_size > UINT16_MAX) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid "
+                    "app-layer.detection-cache-size %"PRIdMAX", using %u",
+                    cache_size, ALPD_CACHE_DEFAULT_SIZE);
+            cache_size = ALPD_CACHE_DEFAULT_SIZE;
+        }
+    }
+    alpd_ctx.cache_size = (uint32_t)cache_size;
+
     SCReturnInt(0);
 }
 
@@ -1998,6 +2142,13 @@ AppLayerProtoDetectThreadCtx *AppLayerProtoDetectGetCtxThread(void)
         goto error;
     }
 
+    if (alpd_ctx.cache_size > 0) {
+        alpd_tctx->cache = SCCalloc(alpd_ctx.cache_size, sizeof(*alpd_tctx->cache));
+        if (alpd_tctx->cache == NULL)
+            goto error;
+        alpd_tctx->cache_size = alpd_ctx.cache_size;
+    }
+
     goto end;
  error:
     if (alpd_tctx != NULL)
@@ -2026,6 +2177,8 @@ void AppLayerProtoDetectDestroyCtxThread(AppLayerProtoDetectThreadCtx *alpd_tctx
     if (alpd_tctx->spm_thread_ctx != NULL) {
         SpmDestroyThreadCtx(alpd_tctx->spm_thread_ctx);
     }
+    if (alpd_tctx->cache != NULL)
+        SCFree(alpd_tctx->cache);
     SCFree(alpd_tctx);
 
     SCReturn;
@@ -3616,6 +3769,153 @@ static int AppLayerProtoDetectTest19(void)
     return result;
 }
 
+/**
+ * \test Test the decision cache: a second flow starting with the same
+ *       data gets the decision and flow state of the first.
+ */
+static int AppLayerProtoDetectTest20(void)
+{
+    AppLayerProtoDetectUnittestCtxBackup();
+    AppLayerProtoDetectSetup();
+
+    uint8_t l7data[] = "HTTP/1.1 200 OK\r\nServer: Apache/1.0\r\n\r\n";
+    const char *buf = "HTTP";
+    AppLayerProtoDetectPMRegisterPatternCS(IPPROTO_TCP, ALPROTO_HTTP, buf, 4, 0, STREAM_TOCLIENT);
+
+    AppLayerProtoDetectPrepareState();
+    AppLayerProtoDetectThreadCtx *alpd_tctx = AppLayerProtoDetectGetCtxThread();
+    FAIL_IF_NULL(alpd_tctx);
+    FAIL_IF_NULL(alpd_tctx->cache);
+
+    Flow f1, f2;
+    memset(&f1, 0x00, sizeof(f1));
+    f1.protomap = FlowGetProtoMapping(IPPROTO_TCP);
+    f1.sp = 80;
+    f1.dp = 1024;
+    f2 = f1;
+
+    bool rflow = false;
+    AppProto alproto = AppLayerProtoDetectGetProto(alpd_tctx, &f1,
+            l7data, sizeof(l7data), IPPROTO_TCP, STREAM_TOCLIENT, &rflow);
+    FAIL_IF(alproto != ALPROTO_HTTP);
+    FAIL_IF(!FLOW_IS_PM_DONE(&f1, STREAM_TOCLIENT));
+
+    /* other source port, no probing parser on it */
+    f2.sp = 81;
+    uint16_t sp, dp;
+    AppLayerProtoDetectCacheEntry *ce = AppLayerProtoDetectCacheSlot(alpd_tctx,
+            &f2, l7data, sizeof(l7data), IPPROTO_TCP, STREAM_TOCLIENT, &sp, &dp);
+    FAIL_IF_NULL(ce);
+    FAIL_IF_NOT(AppLayerProtoDetectCacheLookup(ce, &f2, l7data,
+                sizeof(l7data), STREAM_TOCLIENT, sp, dp));
+    /* different port means different decision */
+    FAIL_IF_NOT(sp == 0);
+    f2.dp = 1025;
+    FAIL_IF(AppLayerProtoDetectCacheLookup(ce, &f2, l7data,
+                sizeof(l7data), STREAM_TOCLIENT, sp, f2.dp));
+    f2.dp = 1024;
+
+    alproto = AppLayerProtoDetectGetProto(alpd_tctx, &f2,
+            l7data, sizeof(l7data), IPPROTO_TCP, STREAM_TOCLIENT, &rflow);
+    FAIL_IF(alproto != ALPROTO_HTTP);
+    FAIL_IF(rflow);
+    FAIL_IF(f2.flags != f1.flags);
+
+    /* the flow state is no longer fresh, so no caching */
+    FAIL_IF_NOT_NULL(AppLayerProtoDetectCacheSlot(alpd_tctx,
+            &f2, l7data, sizeof(l7data), IPPROTO_TCP, STREAM_TOCLIENT, &sp, &dp));
+
+    AppLayerProtoDetectDestroyCtxThread(alpd_tctx);
+    AppLayerProtoDetectDeSetup();
+    AppLayerProtoDetectUnittestCtxRestore();
+    PASS;
+}
+
+static uint16_t ProbingParserFailForTesting(Flow *f, uint8_t direction,
+                                            const uint8_t *input,
+                                            uint32_t input_len, uint8_t *rdir)
+{
+    return ALPROTO_FAILED;
+}
+
+static uint16_t ProbingParserHTTPForTesting(Flow *f, uint8_t direction,
+                                            const uint8_t *input,
+                                            uint32_t input_len, uint8_t *rdir)
+{
+    return ALPROTO_HTTP;
+}
+
+/**
+ * \test Test the decision cache with probing parsers: the source port is
+ *       part of the key if a parser is registered on it, and a hit
+ *       restores the mask midstream detection set in the other direction.
+ */
+static int AppLayerProtoDetectTest21(void)
+{
+    AppLayerProtoDetectUnittestCtxBackup();
+    AppLayerProtoDetectSetup();
+    const bool midstream = stream_config.midstream;
+    stream_config.midstream = true;
+
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "80", ALPROTO_FTP, 0, 0,
+            STREAM_TOSERVER, ProbingParserFailForTesting, NULL);
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "80", ALPROTO_HTTP, 0, 0,
+            STREAM_TOSERVER, ProbingParserHTTPForTesting, NULL);
+
+    AppLayerProtoDetectPrepareState();
+    AppLayerProtoDetectThreadCtx *alpd_tctx = AppLayerProtoDetectGetCtxThread();
+    FAIL_IF_NULL(alpd_tctx);
+
+    /* picked up midstream from the server side */
+    uint8_t l7data[] = "GET / HTTP/1.1\r\n\r\n";
+    Flow f1, f2;
+    memset(&f1, 0x00, sizeof(f1));
+    f1.protomap = FlowGetProtoMapping(IPPROTO_TCP);
+    f1.proto = IPPROTO_TCP;
+    f1.sp = 80;
+    f1.dp = 1024;
+    f2 = f1;
+
+    bool rflow = false;
+    AppProto alproto = AppLayerProtoDetectGetProto(alpd_tctx, &f1,
+            l7data, sizeof(l7data), IPPROTO_TCP, STREAM_TOSERVER, &rflow);
+    FAIL_IF(alproto != ALPROTO_HTTP);
+    FAIL_IF(f1.probing_parser_toclient_alproto_masks == 0);
+
+    uint16_t sp, dp;
+    AppLayerProtoDetectCacheEntry *ce = AppLayerProtoDetectCacheSlot(alpd_tctx,
+            &f2, l7data, sizeof(l7data), IPPROTO_TCP, STREAM_TOSERVER, &sp, &dp);
+    FAIL_IF_NULL(ce);
+    FAIL_IF_NOT(sp == 80);
+    FAIL_IF_NOT(AppLayerProtoDetectCacheLookup(ce, &f2, l7data,
+                sizeof(l7data), STREAM_TOSERVER, sp, dp));
+
+    alproto = AppLayerProtoDetectGetProto(alpd_tctx, &f2,
+            l7data, sizeof(l7data), IPPROTO_TCP, STREAM_TOSERVER, &rflow);
+    FAIL_IF(alproto != ALPROTO_HTTP);
+    FAIL_IF(f2.flags != f1.flags);
+    FAIL_IF(f2.probing_parser_toserver_alproto_masks !=
+            f1.probing_parser_toserver_alproto_masks);
+    FAIL_IF(f2.probing_parser_toclient_alproto_masks !=
+            f1.probing_parser_toclient_alproto_masks);
+
+    /* another source port than the one of the parsers: other key */
+    Flow f3;
+    memset(&f3, 0x00, sizeof(f3));
+    f3.protomap = FlowGetProtoMapping(IPPROTO_TCP);
+    f3.proto = IPPROTO_TCP;
+    f3.sp = 81;
+    f3.dp = 1024;
+    FAIL_IF(AppLayerProtoDetectCacheLookup(ce, &f3, l7data,
+                sizeof(l7data), STREAM_TOSERVER, 0, dp));
+
+    AppLayerProtoDetectDestroyCtxThread(alpd_tctx);
+    stream_config.midstream = midstream;
+    AppLayerProtoDetectDeSetup();
+    AppLayerProtoDetectUnittestCtxRestore();
+    PASS;
+}
+
 void AppLayerProtoDetectUnittestsRegister(void)
 {
     SCEnter();
@@ -3639,6 +3939,8 @@ void AppLayerProtoDetectUnittestsRegister(void)
     UtRegisterTest("AppLayerProtoDetectTest17", AppLayerProtoDetectTest17);
     UtRegisterTest("AppLayerProtoDetectTest18", AppLayerProtoDetectTest18);
     UtRegisterTest("AppLayerProtoDetectTest19", AppLayerProtoDetectTest19);
+    UtRegisterTest("AppLayerProtoDetectTest20", AppLayerProtoDetectTest20);
+    UtRegisterTest("AppLayerProtoDetectTest21", AppLayerProtoDetectTest21);
 
     SCReturn;
 }
@@ -23,6 +23,7 @@
 
 #include "suricata-common.h"
 #include "app-layer-dns-common.h"
+#include "rust-dns-dns-gen.h"
 
 SCEnumCharMap dns_decoder_event_table[ ] = {
     { "UNSOLLICITED_RESPONSE",      DNS_DECODER_EVENT_UNSOLLICITED_RESPONSE, },
@@ -36,6 +37,18 @@ SCEnumCharMap dns_decoder_event_table[ ] = {
     { NULL,                         -1 },
 };
 
+/** \brief queue the txs the parser created since the state had tx_cnt
+ *         txs for the tx loggers. A DNS tx is a single message, so it
+ *         is complete as soon as it exists. */
+void DNSTxReadyToLog(AppLayerParserState *pstate, void *state,
+        uint64_t tx_cnt)
+{
+    const uint64_t new_tx_cnt = rs_dns_state_get_tx_count(state);
+    for (uint64_t tx_id = tx_cnt; tx_id < new_tx_cnt; tx_id++) {
+        AppLayerParserTxReadyToLog(pstate, tx_id);
+    }
+}
+
 int DNSStateGetEventInfo(const char *event_name,
                          int *event_id, AppLayerEventType *event_type)
 {
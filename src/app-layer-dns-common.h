@@ -141,6 +141,9 @@ int DNSStateGetEventInfoById(int event_id, const char **event_name,
 void DNSAppLayerRegisterGetEventInfo(uint8_t ipproto, AppProto alproto);
 void DNSAppLayerRegisterGetEventInfoById(uint8_t ipproto, AppProto alproto);
 
+void DNSTxReadyToLog(AppLayerParserState *pstate, void *state,
+        uint64_t tx_cnt);
+
 void DNSCreateTypeString(uint16_t type, char *str, size_t str_size);
 void DNSCreateRcodeString(uint8_t rcode, char *str, size_t str_size);
 
@@ -37,8 +37,11 @@ static int RustDNSTCPParseRequest(Flow *f, void *state,
         void *local_data, const uint8_t flags)
 {
     SCLogDebug("RustDNSTCPParseRequest");
-    return rs_dns_parse_request_tcp(f, state, pstate, input, input_len,
+    const uint64_t tx_cnt = rs_dns_state_get_tx_count(state);
+    int r = rs_dns_parse_request_tcp(f, state, pstate, input, input_len,
             local_data);
+    DNSTxReadyToLog(pstate, state, tx_cnt);
+    return r;
 }
 
 static int RustDNSTCPParseResponse(Flow *f, void *state,
@@ -46,8 +49,11 @@ static int RustDNSTCPParseResponse(Flow *f, void *state,
         void *local_data, const uint8_t flags)
 {
     SCLogDebug("RustDNSTCPParseResponse");
-    return rs_dns_parse_response_tcp(f, state, pstate, input, input_len,
+    const uint64_t tx_cnt = rs_dns_state_get_tx_count(state);
+    int r = rs_dns_parse_response_tcp(f, state, pstate, input, input_len,
             local_data);
+    DNSTxReadyToLog(pstate, state, tx_cnt);
+    return r;
 }
 
 static uint16_t RustDNSTCPProbe(Flow *f, uint8_t direction,
@@ -162,6 +168,7 @@ void RegisterDNSTCPParsers(void)
                 RustDNSGetTxCnt);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_TCP, ALPROTO_DNS,
                 RustDNSGetTxLogged, RustDNSSetTxLogged);
+        AppLayerParserRegisterLogReadyQueue(IPPROTO_TCP, ALPROTO_DNS);
         AppLayerParserRegisterGetStateProgressFunc(IPPROTO_TCP, ALPROTO_DNS,
                 RustDNSGetAlstateProgress);
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_DNS,
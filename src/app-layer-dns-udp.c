@@ -36,16 +36,22 @@ static int RustDNSUDPParseRequest(Flow *f, void *state,
         AppLayerParserState *pstate, const uint8_t *input, uint32_t input_len,
         void *local_data, const uint8_t flags)
 {
-    return rs_dns_parse_request(f, state, pstate, input, input_len,
+    const uint64_t tx_cnt = rs_dns_state_get_tx_count(state);
+    int r = rs_dns_parse_request(f, state, pstate, input, input_len,
             local_data);
+    DNSTxReadyToLog(pstate, state, tx_cnt);
+    return r;
 }
 
 static int RustDNSUDPParseResponse(Flow *f, void *state,
         AppLayerParserState *pstate, const uint8_t *input, uint32_t input_len,
         void *local_data, const uint8_t flags)
 {
-    return rs_dns_parse_response(f, state, pstate, input, input_len,
+    const uint64_t tx_cnt = rs_dns_state_get_tx_count(state);
+    int r = rs_dns_parse_response(f, state, pstate, input, input_len,
             local_data);
+    DNSTxReadyToLog(pstate, state, tx_cnt);
+    return r;
 }
 
 static uint16_t DNSUDPProbe(Flow *f, uint8_t direction,
@@ -174,6 +180,7 @@ void RegisterDNSUDPParsers(void)
                 RustDNSGetTxCnt);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_UDP, ALPROTO_DNS,
                 RustDNSGetTxLogged, RustDNSSetTxLogged);
+        AppLayerParserRegisterLogReadyQueue(IPPROTO_UDP, ALPROTO_DNS);
         AppLayerParserRegisterGetStateProgressFunc(IPPROTO_UDP, ALPROTO_DNS,
                 RustDNSGetAlstateProgress);
 
@@ -2178,6 +2178,7 @@ static int HTPCallbackRequest(htp_tx_t *tx)
     /* request done, do raw reassembly now to inspect state and stream
      * at the same time. */
     AppLayerParserTriggerRawStreamReassembly(hstate->f, STREAM_TOSERVER);
+    AppLayerParserTxReadyToLog(hstate->f->alparser, tx->index);
     SCReturnInt(HTP_OK);
 }
 
@@ -2231,6 +2232,7 @@ static int HTPCallbackResponse(htp_tx_t *tx)
     }
 
     hstate->last_response_data_stamp = (uint64_t)hstate->conn->out_data_counter;
+    AppLayerParserTxReadyToLog(hstate->f->alparser, tx->index);
     SCReturnInt(HTP_OK);
 }
 
@@ -3186,6 +3188,7 @@ void RegisterHTPParsers(void)
         AppLayerParserRegisterGetTx(IPPROTO_TCP, ALPROTO_HTTP, HTPStateGetTx);
         AppLayerParserRegisterLoggerFuncs(IPPROTO_TCP, ALPROTO_HTTP, HTPStateGetTxLogged,
                                           HTPStateSetTxLogged);
+        AppLayerParserRegisterLogReadyQueue(IPPROTO_TCP, ALPROTO_HTTP);
         AppLayerParserRegisterGetStateProgressCompletionStatus(ALPROTO_HTTP,
                                                                HTPStateGetAlstateProgressCompletionStatus);
         AppLayerParserRegisterGetEventsFunc(IPPROTO_TCP, ALPROTO_HTTP, HTPGetEvents);
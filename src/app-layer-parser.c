@@ -96,6 +96,9 @@ typedef struct AppLayerParserProtoCtx_
     AppLayerParserFPtr Parser[2];
     bool logger;
     uint32_t logger_bits;   /**< registered loggers for this proto */
+    /** parser reports txs that are ready to be logged, see
+     *  AppLayerParserTxReadyToLog() */
+    bool log_ready_queue;
 
     void *(*StateAlloc)(void);
     void (*StateFree)(void *);
@@ -166,6 +169,11 @@ struct AppLayerParserState_ {
 
     uint64_t min_id;
 
+    /* Txs that reached completion since the tx loggers last ran. Only
+     * filled by parsers that registered a log ready queue. */
+    uint64_t log_ready[APP_LAYER_LOG_READY_MAX];
+    uint8_t log_ready_cnt;
+
     /* Used to store decoder events. */
     AppLayerDecoderEvents *decoder_events;
 };
@@ -185,6 +193,20 @@ void UTHAppLayerParserStateGetIds(void *ptr, uint64_t *i1, uint64_t *i2, uint64_
  * Post 2.0 let's look at changing this to move it out to app-layer.c. */
 static AppLayerParserCtx alp_ctx;
 
+/** "parse depth by need" mode. Protocols not used by the detection engine
+ *  or the outputs are only parsed until the first transaction. */
+typedef struct AppLayerParserNeed_ {
+    bool enabled;
+    /** outputs consume all protocols, e.g. due to a wildcard tx logger */
+    bool output_all;
+    bool output[ALPROTO_MAX];
+    /** APP_LAYER_NEED_* bits of the active detection engine(s). Updated
+     *  on rule reloads while the workers use it, so it's set as a whole. */
+    SC_ATOMIC_DECLARE(uint64_t, detect);
+} AppLayerParserNeed;
+
+static AppLayerParserNeed alp_need;
+
 int AppLayerParserProtoIsRegistered(uint8_t ipproto, AppProto alproto)
 {
     uint8_t ipproto_map = FlowGetProtoMapping(ipproto);
@@ -228,6 +250,22 @@ void AppLayerParserPostStreamSetup(void)
     AppProto alproto = 0;
     int flow_proto = 0;
 
+    const char *parse_depth = NULL;
+    if (ConfGet("app-layer.parse-depth", &parse_depth) == 1 && parse_depth) {
+        if (strcasecmp(parse_depth, "need") == 0) {
+            BUG_ON(ALPROTO_MAX >= 63);
+            alp_need.enabled = true;
+            /* until the detection engine tells us otherwise */
+            SC_ATOMIC_INIT(alp_need.detect);
+            SC_ATOMIC_SET(alp_need.detect, ~0ULL);
+            SCLogConfig("app-layer: parsing protocols only as deep as "
+                    "rules and outputs need");
+        } else if (strcasecmp(parse_depth, "full") != 0) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid value "
+                    "'%s' for app-layer.parse-depth, using 'full'", parse_depth);
+        }
+    }
+
     /* lets set a default value for stream_depth */
     for (flow_proto = 0; flow_proto < FLOW_PROTO_DEFAULT; flow_proto++) {
         for (alproto = 0; alproto < ALPROTO_MAX; alproto++) {
@@ -481,6 +519,18 @@ void AppLayerParserRegisterLogger(uint8_t ipproto, AppProto alproto)
     SCReturn;
 }
 
+/** \brief register that the parser calls AppLayerParserTxReadyToLog()
+ *         for each tx that reaches completion in either direction, so
+ *         that the tx loggers only have to look at those txs */
+void AppLayerParserRegisterLogReadyQueue(uint8_t ipproto, AppProto alproto)
+{
+    SCEnter();
+
+    alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].log_ready_queue = true;
+
+    SCReturn;
+}
+
 void AppLayerParserRegisterTruncateFunc(uint8_t ipproto, AppProto alproto,
                                         void (*Truncate)(void *, uint8_t))
 {
@@ -725,6 +775,45 @@ LoggerId AppLayerParserGetTxLogged(const Flow *f,
     SCReturnUInt(r);
 }
 
+/** \brief queue a tx that reached completion for the tx loggers
+ *
+ *  A tx may be queued more than once. If the queue is full the loggers
+ *  fall back to checking all txs of the flow.
+ */
+void AppLayerParserTxReadyToLog(AppLayerParserState *pstate, uint64_t tx_id)
+{
+    if (pstate == NULL)
+        return;
+
+    if (pstate->log_ready_cnt > 0 &&
+            pstate->log_ready[pstate->log_ready_cnt - 1] == tx_id)
+        return;
+    if (pstate->log_ready_cnt == APP_LAYER_LOG_READY_MAX) {
+        pstate->flags |= APP_LAYER_PARSER_LOG_READY_OVERFLOW;
+        return;
+    }
+    pstate->log_ready[pstate->log_ready_cnt++] = tx_id;
+}
+
+/** \brief get the txs queued by AppLayerParserTxReadyToLog()
+ *
+ *  \retval cnt number of txs in ids, or -1 if the queue overflowed
+ */
+int AppLayerParserGetTxLogReady(AppLayerParserState *pstate,
+        const uint64_t **ids)
+{
+    if (pstate->flags & APP_LAYER_PARSER_LOG_READY_OVERFLOW)
+        return -1;
+    *ids = pstate->log_ready;
+    return pstate->log_ready_cnt;
+}
+
+void AppLayerParserResetTxLogReady(AppLayerParserState *pstate)
+{
+    pstate->log_ready_cnt = 0;
+    pstate->flags &= ~APP_LAYER_PARSER_LOG_READY_OVERFLOW;
+}
+
 uint64_t AppLayerParserGetTransactionLogId(AppLayerParserState *pstate)
 {
     SCEnter();
@@ -1179,6 +1268,76 @@ void AppLayerParserSetTxDetectFlags(uint8_t ipproto, AppProto alproto, void *tx,
     SCReturn;
 }
 
+/***** Parse by need *****/
+
+bool AppLayerParserParseByNeedEnabled(void)
+{
+    return alp_need.enabled;
+}
+
+/**
+ *  \brief register that an output consumes transactions of a protocol
+ *
+ *  \param alproto protocol or ALPROTO_UNKNOWN for all protocols
+ */
+void AppLayerParserSetOutputNeed(AppProto alproto)
+{
+    if (alproto == ALPROTO_UNKNOWN)
+        alp_need.output_all = true;
+    else
+        alp_need.output[alproto] = true;
+
+    /* ftp-data flows are set up by the ftp parser */
+    if (alproto == ALPROTO_FTPDATA)
+        alp_need.output[ALPROTO_FTP] = true;
+}
+
+/**
+ *  \brief set the protocols the detection engine uses
+ *
+ *  \param needs APP_LAYER_NEED_* bits of the engine
+ *  \param merge add to the current needs instead of replacing them. Used
+ *               while a reload runs and the old engine is still in use.
+ */
+void AppLayerParserSetDetectNeeds(uint64_t needs, bool merge)
+{
+    if (merge)
+        SC_ATOMIC_OR(alp_need.detect, needs);
+    else
+        SC_ATOMIC_SET(alp_need.detect, needs);
+}
+
+static inline bool AppLayerParserProtoIsNeeded(AppProto alproto,
+        const uint64_t detect)
+{
+    return (alp_need.output_all || alp_need.output[alproto] ||
+            (detect & APP_LAYER_NEED_PROTO(alproto)));
+}
+
+/** \internal
+ *  \brief stop parsing a protocol nothing consumes after the first tx
+ *
+ *  If no rule cares about the flow anymore it's made bypass ready, like
+ *  encrypted TLS sessions. Otherwise only the app-layer is disabled and
+ *  raw stream inspection continues.
+ */
+static void AppLayerParserHandleUnneeded(Flow *f, AppLayerParserState *pstate,
+        void *alstate, const uint64_t detect)
+{
+    if (AppLayerParserGetTxCnt(f, alstate) == 0)
+        return;
+
+    SCLogDebug("%s not needed by detection or outputs, stop parsing",
+            AppProtoToString(f->alproto));
+    if (!(detect & APP_LAYER_NEED_INSPECTION)) {
+        AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_INSPECTION);
+        AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_NO_REASSEMBLY);
+        AppLayerParserStateSetFlag(pstate, APP_LAYER_PARSER_BYPASS_READY);
+    } else if (f->proto == IPPROTO_TCP) {
+        StreamTcpDisableAppLayer(f);
+    }
+}
+
 /***** General *****/
 
 int AppLayerParserParse(ThreadVars *tv, AppLayerParserThreadCtx *alp_tctx, Flow *f, AppProto alproto,
@@ -1245,6 +1404,12 @@ int AppLayerParserParse(ThreadVars *tv, AppLayerParserThreadCtx *alp_tctx, Flow
         }
     }
 
+    if (alp_need.enabled) {
+        const uint64_t detect = SC_ATOMIC_GET(alp_need.detect);
+        if (!AppLayerParserProtoIsNeeded(alproto, detect))
+            AppLayerParserHandleUnneeded(f, pstate, alstate, detect);
+    }
+
     /* set the packets to no inspection and reassembly if required */
     if (pstate->flags & APP_LAYER_PARSER_NO_INSPECTION) {
         AppLayerParserSetEOF(pstate);
@@ -1366,6 +1531,11 @@ int AppLayerParserProtocolHasLogger(uint8_t ipproto, AppProto alproto)
     SCReturnInt(r);
 }
 
+bool AppLayerParserProtocolHasLogReadyQueue(uint8_t ipproto, AppProto alproto)
+{
+    return alp_ctx.ctxs[FlowGetProtoMapping(ipproto)][alproto].log_ready_queue;
+}
+
 LoggerId AppLayerParserProtocolGetLoggerBits(uint8_t ipproto, AppProto alproto)
 {
     SCEnter();
@@ -2159,6 +2329,82 @@ static int AppLayerParserTest02(void)
 }
 
 
+/** \test log ready queue: duplicates, overflow and reset */
+static int AppLayerParserTest03(void)
+{
+    AppLayerParserState *pstate = AppLayerParserStateAlloc();
+    FAIL_IF_NULL(pstate);
+    const uint64_t *ids = NULL;
+
+    FAIL_IF_NOT(AppLayerParserGetTxLogReady(pstate, &ids) == 0);
+
+    AppLayerParserTxReadyToLog(pstate, 1);
+    AppLayerParserTxReadyToLog(pstate, 1);
+    AppLayerParserTxReadyToLog(pstate, 2);
+    FAIL_IF_NOT(AppLayerParserGetTxLogReady(pstate, &ids) == 2);
+    FAIL_IF_NOT(ids[0] == 1 && ids[1] == 2);
+
+    for (uint64_t i = 3; i < 3 + APP_LAYER_LOG_READY_MAX; i++) {
+        AppLayerParserTxReadyToLog(pstate, i);
+    }
+    FAIL_IF_NOT(AppLayerParserGetTxLogReady(pstate, &ids) == -1);
+
+    AppLayerParserResetTxLogReady(pstate);
+    FAIL_IF_NOT(AppLayerParserGetTxLogReady(pstate, &ids) == 0);
+    AppLayerParserTxReadyToLog(pstate, 7);
+    FAIL_IF_NOT(AppLayerParserGetTxLogReady(pstate, &ids) == 1);
+    FAIL_IF_NOT(ids[0] == 7);
+
+    AppLayerParserStateFree(pstate);
+    PASS;
+}
+
+/** \test parse by need: which protocols are parsed beyond the first tx */
+static int AppLayerParserTest04(void)
+{
+    uint64_t detect;
+    bool http[4], dns[4], ftp;
+
+    memset(&alp_need, 0, sizeof(alp_need));
+    SC_ATOMIC_INIT(alp_need.detect);
+    alp_need.enabled = true;
+
+    AppLayerParserSetDetectNeeds(APP_LAYER_NEED_PROTO(ALPROTO_HTTP), false);
+    detect = SC_ATOMIC_GET(alp_need.detect);
+    http[0] = AppLayerParserProtoIsNeeded(ALPROTO_HTTP, detect);
+    dns[0] = AppLayerParserProtoIsNeeded(ALPROTO_DNS, detect);
+
+    /* reload: the old engine is still used until the threads are swapped */
+    AppLayerParserSetDetectNeeds(APP_LAYER_NEED_PROTO(ALPROTO_DNS), true);
+    detect = SC_ATOMIC_GET(alp_need.detect);
+    http[1] = AppLayerParserProtoIsNeeded(ALPROTO_HTTP, detect);
+    dns[1] = AppLayerParserProtoIsNeeded(ALPROTO_DNS, detect);
+
+    /* threads run the new engine */
+    AppLayerParserSetDetectNeeds(APP_LAYER_NEED_PROTO(ALPROTO_DNS), false);
+    detect = SC_ATOMIC_GET(alp_need.detect);
+    http[2] = AppLayerParserProtoIsNeeded(ALPROTO_HTTP, detect);
+    dns[2] = AppLayerParserProtoIsNeeded(ALPROTO_DNS, detect);
+
+    /* outputs */
+    AppLayerParserSetOutputNeed(ALPROTO_HTTP);
+    AppLayerParserSetOutputNeed(ALPROTO_FTPDATA);
+    http[3] = AppLayerParserProtoIsNeeded(ALPROTO_HTTP, detect);
+    ftp = AppLayerParserProtoIsNeeded(ALPROTO_FTP, detect);
+
+    memset(&alp_need, 0, sizeof(alp_need));
+
+    FAIL_IF_NOT(http[0]);
+    FAIL_IF(dns[0]);
+    FAIL_IF_NOT(http[1]);
+    FAIL_IF_NOT(dns[1]);
+    FAIL_IF(http[2]);
+    FAIL_IF_NOT(dns[2]);
+    FAIL_IF_NOT(http[3]);
+    FAIL_IF_NOT(ftp);
+    PASS;
+}
+
 void AppLayerParserRegisterUnittests(void)
 {
     SCEnter();
@@ -2178,6 +2424,8 @@ void AppLayerParserRegisterUnittests(void)
 
     UtRegisterTest("AppLayerParserTest01", AppLayerParserTest01);
     UtRegisterTest("AppLayerParserTest02", AppLayerParserTest02);
+    UtRegisterTest("AppLayerParserTest03", AppLayerParserTest03);
+    UtRegisterTest("AppLayerParserTest04", AppLayerParserTest04);
 
     SCReturn;
 }
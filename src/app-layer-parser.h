@@ -36,6 +36,11 @@
 #define APP_LAYER_PARSER_NO_REASSEMBLY          BIT_U8(2)
 #define APP_LAYER_PARSER_NO_INSPECTION_PAYLOAD  BIT_U8(3)
 #define APP_LAYER_PARSER_BYPASS_READY           BIT_U8(4)
+/** more txs became ready to log than the log ready queue holds */
+#define APP_LAYER_PARSER_LOG_READY_OVERFLOW     BIT_U8(5)
+
+/** size of the per flow queue of txs that are ready to be logged */
+#define APP_LAYER_LOG_READY_MAX                 4
 
 /* Flags for AppLayerParserProtoCtx. */
 #define APP_LAYER_PARSER_OPT_ACCEPT_GAPS        BIT_U32(0)
@@ -58,6 +63,15 @@ int AppLayerParserSetup(void);
 void AppLayerParserPostStreamSetup(void);
 int AppLayerParserDeSetup(void);
 
+/** detection engine needs for app-layer.parse-depth 'need' */
+#define APP_LAYER_NEED_PROTO(alproto)   BIT_U64((alproto))
+/** rules inspect flows beyond the app-layer, so don't bypass */
+#define APP_LAYER_NEED_INSPECTION       BIT_U64(63)
+
+bool AppLayerParserParseByNeedEnabled(void);
+void AppLayerParserSetOutputNeed(AppProto alproto);
+void AppLayerParserSetDetectNeeds(uint64_t needs, bool merge);
+
 typedef struct AppLayerParserThreadCtx_ AppLayerParserThreadCtx;
 
 /**
@@ -144,6 +158,7 @@ void AppLayerParserRegisterLoggerFuncs(uint8_t ipproto, AppProto alproto,
                          void (*StateSetTxLogged)(void *, void *, LoggerId));
 void AppLayerParserRegisterLogger(uint8_t ipproto, AppProto alproto);
 void AppLayerParserRegisterLoggerBits(uint8_t ipproto, AppProto alproto, LoggerId bits);
+void AppLayerParserRegisterLogReadyQueue(uint8_t ipproto, AppProto alproto);
 void AppLayerParserRegisterTruncateFunc(uint8_t ipproto, AppProto alproto,
                              void (*Truncate)(void *, uint8_t));
 void AppLayerParserRegisterGetStateProgressFunc(uint8_t ipproto, AppProto alproto,
@@ -191,6 +206,9 @@ void AppLayerParserDestroyProtocolParserLocalStorage(uint8_t ipproto, AppProto a
 
 uint64_t AppLayerParserGetTransactionLogId(AppLayerParserState *pstate);
 void AppLayerParserSetTransactionLogId(AppLayerParserState *pstate, uint64_t tx_id);
+void AppLayerParserTxReadyToLog(AppLayerParserState *pstate, uint64_t tx_id);
+int AppLayerParserGetTxLogReady(AppLayerParserState *pstate, const uint64_t **ids);
+void AppLayerParserResetTxLogReady(AppLayerParserState *pstate);
 
 void AppLayerParserSetTxLogged(uint8_t ipproto, AppProto alproto, void *alstate,
                                void *tx, LoggerId logged);
@@ -238,6 +256,7 @@ bool AppLayerParserHasDecoderEvents(AppLayerParserState *pstate);
 int AppLayerParserIsTxAware(AppProto alproto);
 int AppLayerParserProtocolIsTxEventAware(uint8_t ipproto, AppProto alproto);
 int AppLayerParserProtocolHasLogger(uint8_t ipproto, AppProto alproto);
+bool AppLayerParserProtocolHasLogReadyQueue(uint8_t ipproto, AppProto alproto);
 LoggerId AppLayerParserProtocolGetLoggerBits(uint8_t ipproto, AppProto alproto);
 void AppLayerParserTriggerRawStreamReassembly(Flow *f, int direction);
 void AppLayerParserSetStreamDepth(uint8_t ipproto, AppProto alproto, uint32_t stream_depth);
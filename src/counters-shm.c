@@ -0,0 +1,362 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Counters exported in a memory mapped file, see counters-shm.h for
+ * the layout.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "threads.h"
+#include "counters-shm.h"
+#include "util-conf.h"
+#include "util-misc.h"
+#include "util-path.h"
+#include "util-unittest.h"
+
+#include <sys/mman.h>
+
+#define STATS_SHM_DEFAULT_FILENAME  "stats.shm"
+#define STATS_SHM_DEFAULT_SIZE      (4 * 1024 * 1024)
+#define STATS_SHM_DEFAULT_INTERVAL  1
+#define STATS_SHM_DEFAULT_NAMES     4096
+
+#define STATS_SHM_ALIGN(x) \
+    (((x) + STATS_SHM_BLOCK_ALIGN - 1) & ~((size_t)STATS_SHM_BLOCK_ALIGN - 1))
+
+static struct {
+    StatsShmHeader *hdr;
+    size_t size;
+    uint32_t interval;
+    /* protects the allocation of names and blocks */
+    SCMutex lock;
+} stats_shm = { .hdr = NULL, .lock = SCMUTEX_INITIALIZER };
+
+bool StatsShmEnabled(void)
+{
+    return stats_shm.hdr != NULL;
+}
+
+uint32_t StatsShmInterval(void)
+{
+    return stats_shm.interval;
+}
+
+static inline StatsShmName *StatsShmNames(StatsShmHeader *hdr)
+{
+    return (StatsShmName *)((uint8_t *)hdr + hdr->names_offset);
+}
+
+/** \internal
+ *  \brief create the file and map it
+ */
+static int StatsShmCreate(const char *filename, size_t size, uint32_t names)
+{
+    const size_t names_offset = STATS_SHM_ALIGN(sizeof(StatsShmHeader));
+    const size_t blocks_offset = STATS_SHM_ALIGN(names_offset +
+            (size_t)names * sizeof(StatsShmName));
+    if (blocks_offset >= size) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "stats.shared-memory.size of %"
+                PRIuMAX" bytes is too small for %u counter names",
+                (uintmax_t)size, names);
+        return -1;
+    }
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644);
+    if (fd == -1) {
+        SCLogError(SC_ERR_OPENING_FILE, "failed to create %s: %s",
+                filename, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, size) != 0) {
+        SCLogError(SC_ERR_FWRITE, "failed to size %s: %s",
+                filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to map %s: %s",
+                filename, strerror(errno));
+        return -1;
+    }
+
+    StatsShmHeader *hdr = ptr;
+    hdr->version = STATS_SHM_VERSION;
+    hdr->size = size;
+    hdr->pid = (uint32_t)getpid();
+    hdr->interval = stats_shm.interval;
+    hdr->start_time = (uint64_t)time(NULL);
+    hdr->names_offset = (uint32_t)names_offset;
+    hdr->names_max = names;
+    hdr->blocks_offset = (uint32_t)blocks_offset;
+    hdr->flags = STATS_SHM_FLAG_RUNNING;
+    /* readers check the magic last */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(hdr->magic, STATS_SHM_MAGIC, sizeof(hdr->magic));
+
+    stats_shm.hdr = hdr;
+    stats_shm.size = size;
+    return 0;
+}
+
+/**
+ * \brief Set up the counter export from the stats config.
+ *
+ * \retval 0 if not enabled or set up, -1 on error
+ */
+int StatsShmSetup(ConfNode *stats)
+{
+    ConfNode *conf = ConfNodeLookupChild(stats, "shared-memory");
+    if (conf == NULL || !ConfNodeChildValueIsTrue(conf, "enabled"))
+        return 0;
+
+    const char *filename = ConfNodeLookupChildValue(conf, "filename");
+    if (filename == NULL)
+        filename = STATS_SHM_DEFAULT_FILENAME;
+    char path[PATH_MAX];
+    if (PathIsAbsolute(filename)) {
+        strlcpy(path, filename, sizeof(path));
+    } else {
+        snprintf(path, sizeof(path), "%s/%s", ConfigGetLogDirectory(),
+                filename);
+    }
+
+    uint32_t size = STATS_SHM_DEFAULT_SIZE;
+    const char *str = ConfNodeLookupChildValue(conf, "size");
+    if (str != NULL && ParseSizeStringU32(str, &size) < 0) {
+        SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                "stats.shared-memory.size from conf file - %s", str);
+        return -1;
+    }
+
+    intmax_t interval = STATS_SHM_DEFAULT_INTERVAL;
+    if (ConfGetChildValueInt(conf, "interval", &interval) &&
+            (interval < 1 || interval > 3600)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "stats.shared-memory.interval "
+                "must be between 1 and 3600 seconds");
+        return -1;
+    }
+    stats_shm.interval = (uint32_t)interval;
+
+    if (StatsShmCreate(path, size, STATS_SHM_DEFAULT_NAMES) != 0)
+        return -1;
+
+    SCLogConfig("stats: exporting counters in %s every %u second(s)",
+            path, stats_shm.interval);
+    return 0;
+}
+
+void StatsShmDeinit(void)
+{
+    if (stats_shm.hdr == NULL)
+        return;
+
+    /* the file is left in place with the final values */
+    __atomic_and_fetch(&stats_shm.hdr->flags, ~STATS_SHM_FLAG_RUNNING,
+            __ATOMIC_RELEASE);
+    munmap(stats_shm.hdr, stats_shm.size);
+    stats_shm.hdr = NULL;
+}
+
+/**
+ * \brief Add a counter name to the names table. Called once for each
+ *        new global counter id.
+ */
+void StatsShmRegisterName(uint16_t gid, const char *name, int type)
+{
+    StatsShmHeader *hdr = stats_shm.hdr;
+    if (hdr == NULL)
+        return;
+
+    SCMutexLock(&stats_shm.lock);
+    if (gid >= hdr->names_max) {
+        SCLogWarning(SC_ERR_STATS_LOG_GENERIC, "stats: no room for counter "
+                "%s in the shared memory names table", name);
+    } else {
+        StatsShmName *n = &StatsShmNames(hdr)[gid];
+        strlcpy(n->name, name, sizeof(n->name));
+        n->type = (uint32_t)type;
+        if (gid >= hdr->names_cnt) {
+            __atomic_store_n(&hdr->names_cnt, gid + 1, __ATOMIC_RELEASE);
+        }
+    }
+    SCMutexUnlock(&stats_shm.lock);
+}
+
+/**
+ * \brief Allocate the block of a thread.
+ *
+ * \param gids global ids of the thread's counters, in the order the
+ *        values are set
+ *
+ * \retval block or NULL if disabled or out of space
+ */
+StatsShmBlock *StatsShmBlockAlloc(const char *thread_name,
+        const uint16_t *gids, uint32_t cnt)
+{
+    StatsShmHeader *hdr = stats_shm.hdr;
+    if (hdr == NULL)
+        return NULL;
+
+    const size_t len = STATS_SHM_ALIGN(sizeof(StatsShmBlock) +
+            (size_t)cnt * sizeof(StatsShmValue));
+    StatsShmBlock *b = NULL;
+
+    SCMutexLock(&stats_shm.lock);
+    if (hdr->blocks_offset + hdr->blocks_len + len > hdr->size) {
+        SCLogWarning(SC_ERR_STATS_LOG_GENERIC, "stats: no room for the "
+                "counters of thread %s in the shared memory, increase "
+                "stats.shared-memory.size", thread_name);
+    } else {
+        b = (StatsShmBlock *)((uint8_t *)hdr + hdr->blocks_offset +
+                hdr->blocks_len);
+        strlcpy(b->thread_name, thread_name, sizeof(b->thread_name));
+        b->cnt = cnt;
+        for (uint32_t i = 0; i < cnt; i++) {
+            b->values[i].gid = gids[i];
+        }
+        hdr->blocks_len += (uint32_t)len;
+        __atomic_store_n(&hdr->blocks_cnt, hdr->blocks_cnt + 1,
+                __ATOMIC_RELEASE);
+    }
+    SCMutexUnlock(&stats_shm.lock);
+    return b;
+}
+
+#ifdef UNITTESTS
+
+/** \test blocks are laid out after each other, the sequence number is odd
+ *        during an update and the values are in gid order */
+static int StatsShmTest01(void)
+{
+    char path[] = "/tmp/suricata-stats-shm-XXXXXX";
+    int fd = mkstemp(path);
+    FAIL_IF(fd < 0);
+    close(fd);
+
+    stats_shm.interval = 1;
+    FAIL_IF(StatsShmCreate(path, 4096, 4) != 0);
+    FAIL_IF_NOT(StatsShmEnabled());
+    StatsShmHeader *hdr = stats_shm.hdr;
+    FAIL_IF(memcmp(hdr->magic, STATS_SHM_MAGIC, sizeof(hdr->magic)) != 0);
+    FAIL_IF_NOT(hdr->flags & STATS_SHM_FLAG_RUNNING);
+
+    StatsShmRegisterName(0, "decoder.pkts", STATS_SHM_TYPE_NORMAL);
+    StatsShmRegisterName(2, "decoder.max_pkt_size", STATS_SHM_TYPE_MAXIMUM);
+    FAIL_IF(hdr->names_cnt != 3);
+    FAIL_IF(strcmp(StatsShmNames(hdr)[2].name, "decoder.max_pkt_size") != 0);
+    /* out of room in the names table */
+    StatsShmRegisterName(4, "decoder.bytes", STATS_SHM_TYPE_NORMAL);
+    FAIL_IF(hdr->names_cnt != 3);
+
+    const uint16_t gids1[] = { 0, 2 };
+    StatsShmBlock *b1 = StatsShmBlockAlloc("W#01", gids1, 2);
+    FAIL_IF_NULL(b1);
+    const uint16_t gids2[] = { 0 };
+    StatsShmBlock *b2 = StatsShmBlockAlloc("W#02", gids2, 1);
+    FAIL_IF_NULL(b2);
+    FAIL_IF(hdr->blocks_cnt != 2);
+    FAIL_IF((uint8_t *)b1 != (uint8_t *)hdr + hdr->blocks_offset);
+    FAIL_IF((uint8_t *)b2 != (uint8_t *)b1 + STATS_SHM_ALIGN(
+                sizeof(StatsShmBlock) + 2 * sizeof(StatsShmValue)));
+    FAIL_IF(((uintptr_t)b2 % STATS_SHM_BLOCK_ALIGN) != 0);
+    FAIL_IF(b1->seq != 0);
+    FAIL_IF(b1->values[1].gid != 2);
+    FAIL_IF(strcmp(b2->thread_name, "W#02") != 0);
+
+    StatsShmBlockBegin(b1);
+    FAIL_IF(b1->seq != 1);
+    StatsShmBlockSet(b1, 0, 10, 5);
+    StatsShmBlockSet(b1, 1, 1500, 1);
+    StatsShmBlockEnd(b1, 1234);
+    FAIL_IF(b1->seq != 2);
+    FAIL_IF(b1->ts != 1234);
+    FAIL_IF(b1->values[0].value != 10 || b1->values[0].updates != 5);
+    FAIL_IF(b1->values[1].value != 1500 || b1->values[1].updates != 1);
+    /* the other block is not touched */
+    FAIL_IF(b2->seq != 0);
+    FAIL_IF(b2->values[0].value != 0);
+
+    /* replacing a block: the values stay, the seq moves on */
+    StatsShmBlockRetire(b1);
+    FAIL_IF(b1->seq != 4);
+    FAIL_IF_NOT(b1->flags & STATS_SHM_BLOCK_RETIRED);
+    FAIL_IF(b1->values[0].value != 10);
+    FAIL_IF(b2->flags != 0);
+
+    /* out of space */
+    uint16_t gids3[256];
+    memset(gids3, 0, sizeof(gids3));
+    FAIL_IF_NOT_NULL(StatsShmBlockAlloc("W#03", gids3, 256));
+    FAIL_IF(hdr->blocks_cnt != 2);
+
+    StatsShmDeinit();
+    FAIL_IF(StatsShmEnabled());
+    unlink(path);
+    PASS;
+}
+
+/** \test the file is left in place, with the values and not running */
+static int StatsShmTest02(void)
+{
+    char path[] = "/tmp/suricata-stats-shm-XXXXXX";
+    int fd = mkstemp(path);
+    FAIL_IF(fd < 0);
+    close(fd);
+
+    stats_shm.interval = 1;
+    FAIL_IF(StatsShmCreate(path, 4096, 4) != 0);
+    StatsShmRegisterName(0, "flow.memuse", STATS_SHM_TYPE_FUNC);
+    const uint16_t gids[] = { 0 };
+    StatsShmBlock *b = StatsShmBlockAlloc("Global", gids, 1);
+    FAIL_IF_NULL(b);
+    StatsShmBlockBegin(b);
+    StatsShmBlockSet(b, 0, 4096, 1);
+    StatsShmBlockEnd(b, 1);
+    const size_t offset = (uint8_t *)b - (uint8_t *)stats_shm.hdr;
+    StatsShmDeinit();
+
+    FILE *fp = fopen(path, "r");
+    FAIL_IF_NULL(fp);
+    uint8_t buf[4096];
+    FAIL_IF(fread(buf, 1, sizeof(buf), fp) != sizeof(buf));
+    fclose(fp);
+    unlink(path);
+
+    const StatsShmHeader *hdr = (const StatsShmHeader *)buf;
+    FAIL_IF(hdr->flags & STATS_SHM_FLAG_RUNNING);
+    FAIL_IF(hdr->blocks_cnt != 1);
+    const StatsShmBlock *rb = (const StatsShmBlock *)(buf + offset);
+    FAIL_IF(rb->seq != 2);
+    FAIL_IF(rb->values[0].value != 4096);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void StatsShmRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("StatsShmTest01", StatsShmTest01);
+    UtRegisterTest("StatsShmTest02", StatsShmTest02);
+#endif
+}
@@ -0,0 +1,145 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Counters exported in a memory mapped file.
+ *
+ * The file starts with a StatsShmHeader, followed by a table of counter
+ * names indexed by the global counter id and then the thread blocks.
+ * Each thread block holds the values of the counters of one thread and
+ * is only written by that thread. Readers use the block's sequence
+ * number: it is odd while the values are updated, and a read is only
+ * consistent if the sequence number was even and did not change during
+ * the read.
+ *
+ * names_cnt and blocks_cnt only grow, and the names and blocks they
+ * cover are complete before they are increased. A block that has been
+ * replaced by a bigger one is flagged STATS_SHM_BLOCK_RETIRED and must
+ * be skipped by readers.
+ */
+
+#ifndef __COUNTERS_SHM_H__
+#define __COUNTERS_SHM_H__
+
+#include "conf.h"
+
+#define STATS_SHM_MAGIC             "SCSTATS1"
+#define STATS_SHM_VERSION           1
+
+#define STATS_SHM_NAME_LEN          128
+#define STATS_SHM_THREAD_NAME_LEN   64
+
+/* blocks start at a cache line boundary */
+#define STATS_SHM_BLOCK_ALIGN       64
+
+/* header flags */
+#define STATS_SHM_FLAG_RUNNING      BIT_U32(0)
+
+/* block flags */
+#define STATS_SHM_BLOCK_RETIRED     BIT_U32(0)
+
+/* counter types, how to merge the values of the threads */
+#define STATS_SHM_TYPE_NORMAL       1   /**< sum of the values */
+#define STATS_SHM_TYPE_AVERAGE      2   /**< sum of values / sum of updates */
+#define STATS_SHM_TYPE_MAXIMUM      3   /**< highest value */
+#define STATS_SHM_TYPE_FUNC         4   /**< only in the global block */
+
+typedef struct StatsShmHeader_ {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t size;
+    uint32_t pid;
+    /* seconds between updates of the blocks */
+    uint32_t interval;
+    uint64_t start_time;
+
+    uint32_t names_offset;
+    uint32_t names_max;
+    uint32_t names_cnt;
+
+    uint32_t blocks_offset;
+    uint32_t blocks_cnt;
+    /* bytes of the block area in use */
+    uint32_t blocks_len;
+} StatsShmHeader;
+
+typedef struct StatsShmName_ {
+    char name[STATS_SHM_NAME_LEN];
+    uint32_t type;
+    uint32_t pad;
+} StatsShmName;
+
+typedef struct StatsShmValue_ {
+    /* index in the names table */
+    uint32_t gid;
+    uint32_t pad;
+    uint64_t value;
+    uint64_t updates;
+} StatsShmValue;
+
+typedef struct StatsShmBlock_ {
+    char thread_name[STATS_SHM_THREAD_NAME_LEN];
+    uint64_t seq;
+    /* time of the last update, usecs */
+    uint64_t ts;
+    uint32_t cnt;
+    uint32_t flags;
+    StatsShmValue values[];
+} StatsShmBlock;
+
+int StatsShmSetup(ConfNode *stats);
+bool StatsShmEnabled(void);
+uint32_t StatsShmInterval(void);
+void StatsShmDeinit(void);
+
+void StatsShmRegisterName(uint16_t gid, const char *name, int type);
+StatsShmBlock *StatsShmBlockAlloc(const char *thread_name,
+        const uint16_t *gids, uint32_t cnt);
+void StatsShmRegisterTests(void);
+
+static inline void StatsShmBlockBegin(StatsShmBlock *b)
+{
+    __atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void StatsShmBlockSet(StatsShmBlock *b, uint32_t i,
+        uint64_t value, uint64_t updates)
+{
+    __atomic_store_n(&b->values[i].value, value, __ATOMIC_RELAXED);
+    __atomic_store_n(&b->values[i].updates, updates, __ATOMIC_RELAXED);
+}
+
+static inline void StatsShmBlockEnd(StatsShmBlock *b, uint64_t ts)
+{
+    __atomic_store_n(&b->ts, ts, __ATOMIC_RELAXED);
+    __atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELEASE);
+}
+
+/** \brief flag a block that was replaced, readers skip it from now on */
+static inline void StatsShmBlockRetire(StatsShmBlock *b)
+{
+    StatsShmBlockBegin(b);
+    __atomic_store_n(&b->flags, b->flags | STATS_SHM_BLOCK_RETIRED,
+            __ATOMIC_RELAXED);
+    StatsShmBlockEnd(b, b->ts);
+}
+
+#endif /* __COUNTERS_SHM_H__ */
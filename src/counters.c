@@ -27,6 +27,7 @@
 #include "suricata-common.h"
 #include "suricata.h"
 #include "counters.h"
+#include "counters-shm.h"
 #include "threadvars.h"
 #include "tm-threads.h"
 #include "conf.h"
@@ -95,6 +96,10 @@ static StatsGlobalContext *stats_ctx = NULL;
 static time_t stats_start_time;
 /** refresh interval in seconds */
 static uint32_t stats_tts = STATS_MGMTT_TTS;
+/** interval in seconds at which threads sync their counters */
+static uint32_t stats_wut_tts = STATS_WUT_TTS;
+/** block of the global counters in the shared memory export */
+static StatsShmBlock *stats_shm_global = NULL;
 /** is the stats counter enabled? */
 static char stats_enabled = TRUE;
 
@@ -106,6 +111,7 @@ bool stats_stream_events = false;
 
 static int StatsOutput(ThreadVars *tv);
 static int StatsThreadRegister(const char *thread_name, StatsPublicThreadContext *);
+static void StatsAssignGlobalIdsLocked(StatsPublicThreadContext *pctx);
 void StatsReleaseCounters(StatsCounter *head);
 
 /** stats table is filled each interval and passed to the
@@ -272,6 +278,10 @@ static void StatsInitCtxPreOutput(void)
             prefix = "decoder.event";
         }
         stats_decoder_events_prefix = prefix;
+
+        if (StatsShmSetup(stats) != 0) {
+            exit(EXIT_FAILURE);
+        }
     }
     SCReturn;
 }
@@ -282,18 +292,13 @@ static void StatsInitCtxPostOutput(void)
     /* Store the engine start time */
     time(&stats_start_time);
 
-    /* init the lock used by StatsThreadStore */
-    if (SCMutexInit(&stats_ctx->sts_lock, NULL) != 0) {
-        SCLogError(SC_ERR_INITIALIZATION, "error initializing sts mutex");
-        exit(EXIT_FAILURE);
-    }
-
     if (stats_enabled && !OutputStatsLoggersRegistered()) {
         stats_loggers_active = 0;
 
         /* if the unix command socket is enabled we do the background
-         * stats sync just in case someone runs 'dump-counters' */
-        if (!ConfUnixSocketIsEnable()) {
+         * stats sync just in case someone runs 'dump-counters'. The
+         * same goes for readers of the shared memory export. */
+        if (!ConfUnixSocketIsEnable() && !StatsShmEnabled()) {
             SCLogWarning(SC_WARN_NO_STATS_LOGGERS, "stats are enabled but no loggers are active");
             stats_enabled = FALSE;
             SCReturn;
@@ -337,6 +342,9 @@ static void StatsReleaseCtx(void)
     SCFree(stats_ctx);
     stats_ctx = NULL;
 
+    stats_shm_global = NULL;
+    StatsShmDeinit();
+
     SCMutexLock(&stats_table_mutex);
     /* free stats table */
     if (stats_table.tstats != NULL) {
@@ -436,6 +444,79 @@ static void *StatsMgmtThread(void *arg)
     return NULL;
 }
 
+static uint64_t StatsShmTimestamp(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/**
+ * \brief copy the values of a thread's counters to its block in the
+ *        shared memory export
+ *
+ * Called by the thread itself, so the private values are read without
+ * a lock. Schedules the next update StatsShmInterval() seconds out.
+ */
+void StatsShmPublish(StatsPrivateThreadContext *pca)
+{
+    StatsShmBlock *b = pca->shm;
+
+    StatsShmBlockBegin(b);
+    for (uint32_t i = 1; i <= pca->size; i++) {
+        StatsShmBlockSet(b, i - 1, pca->head[i].value, pca->head[i].updates);
+    }
+    StatsShmBlockEnd(b, StatsShmTimestamp());
+
+    pca->shm_next = time(NULL) + StatsShmInterval();
+}
+
+/** \internal
+ *  \brief update the global counters in the shared memory export
+ *
+ *  The block is (re)allocated when global counters were registered
+ *  since the last call, the block it replaces is retired.
+ */
+static void StatsShmPublishGlobal(void)
+{
+    if (!StatsShmEnabled())
+        return;
+
+    StatsPublicThreadContext *pctx = &stats_ctx->global_counter_ctx;
+
+    SCMutexLock(&stats_ctx->sts_lock);
+    if (pctx->curr_id == 0) {
+        SCMutexUnlock(&stats_ctx->sts_lock);
+        return;
+    }
+    if (stats_shm_global == NULL || stats_shm_global->cnt != pctx->curr_id) {
+        StatsAssignGlobalIdsLocked(pctx);
+        uint16_t gids[pctx->curr_id];
+        uint32_t cnt = 0;
+        for (StatsCounter *pc = pctx->head; pc != NULL && cnt < pctx->curr_id;
+                pc = pc->next) {
+            gids[cnt++] = pc->gid;
+        }
+        StatsShmBlock *b = StatsShmBlockAlloc("Global", gids, cnt);
+        if (b == NULL) {
+            SCMutexUnlock(&stats_ctx->sts_lock);
+            return;
+        }
+        if (stats_shm_global != NULL)
+            StatsShmBlockRetire(stats_shm_global);
+        stats_shm_global = b;
+    }
+
+    StatsShmBlock *b = stats_shm_global;
+    uint32_t i = 0;
+    StatsShmBlockBegin(b);
+    for (StatsCounter *pc = pctx->head; pc != NULL && i < b->cnt; pc = pc->next) {
+        StatsShmBlockSet(b, i++, pc->Func ? pc->Func() : pc->value, 1);
+    }
+    StatsShmBlockEnd(b, StatsShmTimestamp());
+    SCMutexUnlock(&stats_ctx->sts_lock);
+}
+
 /**
  * \brief Wake up thread.  This thread wakes up every TTS(time to sleep) seconds
  *        and sets the flag for every ThreadVars' StatsPublicThreadContext
@@ -467,6 +548,13 @@ static void *StatsWakeupThread(void *arg)
         return NULL;
     }
 
+    /* the global counters in the shared memory export are updated at its
+     * own interval, the threads are still signalled every stats_wut_tts */
+    uint32_t tts = stats_wut_tts;
+    if (StatsShmEnabled())
+        tts = MIN(tts, StatsShmInterval());
+    time_t next_sync = 0;
+
     TmThreadsSetFlag(tv_local, THV_INIT_DONE);
     while (1) {
         if (TmThreadsCheckFlag(tv_local, THV_PAUSE)) {
@@ -478,7 +566,7 @@ static void *StatsWakeupThread(void *arg)
         struct timeval cur_timev;
         gettimeofday(&cur_timev, NULL);
         struct timespec cond_time = FROM_TIMEVAL(cur_timev);
-        cond_time.tv_sec += STATS_WUT_TTS;
+        cond_time.tv_sec += tts;
 
         /* wait for the set time, or until we are woken up by
          * the shutdown procedure */
@@ -486,6 +574,14 @@ static void *StatsWakeupThread(void *arg)
         SCCtrlCondTimedwait(tv_local->ctrl_cond, tv_local->ctrl_mutex, &cond_time);
         SCCtrlMutexUnlock(tv_local->ctrl_mutex);
 
+        StatsShmPublishGlobal();
+
+        const time_t now = time(NULL);
+        if (now < next_sync && !TmThreadsCheckFlag(tv_local, THV_KILL)) {
+            continue;
+        }
+        next_sync = now + stats_wut_tts;
+
         SCMutexLock(&tv_root_lock);
         ThreadVars *tv = tv_root[TVT_PPT];
         while (tv != NULL) {
@@ -866,6 +962,13 @@ void StatsInit(void)
     }
     memset(stats_ctx, 0, sizeof(StatsGlobalContext));
 
+    /* init the lock used by StatsThreadStore, global counters are
+     * registered under it as well */
+    if (SCMutexInit(&stats_ctx->sts_lock, NULL) != 0) {
+        SCLogError(SC_ERR_INITIALIZATION, "error initializing sts mutex");
+        exit(EXIT_FAILURE);
+    }
+
     StatsPublicThreadContextInit(&stats_ctx->global_counter_ctx);
 }
 
@@ -1006,10 +1109,13 @@ uint16_t StatsRegisterGlobalCounter(const char *name, uint64_t (*Func)(void))
 #else
     BUG_ON(stats_ctx == NULL);
 #endif
+    /* the shared memory export walks the list from the wakeup thread */
+    SCMutexLock(&stats_ctx->sts_lock);
     uint16_t id = StatsRegisterQualifiedCounter(name, NULL,
             &(stats_ctx->global_counter_ctx),
             STATS_TYPE_FUNC,
             Func);
+    SCMutexUnlock(&stats_ctx->sts_lock);
     return id;
 }
 
@@ -1062,27 +1168,11 @@ static void CountersIdHashFreeFunc(void *data)
 
 
 /** \internal
- *  \brief Adds a TM to the clubbed TM table.  Multiple instances of the same TM
- *         are stacked together in a PCTMI container.
- *
- *  \param tm_name Name of the tm to be added to the table
- *  \param pctx    StatsPublicThreadContext associated with the TM tm_name
- *
- *  \retval 1 on success, 0 on failure
+ *  \brief set the global ids of the counters of a thread, adding new
+ *         ids for names not seen before. Called with sts_lock held.
  */
-static int StatsThreadRegister(const char *thread_name, StatsPublicThreadContext *pctx)
+static void StatsAssignGlobalIdsLocked(StatsPublicThreadContext *pctx)
 {
-    if (stats_ctx == NULL) {
-        SCLogDebug("Counter module has been disabled");
-        return 0;
-    }
-
-    if (thread_name == NULL || pctx == NULL) {
-        SCLogDebug("supplied argument(s) to StatsThreadRegister NULL");
-        return 0;
-    }
-
-    SCMutexLock(&stats_ctx->sts_lock);
     if (stats_ctx->counters_id_hash == NULL) {
         stats_ctx->counters_id_hash = HashTableInit(256, CountersIdHashFunc,
                                                               CountersIdHashCompareFunc,
@@ -1099,11 +1189,36 @@ static int StatsThreadRegister(const char *thread_name, StatsPublicThreadContext
             id->id = counters_global_id++;
             id->string = pc->name;
             BUG_ON(HashTableAdd(stats_ctx->counters_id_hash, id, sizeof(*id)) < 0);
+            StatsShmRegisterName(id->id, pc->name, pc->type);
         }
         pc->gid = id->id;
         pc = pc->next;
     }
+}
 
+/** \internal
+ *  \brief Adds a TM to the clubbed TM table.  Multiple instances of the same TM
+ *         are stacked together in a PCTMI container.
+ *
+ *  \param tm_name Name of the tm to be added to the table
+ *  \param pctx    StatsPublicThreadContext associated with the TM tm_name
+ *
+ *  \retval 1 on success, 0 on failure
+ */
+static int StatsThreadRegister(const char *thread_name, StatsPublicThreadContext *pctx)
+{
+    if (stats_ctx == NULL) {
+        SCLogDebug("Counter module has been disabled");
+        return 0;
+    }
+
+    if (thread_name == NULL || pctx == NULL) {
+        SCLogDebug("supplied argument(s) to StatsThreadRegister NULL");
+        return 0;
+    }
+
+    SCMutexLock(&stats_ctx->sts_lock);
+    StatsAssignGlobalIdsLocked(pctx);
 
     StatsThreadStore *temp = NULL;
     if ( (temp = SCMalloc(sizeof(StatsThreadStore))) == NULL) {
@@ -1199,8 +1314,17 @@ int StatsSetupPrivate(ThreadVars *tv)
 {
     StatsGetAllCountersArray(&(tv)->perf_public_ctx, &(tv)->perf_private_ctx);
 
-    StatsThreadRegister(tv->printable_name ? tv->printable_name : tv->name,
-        &(tv)->perf_public_ctx);
+    const char *name = tv->printable_name ? tv->printable_name : tv->name;
+    StatsThreadRegister(name, &(tv)->perf_public_ctx);
+
+    StatsPrivateThreadContext *pca = &tv->perf_private_ctx;
+    if (StatsShmEnabled() && pca->initialized && pca->size > 0) {
+        uint16_t gids[pca->size];
+        for (uint32_t i = 1; i <= pca->size; i++) {
+            gids[i - 1] = pca->head[i].pc->gid;
+        }
+        pca->shm = StatsShmBlockAlloc(name, gids, pca->size);
+    }
     return 0;
 }
 
@@ -1291,6 +1415,7 @@ static void StatsReleasePrivateThreadContext(StatsPrivateThreadContext *pca)
             pca->size = 0;
         }
         pca->initialized = 0;
+        pca->shm = NULL;
     }
 }
 
@@ -101,6 +101,12 @@ typedef struct StatsPrivateThreadContext_ {
     uint32_t size;
 
     int initialized;
+
+    /* block in the shared memory export, if enabled */
+    struct StatsShmBlock_ *shm;
+
+    /* time the block is written next, checked from the thread's loop */
+    time_t shm_next;
 } StatsPrivateThreadContext;
 
 /* the initialization functions */
@@ -127,19 +133,32 @@ void StatsIncr(struct ThreadVars_ *, uint16_t);
 
 /* utility functions */
 int StatsUpdateCounterArray(StatsPrivateThreadContext *, StatsPublicThreadContext *);
+void StatsShmPublish(StatsPrivateThreadContext *);
 uint64_t StatsGetLocalCounterValue(struct ThreadVars_ *, uint16_t);
 int StatsSetupPrivate(struct ThreadVars_ *);
 void StatsThreadCleanup(struct ThreadVars_ *);
 
-#define StatsSyncCounters(tv) \
-    StatsUpdateCounterArray(&(tv)->perf_private_ctx, &(tv)->perf_public_ctx);  \
+#define StatsSyncCounters(tv)                                                  \
+    do {                                                                        \
+        StatsUpdateCounterArray(&(tv)->perf_private_ctx,                       \
+                                 &(tv)->perf_public_ctx);                       \
+        if ((tv)->perf_private_ctx.shm != NULL) {                               \
+            StatsShmPublish(&(tv)->perf_private_ctx);                           \
+        }                                                                       \
+    } while (0)
 
+/* the shared memory block is written by the thread itself when it is due,
+ * independent of the signalled sync */
 #define StatsSyncCountersIfSignalled(tv)                                       \
     do {                                                                        \
         if ((tv)->perf_public_ctx.perf_flag == 1) {                             \
             StatsUpdateCounterArray(&(tv)->perf_private_ctx,                   \
                                      &(tv)->perf_public_ctx);                   \
         }                                                                       \
+        if ((tv)->perf_private_ctx.shm != NULL &&                               \
+                time(NULL) >= (tv)->perf_private_ctx.shm_next) {                \
+            StatsShmPublish(&(tv)->perf_private_ctx);                           \
+        }                                                                       \
     } while (0)
 
 #ifdef BUILD_UNIX_SOCKET
@@ -38,9 +38,115 @@
 #include "util-unittest.h"
 #include "util-debug.h"
 
+/**
+ * \internal
+ * \brief Fast path for the common Ethernet, up to 2 VLAN tags, IPv4
+ *        without options and fragmentation or IPv6 without extension
+ *        headers, then TCP or UDP stack.
+ *
+ * The L2 and L3 headers are validated with a few combined checks before
+ * anything is set in the packet, the TCP and UDP decoders are then called
+ * as usual. Anything else is left to the full decoders.
+ *
+ * \retval 1 packet decoded
+ * \retval 0 not handled, the packet is untouched
+ */
+static inline int DecodeEthernetFast(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+                                     const uint8_t *pkt, uint32_t len, PacketQueue *pq)
+{
+    uint16_t vlan_id[2];
+    int vlan_cnt = 0;
+    uint32_t off = ETHERNET_HEADER_LEN;
+
+    if (unlikely(len < ETHERNET_HEADER_LEN + IPV4_HEADER_LEN ||
+                 len > ETHERNET_HEADER_LEN + USHRT_MAX))
+        return 0;
+
+    uint16_t type = SCNtohs(((const EthernetHdr *)pkt)->eth_type);
+    while (type == ETHERNET_TYPE_VLAN ||
+            (vlan_cnt == 0 && type == ETHERNET_TYPE_8021QINQ) ||
+            (vlan_cnt > 0 && type == ETHERNET_TYPE_8021AD)) {
+        if (p->vlan_idx + vlan_cnt >= 2 || len < off + VLAN_HEADER_LEN)
+            return 0;
+        const VLANHdr *vlan_hdr = (const VLANHdr *)(pkt + off);
+        vlan_id[vlan_cnt++] = GET_VLAN_ID(vlan_hdr);
+        type = GET_VLAN_PROTO(vlan_hdr);
+        off += VLAN_HEADER_LEN;
+    }
+
+    const uint8_t *ip = pkt + off;
+    const uint32_t avail = len - off;
+    uint8_t proto;
+    uint16_t l4len;
+
+    if (type == ETHERNET_TYPE_IP) {
+        const IPV4Hdr *ip4h = (const IPV4Hdr *)ip;
+        /* version 4 and no options, then length, MF flag and fragment
+         * offset, protocol */
+        if (avail < IPV4_HEADER_LEN || ip4h->ip_verhl != 0x45)
+            return 0;
+        uint16_t iplen = SCNtohs(IPV4_GET_RAW_IPLEN(ip4h));
+        proto = IPV4_GET_RAW_IPPROTO(ip4h);
+        if (iplen < IPV4_HEADER_LEN || iplen > avail ||
+                (SCNtohs(IPV4_GET_RAW_IPOFFSET(ip4h)) & 0x3fff) ||
+                (proto != IPPROTO_TCP && proto != IPPROTO_UDP))
+            return 0;
+        l4len = iplen - IPV4_HEADER_LEN;
+    } else if (type == ETHERNET_TYPE_IPV6) {
+        const IPV6Hdr *ip6h = (const IPV6Hdr *)ip;
+        if (avail < IPV6_HEADER_LEN || IP_GET_RAW_VER(ip) != 6)
+            return 0;
+        l4len = IPV6_GET_RAW_PLEN(ip6h);
+        proto = IPV6_GET_RAW_NH(ip6h);
+        if (IPV6_HEADER_LEN + (uint32_t)l4len > avail ||
+                (proto != IPPROTO_TCP && proto != IPPROTO_UDP))
+            return 0;
+    } else {
+        return 0;
+    }
+
+    /* headers are fine, fill the packet like the full decoders do */
+    StatsIncr(tv, dtv->counter_eth);
+    p->ethh = (EthernetHdr *)pkt;
+    for (int i = 0; i < vlan_cnt; i++) {
+        if (p->vlan_idx == 0)
+            StatsIncr(tv, dtv->counter_vlan);
+        else
+            StatsIncr(tv, dtv->counter_vlan_qinq);
+        p->vlan_id[p->vlan_idx++] = vlan_id[i];
+    }
+
+    const uint8_t *l4 = ip;
+    if (type == ETHERNET_TYPE_IP) {
+        StatsIncr(tv, dtv->counter_ipv4);
+        p->ip4h = (IPV4Hdr *)ip;
+        SET_IPV4_SRC_ADDR(p, &p->src);
+        SET_IPV4_DST_ADDR(p, &p->dst);
+        p->proto = proto;
+        l4 += IPV4_HEADER_LEN;
+    } else {
+        StatsIncr(tv, dtv->counter_ipv6);
+        p->ip6h = (IPV6Hdr *)ip;
+        SET_IPV6_SRC_ADDR(p, &p->src);
+        SET_IPV6_DST_ADDR(p, &p->dst);
+        IPV6_SET_L4PROTO(p, proto);
+        l4 += IPV6_HEADER_LEN;
+    }
+
+    if (proto == IPPROTO_TCP) {
+        DecodeTCP(tv, dtv, p, l4, l4len, pq);
+    } else {
+        DecodeUDP(tv, dtv, p, l4, l4len, pq);
+    }
+    return 1;
+}
+
 int DecodeEthernet(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
                    const uint8_t *pkt, uint32_t len, PacketQueue *pq)
 {
+    if (likely(DecodeEthernetFast(tv, dtv, p, pkt, len, pq)))
+        return TM_ECODE_OK;
+
     StatsIncr(tv, dtv->counter_eth);
 
     if (unlikely(len < ETHERNET_HEADER_LEN)) {
@@ -210,6 +316,96 @@ static int DecodeEthernetTestDceNextTooSmall(void)
     PASS;
 }
 
+/**
+ * Test the fast path with a VLAN tagged IPv4/TCP frame.
+ */
+static int DecodeEthernetTestFastPath01(void)
+{
+    uint8_t raw_eth[] = {
+        0x00, 0x10, 0x94, 0x55, 0x00, 0x01, 0x00, 0x10,
+        0x94, 0x56, 0x00, 0x01, 0x81, 0x00, 0x00, 0x64,
+        0x08, 0x00,
+        /* IPv4 10.0.0.1 -> 10.0.0.2 */
+        0x45, 0x00, 0x00, 0x2c, 0x00, 0x01, 0x40, 0x00,
+        0x40, 0x06, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        /* TCP 1024 -> 80 PSH ACK */
+        0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x01, 0x50, 0x18, 0x20, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+        /* payload */
+        0x41, 0x42, 0x43, 0x44,
+    };
+
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&tv,  0, sizeof(ThreadVars));
+    memset(p, 0, SIZE_OF_PACKET);
+
+    FAIL_IF_NOT(DecodeEthernetFast(&tv, &dtv, p, raw_eth, sizeof(raw_eth), NULL));
+    FAIL_IF(p->flags & PKT_IS_INVALID);
+    FAIL_IF_NOT(p->vlan_idx == 1);
+    FAIL_IF_NOT(p->vlan_id[0] == 100);
+    FAIL_IF_NOT(PKT_IS_IPV4(p));
+    FAIL_IF_NOT(PKT_IS_TCP(p));
+    FAIL_IF_NOT(p->proto == IPPROTO_TCP);
+    FAIL_IF_NOT(p->sp == 1024 && p->dp == 80);
+    FAIL_IF_NOT(p->payload_len == 4);
+
+    SCFree(p);
+    PASS;
+}
+
+/**
+ * Test that IPv4 options and fragments are left to the full decoders.
+ */
+static int DecodeEthernetTestFastPath02(void)
+{
+    uint8_t raw_eth[] = {
+        0x00, 0x10, 0x94, 0x55, 0x00, 0x01, 0x00, 0x10,
+        0x94, 0x56, 0x00, 0x01, 0x08, 0x00,
+        /* IPv4 with 4 bytes of NOP options */
+        0x46, 0x00, 0x00, 0x2c, 0x00, 0x01, 0x40, 0x00,
+        0x40, 0x06, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02, 0x01, 0x01, 0x01, 0x01,
+        /* TCP 1024 -> 80 PSH ACK */
+        0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x01, 0x50, 0x18, 0x20, 0x00,
+        0x00, 0x00, 0x00, 0x00,
+    };
+
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&tv,  0, sizeof(ThreadVars));
+    memset(p, 0, SIZE_OF_PACKET);
+
+    FAIL_IF(DecodeEthernetFast(&tv, &dtv, p, raw_eth, sizeof(raw_eth), NULL));
+    FAIL_IF_NOT_NULL(p->ethh);
+
+    /* same result through the full decoders */
+    DecodeEthernet(&tv, &dtv, p, raw_eth, sizeof(raw_eth), NULL);
+    FAIL_IF(p->flags & PKT_IS_INVALID);
+    FAIL_IF_NOT(PKT_IS_TCP(p));
+    FAIL_IF_NOT(p->sp == 1024 && p->dp == 80);
+
+    /* MF flag set */
+    raw_eth[14] = 0x45;
+    raw_eth[20] = 0x20;
+    memset(p, 0, SIZE_OF_PACKET);
+    FAIL_IF(DecodeEthernetFast(&tv, &dtv, p, raw_eth, sizeof(raw_eth), NULL));
+
+    SCFree(p);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 
@@ -225,6 +421,10 @@ void DecodeEthernetRegisterTests(void)
             DecodeEthernetTestDceNextTooSmall);
     UtRegisterTest("DecodeEthernetTestDceTooSmall",
             DecodeEthernetTestDceTooSmall);
+    UtRegisterTest("DecodeEthernetTestFastPath01",
+            DecodeEthernetTestFastPath01);
+    UtRegisterTest("DecodeEthernetTestFastPath02",
+            DecodeEthernetTestFastPath02);
 #endif /* UNITTESTS */
 }
 /**
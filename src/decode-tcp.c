@@ -203,6 +203,9 @@ static int DecodeTCPPacket(ThreadVars *tv, Packet *p, const uint8_t *pkt, uint16
     }
 
     p->tcph = (TCPHdr *)pkt;
+    /* checksum verified by the NIC, no need to compute it */
+    if (p->flags & PKT_L4_CSUM_VALID)
+        p->level4_comp_csum = 0;
 
     uint8_t hlen = TCP_GET_HLEN(p);
     if (unlikely(len < hlen)) {
@@ -49,6 +49,9 @@ static int DecodeUDPPacket(ThreadVars *t, Packet *p, const uint8_t *pkt, uint16_
     }
 
     p->udph = (UDPHdr *)pkt;
+    /* checksum verified by the NIC, no need to compute it */
+    if (p->flags & PKT_L4_CSUM_VALID)
+        p->level4_comp_csum = 0;
 
     if (unlikely(len < UDP_GET_LEN(p))) {
         ENGINE_SET_INVALID_EVENT(p, UDP_PKT_TOO_SMALL);
@@ -93,11 +96,14 @@ int DecodeUDP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
     }
 
     /* Handle VXLAN if configured */
+    const uint8_t recursion_level = p->recursion_level;
     if (DecodeVXLANEnabledForPort(p->sp, p->dp) &&
             unlikely(DecodeVXLAN(tv, dtv, p, p->payload, p->payload_len, pq) == TM_ECODE_OK)) {
         /* Here we have a VXLAN packet and don't need to handle app
-         * layer */
-        FlowSetupPacket(p);
+         * layer. If it was decoded in place, the packet is now the
+         * inner one and its decoders did the flow setup. */
+        if (p->recursion_level == recursion_level)
+            FlowSetupPacket(p);
         return TM_ECODE_OK;
     }
 
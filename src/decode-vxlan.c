@@ -44,6 +44,8 @@
 #define VXLAN_DEFAULT_PORT_S    "4789"
 
 static bool g_vxlan_enabled = true;
+/* decode the inner packet in the outer one instead of a pseudo packet */
+static bool g_vxlan_in_place = false;
 static int g_vxlan_ports[4] = { VXLAN_DEFAULT_PORT, -1, -1, -1 };
 static int g_vxlan_ports_idx = 0;
 
@@ -96,6 +98,14 @@ void DecodeVXLANConfig(void)
         }
     }
 
+    if (ConfGetBool("decoder.vxlan.in-place", &enabled) == 1) {
+        g_vxlan_in_place = enabled ? true : false;
+        if (g_vxlan_in_place) {
+            SCLogConfig("VXLAN packets are decoded in place, the outer "
+                    "headers are not inspected");
+        }
+    }
+
     if (g_vxlan_enabled) {
         ConfNode *node = ConfGetNode("decoder.vxlan.ports");
         if (node && node->val) {
@@ -143,36 +153,40 @@ int DecodeVXLAN(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
     SCLogDebug("VXLAN ethertype 0x%04x", SCNtohs(ethh->eth_type));
 
     /* Best guess at inner packet. */
+    enum DecodeTunnelProto proto;
     switch (SCNtohs(ethh->eth_type)) {
         case ETHERNET_TYPE_ARP:
             SCLogDebug("VXLAN found ARP");
-            break;
+            return TM_ECODE_OK;
         case ETHERNET_TYPE_IP:
             SCLogDebug("VXLAN found IPv4");
-            if (pq != NULL) {
-                Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + VXLAN_HEADER_LEN + ETHERNET_HEADER_LEN,
-                        len - (VXLAN_HEADER_LEN + ETHERNET_HEADER_LEN), DECODE_TUNNEL_IPV4, pq);
-                if (tp != NULL) {
-                    PKT_SET_SRC(tp, PKT_SRC_DECODER_VXLAN);
-                    PacketEnqueue(pq, tp);
-                }
-            }
+            proto = DECODE_TUNNEL_IPV4;
             break;
         case ETHERNET_TYPE_IPV6:
             SCLogDebug("VXLAN found IPv6");
-            if (pq != NULL) {
-                Packet *tp = PacketTunnelPktSetup(tv, dtv, p, pkt + VXLAN_HEADER_LEN + ETHERNET_HEADER_LEN,
-                        len - (VXLAN_HEADER_LEN + ETHERNET_HEADER_LEN), DECODE_TUNNEL_IPV6, pq);
-                if (tp != NULL) {
-                    PKT_SET_SRC(tp, PKT_SRC_DECODER_VXLAN);
-                    PacketEnqueue(pq, tp);
-                }
-            }
+            proto = DECODE_TUNNEL_IPV6;
             break;
         default:
             SCLogDebug("VXLAN found no known Ethertype - only checks for IPv4, IPv6, ARP");
             /* ENGINE_SET_INVALID_EVENT(p, VXLAN_UNKNOWN_PAYLOAD_TYPE);*/
-            break;
+            return TM_ECODE_OK;
+    }
+
+    const uint8_t *inner = pkt + VXLAN_HEADER_LEN + ETHERNET_HEADER_LEN;
+    const uint32_t inner_len = len - (VXLAN_HEADER_LEN + ETHERNET_HEADER_LEN);
+
+    /* an inner packet that can't be decoded in place goes in a pseudo
+     * packet, the outer packet is then inspected as without in-place */
+    if (g_vxlan_in_place &&
+            PacketTunnelDecodeInPlace(tv, dtv, p, inner, inner_len, proto, pq) == TM_ECODE_OK) {
+        return TM_ECODE_OK;
+    }
+    if (pq != NULL) {
+        Packet *tp = PacketTunnelPktSetup(tv, dtv, p, inner, inner_len, proto, pq);
+        if (tp != NULL) {
+            PKT_SET_SRC(tp, PKT_SRC_DECODER_VXLAN);
+            PacketEnqueue(pq, tp);
+        }
     }
 
     return TM_ECODE_OK;
@@ -263,6 +277,126 @@ static int DecodeVXLANtest02 (void)
     PacketFree(p);
     PASS;
 }
+
+/**
+ * \test in place decoding: no pseudo packet, the packet is the inner one
+ */
+static int DecodeVXLANtest03 (void)
+{
+    uint8_t raw_vxlan[] = {
+        0x12, 0xb5, 0x12, 0xb5, 0x00, 0x3a, 0x87, 0x51, /* UDP header */
+        0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x25, 0x00, /* VXLAN header */
+        0x10, 0x00, 0x00, 0x0c, 0x01, 0x00, /* inner destination MAC */
+        0x00, 0x51, 0x52, 0xb3, 0x54, 0xe5, /* inner source MAC */
+        0x08, 0x00, /* another IPv4 0x0800 */
+        0x45, 0x00, 0x00, 0x1c, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11,
+        0x44, 0x45, 0x0a, 0x60, 0x00, 0x0a, 0xb9, 0x1b, 0x73, 0x06,  /* IPv4 hdr */
+        0x00, 0x35, 0x30, 0x39, 0x00, 0x08, 0x98, 0xe4 /* UDP probe src port 53 */
+    };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+
+    DecodeVXLANConfigPorts("4789");
+    g_vxlan_in_place = true;
+
+    memset(&pq, 0, sizeof(PacketQueue));
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(p, 0, SIZE_OF_PACKET);
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+
+    FlowInitConfig(FLOW_QUIET);
+    DecodeUDP(&tv, &dtv, p, raw_vxlan, sizeof(raw_vxlan), &pq);
+    g_vxlan_in_place = false;
+
+    FAIL_IF(pq.top != NULL);
+    FAIL_IF(p->flags & PKT_TUNNEL);
+    FAIL_IF_NULL(p->ip4h);
+    FAIL_IF_NULL(p->udph);
+    FAIL_IF_NOT(p->udph == (UDPHdr *)(raw_vxlan + 50));
+    FAIL_IF_NOT(p->sp == 53);
+    FAIL_IF_NOT(p->recursion_level == 1);
+    FAIL_IF_NOT(p->flags & PKT_WANTS_FLOW);
+
+    FlowShutdown();
+    PacketFree(p);
+    PASS;
+}
+
+/**
+ * \test in place decoding of inner packets the IP decoder refuses, or
+ *       with IPv4 options: the outer packet is kept
+ */
+static int DecodeVXLANtest04 (void)
+{
+    uint8_t raw_vxlan[] = {
+        0x12, 0xb5, 0x12, 0xb5, 0x00, 0x3a, 0x87, 0x51, /* UDP header */
+        0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x25, 0x00, /* VXLAN header */
+        0x10, 0x00, 0x00, 0x0c, 0x01, 0x00, /* inner destination MAC */
+        0x00, 0x51, 0x52, 0xb3, 0x54, 0xe5, /* inner source MAC */
+        0x08, 0x00, /* another IPv4 0x0800 */
+        0x45, 0x00, 0x00, 0x30, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11,
+        0x44, 0x45, 0x0a, 0x60, 0x00, 0x0a, 0xb9, 0x1b, 0x73, 0x06,  /* IPv4 hdr, length past the end */
+        0x00, 0x35, 0x30, 0x39, 0x00, 0x08, 0x98, 0xe4 /* UDP probe src port 53 */
+    };
+    uint8_t raw_vxlan_opts[] = {
+        0x12, 0xb5, 0x12, 0xb5, 0x00, 0x3e, 0x87, 0x51, /* UDP header */
+        0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x25, 0x00, /* VXLAN header */
+        0x10, 0x00, 0x00, 0x0c, 0x01, 0x00, /* inner destination MAC */
+        0x00, 0x51, 0x52, 0xb3, 0x54, 0xe5, /* inner source MAC */
+        0x08, 0x00, /* another IPv4 0x0800 */
+        0x46, 0x00, 0x00, 0x20, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11,
+        0x44, 0x45, 0x0a, 0x60, 0x00, 0x0a, 0xb9, 0x1b, 0x73, 0x06,  /* IPv4 hdr */
+        0x01, 0x01, 0x01, 0x00, /* IPv4 options: NOP NOP NOP EOL */
+        0x00, 0x35, 0x30, 0x39, 0x00, 0x08, 0x98, 0xe4 /* UDP probe src port 53 */
+    };
+    Packet *p = PacketGetFromAlloc();
+    FAIL_IF_NULL(p);
+    Packet *p2 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p2);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    PacketQueue pq2;
+
+    DecodeVXLANConfigPorts("4789");
+    g_vxlan_in_place = true;
+
+    memset(&pq, 0, sizeof(PacketQueue));
+    memset(&pq2, 0, sizeof(PacketQueue));
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(p, 0, SIZE_OF_PACKET);
+    memset(p2, 0, SIZE_OF_PACKET);
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+
+    FlowInitConfig(FLOW_QUIET);
+    DecodeUDP(&tv, &dtv, p, raw_vxlan, sizeof(raw_vxlan), &pq);
+    DecodeUDP(&tv, &dtv, p2, raw_vxlan_opts, sizeof(raw_vxlan_opts), &pq2);
+    g_vxlan_in_place = false;
+
+    /* truncated: no inner packet, the outer one is untouched */
+    FAIL_IF(pq.top != NULL);
+    FAIL_IF_NOT(p->udph == (UDPHdr *)raw_vxlan);
+    FAIL_IF_NOT(p->sp == 4789);
+    FAIL_IF_NOT(p->recursion_level == 0);
+    FAIL_IF(p->flags & PKT_IS_INVALID);
+
+    /* options: decoded in a pseudo packet */
+    FAIL_IF_NOT(p2->udph == (UDPHdr *)raw_vxlan_opts);
+    FAIL_IF_NOT(p2->recursion_level == 0);
+    FAIL_IF(pq2.top == NULL);
+    Packet *tp = PacketDequeue(&pq2);
+    FAIL_IF_NULL(tp->udph);
+    FAIL_IF_NOT(tp->sp == 53);
+
+    FlowShutdown();
+    PacketFree(p);
+    PacketFree(p2);
+    PacketFree(tp);
+    PASS;
+}
 #endif /* UNITTESTS */
 
 void DecodeVXLANRegisterTests(void)
@@ -272,5 +406,9 @@ void DecodeVXLANRegisterTests(void)
                    DecodeVXLANtest01);
     UtRegisterTest("DecodeVXLANtest02",
                    DecodeVXLANtest02);
+    UtRegisterTest("DecodeVXLANtest03",
+                   DecodeVXLANtest03);
+    UtRegisterTest("DecodeVXLANtest04",
+                   DecodeVXLANtest04);
 #endif /* UNITTESTS */
 }
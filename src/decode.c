@@ -67,6 +67,7 @@
 #include "output.h"
 #include "output-flow.h"
 #include "flow-storage.h"
+#include "util-validate.h"
 
 uint32_t default_packet_size = 0;
 extern bool stats_decoder_events;
@@ -335,6 +336,102 @@ Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *pare
     SCReturnPtr(p, "Packet");
 }
 
+/**
+ *  \internal
+ *  \brief Check that the IP decoder will accept a tunneled packet
+ *
+ *  Same checks as DecodeIPV4Packet() and DecodeIPV6Packet(). IPv4
+ *  options are not checked here, so headers with options are refused.
+ */
+static bool PacketTunnelInPlaceValid(const uint8_t *pkt, uint32_t len,
+                                     enum DecodeTunnelProto proto)
+{
+    if (len > UINT16_MAX)
+        return false;
+
+    switch (proto) {
+        case DECODE_TUNNEL_IPV4: {
+            if (len < IPV4_HEADER_LEN || IP_GET_RAW_VER(pkt) != 4)
+                return false;
+            const IPV4Hdr *ip4h = (const IPV4Hdr *)pkt;
+            const uint16_t iplen = SCNtohs(IPV4_GET_RAW_IPLEN(ip4h));
+            return (IPV4_GET_RAW_HLEN(ip4h) << 2) == IPV4_HEADER_LEN &&
+                   iplen >= IPV4_HEADER_LEN && iplen <= len;
+        }
+        case DECODE_TUNNEL_IPV6:
+        case DECODE_TUNNEL_IPV6_TEREDO: {
+            if (len < IPV6_HEADER_LEN || IP_GET_RAW_VER(pkt) != 6)
+                return false;
+            const IPV6Hdr *ip6h = (const IPV6Hdr *)pkt;
+            return IPV6_HEADER_LEN + IPV6_GET_RAW_PLEN(ip6h) <= len;
+        }
+        default:
+            return false;
+    }
+}
+
+/**
+ *  \brief Decode a tunneled packet in place of its outer packet
+ *
+ *  Instead of a pseudo packet with a copy of the inner data, the outer
+ *  L3/L4 headers of the packet are forgotten and the inner headers are
+ *  decoded as pointers into the same buffer. The packet then goes
+ *  through the engine as the inner packet only, so the verdict on it
+ *  applies to the whole frame.
+ *
+ *  The layer fields are reset like for a new pseudo packet so the
+ *  inner packet maps to the same flow in both modes.
+ *
+ *  The inner IP header is checked first, so a packet that the IP
+ *  decoders would refuse leaves the outer packet as it was.
+ *
+ *  \param p packet, its data has to contain pkt
+ *  \param pkt start of the tunneled packet
+ *  \param len tunneled packet length
+ *  \param proto protocol of the tunneled packet, IPv4 or IPv6
+ *
+ *  \retval TM_ECODE_OK the packet is now the inner packet
+ *  \retval TM_ECODE_FAILED not decoded, the packet is unchanged and
+ *          the caller can use a pseudo packet instead
+ */
+int PacketTunnelDecodeInPlace(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+                              const uint8_t *pkt, uint32_t len, enum DecodeTunnelProto proto,
+                              PacketQueue *pq)
+{
+    if (!PacketTunnelInPlaceValid(pkt, len, proto)) {
+        SCLogDebug("inner packet can't be decoded in place");
+        return TM_ECODE_FAILED;
+    }
+
+    CLEAR_IPV4_PACKET(p);
+    CLEAR_IPV6_PACKET(p);
+    CLEAR_TCP_PACKET(p);
+    CLEAR_UDP_PACKET(p);
+    CLEAR_ICMPV4_PACKET(p);
+    CLEAR_ICMPV6_PACKET(p);
+    CLEAR_SCTP_PACKET(p);
+    p->greh = NULL;
+    p->sp = 0;
+    p->dp = 0;
+    p->proto = 0;
+    p->payload = NULL;
+    p->payload_len = 0;
+    p->vlan_id[0] = 0;
+    p->vlan_id[1] = 0;
+    p->vlan_idx = 0;
+    p->recursion_level++;
+    /* the NIC only verified the outer checksum */
+    p->flags &= ~PKT_L4_CSUM_VALID;
+
+    if (DecodeTunnel(tv, dtv, p, pkt, len, pq, proto) != TM_ECODE_OK) {
+        /* not expected after the checks above, the outer headers are
+         * gone so keep the packet as an invalid inner packet */
+        DEBUG_VALIDATE_BUG_ON(1);
+        p->flags |= PKT_IS_INVALID;
+    }
+    return TM_ECODE_OK;
+}
+
 /**
  *  \brief Setup a pseudo packet (reassembled frags)
  *
@@ -65,6 +65,7 @@ enum PktSrcEnum {
 #include "source-pcap.h"
 #include "source-af-packet.h"
 #include "source-netmap.h"
+#include "source-af-xdp.h"
 #include "source-windivert.h"
 #ifdef HAVE_PF_RING_FLOW_OFFLOAD
 #include "source-pfring.h"
@@ -78,6 +79,7 @@ enum PktSrcEnum {
 #include "decode-ppp.h"
 #include "decode-pppoe.h"
 #include "decode-sll.h"
+#include "util-checksum-simd.h"
 #include "decode-ipv4.h"
 #include "decode-ipv6.h"
 #include "decode-icmpv4.h"
@@ -468,6 +470,9 @@ typedef struct Packet_
 #ifdef HAVE_NETMAP
         NetmapPacketVars netmap_v;
 #endif
+#ifdef HAVE_AF_XDP
+        AFXDPPacketVars afxdp_v;
+#endif
 #ifdef HAVE_PFRING
 #ifdef HAVE_PF_RING_FLOW_OFFLOAD
         PfringPacketVars pfring_v;
@@ -900,6 +905,9 @@ enum DecodeTunnelProto {
 
 Packet *PacketTunnelPktSetup(ThreadVars *tv, DecodeThreadVars *dtv, Packet *parent,
                              const uint8_t *pkt, uint32_t len, enum DecodeTunnelProto proto, PacketQueue *pq);
+int PacketTunnelDecodeInPlace(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+                              const uint8_t *pkt, uint32_t len, enum DecodeTunnelProto proto,
+                              PacketQueue *pq);
 Packet *PacketDefragPktSetup(Packet *parent, const uint8_t *pkt, uint32_t len, uint8_t proto);
 void PacketDefragPktSetupParent(Packet *parent);
 void DecodeRegisterPerfCounters(DecodeThreadVars *, ThreadVars *);
@@ -1131,6 +1139,9 @@ void DecodeUnregisterCounters(void);
  *  so flag it for not setting stream events */
 #define PKT_STREAM_NO_EVENTS            (1<<28)
 
+/** TCP/UDP checksum of the packet was verified by the capture hardware */
+#define PKT_L4_CSUM_VALID               (1<<29)
+
 /** \brief return 1 if the packet is a pseudo packet */
 #define PKT_IS_PSEUDOPKT(p) \
     ((p)->flags & (PKT_PSEUDO_STREAM_END|PKT_PSEUDO_DETECTLOG_FLUSH))
@@ -34,6 +34,8 @@
 #include "detect-flow.h"
 #include "detect-flowbits.h"
 
+#include "app-layer-parser.h"
+
 #include "util-profiling.h"
 
 void SigCleanSignatures(DetectEngineCtx *de_ctx)
@@ -1864,6 +1866,41 @@ static int SigMatchPrepare(DetectEngineCtx *de_ctx)
     SCReturnInt(0);
 }
 
+/** \internal
+ *  \brief tell the app-layer which protocols the rules need parsed
+ *
+ *  Used by app-layer.parse-depth 'need'. Flows of other protocols are
+ *  only parsed until the first transaction. If only app-layer and ip-only
+ *  rules are loaded such flows don't need inspection after that either,
+ *  so they are made bypass ready. The needs are published to the app-layer
+ *  when the engine is added to the master.
+ */
+static void SigGroupBuildAppLayerNeeds(DetectEngineCtx *de_ctx)
+{
+    uint64_t needs = 0;
+    const Signature *s;
+
+    for (s = de_ctx->sig_list; s != NULL; s = s->next) {
+        if (s->alproto != ALPROTO_UNKNOWN) {
+            needs |= APP_LAYER_NEED_PROTO(s->alproto);
+        } else if (s->flags & SIG_FLAG_APPLAYER) {
+            /* app-layer rule for any protocol, e.g. app-layer-event */
+            needs = ~0ULL;
+            break;
+        } else if (!(s->flags & SIG_FLAG_IPONLY)) {
+            needs |= APP_LAYER_NEED_INSPECTION;
+        }
+    }
+
+    /* protocols parsed as part of another */
+    if (needs & APP_LAYER_NEED_PROTO(ALPROTO_DCERPC))
+        needs |= APP_LAYER_NEED_PROTO(ALPROTO_SMB);
+    if (needs & APP_LAYER_NEED_PROTO(ALPROTO_FTPDATA))
+        needs |= APP_LAYER_NEED_PROTO(ALPROTO_FTP);
+
+    de_ctx->alproto_needs = needs;
+}
+
 /**
  * \brief Convert the signature list into the runtime match structure.
  *
@@ -1940,6 +1977,7 @@ int SigGroupBuild(DetectEngineCtx *de_ctx)
 
     if (!DetectEngineMultiTenantEnabled()) {
         VarNameStoreActivateStaging();
+        SigGroupBuildAppLayerNeeds(de_ctx);
     }
     return 0;
 }
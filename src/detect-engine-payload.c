@@ -51,12 +51,22 @@
 struct StreamMpmData {
     DetectEngineThreadCtx *det_ctx;
     const MpmCtx *mpm_ctx;
+    MpmStreamState *sstate;
 };
 
-static int StreamMpmFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
+static int StreamMpmFunc(void *cb_data,
+        const uint8_t *data, const uint32_t data_len, const uint64_t offset)
 {
     struct StreamMpmData *smd = cb_data;
-    if (data_len >= smd->mpm_ctx->minlen) {
+    if (smd->sstate != NULL) {
+#ifdef DEBUG
+        smd->det_ctx->stream_mpm_cnt++;
+        smd->det_ctx->stream_mpm_size += data_len;
+#endif
+        (void)MpmStreamSearch(smd->mpm_ctx,
+                &smd->det_ctx->mtcs, &smd->det_ctx->pmq,
+                smd->sstate, data, data_len, offset);
+    } else if (data_len >= smd->mpm_ctx->minlen) {
 #ifdef DEBUG
         smd->det_ctx->stream_mpm_cnt++;
         smd->det_ctx->stream_mpm_size += data_len;
@@ -68,6 +78,42 @@ static int StreamMpmFunc(void *cb_data, const uint8_t *data, const uint32_t data
     return 0;
 }
 
+/** \internal
+ *  \brief get the resumable mpm state for the packet's stream direction
+ *
+ *  The state is allocated on first use and accounted against the stream
+ *  memcap. It's freed with the stream in StreamTcpStreamCleanup().
+ *
+ *  \retval sstate state or NULL if resuming is disabled or unavailable
+ */
+static MpmStreamState *StreamMpmGetState(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const MpmCtx *mpm_ctx)
+{
+    if (!det_ctx->de_ctx->stream_mpm_resume || !MpmCanSearchStream(mpm_ctx))
+        return NULL;
+
+    TcpSession *ssn = (TcpSession *)p->flow->protoctx;
+    TcpStream *stream = PKT_IS_TOSERVER(p) ? &ssn->client : &ssn->server;
+
+    MpmStreamState *sstate = stream->mpm_state;
+    if (sstate == NULL) {
+        if (StreamTcpCheckMemcap((uint64_t)sizeof(MpmStreamState)) == 0)
+            return NULL;
+        sstate = SCMalloc(sizeof(MpmStreamState));
+        if (unlikely(sstate == NULL))
+            return NULL;
+        StreamTcpIncrMemuse((uint64_t)sizeof(MpmStreamState));
+        MpmStreamStateReset(sstate, NULL, det_ctx->de_ctx->version, 0);
+        stream->mpm_state = sstate;
+    }
+
+    /* state built by another detect engine is useless, force a reset */
+    if (sstate->de_version != det_ctx->de_ctx->version) {
+        MpmStreamStateReset(sstate, NULL, det_ctx->de_ctx->version, 0);
+    }
+    return sstate;
+}
+
 static void PrefilterPktStream(DetectEngineThreadCtx *det_ctx,
         Packet *p, const void *pectx)
 {
@@ -79,7 +125,8 @@ static void PrefilterPktStream(DetectEngineThreadCtx *det_ctx,
     if (p->flags & PKT_DETECT_HAS_STREAMDATA) {
         SCLogDebug("PRE det_ctx->raw_stream_progress %"PRIu64,
                 det_ctx->raw_stream_progress);
-        struct StreamMpmData stream_mpm_data = { det_ctx, mpm_ctx };
+        struct StreamMpmData stream_mpm_data = { det_ctx, mpm_ctx,
+            StreamMpmGetState(det_ctx, p, mpm_ctx) };
         StreamReassembleRaw(p->flow->protoctx, p,
                 StreamMpmFunc, &stream_mpm_data,
                 &det_ctx->raw_stream_progress,
@@ -224,7 +271,8 @@ struct StreamContentInspectData {
     Flow *f;
 };
 
-static int StreamContentInspectFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
+static int StreamContentInspectFunc(void *cb_data,
+        const uint8_t *data, const uint32_t data_len, const uint64_t offset)
 {
     SCEnter();
     int r = 0;
@@ -282,7 +330,8 @@ struct StreamContentInspectEngineData {
     Flow *f;
 };
 
-static int StreamContentInspectEngineFunc(void *cb_data, const uint8_t *data, const uint32_t data_len)
+static int StreamContentInspectEngineFunc(void *cb_data,
+        const uint8_t *data, const uint32_t data_len, const uint64_t offset)
 {
     SCEnter();
     int r = 0;
@@ -2440,6 +2440,13 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
             break;
     }
 
+    int stream_resume = 0;
+    if (ConfGetBool("detect.prefilter.stream-resume", &stream_resume) == 1 &&
+            stream_resume) {
+        de_ctx->stream_mpm_resume = true;
+        SCLogConfig("prefilter: stream mpm resumes from per stream state");
+    }
+
     return 0;
 }
 
@@ -3935,6 +3942,33 @@ static int DetectEngineAddToList(DetectEngineCtx *instance)
     return 0;
 }
 
+/** \internal
+ *  \brief publish the app-layer protocols a new engine uses
+ *
+ *  If another engine is still active, e.g. during a reload, the needs
+ *  are added to the current ones. DetectEngineReload() sets the exact
+ *  needs once the threads run the new engine.
+ *
+ *  \note master lock must be held
+ */
+static void DetectEngineSetAppLayerNeeds(const DetectEngineCtx *de_ctx)
+{
+    if (!AppLayerParserParseByNeedEnabled() ||
+        DetectEngineMultiTenantEnabled() ||
+        de_ctx->type != DETECT_ENGINE_TYPE_NORMAL)
+        return;
+
+    bool merge = false;
+    const DetectEngineCtx *instance = g_master_de_ctx.list;
+    for ( ; instance != NULL; instance = instance->next) {
+        if (instance != de_ctx && instance->type == DETECT_ENGINE_TYPE_NORMAL) {
+            merge = true;
+            break;
+        }
+    }
+    AppLayerParserSetDetectNeeds(de_ctx->alproto_needs, merge);
+}
+
 int DetectEngineAddToMaster(DetectEngineCtx *de_ctx)
 {
     int r;
@@ -3947,6 +3981,7 @@ int DetectEngineAddToMaster(DetectEngineCtx *de_ctx)
     DetectEngineMasterCtx *master = &g_master_de_ctx;
     SCMutexLock(&master->lock);
     r = DetectEngineAddToList(de_ctx);
+    DetectEngineSetAppLayerNeeds(de_ctx);
     SCMutexUnlock(&master->lock);
     return r;
 }
@@ -4113,6 +4148,11 @@ int DetectEngineReload(const SCInstance *suri)
     DetectEngineReloadThreads(new_de_ctx);
     SCLogDebug("threads now run new_de_ctx %p", new_de_ctx);
 
+    /* old engine is no longer used, drop the protocols only it needed */
+    if (AppLayerParserParseByNeedEnabled()) {
+        AppLayerParserSetDetectNeeds(new_de_ctx->alproto_needs, false);
+    }
+
     /* walk free list, freeing the old_de_ctx */
     DetectEnginePruneFreeList();
 
@@ -4506,6 +4546,45 @@ static int DetectEngineTest09(void)
     return result;
 }
 
+/** \test app-layer protocols the rules need for parse-depth 'need' */
+static int DetectEngineTest10(void)
+{
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = DetectEngineAppendSig(de_ctx, "alert http any any -> any any "
+            "(content:\"/index\"; http_uri; sid:1;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert dcerpc any any -> any any (sid:2;)");
+    FAIL_IF_NULL(s);
+    s = DetectEngineAppendSig(de_ctx, "alert ip 1.2.3.4 any -> any any (sid:3;)");
+    FAIL_IF_NULL(s);
+    SigGroupBuild(de_ctx);
+
+    /* only app-layer and ip-only rules: unneeded protocols can be bypassed */
+    FAIL_IF_NOT(de_ctx->alproto_needs & APP_LAYER_NEED_PROTO(ALPROTO_HTTP));
+    FAIL_IF_NOT(de_ctx->alproto_needs & APP_LAYER_NEED_PROTO(ALPROTO_DCERPC));
+    FAIL_IF_NOT(de_ctx->alproto_needs & APP_LAYER_NEED_PROTO(ALPROTO_SMB));
+    FAIL_IF(de_ctx->alproto_needs & APP_LAYER_NEED_PROTO(ALPROTO_DNS));
+    FAIL_IF(de_ctx->alproto_needs & APP_LAYER_NEED_INSPECTION);
+    DetectEngineCtxFree(de_ctx);
+
+    /* raw content rule: flows still need inspection */
+    de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    de_ctx->flags |= DE_QUIET;
+    s = DetectEngineAppendSig(de_ctx, "alert tcp any any -> any 80 "
+            "(content:\"abc\"; sid:1;)");
+    FAIL_IF_NULL(s);
+    SigGroupBuild(de_ctx);
+
+    FAIL_IF_NOT(de_ctx->alproto_needs & APP_LAYER_NEED_INSPECTION);
+    FAIL_IF(de_ctx->alproto_needs & APP_LAYER_NEED_PROTO(ALPROTO_HTTP));
+    DetectEngineCtxFree(de_ctx);
+    PASS;
+}
+
 #endif
 
 void DetectEngineRegisterTests()
@@ -4517,6 +4596,7 @@ void DetectEngineRegisterTests()
     UtRegisterTest("DetectEngineTest04", DetectEngineTest04);
     UtRegisterTest("DetectEngineTest08", DetectEngineTest08);
     UtRegisterTest("DetectEngineTest09", DetectEngineTest09);
+    UtRegisterTest("DetectEngineTest10", DetectEngineTest10);
 #endif
     return;
 }
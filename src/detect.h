@@ -913,6 +913,9 @@ typedef struct DetectEngineCtx_ {
     /** are we useing just mpm or also other prefilters */
     enum DetectEnginePrefilterSetting prefilter_setting;
 
+    /** resume stream mpm from per stream state instead of rescanning */
+    bool stream_mpm_resume;
+
     HashListTable *dport_hash_table;
 
     DetectPort *tcp_whitelist;
@@ -956,6 +959,9 @@ typedef struct DetectEngineCtx_ {
     bool sm_types_prefilter[DETECT_TBLSIZE];
     bool sm_types_silent_error[DETECT_TBLSIZE];
 
+    /** APP_LAYER_NEED_* bits: app-layer protocols used by the rules */
+    uint64_t alproto_needs;
+
 } DetectEngineCtx;
 
 /* Engine groups profiles (low, medium, high, custom) */
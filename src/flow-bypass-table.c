@@ -0,0 +1,571 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Userspace bypass table for capture methods without a kernel bypass.
+ *
+ * When a flow is bypassed, its tuple is added to the table of the capture
+ * thread. The capture thread looks the raw frames up in the table before
+ * getting a Packet and drops the ones of bypassed flows, so they cost a
+ * hash probe instead of a decode and a flow lookup.
+ *
+ * The flow stays in the flow table in the capture bypassed state. The
+ * flow manager checks the counters of the entry through BypassUpdate and
+ * removes the entry when the flow saw no packets during the bypassed
+ * timeout.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "decode.h"
+#include "flow.h"
+#include "flow-storage.h"
+#include "flow-bypass-table.h"
+#include "util-device.h"
+#include "util-hash-lookup3.h"
+#include "util-unittest.h"
+
+/** \brief link between a flow and its table entry */
+typedef struct FlowBypassTableRef_ {
+    FlowBypassTable *t;
+    uint32_t idx;
+    uint32_t tag;
+    /* entry counters of the toserver direction */
+    uint8_t todst;
+    bool removed;
+} FlowBypassTableRef;
+
+FlowBypassTable *FlowBypassTableAlloc(uint32_t size)
+{
+    uint32_t tsize = FLOW_BYPASS_TABLE_PROBE;
+    while (tsize < size && tsize < (1U << 24)) {
+        tsize <<= 1;
+    }
+
+    FlowBypassTable *t = SCCalloc(1, sizeof(*t));
+    if (unlikely(t == NULL)) {
+        return NULL;
+    }
+    t->tags = SCCalloc(tsize, sizeof(uint32_t));
+    t->entries = SCCalloc(tsize, sizeof(FlowBypassTableEntry));
+    if (t->tags == NULL || t->entries == NULL) {
+        SCFree(t->tags);
+        SCFree(t->entries);
+        SCFree(t);
+        return NULL;
+    }
+    t->size = tsize;
+    t->mask = tsize - 1;
+    SC_ATOMIC_INIT(t->refs);
+    SC_ATOMIC_SET(t->refs, 1);
+    return t;
+}
+
+/** \brief drop a reference to the table, freeing it with the last one */
+void FlowBypassTableRelease(FlowBypassTable *t)
+{
+    if (t == NULL)
+        return;
+    if (SC_ATOMIC_SUB(t->refs, 1) != 0)
+        return;
+
+    SCFree(t->tags);
+    SCFree(t->entries);
+    SC_ATOMIC_DESTROY(t->refs);
+    SCFree(t);
+}
+
+/** \internal
+ *  \brief hash of the tuple, the same for both directions */
+static inline uint32_t FlowBypassTableHash(const FlowBypassTableKey *k)
+{
+    uint32_t a = k->src[0] ^ k->src[1] ^ k->src[2] ^ k->src[3];
+    uint32_t b = k->dst[0] ^ k->dst[1] ^ k->dst[2] ^ k->dst[3];
+    uint32_t words[4];
+
+    words[0] = a ^ b;
+    words[1] = a + b;
+    words[2] = (uint32_t)(k->sp ^ k->dp) | ((uint32_t)(uint16_t)(k->sp + k->dp) << 16);
+    words[3] = k->proto | ((uint32_t)(k->vlan_id[0] & 0x0fff) << 8) |
+               ((uint32_t)(k->vlan_id[1] & 0x0fff) << 20);
+
+    uint32_t h = hashword(words, 4, k->ipv6);
+    /* tag 0 marks a free slot */
+    return h ? h : 1;
+}
+
+/** \internal
+ *  \retval 0 same direction
+ *  \retval 1 other direction
+ *  \retval -1 no match */
+static inline int FlowBypassTableKeyCmp(const FlowBypassTableKey *e,
+                                        const FlowBypassTableKey *k)
+{
+    if (e->proto != k->proto || e->ipv6 != k->ipv6 ||
+            e->vlan_id[0] != k->vlan_id[0] || e->vlan_id[1] != k->vlan_id[1])
+        return -1;
+
+    if (e->sp == k->sp && e->dp == k->dp &&
+            memcmp(e->src, k->src, sizeof(e->src)) == 0 &&
+            memcmp(e->dst, k->dst, sizeof(e->dst)) == 0)
+        return 0;
+    if (e->sp == k->dp && e->dp == k->sp &&
+            memcmp(e->src, k->dst, sizeof(e->src)) == 0 &&
+            memcmp(e->dst, k->src, sizeof(e->dst)) == 0)
+        return 1;
+    return -1;
+}
+
+/** \internal
+ *  \brief take a free slot for the key
+ *
+ *  \retval 0 ok, idx and tag set
+ *  \retval -1 no free slot in the probe window */
+static int FlowBypassTableInsert(FlowBypassTable *t, const FlowBypassTableKey *k,
+                                 uint32_t *idx, uint32_t *tag)
+{
+    uint32_t h = FlowBypassTableHash(k);
+
+    for (uint32_t i = 0; i < FLOW_BYPASS_TABLE_PROBE; i++) {
+        uint32_t n = (h + i) & t->mask;
+        if (t->tags[n] != 0)
+            continue;
+
+        FlowBypassTableEntry *e = &t->entries[n];
+        e->key = *k;
+        SC_ATOMIC_SET(e->todstpkts, 0);
+        SC_ATOMIC_SET(e->tosrcpkts, 0);
+        SC_ATOMIC_SET(e->todstbytes, 0);
+        SC_ATOMIC_SET(e->tosrcbytes, 0);
+        /* publish the entry once it is complete */
+        if (!SCAtomicCompareAndSwap(&t->tags[n], 0, h))
+            continue;
+        *idx = n;
+        *tag = h;
+        return 0;
+    }
+    return -1;
+}
+
+static void FlowBypassTableRemove(FlowBypassTableRef *ref)
+{
+    if (ref->removed)
+        return;
+    (void)SCAtomicCompareAndSwap(&ref->t->tags[ref->idx], ref->tag, 0);
+    ref->removed = true;
+}
+
+/**
+ *  \brief match a raw ethernet frame against the table
+ *
+ *  Only frames the decoder would turn into a non fragmented TCP or UDP
+ *  packet with at most two VLAN layers are looked up.
+ *
+ *  \param vlan_id VLAN id the capture got out of band
+ *  \param vlan_valid true if vlan_id is set
+ *
+ *  \retval true the frame belongs to a bypassed flow and was accounted
+ */
+bool FlowBypassTableMatch(FlowBypassTable *t, const uint8_t *pkt, uint32_t len,
+                          uint16_t vlan_id, bool vlan_valid)
+{
+    const uint32_t pktlen = len;
+    FlowBypassTableKey k;
+    int vlan_idx = 0;
+
+    memset(&k, 0, sizeof(k));
+    if (vlan_valid) {
+        k.vlan_id[vlan_idx++] = vlan_id;
+    }
+
+    if (len < ETHERNET_HEADER_LEN)
+        return false;
+    uint16_t type = (pkt[12] << 8) | pkt[13];
+    pkt += ETHERNET_HEADER_LEN;
+    len -= ETHERNET_HEADER_LEN;
+
+    /* same VLAN types as DecodeEthernet() and DecodeVLAN() */
+    bool outer = true;
+    while (type == ETHERNET_TYPE_VLAN ||
+            (outer && type == ETHERNET_TYPE_8021QINQ) ||
+            (!outer && type == ETHERNET_TYPE_8021AD)) {
+        if (vlan_idx >= 2 || len < VLAN_HEADER_LEN)
+            return false;
+        k.vlan_id[vlan_idx++] = ((pkt[0] << 8) | pkt[1]) & 0x0fff;
+        type = (pkt[2] << 8) | pkt[3];
+        pkt += VLAN_HEADER_LEN;
+        len -= VLAN_HEADER_LEN;
+        outer = false;
+    }
+
+    const uint8_t *l4;
+    if (type == ETHERNET_TYPE_IP) {
+        if (len < IPV4_HEADER_LEN || (pkt[0] >> 4) != 4)
+            return false;
+        uint32_t hlen = (pkt[0] & 0x0f) << 2;
+        if (hlen < IPV4_HEADER_LEN || len < hlen + 4)
+            return false;
+        /* fragments go through defrag */
+        if ((((pkt[6] << 8) | pkt[7]) & 0x3fff) != 0)
+            return false;
+        k.proto = pkt[9];
+        memcpy(&k.src[0], pkt + 12, sizeof(uint32_t));
+        memcpy(&k.dst[0], pkt + 16, sizeof(uint32_t));
+        l4 = pkt + hlen;
+    } else if (type == ETHERNET_TYPE_IPV6) {
+        if (len < IPV6_HEADER_LEN + 4 || (pkt[0] >> 4) != 6)
+            return false;
+        k.proto = pkt[6];
+        memcpy(k.src, pkt + 8, sizeof(k.src));
+        memcpy(k.dst, pkt + 24, sizeof(k.dst));
+        k.ipv6 = 1;
+        l4 = pkt + IPV6_HEADER_LEN;
+    } else {
+        return false;
+    }
+    if (k.proto != IPPROTO_TCP && k.proto != IPPROTO_UDP)
+        return false;
+    k.sp = (l4[0] << 8) | l4[1];
+    k.dp = (l4[2] << 8) | l4[3];
+    /* like the flow hash, see FlowBypassTableAdd() */
+    k.vlan_id[0] &= g_vlan_mask;
+    k.vlan_id[1] &= g_vlan_mask;
+
+    uint32_t h = FlowBypassTableHash(&k);
+    for (uint32_t i = 0; i < FLOW_BYPASS_TABLE_PROBE; i++) {
+        uint32_t n = (h + i) & t->mask;
+        if (t->tags[n] != h)
+            continue;
+        FlowBypassTableEntry *e = &t->entries[n];
+        int dir = FlowBypassTableKeyCmp(&e->key, &k);
+        if (dir < 0)
+            continue;
+        if (dir == 0) {
+            (void)SC_ATOMIC_ADD(e->todstpkts, 1);
+            (void)SC_ATOMIC_ADD(e->todstbytes, pktlen);
+        } else {
+            (void)SC_ATOMIC_ADD(e->tosrcpkts, 1);
+            (void)SC_ATOMIC_ADD(e->tosrcbytes, pktlen);
+        }
+        return true;
+    }
+    return false;
+}
+
+#ifdef CAPTURE_OFFLOAD
+/** \internal
+ *  \brief flow manager callback, keeps the flow while the entry matches
+ *         packets and removes the entry otherwise */
+static bool FlowBypassTableUpdate(Flow *f, void *data, time_t tsec)
+{
+    FlowBypassTableRef *ref = (FlowBypassTableRef *)data;
+    if (ref == NULL || ref->removed) {
+        return false;
+    }
+    FlowBypassInfo *fc = FlowGetStorageById(f, GetFlowBypassInfoID());
+    if (fc == NULL) {
+        return false;
+    }
+
+    /* the key may be in the other direction than the flow */
+    FlowBypassTableEntry *e = &ref->t->entries[ref->idx];
+    uint64_t todst, tosrc, todstbytes, tosrcbytes;
+    if (ref->todst == 0) {
+        todst = SC_ATOMIC_GET(e->todstpkts);
+        tosrc = SC_ATOMIC_GET(e->tosrcpkts);
+        todstbytes = SC_ATOMIC_GET(e->todstbytes);
+        tosrcbytes = SC_ATOMIC_GET(e->tosrcbytes);
+    } else {
+        todst = SC_ATOMIC_GET(e->tosrcpkts);
+        tosrc = SC_ATOMIC_GET(e->todstpkts);
+        todstbytes = SC_ATOMIC_GET(e->tosrcbytes);
+        tosrcbytes = SC_ATOMIC_GET(e->todstbytes);
+    }
+    if (todst == fc->todstpktcnt && tosrc == fc->tosrcpktcnt) {
+        SCLogDebug("no activity, removing entry %u", ref->idx);
+        FlowBypassTableRemove(ref);
+        return false;
+    }
+
+    fc->todstpktcnt = todst;
+    fc->todstbytecnt = todstbytes;
+    fc->tosrcpktcnt = tosrc;
+    fc->tosrcbytecnt = tosrcbytes;
+    f->lastts.tv_sec = tsec;
+    return true;
+}
+
+static void FlowBypassTableFree(void *data)
+{
+    FlowBypassTableRef *ref = (FlowBypassTableRef *)data;
+    if (ref == NULL)
+        return;
+    FlowBypassTableRemove(ref);
+    FlowBypassTableRelease(ref->t);
+    SCFree(ref);
+}
+#endif /* CAPTURE_OFFLOAD */
+
+/**
+ *  \brief add the flow of a packet to the table
+ *
+ *  To be called from the BypassPacketsFlow callback of a capture, in
+ *  the capture thread owning the table.
+ *
+ *  \retval 1 the flow is bypassed by the table
+ *  \retval 0 the flow can't be added
+ */
+int FlowBypassTableAdd(FlowBypassTable *t, Packet *p)
+{
+#ifdef CAPTURE_OFFLOAD
+    if (t == NULL || p->flow == NULL) {
+        return 0;
+    }
+    /* the frames are only parsed up to the TCP or UDP ports. Packets
+     * decapsulated in place have no PKT_TUNNEL, only their recursion
+     * level tells they are not the outer frame. */
+    if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p)) || IS_TUNNEL_PKT(p) ||
+            p->recursion_level != 0) {
+        return 0;
+    }
+    FlowBypassInfo *fc = FlowGetStorageById(p->flow, GetFlowBypassInfoID());
+    if (fc == NULL) {
+        return 0;
+    }
+
+    FlowBypassTableKey k;
+    int family;
+    memset(&k, 0, sizeof(k));
+    if (PKT_IS_IPV4(p)) {
+        k.src[0] = GET_IPV4_SRC_ADDR_U32(p);
+        k.dst[0] = GET_IPV4_DST_ADDR_U32(p);
+        family = AF_INET;
+    } else if (PKT_IS_IPV6(p)) {
+        memcpy(k.src, GET_IPV6_SRC_ADDR(p), sizeof(k.src));
+        memcpy(k.dst, GET_IPV6_DST_ADDR(p), sizeof(k.dst));
+        k.ipv6 = 1;
+        family = AF_INET6;
+    } else {
+        return 0;
+    }
+    k.sp = p->sp;
+    k.dp = p->dp;
+    k.proto = p->proto;
+    /* g_vlan_mask sets the vlan_ids to 0 if vlan.use-for-tracking
+     * is disabled, the flow of the packet covers all vlans then */
+    k.vlan_id[0] = p->vlan_id[0] & g_vlan_mask;
+    k.vlan_id[1] = p->vlan_id[1] & g_vlan_mask;
+
+    FlowBypassTableRef *ref = SCCalloc(1, sizeof(*ref));
+    if (ref == NULL) {
+        LiveDevAddBypassFail(p->livedev, 1, family);
+        return 0;
+    }
+    if (FlowBypassTableInsert(t, &k, &ref->idx, &ref->tag) < 0) {
+        SCLogDebug("no room for the flow in the bypass table");
+        LiveDevAddBypassFail(p->livedev, 1, family);
+        SCFree(ref);
+        return 0;
+    }
+    ref->t = t;
+    ref->todst = PKT_IS_TOSERVER(p) ? 0 : 1;
+    (void)SC_ATOMIC_ADD(t->refs, 1);
+
+    fc->BypassUpdate = FlowBypassTableUpdate;
+    fc->BypassFree = FlowBypassTableFree;
+    fc->bypass_data = ref;
+
+    LiveDevAddBypassStats(p->livedev, 1, family);
+    LiveDevAddBypassSuccess(p->livedev, 1, family);
+    return 1;
+#else
+    return 0;
+#endif /* CAPTURE_OFFLOAD */
+}
+
+#ifdef UNITTESTS
+static const uint8_t bypass_table_frame[] = {
+    /* ethernet */
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x08, 0x00,
+    /* ipv4, 10.0.0.1 -> 10.0.0.2, tcp */
+    0x45, 0x00, 0x00, 0x28, 0x00, 0x01, 0x40, 0x00, 0x40, 0x06, 0x00, 0x00,
+    0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+    /* tcp, 1024 -> 80 */
+    0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x50, 0x10, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00,
+};
+
+static void FlowBypassTableTestKey(FlowBypassTableKey *k)
+{
+    memset(k, 0, sizeof(*k));
+    k->src[0] = htonl(0x0a000001);
+    k->dst[0] = htonl(0x0a000002);
+    k->sp = 1024;
+    k->dp = 80;
+    k->proto = IPPROTO_TCP;
+}
+
+/** \test entry matches the frames of both directions */
+static int FlowBypassTableTest01(void)
+{
+    FlowBypassTable *t = FlowBypassTableAlloc(16);
+    FAIL_IF_NULL(t);
+    FAIL_IF_NOT(t->size == 16);
+
+    uint8_t frame[sizeof(bypass_table_frame)];
+    memcpy(frame, bypass_table_frame, sizeof(frame));
+    FAIL_IF(FlowBypassTableMatch(t, frame, sizeof(frame), 0, false));
+
+    FlowBypassTableKey k;
+    FlowBypassTableTestKey(&k);
+    uint32_t idx, tag;
+    FAIL_IF(FlowBypassTableInsert(t, &k, &idx, &tag) != 0);
+
+    FAIL_IF_NOT(FlowBypassTableMatch(t, frame, sizeof(frame), 0, false));
+    FAIL_IF_NOT(SC_ATOMIC_GET(t->entries[idx].todstpkts) == 1);
+    FAIL_IF_NOT(SC_ATOMIC_GET(t->entries[idx].todstbytes) == sizeof(frame));
+
+    /* reply: swap addresses and ports */
+    uint8_t reply[sizeof(bypass_table_frame)];
+    memcpy(reply, frame, sizeof(reply));
+    memcpy(reply + 26, frame + 30, 4);
+    memcpy(reply + 30, frame + 26, 4);
+    memcpy(reply + 34, frame + 36, 2);
+    memcpy(reply + 36, frame + 34, 2);
+    FAIL_IF_NOT(FlowBypassTableMatch(t, reply, sizeof(reply), 0, false));
+    FAIL_IF_NOT(SC_ATOMIC_GET(t->entries[idx].tosrcpkts) == 1);
+    FAIL_IF_NOT(SC_ATOMIC_GET(t->entries[idx].tosrcbytes) == sizeof(reply));
+
+    /* other port */
+    frame[37] = 0x51;
+    FAIL_IF(FlowBypassTableMatch(t, frame, sizeof(frame), 0, false));
+    frame[37] = 0x50;
+
+    /* fragment */
+    frame[20] = 0x20;
+    FAIL_IF(FlowBypassTableMatch(t, frame, sizeof(frame), 0, false));
+    frame[20] = 0x40;
+
+    /* vlan from the capture header is part of the key */
+    FAIL_IF(FlowBypassTableMatch(t, frame, sizeof(frame), 10, true));
+
+    FlowBypassTableRelease(t);
+    PASS;
+}
+
+/** \test vlan tagged frame and removed entry */
+static int FlowBypassTableTest02(void)
+{
+    FlowBypassTable *t = FlowBypassTableAlloc(16);
+    FAIL_IF_NULL(t);
+
+    uint8_t frame[sizeof(bypass_table_frame) + VLAN_HEADER_LEN];
+    memcpy(frame, bypass_table_frame, 12);
+    const uint8_t vlan[] = { 0x81, 0x00, 0x00, 0x0a, 0x08, 0x00 };
+    memcpy(frame + 12, vlan, sizeof(vlan));
+    memcpy(frame + 18, bypass_table_frame + 14, sizeof(bypass_table_frame) - 14);
+
+    FlowBypassTableKey k;
+    FlowBypassTableTestKey(&k);
+    k.vlan_id[0] = 10;
+    FlowBypassTableRef ref;
+    memset(&ref, 0, sizeof(ref));
+    ref.t = t;
+    FAIL_IF(FlowBypassTableInsert(t, &k, &ref.idx, &ref.tag) != 0);
+
+    FAIL_IF_NOT(FlowBypassTableMatch(t, frame, sizeof(frame), 0, false));
+    FAIL_IF(FlowBypassTableMatch(t, bypass_table_frame,
+                sizeof(bypass_table_frame), 0, false));
+    /* same id given by the capture */
+    FAIL_IF_NOT(FlowBypassTableMatch(t, bypass_table_frame,
+                sizeof(bypass_table_frame), 10, true));
+
+    FlowBypassTableRemove(&ref);
+    FAIL_IF_NOT(t->tags[ref.idx] == 0);
+    FAIL_IF(FlowBypassTableMatch(t, frame, sizeof(frame), 0, false));
+
+    FlowBypassTableRelease(t);
+    PASS;
+}
+
+/** 	est vlan ids are not part of the key if not used for tracking */
+static int FlowBypassTableTest04(void)
+{
+    FlowBypassTable *t = FlowBypassTableAlloc(16);
+    FAIL_IF_NULL(t);
+    const uint16_t vlan_mask = g_vlan_mask;
+    g_vlan_mask = 0x0000;
+
+    uint8_t frame[sizeof(bypass_table_frame) + VLAN_HEADER_LEN];
+    memcpy(frame, bypass_table_frame, 12);
+    const uint8_t vlan[] = { 0x81, 0x00, 0x00, 0x0a, 0x08, 0x00 };
+    memcpy(frame + 12, vlan, sizeof(vlan));
+    memcpy(frame + 18, bypass_table_frame + 14, sizeof(bypass_table_frame) - 14);
+
+    /* as added for a packet of any vlan */
+    FlowBypassTableKey k;
+    FlowBypassTableTestKey(&k);
+    uint32_t idx, tag;
+    FAIL_IF(FlowBypassTableInsert(t, &k, &idx, &tag) != 0);
+
+    FAIL_IF_NOT(FlowBypassTableMatch(t, frame, sizeof(frame), 0, false));
+    FAIL_IF_NOT(FlowBypassTableMatch(t, bypass_table_frame,
+                sizeof(bypass_table_frame), 0, false));
+    FAIL_IF_NOT(FlowBypassTableMatch(t, bypass_table_frame,
+                sizeof(bypass_table_frame), 20, true));
+    FAIL_IF_NOT(FlowBypassTableMatch(t, frame, sizeof(frame), 20, true));
+    FAIL_IF_NOT(SC_ATOMIC_GET(t->entries[idx].todstpkts) == 4);
+
+    g_vlan_mask = vlan_mask;
+    FlowBypassTableRelease(t);
+    PASS;
+}
+
+/** \test table is full once the probe window is used */
+static int FlowBypassTableTest03(void)
+{
+    FlowBypassTable *t = FlowBypassTableAlloc(1);
+    FAIL_IF_NULL(t);
+    FAIL_IF_NOT(t->size == FLOW_BYPASS_TABLE_PROBE);
+
+    FlowBypassTableKey k;
+    FlowBypassTableTestKey(&k);
+    uint32_t idx, tag;
+    for (int i = 0; i < FLOW_BYPASS_TABLE_PROBE; i++) {
+        k.sp = 1024 + i;
+        FAIL_IF(FlowBypassTableInsert(t, &k, &idx, &tag) != 0);
+    }
+    k.sp = 2048;
+    FAIL_IF(FlowBypassTableInsert(t, &k, &idx, &tag) == 0);
+
+    FlowBypassTableRelease(t);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void FlowBypassTableRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowBypassTableTest01", FlowBypassTableTest01);
+    UtRegisterTest("FlowBypassTableTest02", FlowBypassTableTest02);
+    UtRegisterTest("FlowBypassTableTest03", FlowBypassTableTest03);
+    UtRegisterTest("FlowBypassTableTest04", FlowBypassTableTest04);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,80 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Userspace bypass table of a capture thread. Packets of bypassed
+ * flows are matched on the raw frame and released before decoding.
+ */
+
+#ifndef __FLOW_BYPASS_TABLE_H__
+#define __FLOW_BYPASS_TABLE_H__
+
+#define FLOW_BYPASS_TABLE_DEFAULT_SIZE  1024
+/** slots looked at for a flow, starting from its hash */
+#define FLOW_BYPASS_TABLE_PROBE         8
+
+typedef struct FlowBypassTableKey_ {
+    /* IPv4 addresses only use the first word */
+    uint32_t src[4];
+    uint32_t dst[4];
+    uint16_t sp;
+    uint16_t dp;
+    uint16_t vlan_id[2];
+    uint8_t proto;
+    uint8_t ipv6;
+} FlowBypassTableKey;
+
+typedef struct FlowBypassTableEntry_ {
+    FlowBypassTableKey key;
+    /* counters of the key's src to dst and dst to src directions. Only
+     * updated by the capture thread, the flow manager reads them to see
+     * activity */
+    SC_ATOMIC_DECLARE(uint64_t, todstpkts);
+    SC_ATOMIC_DECLARE(uint64_t, tosrcpkts);
+    SC_ATOMIC_DECLARE(uint64_t, todstbytes);
+    SC_ATOMIC_DECLARE(uint64_t, tosrcbytes);
+} FlowBypassTableEntry;
+
+/** \brief Bypass table owned by a capture thread
+ *
+ *  Only the capture thread adds entries and matches packets, so
+ *  the table can only be used when the capture thread also does the
+ *  flow handling (workers runmode). The flow manager clears the tag
+ *  of an entry when the flow times out. */
+typedef struct FlowBypassTable_ {
+    /* hash of the entry in use, 0 if the slot is free */
+    uint32_t *tags;
+    FlowBypassTableEntry *entries;
+    uint32_t size;
+    uint32_t mask;
+
+    /* capture thread and flows using the table */
+    SC_ATOMIC_DECLARE(uint32_t, refs);
+} FlowBypassTable;
+
+FlowBypassTable *FlowBypassTableAlloc(uint32_t size);
+void FlowBypassTableRelease(FlowBypassTable *t);
+
+int FlowBypassTableAdd(FlowBypassTable *t, Packet *p);
+bool FlowBypassTableMatch(FlowBypassTable *t, const uint8_t *pkt, uint32_t len,
+                          uint16_t vlan_id, bool vlan_valid);
+
+void FlowBypassTableRegisterTests(void);
+
+#endif /* __FLOW_BYPASS_TABLE_H__ */
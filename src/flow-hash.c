@@ -303,6 +303,12 @@ static inline bool CmpVlanIds(const uint16_t vlan_id1[2], const uint16_t vlan_id
            ((vlan_id1[1] ^ vlan_id2[1]) & g_vlan_mask) == 0;
 }
 
+static inline bool CmpLiveDevs(const struct LiveDevice_ *ld1,
+                               const struct LiveDevice_ *ld2)
+{
+    return !g_livedev_tracking || ld1 == ld2;
+}
+
 /* Since two or more flows can have the same hash key, we need to compare
  * the flow with the current packet or flow key. */
 static inline bool CmpFlowPacket(const Flow *f, const Packet *p)
@@ -314,7 +320,8 @@ static inline bool CmpFlowPacket(const Flow *f, const Packet *p)
     return CmpAddrsAndPorts(f_src, f_dst, f->sp, f->dp, p_src, p_dst, p->sp,
                             p->dp) && f->proto == p->proto &&
             f->recursion_level == p->recursion_level &&
-            CmpVlanIds(f->vlan_id, p->vlan_id);
+            CmpVlanIds(f->vlan_id, p->vlan_id) &&
+            CmpLiveDevs(f->livedev, p->livedev);
 }
 
 static inline bool CmpFlowKey(const Flow *f, const FlowKey *k)
@@ -352,7 +359,8 @@ static inline bool CmpFlowICMPPacket(const Flow *f, const Packet *p)
     return CmpAddrsAndICMPTypes(f_src, f_dst, f->icmp_s.type,
                 f->icmp_d.type, p_src, p_dst, p->icmp_s.type, p->icmp_d.type) &&
             f->proto == p->proto && f->recursion_level == p->recursion_level &&
-            CmpVlanIds(f->vlan_id, p->vlan_id);
+            CmpVlanIds(f->vlan_id, p->vlan_id) &&
+            CmpLiveDevs(f->livedev, p->livedev);
 }
 
 /**
@@ -378,7 +386,8 @@ static inline int FlowCompareICMPv4(Flow *f, const Packet *p)
                 f->proto == ICMPV4_GET_EMB_PROTO(p) &&
                 f->recursion_level == p->recursion_level &&
                 f->vlan_id[0] == p->vlan_id[0] &&
-                f->vlan_id[1] == p->vlan_id[1])
+                f->vlan_id[1] == p->vlan_id[1] &&
+                CmpLiveDevs(f->livedev, p->livedev))
         {
             return 1;
 
@@ -391,7 +400,8 @@ static inline int FlowCompareICMPv4(Flow *f, const Packet *p)
                 f->proto == ICMPV4_GET_EMB_PROTO(p) &&
                 f->recursion_level == p->recursion_level &&
                 f->vlan_id[0] == p->vlan_id[0] &&
-                f->vlan_id[1] == p->vlan_id[1])
+                f->vlan_id[1] == p->vlan_id[1] &&
+                CmpLiveDevs(f->livedev, p->livedev))
         {
             return 1;
         }
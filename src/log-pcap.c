@@ -28,6 +28,8 @@
 #include "suricata-common.h"
 #include "util-fmemopen.h"
 
+#include <sys/uio.h>
+
 #ifdef HAVE_LIBLZ4
 #include <lz4frame.h>
 #endif /* HAVE_LIBLZ4 */
@@ -58,6 +60,10 @@
 #include "util-misc.h"
 #include "util-cpu.h"
 #include "util-atomic.h"
+#include "util-privs.h"
+#include "util-hash.h"
+
+#include "runmodes.h"
 
 #include "source-pcap.h"
 
@@ -89,6 +95,15 @@
 
 #define PCAP_SNAPLEN                    262144
 
+/* async writer: buffers are aligned for O_DIRECT and large enough that
+ * a record never spans more than two of them */
+#define PCAP_LOG_ASYNC_ALIGN            4096
+#define PCAP_LOG_ASYNC_MIN_BUFFER       (512 * 1024)
+#define PCAP_LOG_ASYNC_DEFAULT_BUFFER   (1024 * 1024)
+#define PCAP_LOG_ASYNC_DEFAULT_BUFFERS  8
+#define PCAP_LOG_ASYNC_DEFAULT_FLUSH    1
+#define PCAP_LOG_ASYNC_MAX_IOV          64
+
 SC_ATOMIC_DECLARE(uint32_t, thread_cnt);
 
 typedef struct PcapFileName_ {
@@ -133,6 +148,153 @@ typedef struct PcapLogCompressionData_ {
     uint64_t bytes_in_block;
 } PcapLogCompressionData;
 
+/** record header as stored in the file. struct pcap_pkthdr holds a
+ *  struct timeval, so it can't be copied as is. */
+typedef struct PcapLogRecordHdr_ {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t caplen;
+    uint32_t len;
+} PcapLogRecordHdr;
+
+/* flow index written next to each pcap file as "<file>.idx":
+ * a PcapLogIndexHdr, the flows sorted by time of their first packet and
+ * the file offsets of the packet records of all flows. All fields are in
+ * host byte order. */
+#define PCAP_LOG_INDEX_MAGIC            "SCPCAPIX"
+#define PCAP_LOG_INDEX_VERSION          1
+#define PCAP_LOG_INDEX_SUFFIX           ".idx"
+#define PCAP_LOG_INDEX_HASH_SIZE        4096
+
+typedef struct PcapLogIndexHdr_ {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;        /**< sizeof(PcapLogIndexEntry) */
+    uint32_t linktype;
+    uint32_t pad;
+    uint64_t entry_cnt;
+    uint64_t offset_cnt;
+    uint64_t first_ts;          /**< usecs since the epoch */
+    uint64_t last_ts;
+} PcapLogIndexHdr;
+
+typedef struct PcapLogIndexEntry_ {
+    uint32_t flow_hash;
+    uint8_t ipver;              /**< 4 or 6 */
+    uint8_t proto;
+    uint16_t sp;
+    uint16_t dp;
+    uint16_t pad;
+    uint32_t src[4];            /**< flow addresses, network byte order */
+    uint32_t dst[4];
+    uint32_t pkts;
+    uint64_t first_ts;          /**< usecs since the epoch */
+    uint64_t last_ts;
+    uint64_t offsets_idx;       /**< first of pkts entries in the offsets */
+} PcapLogIndexEntry;
+
+/** flow of the index of the file being written */
+typedef struct PcapLogIndexFlow_ {
+    PcapLogIndexEntry e;
+    uint64_t *offsets;
+    uint32_t offsets_size;
+} PcapLogIndexFlow;
+
+typedef struct PcapLogIndex_ {
+    HashTable *ht;
+    PcapLogIndexFlow **flows;   /**< in order of the first packet */
+    uint32_t flow_cnt;
+    uint32_t flow_size;
+    uint64_t offset_cnt;
+    uint32_t linktype;
+} PcapLogIndex;
+
+/** indexed pcap file that can be searched by the extract command */
+typedef struct PcapLogIndexFile_ {
+    char *filename;             /**< pcap file */
+    uint64_t first_ts;
+    uint64_t last_ts;
+    TAILQ_ENTRY(PcapLogIndexFile_) next;
+} PcapLogIndexFile;
+
+static bool g_pcap_index_enabled = false;
+static SCMutex pcap_index_lock = SCMUTEX_INITIALIZER;
+static TAILQ_HEAD(, PcapLogIndexFile_) pcap_index_files =
+    TAILQ_HEAD_INITIALIZER(pcap_index_files);
+
+struct PcapLogAsync_;
+
+/** buffer of pcap data handed from a logging thread to a writer thread.
+ *  The writer opens, writes, closes and removes in that order. */
+typedef struct PcapLogBlock_ {
+    uint8_t *data;              /**< PCAP_LOG_ASYNC_ALIGN aligned */
+    uint32_t len;
+    char *open;                 /**< close the current file and open this one */
+    bool close;                 /**< close the file after writing the data */
+    char *remove;               /**< ring buffer: file to remove */
+    char *remove_dir;           /**< sguil dir to remove */
+    uint8_t *index;             /**< index to write after closing */
+    size_t index_len;
+    struct PcapLogAsync_ *owner;
+    TAILQ_ENTRY(PcapLogBlock_) next;
+} PcapLogBlock;
+
+typedef struct PcapLogWriter_ {
+    SCCtrlMutex mutex;
+    SCCtrlCondT cond;           /**< blocks were queued */
+    SCCtrlCondT done_cond;      /**< blocks were written and freed */
+    TAILQ_HEAD(, PcapLogBlock_) queue;
+    int running;                /**< else blocks are written inline */
+} PcapLogWriter;
+
+typedef struct PcapLogAsyncStats_ {
+    uint32_t thread_number;
+    uint64_t blocks;            /**< blocks handed to the writer */
+    uint64_t bytes;
+    uint64_t waits;             /**< waited for a free block */
+    uint64_t drops;             /**< packets dropped, no free block */
+    uint32_t queue_max;         /**< most blocks queued at once */
+    uint64_t write_errors;
+} PcapLogAsyncStats;
+
+/** async output state of a PcapLogData */
+typedef struct PcapLogAsync_ {
+    PcapLogWriter *writer;
+    /* free blocks and the queued count are protected by the writer's
+     * mutex */
+    TAILQ_HEAD(, PcapLogBlock_) free;
+    uint32_t queued;
+
+    /* logging side, protected like the rest of the PcapLogData */
+    PcapLogBlock *cur;          /**< block being filled */
+    time_t cur_ts;              /**< packet time of the first data in cur */
+    bool file_open;
+    uint64_t file_offset;       /**< offset of the next record */
+
+    /* writer side */
+    char *filename;
+    int fd;
+    bool direct;
+    bool error;                 /**< write error reported for this file */
+
+    PcapLogAsyncStats stats;
+} PcapLogAsync;
+
+/** async settings, shared by all pcap-log threads */
+static struct {
+    bool enabled;
+    bool direct;
+    /* wait for a free block instead of dropping packets */
+    bool wait;
+    uint32_t buffer_size;
+    uint32_t buffers;
+    uint32_t flush_interval;
+    int writer_cnt;
+    PcapLogWriter *writers;
+} g_pcap_async;
+
+static const char *thread_name_pcap_log = "PcapLogWriter";
+
 /**
  * PcapLog thread vars
  *
@@ -178,6 +340,12 @@ typedef struct PcapLogData_ {
     int filename_part_cnt;
 
     PcapLogCompressionData compression;
+
+    PcapLogIndex *index;        /**< flow index of the current file */
+    PcapLogAsync *async;        /**< set if written by the async writer */
+    /* per thread async stats, collected in the global at exit */
+    PcapLogAsyncStats *async_stats;
+    int async_stats_cnt;
 } PcapLogData;
 
 typedef struct PcapLogThreadData_ {
@@ -198,6 +366,7 @@ static int PcapLog(ThreadVars *, void *, const Packet *);
 static TmEcode PcapLogDataInit(ThreadVars *, const void *, void **);
 static TmEcode PcapLogDataDeinit(ThreadVars *, void *);
 static void PcapLogFileDeInitCtx(OutputCtx *);
+static void PcapLogDataFree(PcapLogData *);
 static OutputInitResult PcapLogInitCtx(ConfNode *);
 static void PcapLogProfilingDump(PcapLogData *);
 static int PcapLogCondition(ThreadVars *, const Packet *);
@@ -230,6 +399,817 @@ static int PcapLogCondition(ThreadVars *tv, const Packet *p)
     return TRUE;
 }
 
+static uint32_t PcapLogIndexHash(HashTable *ht, void *data, uint16_t len)
+{
+    const PcapLogIndexEntry *e = data;
+    return e->flow_hash % ht->array_size;
+}
+
+static char PcapLogIndexCompare(void *a, uint16_t alen, void *b, uint16_t blen)
+{
+    const PcapLogIndexEntry *e1 = a;
+    const PcapLogIndexEntry *e2 = b;
+    return e1->ipver == e2->ipver && e1->proto == e2->proto &&
+        e1->sp == e2->sp && e1->dp == e2->dp &&
+        memcmp(e1->src, e2->src, sizeof(e1->src)) == 0 &&
+        memcmp(e1->dst, e2->dst, sizeof(e1->dst)) == 0;
+}
+
+static void PcapLogIndexFlowFree(void *data)
+{
+    PcapLogIndexFlow *flow = data;
+    SCFree(flow->offsets);
+    SCFree(flow);
+}
+
+static PcapLogIndex *PcapLogIndexNew(void)
+{
+    PcapLogIndex *idx = SCCalloc(1, sizeof(*idx));
+    if (unlikely(idx == NULL))
+        return NULL;
+    idx->ht = HashTableInit(PCAP_LOG_INDEX_HASH_SIZE, PcapLogIndexHash,
+            PcapLogIndexCompare, PcapLogIndexFlowFree);
+    if (idx->ht == NULL) {
+        SCFree(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+static void PcapLogIndexReset(PcapLogIndex *idx)
+{
+    /* frees the flows */
+    HashTableFree(idx->ht);
+    idx->ht = HashTableInit(PCAP_LOG_INDEX_HASH_SIZE, PcapLogIndexHash,
+            PcapLogIndexCompare, PcapLogIndexFlowFree);
+    idx->flow_cnt = 0;
+    idx->offset_cnt = 0;
+}
+
+static void PcapLogIndexFree(PcapLogIndex *idx)
+{
+    if (idx->ht != NULL)
+        HashTableFree(idx->ht);
+    SCFree(idx->flows);
+    SCFree(idx);
+}
+
+/**
+ * \brief add the record of a packet at offset to the index of the file
+ *
+ * Packets without a flow are not indexed.
+ */
+static void PcapLogIndexAdd(PcapLogIndex *idx, const Packet *p, uint64_t offset)
+{
+    const Flow *f = p->flow;
+    if (f == NULL || idx->ht == NULL)
+        return;
+
+    PcapLogIndexEntry key;
+    memset(&key, 0, sizeof(key));
+    key.flow_hash = p->flow_hash;
+    key.ipver = FLOW_IS_IPV4(f) ? 4 : 6;
+    key.proto = f->proto;
+    key.sp = f->sp;
+    key.dp = f->dp;
+    memcpy(key.src, f->src.addr_data32, sizeof(key.src));
+    memcpy(key.dst, f->dst.addr_data32, sizeof(key.dst));
+
+    const uint64_t ts = (uint64_t)p->ts.tv_sec * 1000000 + p->ts.tv_usec;
+
+    PcapLogIndexFlow *flow = HashTableLookup(idx->ht, &key, sizeof(key));
+    if (flow == NULL) {
+        if (idx->flow_cnt == idx->flow_size) {
+            uint32_t size = idx->flow_size ? idx->flow_size * 2 : 1024;
+            PcapLogIndexFlow **flows = SCRealloc(idx->flows,
+                    size * sizeof(*flows));
+            if (unlikely(flows == NULL))
+                return;
+            idx->flows = flows;
+            idx->flow_size = size;
+        }
+        flow = SCCalloc(1, sizeof(*flow));
+        if (unlikely(flow == NULL))
+            return;
+        flow->e = key;
+        flow->e.first_ts = ts;
+        if (HashTableAdd(idx->ht, flow, sizeof(*flow)) != 0) {
+            SCFree(flow);
+            return;
+        }
+        idx->flows[idx->flow_cnt++] = flow;
+    }
+
+    if (flow->e.pkts == flow->offsets_size) {
+        uint32_t size = flow->offsets_size ? flow->offsets_size * 2 : 8;
+        uint64_t *offsets = SCRealloc(flow->offsets, size * sizeof(*offsets));
+        if (unlikely(offsets == NULL))
+            return;
+        flow->offsets = offsets;
+        flow->offsets_size = size;
+    }
+    flow->offsets[flow->e.pkts++] = offset;
+    flow->e.last_ts = ts;
+    idx->offset_cnt++;
+}
+
+static int PcapLogIndexFlowCmp(const void *a, const void *b)
+{
+    const PcapLogIndexFlow *f1 = *(const PcapLogIndexFlow **)a;
+    const PcapLogIndexFlow *f2 = *(const PcapLogIndexFlow **)b;
+    if (f1->e.first_ts < f2->e.first_ts)
+        return -1;
+    return f1->e.first_ts > f2->e.first_ts;
+}
+
+/**
+ * \brief serialize the index of the file being closed and reset it for
+ *        the next file
+ *
+ * \retval buf index file content or NULL if there is nothing to write
+ */
+static uint8_t *PcapLogIndexFinish(PcapLogIndex *idx, size_t *len)
+{
+    uint8_t *buf = NULL;
+
+    if (idx->flow_cnt == 0)
+        goto end;
+
+    /* packets may be slightly out of order when multiple threads log to
+     * the same file */
+    qsort(idx->flows, idx->flow_cnt, sizeof(*idx->flows), PcapLogIndexFlowCmp);
+
+    *len = sizeof(PcapLogIndexHdr) + idx->flow_cnt * sizeof(PcapLogIndexEntry) +
+        idx->offset_cnt * sizeof(uint64_t);
+    buf = SCMalloc(*len);
+    if (unlikely(buf == NULL))
+        goto end;
+
+    PcapLogIndexHdr *hdr = (PcapLogIndexHdr *)buf;
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, PCAP_LOG_INDEX_MAGIC, sizeof(hdr->magic));
+    hdr->version = PCAP_LOG_INDEX_VERSION;
+    hdr->entry_size = sizeof(PcapLogIndexEntry);
+    hdr->linktype = idx->linktype;
+    hdr->entry_cnt = idx->flow_cnt;
+    hdr->offset_cnt = idx->offset_cnt;
+    hdr->first_ts = UINT64_MAX;
+
+    PcapLogIndexEntry *e = (PcapLogIndexEntry *)(buf + sizeof(*hdr));
+    uint64_t *offsets = (uint64_t *)(e + idx->flow_cnt);
+    uint64_t o = 0;
+    for (uint32_t i = 0; i < idx->flow_cnt; i++, e++) {
+        const PcapLogIndexFlow *flow = idx->flows[i];
+        *e = flow->e;
+        e->offsets_idx = o;
+        memcpy(offsets + o, flow->offsets, flow->e.pkts * sizeof(uint64_t));
+        o += flow->e.pkts;
+        hdr->first_ts = MIN(hdr->first_ts, e->first_ts);
+        hdr->last_ts = MAX(hdr->last_ts, e->last_ts);
+    }
+
+end:
+    PcapLogIndexReset(idx);
+    return buf;
+}
+
+static void PcapLogIndexFileName(const char *filename, char *out, size_t size)
+{
+    snprintf(out, size, "%s%s", filename, PCAP_LOG_INDEX_SUFFIX);
+}
+
+/** \brief make an indexed file available to the extract command */
+static void PcapLogIndexRegister(const char *filename, uint64_t first_ts,
+        uint64_t last_ts)
+{
+    PcapLogIndexFile *f = SCCalloc(1, sizeof(*f));
+    if (unlikely(f == NULL))
+        return;
+    if ((f->filename = SCStrdup(filename)) == NULL) {
+        SCFree(f);
+        return;
+    }
+    f->first_ts = first_ts;
+    f->last_ts = last_ts;
+
+    SCMutexLock(&pcap_index_lock);
+    TAILQ_INSERT_TAIL(&pcap_index_files, f, next);
+    SCMutexUnlock(&pcap_index_lock);
+}
+
+/** \brief write the index of a closed pcap file */
+static void PcapLogIndexWrite(const char *filename, const uint8_t *buf, size_t len)
+{
+    char path[PATH_MAX], tmp[PATH_MAX];
+
+    PcapLogIndexFileName(filename, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    /* written under a temporary name so the extract command never sees
+     * a partial index */
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        SCLogError(SC_ERR_FOPEN, "failed to open pcap-log index %s: %s",
+                tmp, strerror(errno));
+        return;
+    }
+    size_t written = fwrite(buf, 1, len, fp);
+    if (fclose(fp) != 0 || written != len) {
+        SCLogError(SC_ERR_FWRITE, "failed to write pcap-log index %s", tmp);
+        (void)remove(tmp);
+        return;
+    }
+    if (rename(tmp, path) != 0) {
+        SCLogError(SC_ERR_FOPEN, "failed to rename pcap-log index %s: %s",
+                tmp, strerror(errno));
+        (void)remove(tmp);
+        return;
+    }
+
+    const PcapLogIndexHdr *hdr = (const PcapLogIndexHdr *)buf;
+    PcapLogIndexRegister(filename, hdr->first_ts, hdr->last_ts);
+}
+
+/** \brief forget the index of a pcap file that is removed and remove
+ *         the index file */
+static void PcapLogIndexRemove(const char *filename)
+{
+    char path[PATH_MAX];
+
+    SCMutexLock(&pcap_index_lock);
+    PcapLogIndexFile *f;
+    TAILQ_FOREACH(f, &pcap_index_files, next) {
+        if (strcmp(f->filename, filename) == 0) {
+            TAILQ_REMOVE(&pcap_index_files, f, next);
+            SCFree(f->filename);
+            SCFree(f);
+            break;
+        }
+    }
+    SCMutexUnlock(&pcap_index_lock);
+
+    PcapLogIndexFileName(filename, path, sizeof(path));
+    (void)remove(path);
+}
+
+/** \brief check if a file name found in the log dir is an index */
+static bool PcapLogIsIndexFile(const char *name)
+{
+    static const char *suffixes[] = {
+        PCAP_LOG_INDEX_SUFFIX, PCAP_LOG_INDEX_SUFFIX ".tmp" };
+    const size_t len = strlen(name);
+
+    for (size_t i = 0; i < ARRAY_SIZE(suffixes); i++) {
+        const size_t slen = strlen(suffixes[i]);
+        if (len > slen && strcmp(name + len - slen, suffixes[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+/** \brief read the time range of an index left by an earlier run
+ *  \retval 1 if the index is usable */
+static int PcapLogIndexReadHdr(const char *filename, PcapLogIndexHdr *hdr)
+{
+    char path[PATH_MAX];
+    PcapLogIndexFileName(filename, path, sizeof(path));
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+    size_t r = fread(hdr, 1, sizeof(*hdr), fp);
+    fclose(fp);
+    return r == sizeof(*hdr) &&
+        memcmp(hdr->magic, PCAP_LOG_INDEX_MAGIC, sizeof(hdr->magic)) == 0 &&
+        hdr->version == PCAP_LOG_INDEX_VERSION &&
+        hdr->entry_size == sizeof(PcapLogIndexEntry);
+}
+
+#ifdef UNITTESTS
+/* replaced by the tests to simulate short writes */
+static ssize_t (*PcapLogAsyncWritevFunc)(int, const struct iovec *, int) = writev;
+#else
+#define PcapLogAsyncWritevFunc writev
+#endif
+
+/**
+ * \brief write the iovecs to the owner's file
+ *
+ * With O_DIRECT only whole aligned blocks can be written. The unaligned
+ * tail of the last block of a file is written after switching O_DIRECT
+ * off, the file is closed right after.
+ */
+static void PcapLogAsyncWritev(PcapLogAsync *a, struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    struct iovec tail = { NULL, 0 };
+    if (a->direct && total % PCAP_LOG_ASYNC_ALIGN) {
+        tail.iov_len = total % PCAP_LOG_ASYNC_ALIGN;
+        iov[iovcnt - 1].iov_len -= tail.iov_len;
+        tail.iov_base = (uint8_t *)iov[iovcnt - 1].iov_base +
+            iov[iovcnt - 1].iov_len;
+        total -= tail.iov_len;
+    }
+
+    while (total > 0) {
+        ssize_t r = PcapLogAsyncWritevFunc(a->fd, iov, iovcnt);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            goto error;
+        }
+        total -= r;
+        /* short write, skip what was written */
+        while (iovcnt > 0 && (size_t)r >= iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+
+    if (tail.iov_len > 0) {
+#ifdef O_DIRECT
+        int flags = fcntl(a->fd, F_GETFL);
+        if (flags == -1 || fcntl(a->fd, F_SETFL, flags & ~O_DIRECT) == -1)
+            goto error;
+#endif
+        a->direct = false;
+        PcapLogAsyncWritev(a, &tail, 1);
+    }
+    return;
+
+error:
+    a->stats.write_errors++;
+    if (!a->error) {
+        SCLogError(SC_ERR_FWRITE, "pcap-log write failed: %s",
+                strerror(errno));
+        a->error = true;
+    }
+}
+
+static void PcapLogAsyncOpen(PcapLogAsync *a, const char *filename)
+{
+    if (a->fd != -1)
+        close(a->fd);
+
+    a->error = false;
+    a->direct = false;
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if (g_pcap_async.direct) {
+        a->fd = open(filename, flags | O_DIRECT, 0666);
+        if (a->fd != -1) {
+            a->direct = true;
+            return;
+        }
+        /* not all file systems support O_DIRECT */
+        SCLogDebug("opening %s with O_DIRECT failed: %s", filename,
+                strerror(errno));
+    }
+#endif
+    a->fd = open(filename, flags, 0666);
+    if (a->fd == -1) {
+        SCLogError(SC_ERR_FOPEN, "Error opening dump file %s: %s",
+                filename, strerror(errno));
+    }
+}
+
+/**
+ * \brief open, write, close and remove as requested by a block
+ *
+ * \param batch also write the blocks queued after this one for the same
+ *        file, with a single writev
+ * \retval last the last block handled
+ */
+static PcapLogBlock *PcapLogAsyncProcess(PcapLogBlock *blk, bool batch)
+{
+    PcapLogAsync *a = blk->owner;
+    struct iovec iov[PCAP_LOG_ASYNC_MAX_IOV];
+    int iovcnt = 0;
+
+    if (blk->open != NULL) {
+        PcapLogAsyncOpen(a, blk->open);
+        SCFree(a->filename);
+        a->filename = blk->open;
+        blk->open = NULL;
+    }
+
+    PcapLogBlock *last = blk;
+    if (blk->len > 0) {
+        iov[iovcnt].iov_base = blk->data;
+        iov[iovcnt++].iov_len = blk->len;
+    }
+    while (batch && !last->close && last->remove == NULL &&
+            iovcnt < PCAP_LOG_ASYNC_MAX_IOV) {
+        PcapLogBlock *nb = TAILQ_NEXT(last, next);
+        if (nb == NULL || nb->owner != a || nb->open != NULL)
+            break;
+        last = nb;
+        if (nb->len > 0) {
+            iov[iovcnt].iov_base = nb->data;
+            iov[iovcnt++].iov_len = nb->len;
+        }
+    }
+
+    if (iovcnt > 0 && a->fd != -1) {
+        PcapLogAsyncWritev(a, iov, iovcnt);
+    }
+
+    if (last->close && a->fd != -1) {
+        close(a->fd);
+        a->fd = -1;
+    }
+    if (last->index != NULL && a->filename != NULL) {
+        PcapLogIndexWrite(a->filename, last->index, last->index_len);
+    }
+    if (last->remove != NULL) {
+        SCLogDebug("Removing pcap file %s", last->remove);
+        if (g_pcap_index_enabled)
+            PcapLogIndexRemove(last->remove);
+        /* remove can fail because file is already gone */
+        (void)remove(last->remove);
+    }
+    if (last->remove_dir != NULL) {
+        if (remove(last->remove_dir) != 0) {
+            SCLogWarning(SC_ERR_PCAP_FILE_DELETE_FAILED,
+                    "failed to remove sguil log %s: %s",
+                    last->remove_dir, strerror(errno));
+        }
+    }
+    return last;
+}
+
+static void PcapLogAsyncBlockReset(PcapLogBlock *blk)
+{
+    blk->len = 0;
+    blk->close = false;
+    if (blk->open != NULL) {
+        SCFree(blk->open);
+        blk->open = NULL;
+    }
+    if (blk->remove != NULL) {
+        SCFree(blk->remove);
+        blk->remove = NULL;
+    }
+    if (blk->remove_dir != NULL) {
+        SCFree(blk->remove_dir);
+        blk->remove_dir = NULL;
+    }
+    if (blk->index != NULL) {
+        SCFree(blk->index);
+        blk->index = NULL;
+    }
+}
+
+/**
+ * \brief get a free block
+ *
+ * \param wait wait for the writer to free one, else count a drop
+ * \retval blk or NULL if none is free
+ */
+static PcapLogBlock *PcapLogAsyncGetBlock(PcapLogAsync *a, bool wait)
+{
+    PcapLogWriter *w = a->writer;
+    PcapLogBlock *blk;
+
+    SCCtrlMutexLock(&w->mutex);
+    while ((blk = TAILQ_FIRST(&a->free)) == NULL) {
+        if (!wait) {
+            a->stats.drops++;
+            SCCtrlMutexUnlock(&w->mutex);
+            return NULL;
+        }
+        a->stats.waits++;
+        SCCtrlCondWait(&w->done_cond, &w->mutex);
+    }
+    TAILQ_REMOVE(&a->free, blk, next);
+    SCCtrlMutexUnlock(&w->mutex);
+    return blk;
+}
+
+static void PcapLogAsyncPutBlock(PcapLogAsync *a, PcapLogBlock *blk)
+{
+    PcapLogAsyncBlockReset(blk);
+    SCCtrlMutexLock(&a->writer->mutex);
+    TAILQ_INSERT_TAIL(&a->free, blk, next);
+    SCCtrlMutexUnlock(&a->writer->mutex);
+}
+
+/**
+ * \brief hand a block to the writer thread, or write it now if the
+ *        writer isn't running
+ */
+static void PcapLogAsyncSubmit(PcapLogAsync *a, PcapLogBlock *blk)
+{
+    PcapLogWriter *w = a->writer;
+
+    a->stats.blocks++;
+    a->stats.bytes += blk->len;
+
+    SCCtrlMutexLock(&w->mutex);
+    if (w->running) {
+        TAILQ_INSERT_TAIL(&w->queue, blk, next);
+        a->queued++;
+        if (a->queued > a->stats.queue_max)
+            a->stats.queue_max = a->queued;
+        SCCtrlCondSignal(&w->cond);
+        SCCtrlMutexUnlock(&w->mutex);
+        return;
+    }
+    SCCtrlMutexUnlock(&w->mutex);
+
+    PcapLogAsyncProcess(blk, false);
+    PcapLogAsyncPutBlock(a, blk);
+}
+
+/** \brief block for file operations, waits for a free block if needed */
+static PcapLogBlock *PcapLogAsyncCurBlock(PcapLogAsync *a)
+{
+    if (a->cur == NULL) {
+        a->cur = PcapLogAsyncGetBlock(a, true);
+    }
+    return a->cur;
+}
+
+/** \brief copy into the current block, handing it off when full
+ *  \param next free block to continue in, the caller made sure there
+ *         is one if the data doesn't fit */
+static void PcapLogAsyncCopy(PcapLogAsync *a, PcapLogBlock **next,
+        const uint8_t *data, uint32_t len, time_t ts)
+{
+    while (len > 0) {
+        if (a->cur == NULL) {
+            BUG_ON(*next == NULL);
+            a->cur = *next;
+            *next = NULL;
+            a->cur_ts = ts;
+        }
+        PcapLogBlock *blk = a->cur;
+        uint32_t n = MIN(len, g_pcap_async.buffer_size - blk->len);
+        memcpy(blk->data + blk->len, data, n);
+        blk->len += n;
+        data += n;
+        len -= n;
+        if (blk->len == g_pcap_async.buffer_size) {
+            PcapLogAsyncSubmit(a, blk);
+            a->cur = NULL;
+        }
+    }
+}
+
+/**
+ * \brief add a packet to the current block
+ *
+ * The file is opened by the writer when it gets the first block with
+ * data for it, which starts with the pcap file header.
+ *
+ * \param offset set to the file offset of the record
+ * \retval 0 on success, -1 if the packet was dropped
+ */
+static int PcapLogAsyncWrite(PcapLogData *pl, const Packet *p, uint32_t caplen,
+        uint64_t *offset)
+{
+    PcapLogAsync *a = pl->async;
+    PcapLogBlock *next = NULL;
+
+    if (!a->file_open) {
+        if (a->cur != NULL) {
+            PcapLogAsyncSubmit(a, a->cur);
+            a->cur = NULL;
+        }
+        PcapLogBlock *blk = PcapLogAsyncGetBlock(a, g_pcap_async.wait);
+        if (blk == NULL)
+            return -1;
+        blk->open = SCStrdup(pl->filename);
+        if (unlikely(blk->open == NULL)) {
+            PcapLogAsyncPutBlock(a, blk);
+            return -1;
+        }
+
+        struct pcap_file_header fh;
+        memset(&fh, 0, sizeof(fh));
+        fh.magic = 0xa1b2c3d4; /* usec timestamps, host byte order */
+        fh.version_major = PCAP_VERSION_MAJOR;
+        fh.version_minor = PCAP_VERSION_MINOR;
+        fh.snaplen = PCAP_SNAPLEN;
+        fh.linktype = p->datalink;
+        memcpy(blk->data, &fh, sizeof(fh));
+        blk->len = sizeof(fh);
+
+        a->cur = blk;
+        a->cur_ts = p->ts.tv_sec;
+        a->file_open = true;
+        a->file_offset = sizeof(fh);
+    }
+
+    uint32_t need = sizeof(PcapLogRecordHdr) + caplen;
+    uint32_t avail = a->cur ? g_pcap_async.buffer_size - a->cur->len : 0;
+    if (need > avail) {
+        next = PcapLogAsyncGetBlock(a, g_pcap_async.wait);
+        if (next == NULL)
+            return -1;
+    }
+
+    PcapLogRecordHdr hdr = {
+        .ts_sec = (uint32_t)p->ts.tv_sec,
+        .ts_usec = (uint32_t)p->ts.tv_usec,
+        .caplen = caplen,
+        .len = GET_PKT_LEN(p),
+    };
+    PcapLogAsyncCopy(a, &next, (const uint8_t *)&hdr, sizeof(hdr), p->ts.tv_sec);
+    PcapLogAsyncCopy(a, &next, GET_PKT_DATA(p), caplen, p->ts.tv_sec);
+    BUG_ON(next != NULL);
+    *offset = a->file_offset;
+    a->file_offset += need;
+
+    /* with O_DIRECT partial blocks can only be written at file close */
+    if (a->cur != NULL && !g_pcap_async.direct && g_pcap_async.flush_interval &&
+            p->ts.tv_sec - a->cur_ts >= (time_t)g_pcap_async.flush_interval) {
+        PcapLogAsyncSubmit(a, a->cur);
+        a->cur = NULL;
+    }
+    return 0;
+}
+
+/** \brief close the file after the data written so far, followed by
+ *         writing its index */
+static void PcapLogAsyncClose(PcapLogAsync *a, PcapLogIndex *idx)
+{
+    if (!a->file_open)
+        return;
+    PcapLogBlock *blk = PcapLogAsyncCurBlock(a);
+    blk->close = true;
+    if (idx != NULL) {
+        blk->index = PcapLogIndexFinish(idx, &blk->index_len);
+    }
+    a->file_open = false;
+}
+
+/** \brief remove a ring buffer file (and sguil dir) once the writer is
+ *         done with what was queued before */
+static int PcapLogAsyncRemove(PcapLogAsync *a, const char *filename,
+        const char *dirname)
+{
+    if (a->cur != NULL && a->cur->remove != NULL) {
+        PcapLogAsyncSubmit(a, a->cur);
+        a->cur = NULL;
+    }
+    PcapLogBlock *blk = PcapLogAsyncCurBlock(a);
+    if ((blk->remove = SCStrdup(filename)) == NULL)
+        return -1;
+    if (dirname != NULL && (blk->remove_dir = SCStrdup(dirname)) == NULL)
+        return -1;
+    return 0;
+}
+
+/** \brief hand off the current block and wait for the writer to finish
+ *         all blocks of this output */
+static void PcapLogAsyncFinish(PcapLogAsync *a)
+{
+    if (a->cur != NULL) {
+        PcapLogAsyncSubmit(a, a->cur);
+        a->cur = NULL;
+    }
+
+    PcapLogWriter *w = a->writer;
+    SCCtrlMutexLock(&w->mutex);
+    while (a->queued > 0 && w->running) {
+        SCCtrlCondWait(&w->done_cond, &w->mutex);
+    }
+    SCCtrlMutexUnlock(&w->mutex);
+}
+
+static PcapLogAsync *PcapLogAsyncNew(uint32_t thread_number)
+{
+    PcapLogAsync *a = SCCalloc(1, sizeof(*a));
+    if (unlikely(a == NULL))
+        return NULL;
+
+    a->writer = &g_pcap_async.writers[thread_number % g_pcap_async.writer_cnt];
+    a->fd = -1;
+    a->stats.thread_number = thread_number;
+    TAILQ_INIT(&a->free);
+
+    for (uint32_t i = 0; i < g_pcap_async.buffers; i++) {
+        PcapLogBlock *blk = SCCalloc(1, sizeof(*blk));
+        if (unlikely(blk == NULL))
+            goto error;
+        blk->data = SCMallocAligned(g_pcap_async.buffer_size, PCAP_LOG_ASYNC_ALIGN);
+        if (unlikely(blk->data == NULL)) {
+            SCFree(blk);
+            goto error;
+        }
+        blk->owner = a;
+        TAILQ_INSERT_TAIL(&a->free, blk, next);
+    }
+    return a;
+
+error:
+    SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate pcap-log buffers");
+    PcapLogBlock *blk;
+    while ((blk = TAILQ_FIRST(&a->free)) != NULL) {
+        TAILQ_REMOVE(&a->free, blk, next);
+        SCFreeAligned(blk->data);
+        SCFree(blk);
+    }
+    SCFree(a);
+    return NULL;
+}
+
+/** \brief free the async state, PcapLogAsyncFinish must have been
+ *         called */
+static void PcapLogAsyncFree(PcapLogAsync *a)
+{
+    PcapLogBlock *blk;
+
+    if (a->cur != NULL) {
+        TAILQ_INSERT_TAIL(&a->free, a->cur, next);
+        a->cur = NULL;
+    }
+    while ((blk = TAILQ_FIRST(&a->free)) != NULL) {
+        TAILQ_REMOVE(&a->free, blk, next);
+        PcapLogAsyncBlockReset(blk);
+        SCFreeAligned(blk->data);
+        SCFree(blk);
+    }
+    if (a->fd != -1)
+        close(a->fd);
+    SCFree(a->filename);
+    SCFree(a);
+}
+
+/**
+ * \brief write the queued blocks
+ *
+ * \param final write everything that is queued and stop queueing, later
+ *        blocks are written inline
+ */
+static void PcapLogWriterFlush(void *data, bool final)
+{
+    PcapLogWriter *w = data;
+    TAILQ_HEAD(, PcapLogBlock_) batch;
+    PcapLogBlock *blk;
+
+    SCCtrlMutexLock(&w->mutex);
+    if (!final && TAILQ_EMPTY(&w->queue)) {
+        struct timeval tv;
+        struct timespec ts;
+        gettimeofday(&tv, NULL);
+        ts.tv_sec = tv.tv_sec + 1;
+        ts.tv_nsec = tv.tv_usec * 1000;
+        SCCtrlCondTimedwait(&w->cond, &w->mutex, &ts);
+    }
+
+    while (!TAILQ_EMPTY(&w->queue)) {
+        TAILQ_INIT(&batch);
+        while ((blk = TAILQ_FIRST(&w->queue)) != NULL) {
+            TAILQ_REMOVE(&w->queue, blk, next);
+            TAILQ_INSERT_TAIL(&batch, blk, next);
+        }
+        SCCtrlMutexUnlock(&w->mutex);
+
+        for (blk = TAILQ_FIRST(&batch); blk != NULL;
+                blk = TAILQ_NEXT(blk, next)) {
+            blk = PcapLogAsyncProcess(blk, true);
+        }
+
+        SCCtrlMutexLock(&w->mutex);
+        while ((blk = TAILQ_FIRST(&batch)) != NULL) {
+            TAILQ_REMOVE(&batch, blk, next);
+            PcapLogAsyncBlockReset(blk);
+            blk->owner->queued--;
+            TAILQ_INSERT_TAIL(&blk->owner->free, blk, next);
+        }
+        SCCtrlCondBroadcast(&w->done_cond);
+
+        if (!final)
+            break;
+    }
+
+    if (final) {
+        w->running = 0;
+        SCCtrlCondBroadcast(&w->done_cond);
+    }
+    SCCtrlMutexUnlock(&w->mutex);
+}
+
+/** \brief spawn the writer threads if pcap-log uses async output */
+void PcapLogWriterThreadSpawn(void)
+{
+    for (int i = 0; i < g_pcap_async.writer_cnt; i++) {
+        PcapLogWriter *w = &g_pcap_async.writers[i];
+        TmThreadSpawnWriter(thread_name_pcap_log, i + 1, w,
+                PcapLogWriterFlush, &w->mutex, &w->cond, &w->running);
+    }
+}
+
 /**
  * \brief Function to close pcaplog file
  *
@@ -241,8 +1221,23 @@ static int PcapLogCloseFile(ThreadVars *t, PcapLogData *pl)
     if (pl != NULL) {
         PCAPLOG_PROFILE_START;
 
+        if (pl->async != NULL) {
+            PcapLogAsyncClose(pl->async, pl->index);
+            pl->size_current = 0;
+            PCAPLOG_PROFILE_END(pl->profile_close);
+            return 0;
+        }
+
         if (pl->pcap_dumper != NULL) {
             pcap_dump_close(pl->pcap_dumper);
+            if (pl->index != NULL) {
+                size_t len = 0;
+                uint8_t *buf = PcapLogIndexFinish(pl->index, &len);
+                if (buf != NULL) {
+                    PcapLogIndexWrite(pl->filename, buf, len);
+                    SCFree(buf);
+                }
+            }
 #ifdef HAVE_LIBLZ4
             PcapLogCompressionData *comp = &pl->compression;
             if (comp->format == PCAP_LOG_COMPRESSION_FORMAT_LZ4) {
@@ -334,7 +1329,12 @@ static int PcapLogRotateFile(ThreadVars *t, PcapLogData *pl)
         pf = TAILQ_FIRST(&pl->pcap_file_list);
         SCLogDebug("Removing pcap file %s", pf->filename);
 
-        if (remove(pf->filename) != 0) {
+        /* the async writer removes the file after closing it */
+        const char *remove_dir = NULL;
+        if (pl->async == NULL && g_pcap_index_enabled) {
+            PcapLogIndexRemove(pf->filename);
+        }
+        if (pl->async == NULL && remove(pf->filename) != 0) {
             // VJ remove can fail because file is already gone
             //LogWarning(SC_ERR_PCAP_FILE_DELETE_FAILED,
             //           "failed to remove log file %s: %s",
@@ -354,7 +1354,9 @@ static int PcapLogRotateFile(ThreadVars *t, PcapLogData *pl)
                         "not equal: removing dir",
                         pf->dirname, pfnext->dirname);
 
-                if (remove(pf->dirname) != 0) {
+                if (pl->async != NULL) {
+                    remove_dir = pf->dirname;
+                } else if (remove(pf->dirname) != 0) {
                     SCLogWarning(SC_ERR_PCAP_FILE_DELETE_FAILED,
                             "failed to remove sguil log %s: %s",
                             pf->dirname, strerror( errno ));
@@ -362,6 +1364,11 @@ static int PcapLogRotateFile(ThreadVars *t, PcapLogData *pl)
             }
         }
 
+        if (pl->async != NULL &&
+                PcapLogAsyncRemove(pl->async, pf->filename, remove_dir) < 0) {
+            SCLogDebug("PcapLogAsyncRemove failed");
+        }
+
         TAILQ_REMOVE(&pl->pcap_file_list, pf, next);
         PcapFileNameFree(pf);
         pl->file_cnt--;
@@ -498,6 +1505,10 @@ static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
     pl->h->caplen = GET_PKT_LEN(p);
     pl->h->len = GET_PKT_LEN(p);
     len = sizeof(*pl->h) + GET_PKT_LEN(p);
+    if (pl->async != NULL) {
+        pl->h->caplen = MIN(GET_PKT_LEN(p), PCAP_SNAPLEN);
+        len = sizeof(PcapLogRecordHdr) + pl->h->caplen;
+    }
 
     if (pl->filename == NULL) {
         ret = PcapLogOpenFileCtx(pl);
@@ -546,6 +1557,22 @@ static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
     }
 #endif /* HAVE_LIBLZ4 */
 
+    if (pl->async != NULL) {
+        PCAPLOG_PROFILE_START;
+        uint64_t offset;
+        if (PcapLogAsyncWrite(pl, p, pl->h->caplen, &offset) == 0) {
+            pl->size_current += len;
+            pl->profile_data_size += len;
+            if (pl->index != NULL) {
+                pl->index->linktype = p->datalink;
+                PcapLogIndexAdd(pl->index, p, offset);
+            }
+        }
+        PCAPLOG_PROFILE_END(pl->profile_write);
+        PcapLogUnlock(pl);
+        return TM_ECODE_OK;
+    }
+
     /* XXX pcap handles, nfq, pfring, can only have one link type ipfw? we do
      * this here as we don't know the link type until we get our first packet */
     if (pl->pcap_dead_handle == NULL || pl->pcap_dumper == NULL) {
@@ -556,6 +1583,10 @@ static int PcapLog (ThreadVars *t, void *thread_data, const Packet *p)
     }
 
     PCAPLOG_PROFILE_START;
+    if (pl->index != NULL) {
+        pl->index->linktype = p->datalink;
+        PcapLogIndexAdd(pl->index, p, (uint64_t)pcap_dump_ftell(pl->pcap_dumper));
+    }
     pcap_dump((u_char *)pl->pcap_dumper, pl->h, GET_PKT_DATA(p));
     if (pl->compression.format == PCAP_LOG_COMPRESSION_FORMAT_NONE) {
         pl->size_current += len;
@@ -818,6 +1849,9 @@ static TmEcode PcapLogInitRingBuffer(PcapLogData *pl)
         if (fnmatch(basename, entry->d_name, 0) != 0) {
             continue;
         }
+        if (PcapLogIsIndexFile(entry->d_name)) {
+            continue;
+        }
 
         uint64_t secs = 0;
         uint32_t usecs = 0;
@@ -883,6 +1917,9 @@ static TmEcode PcapLogInitRingBuffer(PcapLogData *pl)
         PcapFileName *pf = TAILQ_FIRST(&pl->pcap_file_list);
         while (pf != NULL && pl->file_cnt > pl->max_files) {
             SCLogDebug("Removing PCAP file %s", pf->filename);
+            if (g_pcap_index_enabled) {
+                PcapLogIndexRemove(pf->filename);
+            }
             if (remove(pf->filename) != 0) {
                 SCLogWarning(SC_WARN_REMOVE_FILE,
                     "Failed to remove PCAP file %s: %s", pf->filename,
@@ -897,6 +1934,17 @@ static TmEcode PcapLogInitRingBuffer(PcapLogData *pl)
 
     closedir(dir);
 
+    /* files of an earlier run can be searched if they were indexed */
+    if (g_pcap_index_enabled) {
+        PcapFileName *pf;
+        TAILQ_FOREACH(pf, &pl->pcap_file_list, next) {
+            PcapLogIndexHdr hdr;
+            if (PcapLogIndexReadHdr(pf->filename, &hdr)) {
+                PcapLogIndexRegister(pf->filename, hdr.first_ts, hdr.last_ts);
+            }
+        }
+    }
+
     /* For some reason file count is initialized at one, instead of 0. */
     SCLogNotice("Ring buffer initialized with %d files.", pl->file_cnt - 1);
 
@@ -925,6 +1973,28 @@ static TmEcode PcapLogDataInit(ThreadVars *t, const void *initdata, void **data)
 
     PcapLogLock(td->pcap_log);
 
+    if (g_pcap_async.enabled && td->pcap_log->async == NULL) {
+        td->pcap_log->async = PcapLogAsyncNew(td->pcap_log->thread_number);
+        if (td->pcap_log->async == NULL) {
+            PcapLogUnlock(td->pcap_log);
+            if (td->pcap_log != pl)
+                PcapLogDataFree(td->pcap_log);
+            SCFree(td);
+            return TM_ECODE_FAILED;
+        }
+    }
+
+    if (g_pcap_index_enabled && td->pcap_log->index == NULL) {
+        td->pcap_log->index = PcapLogIndexNew();
+        if (td->pcap_log->index == NULL) {
+            PcapLogUnlock(td->pcap_log);
+            if (td->pcap_log != pl)
+                PcapLogDataFree(td->pcap_log);
+            SCFree(td);
+            return TM_ECODE_FAILED;
+        }
+    }
+
     /** Use the Ouptut Context (file pointer and mutex) */
     td->pcap_log->pkt_cnt = 0;
     td->pcap_log->pcap_dead_handle = NULL;
@@ -962,6 +2032,18 @@ static TmEcode PcapLogDataInit(ThreadVars *t, const void *initdata, void **data)
     return TM_ECODE_OK;
 }
 
+/** \brief keep a copy of the async stats of a thread for the profiling
+ *         report */
+static void PcapLogAsyncStatsCollect(PcapLogData *dst, const PcapLogAsync *a)
+{
+    PcapLogAsyncStats *stats = SCRealloc(dst->async_stats,
+            (dst->async_stats_cnt + 1) * sizeof(*stats));
+    if (unlikely(stats == NULL))
+        return;
+    dst->async_stats = stats;
+    stats[dst->async_stats_cnt++] = a->stats;
+}
+
 static void StatsMerge(PcapLogData *dst, PcapLogData *src)
 {
     dst->profile_open.total += src->profile_open.total;
@@ -986,6 +2068,10 @@ static void StatsMerge(PcapLogData *dst, PcapLogData *src)
     dst->profile_unlock.cnt += src->profile_unlock.cnt;
 
     dst->profile_data_size += src->profile_data_size;
+
+    if (src->async != NULL) {
+        PcapLogAsyncStatsCollect(dst, src->async);
+    }
 }
 
 static void PcapLogDataFree(PcapLogData *pl)
@@ -1006,6 +2092,15 @@ static void PcapLogDataFree(PcapLogData *pl)
     SCFree(pl->h);
     SCFree(pl->filename);
     SCFree(pl->prefix);
+    if (pl->async != NULL) {
+        PcapLogAsyncFree(pl->async);
+    }
+    if (pl->index != NULL) {
+        PcapLogIndexFree(pl->index);
+    }
+    if (pl->async_stats != NULL) {
+        SCFree(pl->async_stats);
+    }
 
 #ifdef HAVE_LIBLZ4
     if (pl->compression.format == PCAP_LOG_COMPRESSION_FORMAT_LZ4) {
@@ -1035,7 +2130,10 @@ static TmEcode PcapLogDataDeinit(ThreadVars *t, void *thread_data)
     PcapLogThreadData *td = (PcapLogThreadData *)thread_data;
     PcapLogData *pl = td->pcap_log;
 
-    if (pl->pcap_dumper != NULL) {
+    if (pl->async != NULL) {
+        PcapLogCloseFile(t, pl);
+        PcapLogAsyncFinish(pl->async);
+    } else if (pl->pcap_dumper != NULL) {
         if (PcapLogCloseFile(t,pl) < 0) {
             SCLogDebug("PcapLogCloseFile failed");
         }
@@ -1050,6 +2148,8 @@ static TmEcode PcapLogDataDeinit(ThreadVars *t, void *thread_data)
         SCMutexUnlock(&g_pcap_data->plog_lock);
     } else {
         if (pl->reported == 0) {
+            if (pl->async != NULL)
+                PcapLogAsyncStatsCollect(pl, pl->async);
             PcapLogProfilingDump(pl);
             pl->reported = 1;
         }
@@ -1157,6 +2257,103 @@ error:
     return -1;
 }
 
+/** \brief set up the writers, buffer_size must be a multiple of
+ *         PCAP_LOG_ASYNC_ALIGN */
+static void PcapLogAsyncInit(int writer_cnt, uint32_t buffer_size,
+        uint32_t buffers, uint32_t flush_interval, bool direct)
+{
+    g_pcap_async.writers = SCCalloc(writer_cnt, sizeof(PcapLogWriter));
+    if (unlikely(g_pcap_async.writers == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate pcap-log writers");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < writer_cnt; i++) {
+        PcapLogWriter *w = &g_pcap_async.writers[i];
+        SCCtrlMutexInit(&w->mutex, NULL);
+        SCCtrlCondInit(&w->cond, NULL);
+        SCCtrlCondInit(&w->done_cond, NULL);
+        TAILQ_INIT(&w->queue);
+    }
+
+    g_pcap_async.enabled = true;
+    g_pcap_async.direct = direct;
+    g_pcap_async.buffer_size = buffer_size;
+    g_pcap_async.buffers = buffers;
+    g_pcap_async.flush_interval = flush_interval;
+    g_pcap_async.writer_cnt = writer_cnt;
+}
+
+/**
+ * \brief set up the async writer from the pcap-log "async" node
+ *
+ * The writer threads are started by PcapLogWriterThreadSpawn.
+ */
+static void PcapLogAsyncSetup(ConfNode *conf)
+{
+    uint32_t size = PCAP_LOG_ASYNC_DEFAULT_BUFFER;
+    const char *str = ConfNodeLookupChildValue(conf, "buffer-size");
+    if (str != NULL && ParseSizeStringU32(str, &size) < 0) {
+        SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                "pcap-log.async.buffer-size from conf file - %s", str);
+        exit(EXIT_FAILURE);
+    }
+    if (size < PCAP_LOG_ASYNC_MIN_BUFFER) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-log.async.buffer-size "
+                "must be at least %u bytes", PCAP_LOG_ASYNC_MIN_BUFFER);
+        exit(EXIT_FAILURE);
+    }
+    /* whole buffers must be O_DIRECT aligned */
+    size = (size + PCAP_LOG_ASYNC_ALIGN - 1) & ~(PCAP_LOG_ASYNC_ALIGN - 1);
+
+    intmax_t val = PCAP_LOG_ASYNC_DEFAULT_BUFFERS;
+    if (ConfGetChildValueInt(conf, "buffers", &val) &&
+            (val < 2 || val > UINT16_MAX)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid "
+                "pcap-log.async.buffers %"PRIdMAX, val);
+        exit(EXIT_FAILURE);
+    }
+    const uint32_t buffers = (uint32_t)val;
+
+    val = 1;
+    if (ConfGetChildValueInt(conf, "writer-threads", &val) &&
+            (val < 1 || val > 64)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid "
+                "pcap-log.async.writer-threads %"PRIdMAX, val);
+        exit(EXIT_FAILURE);
+    }
+    const int writer_cnt = (int)val;
+
+    uint64_t flush_interval = PCAP_LOG_ASYNC_DEFAULT_FLUSH;
+    str = ConfNodeLookupChildValue(conf, "flush-interval");
+    if (str != NULL) {
+        flush_interval = SCParseTimeSizeString(str);
+        if (flush_interval == 0 || flush_interval > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_NUMERIC_VALUE, "Invalid "
+                    "pcap-log.async.flush-interval %s", str);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int direct = 0;
+    (void)ConfGetChildValueBool(conf, "direct-io", &direct);
+#ifndef O_DIRECT
+    if (direct) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "pcap-log.async."
+                "direct-io is not supported on this platform");
+        direct = 0;
+    }
+#endif
+
+    PcapLogAsyncInit(writer_cnt, size, buffers, (uint32_t)flush_interval,
+            direct != 0);
+    /* reading a pcap there is no need to drop, wait for the disk */
+    g_pcap_async.wait = IsRunModeOffline(RunmodeGetCurrent());
+
+    SCLogConfig("pcap-log: async output with %"PRIu32" buffers of %"PRIu32
+            " bytes per file, %d writer thread(s)%s", buffers, size,
+            writer_cnt, direct ? ", direct I/O" : "");
+}
+
 /** \brief Fill in pcap logging struct from the provided ConfNode.
  *  \param conf The configuration node for this output.
  *  \retval output_ctx
@@ -1495,6 +2692,28 @@ static OutputInitResult PcapLogInitCtx(ConfNode *conf)
         }
     }
 
+    if (conf != NULL && ConfNodeChildValueIsTrue(conf, "index")) {
+        if (pl->compression.format != PCAP_LOG_COMPRESSION_FORMAT_NONE) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "pcap-log index "
+                    "can't be combined with compression");
+            exit(EXIT_FAILURE);
+        }
+        g_pcap_index_enabled = true;
+        SCLogConfig("pcap-log: writing flow index files");
+    }
+
+    if (conf != NULL) { /* To faciliate unit tests. */
+        ConfNode *async = ConfNodeLookupChild(conf, "async");
+        if (async != NULL && ConfNodeChildValueIsTrue(async, "enabled")) {
+            if (pl->compression.format != PCAP_LOG_COMPRESSION_FORMAT_NONE) {
+                SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "pcap-log async "
+                        "output can't be combined with compression");
+                exit(EXIT_FAILURE);
+            }
+            PcapLogAsyncSetup(async);
+        }
+    }
+
     /* create the output ctx and send it back */
 
     OutputCtx *output_ctx = SCCalloc(1, sizeof(OutputCtx));
@@ -1523,6 +2742,15 @@ static void PcapLogFileDeInitCtx(OutputCtx *output_ctx)
         SCLogDebug("PCAP files left at exit: %s\n", pf->filename);
     }
     PcapLogDataFree(pl);
+
+    SCMutexLock(&pcap_index_lock);
+    PcapLogIndexFile *f;
+    while ((f = TAILQ_FIRST(&pcap_index_files)) != NULL) {
+        TAILQ_REMOVE(&pcap_index_files, f, next);
+        SCFree(f->filename);
+        SCFree(f);
+    }
+    SCMutexUnlock(&pcap_index_lock);
     SCFree(output_ctx);
     return;
 }
@@ -1697,6 +2925,364 @@ error:
     return -1;
 }
 
+#ifdef BUILD_UNIX_SOCKET
+/** packet record found through the index */
+typedef struct PcapLogExtractRecord_ {
+    uint64_t ts;
+    uint64_t offset;
+    uint32_t caplen;
+    uint32_t file;              /**< index in the file list */
+} PcapLogExtractRecord;
+
+typedef struct PcapLogExtract_ {
+    PcapLogIndexEntry q;        /**< addresses, ports and proto to match */
+    bool ports;
+    bool proto;
+    uint64_t start;
+    uint64_t end;
+
+    PcapLogExtractRecord *recs;
+    uint32_t rec_cnt;
+    uint32_t rec_size;
+    uint32_t flows;
+    uint32_t linktype;
+} PcapLogExtract;
+
+static int PcapLogExtractParseAddr(const char *str, uint8_t *ipver, uint32_t *addr)
+{
+    memset(addr, 0, 16);
+    if (inet_pton(AF_INET, str, addr) == 1) {
+        *ipver = 4;
+        return 0;
+    }
+    if (inet_pton(AF_INET6, str, addr) == 1) {
+        *ipver = 6;
+        return 0;
+    }
+    return -1;
+}
+
+/** \brief match the flow in either direction */
+static bool PcapLogExtractMatch(const PcapLogExtract *x, const PcapLogIndexEntry *e)
+{
+    const PcapLogIndexEntry *q = &x->q;
+
+    if (e->ipver != q->ipver || (x->proto && e->proto != q->proto))
+        return false;
+    if (e->last_ts < x->start || e->first_ts > x->end)
+        return false;
+
+    if (memcmp(e->src, q->src, sizeof(e->src)) == 0 &&
+            memcmp(e->dst, q->dst, sizeof(e->dst)) == 0 &&
+            (!x->ports || (e->sp == q->sp && e->dp == q->dp)))
+        return true;
+    if (memcmp(e->src, q->dst, sizeof(e->src)) == 0 &&
+            memcmp(e->dst, q->src, sizeof(e->dst)) == 0 &&
+            (!x->ports || (e->sp == q->dp && e->dp == q->sp)))
+        return true;
+    return false;
+}
+
+/** \brief collect the records of the matching flows of one pcap file
+ *  \retval 0 on success, -1 if the index or pcap can't be used */
+static int PcapLogExtractFile(PcapLogExtract *x, const char *filename,
+        uint32_t file, int fd)
+{
+    char path[PATH_MAX];
+    int ret = -1;
+
+    PcapLogIndexFileName(filename, path, sizeof(path));
+    int ifd = open(path, O_RDONLY);
+    if (ifd == -1)
+        return -1;
+
+    struct stat st;
+    if (fstat(ifd, &st) != 0 || (size_t)st.st_size < sizeof(PcapLogIndexHdr)) {
+        close(ifd);
+        return -1;
+    }
+    const size_t size = (size_t)st.st_size;
+    uint8_t *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, ifd, 0);
+    close(ifd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    const PcapLogIndexHdr *hdr = (const PcapLogIndexHdr *)map;
+    if (memcmp(hdr->magic, PCAP_LOG_INDEX_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != PCAP_LOG_INDEX_VERSION ||
+            hdr->entry_size != sizeof(PcapLogIndexEntry) ||
+            hdr->entry_cnt > size / sizeof(PcapLogIndexEntry) ||
+            hdr->offset_cnt > size / sizeof(uint64_t) ||
+            sizeof(*hdr) + hdr->entry_cnt * sizeof(PcapLogIndexEntry) +
+            hdr->offset_cnt * sizeof(uint64_t) != size) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "invalid pcap-log index %s", path);
+        goto end;
+    }
+    if (x->rec_cnt == 0 && x->flows == 0)
+        x->linktype = hdr->linktype;
+
+    const PcapLogIndexEntry *e = (const PcapLogIndexEntry *)(map + sizeof(*hdr));
+    const uint64_t *offsets = (const uint64_t *)(e + hdr->entry_cnt);
+    for (uint64_t i = 0; i < hdr->entry_cnt; i++, e++) {
+        if (!PcapLogExtractMatch(x, e))
+            continue;
+        if (e->offsets_idx + e->pkts > hdr->offset_cnt)
+            continue;
+        x->flows++;
+
+        for (uint32_t n = 0; n < e->pkts; n++) {
+            PcapLogRecordHdr rh;
+            const uint64_t offset = offsets[e->offsets_idx + n];
+            if (pread(fd, &rh, sizeof(rh), (off_t)offset) != (ssize_t)sizeof(rh))
+                break;
+            const uint64_t ts = (uint64_t)rh.ts_sec * 1000000 + rh.ts_usec;
+            if (ts < x->start || ts > x->end)
+                continue;
+
+            if (x->rec_cnt == x->rec_size) {
+                uint32_t rsize = x->rec_size ? x->rec_size * 2 : 256;
+                PcapLogExtractRecord *recs = SCRealloc(x->recs,
+                        rsize * sizeof(*recs));
+                if (unlikely(recs == NULL))
+                    goto end;
+                x->recs = recs;
+                x->rec_size = rsize;
+            }
+            PcapLogExtractRecord *r = &x->recs[x->rec_cnt++];
+            r->ts = ts;
+            r->offset = offset;
+            r->caplen = MIN(rh.caplen, PCAP_SNAPLEN);
+            r->file = file;
+        }
+    }
+    ret = 0;
+
+end:
+    munmap(map, size);
+    return ret;
+}
+
+static int PcapLogExtractRecordCmp(const void *a, const void *b)
+{
+    const PcapLogExtractRecord *r1 = a;
+    const PcapLogExtractRecord *r2 = b;
+    if (r1->ts < r2->ts)
+        return -1;
+    return r1->ts > r2->ts;
+}
+
+/**
+ * \brief unix socket command extracting the packets of a flow from the
+ *        indexed pcap-log files into a new pcap file
+ *
+ * Arguments: "src-ip", "dst-ip", "filename" and optionally "src-port"
+ * with "dst-port", "proto" and "start"/"end" in seconds since the epoch.
+ * The flow is matched in both directions. The file being written is only
+ * searched once it has been rotated.
+ */
+TmEcode PcapLogUnixSocketExtract(json_t *cmd, json_t *answer, void *data)
+{
+    PcapLogExtract x;
+    char **files = NULL;
+    int *fds = NULL;
+    uint32_t file_cnt = 0;
+    FILE *out = NULL;
+    uint8_t *buf = NULL;
+    TmEcode ret = TM_ECODE_FAILED;
+
+    memset(&x, 0, sizeof(x));
+    x.end = UINT64_MAX;
+
+    if (!g_pcap_index_enabled) {
+        json_object_set_new(answer, "message",
+                json_string("pcap-log index is not enabled"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *jarg = json_object_get(cmd, "src-ip");
+    if (!json_is_string(jarg) || PcapLogExtractParseAddr(json_string_value(jarg),
+                &x.q.ipver, x.q.src) != 0) {
+        json_object_set_new(answer, "message", json_string("invalid src-ip"));
+        return TM_ECODE_FAILED;
+    }
+    uint8_t ipver = 0;
+    jarg = json_object_get(cmd, "dst-ip");
+    if (!json_is_string(jarg) || PcapLogExtractParseAddr(json_string_value(jarg),
+                &ipver, x.q.dst) != 0 || ipver != x.q.ipver) {
+        json_object_set_new(answer, "message", json_string("invalid dst-ip"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *jsp = json_object_get(cmd, "src-port");
+    json_t *jdp = json_object_get(cmd, "dst-port");
+    if (jsp != NULL || jdp != NULL) {
+        if (!json_is_integer(jsp) || !json_is_integer(jdp) ||
+                json_integer_value(jsp) < 0 || json_integer_value(jsp) > 65535 ||
+                json_integer_value(jdp) < 0 || json_integer_value(jdp) > 65535) {
+            json_object_set_new(answer, "message",
+                    json_string("src-port and dst-port must be port numbers"));
+            return TM_ECODE_FAILED;
+        }
+        x.q.sp = (uint16_t)json_integer_value(jsp);
+        x.q.dp = (uint16_t)json_integer_value(jdp);
+        x.ports = true;
+    }
+    jarg = json_object_get(cmd, "proto");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) < 0 ||
+                json_integer_value(jarg) > 255) {
+            json_object_set_new(answer, "message", json_string("invalid proto"));
+            return TM_ECODE_FAILED;
+        }
+        x.q.proto = (uint8_t)json_integer_value(jarg);
+        x.proto = true;
+    }
+    jarg = json_object_get(cmd, "start");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) < 0) {
+            json_object_set_new(answer, "message", json_string("invalid start"));
+            return TM_ECODE_FAILED;
+        }
+        x.start = (uint64_t)json_integer_value(jarg) * 1000000;
+    }
+    jarg = json_object_get(cmd, "end");
+    if (jarg != NULL) {
+        if (!json_is_integer(jarg) || json_integer_value(jarg) < 0) {
+            json_object_set_new(answer, "message", json_string("invalid end"));
+            return TM_ECODE_FAILED;
+        }
+        x.end = (uint64_t)json_integer_value(jarg) * 1000000 + 999999;
+    }
+
+    jarg = json_object_get(cmd, "filename");
+    if (!json_is_string(jarg)) {
+        json_object_set_new(answer, "message", json_string("filename is not a string"));
+        return TM_ECODE_FAILED;
+    }
+    char outname[PATH_MAX];
+    if (PathIsAbsolute(json_string_value(jarg))) {
+        strlcpy(outname, json_string_value(jarg), sizeof(outname));
+    } else {
+        snprintf(outname, sizeof(outname), "%s/%s", ConfigGetLogDirectory(),
+                json_string_value(jarg));
+    }
+
+    /* take the files covering the time range, the list may change while
+     * we read them */
+    SCMutexLock(&pcap_index_lock);
+    PcapLogIndexFile *f;
+    uint32_t n = 0;
+    TAILQ_FOREACH(f, &pcap_index_files, next) {
+        n++;
+    }
+    if (n > 0) {
+        files = SCCalloc(n, sizeof(char *));
+        fds = SCCalloc(n, sizeof(int));
+    }
+    if (n > 0 && (files == NULL || fds == NULL)) {
+        SCMutexUnlock(&pcap_index_lock);
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        goto end;
+    }
+    TAILQ_FOREACH(f, &pcap_index_files, next) {
+        if (f->last_ts < x.start || f->first_ts > x.end)
+            continue;
+        if ((files[file_cnt] = SCStrdup(f->filename)) == NULL)
+            break;
+        fds[file_cnt++] = -1;
+    }
+    SCMutexUnlock(&pcap_index_lock);
+
+    uint32_t searched = 0;
+    for (uint32_t i = 0; i < file_cnt; i++) {
+        fds[i] = open(files[i], O_RDONLY);
+        if (fds[i] == -1) {
+            /* removed by the ring buffer in the mean time */
+            continue;
+        }
+        uint32_t magic = 0;
+        if (pread(fds[i], &magic, sizeof(magic), 0) != (ssize_t)sizeof(magic) ||
+                magic != 0xa1b2c3d4) {
+            continue;
+        }
+        if (PcapLogExtractFile(&x, files[i], i, fds[i]) == 0)
+            searched++;
+    }
+
+    if (x.rec_cnt > 0) {
+        qsort(x.recs, x.rec_cnt, sizeof(*x.recs), PcapLogExtractRecordCmp);
+    }
+
+    out = fopen(outname, "w");
+    if (out == NULL) {
+        json_object_set_new(answer, "message", json_string(strerror(errno)));
+        goto end;
+    }
+    struct pcap_file_header fh;
+    memset(&fh, 0, sizeof(fh));
+    fh.magic = 0xa1b2c3d4;
+    fh.version_major = PCAP_VERSION_MAJOR;
+    fh.version_minor = PCAP_VERSION_MINOR;
+    fh.snaplen = PCAP_SNAPLEN;
+    fh.linktype = x.linktype;
+    if (fwrite(&fh, sizeof(fh), 1, out) != 1)
+        goto write_error;
+
+    buf = SCMalloc(sizeof(PcapLogRecordHdr) + PCAP_SNAPLEN);
+    if (unlikely(buf == NULL)) {
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        goto end;
+    }
+    uint32_t pkts = 0;
+    for (uint32_t i = 0; i < x.rec_cnt; i++) {
+        const PcapLogExtractRecord *r = &x.recs[i];
+        const size_t len = sizeof(PcapLogRecordHdr) + r->caplen;
+        if (pread(fds[r->file], buf, len, (off_t)r->offset) != (ssize_t)len)
+            continue;
+        /* caplen may have been capped */
+        memcpy(buf + offsetof(PcapLogRecordHdr, caplen), &r->caplen,
+                sizeof(r->caplen));
+        if (fwrite(buf, len, 1, out) != 1)
+            goto write_error;
+        pkts++;
+    }
+    if (fclose(out) != 0) {
+        out = NULL;
+        goto write_error;
+    }
+    out = NULL;
+
+    json_t *jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(answer, "message", json_string("out of memory"));
+        goto end;
+    }
+    json_object_set_new(jdata, "filename", json_string(outname));
+    json_object_set_new(jdata, "packets", json_integer(pkts));
+    json_object_set_new(jdata, "flows", json_integer(x.flows));
+    json_object_set_new(jdata, "files", json_integer(searched));
+    json_object_set_new(answer, "message", jdata);
+    ret = TM_ECODE_OK;
+    goto end;
+
+write_error:
+    json_object_set_new(answer, "message", json_string("writing the output failed"));
+end:
+    if (out != NULL)
+        fclose(out);
+    for (uint32_t i = 0; i < file_cnt; i++) {
+        if (fds[i] != -1)
+            close(fds[i]);
+        SCFree(files[i]);
+    }
+    SCFree(files);
+    SCFree(fds);
+    SCFree(x.recs);
+    SCFree(buf);
+    return ret;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
 static int profiling_pcaplog_enabled = 0;
 static int profiling_pcaplog_output_to_file = 0;
 static char *profiling_pcaplog_file_name = NULL;
@@ -1784,7 +3370,8 @@ static void PcapLogProfilingDump(PcapLogData *pl)
         pl->profile_data_size, pl->profile_write.cnt ?
             (int)(pl->profile_data_size / pl->profile_write.cnt) : 0);
     fprintf(fp, "         PCAP data structure overhead: %"PRIuMAX" per write.\n",
-        (uintmax_t)sizeof(struct pcap_pkthdr));
+        pl->async_stats_cnt ? (uintmax_t)sizeof(PcapLogRecordHdr) :
+            (uintmax_t)sizeof(struct pcap_pkthdr));
 
     /* print total bytes written */
     char bytes_str[32];
@@ -1809,6 +3396,26 @@ static void PcapLogProfilingDump(PcapLogData *pl)
         FormatNumber(ticks_per_gib, ticks_per_gib_str, sizeof(ticks_per_gib_str));
     fprintf(fp, "         Ticks per GiB: %s\n", ticks_per_gib_str);
 
+    /* async writer queue stats per thread, thread 0 is the shared file
+     * in normal and sguil mode */
+    if (pl->async_stats_cnt > 0) {
+        fprintf(fp, "\nAsync thread Blocks     Size       Waits      Drops      Max queue  Errors\n");
+        fprintf(fp,   "------------ ---------- ---------- ---------- ---------- ---------- ----------\n");
+        for (int i = 0; i < pl->async_stats_cnt; i++) {
+            const PcapLogAsyncStats *st = &pl->async_stats[i];
+            char blocks_str[32], size_str[32], waits_str[32], drops_str[32];
+            char errors_str[32];
+            FormatNumber(st->blocks, blocks_str, sizeof(blocks_str));
+            FormatBytes(st->bytes, size_str, sizeof(size_str));
+            FormatNumber(st->waits, waits_str, sizeof(waits_str));
+            FormatNumber(st->drops, drops_str, sizeof(drops_str));
+            FormatNumber(st->write_errors, errors_str, sizeof(errors_str));
+            fprintf(fp, "%-12"PRIu32" %-10s %-10s %-10s %-10s %-10"PRIu32" %-10s\n",
+                    st->thread_number, blocks_str, size_str, waits_str,
+                    drops_str, st->queue_max, errors_str);
+        }
+    }
+
     if (fp != stdout)
         fclose(fp);
 }
@@ -1846,3 +3453,594 @@ void PcapLogProfileSetup(void)
         }
     }
 }
+
+#ifdef UNITTESTS
+#ifdef BUILD_UNIX_SOCKET
+typedef struct PcapLogTestFlow_ {
+    Flow f;
+    uint32_t flow_hash;
+    uint8_t payload;            /**< byte the packets of the flow are filled with */
+} PcapLogTestFlow;
+
+static void PcapLogTestFlowInit(PcapLogTestFlow *tf, const char *src,
+        const char *dst, uint16_t sp, uint16_t dp, uint8_t payload)
+{
+    memset(tf, 0, sizeof(*tf));
+    tf->f.flags |= FLOW_IPV4;
+    tf->f.proto = IPPROTO_TCP;
+    inet_pton(AF_INET, src, &tf->f.src.addr_data32[0]);
+    inet_pton(AF_INET, dst, &tf->f.dst.addr_data32[0]);
+    tf->f.sp = sp;
+    tf->f.dp = dp;
+    tf->flow_hash = payload;
+    tf->payload = payload;
+}
+
+/** \internal
+ *  \brief append a packet record of the flow to the pcap and the index */
+static int PcapLogTestWritePacket(FILE *fp, PcapLogIndex *idx,
+        PcapLogTestFlow *tf, uint32_t ts_sec)
+{
+    Packet *p = SCCalloc(1, SIZE_OF_PACKET);
+    if (p == NULL)
+        return -1;
+    p->flow = &tf->f;
+    p->flow_hash = tf->flow_hash;
+    p->ts.tv_sec = ts_sec;
+
+    uint8_t data[8];
+    memset(data, tf->payload, sizeof(data));
+    PcapLogRecordHdr rh = { .ts_sec = ts_sec, .ts_usec = 0,
+        .caplen = sizeof(data), .len = sizeof(data) };
+    const long offset = ftell(fp);
+    int r = -1;
+    if (offset >= 0 && fwrite(&rh, sizeof(rh), 1, fp) == 1 &&
+            fwrite(data, sizeof(data), 1, fp) == 1) {
+        PcapLogIndexAdd(idx, p, (uint64_t)offset);
+        r = 0;
+    }
+    SCFree(p);
+    return r;
+}
+
+static FILE *PcapLogTestOpenPcap(const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+        return NULL;
+    struct pcap_file_header fh;
+    memset(&fh, 0, sizeof(fh));
+    fh.magic = 0xa1b2c3d4;
+    fh.version_major = PCAP_VERSION_MAJOR;
+    fh.version_minor = PCAP_VERSION_MINOR;
+    fh.snaplen = PCAP_SNAPLEN;
+    fh.linktype = DLT_EN10MB;
+    if (fwrite(&fh, sizeof(fh), 1, fp) != 1) {
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+/** \internal
+ *  \brief run the extract command for the flow between 10.0.0.1 and
+ *         10.0.0.2 and return the "message" of the answer */
+static json_t *PcapLogTestExtract(const char *outname)
+{
+    json_t *cmd = json_object();
+    json_t *answer = json_object();
+    if (cmd == NULL || answer == NULL) {
+        json_decref(cmd);
+        json_decref(answer);
+        return NULL;
+    }
+    json_object_set_new(cmd, "src-ip", json_string("10.0.0.2"));
+    json_object_set_new(cmd, "dst-ip", json_string("10.0.0.1"));
+    json_object_set_new(cmd, "filename", json_string(outname));
+
+    json_t *msg = NULL;
+    if (PcapLogUnixSocketExtract(cmd, answer, NULL) == TM_ECODE_OK) {
+        msg = json_incref(json_object_get(answer, "message"));
+    }
+    json_decref(cmd);
+    json_decref(answer);
+    return msg;
+}
+
+static int PcapLogTestJsonInt(const json_t *msg, const char *key)
+{
+    return (int)json_integer_value(json_object_get(msg, key));
+}
+
+/** \test extract the packets of one of two flows through the index */
+static int PcapLogIndexTest01(void)
+{
+    char dir[] = "/tmp/suricata-pcap-log-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+    char filename[PATH_MAX], outname[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s/log.pcap", dir);
+    snprintf(outname, sizeof(outname), "%s/out.pcap", dir);
+
+    PcapLogTestFlow a, b;
+    PcapLogTestFlowInit(&a, "10.0.0.1", "10.0.0.2", 1024, 80, 'a');
+    PcapLogTestFlowInit(&b, "10.0.0.1", "10.0.0.3", 1025, 80, 'b');
+
+    PcapLogIndex *idx = PcapLogIndexNew();
+    FAIL_IF_NULL(idx);
+    idx->linktype = DLT_EN10MB;
+    FILE *fp = PcapLogTestOpenPcap(filename);
+    FAIL_IF_NULL(fp);
+    FAIL_IF(PcapLogTestWritePacket(fp, idx, &b, 100) != 0);
+    FAIL_IF(PcapLogTestWritePacket(fp, idx, &a, 101) != 0);
+    FAIL_IF(PcapLogTestWritePacket(fp, idx, &b, 102) != 0);
+    FAIL_IF(PcapLogTestWritePacket(fp, idx, &a, 103) != 0);
+    FAIL_IF(fclose(fp) != 0);
+
+    size_t len = 0;
+    uint8_t *buf = PcapLogIndexFinish(idx, &len);
+    FAIL_IF_NULL(buf);
+    const PcapLogIndexHdr *hdr = (const PcapLogIndexHdr *)buf;
+    FAIL_IF(hdr->entry_cnt != 2);
+    FAIL_IF(hdr->offset_cnt != 4);
+    FAIL_IF(hdr->first_ts != 100 * 1000000ULL);
+    FAIL_IF(hdr->last_ts != 103 * 1000000ULL);
+    FAIL_IF(len != sizeof(*hdr) + 2 * sizeof(PcapLogIndexEntry) +
+            4 * sizeof(uint64_t));
+    /* the index is reset for the next file */
+    FAIL_IF(idx->flow_cnt != 0);
+    FAIL_IF(idx->offset_cnt != 0);
+    PcapLogIndexWrite(filename, buf, len);
+    SCFree(buf);
+    PcapLogIndexFree(idx);
+
+    g_pcap_index_enabled = true;
+    json_t *msg = PcapLogTestExtract(outname);
+    g_pcap_index_enabled = false;
+    FAIL_IF_NULL(msg);
+    FAIL_IF(PcapLogTestJsonInt(msg, "packets") != 2);
+    FAIL_IF(PcapLogTestJsonInt(msg, "flows") != 1);
+    FAIL_IF(PcapLogTestJsonInt(msg, "files") != 1);
+    json_decref(msg);
+
+    /* only the records of flow a, in order */
+    fp = fopen(outname, "r");
+    FAIL_IF_NULL(fp);
+    struct pcap_file_header fh;
+    FAIL_IF(fread(&fh, sizeof(fh), 1, fp) != 1);
+    FAIL_IF(fh.magic != 0xa1b2c3d4);
+    FAIL_IF(fh.linktype != DLT_EN10MB);
+    for (uint32_t ts = 101; ts <= 103; ts += 2) {
+        PcapLogRecordHdr rh;
+        uint8_t data[8];
+        FAIL_IF(fread(&rh, sizeof(rh), 1, fp) != 1);
+        FAIL_IF(rh.ts_sec != ts);
+        FAIL_IF(rh.caplen != sizeof(data));
+        FAIL_IF(fread(data, sizeof(data), 1, fp) != 1);
+        FAIL_IF(memchr(data, 'b', sizeof(data)) != NULL);
+        FAIL_IF(data[0] != 'a');
+    }
+    FAIL_IF(fgetc(fp) != EOF);
+    fclose(fp);
+
+    PcapLogIndexRemove(filename);
+    FAIL_IF_NOT(TAILQ_EMPTY(&pcap_index_files));
+    unlink(filename);
+    unlink(outname);
+    rmdir(dir);
+    PASS;
+}
+
+/** \test a missing or corrupt index is skipped, the extract still
+ *        produces an empty pcap */
+static int PcapLogIndexTest02(void)
+{
+    char dir[] = "/tmp/suricata-pcap-log-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+    char filename[PATH_MAX], outname[PATH_MAX], path[PATH_MAX];
+    snprintf(filename, sizeof(filename), "%s/log.pcap", dir);
+    snprintf(outname, sizeof(outname), "%s/out.pcap", dir);
+    PcapLogIndexFileName(filename, path, sizeof(path));
+
+    PcapLogTestFlow a;
+    PcapLogTestFlowInit(&a, "10.0.0.1", "10.0.0.2", 1024, 80, 'a');
+    PcapLogIndex *idx = PcapLogIndexNew();
+    FAIL_IF_NULL(idx);
+    FILE *fp = PcapLogTestOpenPcap(filename);
+    FAIL_IF_NULL(fp);
+    FAIL_IF(PcapLogTestWritePacket(fp, idx, &a, 100) != 0);
+    FAIL_IF(fclose(fp) != 0);
+    size_t len = 0;
+    uint8_t *buf = PcapLogIndexFinish(idx, &len);
+    FAIL_IF_NULL(buf);
+    PcapLogIndexFree(idx);
+
+    /* nothing to finish */
+    idx = PcapLogIndexNew();
+    FAIL_IF_NULL(idx);
+    size_t empty_len = 0;
+    FAIL_IF_NOT_NULL(PcapLogIndexFinish(idx, &empty_len));
+    PcapLogIndexFree(idx);
+
+    PcapLogIndexHdr hdr;
+    g_pcap_index_enabled = true;
+
+    /* missing */
+    PcapLogIndexRegister(filename, 0, UINT64_MAX);
+    FAIL_IF(PcapLogIndexReadHdr(filename, &hdr));
+    json_t *msg = PcapLogTestExtract(outname);
+    FAIL_IF_NULL(msg);
+    FAIL_IF(PcapLogTestJsonInt(msg, "packets") != 0);
+    FAIL_IF(PcapLogTestJsonInt(msg, "files") != 0);
+    json_decref(msg);
+
+    /* truncated: the header is fine, the offsets are missing */
+    fp = fopen(path, "w");
+    FAIL_IF_NULL(fp);
+    FAIL_IF(fwrite(buf, len - sizeof(uint64_t), 1, fp) != 1);
+    fclose(fp);
+    FAIL_IF_NOT(PcapLogIndexReadHdr(filename, &hdr));
+    msg = PcapLogTestExtract(outname);
+    FAIL_IF_NULL(msg);
+    FAIL_IF(PcapLogTestJsonInt(msg, "packets") != 0);
+    FAIL_IF(PcapLogTestJsonInt(msg, "files") != 0);
+    json_decref(msg);
+
+    /* bad magic */
+    memcpy(buf, "XXXXXXXX", 8);
+    fp = fopen(path, "w");
+    FAIL_IF_NULL(fp);
+    FAIL_IF(fwrite(buf, len, 1, fp) != 1);
+    fclose(fp);
+    FAIL_IF(PcapLogIndexReadHdr(filename, &hdr));
+    msg = PcapLogTestExtract(outname);
+    FAIL_IF_NULL(msg);
+    FAIL_IF(PcapLogTestJsonInt(msg, "packets") != 0);
+    FAIL_IF(PcapLogTestJsonInt(msg, "files") != 0);
+    json_decref(msg);
+
+    /* the output is a valid, empty pcap */
+    struct stat st;
+    FAIL_IF(stat(outname, &st) != 0);
+    FAIL_IF(st.st_size != sizeof(struct pcap_file_header));
+
+    g_pcap_index_enabled = false;
+    SCFree(buf);
+    PcapLogIndexRemove(filename);
+    FAIL_IF_NOT(TAILQ_EMPTY(&pcap_index_files));
+    unlink(filename);
+    unlink(outname);
+    rmdir(dir);
+    PASS;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+#define PCAP_LOG_TEST_CAPLEN 1500
+#define PCAP_LOG_TEST_RECORD (sizeof(PcapLogRecordHdr) + PCAP_LOG_TEST_CAPLEN)
+
+static void PcapLogAsyncTestFree(void)
+{
+    for (int i = 0; i < g_pcap_async.writer_cnt; i++) {
+        PcapLogWriter *w = &g_pcap_async.writers[i];
+        SCCtrlCondDestroy(&w->done_cond);
+        SCCtrlCondDestroy(&w->cond);
+        SCCtrlMutexDestroy(&w->mutex);
+    }
+    SCFree(g_pcap_async.writers);
+    memset(&g_pcap_async, 0, sizeof(g_pcap_async));
+    PcapLogAsyncWritevFunc = writev;
+}
+
+/** \internal
+ *  \brief log a packet of PCAP_LOG_TEST_CAPLEN bytes filled with the
+ *         low byte of ts_sec */
+static int PcapLogAsyncTestWrite(PcapLogData *pl, uint32_t ts_sec,
+        uint64_t *offset)
+{
+    uint8_t data[PCAP_LOG_TEST_CAPLEN];
+    memset(data, (uint8_t)ts_sec, sizeof(data));
+
+    Packet *p = SCCalloc(1, SIZE_OF_PACKET);
+    if (p == NULL)
+        return -1;
+    p->ext_pkt = data;
+    SET_PKT_LEN(p, sizeof(data));
+    p->ts.tv_sec = ts_sec;
+    p->datalink = DLT_EN10MB;
+    int r = PcapLogAsyncWrite(pl, p, sizeof(data), offset);
+    SCFree(p);
+    return r;
+}
+
+/** \internal
+ *  \brief check that the file holds the records of the packets logged
+ *         with PcapLogAsyncTestWrite at the times in ts, and nothing else */
+static bool PcapLogAsyncTestCheckFile(const char *filename,
+        const uint32_t *ts, uint32_t cnt)
+{
+    bool ok = false;
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+        return false;
+
+    struct pcap_file_header fh;
+    if (fread(&fh, sizeof(fh), 1, fp) != 1 || fh.magic != 0xa1b2c3d4 ||
+            fh.linktype != DLT_EN10MB)
+        goto end;
+    for (uint32_t i = 0; i < cnt; i++) {
+        PcapLogRecordHdr rh;
+        uint8_t data[PCAP_LOG_TEST_CAPLEN];
+        if (fread(&rh, sizeof(rh), 1, fp) != 1 || rh.ts_sec != ts[i] ||
+                rh.caplen != sizeof(data) || rh.len != sizeof(data))
+            goto end;
+        if (fread(data, sizeof(data), 1, fp) != 1)
+            goto end;
+        for (size_t n = 0; n < sizeof(data); n++) {
+            if (data[n] != (uint8_t)ts[i])
+                goto end;
+        }
+    }
+    ok = fgetc(fp) == EOF;
+end:
+    fclose(fp);
+    return ok;
+}
+
+/** \test records split over two blocks are written in one piece */
+static int PcapLogAsyncTest01(void)
+{
+    char filename[] = "/tmp/suricata-pcap-log-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd == -1);
+    close(fd);
+
+    PcapLogAsyncInit(1, PCAP_LOG_ASYNC_ALIGN, 4, 0, false);
+    PcapLogData pl;
+    memset(&pl, 0, sizeof(pl));
+    pl.filename = filename;
+    pl.async = PcapLogAsyncNew(1);
+    FAIL_IF_NULL(pl.async);
+
+    const uint32_t ts[] = { 1, 2, 3, 4 };
+    for (uint32_t i = 0; i < ARRAY_SIZE(ts); i++) {
+        uint64_t offset = 0;
+        FAIL_IF(PcapLogAsyncTestWrite(&pl, ts[i], &offset) != 0);
+        FAIL_IF(offset != sizeof(struct pcap_file_header) +
+                i * PCAP_LOG_TEST_RECORD);
+    }
+    /* the 3rd record filled the first block, it was written inline */
+    FAIL_IF(pl.async->stats.blocks != 1);
+    FAIL_IF(pl.async->stats.bytes != PCAP_LOG_ASYNC_ALIGN);
+
+    PcapLogAsyncClose(pl.async, NULL);
+    PcapLogAsyncFinish(pl.async);
+    FAIL_IF(pl.async->fd != -1);
+    FAIL_IF(pl.async->stats.drops != 0);
+    FAIL_IF_NOT(PcapLogAsyncTestCheckFile(filename, ts, ARRAY_SIZE(ts)));
+
+    PcapLogAsyncFree(pl.async);
+    PcapLogAsyncTestFree();
+    unlink(filename);
+    PASS;
+}
+
+static int pcap_log_test_writev_calls = 0;
+static size_t pcap_log_test_writev_max = 0;
+static size_t pcap_log_test_writev_len[64];
+
+/** \internal
+ *  \brief writev interrupted on the first call, after that writing at
+ *         most pcap_log_test_writev_max bytes per call */
+static ssize_t PcapLogAsyncTestWritev(int fd, const struct iovec *iov, int iovcnt)
+{
+    const int call = pcap_log_test_writev_calls++;
+    if (call == 0) {
+        errno = EINTR;
+        return -1;
+    }
+
+    struct iovec short_iov[PCAP_LOG_ASYNC_MAX_IOV];
+    size_t left = pcap_log_test_writev_max;
+    int cnt = 0;
+    for (int i = 0; i < iovcnt && left > 0; i++, cnt++) {
+        short_iov[i] = iov[i];
+        if (short_iov[i].iov_len > left)
+            short_iov[i].iov_len = left;
+        left -= short_iov[i].iov_len;
+    }
+    ssize_t r = writev(fd, short_iov, cnt);
+    if (r > 0 && call < (int)ARRAY_SIZE(pcap_log_test_writev_len))
+        pcap_log_test_writev_len[call] = (size_t)r;
+    return r;
+}
+
+/** \test short writes continue where the previous write stopped */
+static int PcapLogAsyncTest02(void)
+{
+    char filename[] = "/tmp/suricata-pcap-log-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd == -1);
+    close(fd);
+
+    PcapLogAsyncInit(1, PCAP_LOG_ASYNC_ALIGN, 4, 0, false);
+    PcapLogAsyncWritevFunc = PcapLogAsyncTestWritev;
+    pcap_log_test_writev_calls = 0;
+    /* not a divisor of the record or block size */
+    pcap_log_test_writev_max = 1000;
+
+    PcapLogData pl;
+    memset(&pl, 0, sizeof(pl));
+    pl.filename = filename;
+    pl.async = PcapLogAsyncNew(1);
+    FAIL_IF_NULL(pl.async);
+
+    const uint32_t ts[] = { 1, 2, 3, 4, 5, 6 };
+    for (uint32_t i = 0; i < ARRAY_SIZE(ts); i++) {
+        uint64_t offset = 0;
+        FAIL_IF(PcapLogAsyncTestWrite(&pl, ts[i], &offset) != 0);
+    }
+    PcapLogAsyncClose(pl.async, NULL);
+    PcapLogAsyncFinish(pl.async);
+
+    const size_t size = sizeof(struct pcap_file_header) +
+        ARRAY_SIZE(ts) * PCAP_LOG_TEST_RECORD;
+    /* the interrupted call, then at most 1000 bytes per call */
+    FAIL_IF(pcap_log_test_writev_calls < 1 + (int)((size + 999) / 1000));
+    FAIL_IF(pl.async->stats.write_errors != 0);
+    FAIL_IF_NOT(PcapLogAsyncTestCheckFile(filename, ts, ARRAY_SIZE(ts)));
+
+    PcapLogAsyncFree(pl.async);
+    PcapLogAsyncTestFree();
+    unlink(filename);
+    PASS;
+}
+
+/** \test with O_DIRECT only whole blocks are written, the tail is
+ *        written after switching it off and the file is not padded */
+static int PcapLogAsyncTest03(void)
+{
+    char filename[] = "/tmp/suricata-pcap-log-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd == -1);
+
+    /* partial blocks are not flushed on the interval */
+    PcapLogAsyncInit(1, PCAP_LOG_ASYNC_ALIGN, 4, 1, true);
+    PcapLogData pl;
+    memset(&pl, 0, sizeof(pl));
+    pl.filename = filename;
+    pl.async = PcapLogAsyncNew(1);
+    FAIL_IF_NULL(pl.async);
+    uint64_t offset = 0;
+    FAIL_IF(PcapLogAsyncTestWrite(&pl, 10, &offset) != 0);
+    FAIL_IF(PcapLogAsyncTestWrite(&pl, 20, &offset) != 0);
+    FAIL_IF(pl.async->stats.blocks != 0);
+    FAIL_IF_NULL(pl.async->cur);
+
+    /* a whole block and a tail, the file system may not support O_DIRECT
+     * so the fd is set up by hand */
+    const size_t tail = 476;
+    uint8_t *buf = SCMallocAligned(2 * PCAP_LOG_ASYNC_ALIGN, PCAP_LOG_ASYNC_ALIGN);
+    FAIL_IF_NULL(buf);
+    for (size_t i = 0; i < PCAP_LOG_ASYNC_ALIGN + tail; i++)
+        buf[i] = (uint8_t)i;
+    struct iovec iov[2] = {
+        { buf, PCAP_LOG_ASYNC_ALIGN - 100 },
+        { buf + PCAP_LOG_ASYNC_ALIGN - 100, tail + 100 },
+    };
+    PcapLogAsync a;
+    memset(&a, 0, sizeof(a));
+    a.fd = fd;
+    a.direct = true;
+    PcapLogAsyncWritevFunc = PcapLogAsyncTestWritev;
+    pcap_log_test_writev_calls = 0;
+    pcap_log_test_writev_max = SIZE_MAX;
+    PcapLogAsyncWritev(&a, iov, 2);
+    PcapLogAsyncWritevFunc = writev;
+
+    /* the interrupted call, the aligned part, the tail */
+    FAIL_IF(pcap_log_test_writev_calls != 3);
+    FAIL_IF(pcap_log_test_writev_len[1] != PCAP_LOG_ASYNC_ALIGN);
+    FAIL_IF(pcap_log_test_writev_len[2] != tail);
+    FAIL_IF(a.direct);
+    FAIL_IF(a.stats.write_errors != 0);
+#ifdef O_DIRECT
+    FAIL_IF(fcntl(fd, F_GETFL) & O_DIRECT);
+#endif
+    close(fd);
+
+    uint8_t rbuf[PCAP_LOG_ASYNC_ALIGN + 476 + 1];
+    FILE *fp = fopen(filename, "r");
+    FAIL_IF_NULL(fp);
+    size_t len = fread(rbuf, 1, sizeof(rbuf), fp);
+    fclose(fp);
+    FAIL_IF(len != PCAP_LOG_ASYNC_ALIGN + tail);
+    FAIL_IF(memcmp(rbuf, buf, len) != 0);
+    SCFreeAligned(buf);
+
+    /* the partial block is written when the file is closed */
+    PcapLogAsyncClose(pl.async, NULL);
+    PcapLogAsyncFinish(pl.async);
+    const uint32_t ts[] = { 10, 20 };
+    FAIL_IF_NOT(PcapLogAsyncTestCheckFile(filename, ts, ARRAY_SIZE(ts)));
+    struct stat st;
+    FAIL_IF(stat(filename, &st) != 0);
+    FAIL_IF((size_t)st.st_size != sizeof(struct pcap_file_header) +
+            ARRAY_SIZE(ts) * PCAP_LOG_TEST_RECORD);
+
+    PcapLogAsyncFree(pl.async);
+    PcapLogAsyncTestFree();
+    unlink(filename);
+    PASS;
+}
+
+/** \test packets are dropped and counted while all blocks are queued,
+ *        the queue is written when the writer stops */
+static int PcapLogAsyncTest04(void)
+{
+    char filename[] = "/tmp/suricata-pcap-log-XXXXXX";
+    int fd = mkstemp(filename);
+    FAIL_IF(fd == -1);
+    close(fd);
+
+    PcapLogAsyncInit(1, PCAP_LOG_ASYNC_ALIGN, 2, 0, false);
+    PcapLogWriter *w = &g_pcap_async.writers[0];
+    /* no thread, the queue is only written by the flush below */
+    w->running = 1;
+
+    PcapLogData pl;
+    memset(&pl, 0, sizeof(pl));
+    pl.filename = filename;
+    pl.async = PcapLogAsyncNew(1);
+    FAIL_IF_NULL(pl.async);
+
+    /* 5 records fill the first block and most of the second */
+    uint64_t offset = 0;
+    for (uint32_t ts = 1; ts <= 5; ts++) {
+        FAIL_IF(PcapLogAsyncTestWrite(&pl, ts, &offset) != 0);
+    }
+    FAIL_IF(pl.async->queued != 1);
+    FAIL_IF(pl.async->stats.queue_max != 1);
+    FAIL_IF_NOT(TAILQ_EMPTY(&pl.async->free));
+
+    /* no block for the next one */
+    FAIL_IF(PcapLogAsyncTestWrite(&pl, 6, &offset) != -1);
+    FAIL_IF(PcapLogAsyncTestWrite(&pl, 7, &offset) != -1);
+    FAIL_IF(pl.async->stats.drops != 2);
+    FAIL_IF(pl.async->stats.waits != 0);
+    FAIL_IF(pl.async->file_offset != sizeof(struct pcap_file_header) +
+            5 * PCAP_LOG_TEST_RECORD);
+
+    PcapLogWriterFlush(w, true);
+    FAIL_IF(w->running);
+    FAIL_IF_NOT(TAILQ_EMPTY(&w->queue));
+    FAIL_IF(pl.async->queued != 0);
+
+    /* written inline from now on */
+    FAIL_IF(PcapLogAsyncTestWrite(&pl, 8, &offset) != 0);
+    FAIL_IF(offset != sizeof(struct pcap_file_header) + 5 * PCAP_LOG_TEST_RECORD);
+    PcapLogAsyncClose(pl.async, NULL);
+    PcapLogAsyncFinish(pl.async);
+    FAIL_IF(pl.async->stats.drops != 2);
+
+    const uint32_t ts[] = { 1, 2, 3, 4, 5, 8 };
+    FAIL_IF_NOT(PcapLogAsyncTestCheckFile(filename, ts, ARRAY_SIZE(ts)));
+
+    PcapLogAsyncFree(pl.async);
+    PcapLogAsyncTestFree();
+    unlink(filename);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PcapLogRegisterTests(void)
+{
+#ifdef UNITTESTS
+#ifdef BUILD_UNIX_SOCKET
+    UtRegisterTest("PcapLogIndexTest01", PcapLogIndexTest01);
+    UtRegisterTest("PcapLogIndexTest02", PcapLogIndexTest02);
+#endif
+    UtRegisterTest("PcapLogAsyncTest01", PcapLogAsyncTest01);
+    UtRegisterTest("PcapLogAsyncTest02", PcapLogAsyncTest02);
+    UtRegisterTest("PcapLogAsyncTest03", PcapLogAsyncTest03);
+    UtRegisterTest("PcapLogAsyncTest04", PcapLogAsyncTest04);
+#endif
+}
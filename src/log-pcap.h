@@ -30,5 +30,11 @@
 
 void PcapLogRegister(void);
 void PcapLogProfileSetup(void);
+void PcapLogWriterThreadSpawn(void);
+void PcapLogRegisterTests(void);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode PcapLogUnixSocketExtract(json_t *cmd, json_t *answer, void *data);
+#endif
 
 #endif /* __LOG_PCAP_H__ */
@@ -26,8 +26,18 @@
 #include "output-filestore.h"
 #include "output-json-file.h"
 
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "queue.h"
+
 #include "util-print.h"
 #include "util-misc.h"
+#include "util-hash.h"
+#include "util-privs.h"
+#include "util-unittest.h"
+
+#include <sys/uio.h>
 
 #ifdef HAVE_NSS
 
@@ -55,6 +65,8 @@ typedef struct OutputFilestoreCtx_ {
 
 typedef struct OutputFilestoreLogThread_ {
     OutputFilestoreCtx *ctx;
+    /* async output: files being buffered or streamed, by file_store_id */
+    HashTable *files;
     uint16_t counter_max_hits;
     uint16_t fs_error_counter;
 } OutputFilestoreLogThread;
@@ -121,52 +133,89 @@ static void OutputFilestoreUpdateFileTime(const char *src_filename,
     }
 }
 
-static void OutputFilestoreFinalizeFiles(ThreadVars *tv,
-        const OutputFilestoreLogThread *oft, const OutputFilestoreCtx *ctx,
-        const Packet *p, File *ff, uint8_t dir) {
+static void OutputFilestoreFinalFilename(const OutputFilestoreCtx *ctx,
+        const uint8_t *sha256, char *out, size_t out_size)
+{
     /* Stringify the SHA256 which will be used in the final
      * filename. */
     char sha256string[(SHA256_LENGTH * 2) + 1];
-    PrintHexString(sha256string, sizeof(sha256string), ff->sha256,
-            sizeof(ff->sha256));
+    PrintHexString(sha256string, sizeof(sha256string), (uint8_t *)sha256,
+            SHA256_LENGTH);
 
-    char tmp_filename[PATH_MAX] = "";
-    snprintf(tmp_filename, sizeof(tmp_filename), "%s/file.%u", ctx->tmpdir,
-            ff->file_store_id);
-
-    char final_filename[PATH_MAX] = "";
-    snprintf(final_filename, sizeof(final_filename), "%s/%c%c/%s",
+    snprintf(out, out_size, "%s/%c%c/%s",
             ctx->prefix, sha256string[0], sha256string[1], sha256string);
+}
+
+static bool OutputFilestoreFileinfoFilename(char *out, size_t out_size,
+        const char *final_filename, uint64_t ts, uint32_t file_store_id)
+{
+    if (snprintf(out, out_size, "%s.%"PRIuMAX".%u.json", final_filename,
+                (uintmax_t)ts, file_store_id) == (int)out_size) {
+        WARN_ONCE(SC_ERR_SPRINTF,
+                "Failed to write file info record. Output filename truncated.");
+        return false;
+    }
+    return true;
+}
 
+/**
+ * \brief Move a completed temporary file to its final name, or drop
+ *     it if a file with the same content was stored before.
+ *
+ * \param errors Incremented for each file system error.
+ *
+ * \retval true if the file is at its final name.
+ */
+static bool OutputFilestoreMoveFile(const char *tmp_filename,
+        const char *final_filename, uint32_t *errors)
+{
     if (SCPathExists(final_filename)) {
         OutputFilestoreUpdateFileTime(tmp_filename, final_filename);
         if (unlink(tmp_filename) != 0) {
-            StatsIncr(tv, oft->fs_error_counter);
+            (*errors)++;
             WARN_ONCE(SC_WARN_REMOVE_FILE,
                     "Failed to remove temporary file %s: %s", tmp_filename,
                     strerror(errno));
         }
     } else if (rename(tmp_filename, final_filename) != 0) {
-        StatsIncr(tv, oft->fs_error_counter);
+        (*errors)++;
         WARN_ONCE(SC_WARN_RENAMING_FILE, "Failed to rename %s to %s: %s",
                 tmp_filename, final_filename, strerror(errno));
         if (unlink(tmp_filename) != 0) {
             /* Just increment, don't log as has_fs_errors would
              * already be set above. */
-            StatsIncr(tv, oft->fs_error_counter);
+            (*errors)++;
         }
+        return false;
+    }
+    return true;
+}
+
+static void OutputFilestoreFinalizeFiles(ThreadVars *tv,
+        const OutputFilestoreLogThread *oft, const OutputFilestoreCtx *ctx,
+        const Packet *p, File *ff, uint8_t dir) {
+    char tmp_filename[PATH_MAX] = "";
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s/file.%u", ctx->tmpdir,
+            ff->file_store_id);
+
+    char final_filename[PATH_MAX] = "";
+    OutputFilestoreFinalFilename(ctx, ff->sha256, final_filename,
+            sizeof(final_filename));
+
+    uint32_t errors = 0;
+    bool moved = OutputFilestoreMoveFile(tmp_filename, final_filename, &errors);
+    if (errors > 0) {
+        StatsAddUI64(tv, oft->fs_error_counter, errors);
+    }
+    if (!moved) {
         return;
     }
 
     if (ctx->fileinfo) {
         char js_metadata_filename[PATH_MAX];
-        if (snprintf(js_metadata_filename, sizeof(js_metadata_filename),
-                        "%s.%"PRIuMAX".%u.json", final_filename,
-                        (uintmax_t)p->ts.tv_sec, ff->file_store_id)
-                == (int)sizeof(js_metadata_filename)) {
-            WARN_ONCE(SC_ERR_SPRINTF,
-                "Failed to write file info record. Output filename truncated.");
-        } else {
+        if (OutputFilestoreFileinfoFilename(js_metadata_filename,
+                    sizeof(js_metadata_filename), final_filename,
+                    (uint64_t)p->ts.tv_sec, ff->file_store_id)) {
             json_t *js_fileinfo = JsonBuildFileInfoRecord(p, ff, true, dir,
                     ctx->xff_cfg);
             if (likely(js_fileinfo != NULL)) {
@@ -177,6 +226,818 @@ static void OutputFilestoreFinalizeFiles(ThreadVars *tv,
     }
 }
 
+/*
+ * Async output. File data is handed to writer threads, which batch the
+ * writes and keep a cache of open tmp files. Files up to
+ * dedup-buffer-size are kept in memory until they are complete, so a
+ * file whose sha256 was stored before is not written to disk again.
+ */
+
+#define FILESTORE_ASYNC_DEFAULT_THREADS     2
+#define FILESTORE_ASYNC_DEFAULT_QUEUE       (64 * 1024 * 1024)
+#define FILESTORE_ASYNC_DEFAULT_BUFFER      (1024 * 1024)
+#define FILESTORE_ASYNC_DEFAULT_INDEX       (1 << 20)
+#define FILESTORE_ASYNC_DEFAULT_FDS         32
+#define FILESTORE_ASYNC_MAX_THREADS         64
+#define FILESTORE_ASYNC_MAX_IOV             64
+
+static const char *thread_name_filestore = "FilestoreWriter";
+
+enum {
+    /* file data, appended to the tmp file */
+    FILESTORE_JOB_DATA = 0,
+    /* end of a streamed file: close the tmp file and move it in place */
+    FILESTORE_JOB_CLOSE,
+    /* a complete file from memory, not written if already stored */
+    FILESTORE_JOB_STORE,
+};
+
+typedef struct FilestoreJob_ {
+    uint8_t type;
+    /* first data of the file, (re)create the tmp file */
+    bool open;
+    uint32_t file_store_id;
+    uint8_t *data;
+    uint32_t len;
+    uint8_t sha256[SHA256_LENGTH];
+    /* fileinfo record and the timestamp used in its filename */
+    char *fileinfo;
+    uint64_t ts;
+    TAILQ_ENTRY(FilestoreJob_) next;
+} FilestoreJob;
+
+typedef TAILQ_HEAD(FilestoreJobQueue_, FilestoreJob_) FilestoreJobQueue;
+
+typedef struct FilestoreFd_ {
+    uint32_t file_store_id;
+    int fd;
+    uint64_t used;
+} FilestoreFd;
+
+typedef struct FilestoreWriter_ {
+    SCCtrlMutex mutex;
+    /* wakes the writer when jobs are queued */
+    SCCtrlCondT cond;
+    /* wakes workers waiting for room in a full queue */
+    SCCtrlCondT space_cond;
+    FilestoreJobQueue queue;
+    /* bytes of file data queued or being written */
+    uint64_t queued;
+    /* set while the writer thread runs, else jobs are done inline */
+    int running;
+
+    /* held while jobs are processed, by the writer thread or inline */
+    SCMutex proc_lock;
+    /* tmp files kept open between jobs, least recently used is closed
+     * first */
+    FilestoreFd *fds;
+    uint32_t fds_cnt;
+    uint64_t fds_tick;
+} FilestoreWriter;
+
+/* Stored files by the first 8 bytes of their sha256. Open addressing,
+ * entries are never removed. A stale entry only costs a failed utime()
+ * after which the file is written again. */
+typedef struct FilestoreIndex_ {
+    SCMutex lock;
+    uint64_t *slots;
+    /* power of 2 */
+    uint32_t size;
+    uint32_t cnt;
+} FilestoreIndex;
+
+static struct {
+    bool enabled;
+    /* files up to this size are buffered on the worker until closed */
+    uint32_t buffer_size;
+    /* per writer */
+    uint64_t max_queue;
+    uint32_t max_fds;
+    int writer_cnt;
+    FilestoreWriter *writers;
+    FilestoreIndex index;
+    const OutputFilestoreCtx *ctx;
+} g_filestore_async = { .enabled = false };
+
+static SC_ATOMIC_DECLARE(uint64_t, filestore_async_queued);
+static SC_ATOMIC_DECLARE(uint64_t, filestore_async_dedup);
+static SC_ATOMIC_DECLARE(uint64_t, filestore_async_stalls);
+static SC_ATOMIC_DECLARE(uint64_t, filestore_async_errors);
+
+/* per worker: data of a file that is not complete yet */
+typedef struct FilestoreFile_ {
+    uint32_t file_store_id;
+    /* too large to buffer, the data goes to the writer as it comes */
+    bool streaming;
+    uint8_t *buf;
+    uint32_t len;
+    uint32_t size;
+} FilestoreFile;
+
+static uint64_t FilestoreAsyncQueuedCounter(void)
+{
+    return SC_ATOMIC_GET(filestore_async_queued);
+}
+
+static uint64_t FilestoreAsyncDedupCounter(void)
+{
+    return SC_ATOMIC_GET(filestore_async_dedup);
+}
+
+static uint64_t FilestoreAsyncStallsCounter(void)
+{
+    return SC_ATOMIC_GET(filestore_async_stalls);
+}
+
+static uint64_t FilestoreAsyncErrorsCounter(void)
+{
+    return SC_ATOMIC_GET(filestore_async_errors);
+}
+
+static inline uint64_t FilestoreIndexKey(const uint8_t *sha256)
+{
+    uint64_t key;
+    memcpy(&key, sha256, sizeof(key));
+    /* 0 marks an empty slot */
+    return key ? key : 1;
+}
+
+static bool FilestoreIndexLookup(FilestoreIndex *idx, const uint8_t *sha256)
+{
+    if (idx->slots == NULL)
+        return false;
+
+    const uint64_t key = FilestoreIndexKey(sha256);
+    const uint32_t mask = idx->size - 1;
+    bool found = false;
+
+    SCMutexLock(&idx->lock);
+    for (uint32_t i = 0; i < idx->size; i++) {
+        const uint64_t v = idx->slots[(key + i) & mask];
+        if (v == key) {
+            found = true;
+            break;
+        } else if (v == 0) {
+            break;
+        }
+    }
+    SCMutexUnlock(&idx->lock);
+    return found;
+}
+
+static void FilestoreIndexAdd(FilestoreIndex *idx, const uint8_t *sha256)
+{
+    if (idx->slots == NULL)
+        return;
+
+    const uint64_t key = FilestoreIndexKey(sha256);
+    const uint32_t mask = idx->size - 1;
+
+    SCMutexLock(&idx->lock);
+    /* keep the load factor below 3/4, after that new files are only
+     * deduplicated through the file system */
+    if (idx->cnt < idx->size / 4 * 3) {
+        for (uint32_t i = 0; i < idx->size; i++) {
+            uint64_t *v = &idx->slots[(key + i) & mask];
+            if (*v == key) {
+                break;
+            } else if (*v == 0) {
+                *v = key;
+                idx->cnt++;
+                break;
+            }
+        }
+    }
+    SCMutexUnlock(&idx->lock);
+}
+
+static void FilestoreJobFree(FilestoreJob *job)
+{
+    if (job->data != NULL)
+        SCFree(job->data);
+    if (job->fileinfo != NULL)
+        SCFree(job->fileinfo);
+    SCFree(job);
+}
+
+static int FilestoreWritev(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0) {
+        ssize_t r = writev(fd, iov, cnt);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t)r >= iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    return 0;
+}
+
+static void FilestoreTmpFilename(uint32_t file_store_id, char *out,
+        size_t out_size)
+{
+    snprintf(out, out_size, "%s/file.%u", g_filestore_async.ctx->tmpdir,
+            file_store_id);
+}
+
+static void FilestoreWriterCloseFd(FilestoreWriter *w, uint32_t file_store_id)
+{
+    for (uint32_t i = 0; i < w->fds_cnt; i++) {
+        if (w->fds[i].file_store_id == file_store_id) {
+            close(w->fds[i].fd);
+            SC_ATOMIC_SUB(filestore_open_file_cnt, 1);
+            w->fds[i] = w->fds[--w->fds_cnt];
+            return;
+        }
+    }
+}
+
+/**
+ * \brief Get the fd of a tmp file from the cache or open it.
+ *
+ * \param create true for the first data of a file
+ */
+static int FilestoreWriterGetFd(FilestoreWriter *w, uint32_t file_store_id,
+        bool create)
+{
+    for (uint32_t i = 0; i < w->fds_cnt; i++) {
+        if (w->fds[i].file_store_id == file_store_id) {
+            w->fds[i].used = ++w->fds_tick;
+            return w->fds[i].fd;
+        }
+    }
+
+    char filename[PATH_MAX] = "";
+    FilestoreTmpFilename(file_store_id, filename, sizeof(filename));
+    int fd;
+    if (create) {
+        fd = open(filename, O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY, 0644);
+    } else {
+        fd = open(filename, O_APPEND | O_NOFOLLOW | O_WRONLY);
+    }
+    if (fd == -1) {
+        (void) SC_ATOMIC_ADD(filestore_async_errors, 1);
+        WARN_ONCE(SC_ERR_OPENING_FILE,
+                "Filestore (v2) failed to open file %s: %s",
+                filename, strerror(errno));
+        return -1;
+    }
+
+    if (w->fds_cnt == g_filestore_async.max_fds) {
+        uint32_t lru = 0;
+        for (uint32_t i = 1; i < w->fds_cnt; i++) {
+            if (w->fds[i].used < w->fds[lru].used)
+                lru = i;
+        }
+        FilestoreWriterCloseFd(w, w->fds[lru].file_store_id);
+    }
+    w->fds[w->fds_cnt].file_store_id = file_store_id;
+    w->fds[w->fds_cnt].fd = fd;
+    w->fds[w->fds_cnt].used = ++w->fds_tick;
+    w->fds_cnt++;
+    SC_ATOMIC_ADD(filestore_open_file_cnt, 1);
+    return fd;
+}
+
+static void FilestoreWriterFileinfo(const FilestoreJob *job,
+        const char *final_filename)
+{
+    if (job->fileinfo == NULL)
+        return;
+
+    char filename[PATH_MAX];
+    if (!OutputFilestoreFileinfoFilename(filename, sizeof(filename),
+                final_filename, job->ts, job->file_store_id))
+        return;
+
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        (void) SC_ATOMIC_ADD(filestore_async_errors, 1);
+        WARN_ONCE(SC_ERR_OPENING_FILE,
+                "Filestore (v2) failed to create %s: %s", filename,
+                strerror(errno));
+        return;
+    }
+    if (fputs(job->fileinfo, fp) == EOF) {
+        (void) SC_ATOMIC_ADD(filestore_async_errors, 1);
+    }
+    fclose(fp);
+}
+
+/**
+ * \brief Write the data of a file, together with the data of the same
+ *     file further down the batch, with a single writev.
+ */
+static void FilestoreWriterData(FilestoreWriter *w, FilestoreJobQueue *batch,
+        FilestoreJob *first)
+{
+    struct iovec iov[FILESTORE_ASYNC_MAX_IOV];
+    FilestoreJob *jobs[FILESTORE_ASYNC_MAX_IOV];
+    int cnt = 0;
+
+    for (FilestoreJob *job = first; job != NULL && cnt < FILESTORE_ASYNC_MAX_IOV;
+            job = TAILQ_NEXT(job, next)) {
+        if (job->file_store_id != first->file_store_id)
+            continue;
+        if (job->type != FILESTORE_JOB_DATA || (cnt > 0 && job->open))
+            break;
+        jobs[cnt] = job;
+        iov[cnt].iov_base = job->data;
+        iov[cnt].iov_len = job->len;
+        cnt++;
+    }
+
+    int fd = FilestoreWriterGetFd(w, first->file_store_id, first->open);
+    if (fd != -1 && FilestoreWritev(fd, iov, cnt) != 0) {
+        (void) SC_ATOMIC_ADD(filestore_async_errors, 1);
+        WARN_ONCE(SC_ERR_FWRITE,
+                "Filestore (v2) failed to write to file.%u: %s",
+                first->file_store_id, strerror(errno));
+        FilestoreWriterCloseFd(w, first->file_store_id);
+    }
+
+    for (int i = 0; i < cnt; i++) {
+        TAILQ_REMOVE(batch, jobs[i], next);
+        FilestoreJobFree(jobs[i]);
+    }
+}
+
+static void FilestoreWriterClose(FilestoreWriter *w, const FilestoreJob *job)
+{
+    FilestoreWriterCloseFd(w, job->file_store_id);
+
+    char tmp_filename[PATH_MAX] = "";
+    FilestoreTmpFilename(job->file_store_id, tmp_filename, sizeof(tmp_filename));
+    char final_filename[PATH_MAX] = "";
+    OutputFilestoreFinalFilename(g_filestore_async.ctx, job->sha256,
+            final_filename, sizeof(final_filename));
+
+    uint32_t errors = 0;
+    bool moved = OutputFilestoreMoveFile(tmp_filename, final_filename, &errors);
+    if (errors > 0) {
+        (void) SC_ATOMIC_ADD(filestore_async_errors, errors);
+    }
+    if (moved) {
+        FilestoreIndexAdd(&g_filestore_async.index, job->sha256);
+        FilestoreWriterFileinfo(job, final_filename);
+    }
+}
+
+static void FilestoreWriterStore(const FilestoreJob *job)
+{
+    char final_filename[PATH_MAX] = "";
+    OutputFilestoreFinalFilename(g_filestore_async.ctx, job->sha256,
+            final_filename, sizeof(final_filename));
+
+    /* already stored: only update the timestamps, like a rename of a
+     * duplicate tmp file would */
+    if (FilestoreIndexLookup(&g_filestore_async.index, job->sha256) ||
+            SCPathExists(final_filename)) {
+        if (utime(final_filename, NULL) == 0) {
+            (void) SC_ATOMIC_ADD(filestore_async_dedup, 1);
+            FilestoreIndexAdd(&g_filestore_async.index, job->sha256);
+            FilestoreWriterFileinfo(job, final_filename);
+            return;
+        }
+    }
+
+    char tmp_filename[PATH_MAX] = "";
+    FilestoreTmpFilename(job->file_store_id, tmp_filename, sizeof(tmp_filename));
+    int fd = open(tmp_filename, O_CREAT | O_TRUNC | O_NOFOLLOW | O_WRONLY, 0644);
+    if (fd == -1) {
+        (void) SC_ATOMIC_ADD(filestore_async_errors, 1);
+        WARN_ONCE(SC_ERR_OPENING_FILE,
+                "Filestore (v2) failed to create %s: %s", tmp_filename,
+                strerror(errno));
+        return;
+    }
+    struct iovec iov = { .iov_base = job->data, .iov_len = job->len };
+    int r = FilestoreWritev(fd, &iov, 1);
+    close(fd);
+    if (r != 0) {
+        (void) SC_ATOMIC_ADD(filestore_async_errors, 1);
+        WARN_ONCE(SC_ERR_FWRITE,
+                "Filestore (v2) failed to write to %s: %s",
+                tmp_filename, strerror(errno));
+        unlink(tmp_filename);
+        return;
+    }
+
+    uint32_t errors = 0;
+    bool moved = OutputFilestoreMoveFile(tmp_filename, final_filename, &errors);
+    if (errors > 0) {
+        (void) SC_ATOMIC_ADD(filestore_async_errors, errors);
+    }
+    if (moved) {
+        FilestoreIndexAdd(&g_filestore_async.index, job->sha256);
+        FilestoreWriterFileinfo(job, final_filename);
+    }
+}
+
+/** \brief process and free a batch of jobs, called with proc_lock held */
+static void FilestoreWriterProcess(FilestoreWriter *w, FilestoreJobQueue *batch)
+{
+    FilestoreJob *job;
+    while ((job = TAILQ_FIRST(batch)) != NULL) {
+        if (job->type == FILESTORE_JOB_DATA) {
+            FilestoreWriterData(w, batch, job);
+            continue;
+        }
+        TAILQ_REMOVE(batch, job, next);
+        if (job->type == FILESTORE_JOB_CLOSE) {
+            FilestoreWriterClose(w, job);
+        } else {
+            FilestoreWriterStore(job);
+        }
+        FilestoreJobFree(job);
+    }
+}
+
+/**
+ * \brief Queue a job for the writer of its file. Waits while the queue
+ *     is full. If the writer thread is not running the job is done
+ *     in the calling thread.
+ */
+static void FilestoreSubmit(FilestoreJob *job)
+{
+    FilestoreWriter *w =
+        &g_filestore_async.writers[job->file_store_id % g_filestore_async.writer_cnt];
+
+    SCCtrlMutexLock(&w->mutex);
+    if (w->running && w->queued > 0 &&
+            w->queued + job->len > g_filestore_async.max_queue) {
+        (void) SC_ATOMIC_ADD(filestore_async_stalls, 1);
+        while (w->running && w->queued > 0 &&
+                w->queued + job->len > g_filestore_async.max_queue) {
+            SCCtrlCondWait(&w->space_cond, &w->mutex);
+        }
+    }
+    if (w->running) {
+        TAILQ_INSERT_TAIL(&w->queue, job, next);
+        w->queued += job->len;
+        (void) SC_ATOMIC_ADD(filestore_async_queued, job->len);
+        SCCtrlCondSignal(&w->cond);
+        SCCtrlMutexUnlock(&w->mutex);
+        return;
+    }
+    SCCtrlMutexUnlock(&w->mutex);
+
+    FilestoreJobQueue batch;
+    TAILQ_INIT(&batch);
+    TAILQ_INSERT_TAIL(&batch, job, next);
+    SCMutexLock(&w->proc_lock);
+    FilestoreWriterProcess(w, &batch);
+    SCMutexUnlock(&w->proc_lock);
+}
+
+static FilestoreJob *FilestoreJobNew(uint8_t type, uint32_t file_store_id)
+{
+    FilestoreJob *job = SCCalloc(1, sizeof(*job));
+    if (unlikely(job == NULL))
+        return NULL;
+    job->type = type;
+    job->file_store_id = file_store_id;
+    return job;
+}
+
+/**
+ * \brief Hand data to the writer.
+ *
+ * \param data buffer to take ownership of, or NULL to copy copy_data
+ */
+static int FilestoreSubmitData(FilestoreFile *sf, bool open, uint8_t *data,
+        const uint8_t *copy_data, uint32_t len)
+{
+    FilestoreJob *job = FilestoreJobNew(FILESTORE_JOB_DATA, sf->file_store_id);
+    if (unlikely(job == NULL)) {
+        if (data != NULL)
+            SCFree(data);
+        return -1;
+    }
+    job->open = open;
+    if (data == NULL && len > 0) {
+        data = SCMalloc(len);
+        if (unlikely(data == NULL)) {
+            SCFree(job);
+            return -1;
+        }
+        memcpy(data, copy_data, len);
+    }
+    job->data = data;
+    job->len = len;
+    FilestoreSubmit(job);
+    return 0;
+}
+
+static int FilestoreFileAppend(FilestoreFile *sf, const uint8_t *data,
+        uint32_t data_len)
+{
+    if (sf->len + data_len > sf->size) {
+        uint32_t size = MAX(sf->size * 2, 4096);
+        size = MAX(size, sf->len + data_len);
+        size = MIN(size, g_filestore_async.buffer_size);
+        uint8_t *buf = SCRealloc(sf->buf, size);
+        if (unlikely(buf == NULL))
+            return -1;
+        sf->buf = buf;
+        sf->size = size;
+    }
+    memcpy(sf->buf + sf->len, data, data_len);
+    sf->len += data_len;
+    return 0;
+}
+
+static int OutputFilestoreLoggerAsync(ThreadVars *tv,
+        OutputFilestoreLogThread *aft, const Packet *p, File *ff,
+        const uint8_t *data, uint32_t data_len, uint8_t flags, uint8_t dir)
+{
+    FilestoreFile lookup = { .file_store_id = ff->file_store_id };
+    FilestoreFile *sf = HashTableLookup(aft->files, &lookup, sizeof(lookup));
+    if (sf == NULL) {
+        sf = SCCalloc(1, sizeof(*sf));
+        if (unlikely(sf == NULL)) {
+            StatsIncr(tv, aft->fs_error_counter);
+            return -1;
+        }
+        sf->file_store_id = ff->file_store_id;
+        /* data of a file we lost track of is still appended */
+        sf->streaming = !(flags & OUTPUT_FILEDATA_FLAG_OPEN);
+        if (HashTableAdd(aft->files, sf, sizeof(*sf)) != 0) {
+            SCFree(sf);
+            StatsIncr(tv, aft->fs_error_counter);
+            return -1;
+        }
+    }
+
+    int r = 0;
+    if (data != NULL && data_len > 0) {
+        if (!sf->streaming &&
+                sf->len + data_len > g_filestore_async.buffer_size) {
+            /* too large to keep in memory, stream it */
+            r |= FilestoreSubmitData(sf, true, sf->buf, NULL, sf->len);
+            sf->buf = NULL;
+            sf->len = sf->size = 0;
+            sf->streaming = true;
+        }
+        if (sf->streaming) {
+            r |= FilestoreSubmitData(sf, false, NULL, data, data_len);
+        } else {
+            r |= FilestoreFileAppend(sf, data, data_len);
+        }
+    }
+
+    if (flags & OUTPUT_FILEDATA_FLAG_CLOSE) {
+        FilestoreJob *job = FilestoreJobNew(sf->streaming ?
+                FILESTORE_JOB_CLOSE : FILESTORE_JOB_STORE, sf->file_store_id);
+        if (likely(job != NULL)) {
+            memcpy(job->sha256, ff->sha256, sizeof(job->sha256));
+            if (!sf->streaming) {
+                job->data = sf->buf;
+                job->len = sf->len;
+                sf->buf = NULL;
+            }
+            if (aft->ctx->fileinfo) {
+                json_t *js_fileinfo = JsonBuildFileInfoRecord(p, ff, true,
+                        dir, aft->ctx->xff_cfg);
+                if (likely(js_fileinfo != NULL)) {
+                    job->fileinfo = json_dumps(js_fileinfo, 0);
+                    json_decref(js_fileinfo);
+                }
+                job->ts = (uint64_t)p->ts.tv_sec;
+            }
+            FilestoreSubmit(job);
+        } else {
+            r = -1;
+        }
+        HashTableRemove(aft->files, sf, sizeof(*sf));
+    }
+
+    if (r != 0) {
+        StatsIncr(tv, aft->fs_error_counter);
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t FilestoreFileHash(HashTable *ht, void *data, uint16_t len)
+{
+    const FilestoreFile *sf = data;
+    return sf->file_store_id % ht->array_size;
+}
+
+static char FilestoreFileCompare(void *a, uint16_t alen, void *b, uint16_t blen)
+{
+    return ((FilestoreFile *)a)->file_store_id ==
+        ((FilestoreFile *)b)->file_store_id;
+}
+
+static void FilestoreFileFree(void *data)
+{
+    FilestoreFile *sf = data;
+    if (sf->buf != NULL)
+        SCFree(sf->buf);
+    SCFree(sf);
+}
+
+static void FilestoreWriterFlush(void *data, bool final)
+{
+    FilestoreWriter *w = data;
+    FilestoreJobQueue batch;
+    FilestoreJob *job;
+
+    SCCtrlMutexLock(&w->mutex);
+    if (!final && TAILQ_EMPTY(&w->queue)) {
+        struct timeval tv;
+        struct timespec ts;
+        gettimeofday(&tv, NULL);
+        ts.tv_sec = tv.tv_sec + 1;
+        ts.tv_nsec = tv.tv_usec * 1000;
+        SCCtrlCondTimedwait(&w->cond, &w->mutex, &ts);
+    }
+
+    while (!TAILQ_EMPTY(&w->queue)) {
+        uint64_t len = 0;
+        TAILQ_INIT(&batch);
+        while ((job = TAILQ_FIRST(&w->queue)) != NULL) {
+            TAILQ_REMOVE(&w->queue, job, next);
+            len += job->len;
+            TAILQ_INSERT_TAIL(&batch, job, next);
+        }
+        SCCtrlMutexUnlock(&w->mutex);
+
+        SCMutexLock(&w->proc_lock);
+        FilestoreWriterProcess(w, &batch);
+        SCMutexUnlock(&w->proc_lock);
+        (void) SC_ATOMIC_SUB(filestore_async_queued, len);
+
+        SCCtrlMutexLock(&w->mutex);
+        w->queued -= len;
+        SCCtrlCondBroadcast(&w->space_cond);
+
+        if (!final)
+            break;
+    }
+
+    if (final) {
+        w->running = 0;
+        SCCtrlCondBroadcast(&w->space_cond);
+    }
+    SCCtrlMutexUnlock(&w->mutex);
+}
+
+static void FilestoreWriterThreadSpawn(void)
+{
+    for (int i = 0; i < g_filestore_async.writer_cnt; i++) {
+        FilestoreWriter *w = &g_filestore_async.writers[i];
+        TmThreadSpawnWriter(thread_name_filestore, i + 1, w,
+                FilestoreWriterFlush, &w->mutex, &w->cond, &w->running);
+    }
+}
+
+static void OutputFilestoreAsyncFree(void)
+{
+    for (int i = 0; i < g_filestore_async.writer_cnt; i++) {
+        FilestoreWriter *w = &g_filestore_async.writers[i];
+        FilestoreJob *job;
+        while ((job = TAILQ_FIRST(&w->queue)) != NULL) {
+            TAILQ_REMOVE(&w->queue, job, next);
+            FilestoreJobFree(job);
+        }
+        while (w->fds_cnt > 0) {
+            FilestoreWriterCloseFd(w, w->fds[0].file_store_id);
+        }
+        SCFree(w->fds);
+        SCMutexDestroy(&w->proc_lock);
+        SCCtrlCondDestroy(&w->space_cond);
+        SCCtrlCondDestroy(&w->cond);
+        SCCtrlMutexDestroy(&w->mutex);
+    }
+    SCFree(g_filestore_async.writers);
+    g_filestore_async.writers = NULL;
+    g_filestore_async.writer_cnt = 0;
+
+    if (g_filestore_async.index.slots != NULL) {
+        SCFree(g_filestore_async.index.slots);
+        g_filestore_async.index.slots = NULL;
+        g_filestore_async.index.size = 0;
+        g_filestore_async.index.cnt = 0;
+        SCMutexDestroy(&g_filestore_async.index.lock);
+    }
+    g_filestore_async.enabled = false;
+}
+
+/** \brief set up the writers and the dedup index */
+static void OutputFilestoreAsyncInit(const OutputFilestoreCtx *ctx,
+        int threads, uint32_t max_queue, uint32_t buffer_size,
+        uint32_t index_size)
+{
+    g_filestore_async.ctx = ctx;
+    g_filestore_async.buffer_size = buffer_size;
+    g_filestore_async.writer_cnt = threads;
+    g_filestore_async.max_queue = max_queue / threads;
+    g_filestore_async.max_fds = FILESTORE_ASYNC_DEFAULT_FDS;
+    if (FileGetMaxOpenFiles() > 0) {
+        g_filestore_async.max_fds = MAX(1, FileGetMaxOpenFiles() / threads);
+    }
+
+    g_filestore_async.writers = SCCalloc(threads, sizeof(FilestoreWriter));
+    if (g_filestore_async.writers == NULL) {
+        FatalError(SC_ERR_MEM_ALLOC, "failed to allocate file-store writers");
+    }
+    for (int i = 0; i < threads; i++) {
+        FilestoreWriter *w = &g_filestore_async.writers[i];
+        SCCtrlMutexInit(&w->mutex, NULL);
+        SCCtrlCondInit(&w->cond, NULL);
+        SCCtrlCondInit(&w->space_cond, NULL);
+        SCMutexInit(&w->proc_lock, NULL);
+        TAILQ_INIT(&w->queue);
+        w->fds = SCCalloc(g_filestore_async.max_fds, sizeof(FilestoreFd));
+        if (w->fds == NULL) {
+            FatalError(SC_ERR_MEM_ALLOC, "failed to allocate file-store writers");
+        }
+    }
+
+    if (index_size > 0) {
+        /* slots for the requested number of entries at the max load */
+        uint32_t size = 1;
+        while (size / 4 * 3 < index_size)
+            size <<= 1;
+        g_filestore_async.index.slots = SCCalloc(size, sizeof(uint64_t));
+        if (g_filestore_async.index.slots == NULL) {
+            FatalError(SC_ERR_MEM_ALLOC, "failed to allocate file-store "
+                    "dedup index of %u entries", size);
+        }
+        g_filestore_async.index.size = size;
+        SCMutexInit(&g_filestore_async.index.lock, NULL);
+    }
+
+    g_filestore_async.enabled = true;
+}
+
+static void OutputFilestoreAsyncSetup(const OutputFilestoreCtx *ctx,
+        ConfNode *conf)
+{
+    intmax_t threads = FILESTORE_ASYNC_DEFAULT_THREADS;
+    if (ConfGetChildValueInt(conf, "threads", &threads) &&
+            (threads < 1 || threads > FILESTORE_ASYNC_MAX_THREADS)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "file-store.async.threads "
+                "must be between 1 and %d", FILESTORE_ASYNC_MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t max_queue = FILESTORE_ASYNC_DEFAULT_QUEUE;
+    const char *str = ConfNodeLookupChildValue(conf, "max-queue-size");
+    if (str != NULL && (ParseSizeStringU32(str, &max_queue) < 0 ||
+                max_queue == 0)) {
+        SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                "file-store.async.max-queue-size from conf file - %s. "
+                "Killing engine", str);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t buffer_size = FILESTORE_ASYNC_DEFAULT_BUFFER;
+    str = ConfNodeLookupChildValue(conf, "dedup-buffer-size");
+    if (str != NULL && ParseSizeStringU32(str, &buffer_size) < 0) {
+        SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                "file-store.async.dedup-buffer-size from conf file - %s. "
+                "Killing engine", str);
+        exit(EXIT_FAILURE);
+    }
+
+    intmax_t index_size = FILESTORE_ASYNC_DEFAULT_INDEX;
+    if (ConfGetChildValueInt(conf, "dedup-index-size", &index_size) &&
+            (index_size < 0 || index_size > (1 << 30))) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "file-store.async.dedup-index-size "
+                "must be between 0 and %d", 1 << 30);
+        exit(EXIT_FAILURE);
+    }
+
+    OutputFilestoreAsyncInit(ctx, (int)threads, max_queue, buffer_size,
+            (uint32_t)index_size);
+
+    StatsRegisterGlobalCounter("file_store.async.queued_bytes",
+            FilestoreAsyncQueuedCounter);
+    StatsRegisterGlobalCounter("file_store.async.dedup",
+            FilestoreAsyncDedupCounter);
+    StatsRegisterGlobalCounter("file_store.async.stalls",
+            FilestoreAsyncStallsCounter);
+    StatsRegisterGlobalCounter("file_store.async.fs_errors",
+            FilestoreAsyncErrorsCounter);
+
+    SCLogConfig("Filestore (v2) writing files from %d writer threads, "
+            "buffering files up to %u bytes for deduplication",
+            g_filestore_async.writer_cnt, g_filestore_async.buffer_size);
+}
+
 static int OutputFilestoreLogger(ThreadVars *tv, void *thread_data,
         const Packet *p, File *ff, const uint8_t *data, uint32_t data_len,
         uint8_t flags, uint8_t dir)
@@ -198,6 +1059,11 @@ static int OutputFilestoreLogger(ThreadVars *tv, void *thread_data,
 
     SCLogDebug("ff %p, data %p, data_len %u", ff, data, data_len);
 
+    if (aft->files != NULL) {
+        return OutputFilestoreLoggerAsync(tv, aft, p, ff, data, data_len,
+                flags, dir);
+    }
+
     char base_filename[PATH_MAX] = "";
     snprintf(base_filename, sizeof(base_filename), "%s/file.%u",
             ctx->tmpdir, ff->file_store_id);
@@ -293,6 +1159,15 @@ static TmEcode OutputFilestoreLogThreadInit(ThreadVars *t, const void *initdata,
      * occurence. */
     aft->fs_error_counter = StatsRegisterCounter("file_store.fs_errors", t);
 
+    if (g_filestore_async.enabled) {
+        aft->files = HashTableInit(1024, FilestoreFileHash,
+                FilestoreFileCompare, FilestoreFileFree);
+        if (aft->files == NULL) {
+            SCFree(aft);
+            return TM_ECODE_FAILED;
+        }
+    }
+
     *data = (void *)aft;
     return TM_ECODE_OK;
 }
@@ -304,6 +1179,11 @@ static TmEcode OutputFilestoreLogThreadDeinit(ThreadVars *t, void *data)
         return TM_ECODE_OK;
     }
 
+    /* files that were never closed are not stored */
+    if (aft->files != NULL) {
+        HashTableFree(aft->files);
+    }
+
     /* clear memory */
     memset(aft, 0, sizeof(OutputFilestoreLogThread));
 
@@ -314,6 +1194,9 @@ static TmEcode OutputFilestoreLogThreadDeinit(ThreadVars *t, void *data)
 static void OutputFilestoreLogDeInitCtx(OutputCtx *output_ctx)
 {
     OutputFilestoreCtx *ctx = (OutputFilestoreCtx *)output_ctx->data;
+    if (g_filestore_async.enabled) {
+        OutputFilestoreAsyncFree();
+    }
     if (ctx->xff_cfg != NULL) {
         SCFree(ctx->xff_cfg);
     }
@@ -510,11 +1393,270 @@ static OutputInitResult OutputFilestoreLogInitCtx(ConfNode *conf)
     StatsRegisterGlobalCounter("file_store.open_files",
             OutputFilestoreOpenFilesCounter);
 
+    ConfNode *async = ConfNodeLookupChild(conf, "async");
+    if (async != NULL && ConfNodeChildValueIsTrue(async, "enabled")) {
+        OutputFilestoreAsyncSetup(ctx, async);
+    }
+
     result.ctx = output_ctx;
     result.ok = true;
     SCReturnCT(result, "OutputInitResult");
 }
 
+#ifdef UNITTESTS
+
+static bool FilestoreTestSetup(OutputFilestoreCtx *ctx, char *dir,
+        uint32_t buffer_size, uint32_t max_queue)
+{
+    if (mkdtemp(dir) == NULL || !InitFilestoreDirectory(dir))
+        return false;
+    memset(ctx, 0, sizeof(*ctx));
+    strlcpy(ctx->prefix, dir, sizeof(ctx->prefix));
+    snprintf(ctx->tmpdir, sizeof(ctx->tmpdir), "%s/tmp", dir);
+    OutputFilestoreAsyncInit(ctx, 1, max_queue, buffer_size, 16);
+    return true;
+}
+
+static void FilestoreTestTeardown(const char *dir)
+{
+    OutputFilestoreAsyncFree();
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/tmp", dir);
+    rmdir(path);
+    for (int i = 0; i <= 0xff; i++) {
+        snprintf(path, sizeof(path), "%s/%02x", dir, i);
+        rmdir(path);
+    }
+    rmdir(dir);
+}
+
+static void FilestoreTestSha256(uint8_t *sha256, uint8_t first, uint8_t last)
+{
+    memset(sha256, 0, SHA256_LENGTH);
+    sha256[0] = first;
+    sha256[SHA256_LENGTH - 1] = last;
+}
+
+/** \internal
+ *  \brief check the content of a file and remove it */
+static bool FilestoreTestCheckFile(const char *filename, const char *data)
+{
+    char buf[256] = "";
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+        return false;
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    unlink(filename);
+    return len == strlen(data) && memcmp(buf, data, len) == 0;
+}
+
+static FilestoreJob *FilestoreTestStoreJob(uint32_t file_store_id,
+        const uint8_t *sha256, const char *data)
+{
+    FilestoreJob *job = FilestoreJobNew(FILESTORE_JOB_STORE, file_store_id);
+    if (job == NULL)
+        return NULL;
+    memcpy(job->sha256, sha256, SHA256_LENGTH);
+    job->len = (uint32_t)strlen(data);
+    job->data = (uint8_t *)SCStrdup(data);
+    return job;
+}
+
+/** \test a file that was stored before is not written again, only its
+ *        timestamps are updated */
+static int OutputFilestoreTest01(void)
+{
+    OutputFilestoreCtx ctx;
+    char dir[] = "/tmp/suricata-filestore-XXXXXX";
+    FAIL_IF_NOT(FilestoreTestSetup(&ctx, dir, 1024, 1024));
+    const uint64_t dedup = SC_ATOMIC_GET(filestore_async_dedup);
+
+    uint8_t sha256[SHA256_LENGTH];
+    FilestoreTestSha256(sha256, 0xab, 1);
+    char filename[PATH_MAX];
+    OutputFilestoreFinalFilename(&ctx, sha256, filename, sizeof(filename));
+
+    FilestoreJob *job = FilestoreTestStoreJob(1, sha256, "first");
+    FAIL_IF_NULL(job);
+    FilestoreSubmit(job);
+    FAIL_IF_NOT(SCPathExists(filename));
+    FAIL_IF_NOT(FilestoreIndexLookup(&g_filestore_async.index, sha256));
+    FAIL_IF(SC_ATOMIC_GET(filestore_async_dedup) != dedup);
+
+    struct utimbuf old = { .actime = 1000, .modtime = 1000 };
+    FAIL_IF(utime(filename, &old) != 0);
+
+    /* same sha256: the stored file is kept and touched */
+    job = FilestoreTestStoreJob(2, sha256, "second");
+    FAIL_IF_NULL(job);
+    FilestoreSubmit(job);
+    FAIL_IF(SC_ATOMIC_GET(filestore_async_dedup) != dedup + 1);
+    struct stat st;
+    FAIL_IF(stat(filename, &st) != 0);
+    FAIL_IF(st.st_mtime == 1000);
+    char tmp_filename[PATH_MAX];
+    FilestoreTmpFilename(2, tmp_filename, sizeof(tmp_filename));
+    FAIL_IF(SCPathExists(tmp_filename));
+    FAIL_IF_NOT(FilestoreTestCheckFile(filename, "first"));
+
+    FilestoreTestTeardown(dir);
+    PASS;
+}
+
+/** \test hashes that share the 8 bytes used as index key, or the slot
+ *        they start probing at */
+static int OutputFilestoreTest02(void)
+{
+    OutputFilestoreCtx ctx;
+    char dir[] = "/tmp/suricata-filestore-XXXXXX";
+    FAIL_IF_NOT(FilestoreTestSetup(&ctx, dir, 1024, 1024));
+    const uint64_t dedup = SC_ATOMIC_GET(filestore_async_dedup);
+
+    /* same key: the index hit is not trusted without the file */
+    uint8_t sha_a[SHA256_LENGTH], sha_b[SHA256_LENGTH];
+    FilestoreTestSha256(sha_a, 0x11, 1);
+    FilestoreTestSha256(sha_b, 0x11, 2);
+    FilestoreJob *job = FilestoreTestStoreJob(1, sha_a, "aaaa");
+    FAIL_IF_NULL(job);
+    FilestoreSubmit(job);
+    FAIL_IF_NOT(FilestoreIndexLookup(&g_filestore_async.index, sha_b));
+    job = FilestoreTestStoreJob(2, sha_b, "bbbb");
+    FAIL_IF_NULL(job);
+    FilestoreSubmit(job);
+    FAIL_IF(SC_ATOMIC_GET(filestore_async_dedup) != dedup);
+
+    char filename[PATH_MAX];
+    OutputFilestoreFinalFilename(&ctx, sha_a, filename, sizeof(filename));
+    FAIL_IF_NOT(FilestoreTestCheckFile(filename, "aaaa"));
+    OutputFilestoreFinalFilename(&ctx, sha_b, filename, sizeof(filename));
+    FAIL_IF_NOT(FilestoreTestCheckFile(filename, "bbbb"));
+
+    /* different keys starting at the same slot are probed past */
+    const uint32_t size = g_filestore_async.index.size;
+    uint8_t sha_c[SHA256_LENGTH], sha_d[SHA256_LENGTH], sha_e[SHA256_LENGTH];
+    FilestoreTestSha256(sha_c, 0x21, 0);
+    FilestoreTestSha256(sha_d, (uint8_t)(0x21 + size), 0);
+    FilestoreTestSha256(sha_e, (uint8_t)(0x21 + 2 * size), 0);
+    FilestoreIndexAdd(&g_filestore_async.index, sha_c);
+    FilestoreIndexAdd(&g_filestore_async.index, sha_d);
+    FAIL_IF_NOT(FilestoreIndexLookup(&g_filestore_async.index, sha_c));
+    FAIL_IF_NOT(FilestoreIndexLookup(&g_filestore_async.index, sha_d));
+    FAIL_IF(FilestoreIndexLookup(&g_filestore_async.index, sha_e));
+
+    FilestoreTestTeardown(dir);
+    PASS;
+}
+
+/** \test a file is buffered until it outgrows the buffer, then what was
+ *        buffered and the rest of the file are streamed */
+static int OutputFilestoreTest03(void)
+{
+    OutputFilestoreCtx ctx;
+    char dir[] = "/tmp/suricata-filestore-XXXXXX";
+    FAIL_IF_NOT(FilestoreTestSetup(&ctx, dir, 8, 1024));
+
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    OutputFilestoreLogThread aft = { .ctx = &ctx };
+    aft.files = HashTableInit(16, FilestoreFileHash, FilestoreFileCompare,
+            FilestoreFileFree);
+    FAIL_IF_NULL(aft.files);
+    File ff;
+    memset(&ff, 0, sizeof(ff));
+    ff.file_store_id = 3;
+    FilestoreTestSha256(ff.sha256, 0x33, 3);
+
+    char tmp_filename[PATH_MAX];
+    FilestoreTmpFilename(ff.file_store_id, tmp_filename, sizeof(tmp_filename));
+
+    FAIL_IF(OutputFilestoreLoggerAsync(&tv, &aft, NULL, &ff,
+                (const uint8_t *)"abcd", 4, OUTPUT_FILEDATA_FLAG_OPEN, 0) != 0);
+    FilestoreFile lookup = { .file_store_id = ff.file_store_id };
+    FilestoreFile *sf = HashTableLookup(aft.files, &lookup, sizeof(lookup));
+    FAIL_IF_NULL(sf);
+    FAIL_IF(sf->streaming);
+    FAIL_IF(sf->len != 4);
+    FAIL_IF(SCPathExists(tmp_filename));
+
+    /* 4 + 6 > 8: switch to streaming */
+    FAIL_IF(OutputFilestoreLoggerAsync(&tv, &aft, NULL, &ff,
+                (const uint8_t *)"efghij", 6, 0, 0) != 0);
+    FAIL_IF_NOT(sf->streaming);
+    FAIL_IF_NOT_NULL(sf->buf);
+    FAIL_IF(sf->len != 0);
+    FAIL_IF_NOT(SCPathExists(tmp_filename));
+
+    FAIL_IF(OutputFilestoreLoggerAsync(&tv, &aft, NULL, &ff,
+                (const uint8_t *)"kl", 2, OUTPUT_FILEDATA_FLAG_CLOSE, 0) != 0);
+    FAIL_IF_NOT_NULL(HashTableLookup(aft.files, &lookup, sizeof(lookup)));
+    FAIL_IF(SCPathExists(tmp_filename));
+
+    char filename[PATH_MAX];
+    OutputFilestoreFinalFilename(&ctx, ff.sha256, filename, sizeof(filename));
+    FAIL_IF_NOT(FilestoreTestCheckFile(filename, "abcdefghijkl"));
+
+    HashTableFree(aft.files);
+    FilestoreTestTeardown(dir);
+    PASS;
+}
+
+/** \test jobs queued for the writer are all written by the final flush,
+ *        later jobs are done inline */
+static int OutputFilestoreTest04(void)
+{
+    OutputFilestoreCtx ctx;
+    char dir[] = "/tmp/suricata-filestore-XXXXXX";
+    FAIL_IF_NOT(FilestoreTestSetup(&ctx, dir, 1024, 1024));
+    FilestoreWriter *w = &g_filestore_async.writers[0];
+    const uint64_t queued = SC_ATOMIC_GET(filestore_async_queued);
+
+    /* no thread, the queue is only drained by the flush below */
+    w->running = 1;
+
+    uint8_t sha_a[SHA256_LENGTH], sha_b[SHA256_LENGTH];
+    FilestoreTestSha256(sha_a, 0x41, 1);
+    FilestoreTestSha256(sha_b, 0x42, 2);
+    FilestoreJob *job = FilestoreTestStoreJob(1, sha_a, "queued");
+    FAIL_IF_NULL(job);
+    FilestoreSubmit(job);
+    job = FilestoreTestStoreJob(2, sha_b, "also queued");
+    FAIL_IF_NULL(job);
+    FilestoreSubmit(job);
+    FAIL_IF(w->queued != 17);
+    FAIL_IF(SC_ATOMIC_GET(filestore_async_queued) != queued + 17);
+
+    char filename_a[PATH_MAX], filename_b[PATH_MAX];
+    OutputFilestoreFinalFilename(&ctx, sha_a, filename_a, sizeof(filename_a));
+    OutputFilestoreFinalFilename(&ctx, sha_b, filename_b, sizeof(filename_b));
+    FAIL_IF(SCPathExists(filename_a));
+
+    FilestoreWriterFlush(w, true);
+    FAIL_IF(w->running);
+    FAIL_IF_NOT(TAILQ_EMPTY(&w->queue));
+    FAIL_IF(w->queued != 0);
+    FAIL_IF(SC_ATOMIC_GET(filestore_async_queued) != queued);
+    FAIL_IF_NOT(FilestoreTestCheckFile(filename_a, "queued"));
+    FAIL_IF_NOT(FilestoreTestCheckFile(filename_b, "also queued"));
+
+    /* writer is gone: written inline */
+    uint8_t sha_c[SHA256_LENGTH];
+    FilestoreTestSha256(sha_c, 0x43, 3);
+    job = FilestoreTestStoreJob(3, sha_c, "late");
+    FAIL_IF_NULL(job);
+    FilestoreSubmit(job);
+    FAIL_IF_NOT(TAILQ_EMPTY(&w->queue));
+    char filename_c[PATH_MAX];
+    OutputFilestoreFinalFilename(&ctx, sha_c, filename_c, sizeof(filename_c));
+    FAIL_IF_NOT(FilestoreTestCheckFile(filename_c, "late"));
+
+    FilestoreTestTeardown(dir);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
 #endif /* HAVE_NSS */
 
 void OutputFilestoreRegister(void)
@@ -527,5 +1669,27 @@ void OutputFilestoreRegister(void)
 
     SC_ATOMIC_INIT(filestore_open_file_cnt);
     SC_ATOMIC_SET(filestore_open_file_cnt, 0);
+    SC_ATOMIC_INIT(filestore_async_queued);
+    SC_ATOMIC_INIT(filestore_async_dedup);
+    SC_ATOMIC_INIT(filestore_async_stalls);
+    SC_ATOMIC_INIT(filestore_async_errors);
+#endif
+}
+
+/** \brief spawn the writer threads if file-store uses async output */
+void OutputFilestoreWriterThreadSpawn(void)
+{
+#ifdef HAVE_NSS
+    FilestoreWriterThreadSpawn();
+#endif
+}
+
+void OutputFilestoreRegisterTests(void)
+{
+#if defined(HAVE_NSS) && defined(UNITTESTS)
+    UtRegisterTest("OutputFilestoreTest01", OutputFilestoreTest01);
+    UtRegisterTest("OutputFilestoreTest02", OutputFilestoreTest02);
+    UtRegisterTest("OutputFilestoreTest03", OutputFilestoreTest03);
+    UtRegisterTest("OutputFilestoreTest04", OutputFilestoreTest04);
 #endif
 }
@@ -20,5 +20,7 @@
 
 void OutputFilestoreRegister(void);
 void OutputFilestoreInitConfig(void);
+void OutputFilestoreWriterThreadSpawn(void);
+void OutputFilestoreRegisterTests(void);
 
 #endif /* __OUTPUT_FILESTORE_H__ */
@@ -77,6 +77,8 @@
 #include "util-buffer.h"
 #include "util-crypt.h"
 #include "util-validate.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
 
 #define MODULE_NAME "JsonAlertLog"
 
@@ -260,13 +262,13 @@ static void AlertJsonSourceTarget(const Packet *p, const PacketAlert *pa,
     json_object_set_new(ajs, "target", tjs);
 }
 
-static void AlertJsonMetadata(AlertJsonOutputCtx *json_output_ctx, const PacketAlert *pa, json_t *ajs)
+static json_t *AlertJsonMetadataObject(const PacketAlert *pa)
 {
     if (pa->s->metadata) {
         const DetectMetadata* kv = pa->s->metadata;
         json_t *mjs = json_object();
         if (unlikely(mjs == NULL)) {
-            return;
+            return NULL;
         }
         while (kv) {
             json_t *jkey = json_object_get(mjs, kv->key);
@@ -285,17 +287,23 @@ static void AlertJsonMetadata(AlertJsonOutputCtx *json_output_ctx, const PacketA
 
         if (json_object_size(mjs) == 0) {
             json_decref(mjs);
-        } else {
-            json_object_set_new(ajs, "metadata", mjs);
+            return NULL;
         }
+        return mjs;
     }
+    return NULL;
 }
 
+static void AlertJsonMetadata(AlertJsonOutputCtx *json_output_ctx, const PacketAlert *pa, json_t *ajs)
+{
+    json_t *mjs = AlertJsonMetadataObject(pa);
+    if (mjs != NULL) {
+        json_object_set_new(ajs, "metadata", mjs);
+    }
+}
 
-void AlertJsonHeader(void *ctx, const Packet *p, const PacketAlert *pa, json_t *js,
-                     uint16_t flags)
+static const char *AlertJsonAction(const Packet *p, const PacketAlert *pa)
 {
-    AlertJsonOutputCtx *json_output_ctx = (AlertJsonOutputCtx *)ctx;
     const char *action = "allowed";
     /* use packet action if rate_filter modified the action */
     if (unlikely(pa->flags & PACKET_ALERT_RATE_FILTER_MODIFIED)) {
@@ -310,6 +318,15 @@ void AlertJsonHeader(void *ctx, const Packet *p, const PacketAlert *pa, json_t *
             action = "blocked";
         }
     }
+    return action;
+}
+
+
+void AlertJsonHeader(void *ctx, const Packet *p, const PacketAlert *pa, json_t *js,
+                     uint16_t flags)
+{
+    AlertJsonOutputCtx *json_output_ctx = (AlertJsonOutputCtx *)ctx;
+    const char *action = AlertJsonAction(p, pa);
 
     /* Add tx_id to root element for correlation with other events. */
     json_object_del(js, "tx_id");
@@ -346,36 +363,108 @@ void AlertJsonHeader(void *ctx, const Packet *p, const PacketAlert *pa, json_t *
     json_object_set_new(js, "alert", ajs);
 }
 
-static void AlertJsonTunnel(const Packet *p, json_t *js)
+static void AlertJsonBuilderSourceTarget(const Packet *p,
+        const PacketAlert *pa, const JsonAddrInfo *addr, JsonBuilder *jb)
 {
-    json_t *tunnel = json_object();
-    if (tunnel == NULL)
-        return;
+    const char *sip = NULL, *tip = NULL;
+    Port sp = 0, tp = 0;
 
-    if (p->root == NULL) {
-        json_decref(tunnel);
-        return;
+    if (pa->s->flags & SIG_FLAG_DEST_IS_TARGET) {
+        sip = addr->src_ip;
+        sp = addr->sp;
+        tip = addr->dst_ip;
+        tp = addr->dp;
+    } else if (pa->s->flags & SIG_FLAG_SRC_IS_TARGET) {
+        sip = addr->dst_ip;
+        sp = addr->dp;
+        tip = addr->src_ip;
+        tp = addr->sp;
+    }
+
+    const bool ports = (sip != NULL && (p->proto == IPPROTO_UDP ||
+                p->proto == IPPROTO_TCP || p->proto == IPPROTO_SCTP));
+
+    JsonBuilderOpenObject(jb, "source");
+    JsonBuilderSetString(jb, "ip", sip);
+    if (ports)
+        JsonBuilderSetUint(jb, "port", sp);
+    JsonBuilderClose(jb);
+
+    JsonBuilderOpenObject(jb, "target");
+    JsonBuilderSetString(jb, "ip", tip);
+    if (ports)
+        JsonBuilderSetUint(jb, "port", tp);
+    JsonBuilderClose(jb);
+}
+
+/** \brief AlertJsonHeader for the builder: tx_id and the alert object */
+static void AlertJsonBuilderHeader(const Packet *p, const PacketAlert *pa,
+        JsonBuilder *jb, uint16_t flags, const JsonAddrInfo *addr)
+{
+    /* Add tx_id to root element for correlation with other events. */
+    if (pa->flags & PACKET_ALERT_FLAG_TX)
+        JsonBuilderSetUint(jb, "tx_id", pa->tx_id);
+
+    JsonBuilderOpenObject(jb, "alert");
+    JsonBuilderSetString(jb, "action", AlertJsonAction(p, pa));
+    JsonBuilderSetUint(jb, "gid", pa->s->gid);
+    JsonBuilderSetUint(jb, "signature_id", pa->s->id);
+    JsonBuilderSetUint(jb, "rev", pa->s->rev);
+    JsonBuilderSetString(jb, "signature", (pa->s->msg) ? pa->s->msg : "");
+    JsonBuilderSetString(jb, "category",
+            (pa->s->class_msg) ? pa->s->class_msg : "");
+    JsonBuilderSetInt(jb, "severity", pa->s->prio);
+
+    if (p->tenant_id > 0)
+        JsonBuilderSetUint(jb, "tenant_id", p->tenant_id);
+
+    if ((pa->s->flags & SIG_FLAG_HAS_TARGET) && addr != NULL) {
+        AlertJsonBuilderSourceTarget(p, pa, addr, jb);
     }
 
+    if (flags & LOG_JSON_RULE_METADATA) {
+        json_t *mjs = AlertJsonMetadataObject(pa);
+        if (mjs != NULL) {
+            JsonBuilderSetJson(jb, "metadata", mjs);
+            json_decref(mjs);
+        }
+    }
+
+    /* signature text */
+    if (flags & LOG_JSON_RULE) {
+        JsonBuilderSetString(jb, "rule", pa->s->sig_str);
+    }
+    JsonBuilderClose(jb);
+}
+
+static void AlertJsonTunnel(const Packet *p, JsonBuilder *jb)
+{
+    if (p->root == NULL)
+        return;
+
+    JsonBuilderOpenObject(jb, "tunnel");
+
     /* get a lock to access root packet fields */
     SCMutex *m = &p->root->tunnel_mutex;
 
     SCMutexLock(m);
-    JsonFiveTuple((const Packet *)p->root, 0, tunnel);
+    JsonAddrInfo addr;
+    if (JsonAddrInfoInit((const Packet *)p->root, LOG_DIR_PACKET, &addr)) {
+        JsonBuilderFiveTuple((const Packet *)p->root, &addr, jb);
+    }
     SCMutexUnlock(m);
 
-    json_object_set_new(tunnel, "depth", json_integer(p->recursion_level));
-
-    json_object_set_new(js, "tunnel", tunnel);
+    JsonBuilderSetUint(jb, "depth", p->recursion_level);
+    JsonBuilderClose(jb);
 }
 
-static void AlertAddPayload(AlertJsonOutputCtx *json_output_ctx, json_t *js, const Packet *p)
+static void AlertAddPayload(AlertJsonOutputCtx *json_output_ctx, JsonBuilder *jb, const Packet *p)
 {
     if (json_output_ctx->flags & LOG_JSON_PAYLOAD_BASE64) {
         unsigned long len = p->payload_len * 2 + 1;
         uint8_t encoded[len];
         if (Base64Encode(p->payload, p->payload_len, encoded, &len) == SC_BASE64_OK) {
-            json_object_set_new(js, "payload", json_string((char *)encoded));
+            JsonBuilderSetString(jb, "payload", (char *)encoded);
         }
     }
 
@@ -386,118 +475,178 @@ static void AlertAddPayload(AlertJsonOutputCtx *json_output_ctx, json_t *js, con
                 p->payload_len + 1,
                 p->payload, p->payload_len);
         printable_buf[p->payload_len] = '\0';
-        json_object_set_new(js, "payload_printable", json_string((char *)printable_buf));
+        JsonBuilderSetString(jb, "payload_printable", (char *)printable_buf);
+    }
+}
+
+/** \internal
+ *  \brief add the app-layer objects of the alert's protocol
+ *
+ *  The app-layer loggers still produce json_t, the members are added to
+ *  js and then copied into the record.
+ */
+static void AlertJsonAppLayer(AlertJsonOutputCtx *json_output_ctx,
+        const Packet *p, const PacketAlert *pa, json_t *js)
+{
+    json_t *hjs = NULL;
+
+    const AppProto proto = FlowGetAppProtocol(p->flow);
+    switch (proto) {
+        case ALPROTO_HTTP:
+            hjs = JsonHttpAddMetadata(p->flow, pa->tx_id);
+            if (hjs) {
+                if (json_output_ctx->flags & LOG_JSON_HTTP_BODY) {
+                    JsonHttpLogJSONBodyPrintable(hjs, p->flow, pa->tx_id);
+                }
+                if (json_output_ctx->flags & LOG_JSON_HTTP_BODY_BASE64) {
+                    JsonHttpLogJSONBodyBase64(hjs, p->flow, pa->tx_id);
+                }
+                json_object_set_new(js, "http", hjs);
+            }
+            break;
+        case ALPROTO_TLS:
+            AlertJsonTls(p->flow, js);
+            break;
+        case ALPROTO_SSH:
+            AlertJsonSsh(p->flow, js);
+            break;
+        case ALPROTO_SMTP:
+            hjs = JsonSMTPAddMetadata(p->flow, pa->tx_id);
+            if (hjs) {
+                json_object_set_new(js, "smtp", hjs);
+            }
+
+            hjs = JsonEmailAddMetadata(p->flow, pa->tx_id);
+            if (hjs) {
+                json_object_set_new(js, "email", hjs);
+            }
+            break;
+        case ALPROTO_NFS:
+            hjs = JsonNFSAddMetadataRPC(p->flow, pa->tx_id);
+            if (hjs)
+                json_object_set_new(js, "rpc", hjs);
+            hjs = JsonNFSAddMetadata(p->flow, pa->tx_id);
+            if (hjs)
+                json_object_set_new(js, "nfs", hjs);
+            break;
+        case ALPROTO_SMB:
+            hjs = JsonSMBAddMetadata(p->flow, pa->tx_id);
+            if (hjs)
+                json_object_set_new(js, "smb", hjs);
+            break;
+        case ALPROTO_SIP:
+            hjs = JsonSIPAddMetadata(p->flow, pa->tx_id);
+            if (hjs)
+                json_object_set_new(js, "sip", hjs);
+            break;
+        case ALPROTO_FTPDATA:
+            hjs = JsonFTPDataAddMetadata(p->flow);
+            if (hjs)
+                json_object_set_new(js, "ftp-data", hjs);
+            break;
+        case ALPROTO_DNP3:
+            AlertJsonDnp3(p->flow, pa->tx_id, js);
+            break;
+        case ALPROTO_DNS:
+            AlertJsonDns(p->flow, pa->tx_id, js);
+            break;
+        default:
+            break;
+    }
+}
+
+/** \brief copy of the tuple with the client ip replaced by the xff ip */
+static const JsonAddrInfo *AlertJsonXFFAddr(const Packet *p,
+        const JsonAddrInfo *addr, const char *xff_ip, JsonAddrInfo *xff_addr)
+{
+    *xff_addr = *addr;
+    if (p->flowflags & FLOW_PKT_TOCLIENT) {
+        strlcpy(xff_addr->dst_ip, xff_ip, sizeof(xff_addr->dst_ip));
+    } else {
+        strlcpy(xff_addr->src_ip, xff_ip, sizeof(xff_addr->src_ip));
     }
+    return xff_addr;
 }
 
 static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
 {
     MemBuffer *payload = aft->payload_buffer;
     AlertJsonOutputCtx *json_output_ctx = aft->json_output_ctx;
-    json_t *hjs = NULL;
 
     int i;
 
     if (p->alerts.cnt == 0 && !(p->flags & PKT_HAS_TAG))
         return TM_ECODE_OK;
 
-    json_t *js = CreateJSONHeader(p, LOG_DIR_PACKET, "alert");
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-
-    JsonAddCommonOptions(&json_output_ctx->cfg, p, p->flow, js);
-
     for (i = 0; i < p->alerts.cnt; i++) {
         const PacketAlert *pa = &p->alerts.alerts[i];
         if (unlikely(pa->s == NULL)) {
             continue;
         }
 
-        MemBufferReset(aft->json_buffer);
+        JsonAddrInfo addr;
+        JsonAddrInfo *addrp = JsonAddrInfoInit(p, LOG_DIR_PACKET, &addr) ?
+            &addr : NULL;
+
+        /* tuple of the EVE header, the xff ip if it overwrites it. The
+         * alert source and target are always from the packet. */
+        JsonAddrInfo xff_addr;
+        const JsonAddrInfo *eve_addrp = addrp;
+
+        HttpXFFCfg *xff_cfg = json_output_ctx->xff_cfg != NULL ?
+            json_output_ctx->xff_cfg : json_output_ctx->parent_xff_cfg;
+        int have_xff_ip = 0;
+        char xff_buffer[XFF_MAXLEN];
+
+        /* xff header: the overwrite mode changes the logged tuple, so it
+         * has to be looked up before the header is written */
+        if ((xff_cfg != NULL) && !(xff_cfg->flags & XFF_DISABLED) && p->flow != NULL) {
+            if (FlowGetAppProtocol(p->flow) == ALPROTO_HTTP) {
+                if (pa->flags & PACKET_ALERT_FLAG_TX) {
+                    have_xff_ip = HttpXFFGetIPFromTx(p->flow, pa->tx_id, xff_cfg,
+                            xff_buffer, XFF_MAXLEN);
+                } else {
+                    have_xff_ip = HttpXFFGetIP(p->flow, xff_cfg, xff_buffer,
+                            XFF_MAXLEN);
+                }
+            }
+
+            if (have_xff_ip && !(xff_cfg->flags & XFF_EXTRADATA) &&
+                    (xff_cfg->flags & XFF_OVERWRITE) && addrp != NULL) {
+                eve_addrp = AlertJsonXFFAddr(p, addrp, xff_buffer, &xff_addr);
+            }
+        }
+
+        JsonBuilder jb;
+        JsonBuilderInit(&jb, aft->file_ctx, &aft->json_buffer);
+
+        CreateEveHeader(&jb, p, "alert", eve_addrp);
+        JsonBuilderAddCommonOptions(&json_output_ctx->cfg, p, p->flow, &jb);
 
         /* alert */
-        AlertJsonHeader(json_output_ctx, p, pa, js, json_output_ctx->flags);
+        AlertJsonBuilderHeader(p, pa, &jb, json_output_ctx->flags, addrp);
 
         if (IS_TUNNEL_PKT(p)) {
-            AlertJsonTunnel(p, js);
+            AlertJsonTunnel(p, &jb);
         }
 
         if (json_output_ctx->flags & LOG_JSON_APP_LAYER && p->flow != NULL) {
-            const AppProto proto = FlowGetAppProtocol(p->flow);
-            switch (proto) {
-                case ALPROTO_HTTP:
-                    hjs = JsonHttpAddMetadata(p->flow, pa->tx_id);
-                    if (hjs) {
-                        if (json_output_ctx->flags & LOG_JSON_HTTP_BODY) {
-                            JsonHttpLogJSONBodyPrintable(hjs, p->flow, pa->tx_id);
-                        }
-                        if (json_output_ctx->flags & LOG_JSON_HTTP_BODY_BASE64) {
-                            JsonHttpLogJSONBodyBase64(hjs, p->flow, pa->tx_id);
-                        }
-                        json_object_set_new(js, "http", hjs);
-                    }
-                    break;
-                case ALPROTO_TLS:
-                    AlertJsonTls(p->flow, js);
-                    break;
-                case ALPROTO_SSH:
-                    AlertJsonSsh(p->flow, js);
-                    break;
-                case ALPROTO_SMTP:
-                    hjs = JsonSMTPAddMetadata(p->flow, pa->tx_id);
-                    if (hjs) {
-                        json_object_set_new(js, "smtp", hjs);
-                    }
-
-                    hjs = JsonEmailAddMetadata(p->flow, pa->tx_id);
-                    if (hjs) {
-                        json_object_set_new(js, "email", hjs);
-                    }
-                    break;
-                case ALPROTO_NFS:
-                    hjs = JsonNFSAddMetadataRPC(p->flow, pa->tx_id);
-                    if (hjs)
-                        json_object_set_new(js, "rpc", hjs);
-                    hjs = JsonNFSAddMetadata(p->flow, pa->tx_id);
-                    if (hjs)
-                        json_object_set_new(js, "nfs", hjs);
-                    break;
-                case ALPROTO_SMB:
-                    hjs = JsonSMBAddMetadata(p->flow, pa->tx_id);
-                    if (hjs)
-                        json_object_set_new(js, "smb", hjs);
-                    break;
-                case ALPROTO_SIP:
-                    hjs = JsonSIPAddMetadata(p->flow, pa->tx_id);
-                    if (hjs)
-                        json_object_set_new(js, "sip", hjs);
-                    break;
-                case ALPROTO_FTPDATA:
-                    hjs = JsonFTPDataAddMetadata(p->flow);
-                    if (hjs)
-                        json_object_set_new(js, "ftp-data", hjs);
-                    break;
-                case ALPROTO_DNP3:
-                    AlertJsonDnp3(p->flow, pa->tx_id, js);
-                    break;
-                case ALPROTO_DNS:
-                    AlertJsonDns(p->flow, pa->tx_id, js);
-                    break;
-                default:
-                    break;
+            json_t *js = json_object();
+            if (js != NULL) {
+                AlertJsonAppLayer(json_output_ctx, p, pa, js);
+                JsonBuilderSetJsonMembers(&jb, js);
+                json_decref(js);
             }
         }
 
         if (p->flow) {
             if (json_output_ctx->flags & LOG_JSON_FLOW) {
-                hjs = json_object();
-                if (hjs != NULL) {
-                    JsonAddFlow(p->flow, js, hjs);
-                    json_object_set_new(js, "flow", hjs);
-                }
+                JsonBuilderAddFlow(p->flow, &jb);
+                /* close "flow" */
+                JsonBuilderClose(&jb);
             } else {
-                json_object_set_new(js, "app_proto",
-                        json_string(AppProtoToString(p->flow->alproto)));
+                JsonBuilderSetString(&jb, "app_proto",
+                        AppProtoToString(p->flow->alproto));
             }
         }
 
@@ -527,7 +676,7 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                         unsigned long len = json_output_ctx->payload_buffer_size * 2;
                         uint8_t encoded[len];
                         Base64Encode(payload->buffer, payload->offset, encoded, &len);
-                        json_object_set_new(js, "payload", json_string((char *)encoded));
+                        JsonBuilderSetString(&jb, "payload", (char *)encoded);
                     }
 
                     if (json_output_ctx->flags & LOG_JSON_PAYLOAD) {
@@ -536,78 +685,42 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                         PrintStringsToBuffer(printable_buf, &offset,
                                 sizeof(printable_buf),
                                 payload->buffer, payload->offset);
-                        json_object_set_new(js, "payload_printable",
-                                json_string((char *)printable_buf));
+                        JsonBuilderSetString(&jb, "payload_printable",
+                                (char *)printable_buf);
                     }
                 } else if (p->payload_len) {
                     /* Fallback on packet payload */
-                    AlertAddPayload(json_output_ctx, js, p);
+                    AlertAddPayload(json_output_ctx, &jb, p);
                 }
             } else {
                 /* This is a single packet and not a stream */
-                AlertAddPayload(json_output_ctx, js, p);
+                AlertAddPayload(json_output_ctx, &jb, p);
             }
 
-            json_object_set_new(js, "stream", json_integer(stream));
+            JsonBuilderSetInt(&jb, "stream", stream);
         }
 
         /* base64-encoded full packet */
         if (json_output_ctx->flags & LOG_JSON_PACKET) {
-            JsonPacket(p, js, 0);
+            JsonBuilderPacket(p, &jb, 0);
         }
 
-        /* signature text */
-        if (json_output_ctx->flags & LOG_JSON_RULE) {
-            hjs = json_object_get(js, "alert");
-            if (json_is_object(hjs))
-                json_object_set_new(hjs, "rule", json_string(pa->s->sig_str));
-        }
-
-        HttpXFFCfg *xff_cfg = json_output_ctx->xff_cfg != NULL ?
-            json_output_ctx->xff_cfg : json_output_ctx->parent_xff_cfg;;
-
-        /* xff header */
-        if ((xff_cfg != NULL) && !(xff_cfg->flags & XFF_DISABLED) && p->flow != NULL) {
-            int have_xff_ip = 0;
-            char buffer[XFF_MAXLEN];
-
-            if (FlowGetAppProtocol(p->flow) == ALPROTO_HTTP) {
-                if (pa->flags & PACKET_ALERT_FLAG_TX) {
-                    have_xff_ip = HttpXFFGetIPFromTx(p->flow, pa->tx_id, xff_cfg, buffer, XFF_MAXLEN);
-                } else {
-                    have_xff_ip = HttpXFFGetIP(p->flow, xff_cfg, buffer, XFF_MAXLEN);
-                }
-            }
-
-            if (have_xff_ip) {
-                if (xff_cfg->flags & XFF_EXTRADATA) {
-                    json_object_set_new(js, "xff", json_string(buffer));
-                }
-                else if (xff_cfg->flags & XFF_OVERWRITE) {
-                    if (p->flowflags & FLOW_PKT_TOCLIENT) {
-                        json_object_set(js, "dest_ip", json_string(buffer));
-                    } else {
-                        json_object_set(js, "src_ip", json_string(buffer));
-                    }
-                }
-            }
+        if (have_xff_ip && (xff_cfg->flags & XFF_EXTRADATA)) {
+            JsonBuilderSetString(&jb, "xff", xff_buffer);
         }
 
-        OutputJSONBuffer(js, aft->file_ctx, &aft->json_buffer);
-        json_object_del(js, "alert");
+        OutputJsonBuilderBuffer(&jb, aft->file_ctx);
     }
-    json_object_clear(js);
-    json_decref(js);
 
     if ((p->flags & PKT_HAS_TAG) && (json_output_ctx->flags &
             LOG_JSON_TAGGED_PACKETS)) {
-        MemBufferReset(aft->json_buffer);
-        json_t *packetjs = CreateJSONHeader(p, LOG_DIR_PACKET, "packet");
-        if (unlikely(packetjs != NULL)) {
-            JsonPacket(p, packetjs, 0);
-            OutputJSONBuffer(packetjs, aft->file_ctx, &aft->json_buffer);
-            json_decref(packetjs);
-        }
+        JsonAddrInfo addr;
+        JsonBuilder jb;
+        JsonBuilderInit(&jb, aft->file_ctx, &aft->json_buffer);
+        CreateEveHeader(&jb, p, "packet",
+                JsonAddrInfoInit(p, LOG_DIR_PACKET, &addr) ? &addr : NULL);
+        JsonBuilderPacket(p, &jb, 0);
+        OutputJsonBuilderBuffer(&jb, aft->file_ctx);
     }
 
     return TM_ECODE_OK;
@@ -987,6 +1100,110 @@ error:
     return result;
 }
 
+#ifdef UNITTESTS
+/** \test alert record of the builder matches the jansson one */
+static int JsonAlertTest01(void)
+{
+    uint8_t payload[] = "GET / HTTP/1.1\r\n\r\n";
+    Packet *p = UTHBuildPacketSrcDstPorts(payload, sizeof(payload) - 1,
+            IPPROTO_TCP, 41424, 80);
+    FAIL_IF_NULL(p);
+    p->vlan_id[0] = 10;
+    p->vlan_idx = 1;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    FAIL_IF_NULL(de_ctx);
+    Signature *s = SigInit(de_ctx, "alert tcp any any -> any any "
+            "(msg:\"json \\\"test\\\"\"; target:dest_ip; "
+            "metadata: created_at 2020, created_at 2021, tag x; sid:1; rev:2;)");
+    FAIL_IF_NULL(s);
+
+    PacketAlert pa;
+    memset(&pa, 0, sizeof(pa));
+    pa.s = s;
+    pa.action = ACTION_ALERT;
+    pa.flags = PACKET_ALERT_FLAG_TX;
+    pa.tx_id = 3;
+
+    LogFileCtx *lf = LogFileNewCtx();
+    FAIL_IF_NULL(lf);
+    lf->json_flags = JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|
+        JSON_ESCAPE_SLASH;
+
+    const uint16_t flags = LOG_JSON_RULE_METADATA | LOG_JSON_RULE;
+    AlertJsonOutputCtx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.flags = flags;
+
+    json_t *js = CreateJSONHeader(p, LOG_DIR_PACKET, "alert");
+    FAIL_IF_NULL(js);
+    AlertJsonHeader(&ctx, p, &pa, js, flags);
+    json_object_set_new(json_object_get(js, "alert"), "rule",
+            json_string(s->sig_str));
+    JsonPacket(p, js, 0);
+    char *expect = json_dumps(js, lf->json_flags);
+    FAIL_IF_NULL(expect);
+
+    MemBuffer *buffer = MemBufferCreateNew(16);
+    FAIL_IF_NULL(buffer);
+    JsonBuilder jb;
+    JsonBuilderInit(&jb, lf, &buffer);
+    JsonAddrInfo addr;
+    FAIL_IF_NOT(JsonAddrInfoInit(p, LOG_DIR_PACKET, &addr));
+    CreateEveHeader(&jb, p, "alert", &addr);
+    AlertJsonBuilderHeader(p, &pa, &jb, flags, &addr);
+    JsonBuilderPacket(p, &jb, 0);
+    JsonBuilderClose(&jb);
+    FAIL_IF(jb.error);
+
+    if (strcmp((char *)MEMBUFFER_BUFFER(buffer), expect) != 0) {
+        printf("got: %s\nexpected: %s\n", MEMBUFFER_BUFFER(buffer), expect);
+        FAIL;
+    }
+    free(expect);
+
+    /* xff overwrite: the header tuple has the xff ip, the alert source
+     * and target stay those of the packet */
+    json_object_set_new(js, "src_ip", json_string("10.10.10.10"));
+    expect = json_dumps(js, lf->json_flags);
+    FAIL_IF_NULL(expect);
+    FAIL_IF_NULL(strstr(expect, "\"source\":{\"ip\":\"192.168.1.5\""));
+
+    JsonBuilderInit(&jb, lf, &buffer);
+    JsonAddrInfo xff_addr;
+    CreateEveHeader(&jb, p, "alert",
+            AlertJsonXFFAddr(p, &addr, "10.10.10.10", &xff_addr));
+    AlertJsonBuilderHeader(p, &pa, &jb, flags, &addr);
+    JsonBuilderPacket(p, &jb, 0);
+    JsonBuilderClose(&jb);
+    FAIL_IF(jb.error);
+    FAIL_IF(strcmp(addr.src_ip, "192.168.1.5") != 0);
+
+    if (MEMBUFFER_OFFSET(buffer) != strlen(expect) ||
+            memcmp(MEMBUFFER_BUFFER(buffer), expect, strlen(expect)) != 0) {
+        printf("got: %.*s\nexpected: %s\n", (int)MEMBUFFER_OFFSET(buffer),
+                MEMBUFFER_BUFFER(buffer), expect);
+        FAIL;
+    }
+
+    free(expect);
+    json_decref(js);
+    MemBufferFree(buffer);
+    LogFileFreeCtx(lf);
+    SigFree(s);
+    DetectEngineCtxFree(de_ctx);
+    UTHFreePacket(p);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void JsonAlertLogRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("JsonAlertTest01", JsonAlertTest01);
+#endif
+}
+
 void JsonAlertLogRegister (void)
 {
     OutputRegisterPacketModule(LOGGER_JSON_ALERT, MODULE_NAME, "alert-json-log",
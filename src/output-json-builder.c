@@ -0,0 +1,916 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming JSON writer for EVE records.
+ *
+ * Loggers on the hot path build their record with a JsonBuilder instead
+ * of a jansson tree: members are serialized straight into the thread's
+ * output buffer in the order they are added, so there is no per member
+ * allocation and no separate dump pass. Output is byte for byte what
+ * json_dump_callback produces for the same members with the file's
+ * json flags (compact, ensure_ascii, escape_slash).
+ *
+ * Subtrees that are still produced as json_t can be added with
+ * JsonBuilderSetJson.
+ *
+ * With eve-log "format: cbor" the same calls produce CBOR (RFC 7049)
+ * instead: each record is a 4 byte big endian length followed by one
+ * map. Objects and arrays opened by the builder use indefinite length
+ * encoding, so nothing has to be counted or patched up, integers are
+ * written in binary and strings are copied as is. Members, names and
+ * value types are the same as in the JSON output.
+ */
+
+#include "suricata-common.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-buffer.h"
+#include "util-logopenfile.h"
+#include "source-pcap-file.h"
+
+#include "output-json.h"
+#include "output-json-builder.h"
+
+/* longest string we accept, so that the worst case escaped size can't
+ * overflow the MemBuffer size */
+#define JB_STRING_MAX   (UINT32_MAX / 8)
+
+static int JBReserve(JsonBuilder *jb, size_t len)
+{
+    MemBuffer *mb = *jb->buffer;
+    if (likely(len < (size_t)(mb->size - mb->offset)))
+        return 0;
+    if (jb->error)
+        return -1;
+
+    uint32_t expand_by = (uint32_t)(len + 1 - (mb->size - mb->offset));
+    if (expand_by < JSON_OUTPUT_BUFFER_SIZE)
+        expand_by = JSON_OUTPUT_BUFFER_SIZE;
+    if (MemBufferExpand(jb->buffer, expand_by) < 0) {
+        jb->error = true;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void JBWrite(JsonBuilder *jb, const void *data, size_t len)
+{
+    if (JBReserve(jb, len) < 0)
+        return;
+    MemBuffer *mb = *jb->buffer;
+    memcpy(mb->buffer + mb->offset, data, len);
+    mb->offset += len;
+}
+
+static inline void JBWriteChar(JsonBuilder *jb, char c)
+{
+    if (JBReserve(jb, 1) < 0)
+        return;
+    MemBuffer *mb = *jb->buffer;
+    mb->buffer[mb->offset++] = c;
+}
+
+static int JBDumpCallback(const char *str, size_t size, void *data)
+{
+    JsonBuilder *jb = data;
+    JBWrite(jb, str, size);
+    return jb->error ? -1 : 0;
+}
+
+/**
+ *  \brief decode one UTF-8 sequence, rejecting what jansson rejects
+ *
+ *  \retval n length of the sequence or 0 if it is invalid
+ */
+static inline uint32_t JBUtf8Decode(const uint8_t *s, size_t len, uint32_t *cp)
+{
+    const uint8_t c = s[0];
+    uint32_t n, v;
+
+    if (c < 0xC2) {
+        /* continuation byte or overlong 2 byte sequence */
+        return 0;
+    } else if (c < 0xE0) {
+        n = 2;
+        v = c & 0x1F;
+    } else if (c < 0xF0) {
+        n = 3;
+        v = c & 0x0F;
+    } else if (c < 0xF5) {
+        n = 4;
+        v = c & 0x07;
+    } else {
+        return 0;
+    }
+    if (n > len)
+        return 0;
+
+    for (uint32_t i = 1; i < n; i++) {
+        if ((s[i] & 0xC0) != 0x80)
+            return 0;
+        v = (v << 6) | (s[i] & 0x3F);
+    }
+    if ((n == 3 && v < 0x800) || (n == 4 && v < 0x10000) ||
+            v > 0x10FFFF || (v >= 0xD800 && v <= 0xDFFF))
+        return 0;
+
+    *cp = v;
+    return n;
+}
+
+static inline uint8_t *JBWriteUnicodeEscape(uint8_t *out, uint32_t v)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    *out++ = '\\';
+    *out++ = 'u';
+    *out++ = hex[(v >> 12) & 0xf];
+    *out++ = hex[(v >> 8) & 0xf];
+    *out++ = hex[(v >> 4) & 0xf];
+    *out++ = hex[v & 0xf];
+    return out;
+}
+
+/** \brief escape a single ASCII char, returns NULL if it needs none */
+static inline uint8_t *JBWriteEscapedAscii(const JsonBuilder *jb, uint8_t *out,
+        const uint8_t c)
+{
+    switch (c) {
+        case '"':
+        case '\\':
+            *out++ = '\\';
+            *out++ = c;
+            return out;
+        case '/':
+            if (!(jb->flags & JSON_BUILDER_ESCAPE_SLASH))
+                return NULL;
+            *out++ = '\\';
+            *out++ = c;
+            return out;
+        case '\b':
+            *out++ = '\\';
+            *out++ = 'b';
+            return out;
+        case '\f':
+            *out++ = '\\';
+            *out++ = 'f';
+            return out;
+        case '\n':
+            *out++ = '\\';
+            *out++ = 'n';
+            return out;
+        case '\r':
+            *out++ = '\\';
+            *out++ = 'r';
+            return out;
+        case '\t':
+            *out++ = '\\';
+            *out++ = 't';
+            return out;
+        default:
+            if (c < 0x20)
+                return JBWriteUnicodeEscape(out, c);
+            return NULL;
+    }
+}
+
+/**
+ *  \brief write a string that is not valid UTF-8
+ *
+ *  Same representation SCJsonString uses for strings jansson refuses:
+ *  non-printable bytes as \\xNN.
+ */
+static uint8_t *JBWriteStringFallback(const JsonBuilder *jb, uint8_t *out,
+        const uint8_t *s, size_t len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t c = s[i];
+        if (c >= 0x20 && c < 0x7f) {
+            uint8_t *e = JBWriteEscapedAscii(jb, out, c);
+            if (e != NULL) {
+                out = e;
+            } else {
+                *out++ = c;
+            }
+        } else {
+            *out++ = '\\';
+            *out++ = '\\';
+            *out++ = 'x';
+            *out++ = hex[c >> 4];
+            *out++ = hex[c & 0xf];
+        }
+    }
+    return out;
+}
+
+static void JBWriteString(JsonBuilder *jb, const uint8_t *s, size_t len)
+{
+    if (len > JB_STRING_MAX) {
+        jb->error = true;
+        return;
+    }
+    /* worst case every byte becomes a \u00XX escape */
+    if (JBReserve(jb, len * 6 + 2) < 0)
+        return;
+
+    MemBuffer *mb = *jb->buffer;
+    uint8_t *out = mb->buffer + mb->offset;
+    uint8_t *start = out;
+    *out++ = '"';
+
+    size_t i = 0;
+    while (i < len) {
+        const uint8_t c = s[i];
+        if (likely(c < 0x80)) {
+            uint8_t *e = JBWriteEscapedAscii(jb, out, c);
+            if (likely(e == NULL)) {
+                *out++ = c;
+            } else {
+                out = e;
+            }
+            i++;
+            continue;
+        }
+
+        uint32_t cp;
+        const uint32_t n = JBUtf8Decode(s + i, len - i, &cp);
+        if (n == 0) {
+            out = JBWriteStringFallback(jb, start + 1, s, len);
+            break;
+        }
+        if (!(jb->flags & JSON_BUILDER_ENSURE_ASCII)) {
+            memcpy(out, s + i, n);
+            out += n;
+        } else if (cp < 0x10000) {
+            out = JBWriteUnicodeEscape(out, cp);
+        } else {
+            cp -= 0x10000;
+            out = JBWriteUnicodeEscape(out, 0xD800 | (cp >> 10));
+            out = JBWriteUnicodeEscape(out, 0xDC00 | (cp & 0x3FF));
+        }
+        i += n;
+    }
+
+    *out++ = '"';
+    mb->offset += (uint32_t)(out - start);
+}
+
+/** \brief write the initial byte(s) of a CBOR item: major type and argument */
+static void JBCborHead(JsonBuilder *jb, uint8_t major, uint64_t val)
+{
+    uint8_t buf[9];
+    size_t len;
+
+    major <<= 5;
+    if (val < 24) {
+        buf[0] = major | (uint8_t)val;
+        len = 1;
+    } else if (val <= UINT8_MAX) {
+        buf[0] = major | 24;
+        len = 2;
+    } else if (val <= UINT16_MAX) {
+        buf[0] = major | 25;
+        len = 3;
+    } else if (val <= UINT32_MAX) {
+        buf[0] = major | 26;
+        len = 5;
+    } else {
+        buf[0] = major | 27;
+        len = 9;
+    }
+    for (size_t i = len - 1; i > 0; i--) {
+        buf[i] = (uint8_t)val;
+        val >>= 8;
+    }
+    JBWrite(jb, buf, len);
+}
+
+static void JBCborInt(JsonBuilder *jb, int64_t val)
+{
+    if (val >= 0)
+        JBCborHead(jb, 0, (uint64_t)val);
+    else
+        JBCborHead(jb, 1, (uint64_t)(-(val + 1)));
+}
+
+/**
+ *  \brief write a CBOR text string
+ *
+ *  Text strings must be valid UTF-8, anything else is written in the
+ *  same \\xNN form the JSON output uses, so a converted record is
+ *  identical to the JSON one.
+ */
+static void JBCborString(JsonBuilder *jb, const uint8_t *s, size_t len)
+{
+    if (len > JB_STRING_MAX) {
+        jb->error = true;
+        return;
+    }
+
+    size_t i = 0;
+    while (i < len) {
+        if (likely(s[i] < 0x80)) {
+            i++;
+            continue;
+        }
+        uint32_t cp;
+        const uint32_t n = JBUtf8Decode(s + i, len - i, &cp);
+        if (n == 0)
+            break;
+        i += n;
+    }
+    if (likely(i == len)) {
+        JBCborHead(jb, 3, len);
+        JBWrite(jb, s, len);
+        return;
+    }
+
+    static const char hex[] = "0123456789ABCDEF";
+    size_t flen = 0;
+    for (i = 0; i < len; i++) {
+        flen += (s[i] >= 0x20 && s[i] < 0x7f) ? 1 : 4;
+    }
+    JBCborHead(jb, 3, flen);
+    if (JBReserve(jb, flen) < 0)
+        return;
+
+    MemBuffer *mb = *jb->buffer;
+    uint8_t *out = mb->buffer + mb->offset;
+    for (i = 0; i < len; i++) {
+        const uint8_t c = s[i];
+        if (c >= 0x20 && c < 0x7f) {
+            *out++ = c;
+        } else {
+            *out++ = '\\';
+            *out++ = 'x';
+            *out++ = hex[c >> 4];
+            *out++ = hex[c & 0xf];
+        }
+    }
+    mb->offset += (uint32_t)flen;
+}
+
+static void JBCborDouble(JsonBuilder *jb, double val)
+{
+    uint64_t v;
+    memcpy(&v, &val, sizeof(v));
+    uint8_t buf[9];
+    buf[0] = 0xfb;
+    for (int i = 8; i > 0; i--) {
+        buf[i] = (uint8_t)v;
+        v >>= 8;
+    }
+    JBWrite(jb, buf, sizeof(buf));
+}
+
+/** \brief encode a jansson value as CBOR, containers with definite length */
+static void JBCborJson(JsonBuilder *jb, json_t *val, int depth)
+{
+    if (depth > JSON_BUILDER_MAX_DEPTH) {
+        jb->error = true;
+        return;
+    }
+
+    switch (json_typeof(val)) {
+        case JSON_OBJECT: {
+            const char *k;
+            json_t *v;
+            JBCborHead(jb, 5, json_object_size(val));
+            json_object_foreach(val, k, v) {
+                JBCborString(jb, (const uint8_t *)k, strlen(k));
+                JBCborJson(jb, v, depth + 1);
+            }
+            break;
+        }
+        case JSON_ARRAY: {
+            const size_t size = json_array_size(val);
+            JBCborHead(jb, 4, size);
+            for (size_t i = 0; i < size; i++) {
+                JBCborJson(jb, json_array_get(val, i), depth + 1);
+            }
+            break;
+        }
+        case JSON_STRING: {
+            const char *str = json_string_value(val);
+            JBCborString(jb, (const uint8_t *)str, strlen(str));
+            break;
+        }
+        case JSON_INTEGER:
+            JBCborInt(jb, (int64_t)json_integer_value(val));
+            break;
+        case JSON_REAL:
+            JBCborDouble(jb, json_real_value(val));
+            break;
+        case JSON_TRUE:
+            JBWriteChar(jb, (char)0xf5);
+            break;
+        case JSON_FALSE:
+            JBWriteChar(jb, (char)0xf4);
+            break;
+        case JSON_NULL:
+            JBWriteChar(jb, (char)0xf6);
+            break;
+    }
+}
+
+/** \brief write separator and key for the next member of the current level */
+static int JBMember(JsonBuilder *jb, const char *key)
+{
+    if (unlikely(jb->depth == 0)) {
+        jb->error = true;
+        return -1;
+    }
+    const uint8_t d = jb->depth - 1;
+    if ((key == NULL) != (jb->close[d] == ']')) {
+        jb->error = true;
+        return -1;
+    }
+
+    if (jb->flags & JSON_BUILDER_CBOR) {
+        jb->cnt[d]++;
+        if (key != NULL)
+            JBCborString(jb, (const uint8_t *)key, strlen(key));
+        return jb->error ? -1 : 0;
+    }
+
+    const bool compact = (jb->flags & JSON_BUILDER_COMPACT);
+    if (jb->cnt[d]++ > 0) {
+        if (compact)
+            JBWriteChar(jb, ',');
+        else
+            JBWrite(jb, ", ", 2);
+    }
+    if (key != NULL) {
+        JBWriteString(jb, (const uint8_t *)key, strlen(key));
+        if (compact)
+            JBWriteChar(jb, ':');
+        else
+            JBWrite(jb, ": ", 2);
+    }
+    return jb->error ? -1 : 0;
+}
+
+static void JBOpen(JsonBuilder *jb, const char *key, char open, char close)
+{
+    if (jb->depth >= JSON_BUILDER_MAX_DEPTH) {
+        jb->error = true;
+        return;
+    }
+    if (JBMember(jb, key) < 0)
+        return;
+    if (jb->flags & JSON_BUILDER_CBOR) {
+        /* indefinite length map or array */
+        JBWriteChar(jb, open == '{' ? (char)0xbf : (char)0x9f);
+    } else {
+        JBWriteChar(jb, open);
+    }
+    jb->close[jb->depth] = close;
+    jb->cnt[jb->depth] = 0;
+    jb->depth++;
+}
+
+/**
+ *  \brief reset the buffer and open the root object of a new record
+ *
+ *  Output flags follow the json settings and format of the log file.
+ */
+void JsonBuilderInit(JsonBuilder *jb, const LogFileCtx *file_ctx, MemBuffer **buffer)
+{
+    jb->buffer = buffer;
+    jb->error = false;
+    jb->flags = 0;
+    if (file_ctx->json_flags & JSON_COMPACT)
+        jb->flags |= JSON_BUILDER_COMPACT;
+    if (file_ctx->json_flags & JSON_ENSURE_ASCII)
+        jb->flags |= JSON_BUILDER_ENSURE_ASCII;
+    if (file_ctx->json_flags & JSON_ESCAPE_SLASH)
+        jb->flags |= JSON_BUILDER_ESCAPE_SLASH;
+
+    MemBufferReset(*buffer);
+    if (file_ctx->cbor) {
+        jb->flags |= JSON_BUILDER_CBOR;
+        /* room for the length, filled in by OutputJsonBuilderBuffer */
+        JBWrite(jb, "\0\0\0\0", 4);
+        JBWriteChar(jb, (char)0xbf);
+    } else {
+        if (file_ctx->prefix) {
+            JBWrite(jb, file_ctx->prefix, file_ctx->prefix_len);
+        }
+        JBWriteChar(jb, '{');
+    }
+    jb->close[0] = '}';
+    jb->cnt[0] = 0;
+    jb->depth = 1;
+}
+
+void JsonBuilderOpenObject(JsonBuilder *jb, const char *key)
+{
+    JBOpen(jb, key, '{', '}');
+}
+
+void JsonBuilderOpenArray(JsonBuilder *jb, const char *key)
+{
+    JBOpen(jb, key, '[', ']');
+}
+
+void JsonBuilderClose(JsonBuilder *jb)
+{
+    if (unlikely(jb->depth == 0)) {
+        jb->error = true;
+        return;
+    }
+    jb->depth--;
+    if (jb->flags & JSON_BUILDER_CBOR)
+        JBWriteChar(jb, (char)0xff);
+    else
+        JBWriteChar(jb, jb->close[jb->depth]);
+}
+
+/** \brief add a string, nothing is added if val is NULL */
+void JsonBuilderSetString(JsonBuilder *jb, const char *key, const char *val)
+{
+    if (val == NULL)
+        return;
+    if (JBMember(jb, key) < 0)
+        return;
+    if (jb->flags & JSON_BUILDER_CBOR)
+        JBCborString(jb, (const uint8_t *)val, strlen(val));
+    else
+        JBWriteString(jb, (const uint8_t *)val, strlen(val));
+}
+
+/** \brief add a string of len bytes, which may contain NUL bytes */
+void JsonBuilderSetStringN(JsonBuilder *jb, const char *key,
+        const uint8_t *val, size_t len)
+{
+    if (JBMember(jb, key) < 0)
+        return;
+    if (jb->flags & JSON_BUILDER_CBOR)
+        JBCborString(jb, val, len);
+    else
+        JBWriteString(jb, val, len);
+}
+
+void JsonBuilderSetUint(JsonBuilder *jb, const char *key, uint64_t val)
+{
+    if (JBMember(jb, key) < 0)
+        return;
+    if (jb->flags & JSON_BUILDER_CBOR) {
+        JBCborHead(jb, 0, val);
+        return;
+    }
+
+    char buf[20];
+    char *p = buf + sizeof(buf);
+    do {
+        *--p = '0' + (val % 10);
+        val /= 10;
+    } while (val);
+    JBWrite(jb, p, buf + sizeof(buf) - p);
+}
+
+void JsonBuilderSetInt(JsonBuilder *jb, const char *key, int64_t val)
+{
+    if (val >= 0) {
+        JsonBuilderSetUint(jb, key, (uint64_t)val);
+        return;
+    }
+    if (JBMember(jb, key) < 0)
+        return;
+    if (jb->flags & JSON_BUILDER_CBOR) {
+        JBCborInt(jb, val);
+        return;
+    }
+
+    char buf[24];
+    int r = snprintf(buf, sizeof(buf), "%"PRIi64, val);
+    if (r > 0)
+        JBWrite(jb, buf, r);
+}
+
+void JsonBuilderSetBool(JsonBuilder *jb, const char *key, bool val)
+{
+    if (JBMember(jb, key) < 0)
+        return;
+    if (jb->flags & JSON_BUILDER_CBOR)
+        JBWriteChar(jb, val ? (char)0xf5 : (char)0xf4);
+    else if (val)
+        JBWrite(jb, "true", 4);
+    else
+        JBWrite(jb, "false", 5);
+}
+
+/**
+ *  \brief add a jansson value, serialized in place
+ *
+ *  For subtrees that are still built as json_t. Does not take a
+ *  reference, the caller still owns val.
+ */
+void JsonBuilderSetJson(JsonBuilder *jb, const char *key, json_t *val)
+{
+    if (val == NULL)
+        return;
+    if (JBMember(jb, key) < 0)
+        return;
+    if (jb->flags & JSON_BUILDER_CBOR) {
+        JBCborJson(jb, val, 1);
+        return;
+    }
+
+    size_t flags = 0;
+    if (jb->flags & JSON_BUILDER_COMPACT)
+        flags |= JSON_COMPACT;
+    if (jb->flags & JSON_BUILDER_ENSURE_ASCII)
+        flags |= JSON_ENSURE_ASCII;
+    if (jb->flags & JSON_BUILDER_ESCAPE_SLASH)
+        flags |= JSON_ESCAPE_SLASH;
+    flags |= JSON_PRESERVE_ORDER | JSON_ENCODE_ANY;
+
+    if (json_dump_callback(val, JBDumpCallback, jb, flags) != 0) {
+        jb->error = true;
+    }
+}
+
+/** \brief add all members of a json_t object at the current level */
+void JsonBuilderSetJsonMembers(JsonBuilder *jb, json_t *obj)
+{
+    const char *key;
+    json_t *val;
+
+    json_object_foreach(obj, key, val) {
+        JsonBuilderSetJson(jb, key, val);
+    }
+}
+
+/** \brief close the record, returns -1 if it has to be dropped */
+static int JBFinish(JsonBuilder *jb, const LogFileCtx *file_ctx)
+{
+    while (jb->depth > 1) {
+        JsonBuilderClose(jb);
+    }
+
+    if (file_ctx->sensor_name) {
+        JsonBuilderSetString(jb, "host", file_ctx->sensor_name);
+    }
+
+    if (file_ctx->is_pcap_offline) {
+        JsonBuilderSetString(jb, "pcap_filename", PcapFileGetFilename());
+    }
+
+    while (jb->depth > 0) {
+        JsonBuilderClose(jb);
+    }
+    /* keep the buffer a valid C string for the syslog writer and leave
+     * room for the newline LogFileWrite appends */
+    if (JBReserve(jb, 2) == 0) {
+        MemBuffer *mb = *jb->buffer;
+        mb->buffer[mb->offset] = '\0';
+    }
+    if (jb->error) {
+        MemBufferReset(*jb->buffer);
+        return -1;
+    }
+    if (jb->flags & JSON_BUILDER_CBOR) {
+        /* the length prefix is at the start of the buffer */
+        MemBuffer *mb = *jb->buffer;
+        const uint32_t len = mb->offset - 4;
+        uint8_t *p = mb->buffer;
+        p[0] = (uint8_t)(len >> 24);
+        p[1] = (uint8_t)(len >> 16);
+        p[2] = (uint8_t)(len >> 8);
+        p[3] = (uint8_t)len;
+    }
+    return 0;
+}
+
+/**
+ *  \brief finish the record and write it to the log
+ *
+ *  Adds the same trailing members OutputJSONBuffer does.
+ *
+ *  \retval 0 record written
+ *  \retval -1 record dropped due to an error while building it
+ */
+int OutputJsonBuilderBuffer(JsonBuilder *jb, LogFileCtx *file_ctx)
+{
+    if (JBFinish(jb, file_ctx) < 0)
+        return -1;
+
+    LogFileWrite(file_ctx, *jb->buffer);
+    return 0;
+}
+
+#ifdef UNITTESTS
+
+static int JsonBuilderCompare(LogFileCtx *lf, const char *expect,
+        json_t *tree)
+{
+    MemBuffer *buffer = MemBufferCreateNew(16);
+    FAIL_IF_NULL(buffer);
+
+    JsonBuilder jb;
+    JsonBuilderInit(&jb, lf, &buffer);
+    JsonBuilderSetString(&jb, "str", "a\"b\\c/d\te\x01 \xc3\xa9 \xf0\x9f\x98\x80");
+    JsonBuilderSetString(&jb, "skip", NULL);
+    JsonBuilderSetString(&jb, "invalid", "a\xff\"b");
+    JsonBuilderOpenObject(&jb, "obj");
+    JsonBuilderSetUint(&jb, "u", UINT32_MAX);
+    JsonBuilderSetInt(&jb, "i", -42);
+    JsonBuilderSetBool(&jb, "t", true);
+    JsonBuilderSetBool(&jb, "f", false);
+    JsonBuilderOpenArray(&jb, "arr");
+    JsonBuilderSetUint(&jb, NULL, 0);
+    JsonBuilderOpenObject(&jb, NULL);
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    JsonBuilderClose(&jb);
+    JsonBuilderSetJson(&jb, "tree", tree);
+    JsonBuilderClose(&jb);
+    FAIL_IF(jb.error);
+    FAIL_IF(jb.depth != 0);
+
+    if (strcmp((char *)MEMBUFFER_BUFFER(buffer), expect) != 0) {
+        printf("got: %s\nexpected: %s\n", MEMBUFFER_BUFFER(buffer), expect);
+        FAIL;
+    }
+    MemBufferFree(buffer);
+    PASS;
+}
+
+/** \test output matches what jansson produces for the same members */
+static int JsonBuilderTest01(void)
+{
+    LogFileCtx *lf = LogFileNewCtx();
+    FAIL_IF_NULL(lf);
+    lf->json_flags = JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|
+        JSON_ESCAPE_SLASH;
+
+    json_t *tree = json_object();
+    FAIL_IF_NULL(tree);
+    json_object_set_new(tree, "url", json_string("/x"));
+
+    /* the jansson rendering of the same record, the invalid UTF-8
+     * member is expected in its \\xNN form */
+    json_t *js = json_object();
+    FAIL_IF_NULL(js);
+    json_object_set_new(js, "str",
+            json_string("a\"b\\c/d\te\x01 \xc3\xa9 \xf0\x9f\x98\x80"));
+    json_object_set_new(js, "invalid", json_string("a\\xFF\"b"));
+    json_t *obj = json_object();
+    json_object_set_new(obj, "u", json_integer(UINT32_MAX));
+    json_object_set_new(obj, "i", json_integer(-42));
+    json_object_set_new(obj, "t", json_true());
+    json_object_set_new(obj, "f", json_false());
+    json_t *arr = json_array();
+    json_array_append_new(arr, json_integer(0));
+    json_array_append_new(arr, json_object());
+    json_object_set_new(obj, "arr", arr);
+    json_object_set_new(js, "obj", obj);
+    json_object_set(js, "tree", tree);
+
+    char *expect = json_dumps(js, lf->json_flags);
+    FAIL_IF_NULL(expect);
+    FAIL_IF(JsonBuilderCompare(lf, expect, tree) != 1);
+    free(expect);
+
+    /* relaxed output: spaces after separators, raw UTF-8, plain slashes */
+    lf->json_flags = JSON_PRESERVE_ORDER;
+    expect = json_dumps(js, lf->json_flags);
+    FAIL_IF_NULL(expect);
+    FAIL_IF(JsonBuilderCompare(lf, expect, tree) != 1);
+    free(expect);
+
+    json_decref(js);
+    json_decref(tree);
+    LogFileFreeCtx(lf);
+    PASS;
+}
+
+/** \test prefix, misuse and depth limits */
+static int JsonBuilderTest02(void)
+{
+    LogFileCtx *lf = LogFileNewCtx();
+    FAIL_IF_NULL(lf);
+    lf->json_flags = JSON_COMPACT;
+    lf->prefix = SCStrdup("@cee: ");
+    FAIL_IF_NULL(lf->prefix);
+    lf->prefix_len = strlen(lf->prefix);
+
+    MemBuffer *buffer = MemBufferCreateNew(4);
+    FAIL_IF_NULL(buffer);
+
+    JsonBuilder jb;
+    JsonBuilderInit(&jb, lf, &buffer);
+    JsonBuilderSetUint(&jb, "a", 1);
+    JsonBuilderClose(&jb);
+    FAIL_IF(jb.error);
+    FAIL_IF(strcmp((char *)MEMBUFFER_BUFFER(buffer), "@cee: {\"a\":1}") != 0);
+
+    /* embedded NUL bytes are escaped */
+    JsonBuilderInit(&jb, lf, &buffer);
+    JsonBuilderSetStringN(&jb, "b", (const uint8_t *)"x\0y", 3);
+    JsonBuilderClose(&jb);
+    FAIL_IF(jb.error);
+    FAIL_IF(strcmp((char *)MEMBUFFER_BUFFER(buffer),
+                "@cee: {\"b\":\"x\\u0000y\"}") != 0);
+
+    /* array members are added without a key */
+    JsonBuilderInit(&jb, lf, &buffer);
+    JsonBuilderOpenArray(&jb, "a");
+    JsonBuilderSetUint(&jb, NULL, 1);
+    FAIL_IF(jb.error);
+    JsonBuilderSetUint(&jb, "k", 1);
+    FAIL_IF_NOT(jb.error);
+
+    JsonBuilderInit(&jb, lf, &buffer);
+    for (int i = 0; i < JSON_BUILDER_MAX_DEPTH; i++) {
+        JsonBuilderOpenObject(&jb, "o");
+    }
+    FAIL_IF_NOT(jb.error);
+
+    MemBufferFree(buffer);
+    LogFileFreeCtx(lf);
+    PASS;
+}
+
+/** \test CBOR encoding */
+static int JsonBuilderTest03(void)
+{
+    LogFileCtx *lf = LogFileNewCtx();
+    FAIL_IF_NULL(lf);
+    lf->json_flags = JSON_COMPACT;
+    lf->cbor = true;
+    lf->prefix = SCStrdup("@cee: ");
+    FAIL_IF_NULL(lf->prefix);
+    lf->prefix_len = strlen(lf->prefix);
+
+    MemBuffer *buffer = MemBufferCreateNew(4);
+    FAIL_IF_NULL(buffer);
+
+    json_t *tree = json_object();
+    FAIL_IF_NULL(tree);
+    json_t *arr = json_array();
+    json_array_append_new(arr, json_integer(-500));
+    json_array_append_new(arr, json_real(2.5));
+    json_array_append_new(arr, json_null());
+    json_object_set_new(tree, "k", arr);
+
+    JsonBuilder jb;
+    JsonBuilderInit(&jb, lf, &buffer);
+    JsonBuilderSetString(&jb, "a", "b");
+    JsonBuilderSetUint(&jb, "n", 500);
+    JsonBuilderSetInt(&jb, "i", -1);
+    JsonBuilderOpenArray(&jb, "l");
+    JsonBuilderSetBool(&jb, NULL, true);
+    JsonBuilderClose(&jb);
+    JsonBuilderSetString(&jb, "x", "\xff");
+    JsonBuilderSetJson(&jb, "t", tree);
+    FAIL_IF(JBFinish(&jb, lf) != 0);
+
+    static const uint8_t expect[] = {
+        0x00, 0x00, 0x00, 0x2d, 0xbf,
+        0x61, 'a', 0x61, 'b',
+        0x61, 'n', 0x19, 0x01, 0xf4,
+        0x61, 'i', 0x20,
+        0x61, 'l', 0x9f, 0xf5, 0xff,
+        0x61, 'x', 0x64, '\\', 'x', 'F', 'F',
+        0x61, 't', 0xa1, 0x61, 'k', 0x83, 0x39, 0x01, 0xf3,
+        0xfb, 0x40, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf6,
+        0xff,
+    };
+    FAIL_IF(MEMBUFFER_OFFSET(buffer) != sizeof(expect));
+    FAIL_IF(memcmp(MEMBUFFER_BUFFER(buffer), expect, sizeof(expect)) != 0);
+
+    json_decref(tree);
+    MemBufferFree(buffer);
+    LogFileFreeCtx(lf);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void JsonBuilderRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("JsonBuilderTest01", JsonBuilderTest01);
+    UtRegisterTest("JsonBuilderTest02", JsonBuilderTest02);
+    UtRegisterTest("JsonBuilderTest03", JsonBuilderTest03);
+#endif /* UNITTESTS */
+}
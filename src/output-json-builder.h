@@ -0,0 +1,73 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming JSON writer for EVE records. Writes directly into the
+ * per thread output MemBuffer instead of building a jansson tree.
+ */
+
+#ifndef __OUTPUT_JSON_BUILDER_H__
+#define __OUTPUT_JSON_BUILDER_H__
+
+#include "util-buffer.h"
+#include "util-logopenfile.h"
+
+/** max nesting of objects and arrays, including the root object */
+#define JSON_BUILDER_MAX_DEPTH  32
+
+#define JSON_BUILDER_COMPACT        BIT_U8(0)
+#define JSON_BUILDER_ENSURE_ASCII   BIT_U8(1)
+#define JSON_BUILDER_ESCAPE_SLASH   BIT_U8(2)
+/* emit length prefixed CBOR instead of JSON text */
+#define JSON_BUILDER_CBOR           BIT_U8(3)
+
+typedef struct JsonBuilder_ {
+    /* output buffer, expanded as needed */
+    MemBuffer **buffer;
+    uint8_t flags;
+    /* set on (memory) errors or API misuse, record is dropped */
+    bool error;
+    /* current nesting depth, 1 is the root object */
+    uint8_t depth;
+    /* per level: '}' or ']' and the number of members written so far */
+    char close[JSON_BUILDER_MAX_DEPTH];
+    uint32_t cnt[JSON_BUILDER_MAX_DEPTH];
+} JsonBuilder;
+
+void JsonBuilderInit(JsonBuilder *jb, const LogFileCtx *file_ctx, MemBuffer **buffer);
+
+/* the key argument must be NULL when adding to an array */
+void JsonBuilderOpenObject(JsonBuilder *jb, const char *key);
+void JsonBuilderOpenArray(JsonBuilder *jb, const char *key);
+void JsonBuilderClose(JsonBuilder *jb);
+
+void JsonBuilderSetString(JsonBuilder *jb, const char *key, const char *val);
+void JsonBuilderSetStringN(JsonBuilder *jb, const char *key,
+        const uint8_t *val, size_t len);
+void JsonBuilderSetUint(JsonBuilder *jb, const char *key, uint64_t val);
+void JsonBuilderSetInt(JsonBuilder *jb, const char *key, int64_t val);
+void JsonBuilderSetBool(JsonBuilder *jb, const char *key, bool val);
+void JsonBuilderSetJson(JsonBuilder *jb, const char *key, json_t *val);
+void JsonBuilderSetJsonMembers(JsonBuilder *jb, json_t *obj);
+
+int OutputJsonBuilderBuffer(JsonBuilder *jb, LogFileCtx *file_ctx);
+
+void JsonBuilderRegisterTests(void);
+
+#endif /* __OUTPUT_JSON_BUILDER_H__ */
@@ -76,6 +76,8 @@
 
 static void OutputJsonDeInitCtx(OutputCtx *);
 static void CreateJSONCommunityFlowId(json_t *js, const Flow *f, const uint16_t seed);
+static bool CreateCommunityFlowId(const Flow *f, const uint16_t seed,
+        unsigned char *buf, size_t size);
 
 static const char *TRAFFIC_ID_PREFIX = "traffic/id/";
 static const char *TRAFFIC_LABEL_PREFIX = "traffic/label/";
@@ -398,6 +400,26 @@ void JsonAddCommonOptions(const OutputJsonCommonSettings *cfg,
     }
 }
 
+void JsonBuilderAddCommonOptions(const OutputJsonCommonSettings *cfg,
+        const Packet *p, const Flow *f, JsonBuilder *jb)
+{
+    if (cfg->include_metadata && ((p && p->pktvar) || (f && f->flowvar))) {
+        /* metadata is rare, keep using the jansson code for it */
+        json_t *js = json_object();
+        if (js != NULL) {
+            JsonAddMetadata(p, f, js);
+            JsonBuilderSetJsonMembers(jb, js);
+            json_decref(js);
+        }
+    }
+    if (cfg->include_community_id && f != NULL) {
+        unsigned char buf[64];
+        if (CreateCommunityFlowId(f, cfg->community_id_seed, buf, sizeof(buf))) {
+            JsonBuilderSetString(jb, "community_id", (const char *)buf);
+        }
+    }
+}
+
 /**
  * \brief Jsonify a packet
  *
@@ -422,6 +444,20 @@ void JsonPacket(const Packet *p, json_t *js, unsigned long max_length)
     json_object_set_new(packetinfo_js, "linktype", json_integer(p->datalink));
     json_object_set_new(js, "packet_info", packetinfo_js);
 }
+
+void JsonBuilderPacket(const Packet *p, JsonBuilder *jb, unsigned long max_length)
+{
+    unsigned long max_len = max_length == 0 ? GET_PKT_LEN(p) : max_length;
+    unsigned long len = 2 * max_len;
+    uint8_t encoded_packet[len];
+    if (Base64Encode((unsigned char*) GET_PKT_DATA(p), max_len, encoded_packet, &len) == SC_BASE64_OK) {
+        JsonBuilderSetString(jb, "packet", (char *)encoded_packet);
+    }
+
+    JsonBuilderOpenObject(jb, "packet_info");
+    JsonBuilderSetUint(jb, "linktype", p->datalink);
+    JsonBuilderClose(jb);
+}
 /** \brief jsonify tcp flags field
  *  Only add 'true' fields in an attempt to keep things reasonably compact.
  */
@@ -445,113 +481,152 @@ void JsonTcpFlags(uint8_t flags, json_t *js)
         json_object_set_new(js, "cwr", json_true());
 }
 
+void JsonBuilderTcpFlags(uint8_t flags, JsonBuilder *jb)
+{
+    if (flags & TH_SYN)
+        JsonBuilderSetBool(jb, "syn", true);
+    if (flags & TH_FIN)
+        JsonBuilderSetBool(jb, "fin", true);
+    if (flags & TH_RST)
+        JsonBuilderSetBool(jb, "rst", true);
+    if (flags & TH_PUSH)
+        JsonBuilderSetBool(jb, "psh", true);
+    if (flags & TH_ACK)
+        JsonBuilderSetBool(jb, "ack", true);
+    if (flags & TH_URG)
+        JsonBuilderSetBool(jb, "urg", true);
+    if (flags & TH_ECN)
+        JsonBuilderSetBool(jb, "ecn", true);
+    if (flags & TH_CWR)
+        JsonBuilderSetBool(jb, "cwr", true);
+}
+
 /**
- * \brief Add five tuple from packet to JSON object
+ * \brief Get the five tuple of a packet as strings
  *
  * \param p Packet
  * \param dir log direction (packet or flow)
- * \param js JSON object
+ * \param addr filled in with the tuple
+ *
+ * \retval false packet direction and not an IP packet, nothing to log
  */
-void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
+bool JsonAddrInfoInit(const Packet *p, enum OutputJsonLogDirection dir,
+        JsonAddrInfo *addr)
 {
-    char srcip[46] = {0}, dstip[46] = {0};
-    Port sp, dp;
-    char proto[16];
+    char *srcip = addr->src_ip, *dstip = addr->dst_ip;
+    const size_t ipsize = sizeof(addr->src_ip);
+
+    memset(addr, 0, sizeof(*addr));
 
     switch (dir) {
         case LOG_DIR_PACKET:
             if (PKT_IS_IPV4(p)) {
                 PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                        srcip, sizeof(srcip));
+                        srcip, ipsize);
                 PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                        dstip, sizeof(dstip));
+                        dstip, ipsize);
             } else if (PKT_IS_IPV6(p)) {
                 PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                        srcip, sizeof(srcip));
+                        srcip, ipsize);
                 PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                        dstip, sizeof(dstip));
+                        dstip, ipsize);
             } else {
                 /* Not an IP packet so don't do anything */
-                return;
+                return false;
             }
-            sp = p->sp;
-            dp = p->dp;
+            addr->sp = p->sp;
+            addr->dp = p->dp;
             break;
         case LOG_DIR_FLOW:
         case LOG_DIR_FLOW_TOSERVER:
             if ((PKT_IS_TOSERVER(p))) {
                 if (PKT_IS_IPV4(p)) {
                     PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 } else if (PKT_IS_IPV6(p)) {
                     PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 }
-                sp = p->sp;
-                dp = p->dp;
+                addr->sp = p->sp;
+                addr->dp = p->dp;
             } else {
                 if (PKT_IS_IPV4(p)) {
                     PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 } else if (PKT_IS_IPV6(p)) {
                     PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 }
-                sp = p->dp;
-                dp = p->sp;
+                addr->sp = p->dp;
+                addr->dp = p->sp;
             }
             break;
         case LOG_DIR_FLOW_TOCLIENT:
             if ((PKT_IS_TOCLIENT(p))) {
                 if (PKT_IS_IPV4(p)) {
                     PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 } else if (PKT_IS_IPV6(p)) {
                     PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 }
-                sp = p->sp;
-                dp = p->dp;
+                addr->sp = p->sp;
+                addr->dp = p->dp;
             } else {
                 if (PKT_IS_IPV4(p)) {
                     PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 } else if (PKT_IS_IPV6(p)) {
                     PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p),
-                            srcip, sizeof(srcip));
+                            srcip, ipsize);
                     PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p),
-                            dstip, sizeof(dstip));
+                            dstip, ipsize);
                 }
-                sp = p->dp;
-                dp = p->sp;
+                addr->sp = p->dp;
+                addr->dp = p->sp;
             }
             break;
         default:
             DEBUG_VALIDATE_BUG_ON(1);
-            return;
+            return false;
     }
 
     if (SCProtoNameValid(IP_GET_IPPROTO(p)) == TRUE) {
-        strlcpy(proto, known_proto[IP_GET_IPPROTO(p)], sizeof(proto));
+        strlcpy(addr->proto, known_proto[IP_GET_IPPROTO(p)], sizeof(addr->proto));
     } else {
-        snprintf(proto, sizeof(proto), "%03" PRIu32, IP_GET_IPPROTO(p));
+        snprintf(addr->proto, sizeof(addr->proto), "%03" PRIu32, IP_GET_IPPROTO(p));
     }
+    return true;
+}
 
-    json_object_set_new(js, "src_ip", json_string(srcip));
+/**
+ * \brief Add five tuple from packet to JSON object
+ *
+ * \param p Packet
+ * \param dir log direction (packet or flow)
+ * \param js JSON object
+ */
+void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
+{
+    JsonAddrInfo addr;
+    if (!JsonAddrInfoInit(p, dir, &addr))
+        return;
+
+    json_object_set_new(js, "src_ip", json_string(addr.src_ip));
 
     switch(p->proto) {
         case IPPROTO_ICMP:
@@ -559,11 +634,11 @@ void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "src_port", json_integer(sp));
+            json_object_set_new(js, "src_port", json_integer(addr.sp));
             break;
     }
 
-    json_object_set_new(js, "dest_ip", json_string(dstip));
+    json_object_set_new(js, "dest_ip", json_string(addr.dst_ip));
 
     switch(p->proto) {
         case IPPROTO_ICMP:
@@ -571,15 +646,51 @@ void JsonFiveTuple(const Packet *p, enum OutputJsonLogDirection dir, json_t *js)
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "dest_port", json_integer(dp));
+            json_object_set_new(js, "dest_port", json_integer(addr.dp));
             break;
     }
 
-    json_object_set_new(js, "proto", json_string(proto));
+    json_object_set_new(js, "proto", json_string(addr.proto));
 }
 
-static void CreateJSONCommunityFlowIdv4(json_t *js, const Flow *f,
-        const uint16_t seed)
+void JsonBuilderFiveTuple(const Packet *p, const JsonAddrInfo *addr,
+        JsonBuilder *jb)
+{
+    JsonBuilderSetString(jb, "src_ip", addr->src_ip);
+    switch(p->proto) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonBuilderSetUint(jb, "src_port", addr->sp);
+            break;
+    }
+    JsonBuilderSetString(jb, "dest_ip", addr->dst_ip);
+    switch(p->proto) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonBuilderSetUint(jb, "dest_port", addr->dp);
+            break;
+    }
+    JsonBuilderSetString(jb, "proto", addr->proto);
+}
+
+/** \brief format the community id "1:<base64 of sha1 of tuple>" into buf */
+static bool CommunityFlowIdEncode(const uint8_t *tuple, size_t tuple_len,
+        unsigned char *buf, size_t size)
+{
+    uint8_t hash[20];
+    if (size < 3 || ComputeSHA1(tuple, tuple_len, hash, sizeof(hash)) != 1)
+        return false;
+
+    buf[0] = '1';
+    buf[1] = ':';
+    unsigned long out_len = size - 2;
+    return (Base64Encode(hash, sizeof(hash), buf + 2, &out_len) == SC_BASE64_OK);
+}
+
+static bool CreateCommunityFlowIdv4(const Flow *f, const uint16_t seed,
+        unsigned char *buf, size_t size)
 {
     struct {
         uint16_t seed;
@@ -617,14 +728,7 @@ static void CreateJSONCommunityFlowIdv4(json_t *js, const Flow *f,
     ipv4.proto = f->proto;
     ipv4.pad0 = 0;
 
-    uint8_t hash[20];
-    if (ComputeSHA1((const uint8_t *)&ipv4, sizeof(ipv4), hash, sizeof(hash)) == 1) {
-        unsigned char base64buf[64] = "1:";
-        unsigned long out_len = sizeof(base64buf) - 2;
-        if (Base64Encode(hash, sizeof(hash), base64buf+2, &out_len) == SC_BASE64_OK) {
-            json_object_set_new(js, "community_id", json_string((const char *)base64buf));
-        }
-    }
+    return CommunityFlowIdEncode((const uint8_t *)&ipv4, sizeof(ipv4), buf, size);
 }
 
 static inline bool FlowHashRawAddressIPv6LtU32(const uint32_t *a, const uint32_t *b)
@@ -639,8 +743,8 @@ static inline bool FlowHashRawAddressIPv6LtU32(const uint32_t *a, const uint32_t
     return false;
 }
 
-static void CreateJSONCommunityFlowIdv6(json_t *js, const Flow *f,
-        const uint16_t seed)
+static bool CreateCommunityFlowIdv6(const Flow *f, const uint16_t seed,
+        unsigned char *buf, size_t size)
 {
     struct {
         uint16_t seed;
@@ -678,22 +782,25 @@ static void CreateJSONCommunityFlowIdv6(json_t *js, const Flow *f,
     ipv6.proto = f->proto;
     ipv6.pad0 = 0;
 
-    uint8_t hash[20];
-    if (ComputeSHA1((const uint8_t *)&ipv6, sizeof(ipv6), hash, sizeof(hash)) == 1) {
-        unsigned char base64buf[64] = "1:";
-        unsigned long out_len = sizeof(base64buf) - 2;
-        if (Base64Encode(hash, sizeof(hash), base64buf+2, &out_len) == SC_BASE64_OK) {
-            json_object_set_new(js, "community_id", json_string((const char *)base64buf));
-        }
-    }
+    return CommunityFlowIdEncode((const uint8_t *)&ipv6, sizeof(ipv6), buf, size);
 }
 
-static void CreateJSONCommunityFlowId(json_t *js, const Flow *f, const uint16_t seed)
+static bool CreateCommunityFlowId(const Flow *f, const uint16_t seed,
+        unsigned char *buf, size_t size)
 {
     if (f->flags & FLOW_IPV4)
-        return CreateJSONCommunityFlowIdv4(js, f, seed);
+        return CreateCommunityFlowIdv4(f, seed, buf, size);
     else if (f->flags & FLOW_IPV6)
-        return CreateJSONCommunityFlowIdv6(js, f, seed);
+        return CreateCommunityFlowIdv6(f, seed, buf, size);
+    return false;
+}
+
+static void CreateJSONCommunityFlowId(json_t *js, const Flow *f, const uint16_t seed)
+{
+    unsigned char buf[64];
+    if (CreateCommunityFlowId(f, seed, buf, sizeof(buf))) {
+        json_object_set_new(js, "community_id", json_string((const char *)buf));
+    }
 }
 
 void CreateJSONFlowId(json_t *js, const Flow *f)
@@ -707,6 +814,16 @@ void CreateJSONFlowId(json_t *js, const Flow *f)
     }
 }
 
+void JsonBuilderAddFlowId(JsonBuilder *jb, const Flow *f)
+{
+    if (f == NULL)
+        return;
+    JsonBuilderSetInt(jb, "flow_id", FlowGetId(f));
+    if (f->parent_id) {
+        JsonBuilderSetInt(jb, "parent_id", f->parent_id);
+    }
+}
+
 json_t *CreateJSONHeader(const Packet *p, enum OutputJsonLogDirection dir,
                          const char *event_type)
 {
@@ -780,6 +897,66 @@ json_t *CreateJSONHeader(const Packet *p, enum OutputJsonLogDirection dir,
     return js;
 }
 
+/**
+ * \brief CreateJSONHeader for the builder
+ *
+ * \param addr tuple to log, NULL for none. Callers can change it, e.g.
+ *             for the XFF overwrite mode.
+ */
+void CreateEveHeader(JsonBuilder *jb, const Packet *p, const char *event_type,
+        const JsonAddrInfo *addr)
+{
+    char timebuf[64];
+
+    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
+    JsonBuilderSetString(jb, "timestamp", timebuf);
+
+    JsonBuilderAddFlowId(jb, (const Flow *)p->flow);
+
+    if (sensor_id >= 0)
+        JsonBuilderSetInt(jb, "sensor_id", sensor_id);
+
+    if (p->livedev) {
+        JsonBuilderSetString(jb, "in_iface", p->livedev->dev);
+    }
+
+    if (p->pcap_cnt != 0) {
+        JsonBuilderSetUint(jb, "pcap_cnt", p->pcap_cnt);
+    }
+
+    if (event_type) {
+        JsonBuilderSetString(jb, "event_type", event_type);
+    }
+
+    if (p->vlan_idx > 0) {
+        JsonBuilderOpenArray(jb, "vlan");
+        JsonBuilderSetUint(jb, NULL, p->vlan_id[0]);
+        if (p->vlan_idx > 1) {
+            JsonBuilderSetUint(jb, NULL, p->vlan_id[1]);
+        }
+        JsonBuilderClose(jb);
+    }
+
+    if (addr != NULL) {
+        JsonBuilderFiveTuple(p, addr, jb);
+    }
+
+    switch (p->proto) {
+        case IPPROTO_ICMP:
+            if (p->icmpv4h) {
+                JsonBuilderSetUint(jb, "icmp_type", p->icmpv4h->type);
+                JsonBuilderSetUint(jb, "icmp_code", p->icmpv4h->code);
+            }
+            break;
+        case IPPROTO_ICMPV6:
+            if (p->icmpv6h) {
+                JsonBuilderSetUint(jb, "icmp_type", p->icmpv6h->type);
+                JsonBuilderSetUint(jb, "icmp_code", p->icmpv6h->code);
+            }
+            break;
+    }
+}
+
 json_t *CreateJSONHeaderWithTxId(const Packet *p, enum OutputJsonLogDirection dir,
                                  const char *event_type, uint64_t tx_id)
 {
@@ -808,6 +985,14 @@ int OutputJSONMemBufferCallback(const char *str, size_t size, void *data)
 
 int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer)
 {
+    if (file_ctx->cbor) {
+        JsonBuilder jb;
+
+        JsonBuilderInit(&jb, file_ctx, buffer);
+        JsonBuilderSetJsonMembers(&jb, js);
+        return OutputJsonBuilderBuffer(&jb, file_ctx);
+    }
+
     if (file_ctx->sensor_name) {
         json_object_set_new(js, "host",
                             json_string(file_ctx->sensor_name));
@@ -938,10 +1123,43 @@ OutputInitResult OutputJsonInitCtx(ConfNode *conf)
             json_ctx->file_ctx->prefix_len = strlen(prefix);
         }
 
+        int threaded = 0;
+        (void)ConfGetChildValueBool(conf, "threaded", &threaded);
+
+        const char *format = ConfNodeLookupChildValue(conf, "format");
+        if (format != NULL && strcmp(format, "cbor") == 0) {
+            if (json_ctx->json_out != LOGFILE_TYPE_FILE &&
+                json_ctx->json_out != LOGFILE_TYPE_UNIX_DGRAM &&
+                json_ctx->json_out != LOGFILE_TYPE_UNIX_STREAM) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "eve-log.format cbor is "
+                        "only supported for filetype regular, unix_dgram "
+                        "and unix_stream");
+                exit(EXIT_FAILURE);
+            }
+            if (json_ctx->file_ctx->prefix != NULL) {
+                SCLogWarning(SC_ERR_INVALID_ARGUMENT, "eve-log.prefix is "
+                        "ignored with format cbor");
+            }
+            SCLogConfig("Writing eve-log records as CBOR");
+            json_ctx->file_ctx->cbor = true;
+        } else if (format != NULL && strcmp(format, "json") != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT,
+                    "Invalid eve-log.format: %s", format);
+            exit(EXIT_FAILURE);
+        }
+
         if (json_ctx->json_out == LOGFILE_TYPE_FILE ||
             json_ctx->json_out == LOGFILE_TYPE_UNIX_DGRAM ||
             json_ctx->json_out == LOGFILE_TYPE_UNIX_STREAM)
         {
+            if (threaded) {
+                if (json_ctx->json_out == LOGFILE_TYPE_FILE) {
+                    json_ctx->file_ctx->threaded = true;
+                } else {
+                    SCLogWarning(SC_ERR_INVALID_ARGUMENT, "eve-log.threaded "
+                            "is only supported for regular files, ignoring");
+                }
+            }
             if (SCConfLogOpenGeneric(conf, json_ctx->file_ctx, DEFAULT_LOG_FILENAME, 1) < 0) {
                 LogFileFreeCtx(json_ctx->file_ctx);
                 SCFree(json_ctx);
@@ -30,6 +30,7 @@
 #include "output.h"
 
 #include "app-layer-htp-xff.h"
+#include "output-json-builder.h"
 
 void OutputJsonRegister(void);
 
@@ -43,6 +44,15 @@ enum OutputJsonLogDirection {
 /* Suggested output buffer size */
 #define JSON_OUTPUT_BUFFER_SIZE 65535
 
+/* five tuple of a packet as logged */
+typedef struct JsonAddrInfo_ {
+    char src_ip[46];
+    char dst_ip[46];
+    Port sp;
+    Port dp;
+    char proto[16];
+} JsonAddrInfo;
+
 /* helper struct for OutputJSONMemBufferCallback */
 typedef struct OutputJSONMemBufferWrapper_ {
     MemBuffer **buffer; /**< buffer to use & expand as needed */
@@ -53,8 +63,17 @@ int OutputJSONMemBufferCallback(const char *str, size_t size, void *data);
 
 void CreateJSONFlowId(json_t *js, const Flow *f);
 void JsonTcpFlags(uint8_t flags, json_t *js);
+void JsonBuilderAddFlowId(JsonBuilder *jb, const Flow *f);
+void JsonBuilderTcpFlags(uint8_t flags, JsonBuilder *jb);
 void JsonPacket(const Packet *p, json_t *js, unsigned long max_length);
 void JsonFiveTuple(const Packet *, enum OutputJsonLogDirection, json_t *);
+bool JsonAddrInfoInit(const Packet *p, enum OutputJsonLogDirection dir,
+        JsonAddrInfo *addr);
+void JsonBuilderFiveTuple(const Packet *p, const JsonAddrInfo *addr,
+        JsonBuilder *jb);
+void JsonBuilderPacket(const Packet *p, JsonBuilder *jb, unsigned long max_length);
+void CreateEveHeader(JsonBuilder *jb, const Packet *p, const char *event_type,
+        const JsonAddrInfo *addr);
 json_t *CreateJSONHeader(const Packet *p,
         enum OutputJsonLogDirection dir, const char *event_type);
 json_t *CreateJSONHeaderWithTxId(const Packet *p,
@@ -94,5 +113,7 @@ void SCJsonDecref(json_t *js);
 
 void JsonAddCommonOptions(const OutputJsonCommonSettings *cfg,
         const Packet *p, const Flow *f, json_t *js);
+void JsonBuilderAddCommonOptions(const OutputJsonCommonSettings *cfg,
+        const Packet *p, const Flow *f, JsonBuilder *jb);
 
 #endif /* __OUTPUT_JSON_H__ */
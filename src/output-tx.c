@@ -31,6 +31,9 @@
 #include "app-layer-parser.h"
 #include "util-profiling.h"
 #include "util-validate.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+#include "stream-tcp.h"
 
 typedef struct OutputLoggerThreadStore_ {
     void *thread_data;
@@ -41,6 +44,9 @@ typedef struct OutputLoggerThreadStore_ {
  *  data for the packet loggers. */
 typedef struct OutputLoggerThreadData_ {
     OutputLoggerThreadStore *store;
+    /* txs looked at and txs passed to at least one logger */
+    uint16_t counter_tx_visited;
+    uint16_t counter_tx_logged;
 } OutputLoggerThreadData;
 
 /* logger instance, a module + a output ctx,
@@ -64,6 +70,12 @@ typedef struct OutputTxLogger_ {
 
 static OutputTxLogger *list = NULL;
 
+/* the log ready queue of a parser can only be used if all its loggers
+ * log completed txs: no wild card loggers and no loggers that log
+ * at an earlier progress or on a condition */
+static bool tx_logger_wildcard = false;
+static bool tx_logger_partial[ALPROTO_MAX];
+
 int OutputRegisterTxLogger(LoggerId id, const char *name, AppProto alproto,
                            TxLogger LogFunc,
                            OutputCtx *output_ctx, int tc_log_progress,
@@ -113,6 +125,16 @@ int OutputRegisterTxLogger(LoggerId id, const char *name, AppProto alproto,
         op->ts_log_progress = ts_log_progress;
     }
 
+    if (alproto == ALPROTO_UNKNOWN) {
+        tx_logger_wildcard = true;
+    } else if (LogCondition != NULL ||
+            op->tc_log_progress < AppLayerParserGetStateProgressCompletionStatus(
+                alproto, STREAM_TOCLIENT) ||
+            op->ts_log_progress < AppLayerParserGetStateProgressCompletionStatus(
+                alproto, STREAM_TOSERVER)) {
+        tx_logger_partial[alproto] = true;
+    }
+
     if (list == NULL) {
         op->id = 1;
         list = op;
@@ -132,6 +154,165 @@ int OutputRegisterTxLogger(LoggerId id, const char *name, AppProto alproto,
     return 0;
 }
 
+/** \brief run the loggers on a tx
+ *
+ *  \param logged set if at least one logger was invoked
+ *
+ *  \retval tx_logged the loggers that are done with the tx
+ */
+static LoggerId OutputTxLogTx(ThreadVars *tv,
+        OutputLoggerThreadData *op_thread_data, Packet *p, Flow *f,
+        void *alstate, void *tx, const uint64_t tx_id,
+        const LoggerId logger_expectation, const uint8_t ts_disrupt_flags,
+        const uint8_t tc_disrupt_flags, bool *logged)
+{
+    const AppProto alproto = f->alproto;
+    LoggerId tx_logged = AppLayerParserGetTxLogged(f, alstate, tx);
+    const LoggerId tx_logged_old = tx_logged;
+    SCLogDebug("logger: expect %08x, have %08x", logger_expectation, tx_logged);
+    if (tx_logged == logger_expectation) {
+        /* tx already fully logged */
+        return tx_logged;
+    }
+
+    int tx_progress_ts = AppLayerParserGetStateProgress(p->proto, alproto,
+            tx, ts_disrupt_flags);
+    int tx_progress_tc = AppLayerParserGetStateProgress(p->proto, alproto,
+            tx, tc_disrupt_flags);
+    SCLogDebug("tx_progress_ts %d tx_progress_tc %d",
+            tx_progress_ts, tx_progress_tc);
+
+    const OutputTxLogger *logger = list;
+    const OutputLoggerThreadStore *store = op_thread_data->store;
+
+    DEBUG_VALIDATE_BUG_ON(logger == NULL && store != NULL);
+    DEBUG_VALIDATE_BUG_ON(logger != NULL && store == NULL);
+    DEBUG_VALIDATE_BUG_ON(logger == NULL && store == NULL);
+
+    while (logger && store) {
+        DEBUG_VALIDATE_BUG_ON(logger->LogFunc == NULL);
+
+        SCLogDebug("logger %p, Alproto %d LogCondition %p, ts_log_progress %d "
+                "tc_log_progress %d", logger, logger->alproto, logger->LogCondition,
+                logger->ts_log_progress, logger->tc_log_progress);
+        /* always invoke "wild card" tx loggers */
+        if (logger->alproto == ALPROTO_UNKNOWN ||
+            (logger->alproto == alproto &&
+             (tx_logged_old & (1<<logger->logger_id)) == 0)) {
+
+            SCLogDebug("alproto match %d, logging tx_id %"PRIu64, logger->alproto, tx_id);
+
+            if (!(AppLayerParserStateIssetFlag(f->alparser,
+                                               APP_LAYER_PARSER_EOF))) {
+                if (logger->LogCondition) {
+                    int r = logger->LogCondition(tv, p, alstate, tx, tx_id);
+                    if (r == FALSE) {
+                        SCLogDebug("conditions not met, not logging");
+                        goto next_logger;
+                    }
+                } else {
+                    if (tx_progress_tc < logger->tc_log_progress) {
+                        SCLogDebug("progress not far enough, not logging");
+                        goto next_logger;
+                    }
+
+                    if (tx_progress_ts < logger->ts_log_progress) {
+                        SCLogDebug("progress not far enough, not logging");
+                        goto next_logger;
+                    }
+                }
+            }
+
+            SCLogDebug("Logging tx_id %"PRIu64" to logger %d", tx_id, logger->logger_id);
+            PACKET_PROFILING_LOGGER_START(p, logger->logger_id);
+            logger->LogFunc(tv, store->thread_data, p, f, alstate, tx, tx_id);
+            PACKET_PROFILING_LOGGER_END(p, logger->logger_id);
+            *logged = true;
+
+            if (logger->alproto != ALPROTO_UNKNOWN) {
+                tx_logged |= (1<<logger->logger_id);
+            }
+        }
+
+next_logger:
+        logger = logger->next;
+        store = store->next;
+
+        DEBUG_VALIDATE_BUG_ON(logger == NULL && store != NULL);
+        DEBUG_VALIDATE_BUG_ON(logger != NULL && store == NULL);
+    }
+
+    if (tx_logged != tx_logged_old) {
+        SCLogDebug("logger: storing %08x (was %08x)",
+            tx_logged, tx_logged_old);
+        AppLayerParserSetTxLogged(p->proto, alproto, alstate, tx,
+                tx_logged);
+    }
+    return tx_logged;
+}
+
+/** \brief log the txs the parser queued as ready to log
+ *
+ *  Only the queued txs are passed to the loggers. Afterwards the log id
+ *  is moved past the txs that are now fully logged.
+ */
+static void OutputTxLogReady(ThreadVars *tv,
+        OutputLoggerThreadData *op_thread_data, Packet *p, Flow *f,
+        void *alstate, const uint64_t *ids, int cnt,
+        const LoggerId logger_expectation)
+{
+    const uint8_t ipproto = f->proto;
+    const AppProto alproto = f->alproto;
+    uint64_t log_id = AppLayerParserGetTransactionLogId(f->alparser);
+    uint64_t visited = 0;
+    uint64_t logged_cnt = 0;
+
+    for (int i = 0; i < cnt; i++) {
+        const uint64_t tx_id = ids[i];
+        if (tx_id < log_id)
+            continue;
+        void *tx = AppLayerParserGetTx(ipproto, alproto, alstate, tx_id);
+        if (tx == NULL)
+            continue;
+        bool logged = false;
+        visited++;
+        OutputTxLogTx(tv, op_thread_data, p, f, alstate, tx, tx_id,
+                logger_expectation, STREAM_TOSERVER, STREAM_TOCLIENT, &logged);
+        if (logged)
+            logged_cnt++;
+    }
+
+    /* move the log id past the fully logged txs, each tx is passed
+     * only once here */
+    const uint64_t total_txs = AppLayerParserGetTxCnt(f, alstate);
+    uint64_t tx_id = log_id;
+    AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(ipproto, alproto);
+    AppLayerGetTxIterState state;
+    memset(&state, 0, sizeof(state));
+
+    while (1) {
+        AppLayerGetTxIterTuple ires = IterFunc(ipproto, alproto, alstate, tx_id, total_txs, &state);
+        if (ires.tx_ptr == NULL) {
+            tx_id = total_txs;
+            break;
+        }
+        tx_id = ires.tx_id;
+        visited++;
+        if (AppLayerParserGetTxLogged(f, alstate, ires.tx_ptr) != logger_expectation)
+            break;
+        tx_id++;
+        if (!ires.has_next)
+            break;
+    }
+    if (tx_id > log_id) {
+        SCLogDebug("updating log tx_id %"PRIu64, tx_id);
+        AppLayerParserSetTransactionLogId(f->alparser, tx_id);
+    }
+
+    StatsAddUI64(tv, op_thread_data->counter_tx_visited, visited);
+    StatsAddUI64(tv, op_thread_data->counter_tx_logged, logged_cnt);
+}
+
 static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data)
 {
     DEBUG_VALIDATE_BUG_ON(thread_data == NULL);
@@ -162,11 +343,37 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data)
 
     const uint8_t ts_disrupt_flags = FlowGetDisruptionFlags(f, STREAM_TOSERVER);
     const uint8_t tc_disrupt_flags = FlowGetDisruptionFlags(f, STREAM_TOCLIENT);
+
+    /* Use the parser's queue of txs that became ready to log, unless
+     * txs can be logged without having been queued: at EOF or after a
+     * gap, when all txs are considered complete, or when a logger wants
+     * to see txs before completion. */
+    if (AppLayerParserProtocolHasLogReadyQueue(ipproto, alproto) &&
+            !tx_logger_wildcard && !tx_logger_partial[alproto] &&
+            !((ts_disrupt_flags | tc_disrupt_flags) & (STREAM_DEPTH|STREAM_GAP)) &&
+            !(AppLayerParserStateIssetFlag(f->alparser, APP_LAYER_PARSER_EOF))) {
+        const uint64_t *ids = NULL;
+        int cnt = AppLayerParserGetTxLogReady(f->alparser, &ids);
+        if (cnt >= 0) {
+            if (cnt > 0) {
+                OutputTxLogReady(tv, op_thread_data, p, f, alstate, ids, cnt,
+                        logger_expectation);
+            }
+            AppLayerParserResetTxLogReady(f->alparser);
+            goto end;
+        }
+    }
+    if (f->alparser != NULL) {
+        AppLayerParserResetTxLogReady(f->alparser);
+    }
+
     const uint64_t total_txs = AppLayerParserGetTxCnt(f, alstate);
     uint64_t tx_id = AppLayerParserGetTransactionLogId(f->alparser);
     uint64_t max_id = tx_id;
     int logged = 0;
     int gap = 0;
+    uint64_t visited = 0;
+    uint64_t logged_cnt = 0;
 
     AppLayerGetTxIteratorFunc IterFunc = AppLayerGetTxIterator(ipproto, alproto);
     AppLayerGetTxIterState state;
@@ -178,87 +385,14 @@ static TmEcode OutputTxLog(ThreadVars *tv, Packet *p, void *thread_data)
             break;
         void * const tx = ires.tx_ptr;
         tx_id = ires.tx_id;
+        visited++;
 
-        LoggerId tx_logged = AppLayerParserGetTxLogged(f, alstate, tx);
-        const LoggerId tx_logged_old = tx_logged;
-        SCLogDebug("logger: expect %08x, have %08x", logger_expectation, tx_logged);
-        if (tx_logged == logger_expectation) {
-            /* tx already fully logged */
-            goto next_tx;
-        }
-
-        int tx_progress_ts = AppLayerParserGetStateProgress(p->proto, alproto,
-                tx, ts_disrupt_flags);
-        int tx_progress_tc = AppLayerParserGetStateProgress(p->proto, alproto,
-                tx, tc_disrupt_flags);
-        SCLogDebug("tx_progress_ts %d tx_progress_tc %d",
-                tx_progress_ts, tx_progress_tc);
-
-        const OutputTxLogger *logger = list;
-        const OutputLoggerThreadStore *store = op_thread_data->store;
-
-        DEBUG_VALIDATE_BUG_ON(logger == NULL && store != NULL);
-        DEBUG_VALIDATE_BUG_ON(logger != NULL && store == NULL);
-        DEBUG_VALIDATE_BUG_ON(logger == NULL && store == NULL);
-
-        while (logger && store) {
-            DEBUG_VALIDATE_BUG_ON(logger->LogFunc == NULL);
-
-            SCLogDebug("logger %p, Alproto %d LogCondition %p, ts_log_progress %d "
-                    "tc_log_progress %d", logger, logger->alproto, logger->LogCondition,
-                    logger->ts_log_progress, logger->tc_log_progress);
-            /* always invoke "wild card" tx loggers */
-            if (logger->alproto == ALPROTO_UNKNOWN ||
-                (logger->alproto == alproto &&
-                 (tx_logged_old & (1<<logger->logger_id)) == 0)) {
-
-                SCLogDebug("alproto match %d, logging tx_id %"PRIu64, logger->alproto, tx_id);
-
-                if (!(AppLayerParserStateIssetFlag(f->alparser,
-                                                   APP_LAYER_PARSER_EOF))) {
-                    if (logger->LogCondition) {
-                        int r = logger->LogCondition(tv, p, alstate, tx, tx_id);
-                        if (r == FALSE) {
-                            SCLogDebug("conditions not met, not logging");
-                            goto next_logger;
-                        }
-                    } else {
-                        if (tx_progress_tc < logger->tc_log_progress) {
-                            SCLogDebug("progress not far enough, not logging");
-                            goto next_logger;
-                        }
-
-                        if (tx_progress_ts < logger->ts_log_progress) {
-                            SCLogDebug("progress not far enough, not logging");
-                            goto next_logger;
-                        }
-                    }
-                }
-
-                SCLogDebug("Logging tx_id %"PRIu64" to logger %d", tx_id, logger->logger_id);
-                PACKET_PROFILING_LOGGER_START(p, logger->logger_id);
-                logger->LogFunc(tv, store->thread_data, p, f, alstate, tx, tx_id);
-                PACKET_PROFILING_LOGGER_END(p, logger->logger_id);
-
-                if (logger->alproto != ALPROTO_UNKNOWN) {
-                    tx_logged |= (1<<logger->logger_id);
-                }
-            }
-
-next_logger:
-            logger = logger->next;
-            store = store->next;
-
-            DEBUG_VALIDATE_BUG_ON(logger == NULL && store != NULL);
-            DEBUG_VALIDATE_BUG_ON(logger != NULL && store == NULL);
-        }
-
-        if (tx_logged != tx_logged_old) {
-            SCLogDebug("logger: storing %08x (was %08x)",
-                tx_logged, tx_logged_old);
-            AppLayerParserSetTxLogged(p->proto, alproto, alstate, tx,
-                    tx_logged);
-        }
+        bool tx_logger_invoked = false;
+        LoggerId tx_logged = OutputTxLogTx(tv, op_thread_data, p, f, alstate,
+                tx, tx_id, logger_expectation, ts_disrupt_flags,
+                tc_disrupt_flags, &tx_logger_invoked);
+        if (tx_logger_invoked)
+            logged_cnt++;
 
         /* If all loggers logged set a flag and update the last tx_id
          * that was logged.
@@ -272,7 +406,7 @@ next_logger:
         } else {
             gap = 1;
         }
-next_tx:
+
         if (!ires.has_next)
             break;
         tx_id++;
@@ -285,6 +419,9 @@ next_tx:
         AppLayerParserSetTransactionLogId(f->alparser, max_id + 1);
     }
 
+    StatsAddUI64(tv, op_thread_data->counter_tx_visited, visited);
+    StatsAddUI64(tv, op_thread_data->counter_tx_logged, logged_cnt);
+
 end:
     return TM_ECODE_OK;
 }
@@ -299,6 +436,9 @@ static TmEcode OutputTxLogThreadInit(ThreadVars *tv, const void *initdata, void
         return TM_ECODE_FAILED;
     memset(td, 0x00, sizeof(*td));
 
+    td->counter_tx_visited = StatsRegisterCounter("output.tx.visited", tv);
+    td->counter_tx_logged = StatsRegisterCounter("output.tx.logged", tv);
+
     *data = (void *)td;
     SCLogDebug("OutputTxLogThreadInit happy (*data %p)", *data);
 
@@ -385,4 +525,139 @@ void OutputTxShutdown(void)
         logger = next_logger;
     }
     list = NULL;
+    tx_logger_wildcard = false;
+    memset(tx_logger_partial, 0, sizeof(tx_logger_partial));
+}
+
+#ifdef UNITTESTS
+static uint32_t output_tx_test_logged = 0;
+
+static int OutputTxTestLogger(ThreadVars *tv, void *thread_data,
+        const Packet *p, Flow *f, void *state, void *tx, uint64_t tx_id)
+{
+    output_tx_test_logged++;
+    return 0;
+}
+
+static TmEcode OutputTxTestThreadInit(ThreadVars *tv, const void *initdata,
+        void **data)
+{
+    *data = &output_tx_test_logged;
+    return TM_ECODE_OK;
+}
+
+static int OutputTxTestParse(AppLayerParserThreadCtx *alp_tctx, Flow *f,
+        uint8_t flags, const char *buf)
+{
+    return AppLayerParserParse(NULL, alp_tctx, f, ALPROTO_HTTP, flags,
+            (uint8_t *)buf, strlen(buf));
+}
+
+/** \test txs queued by the parser are logged once, after an overflow of
+ *        the queue the loggers fall back to the full walk */
+static int OutputTxTest01(void)
+{
+    const char *req = "GET / HTTP/1.1\r\nHost: a\r\n\r\n";
+    const char *resp = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    char reqs[256] = "", resps[256] = "";
+    for (int i = 0; i < APP_LAYER_LOG_READY_MAX + 1; i++) {
+        strlcat(reqs, req, sizeof(reqs));
+        strlcat(resps, resp, sizeof(resps));
+    }
+
+    /* run with just the test logger */
+    OutputTxLogger *saved_list = list;
+    const bool saved_wildcard = tx_logger_wildcard;
+    bool saved_partial[ALPROTO_MAX];
+    memcpy(saved_partial, tx_logger_partial, sizeof(saved_partial));
+    const LoggerId saved_bits =
+        AppLayerParserProtocolGetLoggerBits(IPPROTO_TCP, ALPROTO_HTTP);
+    list = NULL;
+    tx_logger_wildcard = false;
+    memset(tx_logger_partial, 0, sizeof(tx_logger_partial));
+    output_tx_test_logged = 0;
+
+    FAIL_IF(OutputRegisterTxLogger(LOGGER_JSON_HTTP, "test", ALPROTO_HTTP,
+                OutputTxTestLogger, NULL, -1, -1, NULL,
+                OutputTxTestThreadInit, NULL, NULL) != 0);
+    AppLayerParserRegisterLogger(IPPROTO_TCP, ALPROTO_HTTP);
+    AppLayerParserRegisterLoggerBits(IPPROTO_TCP, ALPROTO_HTTP,
+            BIT_U32(LOGGER_JSON_HTTP));
+
+    ThreadVars tv;
+    memset(&tv, 0, sizeof(tv));
+    tv.printable_name = (char *)"OutputTxTest";
+    void *data = NULL;
+    FAIL_IF(OutputTxLogThreadInit(&tv, NULL, &data) != TM_ECODE_OK);
+    OutputLoggerThreadData *td = data;
+    StatsSetupPrivate(&tv);
+
+    TcpSession ssn;
+    memset(&ssn, 0, sizeof(ssn));
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+    FAIL_IF_NULL(alp_tctx);
+    Flow *f = UTHBuildFlow(AF_INET, "1.2.3.4", "1.2.3.5", 1024, 80);
+    FAIL_IF_NULL(f);
+    f->protoctx = &ssn;
+    f->proto = IPPROTO_TCP;
+    f->alproto = ALPROTO_HTTP;
+    Packet *p = UTHBuildPacket(NULL, 0, IPPROTO_TCP);
+    FAIL_IF_NULL(p);
+    p->flow = f;
+    StreamTcpInitConfig(TRUE);
+
+    /* request done, the logger waits for the response. From the queue
+     * tx 0 is visited, then again to move the log id. */
+    FAIL_IF(OutputTxTestParse(alp_tctx, f, STREAM_TOSERVER|STREAM_START, req) != 0);
+    OutputTxLog(&tv, p, data);
+    FAIL_IF_NOT(output_tx_test_logged == 0);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, td->counter_tx_visited) == 2);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, td->counter_tx_logged) == 0);
+
+    FAIL_IF(OutputTxTestParse(alp_tctx, f, STREAM_TOCLIENT|STREAM_START, resp) != 0);
+    OutputTxLog(&tv, p, data);
+    FAIL_IF_NOT(output_tx_test_logged == 1);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, td->counter_tx_visited) == 4);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, td->counter_tx_logged) == 1);
+    FAIL_IF_NOT(AppLayerParserGetTransactionLogId(f->alparser) == 1);
+
+    /* nothing queued: nothing visited */
+    OutputTxLog(&tv, p, data);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, td->counter_tx_visited) == 4);
+
+    /* more txs completed than the queue holds: the full walk visits
+     * each of them once */
+    FAIL_IF(OutputTxTestParse(alp_tctx, f, STREAM_TOSERVER, reqs) != 0);
+    FAIL_IF(OutputTxTestParse(alp_tctx, f, STREAM_TOCLIENT, resps) != 0);
+    const uint64_t *ids = NULL;
+    FAIL_IF_NOT(AppLayerParserGetTxLogReady(f->alparser, &ids) == -1);
+    OutputTxLog(&tv, p, data);
+    FAIL_IF_NOT(output_tx_test_logged == 1 + APP_LAYER_LOG_READY_MAX + 1);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, td->counter_tx_visited) ==
+            4 + APP_LAYER_LOG_READY_MAX + 1);
+    FAIL_IF_NOT(StatsGetLocalCounterValue(&tv, td->counter_tx_logged) ==
+            1 + APP_LAYER_LOG_READY_MAX + 1);
+    FAIL_IF_NOT(AppLayerParserGetTxLogReady(f->alparser, &ids) == 0);
+
+    UTHFreePacket(p);
+    AppLayerParserThreadCtxFree(alp_tctx);
+    StreamTcpFreeConfig(TRUE);
+    UTHFreeFlow(f);
+    OutputTxLogThreadDeinit(&tv, data);
+    StatsThreadCleanup(&tv);
+
+    OutputTxShutdown();
+    list = saved_list;
+    tx_logger_wildcard = saved_wildcard;
+    memcpy(tx_logger_partial, saved_partial, sizeof(saved_partial));
+    AppLayerParserRegisterLoggerBits(IPPROTO_TCP, ALPROTO_HTTP, saved_bits);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void OutputTxLogRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("OutputTxTest01", OutputTxTest01);
+#endif
 }
@@ -47,4 +47,6 @@ void OutputTxLoggerRegister (void);
 
 void OutputTxShutdown(void);
 
+void OutputTxLogRegisterTests(void);
+
 #endif /* __OUTPUT_PACKET_H__ */
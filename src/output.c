@@ -83,6 +83,7 @@
 #include "output-json-dnp3.h"
 #include "output-json-metadata.h"
 #include "output-filestore.h"
+#include "source-pcap-file.h"
 
 typedef struct RootLogger_ {
     ThreadInitFunc ThreadInit;
@@ -919,6 +920,10 @@ TmEcode OutputLoggerLog(ThreadVars *tv, Packet *p, void *thread_data)
     LoggerThreadStore *thread_store = (LoggerThreadStore *)thread_data;
     RootLogger *logger = TAILQ_FIRST(&RootLoggers);
     LoggerThreadStoreNode *thread_store_node = TAILQ_FIRST(thread_store);
+
+    /* for the pcap_filename of the json records */
+    PcapFileSetLogPacket(p);
+
     while (logger && thread_store_node) {
         if (logger->LogFunc != NULL) {
             logger->LogFunc(tv, p, thread_store_node->thread_data);
@@ -46,6 +46,7 @@
 #include "alert-debuglog.h"
 
 #include "flow-bypass.h"
+#include "flow-bypass-table.h"
 
 #include "util-debug.h"
 #include "util-time.h"
@@ -470,19 +471,6 @@ static void *ParseAFPConfig(const char *iface)
             SCLogConfig("Using bypass kernel functionality for AF_PACKET (iface %s)",
                     aconf->iface);
             aconf->flags |= AFP_XDPBYPASS;
-            /* if maps are pinned we need to read them at start */
-            if (aconf->ebpf_t_config.flags & EBPF_PINNED_MAPS) {
-                RunModeEnablesBypassManager();
-                struct ebpf_timeout_config *ebt = SCCalloc(1, sizeof(struct ebpf_timeout_config));
-                if (ebt == NULL) {
-                    SCLogError(SC_ERR_MEM_ALLOC, "Flow bypass alloc error");
-                } else {
-                    memcpy(ebt, &(aconf->ebpf_t_config), sizeof(struct ebpf_timeout_config));
-                    BypassedFlowManagerRegisterCheckFunc(NULL,
-                            EBPFCheckBypassedFlowCreate,
-                            (void *)ebt);
-                }
-            }
             BypassedFlowManagerRegisterUpdateFunc(EBPFUpdateFlow, NULL);
         }
 #else
@@ -564,6 +552,42 @@ static void *ParseAFPConfig(const char *iface)
 #endif
     }
 
+#ifdef HAVE_PACKET_EBPF
+    /* maintenance of the bypassed flow tables, and if maps are pinned
+     * creation of their flows at start */
+    if (aconf->flags & (AFP_BYPASS|AFP_XDPBYPASS)) {
+        EBPFRegisterBypassedFlowScan(aconf->iface, &aconf->ebpf_t_config);
+    }
+#endif
+
+    /* userspace bypass for setups without kernel bypass */
+    boolval = false;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default,
+                                           "bypass-table", (int *)&boolval);
+    if (boolval) {
+        const char *active_runmode = RunmodeGetActive();
+        if (aconf->flags & (AFP_BYPASS|AFP_XDPBYPASS)) {
+            SCLogConfig("%s: eBPF bypass in use, bypass-table disabled", iface);
+        } else if (aconf->copy_mode != AFP_COPY_MODE_NONE) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "%s: bypass-table can't be "
+                    "used with copy-mode, disabling it", iface);
+        } else if (active_runmode == NULL || (strcmp("workers", active_runmode) != 0 &&
+                    strcmp("single", active_runmode) != 0)) {
+            /* the table is owned by the capture thread, so the flows
+             * have to be handled in the same thread */
+            SCLogWarning(SC_ERR_RUNMODE, "%s: bypass-table is only "
+                    "implemented for 'workers' runmode, disabling it", iface);
+        } else {
+            aconf->bypass_table_size = FLOW_BYPASS_TABLE_DEFAULT_SIZE;
+            if ((ConfGetChildValueIntWithDefault(if_root, if_default,
+                            "bypass-table-size", &value)) == 1 && value > 0) {
+                aconf->bypass_table_size = value;
+            }
+            SCLogConfig("%s: using a bypass table of %d flows per thread",
+                    iface, aconf->bypass_table_size);
+        }
+    }
+
     if ((ConfGetChildValueIntWithDefault(if_root, if_default, "buffer-size", &value)) == 1) {
         aconf->buffer_size = value;
     } else {
@@ -608,6 +632,22 @@ static void *ParseAFPConfig(const char *iface)
         }
     }
 
+    boolval = false;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default,
+                                           "checksum-trust-nic", (int *)&boolval);
+    if (boolval) {
+        if (aconf->checksum_mode == CHECKSUM_VALIDATION_KERNEL ||
+                aconf->checksum_mode == CHECKSUM_VALIDATION_ENABLE) {
+            SCLogConfig("%s: trusting TCP/UDP checksums verified by the NIC",
+                    aconf->iface);
+            aconf->flags |= AFP_CHECKSUM_TRUST_NIC;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "%s: checksum-trust-nic needs "
+                    "checksum-checks set to 'kernel' or 'yes', ignoring it",
+                    aconf->iface);
+        }
+    }
+
 finalize:
 
     /* if the number of threads is not 1, we need to first check if fanout
@@ -0,0 +1,586 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup afxdp
+ *
+ * @{
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket runmode
+ *
+ */
+
+#include "suricata-common.h"
+#include "config.h"
+#include "tm-threads.h"
+#include "conf.h"
+#include "runmodes.h"
+#include "runmode-af-xdp.h"
+#include "output.h"
+
+#include "flow-bypass.h"
+
+#include "util-debug.h"
+#include "util-time.h"
+#include "util-cpu.h"
+#include "util-affinity.h"
+#include "util-device.h"
+#include "util-runmodes.h"
+#include "util-ioctl.h"
+#include "util-ebpf.h"
+
+#include "source-af-xdp.h"
+
+#ifdef HAVE_AF_XDP
+#include <sys/resource.h>
+#include <linux/if_xdp.h>
+#endif
+
+const char *RunModeAFXDPGetDefaultMode(void)
+{
+    return "workers";
+}
+
+void RunModeIdsAFXDPRegister(void)
+{
+    RunModeRegisterNewRunMode(RUNMODE_AFXDP_DEV, "single",
+                              "Single threaded af-xdp mode",
+                              RunModeIdsAFXDPSingle);
+    RunModeRegisterNewRunMode(RUNMODE_AFXDP_DEV, "workers",
+                              "Workers af-xdp mode, each thread does all"
+                              " tasks from acquisition to logging. Packets"
+                              " are read in place from the UMEM",
+                              RunModeIdsAFXDPWorkers);
+    RunModeRegisterNewRunMode(RUNMODE_AFXDP_DEV, "autofp",
+                              "Multi socket AF_XDP mode.  Packets from "
+                              "each flow are assigned to a single detect "
+                              "thread.",
+                              RunModeIdsAFXDPAutoFp);
+    return;
+}
+
+#ifdef HAVE_AF_XDP
+
+static void AFXDPDerefConfig(void *conf)
+{
+    AFXDPIfaceConfig *pfp = (AFXDPIfaceConfig *)conf;
+    /* Pcap config is used only once but cost of this low. */
+    if (SC_ATOMIC_SUB(pfp->ref, 1) == 0) {
+        SCFree(pfp);
+    }
+}
+
+/**
+ * \brief extract information from config file
+ *
+ * The returned structure will be freed by the thread init function.
+ * This is thus necessary to or copy the structure before giving it
+ * to thread or to reparse the file for each thread (and thus have
+ * new structure.
+ *
+ * \return a AFXDPIfaceConfig corresponding to the interface name
+ */
+static void *ParseAFXDPConfig(const char *iface)
+{
+    const char *threadsstr = NULL;
+    ConfNode *if_root;
+    ConfNode *if_default = NULL;
+    ConfNode *af_xdp_node = NULL;
+    const char *tmpctype;
+    const char *copymodestr;
+    const char *bpf_filter = NULL;
+    const char *out_iface = NULL;
+    intmax_t value;
+    int boolval;
+    const char *ebpf_file = NULL;
+
+    if (iface == NULL) {
+        return NULL;
+    }
+
+    AFXDPIfaceConfig *aconf = SCCalloc(1, sizeof(*aconf));
+    if (unlikely(aconf == NULL)) {
+        return NULL;
+    }
+
+    strlcpy(aconf->iface, iface, sizeof(aconf->iface));
+    aconf->threads = 0;
+    SC_ATOMIC_INIT(aconf->ref);
+    (void) SC_ATOMIC_ADD(aconf->ref, 1);
+    SC_ATOMIC_INIT(aconf->queue_next);
+    aconf->ring_size = AFXDP_RING_SIZE_DEFAULT;
+    aconf->frame_size = AFXDP_FRAME_SIZE_DEFAULT;
+    aconf->batch_size = AFXDP_BATCH_SIZE_DEFAULT;
+    aconf->promisc = 1;
+    aconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+    aconf->DerefFunc = AFXDPDerefConfig;
+    aconf->bpf_filter = NULL;
+    aconf->xdp_filter_file = NULL;
+    aconf->xdp_filter_fd = -1;
+    aconf->out_iface = NULL;
+    aconf->copy_mode = AFXDP_COPY_MODE_NONE;
+#ifdef HAVE_PACKET_EBPF
+    aconf->ebpf_t_config.cpus_count = UtilCpuGetNumProcessorsConfigured();
+#endif
+
+    if (ConfGet("bpf-filter", &bpf_filter) == 1) {
+        if (strlen(bpf_filter) > 0) {
+            aconf->bpf_filter = bpf_filter;
+            SCLogConfig("Going to use command-line provided bpf filter '%s'",
+                       aconf->bpf_filter);
+        }
+    }
+
+    /* Find initial node */
+    af_xdp_node = ConfGetNode("af-xdp");
+    if (af_xdp_node == NULL) {
+        SCLogInfo("unable to find af-xdp config using default values");
+        goto finalize;
+    }
+
+    if_root = ConfFindDeviceConfig(af_xdp_node, iface);
+    if_default = ConfFindDeviceConfig(af_xdp_node, "default");
+
+    if (if_root == NULL && if_default == NULL) {
+        SCLogInfo("unable to find af-xdp config for "
+                  "interface \"%s\" or \"default\", using default values",
+                  iface);
+        goto finalize;
+    }
+
+    /* If there is no setting for current interface use default one as main iface */
+    if (if_root == NULL) {
+        if_root = if_default;
+        if_default = NULL;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "threads", &threadsstr) != 1) {
+        aconf->threads = 0;
+    } else {
+        if (threadsstr != NULL) {
+            if (strcmp(threadsstr, "auto") == 0) {
+                aconf->threads = 0;
+            } else {
+                aconf->threads = atoi(threadsstr);
+            }
+        }
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "ring-size", &value)) == 1) {
+        if (value <= 0 || (value & (value - 1)) != 0) {
+            SCLogError(SC_ERR_INVALID_VALUE, "ring-size of iface %s must be "
+                       "a power of 2, using %u", iface, aconf->ring_size);
+        } else {
+            aconf->ring_size = value;
+        }
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "frame-size", &value)) == 1) {
+        if (value != 2048 && value != 4096) {
+            SCLogError(SC_ERR_INVALID_VALUE, "frame-size of iface %s must be "
+                       "2048 or 4096, using %u", iface, aconf->frame_size);
+        } else {
+            aconf->frame_size = value;
+        }
+    }
+
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "batch-size", &value)) == 1) {
+        if (value <= 0 || value > aconf->ring_size) {
+            SCLogError(SC_ERR_INVALID_VALUE, "batch-size of iface %s must be "
+                       "between 1 and the ring-size, using %u", iface,
+                       aconf->batch_size);
+        } else {
+            aconf->batch_size = value;
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "zero-copy", &tmpctype) == 1) {
+        if (strcmp(tmpctype, "auto") == 0) {
+            aconf->bind_flags = 0;
+        } else if (ConfValIsTrue(tmpctype)) {
+            aconf->bind_flags = XDP_ZEROCOPY;
+        } else if (ConfValIsFalse(tmpctype)) {
+            aconf->bind_flags = XDP_COPY;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid value for "
+                         "zero-copy for %s", iface);
+        }
+    }
+
+    const char *xdp_mode;
+    if (ConfGetChildValueWithDefault(if_root, if_default, "xdp-mode", &xdp_mode) == 1) {
+        if (!strcmp(xdp_mode, "soft")) {
+            aconf->xdp_mode = XDP_FLAGS_SKB_MODE;
+        } else if (!strcmp(xdp_mode, "driver")) {
+            aconf->xdp_mode = XDP_FLAGS_DRV_MODE;
+        } else if (!strcmp(xdp_mode, "hw")) {
+            aconf->xdp_mode = XDP_FLAGS_HW_MODE;
+            aconf->ebpf_t_config.flags |= EBPF_XDP_HW_MODE;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_VALUE,
+                         "Invalid xdp-mode value: '%s'", xdp_mode);
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "copy-iface", &out_iface) == 1) {
+        if (strlen(out_iface) > 0) {
+            aconf->out_iface = out_iface;
+        }
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "copy-mode", &copymodestr) == 1) {
+        if (aconf->out_iface == NULL) {
+            SCLogInfo("Copy mode activated but no destination"
+                      " iface. Disabling feature");
+        } else if (strlen(copymodestr) <= 0) {
+            aconf->out_iface = NULL;
+        } else if (strcmp(copymodestr, "ips") == 0) {
+            SCLogInfo("AF_XDP IPS mode activated %s->%s",
+                    iface,
+                    aconf->out_iface);
+            aconf->copy_mode = AFXDP_COPY_MODE_IPS;
+        } else if (strcmp(copymodestr, "tap") == 0) {
+            SCLogInfo("AF_XDP TAP mode activated %s->%s",
+                    iface,
+                    aconf->out_iface);
+            aconf->copy_mode = AFXDP_COPY_MODE_TAP;
+        } else {
+            SCLogInfo("Invalid mode (not in tap, ips)");
+        }
+    }
+
+    /* load af_xdp bpf filter */
+    /* command line value has precedence */
+    if (ConfGet("bpf-filter", &bpf_filter) != 1) {
+        if (ConfGetChildValueWithDefault(if_root, if_default, "bpf-filter", &bpf_filter) == 1) {
+            if (strlen(bpf_filter) > 0) {
+                aconf->bpf_filter = bpf_filter;
+                SCLogConfig("Going to use bpf filter %s", aconf->bpf_filter);
+            }
+        }
+    }
+
+    boolval = false;
+    if (ConfGetChildValueBoolWithDefault(if_root, if_default, "pinned-maps", (int *)&boolval) == 1) {
+        if (boolval) {
+            SCLogConfig("Using pinned maps on iface %s",
+                        aconf->iface);
+            aconf->ebpf_t_config.flags |= EBPF_PINNED_MAPS;
+        }
+        const char *pinned_maps_name = NULL;
+        if (ConfGetChildValueWithDefault(if_root, if_default,
+                    "pinned-maps-name",
+                    &pinned_maps_name) != 1) {
+            aconf->ebpf_t_config.pinned_maps_name = pinned_maps_name;
+        } else {
+            aconf->ebpf_t_config.pinned_maps_name = NULL;
+        }
+    } else {
+        aconf->ebpf_t_config.pinned_maps_name = NULL;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "xdp-filter-file", &ebpf_file) == 1) {
+        aconf->ebpf_t_config.mode = AFP_MODE_XDP_BYPASS;
+        aconf->ebpf_t_config.flags |= EBPF_XDP_CODE;
+        aconf->xdp_filter_file = ebpf_file;
+        /* the filter is attached by us, libbpf needs the mode */
+        if (aconf->xdp_mode == 0) {
+            aconf->xdp_mode = XDP_FLAGS_DRV_MODE;
+        }
+        boolval = false;
+        ConfGetChildValueBoolWithDefault(if_root, if_default, "bypass", &boolval);
+        if (boolval) {
+            SCLogConfig("Using bypass kernel functionality for AF_XDP (iface %s)",
+                    aconf->iface);
+            aconf->flags |= AFXDP_XDPBYPASS;
+            BypassedFlowManagerRegisterUpdateFunc(EBPFUpdateFlow, NULL);
+        }
+
+        boolval = true;
+        if (ConfGetChildValueBoolWithDefault(if_root, if_default, "use-percpu-hash", (int *)&boolval) == 1) {
+            if (boolval == false) {
+                SCLogConfig("Not using percpu hash on iface %s",
+                        aconf->iface);
+                aconf->ebpf_t_config.cpus_count = 1;
+            }
+        }
+    }
+
+    /* One shot loading of the XDP filter, the sockets are added to its
+     * xsks_map when the threads start */
+    if (aconf->xdp_filter_file) {
+        int ret = EBPFLoadFile(aconf->iface, aconf->xdp_filter_file, "xdp",
+                               &aconf->xdp_filter_fd,
+                               &aconf->ebpf_t_config);
+        switch (ret) {
+            case 1:
+                SCLogInfo("Loaded pinned maps from sysfs");
+                break;
+            case -1:
+                SCLogWarning(SC_ERR_INVALID_VALUE,
+                             "Error when loading XDP filter file");
+                break;
+            case 0:
+                ret = EBPFSetupXDP(aconf->iface, aconf->xdp_filter_fd, aconf->xdp_mode);
+                if (ret != 0) {
+                    SCLogWarning(SC_ERR_INVALID_VALUE,
+                            "Error when setting up XDP");
+                } else {
+                    /* It will just set CPU count to 0 */
+                    EBPFBuildCPUSet(NULL, aconf->iface);
+                }
+                /* we have a peer and we use bypass so we can set up XDP iface redirect */
+                if (aconf->out_iface) {
+                    EBPFSetPeerIface(aconf->iface, aconf->out_iface);
+                }
+        }
+    }
+
+    /* maintenance of the bypassed flow tables, and if maps are pinned
+     * creation of their flows at start */
+    if (aconf->flags & AFXDP_XDPBYPASS) {
+        EBPFRegisterBypassedFlowScan(aconf->iface, &aconf->ebpf_t_config);
+    }
+
+    boolval = false;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", (int *)&boolval);
+    if (boolval) {
+        SCLogConfig("Disabling promiscuous mode on iface %s",
+                aconf->iface);
+        aconf->promisc = 0;
+    }
+
+    if (ConfGetChildValueWithDefault(if_root, if_default, "checksum-checks", &tmpctype) == 1) {
+        if (strcmp(tmpctype, "auto") == 0) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_AUTO;
+        } else if (ConfValIsTrue(tmpctype)) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_ENABLE;
+        } else if (ConfValIsFalse(tmpctype)) {
+            aconf->checksum_mode = CHECKSUM_VALIDATION_DISABLE;
+        } else {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "Invalid value for "
+                         "checksum-checks for %s", aconf->iface);
+        }
+    }
+
+finalize:
+
+    /* one thread and socket per queue */
+    if (aconf->threads == 0) {
+        aconf->threads = GetIfaceRSSQueuesNum(iface);
+        if (aconf->threads)
+            SCLogPerf("%d RX queues, using one AF_XDP socket on each",
+                    aconf->threads);
+    }
+    if (aconf->threads <= 0) {
+        aconf->threads = 1;
+    }
+
+    /* the UMEM and the rings are locked memory */
+    struct rlimit r = {RLIM_INFINITY, RLIM_INFINITY};
+    if (setrlimit(RLIMIT_MEMLOCK, &r) != 0) {
+        SCLogWarning(SC_ERR_MEM_ALLOC, "Unable to raise the locked memory "
+                     "limit, AF_XDP socket creation may fail: %s",
+                     strerror(errno));
+    }
+
+    SC_ATOMIC_RESET(aconf->ref);
+    (void) SC_ATOMIC_ADD(aconf->ref, aconf->threads);
+
+    if (LiveGetOffload() == 0) {
+        (void)GetIfaceOffloading(iface, 1, 1);
+    } else {
+        DisableIfaceOffloading(LiveGetDevice(iface), 1, 1);
+    }
+
+    SCLogPerf("Using %d AF_XDP sockets for interface %s, %u frames of "
+              "%u bytes per socket", aconf->threads, iface,
+              2 * aconf->ring_size, aconf->frame_size);
+
+    return aconf;
+}
+
+static int AFXDPConfigGeThreadsCount(void *conf)
+{
+    AFXDPIfaceConfig *afp = (AFXDPIfaceConfig *)conf;
+    return afp->threads;
+}
+
+int AFXDPRunModeIsIPS()
+{
+    int nlive = LiveGetDeviceCount();
+    int ldev;
+    ConfNode *if_root;
+    ConfNode *if_default = NULL;
+    ConfNode *af_xdp_node;
+    int has_ips = 0;
+    int has_ids = 0;
+
+    /* Find initial node */
+    af_xdp_node = ConfGetNode("af-xdp");
+    if (af_xdp_node == NULL) {
+        return 0;
+    }
+
+    if_default = ConfNodeLookupKeyValue(af_xdp_node, "interface", "default");
+
+    for (ldev = 0; ldev < nlive; ldev++) {
+        const char *live_dev = LiveGetDeviceName(ldev);
+        if (live_dev == NULL) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Problem with config file");
+            return 0;
+        }
+        const char *copymodestr = NULL;
+        if_root = ConfFindDeviceConfig(af_xdp_node, live_dev);
+
+        if (if_root == NULL) {
+            if (if_default == NULL) {
+                SCLogError(SC_ERR_INVALID_VALUE, "Problem with config file");
+                return 0;
+            }
+            if_root = if_default;
+        }
+
+        if (ConfGetChildValueWithDefault(if_root, if_default, "copy-mode", &copymodestr) == 1) {
+            if (strcmp(copymodestr, "ips") == 0) {
+                has_ips = 1;
+            } else {
+                has_ids = 1;
+            }
+        } else {
+            has_ids = 1;
+        }
+    }
+
+    if (has_ids && has_ips) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT,
+                   "AF_XDP IPS mode used and some interfaces are in IDS or "
+                   "TAP mode. Expect bad results as stream-inline is "
+                   "activated.");
+    }
+
+    return has_ips;
+}
+
+#endif /* HAVE_AF_XDP */
+
+int RunModeIdsAFXDPAutoFp(void)
+{
+    SCEnter();
+
+#ifdef HAVE_AF_XDP
+    int ret;
+    const char *live_dev = NULL;
+
+    RunModeInitialize();
+
+    TimeModeSetLive();
+
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    SCLogDebug("live_dev %s", live_dev);
+
+    ret = RunModeSetLiveCaptureAutoFp(ParseAFXDPConfig,
+                              AFXDPConfigGeThreadsCount,
+                              "ReceiveAFXDP",
+                              "DecodeAFXDP", thread_name_autofp,
+                              live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsAFXDPAutoFp initialised");
+#endif /* HAVE_AF_XDP */
+
+    SCReturnInt(0);
+}
+
+/**
+ * \brief Single thread version of the AF_XDP processing.
+ */
+int RunModeIdsAFXDPSingle(void)
+{
+    SCEnter();
+
+#ifdef HAVE_AF_XDP
+    int ret;
+    const char *live_dev = NULL;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    ret = RunModeSetLiveCaptureSingle(ParseAFXDPConfig,
+                                    AFXDPConfigGeThreadsCount,
+                                    "ReceiveAFXDP",
+                                    "DecodeAFXDP", thread_name_single,
+                                    live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsAFXDPSingle initialised");
+
+#endif /* HAVE_AF_XDP */
+    SCReturnInt(0);
+}
+
+/**
+ * \brief Workers version of the AF_XDP processing.
+ *
+ * Start N threads with each thread doing all the work.
+ *
+ */
+int RunModeIdsAFXDPWorkers(void)
+{
+    SCEnter();
+
+#ifdef HAVE_AF_XDP
+    int ret;
+    const char *live_dev = NULL;
+
+    RunModeInitialize();
+    TimeModeSetLive();
+
+    (void)ConfGet("af-xdp.live-interface", &live_dev);
+
+    ret = RunModeSetLiveCaptureWorkers(ParseAFXDPConfig,
+                                    AFXDPConfigGeThreadsCount,
+                                    "ReceiveAFXDP",
+                                    "DecodeAFXDP", thread_name_workers,
+                                    live_dev);
+    if (ret != 0) {
+        SCLogError(SC_ERR_RUNMODE, "Unable to start runmode");
+        exit(EXIT_FAILURE);
+    }
+
+    SCLogDebug("RunModeIdsAFXDPWorkers initialised");
+
+#endif /* HAVE_AF_XDP */
+    SCReturnInt(0);
+}
+
+/**
+ * @}
+ */
@@ -24,11 +24,13 @@
 
 #include "detect-engine.h"
 #include "source-pcap-file.h"
+#include "source-pcap-file-directory-helper.h"
 
 #include "util-debug.h"
 #include "util-time.h"
 #include "util-cpu.h"
 #include "util-affinity.h"
+#include "util-device.h"
 
 #include "util-runmodes.h"
 
@@ -49,6 +51,12 @@ void RunModeFilePcapRegister(void)
                               "the same flow can be processed by any detect "
                               "thread",
                               RunModeFilePcapAutoFp);
+    RunModeRegisterNewRunMode(RUNMODE_PCAP_FILE, "parallel",
+                              "Multi threaded pcap file mode.  Packets are "
+                              "decoded by several threads and passed on to "
+                              "the detect threads by flow in the order they "
+                              "were read",
+                              RunModeFilePcapParallel);
 
     return;
 }
@@ -126,9 +134,51 @@ int RunModeFilePcapSingle(void)
     return 0;
 }
 
+/**
+ * \brief get the number of readers sharing a pcap directory
+ *
+ * Uses "pcap-file.readers", 1 by default. With several readers a device
+ * named after each reader thread is registered and the flows are tracked
+ * per device, so the same tuples in files from different taps don't mix.
+ */
+static int RunModeFilePcapReaders(const char *file)
+{
+    intmax_t readers = 1;
+    char tname[TM_THREAD_NAME_MAX];
+    struct stat st;
+
+    if (ConfGetInt("pcap-file.readers", &readers) != 1 || readers <= 1)
+        return 1;
+
+    if (stat(file, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "pcap-file.readers is only "
+                     "used when reading a directory, using one reader");
+        return 1;
+    }
+    if (readers > 64)
+        readers = 64;
+
+    if (PcapDirectoryClaimsInit() != 0) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to setup the pcap directory readers");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < (int)readers; i++) {
+        snprintf(tname, sizeof(tname), "%s#%02d", thread_name_autofp, i + 1);
+        if (LiveRegisterDevice(tname) != 0) {
+            SCLogError(SC_ERR_MEM_ALLOC, "failed to register device %s", tname);
+            exit(EXIT_FAILURE);
+        }
+    }
+    g_livedev_tracking = true;
+
+    SCLogInfo("reading %d files of %s at a time", (int)readers, file);
+    return (int)readers;
+}
+
 /**
  * \brief RunModeFilePcapAutoFp set up the following thread packet handlers:
- *        - Receive thread (from pcap file)
+ *        - Receive thread (from pcap file), or one per file read at a
+ *          time if "pcap-file.readers" is set for a directory
  *        - Decode thread
  *        - Stream thread
  *        - Detect: If we have only 1 cpu, it will setup one Detect thread
@@ -186,15 +236,187 @@ int RunModeFilePcapAutoFp(void)
         exit(EXIT_FAILURE);
     }
 
+    TmModule *tm_module = NULL;
+    int readers = RunModeFilePcapReaders(file);
+    for (int reader = 0; reader < readers; reader++) {
+        snprintf(tname, sizeof(tname), "%s#%02d", thread_name_autofp, reader + 1);
+
+        /* create the threads */
+        ThreadVars *tv_receivepcap =
+            TmThreadCreatePacketHandler(tname,
+                                        "packetpool", "packetpool",
+                                        queues, "flow",
+                                        "pktacqloop");
+        if (tv_receivepcap == NULL) {
+            SCLogError(SC_ERR_FATAL, "threading setup failed");
+            exit(EXIT_FAILURE);
+        }
+        tm_module = TmModuleGetByName("ReceivePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName failed for ReceivePcap");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
+
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
+
+        TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
+
+        if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    SCFree(queues);
+
+    for (thread = 0; thread < (uint16_t)thread_max; thread++) {
+        snprintf(tname, sizeof(tname), "%s#%02u", thread_name_workers, thread+1);
+        snprintf(qname, sizeof(qname), "pickup%u", thread+1);
+
+        SCLogDebug("tname %s, qname %s", tname, qname);
+        SCLogDebug("Assigning %s affinity to cpu %u", tname, cpu);
+
+        ThreadVars *tv_detect_ncpu =
+            TmThreadCreatePacketHandler(tname,
+                                        qname, "flow",
+                                        "packetpool", "packetpool",
+                                        "varslot");
+        if (tv_detect_ncpu == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
+            exit(EXIT_FAILURE);
+        }
+
+        tm_module = TmModuleGetByName("FlowWorker");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName for FlowWorker failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
+
+        TmThreadSetGroupName(tv_detect_ncpu, "Detect");
+
+        TmThreadSetCPU(tv_detect_ncpu, WORKER_CPU_SET);
+
+        if (TmThreadSpawn(tv_detect_ncpu) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+
+        if ((cpu + 1) == ncpus)
+            cpu = 0;
+        else
+            cpu++;
+    }
+
+    return 0;
+}
+
+/**
+ * \brief get the number of decode threads for the parallel mode
+ *
+ * Uses "pcap-file.decode-threads", a quarter of the cpus by default.
+ */
+static int RunModeFilePcapDecodeThreads(uint16_t ncpus)
+{
+    const char *str = NULL;
+    int threads = 0;
+
+    if (ConfGet("pcap-file.decode-threads", &str) == 1 && str != NULL &&
+        strcmp(str, "auto") != 0)
+    {
+        threads = atoi(str);
+        if (threads <= 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid value for "
+                       "pcap-file.decode-threads: \"%s\"", str);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        threads = ncpus / 4;
+    }
+
+    if (threads < 2)
+        threads = 2;
+    if (threads > 64)
+        threads = 64;
+    return threads;
+}
+
+/**
+ * \brief RunModeFilePcapParallel set up the following thread packet handlers:
+ *        - Receive thread (from pcap file), numbering the packets
+ *        - Decode threads, each decoding chunks of packets
+ *        - Detect threads getting the packets by flow in the order they
+ *          were read, so the result is the same as in autofp mode
+ *
+ * \retval 0 If all goes well. (If any problem is detected the engine will
+ *           exit()).
+ */
+int RunModeFilePcapParallel(void)
+{
+    SCEnter();
+    char tname[TM_THREAD_NAME_MAX];
+    char qname[TM_QUEUE_NAME_MAX];
+    char *queues = NULL;
+    uint16_t thread;
+
+    RunModeInitialize();
+
+    const char *file = NULL;
+    if (ConfGet("pcap-file.file", &file) == 0) {
+        SCLogError(SC_ERR_RUNMODE, "Failed retrieving pcap-file from Conf");
+        exit(EXIT_FAILURE);
+    }
+    SCLogDebug("file %s", file);
+
+    TimeModeSetOffline();
+
+    PcapFileGlobalInit();
+
+    /* Available cpus */
+    uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
+
+    /* always create at least one thread */
+    int thread_max = TmThreadGetNbThreads(WORKER_CPU_SET);
+    if (thread_max == 0)
+        thread_max = ncpus * threading_detect_ratio;
+    if (thread_max < 1)
+        thread_max = 1;
+    if (thread_max > 1024)
+        thread_max = 1024;
+
+    int decode_max = RunModeFilePcapDecodeThreads(ncpus);
+    SCLogConfig("pcap-file: %d decode threads, %d detect threads",
+                decode_max, thread_max);
+
+    /* decode queues for the reader */
+    size_t decode_queues_size = decode_max * TM_QUEUE_NAME_MAX;
+    char *decode_queues = SCMalloc(decode_queues_size);
+    if (unlikely(decode_queues == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc queues buffer: %s",
+                   strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memset(decode_queues, 0x00, decode_queues_size);
+    for (thread = 0; thread < (uint16_t)decode_max; thread++) {
+        if (strlen(decode_queues) > 0)
+            strlcat(decode_queues, ",", decode_queues_size);
+        snprintf(qname, sizeof(qname), "decode%u", thread+1);
+        strlcat(decode_queues, qname, decode_queues_size);
+    }
+
     snprintf(tname, sizeof(tname), "%s#01", thread_name_autofp);
 
-    /* create the threads */
     ThreadVars *tv_receivepcap =
         TmThreadCreatePacketHandler(tname,
                                     "packetpool", "packetpool",
-                                    queues, "flow",
+                                    decode_queues, "ordered-split",
                                     "pktacqloop");
-    SCFree(queues);
+    SCFree(decode_queues);
 
     if (tv_receivepcap == NULL) {
         SCLogError(SC_ERR_FATAL, "threading setup failed");
@@ -207,13 +429,6 @@ int RunModeFilePcapAutoFp(void)
     }
     TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
 
-    tm_module = TmModuleGetByName("DecodePcapFile");
-    if (tm_module == NULL) {
-        SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
-
     TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
 
     if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
@@ -221,13 +436,46 @@ int RunModeFilePcapAutoFp(void)
         exit(EXIT_FAILURE);
     }
 
+    queues = RunmodeAutoFpCreatePickupQueuesString(thread_max);
+    if (queues == NULL) {
+        SCLogError(SC_ERR_RUNMODE, "RunmodeAutoFpCreatePickupQueuesString failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (thread = 0; thread < (uint16_t)decode_max; thread++) {
+        snprintf(tname, sizeof(tname), "%s#%02u", thread_name_decode, thread+1);
+        snprintf(qname, sizeof(qname), "decode%u", thread+1);
+
+        ThreadVars *tv_decode =
+            TmThreadCreatePacketHandler(tname,
+                                        qname, "ordered-merge",
+                                        queues, "ordered-merge",
+                                        "varslot");
+        if (tv_decode == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
+            exit(EXIT_FAILURE);
+        }
+
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName DecodePcap failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_decode, tm_module, NULL);
+
+        TmThreadSetCPU(tv_decode, RECEIVE_CPU_SET);
+
+        if (TmThreadSpawn(tv_decode) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    SCFree(queues);
+
     for (thread = 0; thread < (uint16_t)thread_max; thread++) {
         snprintf(tname, sizeof(tname), "%s#%02u", thread_name_workers, thread+1);
         snprintf(qname, sizeof(qname), "pickup%u", thread+1);
 
-        SCLogDebug("tname %s, qname %s", tname, qname);
-        SCLogDebug("Assigning %s affinity to cpu %u", tname, cpu);
-
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(tname,
                                         qname, "flow",
@@ -253,11 +501,6 @@ int RunModeFilePcapAutoFp(void)
             SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
             exit(EXIT_FAILURE);
         }
-
-        if ((cpu + 1) == ncpus)
-            cpu = 0;
-        else
-            cpu++;
     }
 
     return 0;
@@ -25,6 +25,7 @@
 
 int RunModeFilePcapSingle(void);
 int RunModeFilePcapAutoFp(void);
+int RunModeFilePcapParallel(void);
 void RunModeFilePcapRegister(void);
 const char *RunModeFilePcapGetDefaultMode(void);
 
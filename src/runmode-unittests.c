@@ -43,6 +43,8 @@
 #include "flow.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
+#include "flow-bypass-table.h"
+#include "util-ebpf.h"
 #include "flow-var.h"
 #include "flow-bit.h"
 #include "pkt-var.h"
@@ -66,6 +68,7 @@
 #include "app-layer-ssh.h"
 #include "app-layer-smtp.h"
 
+#include "counters-shm.h"
 #include "util-action.h"
 #include "util-radix-tree.h"
 #include "util-host-os-info.h"
@@ -93,6 +96,18 @@
 #include "util-byte.h"
 #include "util-proto-name.h"
 #include "util-memrchr.h"
+#include "util-base64.h"
+#include "util-checksum.h"
+#include "util-file-offload.h"
+#include "output-filestore.h"
+#include "log-pcap.h"
+#include "output-json-builder.h"
+#include "output-json-alert.h"
+#include "output-tx.h"
+#include "util-log-compress.h"
+#ifdef HAVE_LIBHIREDIS
+#include "util-log-redis.h"
+#endif
 
 #include "util-mpm-ac.h"
 #include "util-mpm-hs.h"
@@ -102,6 +117,10 @@
 #include "conf.h"
 #include "conf-yaml-loader.h"
 #include "tmqh-flow.h"
+#include "tmqh-ordered.h"
+#include "source-pcap-file-mmap.h"
+#include "source-pcap-file.h"
+#include "source-pcap-file-directory-helper.h"
 #include "defrag.h"
 #include "detect-engine-siggroup.h"
 
@@ -145,6 +164,7 @@ static void RegisterUnittests(void)
     HostBitRegisterTests();
     IPPairBitRegisterTests();
     StatsRegisterTests();
+    StatsShmRegisterTests();
     DecodeEthernetRegisterTests();
     DecodePPPRegisterTests();
     DecodeVLANRegisterTests();
@@ -164,7 +184,15 @@ static void RegisterUnittests(void)
     ConfRegisterTests();
     ConfYamlRegisterTests();
     TmqhFlowRegisterTests();
+    TmqhOrderedRegisterTests();
+    PcapFileMmapRegisterTests();
+    PcapFileRegisterTests();
+    PcapDirectoryRegisterTests();
     FlowRegisterTests();
+    FlowBypassTableRegisterTests();
+#ifdef HAVE_PACKET_EBPF
+    EBPFRegisterTests();
+#endif
     HostRegisterUnittests();
     IPPairRegisterUnittests();
     SCSigRegisterSignatureOrderingTests();
@@ -199,6 +227,19 @@ static void RegisterUnittests(void)
     MemrchrRegisterTests();
     AppLayerUnittestsRegister();
     MimeDecRegisterTests();
+    Base64RegisterTests();
+    ChecksumRegisterTests();
+    FileOffloadRegisterTests();
+    OutputFilestoreRegisterTests();
+    PcapLogRegisterTests();
+    JsonBuilderRegisterTests();
+    JsonAlertLogRegisterTests();
+    OutputTxLogRegisterTests();
+    LogCompressRegisterTests();
+    LogFileRegisterTests();
+#ifdef HAVE_LIBHIREDIS
+    SCLogRedisRegisterTests();
+#endif
     StreamingBufferRegisterTests();
 #ifdef OS_WIN32
     Win32SyscallRegisterTests();
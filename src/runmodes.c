@@ -38,6 +38,9 @@
 #include "runmodes.h"
 #include "util-unittest.h"
 #include "util-misc.h"
+#include "util-file-offload.h"
+#include "util-log-compress.h"
+#include "util-log-redis.h"
 
 #include "output.h"
 
@@ -47,6 +50,8 @@
 #include "alert-debuglog.h"
 
 #include "log-httplog.h"
+#include "log-pcap.h"
+#include "output-filestore.h"
 
 #include "source-pfring.h"
 
@@ -62,6 +67,7 @@ int threading_set_cpu_affinity = FALSE;
 const char *thread_name_autofp = "RX";
 const char *thread_name_single = "W";
 const char *thread_name_workers = "W";
+const char *thread_name_decode = "DC";
 const char *thread_name_verdict = "TX";
 const char *thread_name_flow_mgr = "FM";
 const char *thread_name_flow_rec = "FR";
@@ -144,6 +150,12 @@ static const char *RunModeTranslateModeToName(int runmode)
             return "NETMAP";
 #else
             return "NETMAP(DISABLED)";
+#endif
+        case RUNMODE_AFXDP_DEV:
+#ifdef HAVE_AF_XDP
+            return "AF_XDP_DEV";
+#else
+            return "AF_XDP_DEV(DISABLED)";
 #endif
         case RUNMODE_UNIX_SOCKET:
             return "UNIX_SOCKET";
@@ -221,6 +233,7 @@ void RunModeRegisterRunModes(void)
     RunModeNapatechRegister();
     RunModeIdsAFPRegister();
     RunModeIdsNetmapRegister();
+    RunModeIdsAFXDPRegister();
     RunModeIdsNflogRegister();
     RunModeUnixSocketRegister();
     RunModeIpsWinDivertRegister();
@@ -323,6 +336,9 @@ void RunModeDispatch(int runmode, const char *custom_mode)
             case RUNMODE_NETMAP:
                 custom_mode = RunModeNetmapGetDefaultMode();
                 break;
+            case RUNMODE_AFXDP_DEV:
+                custom_mode = RunModeAFXDPGetDefaultMode();
+                break;
             case RUNMODE_UNIX_SOCKET:
                 custom_mode = RunModeUnixSocketGetDefaultMode();
                 break;
@@ -390,6 +406,13 @@ void RunModeDispatch(int runmode, const char *custom_mode)
         if (RunModeNeedsBypassManager()) {
             BypassedFlowManagerThreadSpawn();
         }
+        FileOffloadThreadSpawn();
+        LogCompressThreadSpawn();
+        PcapLogWriterThreadSpawn();
+        OutputFilestoreWriterThreadSpawn();
+#ifdef HAVE_LIBHIREDIS
+        SCLogRedisSpoolThreadSpawn();
+#endif
         StatsSpawnThreads();
     }
 }
@@ -477,6 +500,8 @@ static void RunOutputFreeList(void)
 
 static int file_logger_count = 0;
 static int filedata_logger_count = 0;
+static int streaming_logger_count = 0;
+static bool wildcard_tx_logger = false;
 static LoggerId logger_bits[ALPROTO_MAX];
 
 int RunModeOutputFileEnabled(void)
@@ -535,6 +560,8 @@ void RunModeShutDown(void)
     /* Reset logger counts. */
     file_logger_count = 0;
     filedata_logger_count = 0;
+    streaming_logger_count = 0;
+    wildcard_tx_logger = false;
 }
 
 /** \internal
@@ -588,6 +615,8 @@ static void SetupOutput(const char *name, OutputModule *module, OutputCtx *outpu
         /* Not used with wild card loggers */
         if (module->alproto != ALPROTO_UNKNOWN) {
             logger_bits[module->alproto] |= (1<<module->logger_id);
+        } else {
+            wildcard_tx_logger = true;
         }
     } else if (module->FiledataLogFunc) {
         SCLogDebug("%s is a filedata logger", module->name);
@@ -607,6 +636,7 @@ static void SetupOutput(const char *name, OutputModule *module, OutputCtx *outpu
             module->StreamingLogFunc, output_ctx, module->stream_type,
             module->ThreadInit, module->ThreadDeinit,
             module->ThreadExitPrintStats);
+        streaming_logger_count++;
     } else {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "Unknown logger type: name=%s",
             module->name);
@@ -891,6 +921,22 @@ void RunModeInitializeOutputs(void)
             AppLayerParserRegisterLoggerBits(IPPROTO_UDP, a, logger_bits[a]);
 
     }
+
+    /* register the protocols the outputs consume for parse by need */
+    if (AppLayerParserParseByNeedEnabled()) {
+        if (wildcard_tx_logger || streaming_logger_count > 0) {
+            AppLayerParserSetOutputNeed(ALPROTO_UNKNOWN);
+        }
+        for (a = 0; a < ALPROTO_MAX; a++) {
+            if (logger_bits[a] != 0) {
+                AppLayerParserSetOutputNeed(a);
+            } else if ((file_logger_count > 0 || filedata_logger_count > 0) &&
+                    (AppLayerParserSupportsFiles(IPPROTO_TCP, a) ||
+                     AppLayerParserSupportsFiles(IPPROTO_UDP, a))) {
+                AppLayerParserSetOutputNeed(a);
+            }
+        }
+    }
 }
 
 float threading_detect_ratio = 1;
@@ -36,6 +36,7 @@ enum RunModes {
     RUNMODE_DAG,
     RUNMODE_AFP_DEV,
     RUNMODE_NETMAP,
+    RUNMODE_AFXDP_DEV,
     RUNMODE_UNITTEST,
     RUNMODE_NAPATECH,
     RUNMODE_UNIX_SOCKET,
@@ -63,6 +64,7 @@ enum RunModes {
 extern const char *thread_name_autofp;
 extern const char *thread_name_single;
 extern const char *thread_name_workers;
+extern const char *thread_name_decode;
 extern const char *thread_name_verdict;
 extern const char *thread_name_flow_mgr;
 extern const char *thread_name_flow_bypass;
@@ -107,6 +109,7 @@ int RunModeNeedsBypassManager(void);
 #include "runmode-nflog.h"
 #include "runmode-unix-socket.h"
 #include "runmode-netmap.h"
+#include "runmode-af-xdp.h"
 #include "runmode-windivert.h"
 
 extern int threading_set_cpu_affinity;
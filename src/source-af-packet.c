@@ -58,6 +58,7 @@
 #include "source-af-packet.h"
 #include "runmodes.h"
 #include "flow-storage.h"
+#include "flow-bypass-table.h"
 
 #ifdef HAVE_AF_PACKET
 
@@ -181,6 +182,10 @@ TmEcode NoAFPSupportExit(ThreadVars *tv, const void *initdata, void **data)
 #define TP_STATUS_VLAN_VALID (1 << 4)
 #endif
 
+#ifndef TP_STATUS_CSUM_VALID
+#define TP_STATUS_CSUM_VALID (1 << 7)
+#endif
+
 enum {
     AFP_READ_OK,
     AFP_READ_FAILURE,
@@ -204,6 +209,7 @@ union thdr {
 
 static int AFPBypassCallback(Packet *p);
 static int AFPXDPBypassCallback(Packet *p);
+static int AFPBypassTableCallback(Packet *p);
 
 #define MAX_MAPS 32
 /**
@@ -231,6 +237,8 @@ typedef struct AFPThreadVars_
     /* File descriptor of the IPv6 flow bypass table maps */
     int v6_map_fd;
 #endif
+    /* userspace bypass table, NULL if not used */
+    FlowBypassTable *bypass_table;
 
     unsigned int frame_offset;
 
@@ -240,6 +248,7 @@ typedef struct AFPThreadVars_
     uint16_t capture_kernel_packets;
     uint16_t capture_kernel_drops;
     uint16_t capture_errors;
+    uint16_t capture_bypassed;
 
     /* handle state */
     uint8_t afp_state;
@@ -580,6 +589,28 @@ static inline void AFPDumpCounters(AFPThreadVars *ptv)
 #endif
 }
 
+/**
+ * \brief Check a frame against the bypass table of the thread
+ *
+ * \retval true the frame is from a bypassed flow and can be discarded
+ */
+static inline bool AFPBypassTableMatch(AFPThreadVars *ptv, const uint8_t *pkt,
+                                       uint32_t len, uint32_t status,
+                                       uint16_t vlan_tci)
+{
+    if (ptv->bypass_table == NULL || ptv->datalink != LINKTYPE_ETHERNET)
+        return false;
+
+    bool vlan_valid = (ptv->flags & AFP_VLAN_IN_HEADER) &&
+                      ((status & TP_STATUS_VLAN_VALID) || vlan_tci);
+    if (FlowBypassTableMatch(ptv->bypass_table, pkt, len,
+                vlan_tci & 0x0fff, vlan_valid)) {
+        StatsIncr(ptv->tv, ptv->capture_bypassed);
+        return true;
+    }
+    return false;
+}
+
 /**
  * \brief AF packet read function.
  *
@@ -603,6 +634,7 @@ static int AFPRead(AFPThreadVars *ptv)
         struct cmsghdr cmsg;
         char buf[CMSG_SPACE(sizeof(struct tpacket_auxdata))];
     } cmsg_buf;
+    struct tpacket_auxdata *aux = NULL;
     unsigned char aux_checksum = 0;
 
     msg.msg_name = &from;
@@ -628,6 +660,22 @@ static int AFPRead(AFPThreadVars *ptv)
         SCReturnInt(AFP_READ_FAILURE);
     }
 
+    /* List is NULL if we don't have activated auxiliary data */
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_len < CMSG_LEN(sizeof(struct tpacket_auxdata)) ||
+                cmsg->cmsg_level != SOL_PACKET ||
+                cmsg->cmsg_type != PACKET_AUXDATA)
+            continue;
+
+        aux = (struct tpacket_auxdata *)CMSG_DATA(cmsg);
+        break;
+    }
+
+    if (AFPBypassTableMatch(ptv, ptv->data, caplen + offset,
+                aux ? aux->tp_status : 0, aux ? aux->tp_vlan_tci : 0)) {
+        SCReturnInt(AFP_READ_OK);
+    }
+
     p = PacketGetFromQueueOrAlloc();
     if (p == NULL) {
         SCReturnInt(AFP_SURI_FAILURE);
@@ -649,6 +697,10 @@ static int AFPRead(AFPThreadVars *ptv)
         p->afp_v.nr_cpus = ptv->ebpf_t_config.cpus_count;
 #endif
     }
+    if (ptv->bypass_table) {
+        p->BypassPacketsFlow = AFPBypassTableCallback;
+        p->afp_v.bypass_table = ptv->bypass_table;
+    }
 
     /* get timestamp of packet via ioctl */
     if (ioctl(ptv->socket, SIOCGSTAMP, &p->ts) == -1) {
@@ -693,21 +745,21 @@ static int AFPRead(AFPThreadVars *ptv)
         aux_checksum = 1;
     }
 
-    /* List is NULL if we don't have activated auxiliary data */
-    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-        struct tpacket_auxdata *aux;
-
-        if (cmsg->cmsg_len < CMSG_LEN(sizeof(struct tpacket_auxdata)) ||
-                cmsg->cmsg_level != SOL_PACKET ||
-                cmsg->cmsg_type != PACKET_AUXDATA)
-            continue;
-
-        aux = (struct tpacket_auxdata *)CMSG_DATA(cmsg);
-
+    if (aux != NULL) {
         if (aux_checksum && (aux->tp_status & TP_STATUS_CSUMNOTREADY)) {
             p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (aux_checksum && (ptv->flags & AFP_CHECKSUM_TRUST_NIC) &&
+                (aux->tp_status & TP_STATUS_CSUM_VALID)) {
+            p->flags |= PKT_L4_CSUM_VALID;
+        }
+
+        /* get vlan id from auxiliary data, as the ring modes do with
+         * the frame header, so the bypass table keys match */
+        if ((ptv->flags & AFP_VLAN_IN_HEADER) &&
+                (aux->tp_status & TP_STATUS_VLAN_VALID || aux->tp_vlan_tci)) {
+            p->vlan_id[0] = aux->tp_vlan_tci & 0x0fff;
+            p->vlan_idx = 1;
         }
-        break;
     }
 
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
@@ -915,6 +967,12 @@ static int AFPReadFromRing(AFPThreadVars *ptv)
             goto next_frame;
         }
 
+        if (AFPBypassTableMatch(ptv, (uint8_t *)h.raw + h.h2->tp_mac,
+                    h.h2->tp_snaplen, h.h2->tp_status, h.h2->tp_vlan_tci)) {
+            h.h2->tp_status = TP_STATUS_KERNEL;
+            goto next_frame;
+        }
+
         p = PacketGetFromQueueOrAlloc();
         if (p == NULL) {
             SCReturnInt(AFP_SURI_FAILURE);
@@ -936,6 +994,10 @@ static int AFPReadFromRing(AFPThreadVars *ptv)
             p->afp_v.nr_cpus = ptv->ebpf_t_config.cpus_count;
 #endif
         }
+        if (ptv->bypass_table) {
+            p->BypassPacketsFlow = AFPBypassTableCallback;
+            p->afp_v.bypass_table = ptv->bypass_table;
+        }
 
         /* Suricata will treat packet so telling it is busy, this
          * status will be reset to 0 (ie TP_STATUS_KERNEL) in the release
@@ -1010,6 +1072,9 @@ static int AFPReadFromRing(AFPThreadVars *ptv)
         } else {
             if (h.h2->tp_status & TP_STATUS_CSUMNOTREADY) {
                 p->flags |= PKT_IGNORE_CHECKSUM;
+            } else if ((ptv->flags & AFP_CHECKSUM_TRUST_NIC) &&
+                    (h.h2->tp_status & TP_STATUS_CSUM_VALID)) {
+                p->flags |= PKT_L4_CSUM_VALID;
             }
         }
         if (h.h2->tp_status & TP_STATUS_LOSING) {
@@ -1050,6 +1115,12 @@ static inline void AFPFlushBlock(struct tpacket_block_desc *pbd)
 
 static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd, struct tpacket3_hdr *ppd)
 {
+    /* the block is given back to the kernel by the caller */
+    if (AFPBypassTableMatch(ptv, (uint8_t *)ppd + ppd->tp_mac,
+                ppd->tp_snaplen, ppd->tp_status, ppd->hv1.tp_vlan_tci)) {
+        SCReturnInt(AFP_READ_OK);
+    }
+
     Packet *p = PacketGetFromQueueOrAlloc();
     if (p == NULL) {
         SCReturnInt(AFP_SURI_FAILURE);
@@ -1069,6 +1140,9 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
         p->afp_v.v6_map_fd = ptv->v6_map_fd;
         p->afp_v.nr_cpus = ptv->ebpf_t_config.cpus_count;
 #endif
+    } else if (ptv->bypass_table) {
+        p->BypassPacketsFlow = AFPBypassTableCallback;
+        p->afp_v.bypass_table = ptv->bypass_table;
     }
 
     ptv->pkts++;
@@ -1124,6 +1198,9 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     } else {
         if (ppd->tp_status & TP_STATUS_CSUMNOTREADY) {
             p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if ((ptv->flags & AFP_CHECKSUM_TRUST_NIC) &&
+                (ppd->tp_status & TP_STATUS_CSUM_VALID)) {
+            p->flags |= PKT_L4_CSUM_VALID;
         }
     }
 
@@ -2289,88 +2366,6 @@ TmEcode AFPSetBPFFilter(AFPThreadVars *ptv)
     return TM_ECODE_OK;
 }
 
-#ifdef HAVE_PACKET_EBPF
-/**
- * Insert a half flow in the kernel bypass table
- *
- * \param mapfd file descriptor of the protocol bypass table
- * \param key data to use as key in the table
- * \return 0 in case of error, 1 if success
- */
-static int AFPInsertHalfFlow(int mapd, void *key, unsigned int nr_cpus)
-{
-    BPF_DECLARE_PERCPU(struct pair, value, nr_cpus);
-    unsigned int i;
-
-    if (mapd == -1) {
-        return 0;
-    }
-
-    /* We use a per CPU structure so we have to set an array of values as the kernel
-     * is not duplicating the data on each CPU by itself. */
-    for (i = 0; i < nr_cpus; i++) {
-        BPF_PERCPU(value, i).packets = 0;
-        BPF_PERCPU(value, i).bytes = 0;
-    }
-    if (bpf_map_update_elem(mapd, key, value, BPF_NOEXIST) != 0) {
-        switch (errno) {
-            /* no more place in the hash */
-            case E2BIG:
-                return 0;
-            /* no more place in the hash for some hardware bypass */
-            case EAGAIN:
-                return 0;
-            /* if we already have the key then bypass is a success */
-            case EEXIST:
-                return 1;
-            /* Not supposed to be there so issue a error */
-            default:
-                SCLogError(SC_ERR_BPF, "Can't update eBPF map: %s (%d)",
-                        strerror(errno),
-                        errno);
-                return 0;
-        }
-    }
-    return 1;
-}
-
-static int AFPSetFlowStorage(Packet *p, int map_fd, void *key0, void* key1,
-                             int family)
-{
-    FlowBypassInfo *fc = FlowGetStorageById(p->flow, GetFlowBypassInfoID());
-    if (fc) {
-        EBPFBypassData *eb = SCCalloc(1, sizeof(EBPFBypassData));
-        if (eb == NULL) {
-            EBPFDeleteKey(map_fd, key0);
-            EBPFDeleteKey(map_fd, key1);
-            LiveDevAddBypassFail(p->livedev, 1, family);
-            SCFree(key0);
-            SCFree(key1);
-            return 0;
-        }
-        eb->key[0] = key0;
-        eb->key[1] = key1;
-        eb->mapfd = map_fd;
-        eb->cpus_count = p->afp_v.nr_cpus;
-        fc->BypassUpdate = EBPFBypassUpdate;
-        fc->BypassFree = EBPFBypassFree;
-        fc->bypass_data = eb;
-    } else {
-        EBPFDeleteKey(map_fd, key0);
-        EBPFDeleteKey(map_fd, key1);
-        LiveDevAddBypassFail(p->livedev, 1, family);
-        SCFree(key0);
-        SCFree(key1);
-        return 0;
-    }
-
-    LiveDevAddBypassStats(p->livedev, 1, family);
-    LiveDevAddBypassSuccess(p->livedev, 1, family);
-    return 1;
-}
-
-#endif
-
 /**
  * Bypass function for AF_PACKET capture in eBPF mode
  *
@@ -2428,8 +2423,8 @@ static int AFPBypassCallback(Packet *p)
         } else {
             keys[0]->ip_proto = 0;
         }
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, keys[0],
-                              p->afp_v.nr_cpus) == 0) {
+        if (EBPFInsertHalfFlow(p->afp_v.v4_map_fd, keys[0],
+                               p->afp_v.nr_cpus) == 0) {
             LiveDevAddBypassFail(p->livedev, 1, AF_INET);
             SCFree(keys[0]);
             return 0;
@@ -2449,8 +2444,8 @@ static int AFPBypassCallback(Packet *p)
         keys[1]->vlan1 = p->vlan_id[1];
 
         keys[1]->ip_proto = keys[0]->ip_proto;
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, keys[1],
-                              p->afp_v.nr_cpus) == 0) {
+        if (EBPFInsertHalfFlow(p->afp_v.v4_map_fd, keys[1],
+                               p->afp_v.nr_cpus) == 0) {
             EBPFDeleteKey(p->afp_v.v4_map_fd, keys[0]);
             LiveDevAddBypassFail(p->livedev, 1, AF_INET);
             SCFree(keys[0]);
@@ -2458,7 +2453,8 @@ static int AFPBypassCallback(Packet *p)
             return 0;
         }
         EBPFUpdateFlow(p->flow, p, NULL);
-        return AFPSetFlowStorage(p, p->afp_v.v4_map_fd, keys[0], keys[1], AF_INET);
+        return EBPFSetFlowStorage(p, p->afp_v.v4_map_fd, keys[0], keys[1], AF_INET,
+                                  p->afp_v.nr_cpus);
     }
     /* For IPv6 case we don't handle extended header in eBPF */
     if (PKT_IS_IPV6(p) &&
@@ -2488,8 +2484,8 @@ static int AFPBypassCallback(Packet *p)
         } else {
             keys[0]->ip_proto = 0;
         }
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, keys[0],
-                              p->afp_v.nr_cpus) == 0) {
+        if (EBPFInsertHalfFlow(p->afp_v.v6_map_fd, keys[0],
+                               p->afp_v.nr_cpus) == 0) {
             LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
             SCFree(keys[0]);
             return 0;
@@ -2511,8 +2507,8 @@ static int AFPBypassCallback(Packet *p)
         keys[1]->vlan1 = p->vlan_id[1];
 
         keys[1]->ip_proto = keys[0]->ip_proto;
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, keys[1],
-                              p->afp_v.nr_cpus) == 0) {
+        if (EBPFInsertHalfFlow(p->afp_v.v6_map_fd, keys[1],
+                               p->afp_v.nr_cpus) == 0) {
             EBPFDeleteKey(p->afp_v.v6_map_fd, keys[0]);
             LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
             SCFree(keys[0]);
@@ -2521,7 +2517,8 @@ static int AFPBypassCallback(Packet *p)
         }
         if (p->flow)
             EBPFUpdateFlow(p->flow, p, NULL);
-        return AFPSetFlowStorage(p, p->afp_v.v6_map_fd, keys[0], keys[1], AF_INET6);
+        return EBPFSetFlowStorage(p, p->afp_v.v6_map_fd, keys[0], keys[1], AF_INET6,
+                                  p->afp_v.nr_cpus);
     }
 #endif
     return 0;
@@ -2541,145 +2538,29 @@ static int AFPBypassCallback(Packet *p)
 static int AFPXDPBypassCallback(Packet *p)
 {
 #ifdef HAVE_PACKET_XDP
-    SCLogDebug("Calling af_packet callback function");
-    /* Only bypass TCP and UDP */
-    if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p))) {
-        return 0;
-    }
-
-    /* If we don't have a flow attached to packet the eBPF map entries
-     * will be destroyed at first flow bypass manager pass as we won't
-     * find any associated entry */
-    if (p->flow == NULL) {
-        return 0;
-    }
-    /* Bypassing tunneled packets is currently not supported
-     * because we can't discard the inner packet only due to
-     * primitive parsing in eBPF */
-    if (IS_TUNNEL_PKT(p)) {
-        return 0;
-    }
-    if (PKT_IS_IPV4(p)) {
-        struct flowv4_keys *keys[2];
-        keys[0]= SCCalloc(1, sizeof(struct flowv4_keys));
-        if (keys[0] == NULL) {
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
-            return 0;
-        }
-        if (p->afp_v.v4_map_fd == -1) {
-            SCFree(keys[0]);
-            return 0;
-        }
-        keys[0]->src = p->src.addr_data32[0];
-        keys[0]->dst = p->dst.addr_data32[0];
-        /* In the XDP filter we get port from parsing of packet and not from skb
-         * (as in eBPF filter) so we need to pass from host to network order */
-        keys[0]->port16[0] = htons(p->sp);
-        keys[0]->port16[1] = htons(p->dp);
-        keys[0]->vlan0 = p->vlan_id[0];
-        keys[0]->vlan1 = p->vlan_id[1];
-        if (IPV4_GET_IPPROTO(p) == IPPROTO_TCP) {
-            keys[0]->ip_proto = 1;
-        } else {
-            keys[0]->ip_proto = 0;
-        }
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, keys[0],
-                              p->afp_v.nr_cpus) == 0) {
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
-            SCFree(keys[0]);
-            return 0;
-        }
-        keys[1]= SCCalloc(1, sizeof(struct flowv4_keys));
-        if (keys[1] == NULL) {
-            EBPFDeleteKey(p->afp_v.v4_map_fd, keys[0]);
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
-            SCFree(keys[0]);
-            return 0;
-        }
-        keys[1]->src = p->dst.addr_data32[0];
-        keys[1]->dst = p->src.addr_data32[0];
-        keys[1]->port16[0] = htons(p->dp);
-        keys[1]->port16[1] = htons(p->sp);
-        keys[1]->vlan0 = p->vlan_id[0];
-        keys[1]->vlan1 = p->vlan_id[1];
-        keys[1]->ip_proto = keys[0]->ip_proto;
-        if (AFPInsertHalfFlow(p->afp_v.v4_map_fd, keys[1],
-                              p->afp_v.nr_cpus) == 0) {
-            EBPFDeleteKey(p->afp_v.v4_map_fd, keys[0]);
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
-            SCFree(keys[0]);
-            SCFree(keys[1]);
-            return 0;
-        }
-        return AFPSetFlowStorage(p, p->afp_v.v4_map_fd, keys[0], keys[1], AF_INET);
-    }
-    /* For IPv6 case we don't handle extended header in eBPF */
-    if (PKT_IS_IPV6(p) &&
-        ((IPV6_GET_NH(p) == IPPROTO_TCP) || (IPV6_GET_NH(p) == IPPROTO_UDP))) {
-        SCLogDebug("add an IPv6");
-        if (p->afp_v.v6_map_fd == -1) {
-            return 0;
-        }
-        int i;
-        struct flowv6_keys *keys[2];
-        keys[0] = SCCalloc(1, sizeof(struct flowv6_keys));
-        if (keys[0] == NULL) {
-            return 0;
-        }
-
-        for (i = 0; i < 4; i++) {
-            keys[0]->src[i] = GET_IPV6_SRC_ADDR(p)[i];
-            keys[0]->dst[i] = GET_IPV6_DST_ADDR(p)[i];
-        }
-        keys[0]->port16[0] = htons(GET_TCP_SRC_PORT(p));
-        keys[0]->port16[1] = htons(GET_TCP_DST_PORT(p));
-        keys[0]->vlan0 = p->vlan_id[0];
-        keys[0]->vlan1 = p->vlan_id[1];
-        if (IPV6_GET_NH(p) == IPPROTO_TCP) {
-            keys[0]->ip_proto = 1;
-        } else {
-            keys[0]->ip_proto = 0;
-        }
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, keys[0],
-                              p->afp_v.nr_cpus) == 0) {
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
-            SCFree(keys[0]);
-            return 0;
-        }
-        keys[1]= SCCalloc(1, sizeof(struct flowv6_keys));
-        if (keys[1] == NULL) {
-            EBPFDeleteKey(p->afp_v.v6_map_fd, keys[0]);
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
-            SCFree(keys[0]);
-            return 0;
-        }
-        for (i = 0; i < 4; i++) {
-            keys[1]->src[i] = GET_IPV6_DST_ADDR(p)[i];
-            keys[1]->dst[i] = GET_IPV6_SRC_ADDR(p)[i];
-        }
-        keys[1]->port16[0] = htons(GET_TCP_DST_PORT(p));
-        keys[1]->port16[1] = htons(GET_TCP_SRC_PORT(p));
-        keys[1]->vlan0 = p->vlan_id[0];
-        keys[1]->vlan1 = p->vlan_id[1];
-        keys[1]->ip_proto = keys[0]->ip_proto;
-        if (AFPInsertHalfFlow(p->afp_v.v6_map_fd, keys[1],
-                              p->afp_v.nr_cpus) == 0) {
-            EBPFDeleteKey(p->afp_v.v6_map_fd, keys[0]);
-            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
-            SCFree(keys[0]);
-            SCFree(keys[1]);
-            return 0;
-        }
-        return AFPSetFlowStorage(p, p->afp_v.v6_map_fd, keys[0], keys[1], AF_INET6);
-    }
-#endif
+    return EBPFXDPBypassFlow(p, p->afp_v.v4_map_fd, p->afp_v.v6_map_fd,
+                             p->afp_v.nr_cpus);
+#else
     return 0;
+#endif
 }
 
 
 bool g_flowv4_ok = true;
 bool g_flowv6_ok = true;
 
+/**
+ * Bypass callback used when the flows are bypassed in the userspace
+ * table of the capture thread.
+ *
+ * \param p the packet of the flow to bypass
+ * \return 0 if the flow can't be bypassed, 1 if success
+ */
+static int AFPBypassTableCallback(Packet *p)
+{
+    return FlowBypassTableAdd(p->afp_v.bypass_table, p);
+}
+
 /**
  * \brief Init function for ReceiveAFP.
  *
@@ -2808,6 +2689,19 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, const void *initdata, void **data)
     ptv->datalen = T_DATA_SIZE;
 #undef T_DATA_SIZE
 
+    if (afpconfig->bypass_table_size > 0) {
+        ptv->bypass_table = FlowBypassTableAlloc(afpconfig->bypass_table_size);
+        if (ptv->bypass_table == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate bypass table");
+            afpconfig->DerefFunc(afpconfig);
+            SCFree(ptv->data);
+            SCFree(ptv);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        ptv->capture_bypassed = StatsRegisterCounter("capture.bypassed",
+                ptv->tv);
+    }
+
     *data = (void *)ptv;
 
     afpconfig->DerefFunc(afpconfig);
@@ -2865,6 +2759,9 @@ TmEcode ReceiveAFPThreadDeinit(ThreadVars *tv, void *data)
     ptv->datalen = 0;
 
     ptv->bpf_filter = NULL;
+    /* flows still in the table keep a reference to it */
+    FlowBypassTableRelease(ptv->bypass_table);
+    ptv->bypass_table = NULL;
     if ((ptv->flags & AFP_TPACKET_V3) && ptv->ring.v3) {
         SCFree(ptv->ring.v3);
     } else {
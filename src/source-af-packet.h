@@ -64,6 +64,7 @@ struct ebpf_timeout_config {
 #define AFP_MMAP_LOCKED (1<<6)
 #define AFP_BYPASS   (1<<7)
 #define AFP_XDPBYPASS   (1<<8)
+#define AFP_CHECKSUM_TRUST_NIC (1<<9)
 
 #define AFP_COPY_MODE_NONE  0
 #define AFP_COPY_MODE_TAP   1
@@ -108,6 +109,8 @@ typedef struct AFPIfaceConfig_
     const char *xdp_filter_file;
     int xdp_filter_fd;
     uint8_t xdp_mode;
+    /* flows in the userspace bypass table, 0 if not used */
+    int bypass_table_size;
     const char *out_iface;
 #ifdef HAVE_PACKET_EBPF
     struct ebpf_timeout_config ebpf_t_config;
@@ -149,6 +152,8 @@ typedef struct AFPPacketVars_
      */
     AFPPeer *mpeer;
     uint8_t copy_mode;
+    /** userspace bypass table of the capture thread */
+    struct FlowBypassTable_ *bypass_table;
 #ifdef HAVE_PACKET_EBPF
     int v4_map_fd;
     int v6_map_fd;
@@ -162,6 +167,7 @@ typedef struct AFPPacketVars_
     (afpv)->copy_mode = 0;                \
     (afpv)->peer = NULL;                  \
     (afpv)->mpeer = NULL;                 \
+    (afpv)->bypass_table = NULL;          \
     (afpv)->v4_map_fd = -1;               \
     (afpv)->v6_map_fd = -1;               \
 } while(0)
@@ -171,6 +177,7 @@ typedef struct AFPPacketVars_
     (afpv)->copy_mode = 0;                \
     (afpv)->peer = NULL;                  \
     (afpv)->mpeer = NULL;                 \
+    (afpv)->bypass_table = NULL;          \
 } while(0)
 #endif
 
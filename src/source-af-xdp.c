@@ -0,0 +1,1037 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ *  \defgroup afxdp AF_XDP running mode
+ *
+ *  @{
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket acquisition support
+ *
+ * Each thread owns an AF_XDP socket bound to one queue of the interface.
+ * The socket has its own UMEM: the kernel writes the packets in the UMEM
+ * frames we put in the fill ring and passes them to us in the RX ring.
+ * In workers mode the packets point into the frames, which go back to the
+ * fill ring when the packets are released. Other runmodes copy the data
+ * as the packets are released by other threads.
+ *
+ * In IPS and TAP mode the packets are sent through the TX ring of the
+ * socket of the copy-iface on the same queue.
+ */
+
+#define PCAP_DONT_INCLUDE_PCAP_BPF_H 1
+#define SC_PCAP_DONT_INCLUDE_PCAP_H 1
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "decode.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "conf.h"
+#include "util-debug.h"
+#include "util-device.h"
+#include "util-error.h"
+#include "util-privs.h"
+#include "util-optimize.h"
+#include "util-checksum.h"
+#include "util-validate.h"
+#include "util-ebpf.h"
+
+#include "tmqh-packetpool.h"
+#include "source-af-xdp.h"
+#include "runmodes.h"
+
+#ifdef HAVE_AF_XDP
+
+#if HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#if HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+
+#ifdef HAVE_NET_IF_H
+#include <net/if.h>
+#endif
+
+#include <poll.h>
+#include <bpf/bpf.h>
+#include <bpf/xsk.h>
+
+struct bpf_program {
+    unsigned int bf_len;
+    struct bpf_insn *bf_insns;
+};
+
+#ifdef HAVE_PCAP_H
+#include <pcap.h>
+#endif
+
+#ifdef HAVE_PCAP_PCAP_H
+#include <pcap/pcap.h>
+#endif
+
+#include "util-bpf.h"
+#include "util-ioctl.h"
+
+#endif /* HAVE_AF_XDP */
+
+#ifndef HAVE_AF_XDP
+
+/**
+ * \brief this function prints an error message and exits.
+ */
+static TmEcode NoAFXDPSupportExit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCLogError(SC_ERR_NO_AF_XDP, "Error creating thread %s: you do not have "
+            "support for AF_XDP enabled, please recompile with --enable-ebpf "
+            "and a libbpf providing bpf/xsk.h", tv->name);
+    exit(EXIT_FAILURE);
+}
+
+void TmModuleReceiveAFXDPRegister(void)
+{
+    tmm_modules[TMM_RECEIVEAFXDP].name = "ReceiveAFXDP";
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadInit = NoAFXDPSupportExit;
+    tmm_modules[TMM_RECEIVEAFXDP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeAFXDP.
+ */
+void TmModuleDecodeAFXDPRegister(void)
+{
+    tmm_modules[TMM_DECODEAFXDP].name = "DecodeAFXDP";
+    tmm_modules[TMM_DECODEAFXDP].ThreadInit = NoAFXDPSupportExit;
+    tmm_modules[TMM_DECODEAFXDP].flags = TM_FLAG_DECODE_TM;
+}
+
+void AFXDPSocketsListClean(void)
+{
+}
+
+#else /* We have AF_XDP support */
+
+#define POLL_TIMEOUT 100
+
+#ifndef IFF_PPROMISC
+#define IFF_PPROMISC IFF_PROMISC
+#endif
+
+/* XDP_STATISTICS as filled by recent kernels. Kernels before 5.9 only
+ * fill the first three fields and count all drops in rx_dropped. */
+struct afxdp_statistics {
+    uint64_t rx_dropped;
+    uint64_t rx_invalid_descs;
+    uint64_t tx_invalid_descs;
+    uint64_t rx_ring_full;
+    uint64_t rx_fill_ring_empty_descs;
+    uint64_t tx_ring_empty_descs;
+};
+
+/**
+ * \brief AF_XDP socket and its UMEM, one per thread
+ */
+typedef struct AFXDPSocket_
+{
+    char iface[AFXDP_IFACE_NAME_LENGTH];
+    uint32_t queue_id;
+    uint32_t frame_size;
+
+    struct xsk_socket *xsk;
+    struct xsk_umem *umem;
+    uint8_t *umem_area;
+    size_t umem_size;
+    /* xsks_map of our XDP filter, -1 if libbpf loaded its own program */
+    int xsks_map_fd;
+
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod fill;
+    struct xsk_ring_cons comp;
+    struct xsk_ring_prod tx;
+
+    /* The TX ring is fed by the threads of the peer interface in IPS and
+     * TAP mode, so the TX and completion rings and the TX frames are
+     * protected by tx_lock. */
+    SCMutex tx_lock;
+    uint64_t *tx_free;
+    uint32_t tx_free_cnt;
+    uint32_t tx_outstanding;
+    bool has_tx;
+    bool need_wakeup;
+    /* set when the owning thread is done, the structure itself stays
+     * around until AFXDPSocketsListClean() as peers may point to it */
+    bool closed;
+
+    TAILQ_ENTRY(AFXDPSocket_) next;
+} AFXDPSocket;
+
+/**
+ * \brief Module thread local variables.
+ */
+typedef struct AFXDPThreadVars_
+{
+    AFXDPSocket *sock;
+    /* socket of the copy-iface on the same queue, looked up when the
+     * first packet is sent */
+    AFXDPSocket *peer;
+
+    /* suricata internals */
+    TmSlot *slot;
+    ThreadVars *tv;
+    LiveDevice *livedev;
+
+    char iface[AFXDP_IFACE_NAME_LENGTH];
+    char out_iface[AFXDP_IFACE_NAME_LENGTH];
+    uint32_t queue_id;
+    uint32_t frame_size;
+    uint32_t batch_size;
+
+    /* copy from config */
+    int flags;
+    int copy_mode;
+    ChecksumValidationMode checksum_mode;
+    struct bpf_program bpf_prog;
+
+    /* packets point into the UMEM frames instead of holding a copy */
+    bool in_umem;
+
+    /* RX frames owned by us, waiting to go back to the fill ring */
+    uint64_t *recycle;
+    uint32_t recycle_cnt;
+
+#ifdef HAVE_PACKET_EBPF
+    int v4_map_fd;
+    int v6_map_fd;
+    unsigned int nr_cpus;
+#endif
+
+    /* counters */
+    uint64_t pkts;
+    uint64_t pkts_dumped;
+    uint64_t bytes;
+    uint64_t tx_drops;
+    /* drops reported by the kernel so far */
+    uint64_t kernel_drops;
+
+    uint16_t capture_kernel_packets;
+    uint16_t capture_kernel_drops;
+    uint16_t capture_tx_drops;
+} AFXDPThreadVars;
+
+typedef TAILQ_HEAD(AFXDPSocketList_, AFXDPSocket_) AFXDPSocketList;
+
+static AFXDPSocketList afxdp_sockets = TAILQ_HEAD_INITIALIZER(afxdp_sockets);
+static SCMutex afxdp_sockets_lock = SCMUTEX_INITIALIZER;
+
+static bool g_afxdp_flowv4_ok = true;
+static bool g_afxdp_flowv6_ok = true;
+
+/**
+ * \brief Create the UMEM and the socket for a queue of an interface.
+ *
+ * \param tx set up a TX ring for the packets of the peer interface
+ */
+static AFXDPSocket *AFXDPSocketOpen(const AFXDPIfaceConfig *aconf,
+        uint32_t queue_id, bool tx)
+{
+    int if_flags = GetIfaceFlags(aconf->iface);
+    if (if_flags == -1) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "Can not access interface '%s'",
+                aconf->iface);
+        return NULL;
+    }
+    if ((if_flags & IFF_UP) == 0) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "interface '%s' is down",
+                aconf->iface);
+        return NULL;
+    }
+    /* if needed, try to set iface in promisc mode */
+    if (aconf->promisc && (if_flags & (IFF_PROMISC|IFF_PPROMISC)) == 0) {
+        if_flags |= IFF_PPROMISC;
+        SetIfaceFlags(aconf->iface, if_flags);
+    }
+
+    AFXDPSocket *s = SCCalloc(1, sizeof(*s));
+    if (unlikely(s == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+        return NULL;
+    }
+    strlcpy(s->iface, aconf->iface, sizeof(s->iface));
+    s->queue_id = queue_id;
+    s->frame_size = aconf->frame_size;
+    s->xsks_map_fd = -1;
+    SCMutexInit(&s->tx_lock, NULL);
+
+    /* RX frames are twice the ring size so the fill ring can be kept
+     * full while packets hold frames. TX frames follow them. */
+    const uint32_t rx_frames = 2 * aconf->ring_size;
+    const uint32_t tx_frames = tx ? aconf->ring_size : 0;
+    s->umem_size = (size_t)(rx_frames + tx_frames) * aconf->frame_size;
+    s->umem_area = mmap(NULL, s->umem_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (s->umem_area == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "%s: failed to allocate UMEM of %"PRIuMAX
+                " bytes: %s", aconf->iface, (uintmax_t)s->umem_size,
+                strerror(errno));
+        s->umem_area = NULL;
+        goto error;
+    }
+
+    struct xsk_umem_config ucfg = {
+        .fill_size = aconf->ring_size,
+        .comp_size = aconf->ring_size,
+        .frame_size = aconf->frame_size,
+        .frame_headroom = 0,
+    };
+    int r = xsk_umem__create(&s->umem, s->umem_area, s->umem_size,
+            &s->fill, &s->comp, &ucfg);
+    if (r != 0) {
+        SCLogError(SC_ERR_AF_XDP_CREATE, "%s: failed to create UMEM: %s",
+                aconf->iface, strerror(-r));
+        goto error;
+    }
+
+    struct xsk_socket_config scfg = {
+        .rx_size = aconf->ring_size,
+        .tx_size = aconf->ring_size,
+        .xdp_flags = aconf->xdp_mode,
+        .bind_flags = aconf->bind_flags,
+    };
+    /* with our own XDP filter the socket is added to its xsks_map below,
+     * else libbpf loads a program redirecting all packets to the sockets */
+    if (aconf->xdp_filter_file != NULL) {
+        scfg.libbpf_flags = XSK_LIBBPF_FLAGS__INHIBIT_PROG_LOAD;
+    }
+#ifdef XDP_USE_NEED_WAKEUP
+    scfg.bind_flags |= XDP_USE_NEED_WAKEUP;
+    s->need_wakeup = true;
+retry:
+#endif
+    r = xsk_socket__create(&s->xsk, aconf->iface, queue_id, s->umem,
+            &s->rx, tx ? &s->tx : NULL, &scfg);
+    if (r != 0) {
+#ifdef XDP_USE_NEED_WAKEUP
+        /* kernels before 5.4 don't know the flag */
+        if (r == -EINVAL && s->need_wakeup) {
+            scfg.bind_flags &= ~XDP_USE_NEED_WAKEUP;
+            s->need_wakeup = false;
+            goto retry;
+        }
+#endif
+        SCLogError(SC_ERR_AF_XDP_CREATE, "%s: failed to create AF_XDP socket "
+                "on queue %u: %s", aconf->iface, queue_id, strerror(-r));
+        goto error;
+    }
+
+    if (aconf->xdp_filter_file != NULL) {
+        s->xsks_map_fd = EBPFGetMapFDByName(aconf->iface, "xsks_map");
+        if (s->xsks_map_fd == -1) {
+            SCLogError(SC_ERR_AF_XDP_CREATE, "%s: XDP filter %s has no "
+                    "'xsks_map' to redirect the packets to the sockets",
+                    aconf->iface, aconf->xdp_filter_file);
+            goto error;
+        }
+        int fd = xsk_socket__fd(s->xsk);
+        if (bpf_map_update_elem(s->xsks_map_fd, &queue_id, &fd, 0) != 0) {
+            SCLogError(SC_ERR_AF_XDP_CREATE, "%s: failed to add the socket of "
+                    "queue %u to the XDP filter: %s", aconf->iface, queue_id,
+                    strerror(errno));
+            goto error;
+        }
+    }
+
+    if (tx) {
+        s->tx_free = SCCalloc(tx_frames, sizeof(uint64_t));
+        if (unlikely(s->tx_free == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+            goto error;
+        }
+        for (uint32_t i = 0; i < tx_frames; i++) {
+            s->tx_free[i] = (uint64_t)(rx_frames + i) * aconf->frame_size;
+        }
+        s->tx_free_cnt = tx_frames;
+        s->has_tx = true;
+    }
+
+    SCMutexLock(&afxdp_sockets_lock);
+    TAILQ_INSERT_TAIL(&afxdp_sockets, s, next);
+    SCMutexUnlock(&afxdp_sockets_lock);
+    return s;
+
+error:
+    if (s->xsk != NULL)
+        xsk_socket__delete(s->xsk);
+    if (s->umem != NULL)
+        xsk_umem__delete(s->umem);
+    if (s->umem_area != NULL)
+        munmap(s->umem_area, s->umem_size);
+    SCMutexDestroy(&s->tx_lock);
+    SCFree(s);
+    return NULL;
+}
+
+/**
+ * \brief Close the socket of a thread and release its UMEM.
+ */
+static void AFXDPSocketClose(AFXDPSocket *s)
+{
+    SCMutexLock(&s->tx_lock);
+    s->closed = true;
+    if (s->xsks_map_fd != -1) {
+        (void)bpf_map_delete_elem(s->xsks_map_fd, &s->queue_id);
+    }
+    xsk_socket__delete(s->xsk);
+    xsk_umem__delete(s->umem);
+    munmap(s->umem_area, s->umem_size);
+    s->xsk = NULL;
+    s->umem = NULL;
+    s->umem_area = NULL;
+    SCFree(s->tx_free);
+    s->tx_free = NULL;
+    s->tx_free_cnt = 0;
+    SCMutexUnlock(&s->tx_lock);
+}
+
+/**
+ * \brief Find the socket of an interface queue that can send packets.
+ */
+static AFXDPSocket *AFXDPSocketLookup(const char *iface, uint32_t queue_id)
+{
+    AFXDPSocket *s;
+
+    SCMutexLock(&afxdp_sockets_lock);
+    TAILQ_FOREACH(s, &afxdp_sockets, next) {
+        if (s->has_tx && s->queue_id == queue_id &&
+                strcmp(s->iface, iface) == 0) {
+            break;
+        }
+    }
+    SCMutexUnlock(&afxdp_sockets_lock);
+    return s;
+}
+
+/**
+ * \brief Free the sockets at exit, after all threads are done.
+ */
+void AFXDPSocketsListClean(void)
+{
+    AFXDPSocket *s;
+
+    SCMutexLock(&afxdp_sockets_lock);
+    while ((s = TAILQ_FIRST(&afxdp_sockets))) {
+        TAILQ_REMOVE(&afxdp_sockets, s, next);
+        SCMutexDestroy(&s->tx_lock);
+        SCFree(s);
+    }
+    SCMutexUnlock(&afxdp_sockets_lock);
+}
+
+static inline void AFXDPRecycleFrame(AFXDPThreadVars *ptv, uint64_t addr)
+{
+    ptv->recycle[ptv->recycle_cnt++] = addr;
+}
+
+/**
+ * \brief Give the frames we are done with back to the kernel.
+ */
+static void AFXDPRefill(AFXDPThreadVars *ptv)
+{
+    AFXDPSocket *s = ptv->sock;
+    uint32_t n = ptv->recycle_cnt;
+    uint32_t idx;
+    size_t r;
+
+    if (n == 0)
+        return;
+
+    /* reserve is all or nothing, retry with less while the fill
+     * ring has no room for all frames */
+    while ((r = xsk_ring_prod__reserve(&s->fill, n, &idx)) == 0) {
+        n /= 2;
+        if (n == 0)
+            return;
+    }
+    for (size_t i = 0; i < r; i++) {
+        *xsk_ring_prod__fill_addr(&s->fill, idx++) =
+            ptv->recycle[--ptv->recycle_cnt];
+    }
+    xsk_ring_prod__submit(&s->fill, r);
+}
+
+/**
+ * \brief Move the frames the kernel is done sending back to the free
+ *        list. Called with tx_lock held.
+ */
+static void AFXDPReclaimTx(AFXDPSocket *s)
+{
+    uint32_t idx;
+
+    if (s->tx_outstanding == 0)
+        return;
+
+    size_t n = xsk_ring_cons__peek(&s->comp, s->tx_outstanding, &idx);
+    for (size_t i = 0; i < n; i++) {
+        s->tx_free[s->tx_free_cnt++] = *xsk_ring_cons__comp_addr(&s->comp, idx++);
+    }
+    xsk_ring_cons__release(&s->comp, n);
+    s->tx_outstanding -= n;
+}
+
+/**
+ * \brief Send a packet on the copy-iface, or drop it in IPS mode.
+ */
+static void AFXDPWritePacket(AFXDPThreadVars *ptv, Packet *p)
+{
+    if (ptv->copy_mode == AFXDP_COPY_MODE_IPS) {
+        if (PACKET_TEST_ACTION(p, ACTION_DROP)) {
+            return;
+        }
+    }
+
+    AFXDPSocket *peer = ptv->peer;
+    if (unlikely(peer == NULL)) {
+        peer = ptv->peer = AFXDPSocketLookup(ptv->out_iface, ptv->queue_id);
+        if (peer == NULL) {
+            ptv->tx_drops++;
+            return;
+        }
+    }
+
+    const uint32_t len = GET_PKT_LEN(p);
+    uint32_t idx;
+
+    SCMutexLock(&peer->tx_lock);
+    if (peer->closed || len > peer->frame_size) {
+        goto drop;
+    }
+    AFXDPReclaimTx(peer);
+    if (peer->tx_free_cnt == 0 ||
+            xsk_ring_prod__reserve(&peer->tx, 1, &idx) != 1) {
+        goto drop;
+    }
+
+    const uint64_t addr = peer->tx_free[--peer->tx_free_cnt];
+    memcpy(xsk_umem__get_data(peer->umem_area, addr), GET_PKT_DATA(p), len);
+    struct xdp_desc *desc = xsk_ring_prod__tx_desc(&peer->tx, idx);
+    desc->addr = addr;
+    desc->len = len;
+    xsk_ring_prod__submit(&peer->tx, 1);
+    peer->tx_outstanding++;
+
+    if (!peer->need_wakeup || xsk_ring_prod__needs_wakeup(&peer->tx)) {
+        if (sendto(xsk_socket__fd(peer->xsk), NULL, 0, MSG_DONTWAIT,
+                    NULL, 0) < 0) {
+            SCLogDebug("sendto on %s failed: %s", peer->iface, strerror(errno));
+        }
+    }
+    SCMutexUnlock(&peer->tx_lock);
+    return;
+
+drop:
+    SCMutexUnlock(&peer->tx_lock);
+    ptv->tx_drops++;
+}
+
+/**
+ * \brief Packet release routine.
+ * \param p Packet.
+ */
+static void AFXDPReleasePacket(Packet *p)
+{
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)p->afxdp_v.ptv;
+
+    if ((ptv->copy_mode != AFXDP_COPY_MODE_NONE) && !PKT_IS_PSEUDOPKT(p)) {
+        AFXDPWritePacket(ptv, p);
+    }
+
+    if (p->afxdp_v.in_umem) {
+        AFXDPRecycleFrame(ptv, p->afxdp_v.addr);
+        p->afxdp_v.in_umem = false;
+    }
+
+    PacketFreeOrRelease(p);
+}
+
+static int AFXDPBypassCallback(Packet *p)
+{
+#ifdef HAVE_PACKET_XDP
+    return EBPFXDPBypassFlow(p, p->afxdp_v.v4_map_fd, p->afxdp_v.v6_map_fd,
+                             p->afxdp_v.nr_cpus);
+#else
+    return 0;
+#endif
+}
+
+static void AFXDPProcessFrame(AFXDPThreadVars *ptv, uint64_t addr,
+        uint32_t len, const struct timeval *ts)
+{
+    uint8_t *data = xsk_umem__get_data(ptv->sock->umem_area, addr);
+    const uint64_t frame = addr & ~((uint64_t)ptv->frame_size - 1);
+
+    ptv->pkts++;
+    ptv->bytes += len;
+
+    if (ptv->bpf_prog.bf_len) {
+        struct pcap_pkthdr pkthdr = { {0, 0}, len, len };
+        if (pcap_offline_filter(&ptv->bpf_prog, &pkthdr, data) == 0) {
+            AFXDPRecycleFrame(ptv, frame);
+            return;
+        }
+    }
+
+    Packet *p = PacketGetFromQueueOrAlloc();
+    if (unlikely(p == NULL)) {
+        AFXDPRecycleFrame(ptv, frame);
+        return;
+    }
+
+    PKT_SET_SRC(p, PKT_SRC_WIRE);
+    p->livedev = ptv->livedev;
+    p->datalink = LINKTYPE_ETHERNET;
+    p->ts = *ts;
+
+    if (ptv->in_umem) {
+        if (PacketSetData(p, data, len) == -1) {
+            AFXDPRecycleFrame(ptv, frame);
+            TmqhOutputPacketpool(ptv->tv, p);
+            return;
+        }
+        p->afxdp_v.addr = frame;
+        p->afxdp_v.in_umem = true;
+    } else {
+        int r = PacketCopyData(p, data, len);
+        AFXDPRecycleFrame(ptv, frame);
+        if (r == -1) {
+            TmqhOutputPacketpool(ptv->tv, p);
+            return;
+        }
+        p->afxdp_v.in_umem = false;
+    }
+
+    p->ReleasePacket = AFXDPReleasePacket;
+    p->afxdp_v.ptv = ptv;
+#ifdef HAVE_PACKET_EBPF
+    if (ptv->flags & AFXDP_XDPBYPASS) {
+        p->BypassPacketsFlow = AFXDPBypassCallback;
+        p->afxdp_v.v4_map_fd = ptv->v4_map_fd;
+        p->afxdp_v.v6_map_fd = ptv->v6_map_fd;
+        p->afxdp_v.nr_cpus = ptv->nr_cpus;
+    }
+#endif
+
+    if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+        if (ptv->livedev->ignore_checksum) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (ChecksumAutoModeCheck(ptv->pkts,
+                                          SC_ATOMIC_GET(ptv->livedev->pkts),
+                                          SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+            ptv->livedev->ignore_checksum = 1;
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+    }
+
+    SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
+            GET_PKT_LEN(p), p, GET_PKT_DATA(p));
+
+    if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+        TmqhOutputPacketpool(ptv->tv, p);
+    }
+}
+
+/**
+ * \brief Update the capture counters, reading the drops from the socket.
+ */
+static void AFXDPDumpCounters(AFXDPThreadVars *ptv)
+{
+    struct afxdp_statistics kstats;
+    socklen_t len = sizeof(kstats);
+
+    memset(&kstats, 0, sizeof(kstats));
+    if (getsockopt(xsk_socket__fd(ptv->sock->xsk), SOL_XDP, XDP_STATISTICS,
+                &kstats, &len) == 0) {
+        const uint64_t drops = kstats.rx_dropped + kstats.rx_ring_full;
+        const uint64_t delta = drops - ptv->kernel_drops;
+        ptv->kernel_drops = drops;
+        StatsAddUI64(ptv->tv, ptv->capture_kernel_drops, delta);
+        (void) SC_ATOMIC_ADD(ptv->livedev->drop, delta);
+    }
+
+    const uint64_t pkts = ptv->pkts - ptv->pkts_dumped;
+    ptv->pkts_dumped = ptv->pkts;
+    StatsAddUI64(ptv->tv, ptv->capture_kernel_packets, pkts);
+    (void) SC_ATOMIC_ADD(ptv->livedev->pkts, pkts);
+
+    if (ptv->copy_mode != AFXDP_COPY_MODE_NONE) {
+        StatsAddUI64(ptv->tv, ptv->capture_tx_drops, ptv->tx_drops);
+        ptv->tx_drops = 0;
+    }
+}
+
+/**
+ * \brief Init function for ReceiveAFXDP.
+ * \param tv pointer to ThreadVars
+ * \param initdata pointer to the interface passed from the user
+ * \param data pointer gets populated with AFXDPThreadVars
+ */
+static TmEcode ReceiveAFXDPThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+    AFXDPIfaceConfig *aconf = (AFXDPIfaceConfig *)initdata;
+
+    if (initdata == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "initdata == NULL");
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    AFXDPThreadVars *ptv = SCCalloc(1, sizeof(*ptv));
+    if (unlikely(ptv == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+        goto error;
+    }
+
+    ptv->tv = tv;
+    strlcpy(ptv->iface, aconf->iface, sizeof(ptv->iface));
+    ptv->queue_id = SC_ATOMIC_ADD(aconf->queue_next, 1) - 1;
+    ptv->frame_size = aconf->frame_size;
+    ptv->batch_size = aconf->batch_size;
+    ptv->flags = aconf->flags;
+    ptv->copy_mode = aconf->copy_mode;
+    ptv->checksum_mode = aconf->checksum_mode;
+    if (ptv->copy_mode != AFXDP_COPY_MODE_NONE) {
+        strlcpy(ptv->out_iface, aconf->out_iface, sizeof(ptv->out_iface));
+    }
+
+    ptv->livedev = LiveGetDevice(aconf->iface);
+    if (ptv->livedev == NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Unable to find Live device");
+        goto error_ptv;
+    }
+
+    /* in workers mode the packets are released by this thread, so they
+     * can point into the frames until then */
+    if (strcmp("workers", RunmodeGetActive()) == 0) {
+        ptv->in_umem = true;
+    }
+
+    ptv->sock = AFXDPSocketOpen(aconf, ptv->queue_id,
+            aconf->copy_mode != AFXDP_COPY_MODE_NONE);
+    if (ptv->sock == NULL) {
+        goto error_ptv;
+    }
+
+    /* all RX frames start out with us, the fill ring takes what fits */
+    const uint32_t rx_frames = 2 * aconf->ring_size;
+    ptv->recycle = SCCalloc(rx_frames, sizeof(uint64_t));
+    if (unlikely(ptv->recycle == NULL)) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Memory allocation failed");
+        goto error_sock;
+    }
+    for (uint32_t i = rx_frames; i > 0; i--) {
+        AFXDPRecycleFrame(ptv, (uint64_t)(i - 1) * aconf->frame_size);
+    }
+    AFXDPRefill(ptv);
+
+    ptv->capture_kernel_packets = StatsRegisterCounter("capture.kernel_packets",
+            ptv->tv);
+    ptv->capture_kernel_drops = StatsRegisterCounter("capture.kernel_drops",
+            ptv->tv);
+    if (ptv->copy_mode != AFXDP_COPY_MODE_NONE) {
+        ptv->capture_tx_drops = StatsRegisterCounter("capture.afxdp.tx_drops",
+                ptv->tv);
+    }
+
+    if (aconf->bpf_filter) {
+        SCLogConfig("Using BPF '%s' on iface '%s'",
+                  aconf->bpf_filter, ptv->iface);
+        char errbuf[PCAP_ERRBUF_SIZE];
+        if (SCBPFCompile(default_packet_size,  /* snaplen_arg */
+                    LINKTYPE_ETHERNET,    /* linktype_arg */
+                    &ptv->bpf_prog,       /* program */
+                    aconf->bpf_filter,    /* const char *buf */
+                    1,                    /* optimize */
+                    PCAP_NETMASK_UNKNOWN,  /* mask */
+                    errbuf,
+                    sizeof(errbuf)) == -1)
+        {
+            SCLogError(SC_ERR_AF_XDP_CREATE, "Failed to compile BPF \"%s\": %s",
+                   aconf->bpf_filter,
+                   errbuf);
+            goto error_recycle;
+        }
+    }
+
+#ifdef HAVE_PACKET_EBPF
+    ptv->v4_map_fd = -1;
+    ptv->v6_map_fd = -1;
+    if (ptv->flags & AFXDP_XDPBYPASS) {
+        ptv->nr_cpus = aconf->ebpf_t_config.cpus_count;
+        ptv->v4_map_fd = EBPFGetMapFDByName(ptv->iface, "flow_table_v4");
+        if (ptv->v4_map_fd == -1 && g_afxdp_flowv4_ok) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Can't find eBPF map fd for '%s'",
+                       "flow_table_v4");
+            g_afxdp_flowv4_ok = false;
+        }
+        ptv->v6_map_fd = EBPFGetMapFDByName(ptv->iface, "flow_table_v6");
+        if (ptv->v6_map_fd == -1 && g_afxdp_flowv6_ok) {
+            SCLogError(SC_ERR_INVALID_VALUE, "Can't find eBPF map fd for '%s'",
+                       "flow_table_v6");
+            g_afxdp_flowv6_ok = false;
+        }
+    }
+#endif
+
+    SCLogConfig("%s: AF_XDP socket on queue %u, packets %s", ptv->iface,
+            ptv->queue_id, ptv->in_umem ? "read in place" : "copied");
+
+    *data = (void *)ptv;
+    aconf->DerefFunc(aconf);
+    SCReturnInt(TM_ECODE_OK);
+
+error_recycle:
+    SCFree(ptv->recycle);
+error_sock:
+    AFXDPSocketClose(ptv->sock);
+error_ptv:
+    SCFree(ptv);
+error:
+    aconf->DerefFunc(aconf);
+    SCReturnInt(TM_ECODE_FAILED);
+}
+
+/**
+ *  \brief Main AF_XDP reading loop function
+ *
+ *  The RX ring is read in batches of up to batch-size frames, with one
+ *  timestamp and one ring update per batch.
+ */
+static TmEcode ReceiveAFXDPLoop(ThreadVars *tv, void *data, void *slot)
+{
+    SCEnter();
+
+    TmSlot *s = (TmSlot *)slot;
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+    AFXDPSocket *sock = ptv->sock;
+    struct pollfd fds;
+
+    ptv->slot = s->slot_next;
+    fds.fd = xsk_socket__fd(sock->xsk);
+    fds.events = POLLIN;
+
+    for(;;) {
+        if (unlikely(suricata_ctl_flags != 0)) {
+            break;
+        }
+
+        /* make sure we have at least one packet in the packet pool,
+         * to prevent us from alloc'ing packets at line rate */
+        PacketPoolWait();
+
+        AFXDPRefill(ptv);
+
+        uint32_t idx;
+        const size_t rcvd = xsk_ring_cons__peek(&sock->rx, ptv->batch_size, &idx);
+        if (rcvd == 0) {
+            /* poll also wakes up the driver if it waits for fill ring
+             * entries in need wakeup mode */
+            int r = poll(&fds, 1, POLL_TIMEOUT);
+            if (r < 0) {
+                if (errno != EINTR)
+                    SCLogError(SC_ERR_AF_XDP_READ,
+                            "Error polling AF_XDP socket of iface '%s': %s",
+                            ptv->iface, strerror(errno));
+            } else if (r == 0) {
+                /* sync counters */
+                AFXDPDumpCounters(ptv);
+                StatsSyncCountersIfSignalled(tv);
+
+                /* poll timed out, lets handle the timeout */
+                TmThreadsCaptureHandleTimeout(tv, ptv->slot, NULL);
+            } else if (unlikely(fds.revents & (POLLERR|POLLNVAL))) {
+                SCLogError(SC_ERR_AF_XDP_READ,
+                        "Error on AF_XDP socket of iface '%s'", ptv->iface);
+            }
+            continue;
+        }
+
+        struct timeval ts;
+        gettimeofday(&ts, NULL);
+        for (size_t i = 0; i < rcvd; i++) {
+            const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&sock->rx, idx + i);
+            AFXDPProcessFrame(ptv, desc->addr, desc->len, &ts);
+        }
+        xsk_ring_cons__release(&sock->rx, rcvd);
+
+        if (unlikely(tv->perf_public_ctx.perf_flag == 1)) {
+            AFXDPDumpCounters(ptv);
+        }
+        StatsSyncCountersIfSignalled(tv);
+    }
+
+    AFXDPDumpCounters(ptv);
+    StatsSyncCountersIfSignalled(tv);
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function prints stats to the screen at exit.
+ * \param tv pointer to ThreadVars
+ * \param data pointer that gets cast into AFXDPThreadVars for ptv
+ */
+static void ReceiveAFXDPThreadExitStats(ThreadVars *tv, void *data)
+{
+    SCEnter();
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+
+    AFXDPDumpCounters(ptv);
+    SCLogPerf("(%s) Kernel: Packets %" PRIu64 ", dropped %" PRIu64 ", bytes %" PRIu64 "",
+              tv->name,
+              StatsGetLocalCounterValue(tv, ptv->capture_kernel_packets),
+              StatsGetLocalCounterValue(tv, ptv->capture_kernel_drops),
+              ptv->bytes);
+}
+
+/**
+ * \brief
+ * \param tv
+ * \param data Pointer to AFXDPThreadVars.
+ */
+static TmEcode ReceiveAFXDPThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+
+    AFXDPThreadVars *ptv = (AFXDPThreadVars *)data;
+
+    if (ptv->sock) {
+        AFXDPSocketClose(ptv->sock);
+        ptv->sock = NULL;
+    }
+    if (ptv->bpf_prog.bf_insns) {
+        SCBPFFree(&ptv->bpf_prog);
+    }
+    SCFree(ptv->recycle);
+    SCFree(ptv);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Prepare AF_XDP decode thread.
+ * \param tv Thread local avariables.
+ * \param initdata Thread config.
+ * \param data Pointer to DecodeThreadVars placed here.
+ */
+static TmEcode DecodeAFXDPThreadInit(ThreadVars *tv, const void *initdata, void **data)
+{
+    SCEnter();
+
+    DecodeThreadVars *dtv = DecodeThreadVarsAlloc(tv);
+    if (dtv == NULL)
+        SCReturnInt(TM_ECODE_FAILED);
+
+    DecodeRegisterPerfCounters(dtv, tv);
+
+    *data = (void *)dtv;
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief This function passes off to link type decoders.
+ *
+ * \param t pointer to ThreadVars
+ * \param p pointer to the current packet
+ * \param data pointer that gets cast into DecodeThreadVars
+ * \param pq pointer to the current PacketQueue
+ * \param postpq
+ */
+static TmEcode DecodeAFXDP(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+
+    /* XXX HACK: flow timeout can call us for injected pseudo packets
+     *           see bug: https://redmine.openinfosecfoundation.org/issues/1107 */
+    if (p->flags & PKT_PSEUDO_STREAM_END)
+        SCReturnInt(TM_ECODE_OK);
+
+    /* update counters */
+    DecodeUpdatePacketCounters(tv, dtv, p);
+
+    DecodeEthernet(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+
+    PacketDecodeFinalize(tv, dtv, p);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief
+ * \param tv
+ * \param data Pointer to DecodeThreadVars.
+ */
+static TmEcode DecodeAFXDPThreadDeinit(ThreadVars *tv, void *data)
+{
+    SCEnter();
+
+    if (data != NULL)
+        DecodeThreadVarsFree(tv, data);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Registration Function for ReceiveAFXDP.
+ */
+void TmModuleReceiveAFXDPRegister(void)
+{
+    tmm_modules[TMM_RECEIVEAFXDP].name = "ReceiveAFXDP";
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadInit = ReceiveAFXDPThreadInit;
+    tmm_modules[TMM_RECEIVEAFXDP].PktAcqLoop = ReceiveAFXDPLoop;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadExitPrintStats = ReceiveAFXDPThreadExitStats;
+    tmm_modules[TMM_RECEIVEAFXDP].ThreadDeinit = ReceiveAFXDPThreadDeinit;
+    tmm_modules[TMM_RECEIVEAFXDP].cap_flags = SC_CAP_NET_RAW;
+    tmm_modules[TMM_RECEIVEAFXDP].flags = TM_FLAG_RECEIVE_TM;
+}
+
+/**
+ * \brief Registration Function for DecodeAFXDP.
+ */
+void TmModuleDecodeAFXDPRegister(void)
+{
+    tmm_modules[TMM_DECODEAFXDP].name = "DecodeAFXDP";
+    tmm_modules[TMM_DECODEAFXDP].ThreadInit = DecodeAFXDPThreadInit;
+    tmm_modules[TMM_DECODEAFXDP].Func = DecodeAFXDP;
+    tmm_modules[TMM_DECODEAFXDP].ThreadDeinit = DecodeAFXDPThreadDeinit;
+    tmm_modules[TMM_DECODEAFXDP].cap_flags = 0;
+    tmm_modules[TMM_DECODEAFXDP].flags = TM_FLAG_DECODE_TM;
+}
+
+#endif /* HAVE_AF_XDP */
+
+/**
+ * @}
+ */
@@ -0,0 +1,93 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * AF_XDP socket acquisition support
+ */
+
+#ifndef __SOURCE_AF_XDP_H__
+#define __SOURCE_AF_XDP_H__
+
+#include "source-af-packet.h"
+
+/* copy modes */
+#define AFXDP_COPY_MODE_NONE    0
+#define AFXDP_COPY_MODE_TAP     1
+#define AFXDP_COPY_MODE_IPS     2
+
+/* value for flags */
+#define AFXDP_XDPBYPASS         (1<<0)
+
+#define AFXDP_IFACE_NAME_LENGTH 48
+
+#define AFXDP_RING_SIZE_DEFAULT     2048
+#define AFXDP_FRAME_SIZE_DEFAULT    2048
+#define AFXDP_BATCH_SIZE_DEFAULT    64
+
+typedef struct AFXDPIfaceConfig_
+{
+    char iface[AFXDP_IFACE_NAME_LENGTH];
+    /* number of threads, one per queue */
+    int threads;
+    /* descriptors in each of the rings of a socket */
+    uint32_t ring_size;
+    /* size of a UMEM frame, 2048 or 4096 */
+    uint32_t frame_size;
+    /* max frames handled per pass over the RX ring */
+    uint32_t batch_size;
+    /* XDP_ZEROCOPY, XDP_COPY or 0 to let the kernel pick */
+    uint16_t bind_flags;
+    int promisc;
+    int copy_mode;
+    int flags;
+    ChecksumValidationMode checksum_mode;
+    const char *bpf_filter;
+    const char *out_iface;
+    const char *xdp_filter_file;
+    int xdp_filter_fd;
+    uint32_t xdp_mode;
+#ifdef HAVE_PACKET_EBPF
+    struct ebpf_timeout_config ebpf_t_config;
+#endif
+    /* queue of the next thread to start */
+    SC_ATOMIC_DECLARE(unsigned int, queue_next);
+    SC_ATOMIC_DECLARE(unsigned int, ref);
+    void (*DerefFunc)(void *);
+} AFXDPIfaceConfig;
+
+typedef struct AFXDPPacketVars_
+{
+    /* AFXDPThreadVars */
+    void *ptv;
+    /* UMEM address of the frame for packets not copied out of it */
+    uint64_t addr;
+    bool in_umem;
+#ifdef HAVE_PACKET_EBPF
+    int v4_map_fd;
+    int v6_map_fd;
+    unsigned int nr_cpus;
+#endif
+} AFXDPPacketVars;
+
+void TmModuleReceiveAFXDPRegister(void);
+void TmModuleDecodeAFXDPRegister(void);
+
+void AFXDPSocketsListClean(void);
+
+#endif /* __SOURCE_AF_XDP_H__ */
@@ -48,6 +48,7 @@
 #include "util-cpu.h"
 #include "util-privs.h"
 #include "util-device.h"
+#include "util-unittest.h"
 
 #include "runmodes.h"
 
@@ -123,6 +124,7 @@ typedef struct NFQThreadVars_
     int datalen; /** Length of per function and thread data */
 
     CaptureStats stats;
+    uint16_t counter_verdict_latency;
 } NFQThreadVars;
 /* shared vars for all for nfq queues and threads */
 static NFQGlobalVars nfq_g;
@@ -146,6 +148,7 @@ TmEcode DecodeNFQThreadInit(ThreadVars *, const void *, void **);
 TmEcode DecodeNFQThreadDeinit(ThreadVars *tv, void *data);
 
 TmEcode NFQSetVerdict(Packet *p);
+static void NFQRegisterTests(void);
 
 typedef enum NFQMode_ {
     NFQ_ACCEPT_MODE,
@@ -154,6 +157,7 @@ typedef enum NFQMode_ {
 } NFQMode;
 
 #define NFQ_FLAG_FAIL_OPEN  (1 << 0)
+#define NFQ_FLAG_GSO        (1 << 1)
 
 typedef struct NFQCnf_ {
     NFQMode mode;
@@ -189,7 +193,7 @@ void TmModuleVerdictNFQRegister (void)
     tmm_modules[TMM_VERDICTNFQ].ThreadInit = VerdictNFQThreadInit;
     tmm_modules[TMM_VERDICTNFQ].Func = VerdictNFQ;
     tmm_modules[TMM_VERDICTNFQ].ThreadDeinit = VerdictNFQThreadDeinit;
-    tmm_modules[TMM_VERDICTNFQ].RegisterTests = NULL;
+    tmm_modules[TMM_VERDICTNFQ].RegisterTests = NFQRegisterTests;
 }
 
 void TmModuleDecodeNFQRegister (void)
@@ -242,6 +246,18 @@ void NFQInitConfig(char quiet)
 #endif
     }
 
+    boolval = 0;
+    (void)ConfGetBool("nfq.gso", (int *)&boolval);
+    if (boolval) {
+#if defined(HAVE_NFQ_SET_QUEUE_FLAGS) && defined(NFQA_CFG_F_GSO)
+        SCLogInfo("Enabling GSO packets on queue");
+        nfq_config.flags |= NFQ_FLAG_GSO;
+#else
+        SCLogError(SC_ERR_NFQ_NOSUPPORT,
+                   "nfq.%s set but NFQ library has no support for it.", "gso");
+#endif
+    }
+
     if ((ConfGetInt("nfq.repeat-mark", &value)) == 1) {
         nfq_config.mark = (uint32_t)value;
     }
@@ -294,40 +310,118 @@ void NFQInitConfig(char quiet)
 
 }
 
-static uint8_t NFQVerdictCacheLen(NFQQueueVars *t)
+#ifdef HAVE_NFQ_SET_VERDICT_BATCH
+/** max size of a verdict message without payload */
+#define NFQ_VERDICT_MSG_MAXLEN                                          \
+    (NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct nfgenmsg))) +               \
+     NLA_ALIGN(NLA_HDRLEN + sizeof(struct nfqnl_msg_verdict_hdr)) +     \
+     NLA_ALIGN(NLA_HDRLEN + sizeof(uint32_t)))
+
+static void NFQNlmsgPutAttr(struct nlmsghdr *nlh, uint16_t type,
+                            const void *data, uint16_t len)
+{
+    struct nlattr *nla = (struct nlattr *)((uint8_t *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    nla->nla_type = type;
+    nla->nla_len = NLA_HDRLEN + len;
+    memcpy((uint8_t *)nla + NLA_HDRLEN, data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+}
+
+/**
+ * \brief send the verdict messages of the ring in a single datagram
+ */
+static void NFQVerdictRingFlush(NFQQueueVars *t)
+{
+    if (t->verdict_ring.len == 0)
+        return;
+
+    struct sockaddr_nl nladdr;
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+
+    int iter = 0;
+    ssize_t ret;
+    do {
+        ret = sendto(t->fd, t->verdict_ring.buf, t->verdict_ring.used, 0,
+                     (struct sockaddr *)&nladdr, sizeof(nladdr));
+    } while ((ret < 0) && (iter++ < NFQ_VERDICT_RETRY_TIME));
+
+    if (ret < 0) {
+        SCLogWarning(SC_ERR_NFQ_SET_VERDICT, "sending %u verdicts failed: %s",
+                     t->verdict_ring.len, strerror(errno));
+    }
+#ifdef COUNTERS
+    t->verdict_sends++;
+#endif /* COUNTERS */
+    t->verdict_ring.used = 0;
+    t->verdict_ring.len = 0;
+}
+
+/**
+ * \brief add a verdict message to the ring, sent by NFQVerdictRingFlush()
+ *
+ * \param type NFQNL_MSG_VERDICT or NFQNL_MSG_VERDICT_BATCH
+ */
+static void NFQVerdictRingAdd(NFQQueueVars *t, uint16_t type, uint32_t id,
+                              uint32_t verdict, bool mark_valid, uint32_t mark)
+{
+    struct nlmsghdr *nlh = (struct nlmsghdr *)(t->verdict_ring.buf + t->verdict_ring.used);
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct nfgenmsg));
+    nlh->nlmsg_type = (NFNL_SUBSYS_QUEUE << 8) | type;
+    nlh->nlmsg_flags = NLM_F_REQUEST;
+    nlh->nlmsg_seq = 0;
+    nlh->nlmsg_pid = 0;
+
+    struct nfgenmsg *nfg = NLMSG_DATA(nlh);
+    nfg->nfgen_family = AF_UNSPEC;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons(t->queue_num);
+
+    struct nfqnl_msg_verdict_hdr vh;
+    vh.verdict = htonl(verdict);
+    vh.id = htonl(id);
+    NFQNlmsgPutAttr(nlh, NFQA_VERDICT_HDR, &vh, sizeof(vh));
+    if (mark_valid) {
+        uint32_t nfmark = htonl(mark);
+        NFQNlmsgPutAttr(nlh, NFQA_MARK, &nfmark, sizeof(nfmark));
+    }
+
+    t->verdict_ring.used += NLMSG_ALIGN(nlh->nlmsg_len);
+    t->verdict_ring.len++;
+
+    if (t->verdict_ring.len > t->verdict_cache.maxlen)
+        NFQVerdictRingFlush(t);
+}
+#endif /* HAVE_NFQ_SET_VERDICT_BATCH */
+
+static uint16_t NFQVerdictCacheLen(NFQQueueVars *t)
 {
 #ifdef HAVE_NFQ_SET_VERDICT_BATCH
-    return t->verdict_cache.len;
+    return t->verdict_cache.len + t->verdict_ring.len;
 #else
     return 0;
 #endif
 }
 
+/**
+ * \brief send out the cached and queued verdicts
+ *
+ * The cached verdict is added to the ring as a batch verdict after the
+ * single verdicts queued before it, so the kernel gets them in order.
+ */
 static void NFQVerdictCacheFlush(NFQQueueVars *t)
 {
 #ifdef HAVE_NFQ_SET_VERDICT_BATCH
-    int ret;
-    int iter = 0;
-
-    do {
-        if (t->verdict_cache.mark_valid)
-            ret = nfq_set_verdict_batch2(t->qh,
-                                         t->verdict_cache.packet_id,
-                                         t->verdict_cache.verdict,
-                                         t->verdict_cache.mark);
-        else
-            ret = nfq_set_verdict_batch(t->qh,
-                                        t->verdict_cache.packet_id,
-                                        t->verdict_cache.verdict);
-    } while ((ret < 0) && (iter++ < NFQ_VERDICT_RETRY_TIME));
-
-    if (ret < 0) {
-        SCLogWarning(SC_ERR_NFQ_SET_VERDICT, "nfq_set_verdict_batch failed: %s",
-                     strerror(errno));
-    } else {
+    if (t->verdict_cache.len) {
+        NFQVerdictRingAdd(t, NFQNL_MSG_VERDICT_BATCH,
+                          t->verdict_cache.packet_id,
+                          t->verdict_cache.verdict,
+                          t->verdict_cache.mark_valid,
+                          t->verdict_cache.mark);
         t->verdict_cache.len = 0;
         t->verdict_cache.mark_valid = 0;
     }
+    NFQVerdictRingFlush(t);
 #endif
 }
 
@@ -367,13 +461,59 @@ static int NFQVerdictCacheAdd(NFQQueueVars *t, Packet *p, uint32_t verdict)
         t->verdict_cache.len++;
     return 0;
  flush:
-    /* can't cache. Flush current cache and signal caller it should send single verdict */
-    if (NFQVerdictCacheLen(t) > 0)
-        NFQVerdictCacheFlush(t);
+    /* can't cache. Move the cached verdict to the ring and let the caller
+     * queue or send a single verdict */
+    if (t->verdict_cache.len > 0) {
+        NFQVerdictRingAdd(t, NFQNL_MSG_VERDICT_BATCH,
+                          t->verdict_cache.packet_id,
+                          t->verdict_cache.verdict,
+                          t->verdict_cache.mark_valid,
+                          t->verdict_cache.mark);
+        t->verdict_cache.len = 0;
+        t->verdict_cache.mark_valid = 0;
+    }
 #endif
     return -1;
 }
 
+/**
+ * \brief queue a single verdict without payload in the ring
+ *
+ * \retval 0 queued
+ * \retval -1 the verdict needs to be sent by the caller
+ */
+static int NFQVerdictRingQueue(NFQQueueVars *t, Packet *p, uint32_t verdict)
+{
+#ifdef HAVE_NFQ_SET_VERDICT_BATCH
+    if (t->verdict_ring.buf == NULL)
+        return -1;
+
+    if (p->flags & PKT_STREAM_MODIFIED) {
+        /* the payload goes with the verdict, so send it right away after
+         * what is queued */
+        NFQVerdictRingFlush(t);
+        return -1;
+    }
+
+    switch (nfq_config.mode) {
+        default:
+        case NFQ_ACCEPT_MODE:
+        case NFQ_ROUTE_MODE:
+            NFQVerdictRingAdd(t, NFQNL_MSG_VERDICT, p->nfq_v.id, verdict,
+                              (p->flags & PKT_MARK_MODIFIED) != 0, p->nfq_v.mark);
+            break;
+        case NFQ_REPEAT_MODE:
+            NFQVerdictRingAdd(t, NFQNL_MSG_VERDICT, p->nfq_v.id, verdict, true,
+                              (nfq_config.mark & nfq_config.mask) |
+                              (p->nfq_v.mark & ~nfq_config.mask));
+            break;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 static inline void NFQMutexInit(NFQQueueVars *nq)
 {
     char *active_runmode = RunmodeGetActive();
@@ -442,6 +582,21 @@ static int NFQSetupPkt (Packet *p, struct nfq_q_handle *qh, void *data)
     p->nfq_v.ifo  = nfq_get_outdev(tb);
     p->nfq_v.verdicted = 0;
 
+#ifdef HAVE_NFQ_GET_SKBINFO
+    uint32_t skbinfo = nfq_get_skbinfo(tb);
+    if (skbinfo & NFQA_SKB_CSUMNOTREADY) {
+        /* locally generated or GSO packet, the checksum is only filled in
+         * by the nic or when the packet is sent */
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    }
+#ifdef COUNTERS
+    if (skbinfo & NFQA_SKB_GSO) {
+        NFQQueueVars *q = NFQGetQueue(p->nfq_v.nfq_index);
+        q->gso++;
+    }
+#endif /* COUNTERS */
+#endif /* HAVE_NFQ_GET_SKBINFO */
+
 #ifdef NFQ_GET_PAYLOAD_SIGNED
     ret = nfq_get_payload(tb, &pktdata);
 #else
@@ -694,9 +849,32 @@ static TmEcode NFQInitThread(NFQThreadVars *t, uint32_t queue_maxlen)
     }
 #endif
 
+#if defined(HAVE_NFQ_SET_QUEUE_FLAGS) && defined(NFQA_CFG_F_GSO)
+    if (nfq_config.flags & NFQ_FLAG_GSO) {
+        /* let the kernel pass GSO packets without segmenting them */
+        int r = nfq_set_queue_flags(q->qh, NFQA_CFG_F_GSO, NFQA_CFG_F_GSO);
+
+        if (r == -1) {
+            SCLogWarning(SC_ERR_NFQ_SET_MODE, "can't set gso mode: %s",
+                         strerror(errno));
+        } else {
+            SCLogInfo("gso mode should be set on queue");
+        }
+    }
+#endif
+
 #ifdef HAVE_NFQ_SET_VERDICT_BATCH
     if (runmode_workers) {
         q->verdict_cache.maxlen = nfq_config.batchcount;
+        if (q->verdict_cache.maxlen > 0) {
+            /* room for maxlen single verdicts and a batch verdict */
+            q->verdict_ring.buf = SCCalloc(q->verdict_cache.maxlen + 2,
+                                           NFQ_VERDICT_MSG_MAXLEN);
+            if (q->verdict_ring.buf == NULL) {
+                SCLogError(SC_ERR_MEM_ALLOC, "failed to allocate verdict ring");
+                return TM_ECODE_FAILED;
+            }
+        }
     } else if (nfq_config.batchcount) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "nfq.batchcount is only valid in workers runmode.");
     }
@@ -762,6 +940,11 @@ static void NFQDestroyQueue(NFQQueueVars *nq)
     SCLogDebug("starting... will close queuenum %" PRIu32 "", nq->queue_num);
     NFQMutexLock(nq);
     if (nq->qh != NULL) {
+        NFQVerdictCacheFlush(nq);
+        if (nq->verdict_ring.buf != NULL) {
+            SCFree(nq->verdict_ring.buf);
+            nq->verdict_ring.buf = NULL;
+        }
         nfq_destroy_queue(nq->qh);
         nq->qh = NULL;
         nfq_close(nq->h);
@@ -791,6 +974,8 @@ TmEcode VerdictNFQThreadInit(ThreadVars *tv, const void *initdata, void **data)
     NFQThreadVars *ntv = (NFQThreadVars *) initdata;
 
     CaptureStatsSetup(tv, &ntv->stats);
+    /* until the verdict is queued, see NFQUpdateVerdictLatency() */
+    ntv->counter_verdict_latency = StatsRegisterAvgCounter("nfq.verdict_latency_usec", tv);
 
     *data = (void *)ntv;
     return TM_ECODE_OK;
@@ -1045,6 +1230,8 @@ void ReceiveNFQThreadExitStats(ThreadVars *tv, void *data)
             tv->name, nq->pkts, nq->bytes, nq->errs);
     SCLogNotice("(%s) Verdict: Accepted %"PRIu32", Dropped %"PRIu32", Replaced %"PRIu32,
             tv->name, nq->accepted, nq->dropped, nq->replaced);
+    SCLogNotice("(%s) Verdict batches sent %"PRIu32", GSO packets %"PRIu32,
+            tv->name, nq->verdict_sends, nq->gso);
 #endif
 }
 
@@ -1117,7 +1304,7 @@ TmEcode NFQSetVerdict(Packet *p)
 #endif /* COUNTERS */
 
     int ret = NFQVerdictCacheAdd(t, p, verdict);
-    if (ret == 0) {
+    if (ret == 0 || NFQVerdictRingQueue(t, p, verdict) == 0) {
         NFQMutexUnlock(t);
         return TM_ECODE_OK;
     }
@@ -1196,6 +1383,28 @@ TmEcode NFQSetVerdict(Packet *p)
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief account the time from the packet's arrival to its verdict
+ *
+ * With nfq.batchcount the verdict may still be in the cache or the ring
+ * at this point: the nfq.verdict_latency_usec counter is the time until
+ * the verdict was queued, the kernel gets it up to batchcount verdicts
+ * later.
+ */
+static inline void NFQUpdateVerdictLatency(ThreadVars *tv, NFQThreadVars *ntv,
+                                           const Packet *p)
+{
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t usec = (int64_t)(now.tv_sec - p->ts.tv_sec) * 1000000 +
+                   (now.tv_usec - p->ts.tv_usec);
+    if (usec >= 0)
+        StatsAddUI64(tv, ntv->counter_verdict_latency, (uint64_t)usec);
+}
+
 /**
  * \brief NFQ verdict module packet entry function
  */
@@ -1212,10 +1421,12 @@ TmEcode VerdictNFQ(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packe
         bool verdict = VerdictTunnelPacket(p);
         /* don't verdict if we are not ready */
         if (verdict == true) {
-            int ret = NFQSetVerdict(p->root ? p->root : p);
+            Packet *rp = p->root ? p->root : p;
+            int ret = NFQSetVerdict(rp);
             if (ret != TM_ECODE_OK) {
                 return ret;
             }
+            NFQUpdateVerdictLatency(tv, ntv, rp);
         }
     } else {
         /* no tunnel, verdict normally */
@@ -1223,6 +1434,7 @@ TmEcode VerdictNFQ(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packe
         if (ret != TM_ECODE_OK) {
             return ret;
         }
+        NFQUpdateVerdictLatency(tv, ntv, p);
     }
     return TM_ECODE_OK;
 }
@@ -1302,4 +1514,151 @@ void NFQContextsClean()
         g_nfq_t = NULL;
     }
 }
+
+#ifdef UNITTESTS
+#ifdef HAVE_NFQ_SET_VERDICT_BATCH
+/** \internal
+ *  \brief check a verdict message of the ring
+ *
+ *  \param mark_valid if the message should have a NFQA_MARK attribute
+ *  \retval next message or NULL if the message doesn't match
+ */
+static const struct nlmsghdr *NFQTestCheckMsg(const struct nlmsghdr *nlh,
+        uint16_t queue_num, uint16_t type, uint32_t id, uint32_t verdict,
+        bool mark_valid, uint32_t mark)
+{
+    const uint32_t len = NLMSG_LENGTH(sizeof(struct nfgenmsg)) +
+        NLA_ALIGN(NLA_HDRLEN + sizeof(struct nfqnl_msg_verdict_hdr)) +
+        (mark_valid ? NLA_ALIGN(NLA_HDRLEN + sizeof(uint32_t)) : 0);
+    if (nlh->nlmsg_len != len ||
+            nlh->nlmsg_type != ((NFNL_SUBSYS_QUEUE << 8) | type) ||
+            nlh->nlmsg_flags != NLM_F_REQUEST)
+        return NULL;
+
+    const struct nfgenmsg *nfg = NLMSG_DATA(nlh);
+    if (nfg->nfgen_family != AF_UNSPEC || nfg->version != NFNETLINK_V0 ||
+            ntohs(nfg->res_id) != queue_num)
+        return NULL;
+
+    const struct nlattr *nla = (const struct nlattr *)((const uint8_t *)nlh +
+            NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct nfgenmsg))));
+    struct nfqnl_msg_verdict_hdr vh;
+    memcpy(&vh, (const uint8_t *)nla + NLA_HDRLEN, sizeof(vh));
+    if (nla->nla_type != NFQA_VERDICT_HDR ||
+            nla->nla_len != NLA_HDRLEN + sizeof(vh) ||
+            ntohl(vh.id) != id || ntohl(vh.verdict) != verdict)
+        return NULL;
+
+    if (mark_valid) {
+        nla = (const struct nlattr *)((const uint8_t *)nla + NLA_ALIGN(nla->nla_len));
+        uint32_t nfmark;
+        memcpy(&nfmark, (const uint8_t *)nla + NLA_HDRLEN, sizeof(nfmark));
+        if (nla->nla_type != NFQA_MARK ||
+                nla->nla_len != NLA_HDRLEN + sizeof(nfmark) ||
+                ntohl(nfmark) != mark)
+            return NULL;
+    }
+    return (const struct nlmsghdr *)((const uint8_t *)nlh + NLMSG_ALIGN(len));
+}
+
+/** \internal
+ *  \brief queue the verdict of a packet like NFQSetVerdict() does
+ *  \retval 0 cached or queued, -1 if it would be sent by itself */
+static int NFQTestVerdict(NFQQueueVars *t, uint32_t id, uint32_t verdict,
+        uint32_t flags, uint32_t mark)
+{
+    Packet *p = SCCalloc(1, SIZE_OF_PACKET);
+    if (p == NULL)
+        return -1;
+    p->nfq_v.id = id;
+    p->nfq_v.mark = mark;
+    p->flags = flags;
+    int r = 0;
+    if (NFQVerdictCacheAdd(t, p, verdict) != 0)
+        r = NFQVerdictRingQueue(t, p, verdict);
+    SCFree(p);
+    return r;
+}
+
+/** \test the batch verdict of the cached packets is queued before the
+ *        single verdict that could not be cached, the ring is sent once
+ *        it holds more than batchcount verdicts */
+static int NFQVerdictRingTest01(void)
+{
+    const NFQMode mode = nfq_config.mode;
+    nfq_config.mode = NFQ_ACCEPT_MODE;
+
+    NFQQueueVars t;
+    memset(&t, 0, sizeof(t));
+    t.fd = -1;
+    t.queue_num = 3;
+    t.verdict_cache.maxlen = 4;
+    t.verdict_ring.buf = SCCalloc(t.verdict_cache.maxlen + 2,
+            NFQ_VERDICT_MSG_MAXLEN);
+    FAIL_IF_NULL(t.verdict_ring.buf);
+
+    /* 1 and 2 are cached, sent as a batch verdict for 2 before the drop */
+    FAIL_IF(NFQTestVerdict(&t, 1, NF_ACCEPT, 0, 0) != 0);
+    FAIL_IF(NFQTestVerdict(&t, 2, NF_ACCEPT, 0, 0) != 0);
+    FAIL_IF(t.verdict_ring.len != 0);
+    FAIL_IF(NFQTestVerdict(&t, 3, NF_DROP, 0, 0) != 0);
+    FAIL_IF(t.verdict_ring.len != 2);
+    FAIL_IF(t.verdict_cache.len != 0);
+
+    /* a cached mark ends the batch on the next packet without it */
+    FAIL_IF(NFQTestVerdict(&t, 4, NF_ACCEPT, PKT_MARK_MODIFIED, 0x10) != 0);
+    FAIL_IF(NFQTestVerdict(&t, 5, NF_DROP, PKT_MARK_MODIFIED, 0x20) != 0);
+    FAIL_IF(t.verdict_ring.len != 4);
+    FAIL_IF(NFQVerdictCacheLen(&t) != 4);
+
+    const struct nlmsghdr *nlh = (const struct nlmsghdr *)t.verdict_ring.buf;
+    nlh = NFQTestCheckMsg(nlh, 3, NFQNL_MSG_VERDICT_BATCH, 2, NF_ACCEPT, false, 0);
+    FAIL_IF_NULL(nlh);
+    nlh = NFQTestCheckMsg(nlh, 3, NFQNL_MSG_VERDICT, 3, NF_DROP, false, 0);
+    FAIL_IF_NULL(nlh);
+    nlh = NFQTestCheckMsg(nlh, 3, NFQNL_MSG_VERDICT_BATCH, 4, NF_ACCEPT, true, 0x10);
+    FAIL_IF_NULL(nlh);
+    nlh = NFQTestCheckMsg(nlh, 3, NFQNL_MSG_VERDICT, 5, NF_DROP, true, 0x20);
+    FAIL_IF_NULL(nlh);
+    FAIL_IF((const uint8_t *)nlh - t.verdict_ring.buf != t.verdict_ring.used);
+    FAIL_IF(t.verdict_ring.used > (t.verdict_cache.maxlen + 2) * NFQ_VERDICT_MSG_MAXLEN);
+
+    /* a 5th message is more than batchcount: the ring is sent */
+    FAIL_IF(NFQTestVerdict(&t, 6, NF_DROP, 0, 0) != 0);
+    FAIL_IF(t.verdict_ring.len != 0);
+    FAIL_IF(t.verdict_ring.used != 0);
+
+    /* the payload goes with the verdict, queued verdicts are sent first */
+    FAIL_IF(NFQTestVerdict(&t, 7, NF_DROP, 0, 0) != 0);
+    FAIL_IF(t.verdict_ring.len != 1);
+    FAIL_IF(NFQTestVerdict(&t, 8, NF_ACCEPT, PKT_STREAM_MODIFIED, 0) != -1);
+    FAIL_IF(t.verdict_ring.len != 0);
+
+    /* repeat mode sets the mark on every verdict */
+    nfq_config.mode = NFQ_REPEAT_MODE;
+    const uint32_t mark = nfq_config.mark, mask = nfq_config.mask;
+    nfq_config.mark = 0x100;
+    nfq_config.mask = 0xf00;
+    FAIL_IF(NFQTestVerdict(&t, 9, NF_DROP, PKT_MARK_MODIFIED, 0x2003) != 0);
+    nlh = NFQTestCheckMsg((const struct nlmsghdr *)t.verdict_ring.buf, 3,
+            NFQNL_MSG_VERDICT, 9, NF_DROP, true, 0x2103);
+    FAIL_IF_NULL(nlh);
+    nfq_config.mark = mark;
+    nfq_config.mask = mask;
+
+    nfq_config.mode = mode;
+    SCFree(t.verdict_ring.buf);
+    PASS;
+}
+#endif /* HAVE_NFQ_SET_VERDICT_BATCH */
+#endif /* UNITTESTS */
+
+static void NFQRegisterTests(void)
+{
+#ifdef UNITTESTS
+#ifdef HAVE_NFQ_SET_VERDICT_BATCH
+    UtRegisterTest("NFQVerdictRingTest01", NFQVerdictRingTest01);
+#endif
+#endif
+}
 #endif /* NFQ */
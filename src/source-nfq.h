@@ -73,6 +73,8 @@ typedef struct NFQQueueVars_
     uint32_t accepted;
     uint32_t dropped;
     uint32_t replaced;
+    uint32_t verdict_sends;
+    uint32_t gso;
     struct {
         uint32_t packet_id; /* id of last processed packet */
         uint32_t verdict;
@@ -81,6 +83,12 @@ typedef struct NFQQueueVars_
         uint8_t len;
         uint8_t maxlen;
     } verdict_cache;
+    /* verdict messages not sent yet, sent to the kernel in one go */
+    struct {
+        uint8_t *buf;
+        uint32_t used; /* bytes of buf in use */
+        uint16_t len;  /* messages in buf */
+    } verdict_ring;
 
 } NFQQueueVars;
 
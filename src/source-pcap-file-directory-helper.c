@@ -26,7 +26,13 @@
 #include "source-pcap-file-directory-helper.h"
 #include "runmode-unix-socket.h"
 #include "util-mem.h"
+#include "util-hash.h"
 #include "source-pcap-file.h"
+#include "util-unittest.h"
+
+/** files taken by a reader, set if several readers share the directory */
+static HashTable *claimed_files = NULL;
+static SCMutex claimed_files_lock = SCMUTEX_INITIALIZER;
 
 static void GetTime(struct timespec *tm);
 static void CopyTime(struct timespec *from, struct timespec *to);
@@ -92,6 +98,70 @@ TmEcode PcapRunStatus(PcapFileDirectoryVars *ptv)
     SCReturnInt(TM_ECODE_OK);
 }
 
+static void ClaimedFileFree(void *data)
+{
+    SCFree(data);
+}
+
+int PcapDirectoryClaimsInit(void)
+{
+    claimed_files = HashTableInit(4096, HashTableGenericHash, NULL,
+                                  ClaimedFileFree);
+    if (claimed_files == NULL)
+        return -1;
+    return 0;
+}
+
+void PcapDirectoryClaimsFree(void)
+{
+    SCMutexLock(&claimed_files_lock);
+    if (claimed_files != NULL) {
+        HashTableFree(claimed_files);
+        claimed_files = NULL;
+    }
+    SCMutexUnlock(&claimed_files_lock);
+}
+
+/**
+ * \brief check if another reader took the file already
+ */
+static bool PcapDirectoryIsClaimed(const char *filename)
+{
+    if (claimed_files == NULL)
+        return false;
+
+    SCMutexLock(&claimed_files_lock);
+    bool claimed = HashTableLookup(claimed_files, (void *)filename,
+                                   (uint16_t)strlen(filename)) != NULL;
+    SCMutexUnlock(&claimed_files_lock);
+    return claimed;
+}
+
+/**
+ * \brief take a file for this reader
+ * \retval true if the file is ours to process
+ */
+static bool PcapDirectoryClaimFile(const char *filename)
+{
+    if (claimed_files == NULL)
+        return true;
+
+    bool ours = false;
+    SCMutexLock(&claimed_files_lock);
+    if (HashTableLookup(claimed_files, (void *)filename,
+                        (uint16_t)strlen(filename)) == NULL) {
+        char *copy = SCStrdup(filename);
+        if (copy != NULL &&
+            HashTableAdd(claimed_files, copy, (uint16_t)strlen(copy)) == 0) {
+            ours = true;
+        } else if (copy != NULL) {
+            SCFree(copy);
+        }
+    }
+    SCMutexUnlock(&claimed_files_lock);
+    return ours;
+}
+
 void CleanupPendingFile(PendingFile *pending) {
     if (pending != NULL) {
         if (pending->filename != NULL) {
@@ -358,6 +428,10 @@ TmEcode PcapDirectoryPopulateBuffer(PcapFileDirectoryVars *pv,
                     SCLogDebug("Skipping new file %s", pathbuff);
                     continue;
                 }
+                else if (PcapDirectoryIsClaimed(pathbuff)) {
+                    SCLogDebug("Skipping file %s taken by another reader", pathbuff);
+                    continue;
+                }
             } else {
                 SCLogDebug("Unable to get modified time on %s, skipping", pathbuff);
                 continue;
@@ -427,6 +501,9 @@ TmEcode PcapDirectoryDispatchForTimeRange(PcapFileDirectoryVars *pv,
                 SCLogWarning(SC_ERR_PCAP_DISPATCH, "Current file was null");
             } else if (unlikely(current_file->filename == NULL)) {
                 SCLogWarning(SC_ERR_PCAP_DISPATCH, "Current file filename was null");
+            } else if (!PcapDirectoryClaimFile(current_file->filename)) {
+                SCLogDebug("File %s taken by another reader", current_file->filename);
+                CleanupPendingFile(current_file);
             } else {
                 SCLogDebug("Processing file %s", current_file->filename);
 
@@ -454,6 +531,7 @@ TmEcode PcapDirectoryDispatchForTimeRange(PcapFileDirectoryVars *pv,
                     status = TM_ECODE_OK;
                 } else {
                     pv->current_file = pftv;
+                    uint64_t pkts = pv->shared->pkts;
 
                     status = PcapFileDispatch(pftv);
 
@@ -464,8 +542,8 @@ TmEcode PcapDirectoryDispatchForTimeRange(PcapFileDirectoryVars *pv,
                         SCReturnInt(status);
                     }
 
-                    SCLogInfo("Processed file %s, processed up to %" PRIuMAX,
-                               current_file->filename,
+                    SCLogInfo("Processed file %s, %" PRIu64 " packets, processed up to %" PRIuMAX,
+                               current_file->filename, pv->shared->pkts - pkts,
                                (uintmax_t)SCTimespecAsEpochMillis(&current_file->modified_time));
 
                     if(CompareTimes(&current_file->modified_time, &last_time_seen) > 0) {
@@ -553,3 +631,102 @@ TmEcode PcapDirectoryDispatch(PcapFileDirectoryVars *ptv)
 }
 
 /* eof */
+
+#ifdef UNITTESTS
+/** \test a file can be taken by one reader only */
+static int PcapDirectoryTest01(void)
+{
+    /* a single reader has no table and takes every file */
+    FAIL_IF(PcapDirectoryIsClaimed("/pcaps/a.pcap"));
+    FAIL_IF_NOT(PcapDirectoryClaimFile("/pcaps/a.pcap"));
+    FAIL_IF_NOT(PcapDirectoryClaimFile("/pcaps/a.pcap"));
+
+    FAIL_IF(PcapDirectoryClaimsInit() != 0);
+    FAIL_IF(PcapDirectoryIsClaimed("/pcaps/a.pcap"));
+    FAIL_IF_NOT(PcapDirectoryClaimFile("/pcaps/a.pcap"));
+    FAIL_IF(PcapDirectoryClaimFile("/pcaps/a.pcap"));
+    FAIL_IF_NOT(PcapDirectoryIsClaimed("/pcaps/a.pcap"));
+    FAIL_IF(PcapDirectoryIsClaimed("/pcaps/a.pcapng"));
+    FAIL_IF_NOT(PcapDirectoryClaimFile("/pcaps/a.pcapng"));
+    PcapDirectoryClaimsFree();
+
+    FAIL_IF(PcapDirectoryIsClaimed("/pcaps/a.pcap"));
+    PASS;
+}
+
+static int PcapDirectoryTestPending(PcapFileDirectoryVars *pv)
+{
+    int cnt = 0;
+    PendingFile *file = NULL;
+    TAILQ_FOREACH(file, &pv->directory_content, next) {
+        cnt++;
+    }
+    return cnt;
+}
+
+/** \test a directory scan leaves out the files other readers took */
+static int PcapDirectoryTest02(void)
+{
+    char dir[] = "/tmp/suricata-ut-pcapdir-XXXXXX";
+    char path[2][PATH_MAX];
+    FAIL_IF_NULL(mkdtemp(dir));
+    for (int i = 0; i < 2; i++) {
+        snprintf(path[i], sizeof(path[i]), "%s/%d.pcap", dir, i);
+        FILE *fp = fopen(path[i], "w");
+        FAIL_IF_NULL(fp);
+        fclose(fp);
+    }
+
+    PcapFileSharedVars shared;
+    memset(&shared, 0, sizeof(shared));
+    PcapFileDirectoryVars pv;
+    memset(&pv, 0, sizeof(pv));
+    pv.filename = dir;
+    pv.shared = &shared;
+    TAILQ_INIT(&pv.directory_content);
+    struct timespec older_than;
+    memset(&older_than, 0, sizeof(older_than));
+    older_than.tv_sec = time(NULL) + 60;
+
+    FAIL_IF(PcapDirectoryClaimsInit() != 0);
+    FAIL_IF_NOT(PcapDirectoryClaimFile(path[0]));
+
+    pv.directory = opendir(dir);
+    FAIL_IF_NULL(pv.directory);
+    FAIL_IF(PcapDirectoryPopulateBuffer(&pv, &older_than) != TM_ECODE_OK);
+    closedir(pv.directory);
+    int cnt1 = PcapDirectoryTestPending(&pv);
+    PendingFile *file = TAILQ_FIRST(&pv.directory_content);
+    int match = (file != NULL && strcmp(file->filename, path[1]) == 0);
+    while ((file = TAILQ_FIRST(&pv.directory_content)) != NULL) {
+        TAILQ_REMOVE(&pv.directory_content, file, next);
+        CleanupPendingFile(file);
+    }
+
+    /* all files taken: nothing left for this reader */
+    FAIL_IF_NOT(PcapDirectoryClaimFile(path[1]));
+    pv.directory = opendir(dir);
+    FAIL_IF_NULL(pv.directory);
+    FAIL_IF(PcapDirectoryPopulateBuffer(&pv, &older_than) != TM_ECODE_OK);
+    closedir(pv.directory);
+    int cnt2 = PcapDirectoryTestPending(&pv);
+
+    PcapDirectoryClaimsFree();
+    unlink(path[0]);
+    unlink(path[1]);
+    rmdir(dir);
+
+    FAIL_IF_NOT(cnt1 == 1);
+    FAIL_IF_NOT(match);
+    FAIL_IF_NOT(cnt2 == 0);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PcapDirectoryRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapDirectoryTest01", PcapDirectoryTest01);
+    UtRegisterTest("PcapDirectoryTest02", PcapDirectoryTest02);
+#endif
+}
@@ -81,4 +81,18 @@ TmEcode PcapDetermineDirectoryOrFile(char *filename, DIR **directory);
  */
 TmEcode PcapDirectoryDispatch(PcapFileDirectoryVars *ptv);
 
+/**
+ * Setup the table of the files taken by the readers, so several readers can
+ * share a directory with each file processed once
+ * @return 0 on success
+ */
+int PcapDirectoryClaimsInit(void);
+
+/**
+ * Free the table of the files taken by the readers
+ */
+void PcapDirectoryClaimsFree(void);
+
+void PcapDirectoryRegisterTests(void);
+
 #endif /* __SOURCE_PCAP_FILE_DIRECTORY_HELPER_H__ */
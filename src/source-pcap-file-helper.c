@@ -27,6 +27,7 @@
 #include "util-checksum.h"
 #include "util-profiling.h"
 #include "source-pcap-file.h"
+#include "util-bpf.h"
 
 extern int max_pending_packets;
 extern PcapFileGlobalVars pcap_g;
@@ -40,6 +41,13 @@ void CleanupPcapFileFileVars(PcapFileFileVars *pfv)
             pcap_close(pfv->pcap_handle);
             pfv->pcap_handle = NULL;
         }
+        if (pfv->mmap != NULL) {
+            PcapFileMmapClose(pfv->mmap);
+            pfv->mmap = NULL;
+        }
+        if (pfv->filter.bf_insns != NULL) {
+            pcap_freecode(&pfv->filter);
+        }
         if (pfv->filename != NULL) {
             if (pfv->shared != NULL && pfv->shared->should_delete) {
                 SCLogDebug("Deleting pcap file %s", pfv->filename);
@@ -73,13 +81,22 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     p->ts.tv_usec = h->ts.tv_usec;
     SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
     p->datalink = ptv->datalink;
-    p->pcap_cnt = ++pcap_g.cnt;
+    p->pcap_cnt = SC_ATOMIC_ADD(pcap_g.cnt, 1);
 
     p->pcap_v.tenant_id = ptv->shared->tenant_id;
+    p->pcap_v.filename = ptv->log_filename;
+    if (ptv->shared->livedev != NULL) {
+        p->livedev = ptv->shared->livedev;
+        (void) SC_ATOMIC_ADD(p->livedev->pkts, 1);
+    }
     ptv->shared->pkts++;
     ptv->shared->bytes += h->caplen;
 
-    if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
+    if (ptv->mmap != NULL) {
+        /* point in the file mapping, no copy */
+        PacketSetData(p, pkt, h->caplen);
+        PcapFileMmapPacketSetup(ptv->mmap, p);
+    } else if (unlikely(PacketCopyData(p, pkt, h->caplen))) {
         TmqhOutputPacketpool(ptv->shared->tv, p);
         PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
         SCReturn;
@@ -99,18 +116,115 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
     if (TmThreadsSlotProcessPkt(ptv->shared->tv, ptv->shared->slot, p) != TM_ECODE_OK) {
-        pcap_breakloop(ptv->pcap_handle);
+        if (ptv->pcap_handle != NULL)
+            pcap_breakloop(ptv->pcap_handle);
         ptv->shared->cb_result = TM_ECODE_FAILED;
     }
 
     SCReturn;
 }
 
-char pcap_filename[PATH_MAX] = "unknown";
+/* Names of the files read so far. Packets point to them, possibly long
+ * after their file was closed, so they are only freed at shutdown. */
+typedef struct PcapFileName_ {
+    struct PcapFileName_ *next;
+    char name[];
+} PcapFileName;
+
+static PcapFileName *pcap_filenames = NULL;
+static SCMutex pcap_filenames_lock = SCMUTEX_INITIALIZER;
+/* last file opened by any reader */
+SC_ATOMIC_DECLARE(const char *, pcap_filename_last);
+/* file of the packet the loggers of this thread are handling */
+static __thread const char *pcap_filename_log = NULL;
+
+static const char *PcapFileNameAdd(const char *filename)
+{
+    const size_t len = strlen(filename) + 1;
+    PcapFileName *n = SCMalloc(sizeof(*n) + len);
+    if (unlikely(n == NULL))
+        return NULL;
+    memcpy(n->name, filename, len);
+
+    SCMutexLock(&pcap_filenames_lock);
+    n->next = pcap_filenames;
+    pcap_filenames = n;
+    SCMutexUnlock(&pcap_filenames_lock);
+    return n->name;
+}
+
+void PcapFileNamesFree(void)
+{
+    SCMutexLock(&pcap_filenames_lock);
+    while (pcap_filenames != NULL) {
+        PcapFileName *n = pcap_filenames;
+        pcap_filenames = n->next;
+        SCFree(n);
+    }
+    SC_ATOMIC_SET(pcap_filename_last, NULL);
+    SCMutexUnlock(&pcap_filenames_lock);
+}
+
+/**
+ * \brief let the loggers of this thread report the file of the packet
+ *
+ * Records logged without a packet, e.g. flows logged on timeout, get the
+ * last file opened by any reader.
+ */
+void PcapFileSetLogPacket(const Packet *p)
+{
+    if (pcap_g.active) {
+        pcap_filename_log = p->pcap_v.filename;
+    }
+}
 
 const char *PcapFileGetFilename(void)
 {
-    return pcap_filename;
+    if (pcap_filename_log != NULL)
+        return pcap_filename_log;
+    const char *last = SC_ATOMIC_GET(pcap_filename_last);
+    return last ? last : "unknown";
+}
+
+/** \internal
+ *  \brief get the next packet from the mmap reader that passes the bpf
+ *  \retval 1 packet, 0 end of file, -1 error
+ */
+static int PcapFileMmapNextFiltered(PcapFileFileVars *ptv,
+        struct pcap_pkthdr **h, const u_char **pkt)
+{
+    int r;
+    while ((r = PcapFileMmapNext(ptv->mmap, h, pkt)) == 1) {
+        if (ptv->filter.bf_insns == NULL ||
+            pcap_offline_filter(&ptv->filter, *h, *pkt) != 0)
+            break;
+    }
+    return r;
+}
+
+/** \internal
+ *  \brief pcap_dispatch() for files read through mmap
+ *  \retval cnt packets handled, 0 at end of file, -1 on error, -2 if
+ *          the callback failed
+ */
+static int PcapFileMmapDispatch(PcapFileFileVars *ptv, int cnt)
+{
+    struct pcap_pkthdr *h = NULL;
+    const u_char *pkt = NULL;
+    int n;
+
+    for (n = 0; n < cnt; n++) {
+        int r = PcapFileMmapNextFiltered(ptv, &h, &pkt);
+        if (r == 0)
+            break;
+        if (r < 0)
+            return -1;
+
+        PcapFileCallbackLoop((char *)ptv, h, (u_char *)pkt);
+        if (ptv->shared->cb_result == TM_ECODE_FAILED)
+            return -2;
+    }
+    return n;
 }
 
 /**
@@ -120,9 +234,20 @@ TmEcode PcapFileDispatch(PcapFileFileVars *ptv)
 {
     SCEnter();
 
-    /* initialize all the threads initial timestamp */
+    if (ptv->log_filename == NULL) {
+        ptv->log_filename = PcapFileNameAdd(ptv->filename);
+    }
+    if (ptv->log_filename != NULL) {
+        SC_ATOMIC_SET(pcap_filename_last, ptv->log_filename);
+    }
+
+    /* initialize all the threads initial timestamp. With several readers
+     * only the first file does, so the time doesn't go back for the files
+     * read by the others. */
     if (likely(ptv->first_pkt_hdr != NULL)) {
-        TmThreadsInitThreadsTimestamp(&ptv->first_pkt_ts);
+        if (ptv->shared->livedev == NULL ||
+            SC_ATOMIC_CAS(&pcap_g.ts_init, 0, 1))
+            TmThreadsInitThreadsTimestamp(&ptv->first_pkt_ts);
         PcapFileCallbackLoop((char *)ptv, ptv->first_pkt_hdr, (u_char *)ptv->first_pkt_data);
         ptv->first_pkt_hdr = NULL;
         ptv->first_pkt_data = NULL;
@@ -131,7 +256,6 @@ TmEcode PcapFileDispatch(PcapFileFileVars *ptv)
     int packet_q_len = 64;
     int r;
     TmEcode loop_result = TM_ECODE_OK;
-    strlcpy(pcap_filename, ptv->filename, sizeof(pcap_filename));
 
     while (loop_result == TM_ECODE_OK) {
         if (suricata_ctl_flags & SURICATA_STOP) {
@@ -142,12 +266,16 @@ TmEcode PcapFileDispatch(PcapFileFileVars *ptv)
          * us from alloc'ing packets at line rate */
         PacketPoolWait();
 
-        /* Right now we just support reading packets one at a time. */
-        r = pcap_dispatch(ptv->pcap_handle, packet_q_len,
-                          (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        if (ptv->mmap != NULL) {
+            r = PcapFileMmapDispatch(ptv, packet_q_len);
+        } else {
+            r = pcap_dispatch(ptv->pcap_handle, packet_q_len,
+                              (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        }
         if (unlikely(r == -1)) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s for %s",
-                       r, pcap_geterr(ptv->pcap_handle), ptv->filename);
+                       r, ptv->mmap != NULL ? ptv->mmap->errbuf :
+                       pcap_geterr(ptv->pcap_handle), ptv->filename);
             if (ptv->shared->cb_result == TM_ECODE_FAILED) {
                 SCReturnInt(TM_ECODE_FAILED);
             }
@@ -174,7 +302,12 @@ TmEcode PcapFileDispatch(PcapFileFileVars *ptv)
  */
 static bool PeekFirstPacketTimestamp(PcapFileFileVars *pfv)
 {
-    int r = pcap_next_ex(pfv->pcap_handle, &pfv->first_pkt_hdr, &pfv->first_pkt_data);
+    int r;
+    if (pfv->mmap != NULL) {
+        r = PcapFileMmapNextFiltered(pfv, &pfv->first_pkt_hdr, &pfv->first_pkt_data);
+    } else {
+        r = pcap_next_ex(pfv->pcap_handle, &pfv->first_pkt_hdr, &pfv->first_pkt_data);
+    }
     if (r <= 0 || pfv->first_pkt_hdr == NULL) {
         SCLogError(SC_ERR_PCAP_OPEN_OFFLINE,
                 "failed to get first packet timestamp. pcap_next_ex(): %d", r);
@@ -185,6 +318,46 @@ static bool PeekFirstPacketTimestamp(PcapFileFileVars *pfv)
     return true;
 }
 
+/** \internal
+ *  \brief setup the file to be read through the mmap reader
+ *  \retval bool true if the mmap reader is used
+ */
+static bool InitPcapFileMmap(PcapFileFileVars *pfv)
+{
+    if (pfv->shared == NULL || !pfv->shared->use_mmap)
+        return false;
+#if defined __OpenBSD__
+    /* the bpf filter can only be set on a libpcap handle */
+    if (pfv->shared->bpf_string != NULL)
+        return false;
+#endif
+
+    pfv->mmap = PcapFileMmapOpen(pfv->filename);
+    if (pfv->mmap == NULL)
+        return false;
+
+#if !defined __OpenBSD__
+    if (pfv->shared->bpf_string != NULL) {
+        char errbuf[PCAP_ERRBUF_SIZE] = "";
+
+        SCLogInfo("using bpf-filter \"%s\"", pfv->shared->bpf_string);
+
+        if (SCBPFCompile(pfv->mmap->snaplen ? (int)pfv->mmap->snaplen : 65535,
+                         pfv->mmap->datalink, &pfv->filter,
+                         pfv->shared->bpf_string, 1, 0,
+                         errbuf, sizeof(errbuf)) < 0) {
+            /* let libpcap report the error */
+            PcapFileMmapClose(pfv->mmap);
+            pfv->mmap = NULL;
+            return false;
+        }
+    }
+#endif
+
+    SCLogDebug("reading %s through mmap", pfv->filename);
+    return true;
+}
+
 TmEcode InitPcapFile(PcapFileFileVars *pfv)
 {
     char errbuf[PCAP_ERRBUF_SIZE] = "";
@@ -194,6 +367,17 @@ TmEcode InitPcapFile(PcapFileFileVars *pfv)
         SCReturnInt(TM_ECODE_FAILED);
     }
 
+    if (InitPcapFileMmap(pfv)) {
+        pfv->datalink = pfv->mmap->datalink;
+        SCLogDebug("datalink %" PRId32 "", pfv->datalink);
+
+        if (!PeekFirstPacketTimestamp(pfv))
+            SCReturnInt(TM_ECODE_FAILED);
+
+        DecoderFunc temp;
+        SCReturnInt(ValidateLinkType(pfv->datalink, &temp));
+    }
+
     pfv->pcap_handle = pcap_open_offline(pfv->filename, errbuf);
     if (pfv->pcap_handle == NULL) {
         SCLogError(SC_ERR_FOPEN, "%s", errbuf);
@@ -23,15 +23,23 @@
 
 #include "suricata-common.h"
 #include "tm-threads.h"
+#include "util-device.h"
+#include "source-pcap-file-mmap.h"
 
 #ifndef __SOURCE_PCAP_FILE_HELPER_H__
 #define __SOURCE_PCAP_FILE_HELPER_H__
 
 typedef struct PcapFileGlobalVars_ {
-    uint64_t cnt; /** packet counter */
+    SC_ATOMIC_DECLARE(uint64_t, cnt); /** packet counter */
     ChecksumValidationMode conf_checksum_mode;
     ChecksumValidationMode checksum_mode;
     SC_ATOMIC_DECLARE(unsigned int, invalid_checksums);
+    /** reader threads still running, the last one stops the engine */
+    SC_ATOMIC_DECLARE(unsigned int, readers);
+    /** set once a reader initialized the threads timestamps */
+    SC_ATOMIC_DECLARE(unsigned int, ts_init);
+    /** packets come from pcap files, so their pcap_v is set */
+    bool active;
 } PcapFileGlobalVars;
 
 /**
@@ -47,9 +55,15 @@ typedef struct PcapFileSharedVars_
 
     bool should_delete;
 
+    /* read the files through the mmap reader when possible */
+    bool use_mmap;
+
     ThreadVars *tv;
     TmSlot *slot;
 
+    /* set if several readers share a directory, to keep their flows apart */
+    LiveDevice *livedev;
+
     /* counters */
     uint64_t pkts;
     uint64_t bytes;
@@ -69,12 +83,17 @@ typedef struct PcapFileFileVars_
 {
     char *filename;
     pcap_t *pcap_handle;
+    /* set instead of pcap_handle if the file is read through mmap */
+    PcapFileMmapReader *mmap;
 
     int datalink;
     struct bpf_program filter;
 
     PcapFileSharedVars *shared;
 
+    /* copy of filename for the loggers, kept until shutdown */
+    const char *log_filename;
+
     /* fields used to get the first packets timestamp early,
      * so it can be used to setup the time subsys. */
     const u_char *first_pkt_data;
@@ -0,0 +1,704 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Reader for pcap and pcapng files mapped in memory.
+ *
+ * The file is mapped copy on write and packets point in the mapping,
+ * which is kept until the last of them is released. Only the link types
+ * the pcap-file decoder supports are handled, anything else makes
+ * PcapFileMmapOpen() fail so the caller can fall back to libpcap.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "source-pcap-file-mmap.h"
+#include "tmqh-packetpool.h"
+#include "util-byte.h"
+#include "util-unittest.h"
+
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_MAGIC_NSEC     0xa1b23c4d
+#define PCAPNG_SHB          0x0A0D0D0A
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+
+#define PCAPNG_IDB          1
+#define PCAPNG_OPB          2
+#define PCAPNG_SPB          3
+#define PCAPNG_EPB          6
+
+#define PCAPNG_OPT_END      0
+#define PCAPNG_OPT_TSRESOL  9
+#define PCAPNG_OPT_TSOFFSET 14
+
+/* same limit as libpcap */
+#define PCAP_FILE_MMAP_MAX_SNAPLEN  262144
+
+static PcapFileMap *PcapFileMapNew(uint8_t *data, size_t len, bool mapped)
+{
+    PcapFileMap *map = SCCalloc(1, sizeof(PcapFileMap));
+    if (unlikely(map == NULL))
+        return NULL;
+    map->data = data;
+    map->len = len;
+    map->mapped = mapped;
+    SC_ATOMIC_INIT(map->refs);
+    (void)SC_ATOMIC_SET(map->refs, 1);
+    return map;
+}
+
+static void PcapFileMapRelease(PcapFileMap *map)
+{
+    if (SC_ATOMIC_SUB(map->refs, 1) != 0)
+        return;
+
+#ifdef HAVE_SYS_MMAN_H
+    if (map->mapped)
+        munmap(map->data, map->len);
+#endif
+    SC_ATOMIC_DESTROY(map->refs);
+    SCFree(map);
+}
+
+static void PcapFileMmapReleasePacket(Packet *p)
+{
+    PcapFileMap *map = p->pcap_v.map;
+
+    p->pcap_v.map = NULL;
+    PacketFreeOrRelease(p);
+    PcapFileMapRelease(map);
+}
+
+/**
+ * \brief make the packet hold a reference to the file mapping
+ *
+ * To be called after pointing the packet data in the mapping.
+ */
+void PcapFileMmapPacketSetup(PcapFileMmapReader *r, Packet *p)
+{
+    (void)SC_ATOMIC_ADD(r->map->refs, 1);
+    p->pcap_v.map = r->map;
+    p->ReleasePacket = PcapFileMmapReleasePacket;
+}
+
+static inline uint16_t Read16(const PcapFileMmapReader *r, const uint8_t *d)
+{
+    uint16_t v;
+    memcpy(&v, d, sizeof(v));
+    return r->swapped ? SCByteSwap16(v) : v;
+}
+
+static inline uint32_t Read32(const PcapFileMmapReader *r, const uint8_t *d)
+{
+    uint32_t v;
+    memcpy(&v, d, sizeof(v));
+    return r->swapped ? SCByteSwap32(v) : v;
+}
+
+/** \brief link types the pcap-file decoder handles, as in ValidateLinkType() */
+static bool PcapFileMmapLinkTypeSupported(uint32_t linktype)
+{
+    switch (linktype) {
+        case LINKTYPE_NULL:
+        case LINKTYPE_ETHERNET:
+        case LINKTYPE_PPP:
+        case LINKTYPE_LINUX_SLL:
+        case LINKTYPE_RAW:
+        case LINKTYPE_RAW2:
+        case LINKTYPE_IPV4:
+        case LINKTYPE_GRE_OVER_IP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * \brief parse a pcapng section header block
+ *
+ * \retval 0 ok, -1 error
+ */
+static int PcapngParseSHB(PcapFileMmapReader *r, const uint8_t *b, size_t avail)
+{
+    if (avail < 28)
+        return -1;
+
+    uint32_t order;
+    memcpy(&order, b + 8, sizeof(order));
+    if (order == PCAPNG_BYTE_ORDER) {
+        r->swapped = false;
+    } else if (order == SCByteSwap32(PCAPNG_BYTE_ORDER)) {
+        r->swapped = true;
+    } else {
+        return -1;
+    }
+    if (Read16(r, b + 12) != 1)
+        return -1;
+
+    r->ifaces_cnt = 0;
+    return 0;
+}
+
+/**
+ * \brief parse a pcapng interface description block
+ *
+ * \retval 0 ok, -1 error
+ */
+static int PcapngParseIDB(PcapFileMmapReader *r, const uint8_t *b, uint32_t blen)
+{
+    if (blen < 20)
+        return -1;
+    if (r->ifaces_cnt == PCAP_FILE_MMAP_MAX_IFACES) {
+        snprintf(r->errbuf, sizeof(r->errbuf), "too many interfaces");
+        return -1;
+    }
+
+    PcapFileMmapIface *iface = &r->ifaces[r->ifaces_cnt];
+    memset(iface, 0, sizeof(*iface));
+    iface->linktype = Read16(r, b + 8);
+    iface->snaplen = Read32(r, b + 12);
+    iface->ts_units = 1000000;
+
+    /* options */
+    const uint8_t *o = b + 16;
+    const uint8_t *end = b + blen - 4;
+    while (o + 4 <= end) {
+        uint16_t code = Read16(r, o);
+        uint16_t len = Read16(r, o + 2);
+        if (code == PCAPNG_OPT_END || o + 4 + len > end)
+            break;
+
+        if (code == PCAPNG_OPT_TSRESOL && len == 1) {
+            uint8_t res = o[4];
+            if (res & 0x80) {
+                if ((res & 0x7f) > 63)
+                    return -1;
+                iface->ts_units = 0;
+                iface->ts_shift = res & 0x7f;
+            } else {
+                if (res > 19)
+                    return -1;
+                iface->ts_units = 1;
+                for (uint8_t i = 0; i < res; i++)
+                    iface->ts_units *= 10;
+            }
+        } else if (code == PCAPNG_OPT_TSOFFSET && len == 8) {
+            uint64_t v;
+            memcpy(&v, o + 4, sizeof(v));
+            iface->ts_offset = (int64_t)(r->swapped ? SCByteSwap64(v) : v);
+        }
+        o += 4 + ((len + 3) & ~3);
+    }
+
+    /* packets of all interfaces go out with the datalink of the file */
+    if (r->ifaces_cnt == 0 && r->datalink == -1) {
+        r->datalink = iface->linktype;
+        r->snaplen = iface->snaplen;
+    } else if (iface->linktype != r->datalink) {
+        snprintf(r->errbuf, sizeof(r->errbuf), "interface %u has link type "
+                 "%d, different from %d", r->ifaces_cnt, iface->linktype,
+                 r->datalink);
+        return -1;
+    }
+
+    r->ifaces_cnt++;
+    return 0;
+}
+
+static void PcapngSetTimestamp(const PcapFileMmapIface *iface,
+                               uint32_t ts_high, uint32_t ts_low,
+                               struct timeval *tv)
+{
+    uint64_t ts = ((uint64_t)ts_high << 32) | ts_low;
+    uint64_t sec, frac;
+
+    if (iface->ts_units == 1000000) {
+        sec = ts / 1000000;
+        frac = ts % 1000000;
+    } else if (iface->ts_units == 0) {
+        sec = ts >> iface->ts_shift;
+        frac = ts & ((1ULL << iface->ts_shift) - 1);
+        frac = (uint64_t)((double)frac * 1000000.0 / (double)(1ULL << iface->ts_shift));
+    } else {
+        sec = ts / iface->ts_units;
+        frac = ts % iface->ts_units;
+        if (iface->ts_units > 1000000)
+            frac /= iface->ts_units / 1000000;
+        else
+            frac *= 1000000 / iface->ts_units;
+    }
+
+    tv->tv_sec = (time_t)(sec + iface->ts_offset);
+    tv->tv_usec = (suseconds_t)frac;
+}
+
+/**
+ * \brief get the next pcapng block
+ *
+ * Section header blocks are parsed here, as they set the byte order.
+ *
+ * \retval 1 block, 0 end of file, -1 error
+ */
+static int PcapngNextBlock(PcapFileMmapReader *r, uint32_t *type,
+                           const uint8_t **block, uint32_t *blen)
+{
+    const PcapFileMap *map = r->map;
+
+    if (r->offset == map->len)
+        return 0;
+
+    const uint8_t *b = map->data + r->offset;
+    size_t avail = map->len - r->offset;
+    if (avail < 12) {
+        snprintf(r->errbuf, sizeof(r->errbuf), "truncated block");
+        return -1;
+    }
+
+    memcpy(type, b, sizeof(*type));
+    if (*type == PCAPNG_SHB) {
+        if (PcapngParseSHB(r, b, avail) < 0) {
+            snprintf(r->errbuf, sizeof(r->errbuf), "bad section header");
+            return -1;
+        }
+    } else {
+        *type = Read32(r, b);
+    }
+
+    *blen = Read32(r, b + 4);
+    if (*blen < 12 || (*blen & 3) || *blen > avail) {
+        snprintf(r->errbuf, sizeof(r->errbuf), "bad block length %u at "
+                 "offset %"PRIuMAX, *blen, (uintmax_t)r->offset);
+        return -1;
+    }
+
+    *block = b;
+    r->offset += *blen;
+    return 1;
+}
+
+/**
+ * \brief get the next packet of a pcapng file
+ *
+ * \retval 1 packet, 0 end of file, -1 error
+ */
+static int PcapngNext(PcapFileMmapReader *r, const uint8_t **data)
+{
+    uint32_t type, blen;
+    const uint8_t *b;
+    int ret;
+
+    while ((ret = PcapngNextBlock(r, &type, &b, &blen)) == 1) {
+        uint32_t ifidx = 0, caplen = 0, len = 0;
+        uint32_t ts_high = 0, ts_low = 0;
+        const uint8_t *pkt = NULL;
+
+        switch (type) {
+            case PCAPNG_IDB:
+                if (PcapngParseIDB(r, b, blen) < 0) {
+                    if (r->errbuf[0] == '\0')
+                        snprintf(r->errbuf, sizeof(r->errbuf), "bad interface block");
+                    return -1;
+                }
+                continue;
+            case PCAPNG_EPB:
+            case PCAPNG_OPB:
+                if (blen < 32)
+                    goto bad;
+                if (type == PCAPNG_EPB)
+                    ifidx = Read32(r, b + 8);
+                else
+                    ifidx = Read16(r, b + 8);
+                ts_high = Read32(r, b + 12);
+                ts_low = Read32(r, b + 16);
+                caplen = Read32(r, b + 20);
+                len = Read32(r, b + 24);
+                pkt = b + 28;
+                if (caplen > blen - 32)
+                    goto bad;
+                break;
+            case PCAPNG_SPB:
+                if (blen < 16)
+                    goto bad;
+                len = Read32(r, b + 8);
+                caplen = len;
+                if (r->ifaces_cnt > 0 && r->ifaces[0].snaplen != 0 &&
+                    caplen > r->ifaces[0].snaplen)
+                    caplen = r->ifaces[0].snaplen;
+                if (caplen > blen - 16)
+                    caplen = blen - 16;
+                pkt = b + 12;
+                break;
+            default:
+                /* name resolution, statistics, custom, ... */
+                continue;
+        }
+
+        if (ifidx >= r->ifaces_cnt) {
+            snprintf(r->errbuf, sizeof(r->errbuf), "packet for unknown "
+                     "interface %u", ifidx);
+            return -1;
+        }
+        if (caplen > PCAP_FILE_MMAP_MAX_SNAPLEN)
+            goto bad;
+
+        if (type == PCAPNG_SPB) {
+            r->hdr.ts.tv_sec = 0;
+            r->hdr.ts.tv_usec = 0;
+        } else {
+            PcapngSetTimestamp(&r->ifaces[ifidx], ts_high, ts_low, &r->hdr.ts);
+        }
+        r->hdr.caplen = caplen;
+        r->hdr.len = len;
+        *data = pkt;
+        return 1;
+
+    bad:
+        snprintf(r->errbuf, sizeof(r->errbuf), "bad packet block at offset "
+                 "%"PRIuMAX, (uintmax_t)(b - r->map->data));
+        return -1;
+    }
+
+    return ret;
+}
+
+/**
+ * \brief get the next packet of a pcap file
+ *
+ * \retval 1 packet, 0 end of file, -1 error
+ */
+static int PcapNext(PcapFileMmapReader *r, const uint8_t **data)
+{
+    const PcapFileMap *map = r->map;
+
+    if (r->offset == map->len)
+        return 0;
+    if (map->len - r->offset < 16) {
+        snprintf(r->errbuf, sizeof(r->errbuf), "truncated dump file; tried "
+                 "to read 16 header bytes, only got %"PRIuMAX,
+                 (uintmax_t)(map->len - r->offset));
+        return -1;
+    }
+
+    const uint8_t *h = map->data + r->offset;
+    uint32_t sec = Read32(r, h);
+    uint32_t frac = Read32(r, h + 4);
+    uint32_t caplen = Read32(r, h + 8);
+    uint32_t len = Read32(r, h + 12);
+
+    if (caplen > PCAP_FILE_MMAP_MAX_SNAPLEN) {
+        snprintf(r->errbuf, sizeof(r->errbuf), "invalid packet capture "
+                 "length %u, bigger than maximum of %u", caplen,
+                 PCAP_FILE_MMAP_MAX_SNAPLEN);
+        return -1;
+    }
+    if (caplen > map->len - r->offset - 16) {
+        snprintf(r->errbuf, sizeof(r->errbuf), "truncated dump file; tried "
+                 "to read %u captured bytes, only got %"PRIuMAX, caplen,
+                 (uintmax_t)(map->len - r->offset - 16));
+        return -1;
+    }
+
+    r->hdr.ts.tv_sec = sec;
+    r->hdr.ts.tv_usec = r->nsec ? frac / 1000 : frac;
+    r->hdr.caplen = caplen;
+    r->hdr.len = len;
+    *data = h + 16;
+    r->offset += 16 + caplen;
+    return 1;
+}
+
+/**
+ * \brief get the next packet
+ *
+ * The header is valid until the next call, the data as long as the
+ * reader is open or a packet set up with PcapFileMmapPacketSetup()
+ * points to it.
+ *
+ * \retval 1 packet, 0 end of file, -1 error
+ */
+int PcapFileMmapNext(PcapFileMmapReader *r, struct pcap_pkthdr **hdr,
+                     const uint8_t **data)
+{
+    int ret = r->pcapng ? PcapngNext(r, data) : PcapNext(r, data);
+    if (ret == 1)
+        *hdr = &r->hdr;
+    return ret;
+}
+
+/**
+ * \brief setup a reader on a mapped file
+ *
+ * \retval r reader or NULL if the file isn't in a format we handle
+ */
+static PcapFileMmapReader *PcapFileMmapReaderNew(PcapFileMap *map)
+{
+    PcapFileMmapReader *r = SCCalloc(1, sizeof(PcapFileMmapReader));
+    if (unlikely(r == NULL))
+        return NULL;
+    r->map = map;
+    r->datalink = -1;
+
+    if (map->len < 24)
+        goto unsupported;
+
+    uint32_t magic;
+    memcpy(&magic, map->data, sizeof(magic));
+
+    if (magic == PCAPNG_SHB) {
+        r->pcapng = true;
+        /* the datalink is the one of the first interface */
+        while (r->datalink == -1) {
+            uint32_t type, blen;
+            const uint8_t *b;
+            if (PcapngNextBlock(r, &type, &b, &blen) != 1)
+                goto unsupported;
+            if (type == PCAPNG_IDB) {
+                if (PcapngParseIDB(r, b, blen) < 0)
+                    goto unsupported;
+            } else if (type == PCAPNG_EPB || type == PCAPNG_OPB ||
+                       type == PCAPNG_SPB) {
+                goto unsupported;
+            }
+        }
+        /* start over, the interfaces are set up again as the blocks
+         * are read */
+        r->offset = 0;
+        r->ifaces_cnt = 0;
+    } else {
+        if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC) {
+            r->swapped = false;
+        } else if (magic == SCByteSwap32(PCAP_MAGIC) ||
+                   magic == SCByteSwap32(PCAP_MAGIC_NSEC)) {
+            r->swapped = true;
+        } else {
+            goto unsupported;
+        }
+        r->nsec = (Read32(r, map->data) == PCAP_MAGIC_NSEC);
+        if (Read16(r, map->data + 4) != 2)
+            goto unsupported;
+
+        r->snaplen = Read32(r, map->data + 16);
+        uint32_t linktype = Read32(r, map->data + 20);
+        /* FCS and other flags in the upper bits */
+        if (linktype > 0xffff)
+            goto unsupported;
+        r->datalink = (int)linktype;
+        r->offset = 24;
+    }
+
+    if (!PcapFileMmapLinkTypeSupported(r->datalink))
+        goto unsupported;
+
+    return r;
+
+unsupported:
+    SCFree(r);
+    return NULL;
+}
+
+/**
+ * \brief map a pcap or pcapng file
+ *
+ * \retval r reader or NULL if the file can't be mapped or is in a format
+ *           that should be read through libpcap
+ */
+PcapFileMmapReader *PcapFileMmapOpen(const char *filename)
+{
+#ifdef HAVE_SYS_MMAN_H
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 24 ||
+        (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return NULL;
+    }
+
+    /* private writable mapping, in case a packet is changed in place */
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        SCLogDebug("mmap of %s failed: %s", filename, strerror(errno));
+        return NULL;
+    }
+    (void)madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    PcapFileMap *map = PcapFileMapNew(data, (size_t)st.st_size, true);
+    if (map == NULL) {
+        munmap(data, (size_t)st.st_size);
+        return NULL;
+    }
+
+    PcapFileMmapReader *r = PcapFileMmapReaderNew(map);
+    if (r == NULL) {
+        SCLogDebug("%s: format not handled by the mmap reader", filename);
+        PcapFileMapRelease(map);
+        return NULL;
+    }
+    return r;
+#else
+    return NULL;
+#endif
+}
+
+void PcapFileMmapClose(PcapFileMmapReader *r)
+{
+    if (r == NULL)
+        return;
+    PcapFileMapRelease(r->map);
+    SCFree(r);
+}
+
+#ifdef UNITTESTS
+
+static PcapFileMmapReader *PcapFileMmapReaderFromBuffer(uint8_t *buf, size_t len)
+{
+    PcapFileMap *map = PcapFileMapNew(buf, len, false);
+    if (map == NULL)
+        return NULL;
+    PcapFileMmapReader *r = PcapFileMmapReaderNew(map);
+    if (r == NULL)
+        PcapFileMapRelease(map);
+    return r;
+}
+
+/** \test big endian pcap with nanosecond timestamps */
+static int PcapFileMmapTest01(void)
+{
+    uint8_t buf[] = {
+        0xa1, 0xb2, 0x3c, 0x4d, 0x00, 0x02, 0x00, 0x04,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0xff, 0xff, 0x00, 0x00, 0x00, 0x01,
+        /* packet: 10s 2500ns, 4 of 60 bytes */
+        0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x09, 0xc4,
+        0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x3c,
+        0xde, 0xad, 0xbe, 0xef,
+        /* truncated packet */
+        0x00, 0x00, 0x00, 0x0b, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08,
+        0x01, 0x02,
+    };
+    struct pcap_pkthdr *hdr = NULL;
+    const uint8_t *data = NULL;
+
+    PcapFileMmapReader *r = PcapFileMmapReaderFromBuffer(buf, sizeof(buf));
+    FAIL_IF_NULL(r);
+    FAIL_IF_NOT(r->datalink == LINKTYPE_ETHERNET);
+    FAIL_IF_NOT(r->nsec);
+
+    FAIL_IF_NOT(PcapFileMmapNext(r, &hdr, &data) == 1);
+    FAIL_IF_NOT(hdr->ts.tv_sec == 10);
+    FAIL_IF_NOT(hdr->ts.tv_usec == 2);
+    FAIL_IF_NOT(hdr->caplen == 4);
+    FAIL_IF_NOT(hdr->len == 60);
+    FAIL_IF_NOT(data == buf + 40);
+
+    FAIL_IF_NOT(PcapFileMmapNext(r, &hdr, &data) == -1);
+
+    PcapFileMmapClose(r);
+    PASS;
+}
+
+/** \test pcapng with an unknown block, a nanosecond interface and
+ *        an enhanced packet block */
+static int PcapFileMmapTest02(void)
+{
+    uint8_t buf[] = {
+        /* SHB, little endian */
+        0x0a, 0x0d, 0x0d, 0x0a, 0x1c, 0x00, 0x00, 0x00,
+        0x4d, 0x3c, 0x2b, 0x1a, 0x01, 0x00, 0x00, 0x00,
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+        0x1c, 0x00, 0x00, 0x00,
+        /* IDB, ethernet, if_tsresol 9 */
+        0x01, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0x00,
+        0x09, 0x00, 0x01, 0x00, 0x09, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00,
+        /* custom block */
+        0xad, 0x0b, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+        /* EPB: ts 2759572700 ns, 5 bytes */
+        0x06, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xdc, 0xbc, 0x7b, 0xa4, 0x05, 0x00, 0x00, 0x00,
+        0x05, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04,
+        0x05, 0x00, 0x00, 0x00, 0x28, 0x00, 0x00, 0x00,
+    };
+    struct pcap_pkthdr *hdr = NULL;
+    const uint8_t *data = NULL;
+
+    PcapFileMmapReader *r = PcapFileMmapReaderFromBuffer(buf, sizeof(buf));
+    FAIL_IF_NULL(r);
+    FAIL_IF_NOT(r->pcapng);
+    FAIL_IF_NOT(r->datalink == LINKTYPE_ETHERNET);
+
+    FAIL_IF_NOT(PcapFileMmapNext(r, &hdr, &data) == 1);
+    FAIL_IF_NOT(hdr->ts.tv_sec == 2);
+    FAIL_IF_NOT(hdr->ts.tv_usec == 759572);
+    FAIL_IF_NOT(hdr->caplen == 5);
+    FAIL_IF_NOT(data[0] == 0x01 && data[4] == 0x05);
+
+    FAIL_IF_NOT(PcapFileMmapNext(r, &hdr, &data) == 0);
+
+    PcapFileMmapClose(r);
+    PASS;
+}
+
+/** \test unsupported formats are left to libpcap */
+static int PcapFileMmapTest03(void)
+{
+    uint8_t buf[] = {
+        0xd4, 0xc3, 0xb2, 0xa1, 0x02, 0x00, 0x04, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xff, 0xff, 0x00, 0x00, 0x69, 0x00, 0x00, 0x00,
+    };
+
+    /* 802.11 */
+    FAIL_IF_NOT_NULL(PcapFileMmapReaderFromBuffer(buf, sizeof(buf)));
+
+    /* ethernet with FCS flags */
+    buf[20] = 0x01;
+    buf[23] = 0x14;
+    FAIL_IF_NOT_NULL(PcapFileMmapReaderFromBuffer(buf, sizeof(buf)));
+
+    /* ethernet */
+    buf[23] = 0x00;
+    PcapFileMmapReader *r = PcapFileMmapReaderFromBuffer(buf, sizeof(buf));
+    FAIL_IF_NULL(r);
+    PcapFileMmapClose(r);
+
+    /* not a pcap */
+    buf[0] = 0x1f;
+    FAIL_IF_NOT_NULL(PcapFileMmapReaderFromBuffer(buf, sizeof(buf)));
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void PcapFileMmapRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapFileMmapTest01", PcapFileMmapTest01);
+    UtRegisterTest("PcapFileMmapTest02", PcapFileMmapTest02);
+    UtRegisterTest("PcapFileMmapTest03", PcapFileMmapTest03);
+#endif
+}
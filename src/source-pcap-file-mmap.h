@@ -0,0 +1,86 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Reader for pcap and pcapng files mapped in memory, so the packets
+ * can point to the file data instead of being copied.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+
+#ifndef __SOURCE_PCAP_FILE_MMAP_H__
+#define __SOURCE_PCAP_FILE_MMAP_H__
+
+/** pcapng interfaces we keep track of in a section */
+#define PCAP_FILE_MMAP_MAX_IFACES 64
+
+/**
+ * File mapping, released when the reader and all the packets pointing
+ * in it are done.
+ */
+typedef struct PcapFileMap_ {
+    uint8_t *data;
+    size_t len;
+    /* false if data doesn't come from mmap */
+    bool mapped;
+    SC_ATOMIC_DECLARE(uint32_t, refs);
+} PcapFileMap;
+
+typedef struct PcapFileMmapIface_ {
+    int linktype;
+    uint32_t snaplen;
+    /* timestamp units per second, 0 for a power of 2 */
+    uint64_t ts_units;
+    uint8_t ts_shift;
+    int64_t ts_offset;
+} PcapFileMmapIface;
+
+typedef struct PcapFileMmapReader_ {
+    PcapFileMap *map;
+    size_t offset;
+
+    bool pcapng;
+    /* file, or current pcapng section, in the other byte order */
+    bool swapped;
+    /* classic pcap with nanosecond timestamps */
+    bool nsec;
+
+    int datalink;
+    uint32_t snaplen;
+
+    /* pcapng interfaces of the current section */
+    PcapFileMmapIface ifaces[PCAP_FILE_MMAP_MAX_IFACES];
+    uint32_t ifaces_cnt;
+
+    /* header of the last packet returned */
+    struct pcap_pkthdr hdr;
+
+    char errbuf[256];
+} PcapFileMmapReader;
+
+PcapFileMmapReader *PcapFileMmapOpen(const char *filename);
+int PcapFileMmapNext(PcapFileMmapReader *r, struct pcap_pkthdr **hdr,
+                     const uint8_t **data);
+void PcapFileMmapClose(PcapFileMmapReader *r);
+void PcapFileMmapPacketSetup(PcapFileMmapReader *r, Packet *p);
+
+void PcapFileMmapRegisterTests(void);
+
+#endif /* __SOURCE_PCAP_FILE_MMAP_H__ */
@@ -29,6 +29,7 @@
 #include "source-pcap-file-directory-helper.h"
 #include "flow-manager.h"
 #include "util-checksum.h"
+#include "util-unittest.h"
 
 extern int max_pending_packets;
 PcapFileGlobalVars pcap_g;
@@ -139,7 +140,20 @@ void TmModuleDecodePcapFileRegister (void)
 void PcapFileGlobalInit()
 {
     memset(&pcap_g, 0x00, sizeof(pcap_g));
+    SC_ATOMIC_INIT(pcap_g.cnt);
     SC_ATOMIC_INIT(pcap_g.invalid_checksums);
+    SC_ATOMIC_INIT(pcap_g.readers);
+    SC_ATOMIC_INIT(pcap_g.ts_init);
+    pcap_g.active = true;
+}
+
+/**
+ * \brief a reader is done
+ * \retval true if it was the last one
+ */
+static bool PcapFileReaderDone(void)
+{
+    return SC_ATOMIC_SUB(pcap_g.readers, 1) == 0;
 }
 
 TmEcode PcapFileExit(TmEcode status, struct timespec *last_processed)
@@ -148,7 +162,11 @@ TmEcode PcapFileExit(TmEcode status, struct timespec *last_processed)
         status = UnixSocketPcapFile(status, last_processed);
         SCReturnInt(status);
     } else {
-        EngineStop();
+        /* with several readers the engine stops when the last one is done */
+        if (PcapFileReaderDone()) {
+            PcapDirectoryClaimsFree();
+            EngineStop();
+        }
         SCReturnInt(status);
     }
 }
@@ -196,6 +214,8 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
     const char *tmpstring = NULL;
     const char *tmp_bpf_string = NULL;
 
+    (void) SC_ATOMIC_ADD(pcap_g.readers, 1);
+
     if (initdata == NULL) {
         SCLogError(SC_ERR_INVALID_ARGUMENT, "error: initdata == NULL");
 
@@ -238,6 +258,17 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, const void *initdata, void **d
         ptv->shared.should_delete = should_delete == 1;
     }
 
+    /* the runmode registers a device per reader if there are several */
+    if (g_livedev_tracking) {
+        ptv->shared.livedev = LiveGetDevice(tv->name);
+    }
+
+    int use_mmap = 0;
+    ptv->shared.use_mmap = true;
+    if (ConfGetBool("pcap-file.mmap", &use_mmap) == 1) {
+        ptv->shared.use_mmap = use_mmap == 1;
+    }
+
     DIR *directory = NULL;
     SCLogDebug("checking file or directory %s", (char*)initdata);
     if(PcapDetermineDirectoryOrFile((char *)initdata, &directory) == TM_ECODE_FAILED) {
@@ -356,9 +387,10 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data)
         PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
 
         if (pcap_g.conf_checksum_mode == CHECKSUM_VALIDATION_AUTO &&
-            pcap_g.cnt < CHECKSUM_SAMPLE_COUNT &&
+            SC_ATOMIC_GET(pcap_g.cnt) < CHECKSUM_SAMPLE_COUNT &&
             SC_ATOMIC_GET(pcap_g.invalid_checksums)) {
-            uint64_t chrate = pcap_g.cnt / SC_ATOMIC_GET(pcap_g.invalid_checksums);
+            uint64_t chrate = SC_ATOMIC_GET(pcap_g.cnt) /
+                SC_ATOMIC_GET(pcap_g.invalid_checksums);
             if (chrate < CHECKSUM_INVALID_RATIO)
                 SCLogWarning(SC_ERR_INVALID_CHECKSUM,
                          "1/%" PRIu64 "th of packets have an invalid checksum,"
@@ -456,3 +488,65 @@ void PcapIncreaseInvalidChecksum()
 }
 
 /* eof */
+
+#ifdef UNITTESTS
+/** \test only the last reader to finish is done */
+static int PcapFileTest01(void)
+{
+    PcapFileGlobalInit();
+    for (int i = 0; i < 3; i++) {
+        (void) SC_ATOMIC_ADD(pcap_g.readers, 1);
+    }
+    FAIL_IF(PcapFileReaderDone());
+    FAIL_IF(PcapFileReaderDone());
+    FAIL_IF_NOT(PcapFileReaderDone());
+    PASS;
+}
+
+static void *PcapFileTestLogThread(void *arg)
+{
+    Packet *p = arg;
+    PcapFileSetLogPacket(p);
+    return (void *)PcapFileGetFilename();
+}
+
+/** \test the loggers of a thread report the file of their packet */
+static int PcapFileTest02(void)
+{
+    PcapFileGlobalInit();
+    Packet *p1 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p1);
+    Packet *p2 = PacketGetFromAlloc();
+    FAIL_IF_NULL(p2);
+    p1->pcap_v.filename = "/pcaps/1.pcap";
+    p2->pcap_v.filename = "/pcaps/2.pcap";
+
+    PcapFileSetLogPacket(p1);
+    FAIL_IF_NOT(strcmp(PcapFileGetFilename(), "/pcaps/1.pcap") == 0);
+
+    pthread_t thread;
+    void *other = NULL;
+    FAIL_IF(pthread_create(&thread, NULL, PcapFileTestLogThread, p2) != 0);
+    pthread_join(thread, &other);
+    FAIL_IF_NULL(other);
+    FAIL_IF_NOT(strcmp(other, "/pcaps/2.pcap") == 0);
+    FAIL_IF_NOT(strcmp(PcapFileGetFilename(), "/pcaps/1.pcap") == 0);
+
+    /* a packet without a file falls back to the last file opened */
+    p1->pcap_v.filename = NULL;
+    PcapFileSetLogPacket(p1);
+    FAIL_IF(strcmp(PcapFileGetFilename(), "/pcaps/1.pcap") == 0);
+
+    PacketFree(p1);
+    PacketFree(p2);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void PcapFileRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapFileTest01", PcapFileTest01);
+    UtRegisterTest("PcapFileTest02", PcapFileTest02);
+#endif
+}
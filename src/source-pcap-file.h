@@ -31,6 +31,10 @@ void PcapIncreaseInvalidChecksum(void);
 
 void PcapFileGlobalInit(void);
 const char *PcapFileGetFilename(void);
+void PcapFileSetLogPacket(const struct Packet_ *p);
+void PcapFileNamesFree(void);
+
+void PcapFileRegisterTests(void);
 
 #endif /* __SOURCE_PCAP_FILE_H__ */
 
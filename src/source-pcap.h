@@ -35,6 +35,10 @@ void PcapTranslateIPToDevice(char *pcap_dev, size_t len);
 typedef struct PcapPacketVars_
 {
     uint32_t tenant_id;
+    /* pcap file mapping the packet data points to */
+    struct PcapFileMap_ *map;
+    /* name of the pcap file the packet was read from */
+    const char *filename;
 } PcapPacketVars;
 
 /** needs to be able to contain Windows adapter id's, so
@@ -125,6 +125,8 @@ typedef struct TcpStream_ {
     uint32_t sack_size;             /**< combined size of the SACK ranges currently in our tree. Updated
                                      *   at INSERT/REMOVE time. */
     struct TCPSACK sack_tree;       /**< red back tree of TCP SACK records. */
+
+    struct MpmStreamState_ *mpm_state; /**< resumable stream mpm state, lazily allocated */
 } TcpStream;
 
 #define STREAM_BASE_OFFSET(stream)  ((stream)->sb.stream_offset)
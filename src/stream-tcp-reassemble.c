@@ -1469,7 +1469,7 @@ static int StreamReassembleRawInline(TcpSession *ssn, const Packet *p,
     }
 
     /* run the callback */
-    r = Callback(cb_data, mydata, mydata_len);
+    r = Callback(cb_data, mydata, mydata_len, mydata_offset);
     BUG_ON(r < 0);
 
     if (return_progress) {
@@ -1631,7 +1631,7 @@ static int StreamReassembleRawDo(TcpSession *ssn, TcpStream *stream,
         SCLogDebug("data %p len %u", mydata, mydata_len);
 
         /* we have data. */
-        r = Callback(cb_data, mydata, mydata_len);
+        r = Callback(cb_data, mydata, mydata_len, mydata_offset);
         BUG_ON(r < 0);
 
         if (mydata_offset == progress) {
@@ -205,6 +205,11 @@ void StreamTcpStreamCleanup(TcpStream *stream)
         StreamTcpSackFreeList(stream);
         StreamTcpReturnStreamSegments(stream);
         StreamingBufferClear(&stream->sb);
+        if (stream->mpm_state != NULL) {
+            SCFree(stream->mpm_state);
+            stream->mpm_state = NULL;
+            StreamTcpDecrMemuse((uint64_t)sizeof(MpmStreamState));
+        }
     }
 }
 
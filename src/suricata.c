@@ -94,6 +94,7 @@
 #include "source-napatech.h"
 
 #include "source-af-packet.h"
+#include "source-af-xdp.h"
 #include "source-netmap.h"
 
 #include "source-windivert.h"
@@ -236,6 +237,10 @@ int g_disable_randomness = 1;
   * comparing flows */
 uint16_t g_vlan_mask = 0xffff;
 
+/** keep the flows of different live devices apart, set when several pcap
+  * files are read at the same time */
+bool g_livedev_tracking = false;
+
 /** Suricata instance */
 SCInstance suricata;
 
@@ -379,6 +384,7 @@ static void GlobalsDestroy(SCInstance *suri)
 
     LiveDeviceListClean();
     OutputDeregisterAll();
+    PcapFileNamesFree();
     TimeDeinit();
     SCProtoNameDeInit();
     if (!suri->disabled_detect) {
@@ -401,6 +407,9 @@ static void GlobalsDestroy(SCInstance *suri)
 #ifdef HAVE_AF_PACKET
     AFPPeersListClean();
 #endif
+#ifdef HAVE_AF_XDP
+    AFXDPSocketsListClean();
+#endif
 
 #ifdef NFQ
     NFQContextsClean();
@@ -648,6 +657,9 @@ static void PrintUsage(const char *progname)
 #ifdef HAVE_NETMAP
     printf("\t--netmap[=<dev>]                     : run in netmap mode, no value select interfaces from suricata.yaml\n");
 #endif
+#ifdef HAVE_AF_XDP
+    printf("\t--af-xdp[=<dev>]                     : run in af-xdp mode, no value select interfaces from suricata.yaml\n");
+#endif
 #ifdef HAVE_PFRING
     printf("\t--pfring[=<dev>]                     : run in pfring mode, use interfaces from suricata.yaml\n");
     printf("\t--pfring-int <dev>                   : run in pfring mode, use interface <dev>\n");
@@ -717,6 +729,9 @@ static void PrintBuildInfo(void)
 #ifdef HAVE_NETMAP
     strlcat(features, "NETMAP ", sizeof(features));
 #endif
+#ifdef HAVE_AF_XDP
+    strlcat(features, "AF_XDP ", sizeof(features));
+#endif
 #ifdef HAVE_PACKET_FANOUT
     strlcat(features, "HAVE_PACKET_FANOUT ", sizeof(features));
 #endif
@@ -766,6 +781,9 @@ static void PrintBuildInfo(void)
 
     /* SIMD stuff */
     memset(features, 0x00, sizeof(features));
+#if defined(__AVX2__)
+    strlcat(features, "AVX2 ", sizeof(features));
+#endif
 #if defined(__SSE4_2__)
     strlcat(features, "SSE_4_2 ", sizeof(features));
 #endif
@@ -892,6 +910,9 @@ void RegisterAllModules(void)
     /* netmap */
     TmModuleReceiveNetmapRegister();
     TmModuleDecodeNetmapRegister();
+    /* af-xdp */
+    TmModuleReceiveAFXDPRegister();
+    TmModuleDecodeAFXDPRegister();
     /* pfring */
     TmModuleReceivePfringRegister();
     TmModuleDecodePfringRegister();
@@ -997,6 +1018,22 @@ static TmEcode ParseInterfacesList(const int runmode, char *pcap_dev)
             }
         }
 #endif
+#ifdef HAVE_AF_XDP
+    } else if (runmode == RUNMODE_AFXDP_DEV) {
+        /* iface has been set on command line */
+        if (strlen(pcap_dev)) {
+            if (ConfSetFinal("af-xdp.live-interface", pcap_dev) != 1) {
+                SCLogError(SC_ERR_INITIALIZATION, "Failed to set af-xdp.live-interface");
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+        } else {
+            int ret = LiveBuildDeviceList("af-xdp");
+            if (ret == 0) {
+                SCLogError(SC_ERR_INITIALIZATION, "No interface found in config for af-xdp");
+                SCReturnInt(TM_ECODE_FAILED);
+            }
+        }
+#endif
 #ifdef HAVE_NFLOG
     } else if (runmode == RUNMODE_NFLOG) {
         int ret = LiveBuildDeviceListCustom("nflog", "group");
@@ -1143,6 +1180,37 @@ static int ParseCommandLineAfpacket(SCInstance *suri, const char *in_arg)
 #endif
 }
 
+static int ParseCommandLineAfxdp(SCInstance *suri, const char *in_arg)
+{
+#ifdef HAVE_AF_XDP
+    if (suri->run_mode == RUNMODE_UNKNOWN) {
+        suri->run_mode = RUNMODE_AFXDP_DEV;
+        if (in_arg) {
+            LiveRegisterDeviceName(in_arg);
+            memset(suri->pcap_dev, 0, sizeof(suri->pcap_dev));
+            strlcpy(suri->pcap_dev, in_arg, sizeof(suri->pcap_dev));
+        }
+    } else if (suri->run_mode == RUNMODE_AFXDP_DEV) {
+        if (in_arg) {
+            LiveRegisterDeviceName(in_arg);
+        } else {
+            SCLogInfo("Multiple af-xdp option without interface on each is useless");
+        }
+    } else {
+        SCLogError(SC_ERR_MULTIPLE_RUN_MODE, "more than one run mode "
+                "has been specified");
+        PrintUsage(suri->progname);
+        return TM_ECODE_FAILED;
+    }
+    return TM_ECODE_OK;
+#else
+    SCLogError(SC_ERR_NO_AF_XDP, "AF_XDP not enabled. On Linux "
+            "host, make sure to pass --enable-ebpf to configure when "
+            "building, with a libbpf providing bpf/xsk.h.");
+    return TM_ECODE_FAILED;
+#endif
+}
+
 static int ParseCommandLinePcapLive(SCInstance *suri, const char *in_arg)
 {
     memset(suri->pcap_dev, 0, sizeof(suri->pcap_dev));
@@ -1469,6 +1537,7 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
         {"pfring-cluster-id", required_argument, 0, 0},
         {"pfring-cluster-type", required_argument, 0, 0},
         {"af-packet", optional_argument, 0, 0},
+        {"af-xdp", optional_argument, 0, 0},
         {"netmap", optional_argument, 0, 0},
         {"pcap", optional_argument, 0, 0},
         {"pcap-file-continuous", 0, 0, 0},
@@ -1615,6 +1684,10 @@ static TmEcode ParseCommandLine(int argc, char** argv, SCInstance *suri)
                 if (ParseCommandLineAfpacket(suri, optarg) != TM_ECODE_OK) {
                     return TM_ECODE_FAILED;
                 }
+            } else if (strcmp((long_opts[option_index]).name , "af-xdp") == 0) {
+                if (ParseCommandLineAfxdp(suri, optarg) != TM_ECODE_OK) {
+                    return TM_ECODE_FAILED;
+                }
             } else if (strcmp((long_opts[option_index]).name , "netmap") == 0){
 #ifdef HAVE_NETMAP
                 if (suri->run_mode == RUNMODE_UNKNOWN) {
@@ -2539,6 +2612,7 @@ static int ConfigGetCaptureValue(SCInstance *suri)
                 /* fall through */
             case RUNMODE_PCAP_DEV:
             case RUNMODE_AFP_DEV:
+            case RUNMODE_AFXDP_DEV:
             case RUNMODE_PFRING:
                 nlive = LiveGetDeviceNameCount();
                 for (lthread = 0; lthread < nlive; lthread++) {
@@ -2667,6 +2741,14 @@ static int PostDeviceFinalizedSetup(SCInstance *suri)
         }
     }
 #endif
+#ifdef HAVE_AF_XDP
+    if (suri->run_mode == RUNMODE_AFXDP_DEV) {
+        if (AFXDPRunModeIsIPS()) {
+            SCLogInfo("AF_XDP: Setting IPS mode");
+            EngineModeSetIPS();
+        }
+    }
+#endif
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -169,6 +169,7 @@ void GlobalsInitPreConfig(void);
 extern volatile uint8_t suricata_ctl_flags;
 extern int g_disable_randomness;
 extern uint16_t g_vlan_mask;
+extern bool g_livedev_tracking;
 
 #include <ctype.h>
 #define u8_tolower(c) tolower((uint8_t)(c))
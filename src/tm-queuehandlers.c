@@ -33,6 +33,7 @@
 #include "tmqh-simple.h"
 #include "tmqh-packetpool.h"
 #include "tmqh-flow.h"
+#include "tmqh-ordered.h"
 
 Tmqh tmqh_table[TMQH_SIZE];
 
@@ -43,6 +44,7 @@ void TmqhSetup (void)
     TmqhSimpleRegister();
     TmqhPacketpoolRegister();
     TmqhFlowRegister();
+    TmqhOrderedRegister();
 }
 
 /** \brief Clean up registration time allocs */
@@ -28,6 +28,8 @@ enum {
     TMQH_SIMPLE,
     TMQH_PACKETPOOL,
     TMQH_FLOW,
+    TMQH_ORDERED_SPLIT,
+    TMQH_ORDERED_MERGE,
 
     TMQH_SIZE,
 };
@@ -53,6 +53,8 @@ typedef enum {
     TMM_DECODEAFP,
     TMM_RECEIVENETMAP,
     TMM_DECODENETMAP,
+    TMM_RECEIVEAFXDP,
+    TMM_DECODEAFXDP,
     TMM_ALERTPCAPINFO,
     TMM_RECEIVENAPATECH,
     TMM_DECODENAPATECH,
@@ -34,6 +34,7 @@
 #include "tm-queuehandlers.h"
 #include "tm-threads.h"
 #include "tmqh-packetpool.h"
+#include "tmqh-ordered.h"
 #include "threads.h"
 #include "util-debug.h"
 #include "util-privs.h"
@@ -1355,6 +1356,139 @@ ThreadVars *TmThreadCreateCmdThreadByName(const char *name, const char *module,
     return tv;
 }
 
+/** \internal a background writer run by a management thread */
+typedef struct TmWriter_ {
+    ThreadVars *tv;
+    void *ctx;
+    TmWriterFlushFunc Flush;
+    SCCtrlMutex *mutex;
+    SCCtrlCondT *cond;
+    struct TmWriter_ *next;
+} TmWriter;
+
+static TmWriter *tm_writers = NULL;
+static SCMutex tm_writers_lock = SCMUTEX_INITIALIZER;
+
+/** \internal
+ *  \brief wake up the writer so it sees the kill flag */
+static void TmWriterShutdownHandler(ThreadVars *tv)
+{
+    SCMutexLock(&tm_writers_lock);
+    for (TmWriter *w = tm_writers; w != NULL; w = w->next) {
+        if (w->tv == tv) {
+            SCCtrlMutexLock(w->mutex);
+            SCCtrlCondSignal(w->cond);
+            SCCtrlMutexUnlock(w->mutex);
+        }
+    }
+    SCMutexUnlock(&tm_writers_lock);
+}
+
+static void *TmWriterThread(void *arg)
+{
+    ThreadVars *tv = (ThreadVars *)arg;
+    TmWriter *w = NULL;
+
+    if (SCSetThreadName(tv->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+    if (tv->thread_setup_flags != 0)
+        TmThreadSetupOptions(tv);
+
+    tv->cap_flags = 0;
+    SCDropCaps(tv);
+
+    SCMutexLock(&tm_writers_lock);
+    for (w = tm_writers; w != NULL; w = w->next) {
+        if (w->tv == tv)
+            break;
+    }
+    SCMutexUnlock(&tm_writers_lock);
+    BUG_ON(w == NULL);
+
+    TmThreadsSetFlag(tv, THV_INIT_DONE);
+    while (1) {
+        if (TmThreadsCheckFlag(tv, THV_PAUSE)) {
+            TmThreadsSetFlag(tv, THV_PAUSED);
+            TmThreadTestThreadUnPaused(tv);
+            TmThreadsUnsetFlag(tv, THV_PAUSED);
+        }
+
+        if (TmThreadsCheckFlag(tv, THV_KILL)) {
+            w->Flush(w->ctx, true);
+            break;
+        }
+
+        w->Flush(w->ctx, false);
+    }
+
+    SCMutexLock(&tm_writers_lock);
+    TmWriter **pp = &tm_writers;
+    while (*pp != w)
+        pp = &(*pp)->next;
+    *pp = w->next;
+    SCMutexUnlock(&tm_writers_lock);
+    SCFree(w);
+
+    TmThreadsSetFlag(tv, THV_RUNNING_DONE);
+    TmThreadWaitForFlag(tv, THV_DEINIT);
+    TmThreadsSetFlag(tv, THV_CLOSED);
+    return NULL;
+}
+
+/**
+ * \brief Spawn a management thread that writes out the work queued on
+ *        a context by the packet threads.
+ *
+ * The thread calls Flush until it is killed, then once more with final
+ * set. Flush is to wait at most a second on cond for work, the shutdown
+ * handler signals cond to speed up the kill. The final call writes out
+ * what is left and clears *running, under mutex, so that later work is
+ * done inline.
+ *
+ * \param name    thread name, the thread is called name#<id>
+ * \param running set under mutex before the thread starts
+ *
+ * \retval tv the thread, exits on error
+ */
+ThreadVars *TmThreadSpawnWriter(const char *name, int id, void *ctx,
+        TmWriterFlushFunc Flush, SCCtrlMutex *mutex, SCCtrlCondT *cond,
+        int *running)
+{
+    char tname[TM_THREAD_NAME_MAX];
+    snprintf(tname, sizeof(tname), "%s#%02d", name, id);
+
+    TmWriter *w = SCCalloc(1, sizeof(*w));
+    if (unlikely(w == NULL)) {
+        FatalError(SC_ERR_MEM_ALLOC, "failed to alloc writer for %s", tname);
+    }
+    w->ctx = ctx;
+    w->Flush = Flush;
+    w->mutex = mutex;
+    w->cond = cond;
+
+    w->tv = TmThreadCreateMgmtThread(tname, TmWriterThread, 1);
+    if (w->tv == NULL) {
+        FatalError(SC_ERR_THREAD_CREATE, "TmThreadCreateMgmtThread failed");
+    }
+    w->tv->InShutdownHandler = TmWriterShutdownHandler;
+
+    SCMutexLock(&tm_writers_lock);
+    w->next = tm_writers;
+    tm_writers = w;
+    SCMutexUnlock(&tm_writers_lock);
+
+    SCCtrlMutexLock(mutex);
+    *running = 1;
+    SCCtrlMutexUnlock(mutex);
+
+    ThreadVars *tv = w->tv;
+    if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+        FatalError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed for %s", tname);
+    }
+    return tv;
+}
+
 /**
  * \brief Appends this TV to tv_root based on its type
  *
@@ -1455,6 +1589,12 @@ static bool ThreadStillHasPackets(ThreadVars *tv)
             return true;
         }
     }
+
+    /* packets handed to the ordered queue handlers that didn't
+     * reach a worker queue yet */
+    if (TmqhOrderedHasPending(tv)) {
+        return true;
+    }
     return false;
 }
 
@@ -108,6 +108,35 @@ ThreadVars *TmThreadCreateMgmtThreadByName(const char *name, const char *module,
 ThreadVars *TmThreadCreateCmdThreadByName(const char *name, const char *module,
                                      int mucond);
 TmEcode TmThreadSpawn(ThreadVars *);
+
+/** \brief write out the work queued for a writer thread
+ *  \param final last call, on shutdown */
+typedef void (*TmWriterFlushFunc)(void *ctx, bool final);
+
+ThreadVars *TmThreadSpawnWriter(const char *name, int id, void *ctx,
+        TmWriterFlushFunc Flush, SCCtrlMutex *mutex, SCCtrlCondT *cond,
+        int *running);
+
+/**
+ * \brief Define a global counter callback that combines expr over a list
+ *        of writer contexts.
+ *
+ * The list is walked with lock held. expr is evaluated with the mutex of
+ * each context `c` held and adds to, or replaces, the result `v`.
+ */
+#define TM_WRITER_COUNTER(func, type, head, lock, expr)                     \
+static uint64_t func(void)                                                  \
+{                                                                           \
+    uint64_t v = 0;                                                         \
+    SCMutexLock(&(lock));                                                   \
+    for (type *c = (head); c != NULL; c = c->next) {                        \
+        SCCtrlMutexLock(&c->mutex);                                         \
+        expr;                                                               \
+        SCCtrlMutexUnlock(&c->mutex);                                       \
+    }                                                                       \
+    SCMutexUnlock(&(lock));                                                 \
+    return v;                                                               \
+}
 void TmThreadSetFlags(ThreadVars *, uint8_t);
 void TmThreadKillThreadsFamily(int family);
 void TmThreadKillThreads(void);
@@ -0,0 +1,592 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Ordered queue handlers.
+ *
+ * "ordered-split" is the output handler of a reader thread. It numbers
+ * the packets and hands them out in chunks of TMQH_ORDERED_CHUNK packets
+ * to the decode queues, round robin.
+ *
+ * "ordered-merge" is the input and output handler of the decode threads.
+ * As every decode thread gets its chunks in order, it can tell the number
+ * of each packet it takes. Decoded packets are stored in a ring by number
+ * and passed on to the worker queues by flow hash in the order they were
+ * read, so each worker sees its packets in the same order as with a
+ * single decode thread.
+ */
+
+#include "suricata.h"
+#include "packet-queue.h"
+#include "decode.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "tm-queues.h"
+#include "tmqh-ordered.h"
+#include "tmqh-packetpool.h"
+
+#include "tm-queuehandlers.h"
+
+#include "util-unittest.h"
+
+static Packet *TmqhInputOrderedMerge(ThreadVars *tv);
+static void TmqhInputOrderedShutdownHandler(ThreadVars *tv);
+static void TmqhOutputOrderedSplit(ThreadVars *tv, Packet *p);
+static void TmqhOutputOrderedMerge(ThreadVars *tv, Packet *p);
+static void *TmqhOutputOrderedSplitSetupCtx(const char *queue_str);
+static void TmqhOutputOrderedSplitFreeCtx(void *ctx);
+static void *TmqhOutputOrderedMergeSetupCtx(const char *queue_str);
+static void TmqhOutputOrderedMergeFreeCtx(void *ctx);
+
+/** ctx of the reader, shared with the decode threads */
+static TmqhOrderedCtx *ordered_ctx = NULL;
+
+void TmqhOrderedRegister(void)
+{
+    tmqh_table[TMQH_ORDERED_SPLIT].name = "ordered-split";
+    tmqh_table[TMQH_ORDERED_SPLIT].OutHandler = TmqhOutputOrderedSplit;
+    tmqh_table[TMQH_ORDERED_SPLIT].OutHandlerCtxSetup = TmqhOutputOrderedSplitSetupCtx;
+    tmqh_table[TMQH_ORDERED_SPLIT].OutHandlerCtxFree = TmqhOutputOrderedSplitFreeCtx;
+    tmqh_table[TMQH_ORDERED_SPLIT].RegisterTests = TmqhOrderedRegisterTests;
+
+    tmqh_table[TMQH_ORDERED_MERGE].name = "ordered-merge";
+    tmqh_table[TMQH_ORDERED_MERGE].InHandler = TmqhInputOrderedMerge;
+    tmqh_table[TMQH_ORDERED_MERGE].InShutdownHandler = TmqhInputOrderedShutdownHandler;
+    tmqh_table[TMQH_ORDERED_MERGE].OutHandler = TmqhOutputOrderedMerge;
+    tmqh_table[TMQH_ORDERED_MERGE].OutHandlerCtxSetup = TmqhOutputOrderedMergeSetupCtx;
+    tmqh_table[TMQH_ORDERED_MERGE].OutHandlerCtxFree = TmqhOutputOrderedMergeFreeCtx;
+}
+
+/**
+ * \brief get the number of a packet from its position in a decode queue
+ *
+ * \param cnt packets taken from the decode queue before this one
+ * \param decoder index of the decode queue
+ * \param decoders number of decode queues
+ */
+static inline uint64_t TmqhOrderedSeq(uint64_t cnt, uint16_t decoder,
+                                      uint16_t decoders)
+{
+    uint64_t chunk = (cnt / TMQH_ORDERED_CHUNK) * decoders + decoder;
+    return chunk * TMQH_ORDERED_CHUNK + (cnt % TMQH_ORDERED_CHUNK);
+}
+
+/**
+ * \brief check if packets given to the ordered handlers by this thread
+ *        are still to be passed on to the workers
+ *
+ * Used on shutdown, as these packets are in none of the queues.
+ */
+bool TmqhOrderedHasPending(ThreadVars *tv)
+{
+    if (tv->tmqh_out != TmqhOutputOrderedSplit &&
+        tv->tmqh_out != TmqhOutputOrderedMerge)
+        return false;
+
+    TmqhOrderedCtx *ctx = ordered_ctx;
+    if (ctx == NULL)
+        return false;
+
+    return (SC_ATOMIC_GET(ctx->next) != SC_ATOMIC_GET(ctx->seq));
+}
+
+/**
+ * \brief parse a comma separated list of queue names
+ *
+ * \param queue_str "queuename1,queuename2,etc"
+ * \param cnt set to the number of queues
+ *
+ * \retval queues array of queues or NULL on error
+ */
+static TmqhOrderedQueue *TmqhOrderedParseQueues(const char *queue_str,
+                                                uint16_t *cnt)
+{
+    if (queue_str == NULL || strlen(queue_str) == 0)
+        return NULL;
+
+    uint32_t n = 1;
+    for (const char *c = queue_str; *c != '\0'; c++) {
+        if (*c == ',')
+            n++;
+    }
+    if (n > UINT16_MAX)
+        return NULL;
+
+    TmqhOrderedQueue *queues = SCCalloc(n, sizeof(TmqhOrderedQueue));
+    if (unlikely(queues == NULL))
+        return NULL;
+
+    char *str = SCStrdup(queue_str);
+    if (unlikely(str == NULL)) {
+        SCFree(queues);
+        return NULL;
+    }
+
+    uint32_t i = 0;
+    char *saveptr = NULL;
+    for (char *qname = strtok_r(str, ",", &saveptr); qname != NULL;
+         qname = strtok_r(NULL, ",", &saveptr))
+    {
+        Tmq *tmq = TmqGetQueueByName(qname);
+        if (tmq == NULL) {
+            tmq = TmqCreateQueue(qname);
+            if (tmq == NULL)
+                goto error;
+        }
+        tmq->writer_cnt++;
+
+        queues[i++].q = &trans_q[tmq->id];
+    }
+    if (i == 0)
+        goto error;
+
+    SCFree(str);
+    *cnt = (uint16_t)i;
+    return queues;
+
+error:
+    SCFree(str);
+    SCFree(queues);
+    return NULL;
+}
+
+/**
+ * \brief setup the ctx of the reader
+ *
+ * \param queue_str comma separated string with the decode queue names
+ *
+ * \retval ctx shared ctx or NULL on error
+ */
+static void *TmqhOutputOrderedSplitSetupCtx(const char *queue_str)
+{
+    extern intmax_t max_pending_packets;
+
+    if (ordered_ctx != NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "only one thread can use the "
+                   "\"ordered-split\" queue handler");
+        return NULL;
+    }
+
+    TmqhOrderedCtx *ctx = SCMalloc(sizeof(TmqhOrderedCtx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+    memset(ctx, 0x00, sizeof(TmqhOrderedCtx));
+
+    ctx->decode_q = TmqhOrderedParseQueues(queue_str, &ctx->decoders);
+    if (ctx->decode_q == NULL)
+        goto error;
+
+    /* the reader can't have more packets out than its packet pool
+     * holds, so this leaves room for a slow decode thread */
+    uint64_t want = MAX((uint64_t)max_pending_packets * 2,
+                        (uint64_t)ctx->decoders * TMQH_ORDERED_CHUNK * 4);
+    ctx->size = 1;
+    while (ctx->size < want)
+        ctx->size <<= 1;
+    ctx->mask = ctx->size - 1;
+
+    ctx->ring = SCCalloc(ctx->size, sizeof(Packet *));
+    if (ctx->ring == NULL)
+        goto error;
+
+    SC_ATOMIC_INIT(ctx->seq);
+    SC_ATOMIC_INIT(ctx->next);
+    SCMutexInit(&ctx->publish_m, NULL);
+    ctx->ref = 1;
+
+    ordered_ctx = ctx;
+    return (void *)ctx;
+
+error:
+    if (ctx->decode_q != NULL)
+        SCFree(ctx->decode_q);
+    SCFree(ctx);
+    return NULL;
+}
+
+static void TmqhOrderedCtxRelease(TmqhOrderedCtx *ctx)
+{
+    if (--ctx->ref > 0)
+        return;
+
+    SCLogPerf("ordered - decode queues %" PRIu16 ", worker queues %" PRIu16
+              ", ring size %" PRIu32 ", packets %" PRIu64 ", reader waits %"
+              PRIu64, ctx->decoders, ctx->workers, ctx->size,
+              ctx->published, ctx->window_waits);
+
+    SCMutexDestroy(&ctx->publish_m);
+    SC_ATOMIC_DESTROY(ctx->seq);
+    SC_ATOMIC_DESTROY(ctx->next);
+    SCFree(ctx->ring);
+    SCFree(ctx->decode_q);
+    if (ctx->worker_q != NULL)
+        SCFree(ctx->worker_q);
+    if (ordered_ctx == ctx)
+        ordered_ctx = NULL;
+    SCFree(ctx);
+}
+
+static void TmqhOutputOrderedSplitFreeCtx(void *ctx)
+{
+    TmqhOrderedCtxRelease((TmqhOrderedCtx *)ctx);
+}
+
+/**
+ * \brief setup the ctx of a decode thread
+ *
+ * \param queue_str comma separated string with the worker queue names
+ *
+ * \retval ctx thread ctx or NULL on error
+ */
+static void *TmqhOutputOrderedMergeSetupCtx(const char *queue_str)
+{
+    TmqhOrderedCtx *ctx = ordered_ctx;
+    if (ctx == NULL) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "the \"ordered-merge\" queue "
+                   "handler needs a reader using \"ordered-split\"");
+        return NULL;
+    }
+
+    uint16_t workers = 0;
+    TmqhOrderedQueue *worker_q = TmqhOrderedParseQueues(queue_str, &workers);
+    if (worker_q == NULL)
+        return NULL;
+
+    if (ctx->worker_q == NULL) {
+        ctx->worker_q = worker_q;
+        ctx->workers = workers;
+    } else {
+        int same = (workers == ctx->workers);
+        for (uint16_t i = 0; same && i < workers; i++) {
+            if (worker_q[i].q != ctx->worker_q[i].q)
+                same = 0;
+        }
+        SCFree(worker_q);
+        if (!same) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "all \"ordered-merge\" "
+                       "threads need to output to the same queues");
+            return NULL;
+        }
+    }
+
+    TmqhOrderedThreadCtx *tctx = SCMalloc(sizeof(TmqhOrderedThreadCtx));
+    if (unlikely(tctx == NULL))
+        return NULL;
+    memset(tctx, 0x00, sizeof(TmqhOrderedThreadCtx));
+    tctx->ctx = ctx;
+    tctx->decoder = -1;
+    ctx->ref++;
+
+    return (void *)tctx;
+}
+
+static void TmqhOutputOrderedMergeFreeCtx(void *ctx)
+{
+    TmqhOrderedThreadCtx *tctx = (TmqhOrderedThreadCtx *)ctx;
+
+    TmqhOrderedCtxRelease(tctx->ctx);
+    SCFree(tctx);
+}
+
+static void TmqhOutputOrderedSplit(ThreadVars *tv, Packet *p)
+{
+    TmqhOrderedCtx *ctx = (TmqhOrderedCtx *)tv->outctx;
+    uint64_t seq = SC_ATOMIC_GET(ctx->seq);
+
+    /* wait for the ring to have room for the packet */
+    while (seq - SC_ATOMIC_GET(ctx->next) >= ctx->size) {
+        if (TmThreadsCheckFlag(tv, THV_KILL)) {
+            TmqhOutputPacketpool(tv, p);
+            return;
+        }
+        ctx->window_waits++;
+        SleepUsec(10);
+    }
+
+    PacketQueue *q = ctx->decode_q[(seq / TMQH_ORDERED_CHUNK) % ctx->decoders].q;
+
+    /* count the packet before queueing it so it's never unaccounted
+     * for on shutdown */
+    (void)SC_ATOMIC_ADD(ctx->seq, 1);
+
+    SCMutexLock(&q->mutex_q);
+    PacketEnqueue(q, p);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+}
+
+static Packet *TmqhInputOrderedMerge(ThreadVars *tv)
+{
+    TmqhOrderedThreadCtx *tctx = (TmqhOrderedThreadCtx *)tv->outctx;
+    PacketQueue *q = &trans_q[tv->inq->id];
+    Packet *p = NULL;
+
+    StatsSyncCountersIfSignalled(tv);
+
+    SCMutexLock(&q->mutex_q);
+    if (q->len == 0) {
+        /* if we have no packets in queue, wait... */
+        SCCondWait(&q->cond_q, &q->mutex_q);
+    }
+    if (q->len > 0) {
+        p = PacketDequeue(q);
+    }
+    SCMutexUnlock(&q->mutex_q);
+
+    /* return NULL if we have no pkt. Should only happen on signals. */
+    if (p == NULL)
+        return NULL;
+
+    if (unlikely(tctx->decoder < 0)) {
+        for (uint16_t i = 0; i < tctx->ctx->decoders; i++) {
+            if (tctx->ctx->decode_q[i].q == q) {
+                tctx->decoder = i;
+                break;
+            }
+        }
+        if (tctx->decoder < 0) {
+            FatalError(SC_ERR_FATAL, "%s: queue \"%s\" is not an output "
+                       "queue of the \"ordered-split\" handler",
+                       tv->name, tv->inq->name);
+        }
+    }
+
+    tctx->seq = TmqhOrderedSeq(tctx->cnt, (uint16_t)tctx->decoder,
+                               tctx->ctx->decoders);
+    tctx->cnt++;
+    tctx->cur = p;
+    return p;
+}
+
+static void TmqhInputOrderedShutdownHandler(ThreadVars *tv)
+{
+    if (tv == NULL || tv->inq == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < (tv->inq->reader_cnt + tv->inq->writer_cnt); i++)
+        SCCondSignal(&trans_q[tv->inq->id].cond_q);
+}
+
+/**
+ * \brief pass the packets in the ring on to the workers, in order
+ *
+ * Only one thread at a time publishes. A thread failing to get the lock
+ * can leave its packets to the thread holding it, as that one checks
+ * the ring again after unlocking.
+ */
+static void TmqhOrderedPublish(TmqhOrderedCtx *ctx)
+{
+    do {
+        if (SCMutexTrylock(&ctx->publish_m) != 0)
+            return;
+
+        uint64_t next = SC_ATOMIC_GET(ctx->next);
+        Packet *chain;
+        while ((chain = __atomic_load_n(&ctx->ring[next & ctx->mask],
+                        __ATOMIC_ACQUIRE)) != NULL)
+        {
+            __atomic_store_n(&ctx->ring[next & ctx->mask], NULL, __ATOMIC_RELAXED);
+
+            while (chain != NULL) {
+                Packet *p = chain;
+                chain = p->next;
+                p->next = NULL;
+
+                uint16_t qid;
+                if (p->flags & PKT_WANTS_FLOW) {
+                    qid = p->flow_hash % ctx->workers;
+                } else {
+                    qid = ctx->last++;
+                    if (ctx->last == ctx->workers)
+                        ctx->last = 0;
+                }
+
+                TmqhOrderedQueue *wq = &ctx->worker_q[qid];
+                if (wq->bot != NULL)
+                    wq->bot->next = p;
+                else
+                    wq->top = p;
+                wq->bot = p;
+                ctx->published++;
+            }
+            next++;
+        }
+
+        for (uint16_t i = 0; i < ctx->workers; i++) {
+            TmqhOrderedQueue *wq = &ctx->worker_q[i];
+            if (wq->top == NULL)
+                continue;
+
+            SCMutexLock(&wq->q->mutex_q);
+            while (wq->top != NULL) {
+                Packet *p = wq->top;
+                wq->top = p->next;
+                PacketEnqueue(wq->q, p);
+            }
+            SCCondSignal(&wq->q->cond_q);
+            SCMutexUnlock(&wq->q->mutex_q);
+            wq->bot = NULL;
+        }
+
+        (void)SC_ATOMIC_SET(ctx->next, next);
+        SCMutexUnlock(&ctx->publish_m);
+
+        /* pairs with the store in TmqhOutputOrderedMerge: a packet
+         * stored while we held the lock is seen here */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    } while (__atomic_load_n(&ctx->ring[SC_ATOMIC_GET(ctx->next) & ctx->mask],
+                             __ATOMIC_SEQ_CST) != NULL);
+}
+
+static void TmqhOutputOrderedMerge(ThreadVars *tv, Packet *p)
+{
+    TmqhOrderedThreadCtx *tctx = (TmqhOrderedThreadCtx *)tv->outctx;
+
+    /* packets created by the decoder, like tunnel packets, come before
+     * the packet they are created from. They go out together with it. */
+    if (p != tctx->cur) {
+        p->next = NULL;
+        if (tctx->extra_bot != NULL)
+            tctx->extra_bot->next = p;
+        else
+            tctx->extra_top = p;
+        tctx->extra_bot = p;
+        return;
+    }
+
+    Packet *chain = p;
+    p->next = NULL;
+    if (tctx->extra_top != NULL) {
+        tctx->extra_bot->next = p;
+        chain = tctx->extra_top;
+        tctx->extra_top = tctx->extra_bot = NULL;
+    }
+    tctx->cur = NULL;
+
+    TmqhOrderedCtx *ctx = tctx->ctx;
+    __atomic_store_n(&ctx->ring[tctx->seq & ctx->mask], chain, __ATOMIC_SEQ_CST);
+
+    TmqhOrderedPublish(ctx);
+}
+
+#ifdef UNITTESTS
+
+static int TmqhOrderedSeqTest01(void)
+{
+    const uint16_t decoders = 3;
+    uint64_t cnt[3] = { 0, 0, 0 };
+
+    /* the packet numbers the decode threads compute are the ones
+     * the reader handed out */
+    for (uint64_t seq = 0; seq < 20 * TMQH_ORDERED_CHUNK; seq++) {
+        uint16_t d = (seq / TMQH_ORDERED_CHUNK) % decoders;
+        FAIL_IF_NOT(TmqhOrderedSeq(cnt[d]++, d, decoders) == seq);
+    }
+    PASS;
+}
+
+/** \test packets decoded out of order reach the workers in read order */
+static int TmqhOrderedTest01(void)
+{
+    const uint32_t npkts = 5 * TMQH_ORDERED_CHUNK + 7;
+    ThreadVars tv_read, tv_dec[2];
+    Packet *p;
+
+    TmqResetQueues();
+
+    memset(&tv_read, 0, sizeof(tv_read));
+    tv_read.outctx = TmqhOutputOrderedSplitSetupCtx("dec1,dec2");
+    FAIL_IF_NULL(tv_read.outctx);
+    tv_read.tmqh_out = TmqhOutputOrderedSplit;
+    TmqhOrderedCtx *ctx = (TmqhOrderedCtx *)tv_read.outctx;
+    FAIL_IF_NOT(ctx->decoders == 2);
+
+    for (int i = 0; i < 2; i++) {
+        memset(&tv_dec[i], 0, sizeof(ThreadVars));
+        tv_dec[i].outctx = TmqhOutputOrderedMergeSetupCtx("w1,w2,w3");
+        FAIL_IF_NULL(tv_dec[i].outctx);
+        tv_dec[i].tmqh_out = TmqhOutputOrderedMerge;
+    }
+    tv_dec[0].inq = TmqGetQueueByName("dec1");
+    tv_dec[1].inq = TmqGetQueueByName("dec2");
+    FAIL_IF_NOT(ctx->workers == 3);
+
+    for (uint32_t i = 0; i < npkts; i++) {
+        p = PacketGetFromAlloc();
+        FAIL_IF_NULL(p);
+        p->pcap_cnt = i + 1;
+        if (i % 5) {
+            p->flags |= PKT_WANTS_FLOW;
+            p->flow_hash = i % 7;
+        }
+        TmqhOutputOrderedSplit(&tv_read, p);
+    }
+    FAIL_IF_NOT(TmqhOrderedHasPending(&tv_read));
+
+    /* decode everything of the second thread first, with a tunnel
+     * packet for every tenth packet */
+    for (int i = 1; i >= 0; i--) {
+        while (trans_q[tv_dec[i].inq->id].len > 0) {
+            p = TmqhInputOrderedMerge(&tv_dec[i]);
+            FAIL_IF_NULL(p);
+            if (p->pcap_cnt % 10 == 0) {
+                Packet *tp = PacketGetFromAlloc();
+                FAIL_IF_NULL(tp);
+                tp->pcap_cnt = p->pcap_cnt;
+                TmqhOutputOrderedMerge(&tv_dec[i], tp);
+            }
+            TmqhOutputOrderedMerge(&tv_dec[i], p);
+        }
+    }
+    FAIL_IF(TmqhOrderedHasPending(&tv_read));
+
+    uint32_t total = 0;
+    for (uint16_t w = 0; w < ctx->workers; w++) {
+        PacketQueue *q = ctx->worker_q[w].q;
+        uint64_t last = 0;
+        while ((p = PacketDequeue(q)) != NULL) {
+            FAIL_IF(p->pcap_cnt < last);
+            if (p->flags & PKT_WANTS_FLOW)
+                FAIL_IF_NOT(p->flow_hash % ctx->workers == w);
+            last = p->pcap_cnt;
+            total++;
+            PacketFree(p);
+        }
+    }
+    FAIL_IF_NOT(total == npkts + npkts / 10);
+
+    TmqhOutputOrderedMergeFreeCtx(tv_dec[0].outctx);
+    TmqhOutputOrderedMergeFreeCtx(tv_dec[1].outctx);
+    TmqhOutputOrderedSplitFreeCtx(tv_read.outctx);
+    FAIL_IF_NOT_NULL(ordered_ctx);
+    TmqResetQueues();
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void TmqhOrderedRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TmqhOrderedSeqTest01", TmqhOrderedSeqTest01);
+    UtRegisterTest("TmqhOrderedTest01", TmqhOrderedTest01);
+#endif
+}
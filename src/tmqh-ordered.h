@@ -0,0 +1,91 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Queue handlers spreading the packets of one reader over several
+ * decode threads and merging them back in read order.
+ */
+
+#ifndef __TMQH_ORDERED_H__
+#define __TMQH_ORDERED_H__
+
+/** number of consecutive packets handed to the same decode thread */
+#define TMQH_ORDERED_CHUNK  64
+
+typedef struct TmqhOrderedQueue_ {
+    PacketQueue *q;
+    /* packets to hand over to q, only used while publishing */
+    Packet *top;
+    Packet *bot;
+} TmqhOrderedQueue;
+
+/** \brief Ctx shared by the reader and the decode threads
+ *
+ *  The reader numbers the packets. A decode thread stores the packets
+ *  in the ring at the position of their number and the first thread
+ *  finding the next expected number in the ring passes the packets
+ *  on to the workers. */
+typedef struct TmqhOrderedCtx_ {
+    /* ring of decoded packets, indexed by packet number */
+    Packet **ring;
+    uint32_t size;
+    uint32_t mask;
+
+    /* number of the next packet to read */
+    SC_ATOMIC_DECLARE(uint64_t, seq);
+    /* number of the next packet to pass on to the workers */
+    SC_ATOMIC_DECLARE(uint64_t, next);
+    SCMutex publish_m;
+
+    uint16_t decoders;
+    uint16_t workers;
+    TmqhOrderedQueue *decode_q;
+    TmqhOrderedQueue *worker_q;
+    /* worker for packets without flow, round robin */
+    uint16_t last;
+
+    /* stats */
+    uint64_t published;
+    uint64_t window_waits;
+
+    /* reader and decode threads using the ctx */
+    int ref;
+} TmqhOrderedCtx;
+
+/** \brief Per decode thread ctx of the "ordered-merge" handler */
+typedef struct TmqhOrderedThreadCtx_ {
+    TmqhOrderedCtx *ctx;
+    /* index of the decode queue, -1 until the first packet */
+    int decoder;
+    /* packets taken from the decode queue */
+    uint64_t cnt;
+    /* packet taken from the decode queue and its number */
+    Packet *cur;
+    uint64_t seq;
+    /* tunnel and reassembled packets created while decoding cur */
+    Packet *extra_top;
+    Packet *extra_bot;
+} TmqhOrderedThreadCtx;
+
+void TmqhOrderedRegister(void);
+void TmqhOrderedRegisterTests(void);
+
+bool TmqhOrderedHasPending(ThreadVars *tv);
+
+#endif /* __TMQH_ORDERED_H__ */
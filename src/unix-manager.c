@@ -30,6 +30,7 @@
 #include "conf.h"
 
 #include "output-json-stats.h"
+#include "log-pcap.h"
 
 #include "util-privs.h"
 #include "util-debug.h"
@@ -1085,6 +1086,8 @@ int UnixManagerInit(void)
     UnixManagerRegisterCommand("dataset-add", UnixSocketDatasetAdd, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("dataset-remove", UnixSocketDatasetRemove, &command, UNIX_CMD_TAKE_ARGS);
 
+    UnixManagerRegisterCommand("pcap-log-extract", PcapLogUnixSocketExtract, NULL, UNIX_CMD_TAKE_ARGS);
+
     return 0;
 }
 
@@ -23,10 +23,22 @@
  */
 
 #include "util-base64.h"
+#include "util-unittest.h"
 
 /* Constants */
 #define BASE64_TABLE_MAX  122
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BASE64_SIMD_IN      32  /**< input bytes decoded per SIMD step */
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define BASE64_SIMD_IN      16
+#endif
+#ifdef BASE64_SIMD_IN
+#define BASE64_SIMD_OUT     (BASE64_SIMD_IN / B64_BLOCK * ASCII_BLOCK)
+#endif
+
 /* Base64 character to index conversion table */
 /* Characters are mapped as "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/" */
 static const int b64table[] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
@@ -77,6 +89,113 @@ static inline void DecodeBase64Block(uint8_t ascii[ASCII_BLOCK], uint8_t b64[B64
     ascii[2] = (uint8_t) (b64[2] << 6) | (b64[3]);
 }
 
+#if defined(__AVX2__)
+/**
+ * \brief Decodes 32 base64 characters into 24 bytes
+ *
+ * Translates the characters to their 6 bit values with nibble lookup
+ * tables and packs the values with multiply-add instructions.
+ *
+ * \retval 1 decoded
+ * \retval 0 the input contains a character that is not in the base64
+ *         alphabet, including '=' and NUL. Nothing is written.
+ */
+static inline int DecodeBase64Simd(uint8_t *dest, const uint8_t *src)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+    __m256i in = _mm256_loadu_si256((const __m256i *)src);
+    const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibble);
+    const __m256i lo_nibbles = _mm256_and_si256(in, nibble);
+    const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm256_testz_si256(lo, hi))
+        return 0;
+
+    /* '/' is the only character sharing its high nibble with others
+     * that need a different offset */
+    const __m256i eq_2f = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(0x2f));
+    const __m256i roll = _mm256_shuffle_epi8(lut_roll,
+            _mm256_add_epi8(eq_2f, hi_nibbles));
+    in = _mm256_add_epi8(in, roll);
+
+    /* pack 4x6 bits into 3 bytes per 32 bit lane */
+    in = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+    in = _mm256_madd_epi16(in, _mm256_set1_epi32(0x00011000));
+    in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    in = _mm256_permutevar8x32_epi32(in, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+
+    /* store exactly 24 bytes */
+    _mm_storeu_si128((__m128i *)dest, _mm256_castsi256_si128(in));
+    _mm_storel_epi64((__m128i *)(dest + 16), _mm256_extracti128_si256(in, 1));
+    return 1;
+}
+#elif defined(__SSE4_1__)
+/**
+ * \brief Decodes 16 base64 characters into 12 bytes
+ *
+ * Translates the characters to their 6 bit values with nibble lookup
+ * tables and packs the values with multiply-add instructions.
+ *
+ * \retval 1 decoded
+ * \retval 0 the input contains a character that is not in the base64
+ *         alphabet, including '=' and NUL. Nothing is written.
+ */
+static inline int DecodeBase64Simd(uint8_t *dest, const uint8_t *src)
+{
+    const __m128i lut_lo = _mm_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    __m128i in = _mm_loadu_si128((const __m128i *)src);
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+    const __m128i lo_nibbles = _mm_and_si128(in, nibble);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    if (!_mm_testz_si128(lo, hi))
+        return 0;
+
+    /* '/' is the only character sharing its high nibble with others
+     * that need a different offset */
+    const __m128i eq_2f = _mm_cmpeq_epi8(in, _mm_set1_epi8(0x2f));
+    const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    in = _mm_add_epi8(in, roll);
+
+    /* pack 4x6 bits into 3 bytes per 32 bit lane */
+    in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+    in = _mm_shuffle_epi8(in, _mm_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+    /* store exactly 12 bytes */
+    _mm_storel_epi64((__m128i *)dest, in);
+    uint32_t last = (uint32_t)_mm_extract_epi32(in, 2);
+    memcpy(dest + 8, &last, sizeof(last));
+    return 1;
+}
+#endif
+
 /**
  * \brief Decodes a base64-encoded string buffer into an ascii-encoded byte buffer
  *
@@ -85,11 +204,12 @@ static inline void DecodeBase64Block(uint8_t ascii[ASCII_BLOCK], uint8_t b64[B64
  * \param len The length of the source string
  * \param strict If set file on invalid byte, otherwise return what has been
  *    decoded.
+ * \param simd If set use the SIMD decoder for runs of valid characters
  *
  * \return Number of bytes decoded, or 0 if no data is decoded or it fails
  */
-uint32_t DecodeBase64(uint8_t *dest, const uint8_t *src, uint32_t len,
-    int strict)
+static uint32_t DecodeBase64Do(uint8_t *dest, const uint8_t *src, uint32_t len,
+    int strict, int simd)
 {
     int val;
     uint32_t padding = 0, numDecoded = 0, bbidx = 0, valid = 1, i;
@@ -99,6 +219,20 @@ uint32_t DecodeBase64(uint8_t *dest, const uint8_t *src, uint32_t len,
     /* Traverse through each alpha-numeric letter in the source array */
     for(i = 0; i < len && src[i] != 0; i++) {
 
+#ifdef BASE64_SIMD_IN
+        /* Decode runs of complete blocks of valid characters at once. On
+         * padding or an invalid character fall through to the code below. */
+        if (simd && bbidx == 0) {
+            while (len - i >= BASE64_SIMD_IN && DecodeBase64Simd(dptr, src + i)) {
+                i += BASE64_SIMD_IN;
+                dptr += BASE64_SIMD_OUT;
+                numDecoded += BASE64_SIMD_OUT;
+            }
+            if (i == len || src[i] == 0)
+                break;
+        }
+#endif
+
         /* Get decimal representation */
         val = GetBase64Value(src[i]);
         if (val < 0) {
@@ -149,3 +283,131 @@ uint32_t DecodeBase64(uint8_t *dest, const uint8_t *src, uint32_t len,
 
     return numDecoded;
 }
+
+/**
+ * \brief Decodes a base64-encoded string buffer into an ascii-encoded byte buffer
+ *
+ * Uses SSE4.1 or AVX2 for runs of valid characters if available.
+ *
+ * \param dest The destination byte buffer
+ * \param src The source string
+ * \param len The length of the source string
+ * \param strict If set file on invalid byte, otherwise return what has been
+ *    decoded.
+ *
+ * \return Number of bytes decoded, or 0 if no data is decoded or it fails
+ */
+uint32_t DecodeBase64(uint8_t *dest, const uint8_t *src, uint32_t len,
+    int strict)
+{
+    return DecodeBase64Do(dest, src, len, strict, 1);
+}
+
+#ifdef UNITTESTS
+
+/** Uncomment this to get timings of the scalar and SIMD decoding
+ *  #define ENABLE_BASE64_STATS 1
+ */
+
+static const char *b64alphabet =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * \test Compare the SIMD and the scalar decoding of valid input, and of
+ *       input with padding, invalid characters and NUL bytes at every
+ *       position. Only the decoded bytes are compared, a trailing partial
+ *       block may write stale bytes past them.
+ */
+static int DecodeBase64Test01(void)
+{
+    uint8_t src[256];
+    uint8_t dst1[256], dst2[256];
+
+    for (uint32_t i = 0; i < sizeof(src); i++) {
+        src[i] = b64alphabet[(i * 7 + i / 64) % 64];
+    }
+
+    for (uint32_t len = 0; len <= sizeof(src); len++) {
+        memset(dst1, 0, sizeof(dst1));
+        memset(dst2, 0, sizeof(dst2));
+        uint32_t r1 = DecodeBase64Do(dst1, src, len, 1, 0);
+        uint32_t r2 = DecodeBase64Do(dst2, src, len, 1, 1);
+        FAIL_IF(r1 != r2);
+        FAIL_IF(memcmp(dst1, dst2, r1) != 0);
+    }
+
+    static const uint8_t specials[] = { '=', 0, '*', 0x80, 0xff, '\n' };
+    for (uint32_t s = 0; s < sizeof(specials); s++) {
+        for (uint32_t pos = 0; pos < 128; pos++) {
+            uint8_t save = src[pos];
+            src[pos] = specials[s];
+            for (int strict = 0; strict < 2; strict++) {
+                memset(dst1, 0, sizeof(dst1));
+                memset(dst2, 0, sizeof(dst2));
+                uint32_t r1 = DecodeBase64Do(dst1, src, 128, strict, 0);
+                uint32_t r2 = DecodeBase64Do(dst2, src, 128, strict, 1);
+                FAIL_IF(r1 != r2);
+                FAIL_IF(memcmp(dst1, dst2, r1) != 0);
+            }
+            src[pos] = save;
+        }
+    }
+    PASS;
+}
+
+/**
+ * \test Decode a known string that has all characters of the alphabet.
+ */
+static int DecodeBase64Test02(void)
+{
+    const char *src = "VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRv"
+                      "ZyEgLz8+Pz4/Pj8+";
+    const char *exp = "The quick brown fox jumps over the lazy dog! /?>?>?>?>";
+    uint8_t dst[128];
+
+    uint32_t r = DecodeBase64(dst, (const uint8_t *)src, strlen(src), 1);
+    FAIL_IF(r != strlen(exp));
+    FAIL_IF(memcmp(dst, exp, r) != 0);
+    PASS;
+}
+
+#ifdef ENABLE_BASE64_STATS
+#include "util-clock.h"
+
+#define STATS_TIMES 100000
+
+static int DecodeBase64StatsTest01(void)
+{
+    uint8_t src[4096];
+    uint8_t dst[4096];
+
+    for (uint32_t i = 0; i < sizeof(src); i++) {
+        src[i] = b64alphabet[(i * 7 + i / 64) % 64];
+    }
+
+    for (int simd = 0; simd < 2; simd++) {
+        CLOCK_INIT;
+        CLOCK_START;
+        for (int i = 0; i < STATS_TIMES; i++) {
+            DecodeBase64Do(dst, src, sizeof(src), 1, simd);
+        }
+        CLOCK_END;
+        printf("%s: ", simd ? "simd" : "scalar");
+        CLOCK_PRINT_SEC;
+    }
+    PASS;
+}
+#endif /* ENABLE_BASE64_STATS */
+
+#endif /* UNITTESTS */
+
+void Base64RegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DecodeBase64Test01", DecodeBase64Test01);
+    UtRegisterTest("DecodeBase64Test02", DecodeBase64Test02);
+#ifdef ENABLE_BASE64_STATS
+    UtRegisterTest("DecodeBase64StatsTest01", DecodeBase64StatsTest01);
+#endif
+#endif
+}
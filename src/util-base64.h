@@ -52,4 +52,6 @@
 uint32_t DecodeBase64(uint8_t *dest, const uint8_t *src, uint32_t len,
     int strict);
 
+void Base64RegisterTests(void);
+
 #endif
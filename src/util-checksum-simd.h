@@ -0,0 +1,122 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * One's complement sum of the payload for the IP, TCP, UDP and ICMP
+ * checksums.
+ *
+ * The data is summed as 32 bit words in 64 bit accumulators. As 2^16 and
+ * 2^32 are both 1 modulo 0xffff, folding the result gives the same value
+ * as the sum of the 16 bit words, whatever the byte order of the host.
+ */
+
+#ifndef __UTIL_CHECKSUM_SIMD_H__
+#define __UTIL_CHECKSUM_SIMD_H__
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * \brief Fold a 64 bit one's complement sum to 16 bits
+ */
+static inline uint32_t ChecksumFold64(uint64_t sum)
+{
+    sum = (sum >> 32) + (sum & 0xffffffffULL);
+    sum = (sum >> 32) + (sum & 0xffffffffULL);
+    sum = (sum >> 16) + (sum & 0xffffULL);
+    sum = (sum >> 16) + (sum & 0xffffULL);
+    return (uint32_t)sum;
+}
+
+/**
+ * \brief Add the 16 bit words of a buffer to a checksum
+ *
+ * \param pkt  start of the data, no alignment needed
+ * \param len  length of the data in bytes, an odd last byte is padded
+ * \param csum current unfolded checksum
+ *
+ * \retval csum unfolded checksum, the 16 bit sum of the data added to
+ *         the one passed
+ */
+static inline uint32_t ChecksumAddWords(const uint16_t *pkt, uint32_t len,
+                                        uint32_t csum)
+{
+    const uint8_t *data = (const uint8_t *)pkt;
+    uint64_t sum = 0;
+
+#if defined(__AVX2__)
+    if (len >= 64) {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i acc = zero;
+        while (len >= 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)data);
+            acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+            acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+            data += 32;
+            len -= 32;
+        }
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+#if defined(__SSE2__)
+    if (len >= 32) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero;
+        while (len >= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)data);
+            acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(v, zero));
+            acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(v, zero));
+            data += 16;
+            len -= 16;
+        }
+        uint64_t lanes[2];
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += lanes[0] + lanes[1];
+    }
+#endif
+
+    while (len >= 8) {
+        uint32_t w[2];
+        memcpy(w, data, sizeof(w));
+        sum += (uint64_t)w[0] + w[1];
+        data += 8;
+        len -= 8;
+    }
+    while (len > 1) {
+        uint16_t w;
+        memcpy(&w, data, sizeof(w));
+        sum += w;
+        data += 2;
+        len -= 2;
+    }
+    if (len == 1) {
+        uint16_t pad = 0;
+        *(uint8_t *)(&pad) = *data;
+        sum += pad;
+    }
+
+    return csum + ChecksumFold64(sum);
+}
+
+#endif /* __UTIL_CHECKSUM_SIMD_H__ */
@@ -91,3 +91,190 @@ int ChecksumAutoModeCheck(uint64_t thread_count,
     }
     return 0;
 }
+
+#ifdef UNITTESTS
+#include "util-unittest.h"
+#include "util-clock.h"
+
+/** Comment out this if you want stats
+ *  #define ENABLE_CHECKSUM_STATS 1
+ */
+
+/* Number of times to repeat the sum (for stats) */
+#define CHECKSUM_STATS_TIMES 1000000
+
+/* reference: one 16 bit word at a time */
+static uint32_t ChecksumAddWordsRef(const uint16_t *pkt, uint32_t len, uint32_t csum)
+{
+    const uint8_t *data = (const uint8_t *)pkt;
+    uint16_t pad = 0;
+
+    while (len > 1) {
+        uint16_t w;
+        memcpy(&w, data, sizeof(w));
+        csum += w;
+        data += 2;
+        len -= 2;
+    }
+    if (len == 1) {
+        *(uint8_t *)(&pad) = *data;
+        csum += pad;
+    }
+    return csum;
+}
+
+static uint16_t ChecksumFold(uint32_t csum)
+{
+    csum = (csum >> 16) + (csum & 0x0000FFFF);
+    csum += (csum >> 16);
+    return (uint16_t)csum;
+}
+
+/**
+ * \test all lengths and alignments give the same sum as the reference
+ *
+ * Odd offsets give vector loads and 16 bit words across the alignment
+ * boundaries, and the lengths cover every tail left by the vector loops.
+ */
+static int ChecksumAddWordsTest01(void)
+{
+    uint16_t buf[1024];
+    uint8_t *data = (uint8_t *)buf;
+    uint32_t rnd = 1;
+
+    for (uint32_t i = 0; i < sizeof(buf); i++) {
+        rnd = rnd * 1103515245 + 12345;
+        data[i] = (uint8_t)(rnd >> 16);
+    }
+
+    for (uint32_t off = 0; off < 4; off++) {
+        for (uint32_t len = 0; len <= sizeof(buf) - 4; len++) {
+            const uint16_t *pkt = (const uint16_t *)(data + off);
+            uint16_t ref = ChecksumFold(ChecksumAddWordsRef(pkt, len, 0x1234));
+            uint16_t sum = ChecksumFold(ChecksumAddWords(pkt, len, 0x1234));
+            FAIL_IF(ref != sum);
+        }
+    }
+    PASS;
+}
+
+/**
+ * \test worst case for the carries: all bytes set
+ */
+static int ChecksumAddWordsTest02(void)
+{
+    uint8_t buf[1500];
+    memset(buf, 0xff, sizeof(buf));
+
+    for (uint32_t len = 0; len <= sizeof(buf); len++) {
+        uint16_t ref = ChecksumFold(ChecksumAddWordsRef((uint16_t *)buf, len, 0xffff));
+        uint16_t sum = ChecksumFold(ChecksumAddWords((uint16_t *)buf, len, 0xffff));
+        FAIL_IF(ref != sum);
+    }
+    PASS;
+}
+
+/**
+ * \test buffers shorter than the vector width, at the end of an
+ *       allocation so reads past the end are caught by the sanitizers
+ */
+static int ChecksumAddWordsTest03(void)
+{
+    for (uint32_t off = 0; off < 4; off++) {
+        for (uint32_t len = 0; len < 64; len++) {
+            uint8_t *mem = SCMalloc(off + len + 1);
+            FAIL_IF_NULL(mem);
+            for (uint32_t i = 0; i < off + len + 1; i++)
+                mem[i] = (uint8_t)(0xa5 ^ (i * 31));
+            /* the data ends with the allocation */
+            const uint16_t *pkt = (const uint16_t *)(mem + 1 + off);
+            uint16_t ref = ChecksumFold(ChecksumAddWordsRef(pkt, len, 0));
+            uint16_t sum = ChecksumFold(ChecksumAddWords(pkt, len, 0));
+            SCFree(mem);
+            FAIL_IF(ref != sum);
+        }
+    }
+    PASS;
+}
+
+/**
+ * \test TCP checksum of a packet, valid and corrupted
+ */
+static int ChecksumTCPTest01(void)
+{
+    /* 10.0.0.1:1024 -> 10.0.0.2:80 PSH ACK with 40 bytes of payload */
+    uint8_t raw_ip[] = {
+        0x45, 0x00, 0x00, 0x50, 0x00, 0x01, 0x40, 0x00,
+        0x40, 0x06, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02 };
+    uint8_t raw_tcp[60] = {
+        0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x01, 0x50, 0x18, 0x20, 0x00,
+        0x00, 0x00, 0x00, 0x00 };
+    for (int i = 20; i < (int)sizeof(raw_tcp); i++)
+        raw_tcp[i] = (uint8_t)(i * 7);
+
+    uint16_t csum = TCPChecksum((uint16_t *)(raw_ip + 12), (uint16_t *)raw_tcp,
+            sizeof(raw_tcp), 0);
+    memcpy(raw_tcp + 16, &csum, sizeof(csum));
+    FAIL_IF(TCPChecksum((uint16_t *)(raw_ip + 12), (uint16_t *)raw_tcp,
+                sizeof(raw_tcp), csum) != 0);
+
+    raw_tcp[47] ^= 0x01;
+    FAIL_IF(TCPChecksum((uint16_t *)(raw_ip + 12), (uint16_t *)raw_tcp,
+                sizeof(raw_tcp), csum) == 0);
+    PASS;
+}
+
+#ifdef ENABLE_CHECKSUM_STATS
+/**
+ * \test Give some stats
+ */
+static int ChecksumAddWordsStatsTest01(void)
+{
+    uint8_t buf[1500];
+    uint32_t sum = 0;
+    int i;
+
+    memset(buf, 0x5a, sizeof(buf));
+
+    CLOCK_INIT;
+    printf("reference: ");
+    CLOCK_START;
+    for (i = 0; i < CHECKSUM_STATS_TIMES; i++) {
+        /* change the data so the sum is not hoisted out of the loop */
+        buf[i % sizeof(buf)] = (uint8_t)i;
+        sum += ChecksumAddWordsRef((uint16_t *)buf, sizeof(buf), 0);
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    printf("ChecksumAddWords: ");
+    CLOCK_START;
+    for (i = 0; i < CHECKSUM_STATS_TIMES; i++) {
+        /* change the data so the sum is not hoisted out of the loop */
+        buf[i % sizeof(buf)] = (uint8_t)i;
+        sum += ChecksumAddWords((uint16_t *)buf, sizeof(buf), 0);
+    }
+    CLOCK_END;
+    CLOCK_PRINT_SEC;
+
+    /* keep the loops */
+    FAIL_IF(sum == 0);
+    PASS;
+}
+#endif
+#endif /* UNITTESTS */
+
+void ChecksumRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ChecksumAddWordsTest01", ChecksumAddWordsTest01);
+    UtRegisterTest("ChecksumAddWordsTest02", ChecksumAddWordsTest02);
+    UtRegisterTest("ChecksumAddWordsTest03", ChecksumAddWordsTest03);
+    UtRegisterTest("ChecksumTCPTest01", ChecksumTCPTest01);
+#ifdef ENABLE_CHECKSUM_STATS
+    UtRegisterTest("ChecksumAddWordsStatsTest01", ChecksumAddWordsStatsTest01);
+#endif
+#endif /* UNITTESTS */
+}
@@ -27,6 +27,7 @@
 int ReCalculateChecksum(Packet *p);
 int ChecksumAutoModeCheck(uint64_t thread_count,
         uint64_t iface_count, uint64_t iface_fail);
+void ChecksumRegisterTests(void);
 
 /* constant linked with detection of interface with
  * invalid checksums */
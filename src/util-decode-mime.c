@@ -1440,6 +1440,25 @@ static int ProcessQuotedPrintableBodyLine(const uint8_t *buf, uint32_t len,
     offset = 0;
     while (remaining > 0) {
 
+        /* Copy a run of normal characters at once, using the vectorized
+         * memchr and memcpy. The last character of the line and the one
+         * that fills up the chunk are left to the code below. */
+        if (remaining > 1 && *(buf + offset) != '=' &&
+                DATA_CHUNK_SIZE - state->data_chunk_len > EOL_LEN + 1) {
+            uint32_t run = remaining - 1;
+            const uint8_t *eq = memchr(buf + offset, '=', run);
+            if (eq != NULL) {
+                run = (uint32_t)(eq - (buf + offset));
+            }
+            run = MIN(run, DATA_CHUNK_SIZE - state->data_chunk_len - (EOL_LEN + 1));
+
+            memcpy(state->data_chunk + state->data_chunk_len, buf + offset, run);
+            state->data_chunk_len += run;
+            entity->decoded_body_len += run;
+            remaining -= run;
+            offset += run;
+        }
+
         c = *(buf + offset);
 
         /* Copy over normal character */
@@ -50,6 +50,8 @@
 #include "flow.h"
 #include "flow-hash.h"
 #include "tm-threads.h"
+#include "runmodes.h"
+#include "util-unittest.h"
 
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
@@ -68,6 +70,13 @@ struct bpf_map_item {
     char * name;
     int fd;
     uint8_t to_unlink;
+    /* position of the incremental scan of a bypassed flow table */
+    bool scan_running;
+    /* key to delete once the scan moved past it */
+    bool scan_pending;
+    uint64_t scan_cnt;
+    uint8_t scan_cursor[sizeof(struct flowv6_keys)];
+    uint8_t scan_pending_key[sizeof(struct flowv6_keys)];
 };
 
 struct bpf_maps_info {
@@ -146,33 +155,42 @@ static struct bpf_maps_info *EBPFGetBpfMap(const char *iface)
     return (struct bpf_maps_info *)data;
 }
 
-/**
- * Get file descriptor of a map in the scope of a interface
- *
- * \param iface the interface where the map need to be looked for
- * \param name the name of the map
- * \return the file descriptor or -1 in case of error
- */
-int EBPFGetMapFDByName(const char *iface, const char *name)
+static struct bpf_map_item *EBPFGetMapItemByName(const char *iface, const char *name)
 {
     int i;
 
     if (iface == NULL || name == NULL)
-        return -1;
+        return NULL;
     struct bpf_maps_info *bpf_maps = EBPFGetBpfMap(iface);
     if (bpf_maps == NULL)
-        return -1;
+        return NULL;
 
     for (i = 0; i < BPF_MAP_MAX_COUNT; i++) {
         if (!bpf_maps->array[i].name)
             continue;
         if (!strcmp(bpf_maps->array[i].name, name)) {
-            SCLogDebug("Got fd %d for eBPF map '%s'", bpf_maps->array[i].fd, name);
-            return bpf_maps->array[i].fd;
+            return &bpf_maps->array[i];
         }
     }
 
-    return -1;
+    return NULL;
+}
+
+/**
+ * Get file descriptor of a map in the scope of a interface
+ *
+ * \param iface the interface where the map need to be looked for
+ * \param name the name of the map
+ * \return the file descriptor or -1 in case of error
+ */
+int EBPFGetMapFDByName(const char *iface, const char *name)
+{
+    struct bpf_map_item *item = EBPFGetMapItemByName(iface, name);
+    if (item == NULL)
+        return -1;
+
+    SCLogDebug("Got fd %d for eBPF map '%s'", item->fd, name);
+    return item->fd;
 }
 
 static int EBPFLoadPinnedMapsFile(LiveDevice *livedev, const char *file)
@@ -578,6 +596,93 @@ static bool EBPFCreateFlowForKey(struct flows_stats *flowstats, LiveDevice *dev,
     return false;
 }
 
+/**
+ * Insert a half flow in the kernel bypass table
+ *
+ * \param mapfd file descriptor of the protocol bypass table
+ * \param key data to use as key in the table
+ * \return 0 in case of error, 1 if success
+ */
+int EBPFInsertHalfFlow(int mapd, void *key, unsigned int nr_cpus)
+{
+    BPF_DECLARE_PERCPU(struct pair, value, nr_cpus);
+    unsigned int i;
+
+    if (mapd == -1) {
+        return 0;
+    }
+
+    /* We use a per CPU structure so we have to set an array of values as the kernel
+     * is not duplicating the data on each CPU by itself. */
+    for (i = 0; i < nr_cpus; i++) {
+        BPF_PERCPU(value, i).packets = 0;
+        BPF_PERCPU(value, i).bytes = 0;
+    }
+    if (bpf_map_update_elem(mapd, key, value, BPF_NOEXIST) != 0) {
+        switch (errno) {
+            /* no more place in the hash */
+            case E2BIG:
+                return 0;
+            /* no more place in the hash for some hardware bypass */
+            case EAGAIN:
+                return 0;
+            /* if we already have the key then bypass is a success */
+            case EEXIST:
+                return 1;
+            /* Not supposed to be there so issue a error */
+            default:
+                SCLogError(SC_ERR_BPF, "Can't update eBPF map: %s (%d)",
+                        strerror(errno),
+                        errno);
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Attach the bypass keys of a flow to its bypass storage so the flow
+ * manager can follow the counters of the half flows
+ *
+ * On failure the keys are removed from the table and freed.
+ *
+ * \return 0 in case of error, 1 if success
+ */
+int EBPFSetFlowStorage(Packet *p, int map_fd, void *key0, void *key1,
+                       int family, unsigned int nr_cpus)
+{
+    FlowBypassInfo *fc = FlowGetStorageById(p->flow, GetFlowBypassInfoID());
+    if (fc) {
+        EBPFBypassData *eb = SCCalloc(1, sizeof(EBPFBypassData));
+        if (eb == NULL) {
+            EBPFDeleteKey(map_fd, key0);
+            EBPFDeleteKey(map_fd, key1);
+            LiveDevAddBypassFail(p->livedev, 1, family);
+            SCFree(key0);
+            SCFree(key1);
+            return 0;
+        }
+        eb->key[0] = key0;
+        eb->key[1] = key1;
+        eb->mapfd = map_fd;
+        eb->cpus_count = nr_cpus;
+        fc->BypassUpdate = EBPFBypassUpdate;
+        fc->BypassFree = EBPFBypassFree;
+        fc->bypass_data = eb;
+    } else {
+        EBPFDeleteKey(map_fd, key0);
+        EBPFDeleteKey(map_fd, key1);
+        LiveDevAddBypassFail(p->livedev, 1, family);
+        SCFree(key0);
+        SCFree(key1);
+        return 0;
+    }
+
+    LiveDevAddBypassStats(p->livedev, 1, family);
+    LiveDevAddBypassSuccess(p->livedev, 1, family);
+    return 1;
+}
+
 void EBPFBypassFree(void *data)
 {
     EBPFBypassData *eb = (EBPFBypassData *)data;
@@ -669,250 +774,434 @@ bool EBPFBypassUpdate(Flow *f, void *data, time_t tsec)
     return false;
 }
 
+/** entries read from a bypassed flow table per syscall */
+#define EBPF_MAP_BATCH_SIZE     256
+/** time in microseconds the periodic scan of the bypassed flow tables
+ *  of an interface can take per run. The scan continues at next run. */
+#define EBPF_SCAN_BUDGET        100000
+
+#ifdef HAVE_BPF_MAP_LOOKUP_BATCH
+/* set to false if the kernel doesn't support batched map operations */
+static bool g_ebpf_batch_ok = true;
+#else
+static bool g_ebpf_batch_ok = false;
+#endif
+
+#ifdef UNITTESTS
+/* map access of the entry by entry scan, replaced by the tests */
+static int (*EBPFMapGetNextKey)(int, const void *, void *) = bpf_map_get_next_key;
+static int (*EBPFMapLookupElem)(int, const void *, void *) = bpf_map_lookup_elem;
+#else
+#define EBPFMapGetNextKey bpf_map_get_next_key
+#define EBPFMapLookupElem bpf_map_lookup_elem
+#endif
+
+typedef struct EBPFBypassedScan_ {
+    char iface[IFNAMSIZ];
+    struct ebpf_timeout_config cfg;
+} EBPFBypassedScan;
+
 typedef bool (*OpFlowForKey)(struct flows_stats * flowstats, LiveDevice*dev, void *key,
                             size_t skey, FlowKey *flow_key, struct timespec *ctime,
                             uint64_t pkts_cnt, uint64_t bytes_cnt,
                             int mapfd, int cpus_count);
 
+static void EBPFFlowKeyFromV4(FlowKey *flow_key, const struct flowv4_keys *key,
+                              uint8_t mode)
+{
+    if (mode == AFP_MODE_XDP_BYPASS) {
+        flow_key->sp = ntohs(key->port16[0]);
+        flow_key->dp = ntohs(key->port16[1]);
+        flow_key->src.addr_data32[0] = key->src;
+        flow_key->dst.addr_data32[0] = key->dst;
+    } else {
+        flow_key->sp = key->port16[0];
+        flow_key->dp = key->port16[1];
+        flow_key->src.addr_data32[0] = ntohl(key->src);
+        flow_key->dst.addr_data32[0] = ntohl(key->dst);
+    }
+    flow_key->src.family = AF_INET;
+    flow_key->src.addr_data32[1] = 0;
+    flow_key->src.addr_data32[2] = 0;
+    flow_key->src.addr_data32[3] = 0;
+    flow_key->dst.family = AF_INET;
+    flow_key->dst.addr_data32[1] = 0;
+    flow_key->dst.addr_data32[2] = 0;
+    flow_key->dst.addr_data32[3] = 0;
+    flow_key->vlan_id[0] = key->vlan0;
+    flow_key->vlan_id[1] = key->vlan1;
+    if (key->ip_proto == 1) {
+        flow_key->proto = IPPROTO_TCP;
+    } else {
+        flow_key->proto = IPPROTO_UDP;
+    }
+    flow_key->recursion_level = 0;
+}
+
+static void EBPFFlowKeyFromV6(FlowKey *flow_key, const struct flowv6_keys *key,
+                              uint8_t mode)
+{
+    int i;
+
+    flow_key->src.family = AF_INET6;
+    flow_key->dst.family = AF_INET6;
+    if (mode == AFP_MODE_XDP_BYPASS) {
+        flow_key->sp = ntohs(key->port16[0]);
+        flow_key->dp = ntohs(key->port16[1]);
+        for (i = 0; i < 4; i++) {
+            flow_key->src.addr_data32[i] = key->src[i];
+            flow_key->dst.addr_data32[i] = key->dst[i];
+        }
+    } else {
+        flow_key->sp = key->port16[0];
+        flow_key->dp = key->port16[1];
+        for (i = 0; i < 4; i++) {
+            flow_key->src.addr_data32[i] = ntohl(key->src[i]);
+            flow_key->dst.addr_data32[i] = ntohl(key->dst[i]);
+        }
+    }
+    flow_key->vlan_id[0] = key->vlan0;
+    flow_key->vlan_id[1] = key->vlan1;
+    if (key->ip_proto == 1) {
+        flow_key->proto = IPPROTO_TCP;
+    } else {
+        flow_key->proto = IPPROTO_UDP;
+    }
+    flow_key->recursion_level = 0;
+}
+
 /**
- * Bypassed flows cleaning for IPv4
+ * Read the entries following the scan position of a map one by one,
+ * for systems without bpf_map_lookup_batch()
+ *
+ * The position is the last key read. If that entry is deleted, the
+ * kernel gives the first key of the map as next key, so the pass ends
+ * there instead of starting over.
  *
- * This function iterates on all the flows of the IPv4 table
- * looking for timeouted flow to delete from the flow table.
+ * \return 0 in case of success, -1 with errno set to ENOENT at the end
+ *         of the map or of the pass
  */
-static int EBPFForEachFlowV4Table(ThreadVars *th_v, LiveDevice *dev, const char *name,
-                                  struct timespec *ctime,
-                                  struct ebpf_timeout_config *tcfg,
-                                  OpFlowForKey EBPFOpFlowForKey
-                                  )
+static int EBPFMapLookupChunk(struct bpf_map_item *item, size_t skey,
+                              uint8_t *keys, uint8_t *values, size_t svalue,
+                              uint32_t *count)
 {
-    struct flows_stats flowstats = { 0, 0, 0};
-    int mapfd = EBPFGetMapFDByName(dev->dev, name);
-    if (mapfd == -1)
+    uint32_t n = 0;
+    int ret = 0;
+
+    if (!item->scan_running) {
+        memset(item->scan_cursor, 0, sizeof(item->scan_cursor));
+    } else if (EBPFMapLookupElem(item->fd, item->scan_cursor, values) != 0) {
+        /* position removed since the previous chunk */
+        *count = 0;
+        errno = ENOENT;
         return -1;
-
-    struct flowv4_keys key = {}, next_key;
-    int found = 0;
-    unsigned int i;
-    uint64_t hash_cnt = 0;
-
-    if (tcfg->cpus_count == 0) {
-        return 0;
     }
-
-    bool dead_flow = false;
-    while (bpf_map_get_next_key(mapfd, &key, &next_key) == 0) {
-        uint64_t bytes_cnt = 0;
-        uint64_t pkts_cnt = 0;
-        hash_cnt++;
-        if (dead_flow) {
-            EBPFDeleteKey(mapfd, &key);
-            dead_flow = false;
-        }
-        /* We use a per CPU structure so we will get a array of values. But if nr_cpus
-         * is 1 then we have a global hash. */
-        BPF_DECLARE_PERCPU(struct pair, values_array, tcfg->cpus_count);
-        memset(values_array, 0, sizeof(values_array));
-        int res = bpf_map_lookup_elem(mapfd, &next_key, values_array);
-        if (res < 0) {
-            SCLogDebug("no entry in v4 table for %d -> %d", key.port16[0], key.port16[1]);
-            SCLogDebug("errno: (%d) %s", errno, strerror(errno));
-            key = next_key;
-            continue;
-        }
-        for (i = 0; i < tcfg->cpus_count; i++) {
-            /* let's start accumulating value so we can compute the counters */
-            SCLogDebug("%d: Adding pkts %lu bytes %lu", i,
-                       BPF_PERCPU(values_array, i).packets,
-                       BPF_PERCPU(values_array, i).bytes);
-            pkts_cnt += BPF_PERCPU(values_array, i).packets;
-            bytes_cnt += BPF_PERCPU(values_array, i).bytes;
-        }
-        /* Get the corresponding Flow in the Flow table to compare and update
-         * its counters and lastseen if needed */
-        FlowKey flow_key;
-        if (tcfg->mode == AFP_MODE_XDP_BYPASS) {
-            flow_key.sp = ntohs(next_key.port16[0]);
-            flow_key.dp = ntohs(next_key.port16[1]);
-            flow_key.src.addr_data32[0] = next_key.src;
-            flow_key.dst.addr_data32[0] = next_key.dst;
-        } else {
-            flow_key.sp = next_key.port16[0];
-            flow_key.dp = next_key.port16[1];
-            flow_key.src.addr_data32[0] = ntohl(next_key.src);
-            flow_key.dst.addr_data32[0] = ntohl(next_key.dst);
-        }
-        flow_key.src.family = AF_INET;
-        flow_key.src.addr_data32[1] = 0;
-        flow_key.src.addr_data32[2] = 0;
-        flow_key.src.addr_data32[3] = 0;
-        flow_key.dst.family = AF_INET;
-        flow_key.dst.addr_data32[1] = 0;
-        flow_key.dst.addr_data32[2] = 0;
-        flow_key.dst.addr_data32[3] = 0;
-        flow_key.vlan_id[0] = next_key.vlan0;
-        flow_key.vlan_id[1] = next_key.vlan1;
-        if (next_key.ip_proto == 1) {
-            flow_key.proto = IPPROTO_TCP;
-        } else {
-            flow_key.proto = IPPROTO_UDP;
+    while (n < *count) {
+        uint8_t *key = keys + n * skey;
+        if (EBPFMapGetNextKey(item->fd, item->scan_cursor, key) != 0) {
+            errno = ENOENT;
+            ret = -1;
+            break;
         }
-        flow_key.recursion_level = 0;
-        dead_flow = EBPFOpFlowForKey(&flowstats, dev, &next_key, sizeof(next_key), &flow_key,
-                                     ctime, pkts_cnt, bytes_cnt,
-                                     mapfd, tcfg->cpus_count);
-        if (dead_flow) {
-            found = 1;
+        memcpy(item->scan_cursor, key, skey);
+        /* the entry may have been removed since */
+        if (EBPFMapLookupElem(item->fd, key, values + n * svalue) != 0) {
+            errno = ENOENT;
+            ret = -1;
+            break;
         }
+        n++;
+    }
+    *count = n;
+    return ret;
+}
 
-        if (TmThreadsCheckFlag(th_v, THV_KILL)) {
-            return 0;
+static void EBPFDeleteKeys(int fd, uint8_t *keys, uint32_t count, size_t skey)
+{
+    uint32_t i;
+
+#ifdef HAVE_BPF_MAP_LOOKUP_BATCH
+    if (g_ebpf_batch_ok) {
+        DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
+                .elem_flags = 0,
+                .flags = 0,
+        );
+        uint32_t deleted = count;
+        if (bpf_map_delete_batch(fd, keys, &deleted, &opts) == 0) {
+            return;
+        }
+        /* the batch stops at the first missing key, do the rest one
+         * by one */
+        if (deleted < count) {
+            keys += deleted * skey;
+            count -= deleted;
         }
-
-        key = next_key;
     }
-    if (dead_flow) {
-        EBPFDeleteKey(mapfd, &key);
-        found = 1;
+#endif
+    for (i = 0; i < count; i++) {
+        if (bpf_map_delete_elem(fd, keys + i * skey) < 0 && errno != ENOENT) {
+            SCLogWarning(SC_ERR_SYSCALL, "Unable to delete entry: %s (%d)",
+                    strerror(errno), errno);
+        }
     }
-    SC_ATOMIC_ADD(dev->bypassed, flowstats.packets);
-
-    LiveDevAddBypassStats(dev, flowstats.count, AF_INET);
-    SCLogInfo("IPv4 bypassed flow table size: %" PRIu64, hash_cnt);
-
-    return found;
 }
 
 /**
- * Bypassed flows cleaning for IPv6
+ * Scan a bypassed flow table and call an operation on its entries
  *
- * This function iterates on all the flows of the IPv4 table
- * looking for timeouted flow to delete from the flow table.
+ * Entries are read in batches and their per CPU counters are summed in
+ * the same pass. The keys of the entries the operation reports as dead
+ * are deleted after each batch. When a deadline is set, the scan stops
+ * once it is reached and the next call continues from that position.
+ *
+ * \return 1 if dead entries were found, 0 if not, -1 in case of error
  */
-static int EBPFForEachFlowV6Table(ThreadVars *th_v,
-                                  LiveDevice *dev, const char *name,
-                                  struct timespec *ctime,
-                                  struct ebpf_timeout_config *tcfg,
-                                  OpFlowForKey EBPFOpFlowForKey
-                                  )
+static int EBPFForEachFlowTable(ThreadVars *th_v, LiveDevice *dev, const char *name,
+                                int family, struct timespec *ctime,
+                                struct ebpf_timeout_config *tcfg,
+                                OpFlowForKey EBPFOpFlowForKey,
+                                struct flows_stats *flowstats,
+                                const struct timeval *deadline)
 {
-    struct flows_stats flowstats = { 0, 0, 0};
-    int mapfd = EBPFGetMapFDByName(dev->dev, name);
-    if (mapfd == -1)
+    struct bpf_map_item *item = EBPFGetMapItemByName(dev->dev, name);
+    if (item == NULL)
         return -1;
 
-    struct flowv6_keys key = {}, next_key;
-    int found = 0;
-    unsigned int i;
-    uint64_t hash_cnt = 0;
-
     if (tcfg->cpus_count == 0) {
         SCLogWarning(SC_ERR_INVALID_VALUE, "CPU count should not be 0");
         return 0;
     }
 
-    uint64_t pkts_cnt = 0;
-    while (bpf_map_get_next_key(mapfd, &key, &next_key) == 0) {
-        uint64_t bytes_cnt = 0;
-        hash_cnt++;
-        if (pkts_cnt > 0) {
-            EBPFDeleteKey(mapfd, &key);
-        }
-        pkts_cnt = 0;
-        /* We use a per CPU structure so we will get a array of values. But if nr_cpus
-         * is 1 then we have a global hash. */
-        BPF_DECLARE_PERCPU(struct pair, values_array, tcfg->cpus_count);
-        memset(values_array, 0, sizeof(values_array));
-        int res = bpf_map_lookup_elem(mapfd, &next_key, values_array);
-        if (res < 0) {
-            SCLogDebug("no entry in v4 table for %d -> %d", key.port16[0], key.port16[1]);
-            key = next_key;
-            continue;
-        }
-        for (i = 0; i < tcfg->cpus_count; i++) {
-            /* let's start accumulating value so we can compute the counters */
-            SCLogDebug("%d: Adding pkts %lu bytes %lu", i,
-                       BPF_PERCPU(values_array, i).packets,
-                       BPF_PERCPU(values_array, i).bytes);
-            pkts_cnt += BPF_PERCPU(values_array, i).packets;
-            bytes_cnt += BPF_PERCPU(values_array, i).bytes;
-        }
-        /* Get the corresponding Flow in the Flow table to compare and update
-         * its counters  and lastseen if needed */
-        FlowKey flow_key;
-        if (tcfg->mode == AFP_MODE_XDP_BYPASS) {
-            flow_key.sp = ntohs(next_key.port16[0]);
-            flow_key.dp = ntohs(next_key.port16[1]);
-            flow_key.src.family = AF_INET6;
-            flow_key.src.addr_data32[0] = next_key.src[0];
-            flow_key.src.addr_data32[1] = next_key.src[1];
-            flow_key.src.addr_data32[2] = next_key.src[2];
-            flow_key.src.addr_data32[3] = next_key.src[3];
-            flow_key.dst.family = AF_INET6;
-            flow_key.dst.addr_data32[0] = next_key.dst[0];
-            flow_key.dst.addr_data32[1] = next_key.dst[1];
-            flow_key.dst.addr_data32[2] = next_key.dst[2];
-            flow_key.dst.addr_data32[3] = next_key.dst[3];
-        } else {
-            flow_key.sp = next_key.port16[0];
-            flow_key.dp = next_key.port16[1];
-            flow_key.src.family = AF_INET6;
-            flow_key.src.addr_data32[0] = ntohl(next_key.src[0]);
-            flow_key.src.addr_data32[1] = ntohl(next_key.src[1]);
-            flow_key.src.addr_data32[2] = ntohl(next_key.src[2]);
-            flow_key.src.addr_data32[3] = ntohl(next_key.src[3]);
-            flow_key.dst.family = AF_INET6;
-            flow_key.dst.addr_data32[0] = ntohl(next_key.dst[0]);
-            flow_key.dst.addr_data32[1] = ntohl(next_key.dst[1]);
-            flow_key.dst.addr_data32[2] = ntohl(next_key.dst[2]);
-            flow_key.dst.addr_data32[3] = ntohl(next_key.dst[3]);
+    const size_t skey = (family == AF_INET) ?
+        sizeof(struct flowv4_keys) : sizeof(struct flowv6_keys);
+    /* per CPU values, same layout as BPF_DECLARE_PERCPU() */
+    const size_t svalue = sizeof(struct pair) * tcfg->cpus_count;
+    uint8_t *keys = SCMalloc(skey * EBPF_MAP_BATCH_SIZE);
+    uint8_t *dead = SCMalloc(skey * EBPF_MAP_BATCH_SIZE);
+    uint8_t *values = SCMalloc(svalue * EBPF_MAP_BATCH_SIZE);
+    if (keys == NULL || dead == NULL || values == NULL) {
+        SCFree(keys);
+        SCFree(dead);
+        SCFree(values);
+        return -1;
+    }
+
+    int found = 0;
+    bool end = false;
+    while (!end) {
+        uint32_t count = EBPF_MAP_BATCH_SIZE;
+        int ret;
+        bool batch = g_ebpf_batch_ok;
+
+#ifdef HAVE_BPF_MAP_LOOKUP_BATCH
+        if (batch) {
+            DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
+                    .elem_flags = 0,
+                    .flags = 0,
+            );
+            uint8_t next[sizeof(item->scan_cursor)];
+            ret = bpf_map_lookup_batch(item->fd,
+                    item->scan_running ? item->scan_cursor : NULL, next,
+                    keys, values, &count, &opts);
+            if (ret < 0 && errno != ENOENT) {
+                if (errno == EINVAL && !item->scan_running) {
+                    SCLogConfig("Batched eBPF map operations not supported, "
+                            "reading the bypassed flow tables entry by entry");
+                    g_ebpf_batch_ok = false;
+                    continue;
+                }
+                SCLogWarning(SC_ERR_SYSCALL, "Unable to read eBPF map '%s': %s (%d)",
+                        name, strerror(errno), errno);
+                item->scan_running = false;
+                break;
+            }
+            if (ret == 0) {
+                memcpy(item->scan_cursor, next, sizeof(next));
+            }
+        } else
+#endif
+        {
+            ret = EBPFMapLookupChunk(item, skey, keys, values, svalue, &count);
+            /* previous position is behind us, it can now be deleted */
+            if (item->scan_pending) {
+                EBPFDeleteKeys(item->fd, item->scan_pending_key, 1, skey);
+                item->scan_pending = false;
+            }
         }
-        flow_key.vlan_id[0] = next_key.vlan0;
-        flow_key.vlan_id[1] = next_key.vlan1;
-        if (next_key.ip_proto == 1) {
-            flow_key.proto = IPPROTO_TCP;
-        } else {
-            flow_key.proto = IPPROTO_UDP;
+        end = (ret < 0);
+
+        uint32_t ndead = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t *key = keys + i * skey;
+            const struct pair *v = (const struct pair *)(values + i * svalue);
+            uint64_t pkts_cnt = 0;
+            uint64_t bytes_cnt = 0;
+            for (int c = 0; c < tcfg->cpus_count; c++) {
+                pkts_cnt += v[c].packets;
+                bytes_cnt += v[c].bytes;
+            }
+
+            /* Get the corresponding Flow in the Flow table to compare and
+             * update its counters and lastseen if needed */
+            FlowKey flow_key;
+            if (family == AF_INET) {
+                EBPFFlowKeyFromV4(&flow_key, (struct flowv4_keys *)key, tcfg->mode);
+            } else {
+                EBPFFlowKeyFromV6(&flow_key, (struct flowv6_keys *)key, tcfg->mode);
+            }
+            if (EBPFOpFlowForKey(flowstats, dev, key, skey, &flow_key, ctime,
+                        pkts_cnt, bytes_cnt, item->fd, tcfg->cpus_count)) {
+                memcpy(dead + ndead * skey, key, skey);
+                ndead++;
+            }
         }
-        flow_key.recursion_level = 0;
-        pkts_cnt = EBPFOpFlowForKey(&flowstats, dev, &next_key, sizeof(next_key), &flow_key,
-                                    ctime, pkts_cnt, bytes_cnt,
-                                    mapfd, tcfg->cpus_count);
-        if (pkts_cnt > 0) {
+        item->scan_cnt += count;
+
+        if (ndead > 0) {
             found = 1;
+            /* without batches the position is a key, deleting it now
+             * would restart the scan from the beginning */
+            if (!batch && !end &&
+                    memcmp(dead + (ndead - 1) * skey, item->scan_cursor, skey) == 0) {
+                ndead--;
+                memcpy(item->scan_pending_key, dead + ndead * skey, skey);
+                item->scan_pending = true;
+            }
+            EBPFDeleteKeys(item->fd, dead, ndead, skey);
         }
 
-        if (TmThreadsCheckFlag(th_v, THV_KILL)) {
-            return 0;
+        if (end) {
+            if (deadline == NULL) {
+                SCLogInfo("%s bypassed flow table size: %" PRIu64,
+                        family == AF_INET ? "IPv4" : "IPv6", item->scan_cnt);
+            } else {
+                SCLogDebug("%s bypassed flow table size: %" PRIu64,
+                        family == AF_INET ? "IPv4" : "IPv6", item->scan_cnt);
+            }
+            item->scan_running = false;
+            item->scan_cnt = 0;
+            break;
         }
+        item->scan_running = true;
 
-        key = next_key;
-    }
-    if (pkts_cnt > 0) {
-        EBPFDeleteKey(mapfd, &key);
-        found = 1;
+        if (TmThreadsCheckFlag(th_v, THV_KILL)) {
+            break;
+        }
+        if (deadline) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            if (timercmp(&now, deadline, >)) {
+                break;
+            }
+        }
     }
-    SC_ATOMIC_ADD(dev->bypassed, flowstats.packets);
 
-    LiveDevAddBypassStats(dev, flowstats.count, AF_INET6);
-    SCLogInfo("IPv6 bypassed flow table size: %" PRIu64, hash_cnt);
+    SCFree(keys);
+    SCFree(dead);
+    SCFree(values);
     return found;
 }
 
+/**
+ * Remove the entries of flows that are no more in the flow table
+ *
+ * Flows evicted from the flow table without going through the bypassed
+ * timeout leave their entries behind.
+ *
+ * \return true if the entry has to be deleted
+ */
+static bool EBPFRemoveOrphanForKey(struct flows_stats *flowstats, LiveDevice *dev, void *key,
+                                   size_t skey, FlowKey *flow_key, struct timespec *ctime,
+                                   uint64_t pkts_cnt, uint64_t bytes_cnt,
+                                   int mapfd, int cpus_count)
+{
+    Flow *f = FlowGetExistingFlowFromHash(flow_key, FlowKeyGetHash(flow_key));
+    if (f != NULL) {
+        /* counters are followed by the flow manager */
+        FLOWLOCK_UNLOCK(f);
+        return false;
+    }
+    flowstats->count++;
+    flowstats->packets += pkts_cnt;
+    flowstats->bytes += bytes_cnt;
+    return true;
+}
 
 int EBPFCheckBypassedFlowCreate(ThreadVars *th_v, struct timespec *curtime, void *data)
 {
-    LiveDevice *ldev = NULL, *ndev;
-    struct ebpf_timeout_config *cfg = (struct ebpf_timeout_config *)data;
-    while(LiveDeviceForEach(&ldev, &ndev)) {
-        EBPFForEachFlowV4Table(th_v, ldev, "flow_table_v4",
-                curtime,
-                cfg, EBPFCreateFlowForKey);
-        EBPFForEachFlowV6Table(th_v, ldev, "flow_table_v6",
-                curtime,
-                cfg, EBPFCreateFlowForKey);
-    }
+    EBPFBypassedScan *scan = (EBPFBypassedScan *)data;
+    LiveDevice *ldev = LiveGetDevice(scan->iface);
+    if (ldev == NULL)
+        return 0;
+
+    struct flows_stats flowstats = { 0, 0, 0};
+    EBPFForEachFlowTable(th_v, ldev, "flow_table_v4", AF_INET, curtime,
+            &scan->cfg, EBPFCreateFlowForKey, &flowstats, NULL);
+    SC_ATOMIC_ADD(ldev->bypassed, flowstats.packets);
+    LiveDevAddBypassStats(ldev, flowstats.count, AF_INET);
+
+    memset(&flowstats, 0, sizeof(flowstats));
+    EBPFForEachFlowTable(th_v, ldev, "flow_table_v6", AF_INET6, curtime,
+            &scan->cfg, EBPFCreateFlowForKey, &flowstats, NULL);
+    SC_ATOMIC_ADD(ldev->bypassed, flowstats.packets);
+    LiveDevAddBypassStats(ldev, flowstats.count, AF_INET6);
+
+    return 0;
+}
+
+/**
+ * Periodic scan of the bypassed flow tables of an interface
+ *
+ * The scan is incremental: each run takes at most EBPF_SCAN_BUDGET
+ * microseconds and the next one continues where it stopped.
+ */
+int EBPFCheckBypassedFlowTimeout(ThreadVars *th_v, struct flows_stats *bypassstats,
+                                 struct timespec *curtime, void *data)
+{
+    EBPFBypassedScan *scan = (EBPFBypassedScan *)data;
+    LiveDevice *ldev = LiveGetDevice(scan->iface);
+    if (ldev == NULL)
+        return 0;
+
+    struct timeval deadline;
+    gettimeofday(&deadline, NULL);
+    deadline.tv_usec += EBPF_SCAN_BUDGET;
+    deadline.tv_sec += deadline.tv_usec / 1000000;
+    deadline.tv_usec %= 1000000;
 
+    int ret4 = EBPFForEachFlowTable(th_v, ldev, "flow_table_v4", AF_INET, curtime,
+            &scan->cfg, EBPFRemoveOrphanForKey, bypassstats, &deadline);
+    int ret6 = EBPFForEachFlowTable(th_v, ldev, "flow_table_v6", AF_INET6, curtime,
+            &scan->cfg, EBPFRemoveOrphanForKey, bypassstats, &deadline);
+
+    return (ret4 > 0 || ret6 > 0);
+}
+
+/**
+ * Register the scans of the bypassed flow tables of an interface in the
+ * bypassed flow manager: the creation of the flows of pinned maps at
+ * start and the periodic removal of the entries without flow.
+ *
+ * \return 0 in case of success, -1 in case of error
+ */
+int EBPFRegisterBypassedFlowScan(const char *iface, struct ebpf_timeout_config *config)
+{
+    EBPFBypassedScan *scan = SCCalloc(1, sizeof(*scan));
+    if (scan == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Flow bypass alloc error");
+        return -1;
+    }
+    strlcpy(scan->iface, iface, sizeof(scan->iface));
+    scan->cfg = *config;
+
+    RunModeEnablesBypassManager();
+    if (BypassedFlowManagerRegisterCheckFunc(EBPFCheckBypassedFlowTimeout,
+                (config->flags & EBPF_PINNED_MAPS) ? EBPFCheckBypassedFlowCreate : NULL,
+                (void *)scan) < 0) {
+        SCLogError(SC_ERR_INVALID_VALUE, "Too many bypassed flow checks");
+        SCFree(scan);
+        return -1;
+    }
     return 0;
 }
 
@@ -1073,6 +1362,313 @@ int EBPFUpdateFlow(Flow *f, Packet *p, void *data)
     return 1;
 }
 
+/**
+ * Bypass a flow in the XDP filter
+ *
+ * This function creates two half flows in the map shared with the XDP
+ * filter. The addresses and ports are stored in network order as the
+ * filter reads them from the packet.
+ *
+ * \param p the packet belonging to the flow to bypass
+ * \param v4_map_fd file descriptor of the IPv4 flow table
+ * \param v6_map_fd file descriptor of the IPv6 flow table
+ * \param nr_cpus number of values per entry of the per CPU tables
+ * \return 0 if unable to bypass, 1 if success
+ */
+int EBPFXDPBypassFlow(Packet *p, int v4_map_fd, int v6_map_fd,
+                      unsigned int nr_cpus)
+{
+    /* Only bypass TCP and UDP */
+    if (!(PKT_IS_TCP(p) || PKT_IS_UDP(p))) {
+        return 0;
+    }
+
+    /* If we don't have a flow attached to packet the eBPF map entries
+     * will be destroyed at first flow bypass manager pass as we won't
+     * find any associated entry */
+    if (p->flow == NULL) {
+        return 0;
+    }
+    /* Bypassing tunneled packets is currently not supported
+     * because we can't discard the inner packet only due to
+     * primitive parsing in eBPF */
+    if (IS_TUNNEL_PKT(p)) {
+        return 0;
+    }
+    if (PKT_IS_IPV4(p)) {
+        struct flowv4_keys *keys[2];
+        keys[0]= SCCalloc(1, sizeof(struct flowv4_keys));
+        if (keys[0] == NULL) {
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
+            return 0;
+        }
+        if (v4_map_fd == -1) {
+            SCFree(keys[0]);
+            return 0;
+        }
+        keys[0]->src = p->src.addr_data32[0];
+        keys[0]->dst = p->dst.addr_data32[0];
+        /* In the XDP filter we get port from parsing of packet and not from skb
+         * (as in eBPF filter) so we need to pass from host to network order */
+        keys[0]->port16[0] = htons(p->sp);
+        keys[0]->port16[1] = htons(p->dp);
+        keys[0]->vlan0 = p->vlan_id[0];
+        keys[0]->vlan1 = p->vlan_id[1];
+        if (IPV4_GET_IPPROTO(p) == IPPROTO_TCP) {
+            keys[0]->ip_proto = 1;
+        } else {
+            keys[0]->ip_proto = 0;
+        }
+        if (EBPFInsertHalfFlow(v4_map_fd, keys[0], nr_cpus) == 0) {
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
+            SCFree(keys[0]);
+            return 0;
+        }
+        keys[1]= SCCalloc(1, sizeof(struct flowv4_keys));
+        if (keys[1] == NULL) {
+            EBPFDeleteKey(v4_map_fd, keys[0]);
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
+            SCFree(keys[0]);
+            return 0;
+        }
+        keys[1]->src = p->dst.addr_data32[0];
+        keys[1]->dst = p->src.addr_data32[0];
+        keys[1]->port16[0] = htons(p->dp);
+        keys[1]->port16[1] = htons(p->sp);
+        keys[1]->vlan0 = p->vlan_id[0];
+        keys[1]->vlan1 = p->vlan_id[1];
+        keys[1]->ip_proto = keys[0]->ip_proto;
+        if (EBPFInsertHalfFlow(v4_map_fd, keys[1], nr_cpus) == 0) {
+            EBPFDeleteKey(v4_map_fd, keys[0]);
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET);
+            SCFree(keys[0]);
+            SCFree(keys[1]);
+            return 0;
+        }
+        return EBPFSetFlowStorage(p, v4_map_fd, keys[0], keys[1], AF_INET, nr_cpus);
+    }
+    /* For IPv6 case we don't handle extended header in eBPF */
+    if (PKT_IS_IPV6(p) &&
+        ((IPV6_GET_NH(p) == IPPROTO_TCP) || (IPV6_GET_NH(p) == IPPROTO_UDP))) {
+        SCLogDebug("add an IPv6");
+        if (v6_map_fd == -1) {
+            return 0;
+        }
+        int i;
+        struct flowv6_keys *keys[2];
+        keys[0] = SCCalloc(1, sizeof(struct flowv6_keys));
+        if (keys[0] == NULL) {
+            return 0;
+        }
+
+        for (i = 0; i < 4; i++) {
+            keys[0]->src[i] = GET_IPV6_SRC_ADDR(p)[i];
+            keys[0]->dst[i] = GET_IPV6_DST_ADDR(p)[i];
+        }
+        keys[0]->port16[0] = htons(GET_TCP_SRC_PORT(p));
+        keys[0]->port16[1] = htons(GET_TCP_DST_PORT(p));
+        keys[0]->vlan0 = p->vlan_id[0];
+        keys[0]->vlan1 = p->vlan_id[1];
+        if (IPV6_GET_NH(p) == IPPROTO_TCP) {
+            keys[0]->ip_proto = 1;
+        } else {
+            keys[0]->ip_proto = 0;
+        }
+        if (EBPFInsertHalfFlow(v6_map_fd, keys[0], nr_cpus) == 0) {
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
+            SCFree(keys[0]);
+            return 0;
+        }
+        keys[1]= SCCalloc(1, sizeof(struct flowv6_keys));
+        if (keys[1] == NULL) {
+            EBPFDeleteKey(v6_map_fd, keys[0]);
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
+            SCFree(keys[0]);
+            return 0;
+        }
+        for (i = 0; i < 4; i++) {
+            keys[1]->src[i] = GET_IPV6_DST_ADDR(p)[i];
+            keys[1]->dst[i] = GET_IPV6_SRC_ADDR(p)[i];
+        }
+        keys[1]->port16[0] = htons(GET_TCP_DST_PORT(p));
+        keys[1]->port16[1] = htons(GET_TCP_SRC_PORT(p));
+        keys[1]->vlan0 = p->vlan_id[0];
+        keys[1]->vlan1 = p->vlan_id[1];
+        keys[1]->ip_proto = keys[0]->ip_proto;
+        if (EBPFInsertHalfFlow(v6_map_fd, keys[1], nr_cpus) == 0) {
+            EBPFDeleteKey(v6_map_fd, keys[0]);
+            LiveDevAddBypassFail(p->livedev, 1, AF_INET6);
+            SCFree(keys[0]);
+            SCFree(keys[1]);
+            return 0;
+        }
+        return EBPFSetFlowStorage(p, v6_map_fd, keys[0], keys[1], AF_INET6, nr_cpus);
+    }
+    return 0;
+}
+
 #endif /* HAVE_PACKET_XDP */
 
+#ifdef UNITTESTS
+#define EBPF_TEST_MAP_SIZE 5
+
+/* map of keys 1 to EBPF_TEST_MAP_SIZE, in that order */
+static struct {
+    bool present[EBPF_TEST_MAP_SIZE];
+    /* entry deleted once the scan reads its key, 0 for none */
+    uint32_t vanish;
+} ebpf_test_map;
+
+static int EBPFTestMapIndex(const void *key)
+{
+    uint32_t k;
+    memcpy(&k, key, sizeof(k));
+    if (k == 0 || k > EBPF_TEST_MAP_SIZE || !ebpf_test_map.present[k - 1])
+        return -1;
+    return k - 1;
+}
+
+static int EBPFTestMapGetNextKey(int fd, const void *key, void *next_key)
+{
+    int i = EBPFTestMapIndex(key);
+    /* like the kernel, a missing key gives the first key */
+    for (i = (i < 0) ? 0 : i + 1; i < EBPF_TEST_MAP_SIZE; i++) {
+        if (ebpf_test_map.present[i]) {
+            uint32_t k = i + 1;
+            memset(next_key, 0, sizeof(struct flowv4_keys));
+            memcpy(next_key, &k, sizeof(k));
+            if (ebpf_test_map.vanish == k) {
+                ebpf_test_map.present[i] = false;
+            }
+            return 0;
+        }
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+static int EBPFTestMapLookupElem(int fd, const void *key, void *value)
+{
+    int i = EBPFTestMapIndex(key);
+    if (i < 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    struct pair *v = value;
+    v->packets = i + 1;
+    v->bytes = 100 * (i + 1);
+    return 0;
+}
+
+static void EBPFTestMapSetup(struct bpf_map_item *item)
+{
+    memset(item, 0, sizeof(*item));
+    memset(&ebpf_test_map, 0, sizeof(ebpf_test_map));
+    for (int i = 0; i < EBPF_TEST_MAP_SIZE; i++) {
+        ebpf_test_map.present[i] = true;
+    }
+    EBPFMapGetNextKey = EBPFTestMapGetNextKey;
+    EBPFMapLookupElem = EBPFTestMapLookupElem;
+}
+
+static void EBPFTestMapCleanup(void)
+{
+    EBPFMapGetNextKey = bpf_map_get_next_key;
+    EBPFMapLookupElem = bpf_map_lookup_elem;
+}
+
+/* read a chunk of at most max entries, return the keys read as digits */
+static int EBPFTestChunk(struct bpf_map_item *item, uint32_t max, uint32_t *read)
+{
+    const size_t skey = sizeof(struct flowv4_keys);
+    uint8_t keys[EBPF_TEST_MAP_SIZE * sizeof(struct flowv4_keys)];
+    struct pair values[EBPF_TEST_MAP_SIZE];
+    uint32_t count = max;
+    int ret = EBPFMapLookupChunk(item, skey, keys, (uint8_t *)values,
+            sizeof(struct pair), &count);
+    *read = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t k;
+        memcpy(&k, keys + i * skey, sizeof(k));
+        if (values[i].packets != k)
+            return -2;
+        *read = *read * 10 + k;
+    }
+    item->scan_running = (ret == 0);
+    return ret;
+}
+
+/** \test the scan continues from the last key of the previous chunk */
+static int EBPFTest01(void)
+{
+    struct bpf_map_item item;
+    uint32_t read;
+    EBPFTestMapSetup(&item);
+
+    FAIL_IF_NOT(EBPFTestChunk(&item, 2, &read) == 0);
+    FAIL_IF_NOT(read == 12);
+    FAIL_IF_NOT(EBPFTestChunk(&item, 2, &read) == 0);
+    FAIL_IF_NOT(read == 34);
+    FAIL_IF_NOT(EBPFTestChunk(&item, 2, &read) == -1);
+    FAIL_IF_NOT(read == 5);
+
+    /* next pass starts over */
+    FAIL_IF_NOT(EBPFTestChunk(&item, 5, &read) == 0);
+    FAIL_IF_NOT(read == 12345);
+
+    EBPFTestMapCleanup();
+    PASS;
+}
+
+/** \test the pass ends if the position was deleted between chunks */
+static int EBPFTest02(void)
+{
+    struct bpf_map_item item;
+    uint32_t read;
+    EBPFTestMapSetup(&item);
+
+    FAIL_IF_NOT(EBPFTestChunk(&item, 2, &read) == 0);
+    FAIL_IF_NOT(read == 12);
+    ebpf_test_map.present[1] = false;
+    FAIL_IF_NOT(EBPFTestChunk(&item, 2, &read) == -1);
+    FAIL_IF_NOT(read == 0);
+
+    /* other entries can go */
+    FAIL_IF_NOT(EBPFTestChunk(&item, 2, &read) == 0);
+    FAIL_IF_NOT(read == 13);
+    ebpf_test_map.present[3] = false;
+    FAIL_IF_NOT(EBPFTestChunk(&item, 2, &read) == -1);
+    FAIL_IF_NOT(read == 5);
+
+    EBPFTestMapCleanup();
+    PASS;
+}
+
+/** \test the pass ends if the entry of the key read is deleted */
+static int EBPFTest03(void)
+{
+    struct bpf_map_item item;
+    uint32_t read;
+    EBPFTestMapSetup(&item);
+
+    ebpf_test_map.vanish = 3;
+    FAIL_IF_NOT(EBPFTestChunk(&item, 5, &read) == -1);
+    FAIL_IF_NOT(read == 12);
+    FAIL_IF_NOT(EBPFTestChunk(&item, 5, &read) == -1);
+    FAIL_IF_NOT(read == 1245);
+
+    EBPFTestMapCleanup();
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void EBPFRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("EBPFTest01", EBPFTest01);
+    UtRegisterTest("EBPFTest02", EBPFTest02);
+    UtRegisterTest("EBPFTest03", EBPFTest03);
+#endif
+}
+
 #endif
@@ -82,6 +82,7 @@ int EBPFCheckBypassedFlowTimeout(ThreadVars *th_v, struct flows_stats *bypasssta
                                         struct timespec *curtime,
                                         void *data);
 int EBPFCheckBypassedFlowCreate(ThreadVars *th_v, struct timespec *curtime, void *data);
+int EBPFRegisterBypassedFlowScan(const char *iface, struct ebpf_timeout_config *config);
 
 void EBPFRegisterExtension(void);
 
@@ -95,6 +96,14 @@ void EBPFBypassFree(void *data);
 
 void EBPFDeleteKey(int fd, void *key);
 
+int EBPFInsertHalfFlow(int mapd, void *key, unsigned int nr_cpus);
+int EBPFSetFlowStorage(Packet *p, int map_fd, void *key0, void *key1,
+                       int family, unsigned int nr_cpus);
+int EBPFXDPBypassFlow(Packet *p, int v4_map_fd, int v6_map_fd,
+                      unsigned int nr_cpus);
+
+void EBPFRegisterTests(void);
+
 #ifdef BUILD_UNIX_SOCKET
 TmEcode EBPFGetBypassedStats(json_t *cmd, json_t *answer, void *data);
 #endif
@@ -46,6 +46,9 @@ const char * SCErrorToString(SCError err)
         CASE_CODE (SC_ERR_PCRE_MATCH);
         CASE_CODE (SC_ERR_PCRE_GET_SUBSTRING);
         CASE_CODE (SC_ERR_PCRE_COPY_SUBSTRING);
+        CASE_CODE (SC_ERR_NO_AF_XDP);
+        CASE_CODE (SC_ERR_AF_XDP_CREATE);
+        CASE_CODE (SC_ERR_AF_XDP_READ);
         CASE_CODE (SC_ERR_PCRE_COMPILE);
         CASE_CODE (SC_ERR_PCRE_STUDY);
         CASE_CODE (SC_ERR_PCRE_PARSE);
@@ -356,6 +356,9 @@ typedef enum {
     SC_WARN_ANOMALY_CONFIG,
     SC_WARN_ALERT_CONFIG,
     SC_ERR_PCRE_COPY_SUBSTRING,
+    SC_ERR_NO_AF_XDP,
+    SC_ERR_AF_XDP_CREATE,
+    SC_ERR_AF_XDP_READ,
 
     SC_ERR_MAX
 } SCError;
@@ -0,0 +1,632 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Offload of file data hashing to helper threads.
+ *
+ * The md5/sha1/sha256 updates of file data are queued to a small pool of
+ * helper threads. All data of a file goes to the same helper, so the
+ * updates are done in order. Before a hash is finalized or destroyed
+ * FileHashWait() waits for the file's queued updates, so the hashes are
+ * complete by the time the file is closed and the file keywords and
+ * loggers see the same results as with inline hashing.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "counters.h"
+#include "conf.h"
+#include "util-misc.h"
+#include "util-debug.h"
+#include "util-privs.h"
+#include "util-file.h"
+#include "util-file-offload.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_NSS
+
+#define FILE_OFFLOAD_THREADS_MAX        64
+
+#define FILE_OFFLOAD_DEFAULT_THREADS    2
+#define FILE_OFFLOAD_DEFAULT_MIN_CHUNK  4096
+#define FILE_OFFLOAD_DEFAULT_MAX_QUEUED (16 * 1024 * 1024)
+
+static const char *thread_name_file_offload = "FO";
+
+typedef struct FileHashJob_ {
+    struct FileHashJob_ *next;
+    File *ff;
+    HASHContext *md5_ctx;
+    HASHContext *sha1_ctx;
+    HASHContext *sha256_ctx;
+    struct timeval queued;
+    uint32_t len;
+    uint8_t data[];
+} FileHashJob;
+
+typedef struct FileOffloadQueue_ {
+    SCMutex m;
+    SCCondT cond;           /**< signalled when jobs are added */
+    SCCondT done_cond;      /**< signalled when jobs are done */
+    FileHashJob *top;
+    FileHashJob *bot;
+    ThreadVars *tv;
+    int running;
+
+    uint64_t queued_bytes;
+
+    /* stats, protected by m */
+    uint64_t depth;
+    uint64_t depth_max;
+    uint64_t jobs;
+    uint64_t inline_cnt;
+    uint64_t latency_us;
+    uint64_t latency_max_us;
+} FileOffloadQueue;
+
+static FileOffloadQueue *file_offload_queues = NULL;
+static uint32_t file_offload_threads = 0;
+static uint32_t file_offload_min_chunk = FILE_OFFLOAD_DEFAULT_MIN_CHUNK;
+static uint64_t file_offload_max_queued = FILE_OFFLOAD_DEFAULT_MAX_QUEUED;
+
+static inline FileOffloadQueue *FileOffloadGetQueue(const File *ff)
+{
+    return &file_offload_queues[((uintptr_t)ff / sizeof(File)) % file_offload_threads];
+}
+
+static void FileHashUpdateInline(File *ff, const uint8_t *data, uint32_t data_len)
+{
+    if (ff->md5_ctx)
+        HASH_Update(ff->md5_ctx, data, data_len);
+    if (ff->sha1_ctx)
+        HASH_Update(ff->sha1_ctx, data, data_len);
+    if (ff->sha256_ctx)
+        HASH_Update(ff->sha256_ctx, data, data_len);
+}
+
+/**
+ *  \brief Update the file hashes with a chunk of data
+ *
+ *  Chunks smaller than file-offload.min-chunk-size are hashed inline
+ *  unless the file still has queued chunks. If the queue is full, the
+ *  worker waits for the file's queued chunks and hashes inline.
+ */
+void FileHashUpdate(File *ff, const uint8_t *data, uint32_t data_len)
+{
+    if (ff->md5_ctx == NULL && ff->sha1_ctx == NULL && ff->sha256_ctx == NULL)
+        return;
+
+    if (file_offload_threads == 0) {
+        FileHashUpdateInline(ff, data, data_len);
+        return;
+    }
+
+    FileOffloadQueue *q = FileOffloadGetQueue(ff);
+    SCMutexLock(&q->m);
+    if (!q->running || (ff->hash_jobs == 0 && data_len < file_offload_min_chunk)) {
+        SCMutexUnlock(&q->m);
+        FileHashUpdateInline(ff, data, data_len);
+        return;
+    }
+    if (q->queued_bytes + data_len > file_offload_max_queued) {
+        while (ff->hash_jobs > 0) {
+            SCCondWait(&q->done_cond, &q->m);
+        }
+        q->inline_cnt++;
+        SCMutexUnlock(&q->m);
+        FileHashUpdateInline(ff, data, data_len);
+        return;
+    }
+    SCMutexUnlock(&q->m);
+
+    FileHashJob *job = SCMalloc(sizeof(*job) + data_len);
+    if (unlikely(job == NULL)) {
+        FileHashWait(ff);
+        FileHashUpdateInline(ff, data, data_len);
+        return;
+    }
+    job->next = NULL;
+    job->ff = ff;
+    job->md5_ctx = ff->md5_ctx;
+    job->sha1_ctx = ff->sha1_ctx;
+    job->sha256_ctx = ff->sha256_ctx;
+    job->len = data_len;
+    memcpy(job->data, data, data_len);
+    gettimeofday(&job->queued, NULL);
+
+    SCMutexLock(&q->m);
+    if (!q->running) {
+        /* helper stopped in the mean time, its queue is drained */
+        SCMutexUnlock(&q->m);
+        FileHashUpdateInline(ff, data, data_len);
+        SCFree(job);
+        return;
+    }
+    if (q->bot == NULL) {
+        q->top = q->bot = job;
+    } else {
+        q->bot->next = job;
+        q->bot = job;
+    }
+    ff->hash_jobs++;
+    q->queued_bytes += data_len;
+    q->depth++;
+    if (q->depth > q->depth_max)
+        q->depth_max = q->depth;
+    SCCondSignal(&q->cond);
+    SCMutexUnlock(&q->m);
+}
+
+/**
+ *  \brief Wait until all queued hash updates of the file are done
+ *
+ *  Needs to be called before the file's hash contexts are finalized
+ *  or destroyed. hash_jobs is only read under the queue lock, which
+ *  also makes the helper's updates of the hash contexts visible.
+ */
+void FileHashWait(File *ff)
+{
+    if (file_offload_threads == 0)
+        return;
+
+    FileOffloadQueue *q = FileOffloadGetQueue(ff);
+    SCMutexLock(&q->m);
+    while (ff->hash_jobs > 0) {
+        SCCondWait(&q->done_cond, &q->m);
+    }
+    SCMutexUnlock(&q->m);
+}
+
+static void FileOffloadRunJob(FileOffloadQueue *q, FileHashJob *job)
+{
+    if (job->md5_ctx)
+        HASH_Update(job->md5_ctx, job->data, job->len);
+    if (job->sha1_ctx)
+        HASH_Update(job->sha1_ctx, job->data, job->len);
+    if (job->sha256_ctx)
+        HASH_Update(job->sha256_ctx, job->data, job->len);
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t usec = 0;
+    if (timercmp(&now, &job->queued, >)) {
+        usec = (uint64_t)(now.tv_sec - job->queued.tv_sec) * 1000000 +
+            (now.tv_usec - job->queued.tv_usec);
+    }
+
+    SCMutexLock(&q->m);
+    job->ff->hash_jobs--;
+    q->queued_bytes -= job->len;
+    q->depth--;
+    q->jobs++;
+    q->latency_us += usec;
+    if (usec > q->latency_max_us)
+        q->latency_max_us = usec;
+    pthread_cond_broadcast(&q->done_cond);
+    SCMutexUnlock(&q->m);
+
+    SCFree(job);
+}
+
+static FileHashJob *FileOffloadDequeue(FileOffloadQueue *q)
+{
+    FileHashJob *job = q->top;
+    if (job != NULL) {
+        q->top = job->next;
+        if (q->top == NULL)
+            q->bot = NULL;
+    }
+    return job;
+}
+
+static void FileOffloadShutdownHandler(ThreadVars *tv)
+{
+    for (uint32_t i = 0; i < file_offload_threads; i++) {
+        FileOffloadQueue *q = &file_offload_queues[i];
+        if (q->tv == tv) {
+            SCMutexLock(&q->m);
+            SCCondSignal(&q->cond);
+            SCMutexUnlock(&q->m);
+        }
+    }
+}
+
+static void *FileOffloadThread(void *arg)
+{
+    ThreadVars *tv = (ThreadVars *)arg;
+    FileOffloadQueue *q = NULL;
+
+    if (SCSetThreadName(tv->name) < 0) {
+        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
+    }
+    if (tv->thread_setup_flags != 0)
+        TmThreadSetupOptions(tv);
+
+    tv->cap_flags = 0;
+    SCDropCaps(tv);
+
+    for (uint32_t i = 0; i < file_offload_threads; i++) {
+        if (file_offload_queues[i].tv == tv) {
+            q = &file_offload_queues[i];
+            break;
+        }
+    }
+    BUG_ON(q == NULL);
+
+    TmThreadsSetFlag(tv, THV_INIT_DONE);
+    while (1) {
+        if (TmThreadsCheckFlag(tv, THV_PAUSE)) {
+            TmThreadsSetFlag(tv, THV_PAUSED);
+            TmThreadTestThreadUnPaused(tv);
+            TmThreadsUnsetFlag(tv, THV_PAUSED);
+        }
+
+        SCMutexLock(&q->m);
+        FileHashJob *job = FileOffloadDequeue(q);
+        while (job == NULL && !TmThreadsCheckFlag(tv, THV_KILL)) {
+            SCCondWait(&q->cond, &q->m);
+            job = FileOffloadDequeue(q);
+        }
+        if (job == NULL) {
+            /* killed and drained: from now on the workers hash inline */
+            q->running = 0;
+            pthread_cond_broadcast(&q->done_cond);
+            SCMutexUnlock(&q->m);
+            break;
+        }
+        SCMutexUnlock(&q->m);
+
+        FileOffloadRunJob(q, job);
+    }
+
+    TmThreadsSetFlag(tv, THV_RUNNING_DONE);
+    TmThreadWaitForFlag(tv, THV_DEINIT);
+    TmThreadsSetFlag(tv, THV_CLOSED);
+    return NULL;
+}
+
+#define FILE_OFFLOAD_COUNTER(name, expr)                    \
+static uint64_t FileOffloadCounter##name(void)              \
+{                                                           \
+    uint64_t v = 0;                                         \
+    for (uint32_t i = 0; i < file_offload_threads; i++) {   \
+        FileOffloadQueue *q = &file_offload_queues[i];      \
+        SCMutexLock(&q->m);                                 \
+        expr;                                               \
+        SCMutexUnlock(&q->m);                               \
+    }                                                       \
+    return v;                                               \
+}
+
+FILE_OFFLOAD_COUNTER(QueueDepth, v += q->depth)
+FILE_OFFLOAD_COUNTER(QueueDepthMax, v = MAX(v, q->depth_max))
+FILE_OFFLOAD_COUNTER(Jobs, v += q->jobs)
+FILE_OFFLOAD_COUNTER(Inline, v += q->inline_cnt)
+FILE_OFFLOAD_COUNTER(LatencyMax, v = MAX(v, q->latency_max_us))
+
+static uint64_t FileOffloadCounterLatencyAvg(void)
+{
+    uint64_t jobs = 0, usec = 0;
+    for (uint32_t i = 0; i < file_offload_threads; i++) {
+        FileOffloadQueue *q = &file_offload_queues[i];
+        SCMutexLock(&q->m);
+        jobs += q->jobs;
+        usec += q->latency_us;
+        SCMutexUnlock(&q->m);
+    }
+    return jobs ? usec / jobs : 0;
+}
+
+static int FileOffloadParseConfig(void)
+{
+    int enabled = 0;
+    if (ConfGetBool("file-offload.enabled", &enabled) != 1 || !enabled)
+        return 0;
+
+    intmax_t threads = FILE_OFFLOAD_DEFAULT_THREADS;
+    if (ConfGetInt("file-offload.threads", &threads) == 1) {
+        if (threads < 1 || threads > FILE_OFFLOAD_THREADS_MAX) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "file-offload.threads "
+                    "must be between 1 and %d, using %d",
+                    FILE_OFFLOAD_THREADS_MAX, FILE_OFFLOAD_DEFAULT_THREADS);
+            threads = FILE_OFFLOAD_DEFAULT_THREADS;
+        }
+    }
+
+    const char *str = NULL;
+    if (ConfGet("file-offload.min-chunk-size", &str) == 1 && str != NULL) {
+        if (ParseSizeStringU32(str, &file_offload_min_chunk) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                    "file-offload.min-chunk-size from conf file - %s", str);
+            return 0;
+        }
+    }
+    if (ConfGet("file-offload.max-queued", &str) == 1 && str != NULL) {
+        if (ParseSizeStringU64(str, &file_offload_max_queued) < 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                    "file-offload.max-queued from conf file - %s", str);
+            return 0;
+        }
+    }
+    return (int)threads;
+}
+
+/** \brief spawn the file hash helper threads if enabled in the config */
+void FileOffloadThreadSpawn(void)
+{
+    int threads = FileOffloadParseConfig();
+    if (threads == 0)
+        return;
+
+    file_offload_queues = SCCalloc(threads, sizeof(FileOffloadQueue));
+    if (file_offload_queues == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc file offload queues");
+        return;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        FileOffloadQueue *q = &file_offload_queues[i];
+        SCMutexInit(&q->m, NULL);
+        SCCondInit(&q->cond, NULL);
+        SCCondInit(&q->done_cond, NULL);
+
+        char name[TM_THREAD_NAME_MAX];
+        snprintf(name, sizeof(name), "%s#%02d", thread_name_file_offload, i+1);
+
+        q->tv = TmThreadCreateMgmtThread(name, FileOffloadThread, 1);
+        if (q->tv == NULL) {
+            FatalError(SC_ERR_THREAD_CREATE, "TmThreadCreateMgmtThread failed");
+        }
+        q->tv->InShutdownHandler = FileOffloadShutdownHandler;
+        q->running = 1;
+    }
+    /* queues are set up, make them visible to the workers */
+    file_offload_threads = (uint32_t)threads;
+
+    for (int i = 0; i < threads; i++) {
+        if (TmThreadSpawn(file_offload_queues[i].tv) != 0) {
+            FatalError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed for "
+                    "file offload thread");
+        }
+    }
+
+    StatsRegisterGlobalCounter("file_offload.queue_depth",
+            FileOffloadCounterQueueDepth);
+    StatsRegisterGlobalCounter("file_offload.queue_depth_max",
+            FileOffloadCounterQueueDepthMax);
+    StatsRegisterGlobalCounter("file_offload.jobs",
+            FileOffloadCounterJobs);
+    StatsRegisterGlobalCounter("file_offload.inline",
+            FileOffloadCounterInline);
+    StatsRegisterGlobalCounter("file_offload.latency_avg_us",
+            FileOffloadCounterLatencyAvg);
+    StatsRegisterGlobalCounter("file_offload.latency_max_us",
+            FileOffloadCounterLatencyMax);
+
+    SCLogConfig("file hashing offloaded to %d threads, min chunk size %u, "
+            "max queued %"PRIu64, threads, file_offload_min_chunk,
+            file_offload_max_queued);
+}
+
+#ifdef UNITTESTS
+/** \internal
+ *  \brief helper thread of the tests: runs jobs until the queue is
+ *         stopped and drained */
+static void *FileOffloadTestThread(void *arg)
+{
+    FileOffloadQueue *q = (FileOffloadQueue *)arg;
+
+    SCMutexLock(&q->m);
+    while (1) {
+        FileHashJob *job = FileOffloadDequeue(q);
+        if (job == NULL) {
+            if (!q->running)
+                break;
+            SCCondWait(&q->cond, &q->m);
+            continue;
+        }
+        SCMutexUnlock(&q->m);
+        FileOffloadRunJob(q, job);
+        SCMutexLock(&q->m);
+    }
+    SCMutexUnlock(&q->m);
+    return NULL;
+}
+
+static pthread_t file_offload_test_thread;
+
+static int FileOffloadTestSetup(uint32_t min_chunk, uint64_t max_queued)
+{
+    file_offload_queues = SCCalloc(1, sizeof(FileOffloadQueue));
+    if (file_offload_queues == NULL)
+        return 0;
+    FileOffloadQueue *q = &file_offload_queues[0];
+    SCMutexInit(&q->m, NULL);
+    SCCondInit(&q->cond, NULL);
+    SCCondInit(&q->done_cond, NULL);
+    q->running = 1;
+    file_offload_min_chunk = min_chunk;
+    file_offload_max_queued = max_queued;
+    file_offload_threads = 1;
+
+    if (pthread_create(&file_offload_test_thread, NULL,
+                FileOffloadTestThread, q) != 0) {
+        file_offload_threads = 0;
+        SCFree(file_offload_queues);
+        file_offload_queues = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+static void FileOffloadTestTeardown(void)
+{
+    FileOffloadQueue *q = &file_offload_queues[0];
+    SCMutexLock(&q->m);
+    q->running = 0;
+    SCCondSignal(&q->cond);
+    SCMutexUnlock(&q->m);
+    pthread_join(file_offload_test_thread, NULL);
+
+    SCMutexDestroy(&q->m);
+    SCCondDestroy(&q->cond);
+    SCCondDestroy(&q->done_cond);
+    SCFree(file_offload_queues);
+    file_offload_queues = NULL;
+    file_offload_threads = 0;
+    file_offload_min_chunk = FILE_OFFLOAD_DEFAULT_MIN_CHUNK;
+    file_offload_max_queued = FILE_OFFLOAD_DEFAULT_MAX_QUEUED;
+}
+
+static void FileOffloadTestFileInit(File *ff)
+{
+    memset(ff, 0, sizeof(*ff));
+    ff->md5_ctx = HASH_Create(HASH_AlgMD5);
+    HASH_Begin(ff->md5_ctx);
+    ff->sha1_ctx = HASH_Create(HASH_AlgSHA1);
+    HASH_Begin(ff->sha1_ctx);
+    ff->sha256_ctx = HASH_Create(HASH_AlgSHA256);
+    HASH_Begin(ff->sha256_ctx);
+}
+
+static void FileOffloadTestFileEnd(File *ff)
+{
+    unsigned int len = 0;
+    HASH_End(ff->md5_ctx, ff->md5, &len, sizeof(ff->md5));
+    HASH_End(ff->sha1_ctx, ff->sha1, &len, sizeof(ff->sha1));
+    HASH_End(ff->sha256_ctx, ff->sha256, &len, sizeof(ff->sha256));
+    HASH_Destroy(ff->md5_ctx);
+    HASH_Destroy(ff->sha1_ctx);
+    HASH_Destroy(ff->sha256_ctx);
+    ff->md5_ctx = ff->sha1_ctx = ff->sha256_ctx = NULL;
+}
+
+/** \internal
+ *  \brief hash the same data through the helper and inline
+ *
+ *  Large and small chunks are mixed, so small chunks that follow queued
+ *  ones have to be queued as well to keep the order.
+ */
+static int FileOffloadTestCompare(uint64_t max_queued, uint64_t *inline_cnt,
+        uint64_t *jobs)
+{
+    static uint8_t buf[96 * 1024];
+    static const uint32_t chunks[] = { 100, 8192, 100, 16384, 5000, 7, 32768,
+        4095, 4096, 1 };
+    File offloaded, ref;
+    uint32_t i, offset;
+    int result = 0;
+
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = (uint8_t)(i * 7 + (i >> 8));
+
+    if (FileOffloadTestSetup(4096, max_queued) == 0)
+        return 0;
+    FileOffloadTestFileInit(&offloaded);
+    FileOffloadTestFileInit(&ref);
+
+    for (i = 0, offset = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        FileHashUpdate(&offloaded, buf + offset, chunks[i]);
+        FileHashUpdateInline(&ref, buf + offset, chunks[i]);
+        offset += chunks[i];
+    }
+    FileHashWait(&offloaded);
+
+    FileOffloadQueue *q = &file_offload_queues[0];
+    SCMutexLock(&q->m);
+    *inline_cnt = q->inline_cnt;
+    *jobs = q->jobs;
+    if (offloaded.hash_jobs == 0 && q->depth == 0 && q->queued_bytes == 0)
+        result = 1;
+    SCMutexUnlock(&q->m);
+
+    FileOffloadTestFileEnd(&offloaded);
+    FileOffloadTestFileEnd(&ref);
+    FileOffloadTestTeardown();
+
+    if (memcmp(offloaded.md5, ref.md5, sizeof(ref.md5)) != 0 ||
+        memcmp(offloaded.sha1, ref.sha1, sizeof(ref.sha1)) != 0 ||
+        memcmp(offloaded.sha256, ref.sha256, sizeof(ref.sha256)) != 0)
+        result = 0;
+    return result;
+}
+
+/** \test hashes through the helper match inline hashing */
+static int FileOffloadTest01(void)
+{
+    uint64_t inline_cnt = 0, jobs = 0;
+    FAIL_IF_NOT(FileOffloadTestCompare(FILE_OFFLOAD_DEFAULT_MAX_QUEUED,
+                &inline_cnt, &jobs));
+    /* all chunks of at least min-chunk-size are queued. Small ones are
+     * queued too if the helper didn't finish the file's jobs yet */
+    FAIL_IF_NOT(jobs >= 5);
+    FAIL_IF_NOT(inline_cnt == 0);
+    PASS;
+}
+
+/** \test full queue: wait for the file's jobs and hash inline */
+static int FileOffloadTest02(void)
+{
+    uint64_t inline_cnt = 0, jobs = 0;
+    FAIL_IF_NOT(FileOffloadTestCompare(8192, &inline_cnt, &jobs));
+    FAIL_IF_NOT(inline_cnt > 0);
+    PASS;
+}
+
+/** \test small chunks of a file without queued jobs are hashed inline */
+static int FileOffloadTest03(void)
+{
+    File ff;
+    uint8_t buf[64];
+    memset(buf, 'a', sizeof(buf));
+
+    FAIL_IF_NOT(FileOffloadTestSetup(4096, FILE_OFFLOAD_DEFAULT_MAX_QUEUED));
+    FileOffloadTestFileInit(&ff);
+    FileHashUpdate(&ff, buf, sizeof(buf));
+    const uint32_t hash_jobs = ff.hash_jobs;
+    const uint64_t jobs = file_offload_queues[0].jobs;
+    FileHashWait(&ff);
+    FileOffloadTestFileEnd(&ff);
+    FileOffloadTestTeardown();
+
+    FAIL_IF_NOT(hash_jobs == 0);
+    FAIL_IF_NOT(jobs == 0);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+#else /* HAVE_NSS */
+
+void FileOffloadThreadSpawn(void)
+{
+}
+
+#endif /* HAVE_NSS */
+
+void FileOffloadRegisterTests(void)
+{
+#if defined(HAVE_NSS) && defined(UNITTESTS)
+    UtRegisterTest("FileOffloadTest01", FileOffloadTest01);
+    UtRegisterTest("FileOffloadTest02", FileOffloadTest02);
+    UtRegisterTest("FileOffloadTest03", FileOffloadTest03);
+#endif
+}
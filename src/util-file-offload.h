@@ -0,0 +1,37 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Offload of file data hashing to helper threads.
+ */
+
+#ifndef __UTIL_FILE_OFFLOAD_H__
+#define __UTIL_FILE_OFFLOAD_H__
+
+#include "util-file.h"
+
+void FileOffloadThreadSpawn(void);
+void FileOffloadRegisterTests(void);
+
+#ifdef HAVE_NSS
+void FileHashUpdate(File *ff, const uint8_t *data, uint32_t data_len);
+void FileHashWait(File *ff);
+#endif
+
+#endif /* __UTIL_FILE_OFFLOAD_H__ */
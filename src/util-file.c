@@ -36,6 +36,7 @@
 #include "util-print.h"
 #include "app-layer-parser.h"
 #include "util-validate.h"
+#include "util-file-offload.h"
 
 extern int g_detect_disabled;
 
@@ -514,6 +515,7 @@ static void FileFree(File *ff)
     }
 
 #ifdef HAVE_NSS
+    FileHashWait(ff);
     if (ff->md5_ctx)
         HASH_Destroy(ff->md5_ctx);
     if (ff->sha1_ctx)
@@ -600,15 +602,7 @@ static int AppendData(File *file, const uint8_t *data, uint32_t data_len)
     }
 
 #ifdef HAVE_NSS
-    if (file->md5_ctx) {
-        HASH_Update(file->md5_ctx, data, data_len);
-    }
-    if (file->sha1_ctx) {
-        HASH_Update(file->sha1_ctx, data, data_len);
-    }
-    if (file->sha256_ctx) {
-        HASH_Update(file->sha256_ctx, data, data_len);
-    }
+    FileHashUpdate(file, data, data_len);
 #endif
     SCReturnInt(0);
 }
@@ -643,23 +637,11 @@ static int FileAppendDataDo(File *ff, const uint8_t *data, uint32_t data_len)
     if ((ff->flags & FILE_USE_DETECT) == 0 &&
             FileStoreNoStoreCheck(ff) == 1) {
 #ifdef HAVE_NSS
-        int hash_done = 0;
         /* no storage but forced hashing */
-        if (ff->md5_ctx) {
-            HASH_Update(ff->md5_ctx, data, data_len);
-            hash_done = 1;
-        }
-        if (ff->sha1_ctx) {
-            HASH_Update(ff->sha1_ctx, data, data_len);
-            hash_done = 1;
-        }
-        if (ff->sha256_ctx) {
-            HASH_Update(ff->sha256_ctx, data, data_len);
-            hash_done = 1;
-        }
-
-        if (hash_done)
+        if (ff->md5_ctx || ff->sha1_ctx || ff->sha256_ctx) {
+            FileHashUpdate(ff, data, data_len);
             SCReturnInt(0);
+        }
 #endif
         if (g_file_force_tracking || (!(ff->flags & FILE_NOTRACK)))
             SCReturnInt(0);
@@ -933,12 +915,7 @@ int FileCloseFilePtr(File *ff, const uint8_t *data,
         if (ff->flags & FILE_NOSTORE) {
 #ifdef HAVE_NSS
             /* no storage but hashing */
-            if (ff->md5_ctx)
-                HASH_Update(ff->md5_ctx, data, data_len);
-            if (ff->sha1_ctx)
-                HASH_Update(ff->sha1_ctx, data, data_len);
-            if (ff->sha256_ctx)
-                HASH_Update(ff->sha256_ctx, data, data_len);
+            FileHashUpdate(ff, data, data_len);
 #endif
         } else {
             if (AppendData(ff, data, data_len) != 0) {
@@ -967,6 +944,7 @@ int FileCloseFilePtr(File *ff, const uint8_t *data,
         SCLogDebug("flowfile state transitioned to FILE_STATE_CLOSED");
 
 #ifdef HAVE_NSS
+        FileHashWait(ff);
         if (ff->md5_ctx) {
             unsigned int len = 0;
             HASH_End(ff->md5_ctx, ff->md5, &len, sizeof(ff->md5));
@@ -1124,6 +1102,7 @@ void FileDisableMd5(Flow *f, uint8_t direction)
 #ifdef HAVE_NSS
             /* destroy any ctx we may have so far */
             if (ptr->md5_ctx != NULL) {
+                FileHashWait(ptr);
                 HASH_Destroy(ptr->md5_ctx);
                 ptr->md5_ctx = NULL;
             }
@@ -1163,6 +1142,7 @@ void FileDisableSha1(Flow *f, uint8_t direction)
 #ifdef HAVE_NSS
             /* destroy any ctx we may have so far */
             if (ptr->sha1_ctx != NULL) {
+                FileHashWait(ptr);
                 HASH_Destroy(ptr->sha1_ctx);
                 ptr->sha1_ctx = NULL;
             }
@@ -1202,6 +1182,7 @@ void FileDisableSha256(Flow *f, uint8_t direction)
 #ifdef HAVE_NSS
             /* destroy any ctx we may have so far */
             if (ptr->sha256_ctx != NULL) {
+                FileHashWait(ptr);
                 HASH_Destroy(ptr->sha256_ctx);
                 ptr->sha256_ctx = NULL;
             }
@@ -1372,6 +1353,7 @@ void FileTruncateAllOpenFiles(FileContainer *fc)
 static void FileEndSha256(File *ff)
 {
     if (!(ff->flags & FILE_SHA256) && ff->sha256_ctx) {
+        FileHashWait(ff);
         unsigned int len = 0;
         HASH_End(ff->sha256_ctx, ff->sha256, &len, sizeof(ff->sha256));
         ff->flags |= FILE_SHA256;
@@ -82,6 +82,8 @@ typedef struct File_ {
     uint8_t sha1[SHA1_LENGTH];
     HASHContext *sha256_ctx;
     uint8_t sha256[SHA256_LENGTH];
+    uint32_t hash_jobs;             /**< hash updates queued to the file
+                                         offload threads */
 #endif
     uint64_t content_inspected;     /**< used in pruning if FILE_USE_DETECT
                                      *   flag is set */
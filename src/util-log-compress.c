@@ -0,0 +1,494 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * gzip compressed regular file output.
+ *
+ * Writers append their records to a buffer and return. A writer thread
+ * per output picks the buffer up, compresses it and writes it to the
+ * file, ending each batch with a sync flush so that everything up to
+ * the last batch can be decompressed from a file that is still being
+ * written. A batch is taken after flush-records records or
+ * flush-interval seconds. If the writer falls behind and the buffer is
+ * full, writers wait for it instead of dropping records.
+ *
+ * On rotation (HUP or rotate-interval) the gzip member is finished
+ * before the file is closed, and a new one is started in the new file.
+ * If the file is only reopened, the new member is appended to the old
+ * ones, which gzip tools read as one stream.
+ */
+
+#include "suricata-common.h"
+#include "util-log-compress.h"
+#include "util-logopenfile.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "counters.h"
+#include "util-misc.h"
+#include "util-privs.h"
+#include "util-time.h"
+#include "util-unittest.h"
+
+#define LOG_COMPRESS_DEFAULT_SIZE           (8 * 1024 * 1024)
+#define LOG_COMPRESS_DEFAULT_LEVEL          6
+#define LOG_COMPRESS_DEFAULT_FLUSH_RECORDS  1000
+#define LOG_COMPRESS_DEFAULT_FLUSH_INTERVAL 1
+#define LOG_COMPRESS_INITIAL_SIZE           (64 * 1024)
+#define LOG_COMPRESS_CHUNK                  (64 * 1024)
+
+static const char *thread_name_log_compress = "LogCompress";
+
+/* compressed outputs, set up at config time */
+static SCMutex log_compress_lock = SCMUTEX_INITIALIZER;
+static LogCompressCtx *log_compress_ctxs = NULL;
+
+/**
+ * \brief deflate data and write the output to the file
+ *
+ * Must be called with the output's fp_mutex held.
+ *
+ * \param flush Z_NO_FLUSH, Z_SYNC_FLUSH or Z_FINISH
+ * \param written incremented by the number of bytes written
+ * \retval 0 on success, -1 on error
+ */
+static int LogCompressDeflate(LogCompressCtx *c, const char *data,
+        uint32_t len, int flush, uint64_t *written)
+{
+    FILE *fp = c->log_ctx->fp;
+    if (fp == NULL)
+        return -1;
+
+    if (!c->stream_open) {
+        if (deflateReset(&c->zs) != Z_OK)
+            return -1;
+        c->stream_open = true;
+    }
+
+    c->zs.next_in = (Bytef *)data;
+    c->zs.avail_in = len;
+    clearerr(fp);
+    do {
+        c->zs.next_out = c->zbuf;
+        c->zs.avail_out = LOG_COMPRESS_CHUNK;
+        if (deflate(&c->zs, flush) == Z_STREAM_ERROR) {
+            c->stream_open = false;
+            return -1;
+        }
+        const size_t have = LOG_COMPRESS_CHUNK - c->zs.avail_out;
+        if (have > 0) {
+            if (fwrite(c->zbuf, have, 1, fp) != 1) {
+                SCLogWarning(SC_ERR_FWRITE, "Write error on compressed log "
+                        "file \"%s\": %s", c->log_ctx->filename, strerror(errno));
+                c->stream_open = false;
+                return -1;
+            }
+            *written += have;
+        }
+    } while (c->zs.avail_out == 0);
+
+    if (flush == Z_FINISH)
+        c->stream_open = false;
+    return 0;
+}
+
+/** \brief compress a batch of records and flush it, fp_mutex held */
+static void LogCompressWriteBatch(LogCompressCtx *c, const char *data,
+        uint32_t len)
+{
+    LogFileCtx *log_ctx = c->log_ctx;
+    uint64_t written = 0;
+
+    SCLogFileCheckRotation(log_ctx);
+    if (LogCompressDeflate(c, data, len, Z_SYNC_FLUSH, &written) == 0) {
+        fflush(log_ctx->fp);
+    }
+
+    SCCtrlMutexLock(&c->mutex);
+    c->bytes_in += len;
+    c->bytes_out += written;
+    c->flushes++;
+    SCCtrlMutexUnlock(&c->mutex);
+}
+
+/**
+ * \brief Write callback of compressed outputs
+ *
+ * Queues the record for the writer thread. Records are compressed
+ * inline when the writer isn't running (yet) or when a record is larger
+ * than the whole buffer.
+ */
+static int LogCompressWrite(const char *buffer, int buffer_len,
+        LogFileCtx *log_ctx)
+{
+    LogCompressCtx *c = log_ctx->compress;
+    const uint32_t len = (uint32_t)buffer_len;
+
+    SCCtrlMutexLock(&c->mutex);
+    while (c->running && len <= c->max_size && c->len + len > c->max_size) {
+        c->stalls++;
+        SCCtrlCondSignal(&c->cond);
+        SCCtrlCondWait(&c->space_cond, &c->mutex);
+    }
+    if (c->running && c->len + len > c->buf_size && len <= c->max_size) {
+        uint32_t size = c->buf_size;
+        while (size < c->len + len)
+            size = (size > c->max_size / 2) ? c->max_size : size * 2;
+        char *ptr = SCRealloc(c->buf, size);
+        if (ptr != NULL) {
+            c->buf = ptr;
+            c->buf_size = size;
+        }
+    }
+    if (!c->running || c->len + len > c->buf_size) {
+        SCCtrlMutexUnlock(&c->mutex);
+
+        SCMutexLock(&log_ctx->fp_mutex);
+        LogCompressWriteBatch(c, buffer, len);
+        SCMutexUnlock(&log_ctx->fp_mutex);
+        return 1;
+    }
+
+    memcpy(c->buf + c->len, buffer, len);
+    c->len += len;
+    if (++c->records == c->flush_records || c->len >= c->max_size / 2) {
+        SCCtrlCondSignal(&c->cond);
+    }
+    SCCtrlMutexUnlock(&c->mutex);
+    return 1;
+}
+
+/** \brief Close callback: finish the gzip member, then close the file */
+static void LogCompressClose(LogFileCtx *log_ctx)
+{
+    LogCompressCtx *c = log_ctx->compress;
+    if (log_ctx->fp == NULL)
+        return;
+
+    if (c->stream_open) {
+        uint64_t written = 0;
+        (void)LogCompressDeflate(c, NULL, 0, Z_FINISH, &written);
+        SCCtrlMutexLock(&c->mutex);
+        c->bytes_out += written;
+        SCCtrlMutexUnlock(&c->mutex);
+    }
+    fclose(log_ctx->fp);
+}
+
+/**
+ * \brief take the queued records for the writer
+ * \param wait wait for a batch to fill up or the flush interval to pass
+ * \retval records number of records taken, the data is in c->out
+ */
+static uint32_t LogCompressTake(LogCompressCtx *c, bool wait, uint32_t *len)
+{
+    if (wait && c->records < c->flush_records && c->len < c->max_size / 2) {
+        struct timeval tv;
+        struct timespec ts;
+        gettimeofday(&tv, NULL);
+        ts.tv_sec = tv.tv_sec + c->flush_interval;
+        ts.tv_nsec = tv.tv_usec * 1000;
+        SCCtrlCondTimedwait(&c->cond, &c->mutex, &ts);
+    }
+
+    char *out = c->buf;
+    uint32_t out_size = c->buf_size;
+    uint32_t records = c->records;
+    *len = c->len;
+    c->buf = c->out;
+    c->buf_size = c->out_size;
+    c->out = out;
+    c->out_size = out_size;
+    c->len = 0;
+    c->records = 0;
+    SCCtrlCondBroadcast(&c->space_cond);
+    return records;
+}
+
+/**
+ * \brief compress the queued records
+ * \param final stop queueing: write what is left, later records are
+ *        compressed inline
+ * \retval records number of records written
+ */
+static uint32_t LogCompressFlush(LogCompressCtx *c, bool final)
+{
+    LogFileCtx *log_ctx = c->log_ctx;
+    uint32_t records, len;
+
+    if (final) {
+        /* hold off inline writers until the last batch is out */
+        SCMutexLock(&log_ctx->fp_mutex);
+        SCCtrlMutexLock(&c->mutex);
+        c->running = 0;
+        records = LogCompressTake(c, false, &len);
+        SCCtrlMutexUnlock(&c->mutex);
+        if (len > 0) {
+            LogCompressWriteBatch(c, c->out, len);
+        }
+        SCMutexUnlock(&log_ctx->fp_mutex);
+        return records;
+    }
+
+    SCCtrlMutexLock(&c->mutex);
+    records = LogCompressTake(c, true, &len);
+    SCCtrlMutexUnlock(&c->mutex);
+    if (len > 0) {
+        SCMutexLock(&log_ctx->fp_mutex);
+        LogCompressWriteBatch(c, c->out, len);
+        SCMutexUnlock(&log_ctx->fp_mutex);
+    }
+    return records;
+}
+
+static LogCompressCtx *LogCompressNew(LogFileCtx *log_ctx, int level,
+        uint32_t flush_records, uint32_t flush_interval, uint32_t max_size)
+{
+    LogCompressCtx *c = SCCalloc(1, sizeof(*c));
+    if (unlikely(c == NULL))
+        return NULL;
+
+    c->buf_size = MIN(LOG_COMPRESS_INITIAL_SIZE, max_size);
+    c->buf = SCMalloc(c->buf_size);
+    c->out_size = c->buf_size;
+    c->out = SCMalloc(c->out_size);
+    c->zbuf = SCMalloc(LOG_COMPRESS_CHUNK);
+    if (c->buf == NULL || c->out == NULL || c->zbuf == NULL)
+        goto error;
+
+    /* windowBits 15 + 16: gzip header and trailer */
+    if (deflateInit2(&c->zs, level, Z_DEFLATED, 15 + 16, 8,
+                Z_DEFAULT_STRATEGY) != Z_OK)
+        goto error;
+
+    SCCtrlMutexInit(&c->mutex, NULL);
+    SCCtrlCondInit(&c->cond, NULL);
+    SCCtrlCondInit(&c->space_cond, NULL);
+    c->max_size = max_size;
+    c->flush_records = flush_records;
+    c->flush_interval = flush_interval;
+    c->log_ctx = log_ctx;
+
+    log_ctx->compress = c;
+    log_ctx->Write = LogCompressWrite;
+    log_ctx->Close = LogCompressClose;
+
+    SCMutexLock(&log_compress_lock);
+    c->next = log_compress_ctxs;
+    log_compress_ctxs = c;
+    SCMutexUnlock(&log_compress_lock);
+    return c;
+
+error:
+    SCFree(c->buf);
+    SCFree(c->out);
+    SCFree(c->zbuf);
+    SCFree(c);
+    return NULL;
+}
+
+/**
+ * \brief set up compression for a regular file output
+ *
+ * The file must be open already. The writer thread is started by
+ * LogCompressThreadSpawn.
+ *
+ * \param conf the output's "compression" node
+ */
+int LogCompressSetup(LogFileCtx *log_ctx, ConfNode *conf)
+{
+    intmax_t val = LOG_COMPRESS_DEFAULT_LEVEL;
+    if (ConfGetChildValueInt(conf, "level", &val) && (val < 1 || val > 9)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid compression.level "
+                "%"PRIdMAX", expected 1 to 9", val);
+        exit(EXIT_FAILURE);
+    }
+    const int level = (int)val;
+
+    val = LOG_COMPRESS_DEFAULT_FLUSH_RECORDS;
+    if (ConfGetChildValueInt(conf, "flush-records", &val) &&
+            (val < 1 || val > UINT32_MAX)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "Invalid "
+                "compression.flush-records %"PRIdMAX, val);
+        exit(EXIT_FAILURE);
+    }
+    const uint32_t flush_records = (uint32_t)val;
+
+    uint64_t flush_interval = LOG_COMPRESS_DEFAULT_FLUSH_INTERVAL;
+    const char *str = ConfNodeLookupChildValue(conf, "flush-interval");
+    if (str != NULL) {
+        flush_interval = SCParseTimeSizeString(str);
+        if (flush_interval == 0 || flush_interval > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_NUMERIC_VALUE, "Invalid "
+                    "compression.flush-interval %s", str);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint32_t size = LOG_COMPRESS_DEFAULT_SIZE;
+    str = ConfNodeLookupChildValue(conf, "buffer-size");
+    if (str != NULL && (ParseSizeStringU32(str, &size) < 0 || size == 0)) {
+        SCLogError(SC_ERR_SIZE_PARSE, "Error parsing "
+                "compression.buffer-size from conf file - %s", str);
+        exit(EXIT_FAILURE);
+    }
+
+    if (LogCompressNew(log_ctx, level, flush_records,
+                (uint32_t)flush_interval, size) == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Failed to set up log compression");
+        return -1;
+    }
+    SCLogConfig("gzip level %d, flushing every %"PRIu32" records or "
+            "%"PRIu64"s, buffering up to %"PRIu32" bytes", level,
+            flush_records, flush_interval, size);
+    return 0;
+}
+
+/** \brief free the compression state, after the file was closed */
+void LogCompressFree(LogFileCtx *log_ctx)
+{
+    LogCompressCtx *c = log_ctx->compress;
+
+    SCMutexLock(&log_compress_lock);
+    LogCompressCtx **pp = &log_compress_ctxs;
+    while (*pp != NULL) {
+        if (*pp == c) {
+            *pp = c->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+    SCMutexUnlock(&log_compress_lock);
+
+    if (c->records) {
+        SCLogInfo("%s: %"PRIu32" records not written", log_ctx->filename,
+                c->records);
+    }
+    deflateEnd(&c->zs);
+    SCCtrlMutexDestroy(&c->mutex);
+    SCCtrlCondDestroy(&c->cond);
+    SCCtrlCondDestroy(&c->space_cond);
+    SCFree(c->buf);
+    SCFree(c->out);
+    SCFree(c->zbuf);
+    SCFree(c);
+    log_ctx->compress = NULL;
+}
+
+static void LogCompressWriterFlush(void *data, bool final)
+{
+    (void)LogCompressFlush(data, final);
+}
+
+TM_WRITER_COUNTER(LogCompressCounterQueuedBytes, LogCompressCtx,
+        log_compress_ctxs, log_compress_lock, v += c->len)
+TM_WRITER_COUNTER(LogCompressCounterBytesIn, LogCompressCtx,
+        log_compress_ctxs, log_compress_lock, v += c->bytes_in)
+TM_WRITER_COUNTER(LogCompressCounterBytesOut, LogCompressCtx,
+        log_compress_ctxs, log_compress_lock, v += c->bytes_out)
+TM_WRITER_COUNTER(LogCompressCounterFlushes, LogCompressCtx,
+        log_compress_ctxs, log_compress_lock, v += c->flushes)
+TM_WRITER_COUNTER(LogCompressCounterStalls, LogCompressCtx,
+        log_compress_ctxs, log_compress_lock, v += c->stalls)
+
+/** \brief start the writer threads of the compressed outputs */
+void LogCompressThreadSpawn(void)
+{
+    int n = 0;
+
+    SCMutexLock(&log_compress_lock);
+    for (LogCompressCtx *c = log_compress_ctxs; c != NULL; c = c->next) {
+        TmThreadSpawnWriter(thread_name_log_compress, ++n, c,
+                LogCompressWriterFlush, &c->mutex, &c->cond, &c->running);
+    }
+    SCMutexUnlock(&log_compress_lock);
+
+    if (n == 0)
+        return;
+
+    StatsRegisterGlobalCounter("log_compress.queued_bytes",
+            LogCompressCounterQueuedBytes);
+    StatsRegisterGlobalCounter("log_compress.bytes_in", LogCompressCounterBytesIn);
+    StatsRegisterGlobalCounter("log_compress.bytes_out", LogCompressCounterBytesOut);
+    StatsRegisterGlobalCounter("log_compress.flushes", LogCompressCounterFlushes);
+    StatsRegisterGlobalCounter("log_compress.stalls", LogCompressCounterStalls);
+}
+
+#ifdef UNITTESTS
+
+/** \test queued and inline writes, rotation starts a new gzip member */
+static int LogCompressTest01(void)
+{
+    char path[] = "/tmp/suricata-compress-XXXXXX";
+    int fd = mkstemp(path);
+    FAIL_IF(fd < 0);
+    close(fd);
+
+    LogFileCtx *lf = LogFileNewCtx();
+    FAIL_IF_NULL(lf);
+    lf->fp = fopen(path, "w");
+    FAIL_IF_NULL(lf->fp);
+    lf->filename = SCStrdup(path);
+    FAIL_IF_NULL(lf->filename);
+    lf->is_regular = 1;
+
+    LogCompressCtx *c = LogCompressNew(lf, 6, 2, 1, 1024);
+    FAIL_IF_NULL(c);
+
+    /* no writer thread: compressed inline */
+    FAIL_IF(lf->Write("a\n", 2, lf) != 1);
+    FAIL_IF(c->records != 0);
+    FAIL_IF(c->flushes != 1);
+
+    c->running = 1;
+    FAIL_IF(lf->Write("b\n", 2, lf) != 1);
+    FAIL_IF(lf->Write("c\n", 2, lf) != 1);
+    FAIL_IF(c->records != 2);
+    FAIL_IF(c->flushes != 1);
+    /* a full batch, doesn't wait */
+    FAIL_IF(LogCompressFlush(c, false) != 2);
+    FAIL_IF(c->records != 0);
+
+    lf->rotation_flag = 1;
+    FAIL_IF(lf->Write("d\n", 2, lf) != 1);
+    FAIL_IF(LogCompressFlush(c, true) != 1);
+    FAIL_IF(c->running);
+    FAIL_IF(c->bytes_in != 8);
+    LogFileFreeCtx(lf);
+
+    /* two gzip members, read back as one stream */
+    gzFile gz = gzopen(path, "rb");
+    FAIL_IF_NULL(gz);
+    char buf[64];
+    int n = gzread(gz, buf, sizeof(buf));
+    gzclose(gz);
+    unlink(path);
+    FAIL_IF(n != 8);
+    FAIL_IF(memcmp(buf, "a\nb\nc\nd\n", 8) != 0);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void LogCompressRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogCompressTest01", LogCompressTest01);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,82 @@
+/* Copyright (C) 2020 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * gzip compressed regular file output, compressed by a writer thread.
+ */
+
+#ifndef __UTIL_LOG_COMPRESS_H__
+#define __UTIL_LOG_COMPRESS_H__
+
+#include <zlib.h>
+
+#include "conf.h"
+#include "threads.h"
+#include "util-logopenfile.h"
+
+/** \brief records waiting for the writer thread and the deflate state
+ *         of the output file */
+typedef struct LogCompressCtx_ {
+    SCCtrlMutex mutex;
+    /* wakes the writer when a batch is ready */
+    SCCtrlCondT cond;
+    /* wakes writers waiting for room in a full buffer */
+    SCCtrlCondT space_cond;
+
+    /* records waiting to be picked up by the writer */
+    char *buf;
+    uint32_t buf_size;
+    uint32_t len;
+    uint32_t records;
+
+    /* the writer's half of the double buffer */
+    char *out;
+    uint32_t out_size;
+
+    uint32_t max_size;
+    /* a batch is compressed and flushed to the file after this many
+     * records or this many seconds, whichever comes first */
+    uint32_t flush_records;
+    uint32_t flush_interval;
+    /* set while the writer thread runs, else writes are done inline */
+    int running;
+
+    /* deflate state, protected by the output's fp_mutex. A gzip member
+     * is started on the first write after (re)opening the file and
+     * finished when the file is closed. */
+    z_stream zs;
+    bool stream_open;
+    uint8_t *zbuf;
+
+    struct LogFileCtx_ *log_ctx;
+    struct LogCompressCtx_ *next;
+
+    /* stats */
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t flushes;
+    uint64_t stalls;
+} LogCompressCtx;
+
+int LogCompressSetup(LogFileCtx *log_ctx, ConfNode *conf);
+void LogCompressFree(LogFileCtx *log_ctx);
+void LogCompressThreadSpawn(void);
+void LogCompressRegisterTests(void);
+
+#endif /* __UTIL_LOG_COMPRESS_H__ */
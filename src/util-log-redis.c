@@ -26,6 +26,14 @@
 #include "suricata-common.h" /* errno.h, string.h, etc. */
 #include "util-log-redis.h"
 #include "util-logopenfile.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "counters.h"
+#include "util-misc.h"
+#include "util-privs.h"
+#include "util-time.h"
+#include "util-unittest.h"
 
 #ifdef HAVE_LIBHIREDIS
 
@@ -39,6 +47,18 @@ static const char * redis_publish_cmd = "PUBLISH";
 static const char * redis_default_key = "suricata";
 static const char * redis_default_server = "127.0.0.1";
 
+#define REDIS_SPOOL_DEFAULT_SIZE        (16 * 1024 * 1024)
+#define REDIS_SPOOL_DEFAULT_BATCH_SIZE  512
+#define REDIS_SPOOL_INITIAL_SIZE        (64 * 1024)
+/* max time events wait in the spool for a batch to fill up */
+#define REDIS_SPOOL_FLUSH_MSEC          100
+
+static const char *thread_name_redis_spool = "RedisSpool";
+
+/* spools of all redis outputs, set up at config time */
+static SCMutex redis_spools_lock = SCMUTEX_INITIALIZER;
+static SCLogRedisSpool *redis_spools = NULL;
+
 static int SCConfLogReopenSyncRedis(LogFileCtx *log_ctx);
 static void SCLogFileCloseRedis(LogFileCtx *log_ctx);
 
@@ -406,6 +426,380 @@ static int SCLogRedisWriteSync(LogFileCtx *file_ctx, const char *string)
     return ret;
 }
 
+
+/** \brief set up the spool of a redis output, the sender thread is
+ *         started by SCLogRedisSpoolThreadSpawn */
+static SCLogRedisSpool *SCLogRedisSpoolNew(LogFileCtx *log_ctx)
+{
+    SCLogRedisSpool *spool = SCCalloc(1, sizeof(*spool));
+    if (unlikely(spool == NULL))
+        return NULL;
+
+    const char *cmd = log_ctx->redis_setup.command;
+    const char *key = log_ctx->redis_setup.key;
+    size_t prefix_size = strlen(cmd) + strlen(key) + 64;
+    spool->prefix = SCMalloc(prefix_size);
+    spool->buf_size = MIN(REDIS_SPOOL_INITIAL_SIZE, log_ctx->redis_setup.spool_size);
+    spool->buf = SCMalloc(spool->buf_size);
+    spool->out_size = spool->buf_size;
+    spool->out = SCMalloc(spool->out_size);
+    if (spool->prefix == NULL || spool->buf == NULL || spool->out == NULL) {
+        SCFree(spool->prefix);
+        SCFree(spool->buf);
+        SCFree(spool->out);
+        SCFree(spool);
+        return NULL;
+    }
+    spool->prefix_len = snprintf(spool->prefix, prefix_size,
+            "*3\r\n$%"PRIuMAX"\r\n%s\r\n$%"PRIuMAX"\r\n%s\r\n",
+            (uintmax_t)strlen(cmd), cmd, (uintmax_t)strlen(key), key);
+
+    SCCtrlMutexInit(&spool->mutex, NULL);
+    SCCtrlCondInit(&spool->cond, NULL);
+    spool->max_size = log_ctx->redis_setup.spool_size;
+    spool->batch_size = log_ctx->redis_setup.spool_batch_size;
+    spool->log_ctx = log_ctx;
+
+    SCMutexLock(&redis_spools_lock);
+    spool->next = redis_spools;
+    redis_spools = spool;
+    SCMutexUnlock(&redis_spools_lock);
+    return spool;
+}
+
+static void SCLogRedisSpoolFree(SCLogRedisSpool *spool)
+{
+    SCMutexLock(&redis_spools_lock);
+    SCLogRedisSpool **pp = &redis_spools;
+    while (*pp != NULL) {
+        if (*pp == spool) {
+            *pp = spool->next;
+            break;
+        }
+        pp = &(*pp)->next;
+    }
+    SCMutexUnlock(&redis_spools_lock);
+
+    if (spool->cmds) {
+        SCLogInfo("redis spool: %"PRIu32" events not sent", spool->cmds);
+    }
+    SCCtrlMutexDestroy(&spool->mutex);
+    SCCtrlCondDestroy(&spool->cond);
+    SCFree(spool->prefix);
+    SCFree(spool->buf);
+    SCFree(spool->out);
+    SCFree(spool);
+}
+
+/**
+ * \brief queue an event for the sender thread
+ * \retval 0 queued
+ * \retval -1 dropped, the spool is full
+ * \retval 1 sender not running, caller has to write it itself
+ */
+static int SCLogRedisSpoolAppend(SCLogRedisSpool *spool, const char *string,
+        size_t string_len)
+{
+    char hdr[32];
+    int hdr_len = snprintf(hdr, sizeof(hdr), "$%"PRIuMAX"\r\n",
+            (uintmax_t)string_len);
+    const uint64_t need = (uint64_t)spool->prefix_len + hdr_len + string_len + 2;
+
+    SCCtrlMutexLock(&spool->mutex);
+    if (!spool->running) {
+        SCCtrlMutexUnlock(&spool->mutex);
+        return 1;
+    }
+    if (spool->len + need > spool->max_size) {
+        spool->dropped++;
+        SCCtrlMutexUnlock(&spool->mutex);
+        return -1;
+    }
+    if (spool->len + need > spool->buf_size) {
+        uint64_t size = spool->buf_size;
+        while (size < spool->len + need)
+            size *= 2;
+        size = MIN(size, spool->max_size);
+        char *ptr = SCRealloc(spool->buf, size);
+        if (ptr == NULL) {
+            spool->dropped++;
+            SCCtrlMutexUnlock(&spool->mutex);
+            return -1;
+        }
+        spool->buf = ptr;
+        spool->buf_size = (uint32_t)size;
+    }
+
+    char *dst = spool->buf + spool->len;
+    memcpy(dst, spool->prefix, spool->prefix_len);
+    dst += spool->prefix_len;
+    memcpy(dst, hdr, hdr_len);
+    dst += hdr_len;
+    memcpy(dst, string, string_len);
+    dst += string_len;
+    memcpy(dst, "\r\n", 2);
+    spool->len += (uint32_t)need;
+
+    if (++spool->cmds == spool->batch_size) {
+        SCCtrlCondSignal(&spool->cond);
+    }
+    SCCtrlMutexUnlock(&spool->mutex);
+    return 0;
+}
+
+/** \retval offset of the command after the first n commands of buf */
+static uint32_t SCLogRedisSpoolSkip(const SCLogRedisSpool *spool,
+        const char *buf, uint32_t len, uint32_t n)
+{
+    uint32_t off = 0;
+    for (uint32_t i = 0; i < n && off < len; i++) {
+        /* prefix, then the event as "$<len>\r\n<event>\r\n" */
+        off += spool->prefix_len + 1;
+        uint32_t event_len = 0;
+        while (off < len && buf[off] != '\r')
+            event_len = event_len * 10 + (buf[off++] - '0');
+        off += event_len + 4;
+    }
+    return MIN(off, len);
+}
+
+/**
+ * \brief put the commands of a failed batch back at the head of the
+ *        spool, ahead of what was queued in the meantime. The oldest
+ *        commands are dropped if they don't all fit.
+ */
+static void SCLogRedisSpoolRequeue(SCLogRedisSpool *spool, const char *buf,
+        uint32_t len, uint32_t cmds)
+{
+    SCCtrlMutexLock(&spool->mutex);
+    while (cmds > 0 && (uint64_t)len + spool->len > spool->max_size) {
+        uint32_t skip = SCLogRedisSpoolSkip(spool, buf, len, 1);
+        buf += skip;
+        len -= skip;
+        cmds--;
+        spool->dropped++;
+    }
+    if (cmds == 0) {
+        SCCtrlMutexUnlock(&spool->mutex);
+        return;
+    }
+    if (spool->len + len > spool->buf_size) {
+        uint64_t size = spool->buf_size;
+        while (size < spool->len + len)
+            size *= 2;
+        size = MIN(size, spool->max_size);
+        char *ptr = SCRealloc(spool->buf, size);
+        if (ptr == NULL) {
+            spool->dropped += cmds;
+            SCCtrlMutexUnlock(&spool->mutex);
+            return;
+        }
+        spool->buf = ptr;
+        spool->buf_size = (uint32_t)size;
+    }
+    memmove(spool->buf + len, spool->buf, spool->len);
+    memcpy(spool->buf, buf, len);
+    spool->len += len;
+    spool->cmds += cmds;
+    SCCtrlMutexUnlock(&spool->mutex);
+}
+
+/**
+ * \brief send a batch of formatted commands in a single write and
+ *        collect the replies. If the connection fails, the commands
+ *        without a reply are requeued, so they may be sent twice.
+ * \retval 0 on success, -1 if the connection failed
+ */
+static int SCLogRedisSpoolSend(SCLogRedisSpool *spool, const char *buf,
+        uint32_t len, uint32_t cmds)
+{
+    LogFileCtx *log_ctx = spool->log_ctx;
+    SCLogRedisContext *ctx = log_ctx->redis;
+
+    if (ctx->sync == NULL) {
+        if (SCConfLogReopenSyncRedis(log_ctx) < 0) {
+            SCLogRedisSpoolRequeue(spool, buf, len, cmds);
+            return -1;
+        }
+    }
+    redisContext *redis = ctx->sync;
+
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    uint32_t errors = 0;
+    uint32_t replies = 0;
+    if (redisAppendFormattedCommand(redis, buf, len) != REDIS_OK)
+        goto error;
+    for ( ; replies < cmds; replies++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(redis, (void **)&reply) != REDIS_OK || reply == NULL)
+            goto error;
+        if (reply->type == REDIS_REPLY_ERROR) {
+            if (errors == 0)
+                SCLogWarning(SC_ERR_SOCKET, "Redis error: %s", reply->str);
+            errors++;
+        }
+        freeReplyObject(reply);
+    }
+
+    gettimeofday(&end, NULL);
+    uint64_t usec = (end.tv_sec - start.tv_sec) * 1000000ULL +
+        end.tv_usec - start.tv_usec;
+
+    SCCtrlMutexLock(&spool->mutex);
+    spool->sent += cmds - errors;
+    spool->errors += errors;
+    spool->batches++;
+    spool->rtt_us += usec;
+    if (usec > spool->rtt_max_us)
+        spool->rtt_max_us = usec;
+    SCCtrlMutexUnlock(&spool->mutex);
+    return 0;
+
+error:
+    SCLogWarning(SC_ERR_SOCKET, "Redis spool: connection failed (%s), "
+            "%"PRIu32" events requeued", redis->errstr, cmds - replies);
+    redisFree(ctx->sync);
+    ctx->sync = NULL;
+    SCCtrlMutexLock(&spool->mutex);
+    spool->sent += replies - errors;
+    spool->errors += errors;
+    SCCtrlMutexUnlock(&spool->mutex);
+
+    uint32_t off = SCLogRedisSpoolSkip(spool, buf, len, replies);
+    SCLogRedisSpoolRequeue(spool, buf + off, len - off, cmds - replies);
+    return -1;
+}
+
+/**
+ * \brief hand the queued commands to the sender and send them
+ * \param final don't wait for the batch to fill up
+ * \retval cmds number of commands that were queued
+ */
+static uint32_t SCLogRedisSpoolFlush(SCLogRedisSpool *spool, bool final)
+{
+    LogFileCtx *log_ctx = spool->log_ctx;
+    SCLogRedisContext *ctx = log_ctx->redis;
+    const bool connected = (ctx->sync != NULL ||
+            SCConfLogReopenSyncRedis(log_ctx) == 0);
+
+    SCCtrlMutexLock(&spool->mutex);
+    /* wait for a batch to fill up. While the server is unreachable the
+     * events stay spooled until the spool overflows. */
+    if (!final && (!connected || spool->cmds < spool->batch_size)) {
+        struct timeval tv;
+        struct timespec ts;
+        gettimeofday(&tv, NULL);
+        uint64_t nsec = tv.tv_usec * 1000ULL + REDIS_SPOOL_FLUSH_MSEC * 1000000ULL;
+        ts.tv_sec = tv.tv_sec + nsec / 1000000000ULL;
+        ts.tv_nsec = nsec % 1000000000ULL;
+        SCCtrlCondTimedwait(&spool->cond, &spool->mutex, &ts);
+    }
+    if (!connected) {
+        uint32_t cmds = spool->cmds;
+        if (final) {
+            spool->dropped += cmds;
+            spool->len = 0;
+            spool->cmds = 0;
+        }
+        SCCtrlMutexUnlock(&spool->mutex);
+        return final ? cmds : 0;
+    }
+
+    char *out = spool->buf;
+    uint32_t out_size = spool->buf_size;
+    uint32_t len = spool->len;
+    uint32_t cmds = spool->cmds;
+    spool->buf = spool->out;
+    spool->buf_size = spool->out_size;
+    spool->out = out;
+    spool->out_size = out_size;
+    spool->len = 0;
+    spool->cmds = 0;
+    SCCtrlMutexUnlock(&spool->mutex);
+
+    if (cmds > 0) {
+        (void)SCLogRedisSpoolSend(spool, out, len, cmds);
+    }
+    return cmds;
+}
+
+static void SCLogRedisSpoolWriterFlush(void *data, bool final)
+{
+    SCLogRedisSpool *spool = data;
+
+    if (final) {
+        /* workers are done: send what is left. Late writers fall
+         * back to writing inline, which shares our connection, so
+         * hold them off until we're done. */
+        SCMutexLock(&spool->log_ctx->fp_mutex);
+        SCCtrlMutexLock(&spool->mutex);
+        spool->running = 0;
+        SCCtrlMutexUnlock(&spool->mutex);
+        SCLogRedisSpoolFlush(spool, true);
+        SCMutexUnlock(&spool->log_ctx->fp_mutex);
+        return;
+    }
+    SCLogRedisSpoolFlush(spool, false);
+}
+
+TM_WRITER_COUNTER(SCLogRedisSpoolCounterQueued, SCLogRedisSpool,
+        redis_spools, redis_spools_lock, v += c->cmds)
+TM_WRITER_COUNTER(SCLogRedisSpoolCounterQueuedBytes, SCLogRedisSpool,
+        redis_spools, redis_spools_lock, v += c->len)
+TM_WRITER_COUNTER(SCLogRedisSpoolCounterSent, SCLogRedisSpool,
+        redis_spools, redis_spools_lock, v += c->sent)
+TM_WRITER_COUNTER(SCLogRedisSpoolCounterDropped, SCLogRedisSpool,
+        redis_spools, redis_spools_lock, v += c->dropped)
+TM_WRITER_COUNTER(SCLogRedisSpoolCounterErrors, SCLogRedisSpool,
+        redis_spools, redis_spools_lock, v += c->errors)
+TM_WRITER_COUNTER(SCLogRedisSpoolCounterBatches, SCLogRedisSpool,
+        redis_spools, redis_spools_lock, v += c->batches)
+TM_WRITER_COUNTER(SCLogRedisSpoolCounterRttMax, SCLogRedisSpool,
+        redis_spools, redis_spools_lock, v = MAX(v, c->rtt_max_us))
+
+static uint64_t SCLogRedisSpoolCounterRttAvg(void)
+{
+    uint64_t batches = 0, usec = 0;
+    SCMutexLock(&redis_spools_lock);
+    for (SCLogRedisSpool *s = redis_spools; s != NULL; s = s->next) {
+        SCCtrlMutexLock(&s->mutex);
+        batches += s->batches;
+        usec += s->rtt_us;
+        SCCtrlMutexUnlock(&s->mutex);
+    }
+    SCMutexUnlock(&redis_spools_lock);
+    return batches ? usec / batches : 0;
+}
+
+/** \brief start the sender threads of the redis outputs that use a spool */
+void SCLogRedisSpoolThreadSpawn(void)
+{
+    int n = 0;
+
+    SCMutexLock(&redis_spools_lock);
+    for (SCLogRedisSpool *spool = redis_spools; spool != NULL; spool = spool->next) {
+        TmThreadSpawnWriter(thread_name_redis_spool, ++n, spool,
+                SCLogRedisSpoolWriterFlush, &spool->mutex, &spool->cond,
+                &spool->running);
+    }
+    SCMutexUnlock(&redis_spools_lock);
+
+    if (n == 0)
+        return;
+
+    StatsRegisterGlobalCounter("redis.spool.queued", SCLogRedisSpoolCounterQueued);
+    StatsRegisterGlobalCounter("redis.spool.queued_bytes",
+            SCLogRedisSpoolCounterQueuedBytes);
+    StatsRegisterGlobalCounter("redis.spool.sent", SCLogRedisSpoolCounterSent);
+    StatsRegisterGlobalCounter("redis.spool.dropped", SCLogRedisSpoolCounterDropped);
+    StatsRegisterGlobalCounter("redis.spool.errors", SCLogRedisSpoolCounterErrors);
+    StatsRegisterGlobalCounter("redis.spool.batches", SCLogRedisSpoolCounterBatches);
+    StatsRegisterGlobalCounter("redis.spool.rtt_avg_us", SCLogRedisSpoolCounterRttAvg);
+    StatsRegisterGlobalCounter("redis.spool.rtt_max_us", SCLogRedisSpoolCounterRttMax);
+}
+
 /**
  * \brief LogFileWriteRedis() writes log data to redis output.
  * \param log_ctx Log file context allocated by caller
@@ -421,17 +815,28 @@ int LogFileWriteRedis(void *lf_ctx, const char *string, size_t string_len)
         return -1;
     }
 
+    SCLogRedisContext *ctx = file_ctx->redis;
+    if (ctx->spool != NULL) {
+        int r = SCLogRedisSpoolAppend(ctx->spool, string, string_len);
+        if (r <= 0)
+            return r;
+        /* no sender thread, write it ourselves */
+    }
+
+    int ret = -1;
+    SCMutexLock(&file_ctx->fp_mutex);
 #if HAVE_LIBEVENT
     /* async mode on */
     if (file_ctx->redis_setup.is_async) {
-        return SCLogRedisWriteAsync(file_ctx, string, string_len);
+        ret = SCLogRedisWriteAsync(file_ctx, string, string_len);
     }
 #endif
     /* sync mode */
     if (! file_ctx->redis_setup.is_async) {
-        return SCLogRedisWriteSync(file_ctx, string);
+        ret = SCLogRedisWriteSync(file_ctx, string);
     }
-    return -1;
+    SCMutexUnlock(&file_ctx->fp_mutex);
+    return ret;
 }
 
 /** \brief configure and initializes redis output logging
@@ -498,6 +903,38 @@ int SCConfLogOpenRedis(ConfNode *redis_node, void *lf_ctx)
         log_ctx->redis_setup.batch_size = 0;
     }
 
+    log_ctx->redis_setup.spool_size = 0;
+    if (redis_node) {
+        ConfNode *spool = ConfNodeLookupChild(redis_node, "spool");
+        int enabled = 0;
+        if (spool && ConfGetChildValueBool(spool, "enabled", &enabled) && enabled) {
+            uint32_t size = REDIS_SPOOL_DEFAULT_SIZE;
+            const char *str = ConfNodeLookupChildValue(spool, "max-size");
+            if (str != NULL && (ParseSizeStringU32(str, &size) < 0 || size == 0)) {
+                SCLogError(SC_ERR_SIZE_PARSE, "Error parsing redis "
+                        "spool.max-size from conf file - %s", str);
+                exit(EXIT_FAILURE);
+            }
+            intmax_t val = REDIS_SPOOL_DEFAULT_BATCH_SIZE;
+            if (ConfGetChildValueInt(spool, "batch-size", &val) &&
+                    (val < 1 || val > UINT32_MAX)) {
+                SCLogError(SC_ERR_REDIS_CONFIG, "Invalid redis "
+                        "spool.batch-size %"PRIdMAX, val);
+                exit(EXIT_FAILURE);
+            }
+            log_ctx->redis_setup.spool_size = size;
+            log_ctx->redis_setup.spool_batch_size = (uint32_t)val;
+            if (is_async) {
+                SCLogWarning(SC_ERR_REDIS_CONFIG, "redis spool replaces "
+                        "async mode, ignoring async");
+                is_async = 0;
+                log_ctx->redis_setup.is_async = 0;
+            }
+            /* the sender does its own batching */
+            log_ctx->redis_setup.batch_size = 0;
+        }
+    }
+
     if (!strcmp(redis_mode, "list") || !strcmp(redis_mode,"lpush")) {
         log_ctx->redis_setup.command = redis_lpush_cmd;
     } else if(!strcmp(redis_mode, "rpush")){
@@ -526,6 +963,17 @@ int SCConfLogOpenRedis(ConfNode *redis_node, void *lf_ctx)
         log_ctx->redis = SCLogRedisContextAlloc();
         SCConfLogReopenSyncRedis(log_ctx);
     }
+    if (log_ctx->redis_setup.spool_size) {
+        SCLogRedisContext *ctx = log_ctx->redis;
+        ctx->spool = SCLogRedisSpoolNew(log_ctx);
+        if (ctx->spool == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Unable to allocate redis spool");
+            exit(EXIT_FAILURE);
+        }
+        SCLogConfig("redis: spooling up to %"PRIu32" bytes, batches of "
+                "%"PRIu32" events", log_ctx->redis_setup.spool_size,
+                log_ctx->redis_setup.spool_batch_size);
+    }
     return 0;
 }
 
@@ -538,6 +986,10 @@ void SCLogFileCloseRedis(LogFileCtx *log_ctx)
     if (ctx == NULL) {
         return;
     }
+    if (ctx->spool != NULL) {
+        SCLogRedisSpoolFree(ctx->spool);
+        ctx->spool = NULL;
+    }
     /* asynchronous */
     if (log_ctx->redis_setup.is_async) {
 #if HAVE_LIBEVENT == 1
@@ -576,4 +1028,268 @@ void SCLogFileCloseRedis(LogFileCtx *log_ctx)
     }
 }
 
+
+#ifdef UNITTESTS
+
+/* minimal stand-in for redis-server: accepts one connection and answers
+ * every command with an integer reply, or only the first max_replies */
+typedef struct RedisStandIn_ {
+    int fd;
+    int port;
+    pthread_t thread;
+    uint32_t cmds;
+    uint32_t max_replies;
+    char last[64];
+} RedisStandIn;
+
+/** \retval bytes used by the first complete command in buf, 0 if none */
+static size_t RedisStandInParse(RedisStandIn *r, const char *buf, size_t len)
+{
+    const char *p = buf, *end = buf + len;
+    const char *eol = memchr(p, '\r', end - p);
+    if (*p != '*' || eol == NULL || eol + 1 >= end)
+        return 0;
+    int args = atoi(p + 1);
+    p = eol + 2;
+    for (int i = 0; i < args; i++) {
+        eol = memchr(p, '\r', end - p);
+        if (p >= end || *p != '$' || eol == NULL || eol + 1 >= end)
+            return 0;
+        size_t arg_len = (size_t)atol(p + 1);
+        p = eol + 2;
+        if ((size_t)(end - p) < arg_len + 2)
+            return 0;
+        if (i == args - 1) {
+            size_t n = MIN(arg_len, sizeof(r->last) - 1);
+            memcpy(r->last, p, n);
+            r->last[n] = '\0';
+        }
+        p += arg_len + 2;
+    }
+    return p - buf;
+}
+
+static void *RedisStandInThread(void *arg)
+{
+    RedisStandIn *r = arg;
+    int c = accept(r->fd, NULL, NULL);
+    if (c < 0)
+        return NULL;
+
+    const size_t size = 1024 * 1024;
+    char *buf = SCMalloc(size);
+    size_t len = 0;
+    ssize_t n;
+    while (buf != NULL && len < size && (n = recv(c, buf + len, size - len, 0)) > 0) {
+        len += n;
+        size_t used;
+        while (len > 0 && (used = RedisStandInParse(r, buf, len)) > 0) {
+            memmove(buf, buf + used, len - used);
+            len -= used;
+            r->cmds++;
+            if (r->max_replies != 0 && r->cmds > r->max_replies)
+                continue;
+            if (send(c, ":1\r\n", 4, 0) != 4)
+                break;
+            /* hang up, but read on so that the replies arrive */
+            if (r->cmds == r->max_replies)
+                shutdown(c, SHUT_WR);
+        }
+    }
+    SCFree(buf);
+    close(c);
+    return NULL;
+}
+
+static int RedisStandInStart(RedisStandIn *r, uint32_t max_replies)
+{
+    memset(r, 0, sizeof(*r));
+    r->max_replies = max_replies;
+    r->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (r->fd < 0)
+        return -1;
+
+    struct sockaddr_in sin;
+    socklen_t sin_len = sizeof(sin);
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(r->fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+            listen(r->fd, 1) < 0 ||
+            getsockname(r->fd, (struct sockaddr *)&sin, &sin_len) < 0) {
+        close(r->fd);
+        return -1;
+    }
+    r->port = ntohs(sin.sin_port);
+    if (pthread_create(&r->thread, NULL, RedisStandInThread, r) != 0) {
+        close(r->fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void RedisStandInStop(RedisStandIn *r)
+{
+    pthread_join(r->thread, NULL);
+    close(r->fd);
+}
+
+static LogFileCtx *RedisTestCtx(RedisStandIn *r, uint32_t spool_size,
+        uint32_t batch_size)
+{
+    LogFileCtx *lf = LogFileNewCtx();
+    if (lf == NULL)
+        return NULL;
+    lf->type = LOGFILE_TYPE_REDIS;
+    lf->redis_setup.server = "127.0.0.1";
+    lf->redis_setup.port = r->port;
+    lf->redis_setup.command = redis_rpush_cmd;
+    lf->redis_setup.key = redis_default_key;
+    lf->redis_setup.spool_size = spool_size;
+    lf->redis_setup.spool_batch_size = batch_size;
+    lf->Close = SCLogFileCloseRedis;
+
+    SCLogRedisContext *ctx = SCLogRedisContextAlloc();
+    lf->redis = ctx;
+    ctx->spool = SCLogRedisSpoolNew(lf);
+    if (ctx->spool == NULL) {
+        LogFileFreeCtx(lf);
+        return NULL;
+    }
+    return lf;
+}
+
+/** \test events are spooled, sent as one batch and written inline once
+ *        the sender is gone */
+static int SCLogRedisSpoolTest01(void)
+{
+    RedisStandIn r;
+    FAIL_IF(RedisStandInStart(&r, 0) < 0);
+
+    LogFileCtx *lf = RedisTestCtx(&r, 1024 * 1024, 4);
+    FAIL_IF_NULL(lf);
+    SCLogRedisContext *ctx = lf->redis;
+    SCLogRedisSpool *spool = ctx->spool;
+    spool->running = 1;
+
+    char event[32];
+    for (int i = 0; i < 10; i++) {
+        int len = snprintf(event, sizeof(event), "{\"event\":%d}", i);
+        FAIL_IF(LogFileWriteRedis(lf, event, len) != 0);
+    }
+    FAIL_IF(spool->cmds != 10);
+    FAIL_IF(r.cmds != 0);
+
+    FAIL_IF(SCLogRedisSpoolFlush(spool, true) != 10);
+    FAIL_IF(spool->cmds != 0);
+    FAIL_IF(spool->sent != 10);
+    FAIL_IF(spool->batches != 1);
+    FAIL_IF(spool->errors != 0);
+    FAIL_IF(r.cmds != 10);
+    FAIL_IF(strcmp(r.last, "{\"event\":9}") != 0);
+
+    /* no sender: written directly */
+    spool->running = 0;
+    FAIL_IF(LogFileWriteRedis(lf, "{\"inline\":1}", 12) != 0);
+    FAIL_IF(spool->cmds != 0);
+    FAIL_IF(r.cmds != 11);
+    FAIL_IF(strcmp(r.last, "{\"inline\":1}") != 0);
+
+    LogFileFreeCtx(lf);
+    RedisStandInStop(&r);
+    PASS;
+}
+
+/** \test a full spool drops events instead of blocking the writer */
+static int SCLogRedisSpoolTest02(void)
+{
+    RedisStandIn r;
+    FAIL_IF(RedisStandInStart(&r, 0) < 0);
+
+    LogFileCtx *lf = RedisTestCtx(&r, 128, 100);
+    FAIL_IF_NULL(lf);
+    SCLogRedisContext *ctx = lf->redis;
+    SCLogRedisSpool *spool = ctx->spool;
+    spool->running = 1;
+
+    const char *event = "{\"event_type\":\"flow\"}";
+    int queued = 0, dropped = 0;
+    for (int i = 0; i < 10; i++) {
+        int ret = LogFileWriteRedis(lf, event, strlen(event));
+        if (ret == 0)
+            queued++;
+        else if (ret == -1)
+            dropped++;
+    }
+    FAIL_IF(queued == 0);
+    FAIL_IF(dropped == 0);
+    FAIL_IF(queued + dropped != 10);
+    FAIL_IF(spool->dropped != (uint64_t)dropped);
+    FAIL_IF(spool->len > spool->max_size);
+
+    FAIL_IF(SCLogRedisSpoolFlush(spool, true) != (uint32_t)queued);
+    FAIL_IF(r.cmds != (uint32_t)queued);
+
+    /* room again after the flush */
+    FAIL_IF(LogFileWriteRedis(lf, event, strlen(event)) != 0);
+
+    LogFileFreeCtx(lf);
+    RedisStandInStop(&r);
+    PASS;
+}
+
+/** \test on a connection failure the unsent part of the batch goes back
+ *        to the head of the spool */
+static int SCLogRedisSpoolTest03(void)
+{
+    RedisStandIn r;
+    FAIL_IF(RedisStandInStart(&r, 4) < 0);
+
+    LogFileCtx *lf = RedisTestCtx(&r, 1024 * 1024, 100);
+    FAIL_IF_NULL(lf);
+    SCLogRedisContext *ctx = lf->redis;
+    SCLogRedisSpool *spool = ctx->spool;
+    spool->running = 1;
+
+    char event[32];
+    for (int i = 0; i < 10; i++) {
+        int len = snprintf(event, sizeof(event), "{\"event\":%d}", i);
+        FAIL_IF(LogFileWriteRedis(lf, event, len) != 0);
+    }
+    FAIL_IF(SCLogRedisSpoolFlush(spool, true) != 10);
+    RedisStandInStop(&r);
+    FAIL_IF(r.cmds != 10);
+    FAIL_IF(spool->sent != 4);
+    FAIL_IF(spool->dropped != 0);
+    FAIL_IF(spool->cmds != 6);
+    FAIL_IF_NOT_NULL(ctx->sync);
+
+    /* queued after the failure, so it has to be sent last */
+    FAIL_IF(LogFileWriteRedis(lf, "{\"event\":10}", 12) != 0);
+
+    RedisStandIn r2;
+    FAIL_IF(RedisStandInStart(&r2, 0) < 0);
+    lf->redis_setup.port = r2.port;
+    FAIL_IF(SCLogRedisSpoolFlush(spool, true) != 7);
+    FAIL_IF(spool->sent != 11);
+    FAIL_IF(spool->cmds != 0);
+
+    LogFileFreeCtx(lf);
+    RedisStandInStop(&r2);
+    FAIL_IF(r2.cmds != 7);
+    FAIL_IF(strcmp(r2.last, "{\"event\":10}") != 0);
+    PASS;
+}
+
+#endif /* UNITTESTS */
+
+void SCLogRedisRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCLogRedisSpoolTest01", SCLogRedisSpoolTest01);
+    UtRegisterTest("SCLogRedisSpoolTest02", SCLogRedisSpoolTest02);
+    UtRegisterTest("SCLogRedisSpoolTest03", SCLogRedisSpoolTest03);
+#endif /* UNITTESTS */
+}
+
 #endif //#ifdef HAVE_LIBHIREDIS
@@ -44,8 +44,48 @@ typedef struct RedisSetup_ {
     int  port;
     int is_async;
     int  batch_size;
+    /* spool: send from a dedicated thread, 0 if disabled */
+    uint32_t spool_size;
+    uint32_t spool_batch_size;
 } RedisSetup;
 
+/** \brief bounded buffer of formatted commands, drained by a sender
+ *         thread so that workers never wait for the redis server */
+typedef struct SCLogRedisSpool_ {
+    SCCtrlMutex mutex;
+    SCCtrlCondT cond;
+
+    /* commands waiting to be picked up by the sender */
+    char *buf;
+    uint32_t buf_size;
+    uint32_t len;
+    uint32_t cmds;
+
+    /* the sender's half of the double buffer */
+    char *out;
+    uint32_t out_size;
+
+    /* RESP encoding of command and key, the same for every event */
+    char *prefix;
+    uint32_t prefix_len;
+
+    uint32_t max_size;
+    uint32_t batch_size;
+    /* set while the sender thread runs, else writes are done inline */
+    int running;
+
+    struct LogFileCtx_ *log_ctx;
+    struct SCLogRedisSpool_ *next;
+
+    /* stats */
+    uint64_t sent;
+    uint64_t dropped;
+    uint64_t errors;
+    uint64_t batches;
+    uint64_t rtt_us;
+    uint64_t rtt_max_us;
+} SCLogRedisSpool;
+
 typedef struct SCLogRedisContext_ {
     redisContext *sync;
 #if HAVE_LIBEVENT
@@ -55,11 +95,14 @@ typedef struct SCLogRedisContext_ {
 #endif /* HAVE_LIBEVENT */
     time_t tried;
     int  batch_count;
+    SCLogRedisSpool *spool;
 } SCLogRedisContext;
 
 void SCLogRedisInit(void);
 int SCConfLogOpenRedis(ConfNode *, void *);
 int LogFileWriteRedis(void *, const char *, size_t);
+void SCLogRedisSpoolThreadSpawn(void);
+void SCLogRedisRegisterTests(void);
 
 #endif /* HAVE_LIBHIREDIS */
 #endif /* __UTIL_LOG_REDIS_H__ */
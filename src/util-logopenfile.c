@@ -31,6 +31,7 @@
 #include "util-byte.h"
 #include "util-path.h"
 #include "util-logopenfile.h"
+#include "util-unittest.h"
 
 #if defined(HAVE_SYS_UN_H) && defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_TYPES_H)
 #define BUILD_WITH_UNIXSOCKET
@@ -39,6 +40,8 @@
 #include <sys/un.h>
 #endif
 
+#include "util-log-compress.h"
+
 #ifdef HAVE_LIBHIREDIS
 #include "util-log-redis.h"
 #endif /* HAVE_LIBHIREDIS */
@@ -177,6 +180,27 @@ tryagain:
 }
 #endif /* BUILD_WITH_UNIXSOCKET */
 
+/**
+ * \brief Reopen the file if a HUP or the rotate interval asks for it.
+ *
+ * Must be called with fp_mutex held.
+ */
+void SCLogFileCheckRotation(LogFileCtx *log_ctx)
+{
+    if (log_ctx->rotation_flag) {
+        log_ctx->rotation_flag = 0;
+        SCConfLogReopen(log_ctx);
+    }
+
+    if (log_ctx->flags & LOGFILE_ROTATE_INTERVAL) {
+        time_t now = time(NULL);
+        if (now >= log_ctx->rotate_time) {
+            SCConfLogReopen(log_ctx);
+            log_ctx->rotate_time = now + log_ctx->rotate_interval;
+        }
+    }
+}
+
 /**
  * \brief Write buffer to log file.
  * \retval 0 on failure; otherwise, the return value of fwrite (number of
@@ -193,20 +217,7 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
     } else
 #endif
     {
-
-        /* Check for rotation. */
-        if (log_ctx->rotation_flag) {
-            log_ctx->rotation_flag = 0;
-            SCConfLogReopen(log_ctx);
-        }
-
-        if (log_ctx->flags & LOGFILE_ROTATE_INTERVAL) {
-            time_t now = time(NULL);
-            if (now >= log_ctx->rotate_time) {
-                SCConfLogReopen(log_ctx);
-                log_ctx->rotate_time = now + log_ctx->rotate_interval;
-            }
-        }
+        SCLogFileCheckRotation(log_ctx);
 
         if (log_ctx->fp) {
             clearerr(log_ctx->fp);
@@ -293,6 +304,193 @@ SCLogOpenFileFp(const char *path, const char *append_setting, uint32_t mode)
     return ret;
 }
 
+/* Threaded file output: each writing thread gets its own file, named
+ * after the configured one with the thread's number inserted before the
+ * extension (eve.json -> eve.1.json, eve.2.json, ...). Files are
+ * created on a thread's first write. Lookups go through a small thread
+ * local cache so the output mutex is only taken once per thread.
+ *
+ * Freeing a threaded output bumps log_threaded_epoch. A thread drops its
+ * cache when the epoch changed since it last used it, so it never keeps
+ * the files of a freed output around. */
+
+#define LOGFILE_THREAD_CACHE_SIZE   8
+
+typedef struct LogThreadCacheEntry_ {
+    uint32_t id;
+    LogFileCtx *ctx;
+} LogThreadCacheEntry;
+
+static __thread LogThreadCacheEntry log_thread_cache[LOGFILE_THREAD_CACHE_SIZE];
+static __thread uint32_t log_thread_cache_epoch = 0;
+
+SC_ATOMIC_DECLARE(uint32_t, log_threaded_id);
+SC_ATOMIC_DECLARE(uint32_t, log_threaded_epoch);
+
+static void SCLogThreadedFileName(const char *base, uint32_t n,
+        char *out, size_t out_size)
+{
+    const char *slash = strrchr(base, '/');
+    const char *dot = strrchr(slash ? slash : base, '.');
+    if (dot != NULL && dot != base && dot != slash + 1) {
+        snprintf(out, out_size, "%.*s.%"PRIu32"%s",
+                (int)(dot - base), base, n, dot);
+    } else {
+        snprintf(out, out_size, "%s.%"PRIu32, base, n);
+    }
+}
+
+static LogFileCtx *SCLogThreadedFileNew(LogFileCtx *parent, uint32_t n)
+{
+    char filename[PATH_MAX];
+    SCLogThreadedFileName(parent->filename, n, filename, sizeof(filename));
+
+    LogFileCtx *ctx = LogFileNewCtx();
+    if (ctx == NULL)
+        return NULL;
+
+    ctx->fp = SCLogOpenFileFp(filename,
+            parent->threads->append ? "yes" : "no", parent->filemode);
+    if (ctx->fp == NULL) {
+        LogFileFreeCtx(ctx);
+        return NULL;
+    }
+    ctx->filename = SCStrdup(filename);
+    if (unlikely(ctx->filename == NULL)) {
+        LogFileFreeCtx(ctx);
+        return NULL;
+    }
+    ctx->type = LOGFILE_TYPE_FILE;
+    ctx->is_regular = 1;
+    ctx->filemode = parent->filemode;
+    ctx->flags = parent->flags & LOGFILE_ROTATE_INTERVAL;
+    ctx->rotate_time = parent->rotate_time;
+    ctx->rotate_interval = parent->rotate_interval;
+    ctx->parent = parent;
+    ctx->rotate_gen = SC_ATOMIC_GET(parent->threads->rotate_gen);
+
+    SCLogDebug("opened per thread log file %s", filename);
+    return ctx;
+}
+
+/** \brief get (or create) the calling thread's file of a threaded output */
+static LogFileCtx *SCLogThreadedFileGet(LogFileCtx *parent)
+{
+    LogThreadedFileCtx *threads = parent->threads;
+
+    const uint32_t epoch = SC_ATOMIC_GET(log_threaded_epoch);
+    if (unlikely(epoch != log_thread_cache_epoch)) {
+        memset(log_thread_cache, 0, sizeof(log_thread_cache));
+        log_thread_cache_epoch = epoch;
+    }
+
+    for (int i = 0; i < LOGFILE_THREAD_CACHE_SIZE; i++) {
+        if (log_thread_cache[i].id == threads->id)
+            return log_thread_cache[i].ctx;
+    }
+
+    const pthread_t self = pthread_self();
+    LogFileCtx *ctx = NULL;
+
+    SCMutexLock(&threads->mutex);
+    for (uint32_t u = 0; u < threads->slot_count; u++) {
+        if (pthread_equal(threads->owners[u], self)) {
+            ctx = threads->slots[u];
+            break;
+        }
+    }
+    if (ctx == NULL) {
+        const uint32_t cnt = threads->slot_count + 1;
+        LogFileCtx **slots = SCRealloc(threads->slots, cnt * sizeof(*slots));
+        if (slots != NULL) {
+            threads->slots = slots;
+            pthread_t *owners = SCRealloc(threads->owners, cnt * sizeof(*owners));
+            if (owners != NULL) {
+                threads->owners = owners;
+                ctx = SCLogThreadedFileNew(parent, cnt);
+                if (ctx != NULL) {
+                    threads->slots[threads->slot_count] = ctx;
+                    threads->owners[threads->slot_count] = self;
+                    threads->slot_count = cnt;
+                }
+            }
+        }
+    }
+    SCMutexUnlock(&threads->mutex);
+
+    if (ctx != NULL) {
+        /* use a free entry, or replace one if the cache is full */
+        int slot = threads->id % LOGFILE_THREAD_CACHE_SIZE;
+        for (int i = 0; i < LOGFILE_THREAD_CACHE_SIZE; i++) {
+            if (log_thread_cache[i].id == 0) {
+                slot = i;
+                break;
+            }
+        }
+        log_thread_cache[slot].id = threads->id;
+        log_thread_cache[slot].ctx = ctx;
+    }
+    return ctx;
+}
+
+static int SCLogFileWriteThreaded(const char *buffer, int buffer_len,
+        LogFileCtx *log_ctx)
+{
+    LogThreadedFileCtx *threads = log_ctx->threads;
+
+    /* HUP sets the flag of the output, hand it on to every thread */
+    if (log_ctx->rotation_flag) {
+        SCMutexLock(&threads->mutex);
+        if (log_ctx->rotation_flag) {
+            log_ctx->rotation_flag = 0;
+            (void)SC_ATOMIC_ADD(threads->rotate_gen, 1);
+        }
+        SCMutexUnlock(&threads->mutex);
+    }
+
+    LogFileCtx *ctx = SCLogThreadedFileGet(log_ctx);
+    if (ctx == NULL)
+        return 0;
+
+    const uint32_t gen = SC_ATOMIC_GET(threads->rotate_gen);
+    if (ctx->rotate_gen != gen) {
+        ctx->rotate_gen = gen;
+        ctx->rotation_flag = 1;
+    }
+    return SCLogFileWrite(buffer, buffer_len, ctx);
+}
+
+static int SCLogThreadedFileSetup(LogFileCtx *log_ctx, const char *append)
+{
+    log_ctx->threads = SCCalloc(1, sizeof(LogThreadedFileCtx));
+    if (log_ctx->threads == NULL)
+        return -1;
+
+    SCMutexInit(&log_ctx->threads->mutex, NULL);
+    SC_ATOMIC_INIT(log_ctx->threads->rotate_gen);
+    log_ctx->threads->id = SC_ATOMIC_ADD(log_threaded_id, 1);
+    log_ctx->threads->append = ConfValIsTrue(append);
+    log_ctx->Write = SCLogFileWriteThreaded;
+    return 0;
+}
+
+static void SCLogThreadedFileFree(LogFileCtx *log_ctx)
+{
+    LogThreadedFileCtx *threads = log_ctx->threads;
+
+    /* invalidate the thread caches before the files go away */
+    (void)SC_ATOMIC_ADD(log_threaded_epoch, 1);
+    for (uint32_t u = 0; u < threads->slot_count; u++) {
+        LogFileFreeCtx(threads->slots[u]);
+    }
+    SCFree(threads->slots);
+    SCFree(threads->owners);
+    SC_ATOMIC_DESTROY(threads->rotate_gen);
+    SCMutexDestroy(&threads->mutex);
+    SCFree(threads);
+    log_ctx->threads = NULL;
+}
+
 /** \brief open a generic output "log file", which may be a regular file or a socket
  *  \param conf ConfNode structure for the output section in question
  *  \param log_ctx Log file context allocated by caller
@@ -433,9 +631,29 @@ SCConfLogOpenGeneric(ConfNode *conf,
 #endif
     } else if (strcasecmp(filetype, DEFAULT_LOG_FILETYPE) == 0 ||
                strcasecmp(filetype, "file") == 0) {
-        log_ctx->fp = SCLogOpenFileFp(log_path, append, log_ctx->filemode);
-        if (log_ctx->fp == NULL)
-            return -1; // Error already logged by Open...Fp routine
+        if (log_ctx->threaded) {
+            /* per thread files are opened on first write */
+            if (SCLogThreadedFileSetup(log_ctx, append) < 0)
+                return -1;
+        } else {
+            log_ctx->fp = SCLogOpenFileFp(log_path, append, log_ctx->filemode);
+            if (log_ctx->fp == NULL)
+                return -1; // Error already logged by Open...Fp routine
+        }
+
+        ConfNode *compression = ConfNodeLookupChild(conf, "compression");
+        int compress = 0;
+        if (compression != NULL &&
+                ConfGetChildValueBool(compression, "enabled", &compress) &&
+                compress) {
+            if (log_ctx->threaded) {
+                SCLogError(SC_ERR_INVALID_ARGUMENT, "%s: compression is not "
+                        "supported with threaded file output", conf->name);
+                return -1;
+            }
+            if (LogCompressSetup(log_ctx, compression) < 0)
+                return -1;
+        }
         log_ctx->is_regular = 1;
         if (rotate) {
             OutputRegisterFileRotationFlag(&log_ctx->rotation_flag);
@@ -472,6 +690,12 @@ SCConfLogOpenGeneric(ConfNode *conf,
 #endif
     SCLogInfo("%s output device (%s) initialized: %s", conf->name, filetype,
               filename);
+    if (log_ctx->threads != NULL) {
+        SCLogConfig("%s: writing one file per thread", conf->name);
+    }
+    if (log_ctx->compress != NULL) {
+        SCLogConfig("%s: writing gzip compressed output", conf->name);
+    }
 
     return 0;
 }
@@ -490,6 +714,12 @@ int SCConfLogReopen(LogFileCtx *log_ctx)
         return 0;
     }
 
+    if (log_ctx->threads != NULL) {
+        /* each thread reopens its own file on its next write */
+        log_ctx->rotation_flag = 1;
+        return 0;
+    }
+
     if (log_ctx->filename == NULL) {
         SCLogWarning(SC_ERR_INVALID_ARGUMENT,
             "Can't re-open LogFileCtx without a filename.");
@@ -497,7 +727,8 @@ int SCConfLogReopen(LogFileCtx *log_ctx)
     }
 
     if (log_ctx->fp != NULL) {
-        fclose(log_ctx->fp);
+        log_ctx->Close(log_ctx);
+        log_ctx->fp = NULL;
     }
 
     /* Reopen the file. Append is forced in case the file was not
@@ -550,6 +781,14 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
 
     SCMutexDestroy(&lf_ctx->fp_mutex);
 
+    if (lf_ctx->compress != NULL) {
+        LogCompressFree(lf_ctx);
+    }
+
+    if (lf_ctx->threads != NULL) {
+        SCLogThreadedFileFree(lf_ctx);
+    }
+
     if (lf_ctx->prefix != NULL) {
         SCFree(lf_ctx->prefix);
         lf_ctx->prefix_len = 0;
@@ -577,19 +816,175 @@ int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
                file_ctx->type == LOGFILE_TYPE_UNIX_DGRAM ||
                file_ctx->type == LOGFILE_TYPE_UNIX_STREAM)
     {
-        /* append \n for files only */
-        MemBufferWriteString(buffer, "\n");
+        /* append \n for files only, binary records are length
+         * prefixed instead */
+        if (!file_ctx->cbor) {
+            MemBufferWriteString(buffer, "\n");
+        }
         file_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
                         MEMBUFFER_OFFSET(buffer), file_ctx);
     }
 #ifdef HAVE_LIBHIREDIS
     else if (file_ctx->type == LOGFILE_TYPE_REDIS) {
-        SCMutexLock(&file_ctx->fp_mutex);
+        /* locks fp_mutex itself unless the event goes to the spool */
         LogFileWriteRedis(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
                 MEMBUFFER_OFFSET(buffer));
-        SCMutexUnlock(&file_ctx->fp_mutex);
     }
 #endif
 
     return 0;
 }
+
+#ifdef UNITTESTS
+/** \test per thread file names */
+static int LogFileTest01(void)
+{
+    char name[PATH_MAX];
+
+    SCLogThreadedFileName("eve.json", 1, name, sizeof(name));
+    FAIL_IF_NOT(strcmp(name, "eve.1.json") == 0);
+    SCLogThreadedFileName("/var/log/suricata/eve.json", 12, name, sizeof(name));
+    FAIL_IF_NOT(strcmp(name, "/var/log/suricata/eve.12.json") == 0);
+    SCLogThreadedFileName("/var/log.d/eve", 2, name, sizeof(name));
+    FAIL_IF_NOT(strcmp(name, "/var/log.d/eve.2") == 0);
+    SCLogThreadedFileName("/var/log/.eve", 3, name, sizeof(name));
+    FAIL_IF_NOT(strcmp(name, "/var/log/.eve.3") == 0);
+    PASS;
+}
+
+static LogFileCtx *LogFileTestThreadedCtx(const char *dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/eve.json", dir);
+
+    LogFileCtx *lf = LogFileNewCtx();
+    if (lf == NULL)
+        return NULL;
+    lf->filename = SCStrdup(path);
+    lf->filemode = 0640;
+    lf->type = LOGFILE_TYPE_FILE;
+    lf->is_regular = 1;
+    lf->threaded = true;
+    if (lf->filename == NULL || SCLogThreadedFileSetup(lf, "yes") < 0) {
+        LogFileFreeCtx(lf);
+        return NULL;
+    }
+    return lf;
+}
+
+/** \internal \brief compare the content of dir/name with expect */
+static int LogFileTestContent(const char *dir, const char *name,
+        const char *expect)
+{
+    char path[PATH_MAX];
+    char buf[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+    size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    buf[len] = '\0';
+    return (strcmp(buf, expect) == 0);
+}
+
+static void LogFileTestCleanup(const char *dir)
+{
+    static const char *names[] = { "eve.1.json", "eve.2.json",
+        "eve.1.json.old", NULL };
+    char path[PATH_MAX];
+    for (int i = 0; names[i] != NULL; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+static void *LogFileTestWriter(void *arg)
+{
+    LogFileCtx *lf = (LogFileCtx *)arg;
+    lf->Write("b\n", 2, lf);
+    return NULL;
+}
+
+/** \test threads write their own files, a reopen makes each thread
+ *        reopen its file on its next write */
+static int LogFileTest02(void)
+{
+    char dir[] = "/tmp/suricata-ut-logfile-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir));
+
+    LogFileCtx *lf = LogFileTestThreadedCtx(dir);
+    FAIL_IF_NULL(lf);
+
+    lf->Write("a\n", 2, lf);
+    pthread_t thread;
+    FAIL_IF(pthread_create(&thread, NULL, LogFileTestWriter, lf) != 0);
+    pthread_join(thread, NULL);
+
+    int r1 = LogFileTestContent(dir, "eve.1.json", "a\n");
+    int r2 = LogFileTestContent(dir, "eve.2.json", "b\n");
+
+    /* logrotate: move the file, then ask for a reopen */
+    char from[PATH_MAX], to[PATH_MAX];
+    snprintf(from, sizeof(from), "%s/eve.1.json", dir);
+    snprintf(to, sizeof(to), "%s/eve.1.json.old", dir);
+    int r3 = (rename(from, to) == 0);
+    SCConfLogReopen(lf);
+    lf->Write("c\n", 2, lf);
+
+    int r4 = LogFileTestContent(dir, "eve.1.json", "c\n");
+    int r5 = LogFileTestContent(dir, "eve.1.json.old", "a\n");
+
+    LogFileFreeCtx(lf);
+    LogFileTestCleanup(dir);
+
+    FAIL_IF_NOT(r1);
+    FAIL_IF_NOT(r2);
+    FAIL_IF_NOT(r3);
+    FAIL_IF_NOT(r4);
+    FAIL_IF_NOT(r5);
+    PASS;
+}
+
+/** \test freeing a threaded output invalidates the thread cache */
+static int LogFileTest03(void)
+{
+    char dir1[] = "/tmp/suricata-ut-logfile-XXXXXX";
+    char dir2[] = "/tmp/suricata-ut-logfile-XXXXXX";
+    FAIL_IF_NULL(mkdtemp(dir1));
+    FAIL_IF_NULL(mkdtemp(dir2));
+
+    LogFileCtx *lf = LogFileTestThreadedCtx(dir1);
+    FAIL_IF_NULL(lf);
+    lf->Write("a\n", 2, lf);
+    const uint32_t id = lf->threads->id;
+    LogFileFreeCtx(lf);
+
+    /* a new output with the same id must not find the freed file */
+    lf = LogFileTestThreadedCtx(dir2);
+    FAIL_IF_NULL(lf);
+    lf->threads->id = id;
+    lf->Write("b\n", 2, lf);
+    LogFileFreeCtx(lf);
+
+    int r1 = LogFileTestContent(dir1, "eve.1.json", "a\n");
+    int r2 = LogFileTestContent(dir2, "eve.1.json", "b\n");
+    LogFileTestCleanup(dir1);
+    LogFileTestCleanup(dir2);
+
+    FAIL_IF_NOT(r1);
+    FAIL_IF_NOT(r2);
+    PASS;
+}
+#endif /* UNITTESTS */
+
+void LogFileRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LogFileTest01", LogFileTest01);
+    UtRegisterTest("LogFileTest02", LogFileTest02);
+    UtRegisterTest("LogFileTest03", LogFileTest03);
+#endif
+}
@@ -47,6 +47,25 @@ typedef struct SyslogSetup_ {
     int alert_syslog_level;
 } SyslogSetup;
 
+struct LogFileCtx_;
+struct LogCompressCtx_;
+
+/** per thread files of a "threaded" regular file output */
+typedef struct LogThreadedFileCtx_ {
+    /** protects the slots, only taken when a thread writes its first
+     *  record or when a rotation is requested */
+    SCMutex mutex;
+    struct LogFileCtx_ **slots;
+    pthread_t *owners;
+    uint32_t slot_count;
+    /** unique id of this output, keys the per thread lookup cache */
+    uint32_t id;
+    /** bumped on each HUP rotation, threads reopen their file when it
+     *  changed since their last write */
+    SC_ATOMIC_DECLARE(uint32_t, rotate_gen);
+    bool append;
+} LogThreadedFileCtx;
+
 
 /** Global structure for Output Context */
 typedef struct LogFileCtx_ {
@@ -125,9 +144,25 @@ typedef struct LogFileCtx_ {
     /* Flag set when file rotation notification is received. */
     int rotation_flag;
 
+    /* Records are written as length prefixed CBOR instead of JSON
+     * text lines. */
+    bool cbor;
+
     /* Set to true if the filename should not be timestamped. */
     bool nostamp;
 
+    /* Write each thread's records to its own file instead of
+     * serializing all threads on fp_mutex. */
+    bool threaded;
+    LogThreadedFileCtx *threads;
+    /* set on the per thread files: owning output and rotation
+     * generation last seen */
+    struct LogFileCtx_ *parent;
+    uint32_t rotate_gen;
+
+    /* gzip compression on a writer thread, see util-log-compress.c */
+    struct LogCompressCtx_ *compress;
+
     /* if set to true EVE will add a pcap file record */
     bool is_pcap_offline;
 
@@ -150,5 +185,8 @@ int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer);
 
 int SCConfLogOpenGeneric(ConfNode *conf, LogFileCtx *, const char *, int);
 int SCConfLogReopen(LogFileCtx *);
+void SCLogFileCheckRotation(LogFileCtx *);
+
+void LogFileRegisterTests(void);
 
 #endif /* __UTIL_LOGOPENFILE_H__ */
@@ -71,6 +71,9 @@ int SCACAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
 int SCACPreparePatterns(MpmCtx *mpm_ctx);
 uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
                     PrefilterRuleStore *pmq, const uint8_t *buf, uint32_t buflen);
+uint32_t SCACSearchStream(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                    PrefilterRuleStore *pmq, MpmStreamState *sstate,
+                    const uint8_t *buf, uint32_t buflen);
 void SCACPrintInfo(MpmCtx *mpm_ctx);
 void SCACPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
 void SCACRegisterTests(void);
@@ -1147,6 +1150,104 @@ uint32_t SCACSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
     return matches;
 }
 
+/** \internal
+ *  \brief handle a match found by SCACSearchStream
+ *
+ *  Case sensitive patterns are verified if the match is fully inside
+ *  the buffer. Matches crossing into previously scanned data can't be
+ *  verified and are accepted, which is fine for a prefilter.
+ */
+static inline int SCACStreamMatch(const SCACCtx *ctx, PrefilterRuleStore *pmq,
+        MpmStreamState *sstate, uint8_t *bitarray, uint32_t pid,
+        const uint8_t *buf, uint32_t i)
+{
+    const uint32_t lower_pid = pid & AC_PID_MASK;
+    const SCACPatternList *pat = &ctx->pid_pat_list[lower_pid];
+
+    if ((pid & AC_CASE_MASK) && i + 1 >= pat->patlen) {
+        if (SCMemcmp(pat->cs, buf + (i - pat->patlen + 1), pat->patlen) != 0)
+            return 0;
+    }
+
+    if (!(bitarray[(lower_pid) / 8] & (1 << ((lower_pid) % 8)))) {
+        bitarray[(lower_pid) / 8] |= (1 << ((lower_pid) % 8));
+        PrefilterAddSids(pmq, pat->sids, pat->sids_size);
+    }
+
+    const uint64_t end = sstate->offset + i + 1;
+    MpmStreamStateAddMatch(sstate, pat->sids, pat->sids_size,
+            end - pat->patlen, end);
+    return 1;
+}
+
+/**
+ * \brief Resume an AC search from the stream state.
+ *
+ *        The automaton state is carried over from the previous call, so
+ *        patterns spanning chunks are found without rescanning. Pattern
+ *        offset and depth are not enforced as they have no meaning
+ *        relative to the stream.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param sstate         Stream state, updated on return.
+ * \param buf            Buffer to be searched, starting at sstate->offset.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCACSearchStream(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                    PrefilterRuleStore *pmq, MpmStreamState *sstate,
+                    const uint8_t *buf, uint32_t buflen)
+{
+    const SCACCtx *ctx = (SCACCtx *)mpm_ctx->ctx;
+    uint32_t i = 0;
+    int matches = 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+    if (ctx->state_count < 32767) {
+        register SC_AC_STATE_TYPE_U16 state = (SC_AC_STATE_TYPE_U16)sstate->state;
+        SC_AC_STATE_TYPE_U16 (*state_table_u16)[256] = ctx->state_table_u16;
+        for (i = 0; i < buflen; i++) {
+            state = state_table_u16[state & 0x7FFF][u8_tolower(buf[i])];
+            if (state & 0x8000) {
+                uint32_t no_of_entries = ctx->output_table[state & 0x7FFF].no_of_entries;
+                uint32_t *pids = ctx->output_table[state & 0x7FFF].pids;
+                uint32_t k;
+                for (k = 0; k < no_of_entries; k++) {
+                    matches += SCACStreamMatch(ctx, pmq, sstate, bitarray,
+                            pids[k], buf, i);
+                }
+            }
+        }
+        sstate->state = state;
+
+    } else {
+        register SC_AC_STATE_TYPE_U32 state = sstate->state;
+        SC_AC_STATE_TYPE_U32 (*state_table_u32)[256] = ctx->state_table_u32;
+        for (i = 0; i < buflen; i++) {
+            state = state_table_u32[state & 0x00FFFFFF][u8_tolower(buf[i])];
+            if (state & 0xFF000000) {
+                uint32_t no_of_entries = ctx->output_table[state & 0x00FFFFFF].no_of_entries;
+                uint32_t *pids = ctx->output_table[state & 0x00FFFFFF].pids;
+                uint32_t k;
+                for (k = 0; k < no_of_entries; k++) {
+                    matches += SCACStreamMatch(ctx, pmq, sstate, bitarray,
+                            pids[k], buf, i);
+                }
+            }
+        }
+        sstate->state = state;
+    }
+
+    sstate->offset += buflen;
+    return matches;
+}
+
 /**
  * \brief Add a case insensitive pattern.  Although we have different calls for
  *        adding case sensitive and insensitive patterns, we make a single call
@@ -1247,6 +1348,7 @@ void MpmACRegister(void)
     mpm_table[MPM_AC].AddPatternNocase = SCACAddPatternCI;
     mpm_table[MPM_AC].Prepare = SCACPreparePatterns;
     mpm_table[MPM_AC].Search = SCACSearch;
+    mpm_table[MPM_AC].SearchStream = SCACSearchStream;
     mpm_table[MPM_AC].PrintCtx = SCACPrintInfo;
     mpm_table[MPM_AC].PrintThreadCtx = SCACPrintSearchStats;
     mpm_table[MPM_AC].RegisterUnittests = SCACRegisterTests;
@@ -2280,6 +2382,121 @@ end:
     return result;
 }
 
+/** \test resumable stream search: matches spanning chunks and replay of
+ *        matches in overlapping windows */
+static int SCACTest30(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+    MpmStreamState sstate;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    MpmAddPatternCI(&mpm_ctx, (uint8_t *)"EFGH", 4, 0, 0, 1, 1, 0);
+    PmqSetup(&pmq);
+
+    SCACPreparePatterns(&mpm_ctx);
+    FAIL_IF_NOT(MpmCanSearchStream(&mpm_ctx));
+    MpmStreamStateReset(&sstate, NULL, 0, 0);
+
+    /* pattern split over two chunks */
+    uint32_t cnt = MpmStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &sstate,
+            (uint8_t *)"xxab", 4, 0);
+    FAIL_IF_NOT(cnt == 0);
+    cnt = MpmStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &sstate,
+            (uint8_t *)"cdxx", 4, 4);
+    FAIL_IF_NOT(cnt == 1);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 1);
+    FAIL_IF_NOT(sstate.offset == 8);
+    PmqReset(&pmq);
+
+    /* overlapping window: old match is replayed, only new data scanned */
+    cnt = MpmStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &sstate,
+            (uint8_t *)"abcdxxeFgH", 10, 2);
+    FAIL_IF_NOT(cnt == 1);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 2);
+    FAIL_IF_NOT(sstate.offset == 12);
+    PmqReset(&pmq);
+
+    /* window starting past the first match */
+    cnt = MpmStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &sstate,
+            (uint8_t *)"bcdxxeFgH", 9, 3);
+    FAIL_IF_NOT(cnt == 0);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 1);
+    FAIL_IF_NOT(pmq.rule_id_array[0] == 1);
+    PmqReset(&pmq);
+
+    /* gap resets the state */
+    cnt = MpmStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &sstate,
+            (uint8_t *)"cdxx", 4, 20);
+    FAIL_IF_NOT(cnt == 0);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 0);
+    FAIL_IF_NOT(sstate.offset == 24);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
+/** \test resumable stream search: a repeated pattern must still be found
+ *        in a window that only holds its earlier occurrence */
+static int SCACTest31(void)
+{
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PrefilterRuleStore pmq;
+    MpmStreamState sstate;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_AC);
+    SCACInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(&pmq);
+
+    SCACPreparePatterns(&mpm_ctx);
+    MpmStreamStateReset(&sstate, NULL, 0, 0);
+
+    /* "abcd" at 0 and again at 8 */
+    uint32_t cnt = MpmStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &sstate,
+            (uint8_t *)"abcdxxxx", 8, 0);
+    FAIL_IF_NOT(cnt == 1);
+    PmqReset(&pmq);
+    cnt = MpmStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &sstate,
+            (uint8_t *)"xxxxabcd", 8, 4);
+    FAIL_IF_NOT(cnt == 1);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 1);
+    FAIL_IF_NOT(sstate.offset == 12);
+    PmqReset(&pmq);
+
+    /* overlapping window that ends before the second occurrence: the
+     * remembered match is the one at 8, so this has to be rescanned */
+    cnt = MpmStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &sstate,
+            (uint8_t *)"abcdxx", 6, 0);
+    FAIL_IF_NOT(cnt == 1);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 1);
+    FAIL_IF_NOT(pmq.rule_id_array[0] == 0);
+    FAIL_IF_NOT(sstate.offset == 6);
+    PmqReset(&pmq);
+
+    /* window past the first occurrence: no match */
+    cnt = MpmStreamSearch(&mpm_ctx, &mpm_thread_ctx, &pmq, &sstate,
+            (uint8_t *)"bcdxxxxabc", 10, 1);
+    FAIL_IF_NOT(pmq.rule_id_array_cnt == 0);
+
+    SCACDestroyCtx(&mpm_ctx);
+    SCACDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    PASS;
+}
+
 #endif /* UNITTESTS */
 
 void SCACRegisterTests(void)
@@ -2315,6 +2532,8 @@ void SCACRegisterTests(void)
     UtRegisterTest("SCACTest27", SCACTest27);
     UtRegisterTest("SCACTest28", SCACTest28);
     UtRegisterTest("SCACTest29", SCACTest29);
+    UtRegisterTest("SCACTest30", SCACTest30);
+    UtRegisterTest("SCACTest31", SCACTest31);
 #endif
 
     return;
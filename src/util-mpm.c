@@ -41,6 +41,7 @@
 #include "queue.h"
 #include "util-unittest.h"
 #include "util-memcpy.h"
+#include "util-validate.h"
 #ifdef BUILD_HYPERSCAN
 #include "hs.h"
 #endif
@@ -618,6 +619,117 @@ error:
     return -1;
 }
 
+/**
+ * \brief check if the mpm used by a ctx supports resumable stream search
+ */
+bool MpmCanSearchStream(const MpmCtx *mpm_ctx)
+{
+    return (mpm_table[mpm_ctx->mpm_type].SearchStream != NULL);
+}
+
+/**
+ * \brief (re)initialize a stream state to start scanning at offset
+ */
+void MpmStreamStateReset(MpmStreamState *sstate, const MpmCtx *mpm_ctx,
+        uint32_t de_version, uint64_t offset)
+{
+    sstate->mpm_ctx = mpm_ctx;
+    sstate->de_version = de_version;
+    sstate->state = 0;
+    sstate->offset = offset;
+    sstate->replay_floor = offset;
+    sstate->match_cnt = 0;
+}
+
+/**
+ * \brief remember a match so it can be replayed for overlapping windows
+ *
+ * Only the most recent match per pattern is kept. When an older match
+ * is replaced, or evicted because the list is full, the replay floor is
+ * moved past it so windows that could still hold it are rescanned.
+ */
+void MpmStreamStateAddMatch(MpmStreamState *sstate, SigIntId *sids,
+        uint32_t sids_size, uint64_t start, uint64_t end)
+{
+    MpmStreamMatch *m = NULL;
+    uint32_t i;
+
+    for (i = 0; i < sstate->match_cnt; i++) {
+        if (sstate->matches[i].sids == sids) {
+            m = &sstate->matches[i];
+            break;
+        }
+    }
+
+    if (m == NULL) {
+        if (sstate->match_cnt < MPM_STREAM_MATCHES_MAX) {
+            m = &sstate->matches[sstate->match_cnt++];
+        } else {
+            m = &sstate->matches[0];
+            for (i = 1; i < sstate->match_cnt; i++) {
+                if (sstate->matches[i].start < m->start)
+                    m = &sstate->matches[i];
+            }
+            if (m->start + 1 > sstate->replay_floor)
+                sstate->replay_floor = m->start + 1;
+        }
+        m->sids = sids;
+        m->sids_size = sids_size;
+    } else if (m->start != start && m->start + 1 > sstate->replay_floor) {
+        sstate->replay_floor = m->start + 1;
+    }
+    m->start = start;
+    m->end = end;
+}
+
+/**
+ * \brief search a chunk of stream data, resuming from a stream state
+ *
+ * The chunk may overlap with data that was scanned before. Matches in
+ * the overlapping part are replayed from the state, only the new data
+ * is run through the automaton. Gaps reset the state.
+ *
+ * \param buf_offset absolute stream offset of buf
+ *
+ * \retval number of matches in the newly scanned data
+ */
+uint32_t MpmStreamSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, MpmStreamState *sstate,
+        const uint8_t *buf, uint32_t buflen, uint64_t buf_offset)
+{
+    DEBUG_VALIDATE_BUG_ON(!MpmCanSearchStream(mpm_ctx));
+
+    const uint64_t buf_end = buf_offset + buflen;
+
+    if (sstate->mpm_ctx != mpm_ctx || buf_offset > sstate->offset ||
+            buf_offset < sstate->replay_floor)
+    {
+        SCLogDebug("resetting stream state: ctx %p/%p, offset %"PRIu64
+                ", state offset %"PRIu64", floor %"PRIu64, mpm_ctx,
+                sstate->mpm_ctx, buf_offset, sstate->offset,
+                sstate->replay_floor);
+        MpmStreamStateReset(sstate, mpm_ctx, sstate->de_version, buf_offset);
+    }
+
+    /* replay what we found in the part we scanned before */
+    uint32_t i;
+    for (i = 0; i < sstate->match_cnt; i++) {
+        const MpmStreamMatch *m = &sstate->matches[i];
+        if (m->start >= buf_offset && m->end <= buf_end) {
+            PrefilterAddSids(pmq, m->sids, m->sids_size);
+        }
+    }
+
+    if (buf_end <= sstate->offset)
+        return 0;
+
+    const uint32_t skip = (uint32_t)(sstate->offset - buf_offset);
+    SCLogDebug("scanning %u new bytes from offset %"PRIu64" (skip %u)",
+            buflen - skip, sstate->offset, skip);
+    return mpm_table[mpm_ctx->mpm_type].SearchStream(mpm_ctx, mpm_thread_ctx,
+            pmq, sstate, buf + skip, buflen - skip);
+}
+
 
 /************************************Unittests*********************************/
 
@@ -108,6 +108,43 @@ typedef struct MpmCtx_ {
     MpmPattern **init_hash;
 } MpmCtx;
 
+/** max number of distinct pattern matches a stream state remembers */
+#define MPM_STREAM_MATCHES_MAX  32
+
+typedef struct MpmStreamMatch_ {
+    /* sid(s) of the matching pattern, owned by the mpm ctx */
+    SigIntId *sids;
+    uint32_t sids_size;
+    /* absolute stream offsets of the first byte and the byte after the
+     * last byte of the (most recent) match */
+    uint64_t start;
+    uint64_t end;
+} MpmStreamMatch;
+
+/** \brief resumable search state for a single stream direction
+ *
+ *  Keeps the automaton state at the end of the scanned data so that
+ *  the next scan can resume from there instead of rescanning. Matches
+ *  are remembered so that a caller rescanning an overlapping window
+ *  still gets the sids of matches in the already scanned part. */
+typedef struct MpmStreamState_ {
+    /* ctx the state belongs to. Set to NULL to force a reset. */
+    const MpmCtx *mpm_ctx;
+    /* detect engine version the state was created for */
+    uint32_t de_version;
+
+    /* algo specific automaton state after the last scanned byte */
+    uint32_t state;
+
+    /* absolute offset of the next byte to scan */
+    uint64_t offset;
+    /* matches starting before this offset may have been evicted */
+    uint64_t replay_floor;
+
+    uint32_t match_cnt;
+    MpmStreamMatch matches[MPM_STREAM_MATCHES_MAX];
+} MpmStreamState;
+
 /* if we want to retrieve an unique mpm context from the mpm context factory
  * we should supply this as the key */
 #define MPM_CTX_FACTORY_UNIQUE_CONTEXT -1
@@ -160,6 +197,10 @@ typedef struct MpmTableElmt_ {
     int  (*AddPatternNocase)(struct MpmCtx_ *, uint8_t *, uint16_t, uint16_t, uint16_t, uint32_t, SigIntId, uint8_t);
     int  (*Prepare)(struct MpmCtx_ *);
     uint32_t (*Search)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PrefilterRuleStore *, const uint8_t *, uint32_t);
+    /** optional: resume a search from MpmStreamState::state. The buffer
+     *  starts at MpmStreamState::offset. Pattern offset/depth settings
+     *  are ignored, so the result is a superset of Search. */
+    uint32_t (*SearchStream)(const struct MpmCtx_ *, struct MpmThreadCtx_ *, PrefilterRuleStore *, MpmStreamState *, const uint8_t *, uint32_t);
     void (*PrintCtx)(struct MpmCtx_ *);
     void (*PrintThreadCtx)(struct MpmThreadCtx_ *);
     void (*RegisterUnittests)(void);
@@ -201,4 +242,13 @@ int MpmAddPattern(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
                             uint16_t offset, uint16_t depth, uint32_t pid,
                             SigIntId sid, uint8_t flags);
 
+bool MpmCanSearchStream(const MpmCtx *mpm_ctx);
+void MpmStreamStateReset(MpmStreamState *sstate, const MpmCtx *mpm_ctx,
+        uint32_t de_version, uint64_t offset);
+void MpmStreamStateAddMatch(MpmStreamState *sstate, SigIntId *sids,
+        uint32_t sids_size, uint64_t start, uint64_t end);
+uint32_t MpmStreamSearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+        PrefilterRuleStore *pmq, MpmStreamState *sstate,
+        const uint8_t *buf, uint32_t buflen, uint64_t buf_offset);
+
 #endif /* __UTIL_MPM_H__ */
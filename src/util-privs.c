@@ -69,6 +69,13 @@ void SCDropMainThreadCaps(uint32_t userid, uint32_t groupid)
                     CAP_NET_ADMIN,
                     -1);
             break;
+        case RUNMODE_AFXDP_DEV:
+            capng_updatev(CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED,
+                    CAP_NET_RAW, CAP_NET_ADMIN, CAP_SYS_NICE,
+                    CAP_SYS_ADMIN,          /* needed for the XDP maps */
+                    CAP_IPC_LOCK,           /* needed for the UMEM */
+                    -1);
+            break;
         case RUNMODE_PFRING:
             capng_updatev(CAPNG_ADD, CAPNG_EFFECTIVE|CAPNG_PERMITTED,
                     CAP_NET_ADMIN, CAP_NET_RAW, CAP_SYS_NICE,